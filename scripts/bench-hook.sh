@@ -0,0 +1,98 @@
+#!/bin/bash
+#
+# bench-hook.sh -- measure capture overhead in glXSwapBuffers()
+# Copyright (C) 2007-2008 Pyry Haulos
+# For conditions of distribution and use, see copyright notice in glc.h
+#
+# Runs glc-bench-gl once without glc and then under glc-capture
+# in each mode, printing swap time distribution, dropped frames
+# and disk throughput. Starts Xvfb if there is no display.
+
+BENCH_GL="glc-bench-gl"
+CAPTURE="glc-capture"
+SIZE="1280x720"
+FRAMES="600"
+CONTENT="quads"
+OUT="/tmp/glc-bench-$$"
+
+# mode is name followed by glc-capture options
+MODES=(
+	"bgr           --pbo=0 -e bgr -z none"
+	"bgr-pbo       --pbo=1 -e bgr -z none"
+	"bgr-quicklz   --pbo=1 -e bgr -z quicklz"
+	"bgr-lz4       --pbo=1 -e bgr -z lz4"
+	"420jpeg       --pbo=0 -e 420jpeg -z quicklz"
+	"420jpeg-pbo   --pbo=1 -e 420jpeg -z quicklz"
+	"420jpeg-lz4   --pbo=1 -e 420jpeg -z lz4"
+	"420jpeg-lock  --pbo=1 -e 420jpeg -z quicklz -n"
+)
+
+while [ "$1" != "" ]; do
+	case "$1" in
+		-s) SIZE="$2"; shift ;;
+		-n) FRAMES="$2"; shift ;;
+		-c) CONTENT="$2"; shift ;;
+		-o) OUT="$2"; shift ;;
+		*)
+			echo "$0 [-s WxH] [-n FRAMES] [-c clear|quads|noise] [-o DIR]"
+			exit 1
+			;;
+	esac
+	shift
+done
+
+if [ "${DISPLAY}" == "" ]; then
+	which Xvfb > /dev/null || { echo "no display and no Xvfb"; exit 1; }
+	export DISPLAY=":97"
+	Xvfb "${DISPLAY}" -screen 0 "${SIZE}x24" > /dev/null 2>&1 &
+	XVFB=$!
+	sleep 2
+fi
+
+# don't let vsync hide capture cost
+export vblank_mode=0
+export __GL_SYNC_TO_VBLANK=0
+
+mkdir -p "${OUT}"
+
+field () {
+	grep "^$1 " "$2" | awk '{print $2}'
+}
+
+report () {
+	# name, result file, stream file, seconds
+	local mbs="-"
+	if [ -f "$3" ]; then
+		mbs=$(echo "$(stat -c %s "$3") $4" | awk '{printf "%.1f", $1 / $2 / 1048576}')
+	fi
+	printf "%-14s %8s %9s %9s %9s %9s %9s %8s\n" "$1" \
+		"$(field fps "$2")" "$(field swap_mean "$2")" "$(field swap_p50 "$2")" \
+		"$(field swap_p99 "$2")" "$(field swap_max "$2")" \
+		"$(field dropped "$2")" "${mbs}"
+}
+
+printf "%-14s %8s %9s %9s %9s %9s %9s %8s\n" \
+	"mode" "fps" "mean ms" "p50 ms" "p99 ms" "max ms" "dropped" "disk MB/s"
+
+"${BENCH_GL}" -s "${SIZE}" -n "${FRAMES}" -c "${CONTENT}" > "${OUT}/none.txt" \
+	|| { echo "${BENCH_GL} failed"; exit 1; }
+report "none" "${OUT}/none.txt"
+
+for MODE in "${MODES[@]}"; do
+	NAME=$(echo ${MODE} | awk '{print $1}')
+	ARGS=$(echo ${MODE} | cut -d ' ' -f 2-)
+
+	START=$(date +%s.%N)
+	# file is complete when process exits
+	GLC_CONTROL="${OUT}/control-%d" \
+		${CAPTURE} -s -o "${OUT}/${NAME}.glc" ${ARGS} \
+		"${BENCH_GL}" -s "${SIZE}" -n "${FRAMES}" -c "${CONTENT}" \
+		> "${OUT}/${NAME}.txt" 2> "${OUT}/${NAME}.log"
+	SECS=$(echo "${START} $(date +%s.%N)" | awk '{print $2 - $1}')
+
+	report "${NAME}" "${OUT}/${NAME}.txt" "${OUT}/${NAME}.glc" "${SECS}"
+	rm -f "${OUT}/${NAME}.glc"
+done
+
+[ "${XVFB}" != "" ] && kill "${XVFB}"
+echo "results in ${OUT}"
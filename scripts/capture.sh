@@ -8,11 +8,15 @@
 export GLC_FPS=30
 
 # out filename, %d => getpid()
+# tcp://host:port sends stream to 'glc-play tcp://:port'
 export GLC_FILE="pid-%d.glc"
 
 # scale pictures
 export GLC_SCALE=1.0
 
+# scaling filter, 'bilinear', 'bicubic' or 'lanczos'
+export GLC_SCALE_FILTER=bilinear
+
 # capture audio
 export GLC_AUDIO=1
 
@@ -28,26 +32,149 @@ export GLC_UNSCALED_BUFFER_SIZE=25
 # compressed data buffer size, in MiB
 export GLC_COMPRESSED_BUFFER_SIZE=50
 
+# size all stream buffers at first picture to hold this many
+# milliseconds of pictures at window size and fps, but at least
+# two screen-sized pictures. 0 uses sizes above.
+export GLC_BUFFER_AUTO=0
+
 # take picture at glFinish(), compiz needs this
 export GLC_CAPTURE_GLFINISH=0
 
 # take picture from front or back buffer
 export GLC_CAPTURE=front
 
-# compress stream using 'lzo', 'quicklz' or 'none'
+# compress stream using 'lzo', 'quicklz', 'lzjb', 'lz4',
+# 'zstd' or 'none'. 'adaptive' switches between them
+# depending on how busy compression and disk are.
 export GLC_COMPRESS=quicklz
 
+# write pictures as difference to previous picture, which
+# compresses a lot better, with a key frame every N pictures.
+# 0 disables, needs compression.
+export GLC_DELTA=0
+
+# between key frames write only 64x64 tiles that changed
+# since previous picture, needs GLC_DELTA
+export GLC_DELTA_TILES=0
+
+# code 16, 24 and 32 bit audio with lossless linear
+# prediction instead of compression, needs compression
+export GLC_AUDIO_LPC=0
+
+# compress large pictures in independent blocks of this
+# many KiB, which slice workers (GLC_SLICES) compress in
+# parallel. 0 disables.
+export GLC_COMPRESS_BLOCK_SIZE=0
+
+# share of time adaptive compression keeps compression
+# threads idle, so capture doesn't have to drop frames
+export GLC_COMPRESS_HEADROOM=0.15
+
+# zstd compression level, higher compresses better but
+# is slower. Negative level sets lz4 acceleration.
+export GLC_COMPRESS_LEVEL=1
+
+# stream file is written in blocks of this many KiB,
+# 0 writes every packet separately
+export GLC_FILE_BUFFER=1024
+
+# buffered data is written at least every GLC_FILE_FLUSH ms,
+# 0 writes only full blocks. With GLC_SYNC=1 this is also how
+# much can be lost in a crash.
+export GLC_FILE_FLUSH=1000
+
+# write stream file with O_DIRECT, bypassing page cache
+export GLC_FILE_DIRECT=0
+
+# write seek index entry every GLC_INDEX_INTERVAL ms,
+# 0 writes no index
+export GLC_INDEX_INTERVAL=1000
+
+# split stream into files of GLC_FILE_SEGMENT_SIZE MiB or
+# GLC_FILE_SEGMENT_TIME seconds, each of them playable on its
+# own. '%segment%' in GLC_FILE is replaced with segment number,
+# otherwise it is appended to file name. 0 disables.
+export GLC_FILE_SEGMENT_SIZE=0
+export GLC_FILE_SEGMENT_TIME=0
+
+# write GLC_FILE_BUFFER blocks with io_uring, keeping this
+# many in flight so slow disk doesn't stall capture. 0
+# uses blocking writes.
+export GLC_FILE_URING=0
+
+# encode with libavcodec while capturing instead of writing
+# a glc stream. Needs '420jpeg' colorspace and disables
+# compression and replay. Reload key doesn't start a new file.
+export GLC_ENCODE=0
+export GLC_ENCODE_FILE="%app%-%pid%-%capture%.mkv"
+export GLC_ENCODER=libx264
+# 'veryfast' or faster usually keeps up with capture
+# export GLC_ENCODE_PRESET=veryfast
+export GLC_ENCODE_QUALITY=23
+# video bitrate in kbit/s, 0 uses GLC_ENCODE_QUALITY
+export GLC_ENCODE_BITRATE=0
+# encoder threads, 0 picks automatically
+export GLC_ENCODE_THREADS=0
+
+# hand raw stream to glc-daemon listening at this socket
+# instead of compressing and writing it here. Compression
+# and file settings are then taken from glc-daemon.
+# export GLC_DAEMON=/tmp/glc-daemon
+# shared memory ring size in MiB
+export GLC_DAEMON_RING=32
+
 # try GL_ARB_pixel_buffer_object to speed up readback
 export GLC_TRY_PBO=1
 
-# Skip audio packets. Not skipping requires some busy
-# waiting and can slow program down a quite bit.
+# number of PBOs per video stream, pictures are written
+# only when GPU has finished the transfer
+export GLC_PBO_COUNT=3
+
+# map PBOs and copy pictures in a separate thread with
+# a shared GLX context, requires GL_ARB_sync
+export GLC_PBO_WORKER=0
+
+# compress pictures straight from persistently mapped PBOs,
+# requires GL_ARB_buffer_storage, compression and no scaling
+# or conversion on CPU. Pictures don't pass through
+# uncompressed buffer, so it can be made smaller.
+export GLC_PERSISTENT_PBO=0
+
+# convert to 420jpeg on GPU before readback, requires
+# framebuffer objects and GLSL, only used when not scaling
+export GLC_GPU_CONVERT=0
+
+# apply GLC_SCALE on GPU before readback, pictures are
+# captured unscaled if framebuffer objects are not supported
+export GLC_GPU_SCALE=0
+
+# Audio is never waited for, packets are dropped if capture
+# thread falls behind. This only silences the warnings.
 export GLC_AUDIO_SKIP=0
 
+# coalesce small ALSA periods into packets of this many
+# milliseconds (0 disables) or bytes, whichever is reached
+# first. Partial packet is sent after latency milliseconds.
+export GLC_AUDIO_BATCH=20
+export GLC_AUDIO_BATCH_SIZE=65536
+export GLC_AUDIO_BATCH_LATENCY=50
+
 # show indicator when capturing
 # NOTE this doesn't work properly when capturing front buffer
 export GLC_INDICATOR=0
 
+# write repeated pictures (eg. menus or paused game) as
+# short messages instead of full frames
+export GLC_DETECT_REPEAT=0
+
+# keep only last GLC_REPLAY seconds of capture in memory,
+# at most GLC_REPLAY_SIZE MiB (0 is no limit), and write them
+# to file when GLC_REPLAY_HOTKEY is pressed. 0 writes
+# everything to file as usual.
+export GLC_REPLAY=0
+export GLC_REPLAY_SIZE=0
+export GLC_REPLAY_HOTKEY="<Shift>F10"
+
 # start capturing immediately
 export GLC_START=0
 
@@ -57,6 +184,10 @@ export GLC_HOTKEY="<Shift>F8"
 # lock fps when capturing
 export GLC_LOCK_FPS=0
 
+# how locked fps is paced: 'sleep', 'hybrid' (spins last
+# 0.5 ms) or 'vblank' (waits for vertical blank after that)
+export GLC_LOCK_FPS_PACING=sleep
+
 # saved stream colorspace, bgr or 420jpeg
 # set 420jpeg to convert to Y'CbCr (420JPEG) at capture
 # NOTE this is a lossy operation
@@ -75,10 +206,67 @@ export GLC_CAPTURE_DWORD_ALIGNED=1
 # set SDL audiodriver to alsa
 export SDL_AUDIODRIVER=alsa
 
+# run glc threads on these CPUs
+# export GLC_CPUS=2-3
+
+# per-stage CPU sets, override GLC_CPUS
+# export GLC_PACK_CPUS=2,3
+# export GLC_FILE_CPUS=1
+# export GLC_SCALE_CPUS=2-3
+# export GLC_YCBCR_CPUS=2-3
+# export GLC_SLICE_CPUS=2-3
+
+# split each picture into this many horizontal slices
+# that are scaled and converted in parallel, helps when
+# a single stream is too big for one CPU
+export GLC_SLICES=1
+
+# scale and convert pictures with SSSE3/AVX2/NEON kernels
+# when CPU supports them, 0 uses plain C loops
+export GLC_SIMD=1
+
+# glc thread scheduling policy, 'normal', 'batch' or 'idle'
+export GLC_SCHED=normal
+
+# nice value for glc threads
+export GLC_NICE=0
+
+# allocate stream buffers on and prefer memory from NUMA node
+# export GLC_NUMA_NODE=0
+
+# back stream buffers with transparent hugepages
+export GLC_BUFFER_HUGEPAGES=0
+
+# touch stream buffers at startup instead of faulting
+# pages in during capture
+export GLC_BUFFER_PREFAULT=0
+
+# lock stream buffers into memory (see 'ulimit -l')
+export GLC_BUFFER_LOCK=0
+
+# write captured pictures into a mirrored ring next to
+# uncompressed buffer, buffer queues only references
+export GLC_BUFFER_MIRROR=0
+
 # log verbosity
 export GLC_LOG=1
 
 # log file
 export GLC_LOG_FILE="/dev/stderr"
 
+# per-stage pipeline statistics are logged at log level 2
+# every GLC_STATS_INTERVAL seconds, and optionally written
+# to a stats file, %d => getpid()
+export GLC_STATS_INTERVAL=5
+# export GLC_STATS_FILE="pid-%d.stats"
+
+# dropped frames and pipeline statistics are written into
+# stream every GLC_STREAM_STATS seconds, see 'glc-play -i'.
+# 0 disables.
+export GLC_STREAM_STATS=1
+
+# control socket, %d => getpid(); send 'stats', 'fps 60',
+# 'compress zstd 3' or 'scale 0.5', one command per line
+# export GLC_CONTROL="/tmp/glc-%d.sock"
+
 LD_PRELOAD=libglc-capture.so "${@}"
@@ -0,0 +1,869 @@
+/**
+ * \file bench.c
+ * \brief filter benchmark
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <glc/common/glc.h>
+#include <glc/common/core.h>
+#include <glc/common/log.h>
+#include <glc/common/util.h>
+#include <glc/common/state.h>
+#include <glc/common/slice.h>
+#include <glc/common/thread.h>
+
+#include <glc/core/pack.h>
+#include <glc/core/rgb.h>
+#include <glc/core/color.h>
+#include <glc/core/ycbcr.h>
+#include <glc/core/scale.h>
+
+/** distinct generated pictures, producer cycles through them */
+#define BENCH_PICTURES 4
+/** generated pictures per second, also audio packet length */
+#define BENCH_FPS 60
+/** generated audio rate */
+#define BENCH_AUDIO_RATE 48000
+/** generated audio channels */
+#define BENCH_AUDIO_CHANNELS 2
+/** largest Y'CbCr sample difference between vector and C kernels */
+#define BENCH_CHECK_TOLERANCE 0
+
+enum bench_filter {bench_pack, bench_unpack, bench_ycbcr, bench_scale, bench_color, bench_rgb};
+
+/* packet copied from sink, replayed to unpack */
+struct bench_packet_s {
+	size_t size;
+	struct bench_packet_s *next;
+	char data[];
+};
+
+struct bench_s {
+	glc_t glc;
+
+	unsigned int width, height;
+	glc_video_format_t format;
+	unsigned int frames;
+	unsigned int video_streams, audio_streams;
+	double scale_factor;
+	int level;
+	size_t buffer_size;
+	int filters[bench_rgb + 1];
+	const char *codecs;
+
+	/* generated content for current format */
+	glc_video_format_t picture_format;
+	char *picture[BENCH_PICTURES];
+	size_t picture_size;
+	char *audio;
+	size_t audio_size;
+
+	/* current run, data packets are numbered in write order */
+	size_t packets;
+	glc_utime_t *sent;
+	glc_utime_t *latency;
+	size_t received;
+	size_t in_bytes, out_bytes;
+
+	/* keep sink packets for next run */
+	int keep;
+	struct bench_packet_s *kept, **kept_tail;
+};
+
+int bench_codecs(struct bench_s *bench);
+int bench_check(struct bench_s *bench);
+int bench_run(struct bench_s *bench, enum bench_filter filter, int compression,
+	      const char *name, struct bench_packet_s *replay);
+int bench_generate(struct bench_s *bench, glc_video_format_t format);
+int bench_write_stream(struct bench_s *bench, ps_buffer_t *to);
+int bench_write_replay(struct bench_s *bench, ps_buffer_t *to,
+		       struct bench_packet_s *replay);
+int bench_write_message(ps_buffer_t *to, glc_message_type_t type,
+			void *message, size_t message_size,
+			void *data, size_t data_size);
+int bench_sink_read_callback(glc_thread_state_t *state);
+void bench_report(struct bench_s *bench, const char *name, glc_utime_t elapsed);
+void bench_free_packets(struct bench_packet_s *packet);
+int bench_is_data(glc_message_type_t type);
+int bench_is_video(struct bench_s *bench, size_t packet);
+
+int main(int argc, char *argv[])
+{
+	struct bench_s bench;
+	const char *filters = "pack,unpack,ycbcr,scale,color,rgb";
+	char *list, *tok, *saveptr;
+	int opt, option_index, log_level = 0, slices = 1, check = 0, i;
+
+	struct option long_options[] = {
+		{"size",		1, NULL, 's'},
+		{"format",		1, NULL, 'f'},
+		{"frames",		1, NULL, 'n'},
+		{"video",		1, NULL, 'w'},
+		{"audio",		1, NULL, 'a'},
+		{"filters",		1, NULL, 'F'},
+		{"compression",		1, NULL, 'z'},
+		{"level",		1, NULL, 'l'},
+		{"resize",		1, NULL, 'r'},
+		{"buffer",		1, NULL, 'b'},
+		{"slices",		1, NULL, 'j'},
+		{"threads",		1, NULL, 't'},
+		{"no-simd",		0, NULL, 'S'},
+		{"check",		0, NULL, 'c'},
+		{"verbosity",		1, NULL, 'v'},
+		{"help",		0, NULL, 'h'},
+		{"version",		0, NULL, 'V'},
+		{0, 0, 0, 0}
+	};
+	option_index = 0;
+
+	memset(&bench, 0, sizeof(struct bench_s));
+	bench.width = 1920;
+	bench.height = 1080;
+	bench.format = GLC_VIDEO_BGR;
+	bench.frames = 300;
+	bench.video_streams = 1;
+	bench.audio_streams = 1;
+	bench.scale_factor = 0.5;
+	bench.level = -1;
+	bench.buffer_size = 64 * 1024 * 1024;
+	bench.codecs = "quicklz,lzo,lzjb,lz4,zstd";
+
+	glc_init(&bench.glc);
+
+	while ((opt = getopt_long(argc, argv, "s:f:n:w:a:F:z:l:r:b:j:t:Scv:hV",
+				  long_options, &option_index)) != -1) {
+		switch(opt) {
+		case 's':
+			if (sscanf(optarg, "%ux%u", &bench.width, &bench.height) != 2)
+				goto usage;
+			if ((!bench.width) | (!bench.height))
+				goto usage;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "bgr"))
+				bench.format = GLC_VIDEO_BGR;
+			else if (!strcmp(optarg, "bgra"))
+				bench.format = GLC_VIDEO_BGRA;
+			else if (!strcmp(optarg, "420jpeg"))
+				bench.format = GLC_VIDEO_YCBCR_420JPEG;
+			else
+				goto usage;
+			break;
+		case 'n':
+			bench.frames = atoi(optarg);
+			if (!bench.frames)
+				goto usage;
+			break;
+		case 'w':
+			bench.video_streams = atoi(optarg);
+			break;
+		case 'a':
+			bench.audio_streams = atoi(optarg);
+			break;
+		case 'F':
+			filters = optarg;
+			break;
+		case 'z':
+			bench.codecs = optarg;
+			break;
+		case 'l':
+			bench.level = atoi(optarg);
+			break;
+		case 'r':
+			bench.scale_factor = atof(optarg);
+			if (bench.scale_factor <= 0)
+				goto usage;
+			break;
+		case 'b':
+			bench.buffer_size = atoi(optarg) * 1024 * 1024;
+			if (!bench.buffer_size)
+				goto usage;
+			break;
+		case 'j':
+			slices = atoi(optarg);
+			if (slices < 1)
+				goto usage;
+			break;
+		case 't':
+			if (glc_set_threads_hint(&bench.glc, atoi(optarg)))
+				goto usage;
+			break;
+		case 'S':
+			glc_set_cpu_features(&bench.glc, 0);
+			break;
+		case 'c':
+			check = 1;
+			break;
+		case 'v':
+			log_level = atoi(optarg);
+			break;
+		case 'V':
+			printf("glc version %s\n", glc_version());
+			return EXIT_SUCCESS;
+		case 'h':
+		default:
+			goto usage;
+		}
+	}
+
+	if ((!bench.video_streams) && (!bench.audio_streams))
+		goto usage;
+
+	list = strdup(filters);
+	for (tok = strtok_r(list, ",", &saveptr); tok != NULL;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		if (!strcmp(tok, "pack"))
+			bench.filters[bench_pack] = 1;
+		else if (!strcmp(tok, "unpack"))
+			bench.filters[bench_unpack] = 1;
+		else if (!strcmp(tok, "ycbcr"))
+			bench.filters[bench_ycbcr] = 1;
+		else if (!strcmp(tok, "scale"))
+			bench.filters[bench_scale] = 1;
+		else if (!strcmp(tok, "color"))
+			bench.filters[bench_color] = 1;
+		else if (!strcmp(tok, "rgb"))
+			bench.filters[bench_rgb] = 1;
+		else {
+			free(list);
+			goto usage;
+		}
+	}
+	free(list);
+
+	glc_log_set_level(&bench.glc, log_level);
+	glc_util_log_version(&bench.glc);
+	glc_state_init(&bench.glc);
+	glc_slice_set_count(&bench.glc, slices);
+
+	if (check) {
+		i = bench_check(&bench);
+		glc_state_destroy(&bench.glc);
+		glc_destroy(&bench.glc);
+		return i ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	bench.packets = (size_t) bench.frames * (bench.video_streams + bench.audio_streams);
+	bench.sent = (glc_utime_t *) malloc(sizeof(glc_utime_t) * bench.packets);
+	bench.latency = (glc_utime_t *) malloc(sizeof(glc_utime_t) * bench.packets);
+
+	printf("%ux%u, %u frames, %u video and %u audio streams, %u slices\n",
+	       bench.width, bench.height, bench.frames,
+	       bench.video_streams, bench.audio_streams, glc_slice_count(&bench.glc));
+	printf("%-14s %10s %10s %10s %8s %8s %8s %8s %7s %9s\n",
+	       "filter", "frames/s", "MB/s", "out MB/s", "p50 ms", "p90 ms",
+	       "p99 ms", "max ms", "ratio", "peak MiB");
+
+	if ((bench.filters[bench_pack]) | (bench.filters[bench_unpack]))
+		bench_codecs(&bench);
+
+	if (bench.filters[bench_ycbcr]) {
+		if (bench.format == GLC_VIDEO_YCBCR_420JPEG)
+			fprintf(stderr, "ycbcr: needs 'bgr' or 'bgra' input, skipped\n");
+		else
+			bench_run(&bench, bench_ycbcr, 0, "ycbcr", NULL);
+	}
+	if (bench.filters[bench_scale])
+		bench_run(&bench, bench_scale, 0, "scale", NULL);
+	if (bench.filters[bench_color])
+		bench_run(&bench, bench_color, 0, "color", NULL);
+	if (bench.filters[bench_rgb])
+		bench_run(&bench, bench_rgb, 0, "rgb", NULL);
+
+	for (i = 0; i < BENCH_PICTURES; i++)
+		free(bench.picture[i]);
+	free(bench.audio);
+	free(bench.sent);
+	free(bench.latency);
+
+	glc_state_destroy(&bench.glc);
+	glc_destroy(&bench.glc);
+
+	return EXIT_SUCCESS;
+
+usage:
+	printf("%s [option]...\n", argv[0]);
+	printf("  -s, --size=WxH           picture size, default is 1920x1080\n"
+	       "  -f, --format=FMT         picture format, 'bgr', 'bgra' or '420jpeg',\n"
+	       "                             default is 'bgr', rgb always gets '420jpeg'\n"
+	       "  -n, --frames=N           pictures per video stream, default is 300\n"
+	       "  -w, --video=N            number of video streams, default is 1\n"
+	       "  -a, --audio=N            number of audio streams, default is 1\n"
+	       "  -F, --filters=LIST       filters to run, default is\n"
+	       "                             'pack,unpack,ycbcr,scale,color,rgb'\n"
+	       "  -z, --compression=LIST   codecs for pack and unpack, default is\n"
+	       "                             'quicklz,lzo,lzjb,lz4,zstd'\n"
+	       "  -l, --level=N            compression level\n"
+	       "  -r, --resize=VAL         scale factor for scale, default is 0.5\n"
+	       "  -b, --buffer=SIZE        buffer size in MiB, default is 64 MiB\n"
+	       "  -j, --slices=N           split each picture into N slices processed\n"
+	       "                             in parallel, default is 1\n"
+	       "  -t, --threads=N          threads per filter, default is CPU count\n"
+	       "  -S, --no-simd            use plain C loops instead of SIMD kernels\n"
+	       "  -c, --check              compare SIMD ycbcr kernels against C loops\n"
+	       "                             on random odd-sized BGR and BGRA pictures\n"
+	       "                             and exit, fails on any mismatch\n"
+	       "  -v, --verbosity=LEVEL    verbosity level\n"
+	       "  -V, --version            print glc version and exit\n"
+	       "  -h, --help               show help\n");
+	return EXIT_FAILURE;
+}
+
+int bench_check(struct bench_s *bench)
+{
+	/* odd sizes leave tails for scalar code after vector loops */
+	unsigned int size[][2] = {{5, 5}, {17, 9}, {33, 31}, {67, 45},
+				  {255, 127}, {641, 359}, {1921, 1081}};
+	double scale[] = {1.0, 0.5, bench->scale_factor};
+	glc_video_format_t format[] = {GLC_VIDEO_BGR, GLC_VIDEO_BGRA};
+	unsigned int s, f, i, w, h;
+	int ret, failed = 0;
+	ycbcr_t ycbcr;
+
+	for (s = 0; s < sizeof(scale) / sizeof(scale[0]); s++) {
+		/* default resize is already covered */
+		if ((s == 2) && ((scale[s] == 1.0) || (scale[s] == 0.5)))
+			continue;
+
+		for (f = 0; f < sizeof(format) / sizeof(format[0]); f++) {
+			for (i = 0; i <= sizeof(size) / sizeof(size[0]); i++) {
+				/* last round is with picture size from options */
+				if (i < sizeof(size) / sizeof(size[0])) {
+					w = size[i][0];
+					h = size[i][1];
+				} else {
+					w = bench->width;
+					h = bench->height;
+				}
+
+				if ((ret = ycbcr_init(&ycbcr, &bench->glc)))
+					return ret;
+				ycbcr_set_scale(ycbcr, scale[s]);
+				ret = ycbcr_check(ycbcr, format[f], w, h, BENCH_CHECK_TOLERANCE);
+				ycbcr_destroy(ycbcr);
+
+				/* too small to produce any output at this scale */
+				if (ret == EINVAL)
+					continue;
+
+				printf("ycbcr %-4s %4ux%-4u scale %.2f: %s\n",
+				       (format[f] == GLC_VIDEO_BGRA) ? "bgra" : "bgr",
+				       w, h, scale[s], ret ? "FAILED" : "ok");
+				if (ret)
+					failed++;
+			}
+		}
+	}
+
+	if (failed)
+		fprintf(stderr, "%d ycbcr kernel checks failed\n", failed);
+	return failed ? EDOM : 0;
+}
+
+int bench_codecs(struct bench_s *bench)
+{
+	char *list, *tok, *saveptr, name[32];
+	struct bench_packet_s *packed;
+	int compression;
+
+	list = strdup(bench->codecs);
+	for (tok = strtok_r(list, ",", &saveptr); tok != NULL;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		if (!strcmp(tok, "quicklz"))
+			compression = PACK_QUICKLZ;
+		else if (!strcmp(tok, "lzo"))
+			compression = PACK_LZO;
+		else if (!strcmp(tok, "lzjb"))
+			compression = PACK_LZJB;
+		else if (!strcmp(tok, "lz4"))
+			compression = PACK_LZ4;
+		else if (!strcmp(tok, "zstd"))
+			compression = PACK_ZSTD;
+		else {
+			fprintf(stderr, "unknown compression '%s'\n", tok);
+			continue;
+		}
+
+		/* unpack reads what pack wrote */
+		bench->keep = bench->filters[bench_unpack];
+		snprintf(name, sizeof(name), "pack:%s", tok);
+		if (bench_run(bench, bench_pack, compression,
+			      bench->filters[bench_pack] ? name : NULL, NULL)) {
+			bench_free_packets(bench->kept);
+			bench->kept = NULL;
+			continue;
+		}
+		packed = bench->kept;
+		bench->kept = NULL;
+		bench->keep = 0;
+
+		if (bench->filters[bench_unpack]) {
+			snprintf(name, sizeof(name), "unpack:%s", tok);
+			bench_run(bench, bench_unpack, 0, name, packed);
+		}
+		bench_free_packets(packed);
+	}
+	free(list);
+
+	return 0;
+}
+
+int bench_run(struct bench_s *bench, enum bench_filter filter, int compression,
+	      const char *name, struct bench_packet_s *replay)
+{
+	/*
+	 Every run uses following pipeline:
+
+	 main -(from)->    writes generated or replayed stream
+	 filter -(to)->    filter under test
+	 sink              timestamps and drops packets
+	*/
+
+	ps_bufferattr_t attr;
+	ps_buffer_t from, to;
+	glc_thread_t sink;
+	pack_t pack = NULL;
+	unpack_t unpack = NULL;
+	ycbcr_t ycbcr = NULL;
+	scale_t scale = NULL;
+	color_t color = NULL;
+	rgb_t rgb = NULL;
+	glc_utime_t start;
+	int ret = 0;
+
+	/* rgb converts Y'CbCr, everything else takes selected format */
+	if ((ret = bench_generate(bench, (filter == bench_rgb) ?
+				  GLC_VIDEO_YCBCR_420JPEG : bench->format)))
+		goto err;
+
+	bench->received = 0;
+	bench->in_bytes = bench->out_bytes = 0;
+	bench->kept_tail = &bench->kept;
+
+	if ((ret = ps_bufferattr_init(&attr)))
+		goto err;
+	if ((ret = ps_bufferattr_setsize(&attr, bench->buffer_size)))
+		goto err;
+	if ((ret = ps_buffer_init(&from, &attr)))
+		goto err;
+	if ((ret = ps_buffer_init(&to, &attr)))
+		goto err;
+	if ((ret = ps_bufferattr_destroy(&attr)))
+		goto err;
+
+	switch (filter) {
+	case bench_pack:
+		if ((ret = pack_init(&pack, &bench->glc)))
+			goto err;
+		if ((ret = pack_set_compression(pack, compression)))
+			goto err;
+		if (bench->level >= 0)
+			pack_set_compression_level(pack, bench->level);
+		ret = pack_process_start(pack, &from, &to);
+		break;
+	case bench_unpack:
+		if ((ret = unpack_init(&unpack, &bench->glc)))
+			goto err;
+		ret = unpack_process_start(unpack, &from, &to);
+		break;
+	case bench_ycbcr:
+		if ((ret = ycbcr_init(&ycbcr, &bench->glc)))
+			goto err;
+		ret = ycbcr_process_start(ycbcr, &from, &to);
+		break;
+	case bench_scale:
+		if ((ret = scale_init(&scale, &bench->glc)))
+			goto err;
+		scale_set_scale(scale, bench->scale_factor);
+		ret = scale_process_start(scale, &from, &to);
+		break;
+	case bench_color:
+		if ((ret = color_init(&color, &bench->glc)))
+			goto err;
+		/* identity correction would be skipped */
+		color_override(color, 0.1, 0.1, 1.2, 1.0, 0.8);
+		ret = color_process_start(color, &from, &to);
+		break;
+	case bench_rgb:
+		if ((ret = rgb_init(&rgb, &bench->glc)))
+			goto err;
+		ret = rgb_process_start(rgb, &from, &to);
+		break;
+	}
+	if (ret)
+		goto err;
+
+	memset(&sink, 0, sizeof(glc_thread_t));
+	sink.flags = GLC_THREAD_READ;
+	sink.ptr = bench;
+	sink.read_callback = &bench_sink_read_callback;
+	sink.threads = 1;
+	sink.name = "sink";
+	if ((ret = glc_thread_create(&bench->glc, &sink, &to, NULL)))
+		goto err;
+
+	start = glc_time(&bench->glc);
+	if (replay)
+		ret = bench_write_replay(bench, &from, replay);
+	else
+		ret = bench_write_stream(bench, &from);
+	if (ret)
+		glc_state_set(&bench->glc, GLC_STATE_CANCEL);
+
+	glc_thread_wait(&sink);
+	switch (filter) {
+	case bench_pack:
+		pack_process_wait(pack);
+		break;
+	case bench_unpack:
+		unpack_process_wait(unpack);
+		break;
+	case bench_ycbcr:
+		ycbcr_process_wait(ycbcr);
+		break;
+	case bench_scale:
+		scale_process_wait(scale);
+		break;
+	case bench_color:
+		color_process_wait(color);
+		break;
+	case bench_rgb:
+		rgb_process_wait(rgb);
+		break;
+	}
+
+	if ((!ret) && (name))
+		bench_report(bench, name, glc_time(&bench->glc) - start);
+
+	if (pack)
+		pack_destroy(pack);
+	if (unpack)
+		unpack_destroy(unpack);
+	if (ycbcr)
+		ycbcr_destroy(ycbcr);
+	if (scale)
+		scale_destroy(scale);
+	if (color)
+		color_destroy(color);
+	if (rgb)
+		rgb_destroy(rgb);
+
+	ps_buffer_destroy(&from);
+	ps_buffer_destroy(&to);
+
+	/* next run starts clean */
+	glc_state_clear(&bench->glc, GLC_STATE_CANCEL);
+	if (ret)
+		goto err;
+	return 0;
+err:
+	fprintf(stderr, "%s failed: %s (%d)\n", name ? name : "benchmark",
+		strerror(ret), ret);
+	return ret;
+}
+
+int bench_generate(struct bench_s *bench, glc_video_format_t format)
+{
+	unsigned int x, y, c, i, bpp, w, h;
+	u_int32_t seed = 0x474c43;
+	int16_t *sample;
+	unsigned char *p;
+
+	if ((bench->picture[0]) && (bench->picture_format == format))
+		return 0;
+
+	w = bench->width;
+	h = bench->height;
+	if (format == GLC_VIDEO_YCBCR_420JPEG) {
+		/* even dimensions, as in ycbcr output */
+		w -= w % 2;
+		h -= h % 2;
+		bench->picture_size = w * h + (w / 2) * (h / 2) * 2;
+		bpp = 1;
+	} else {
+		bpp = (format == GLC_VIDEO_BGRA) ? 4 : 3;
+		bench->picture_size = w * h * bpp;
+	}
+
+	/* gradients compress, noisy band in middle doesn't */
+	for (i = 0; i < BENCH_PICTURES; i++) {
+		free(bench->picture[i]);
+		if (!(bench->picture[i] = (char *) malloc(bench->picture_size)))
+			return ENOMEM;
+		p = (unsigned char *) bench->picture[i];
+
+		for (y = 0; y < h; y++) {
+			for (x = 0; x < w * bpp; x++) {
+				if ((y > h * 3 / 8) && (y < h * 5 / 8)) {
+					seed = seed * 1103515245 + 12345;
+					*p++ = seed >> 24;
+				} else
+					*p++ = ((x / bpp + i * 8) ^ (y + i * 3)) & 0xff;
+			}
+		}
+
+		/* chroma planes */
+		if (format == GLC_VIDEO_YCBCR_420JPEG) {
+			for (c = 0; c < 2; c++) {
+				for (y = 0; y < h / 2; y++) {
+					for (x = 0; x < w / 2; x++)
+						*p++ = 128 + (((x + y + i + c * 32) & 0x3f) - 32);
+				}
+			}
+		}
+	}
+	bench->picture_format = format;
+
+	/* one video frame worth of sine */
+	if (!bench->audio) {
+		bench->audio_size = (BENCH_AUDIO_RATE / BENCH_FPS) * BENCH_AUDIO_CHANNELS
+				    * sizeof(int16_t);
+		if (!(bench->audio = (char *) malloc(bench->audio_size)))
+			return ENOMEM;
+		sample = (int16_t *) bench->audio;
+		for (i = 0; i < BENCH_AUDIO_RATE / BENCH_FPS; i++) {
+			seed = seed * 1103515245 + 12345;
+			for (c = 0; c < BENCH_AUDIO_CHANNELS; c++)
+				*sample++ = (int16_t) (8000.0 * sin(2.0 * M_PI * 440.0 * i /
+								    BENCH_AUDIO_RATE) +
+						       (int) (seed >> 28) - 8);
+		}
+	}
+
+	return 0;
+}
+
+int bench_write_stream(struct bench_s *bench, ps_buffer_t *to)
+{
+	glc_video_format_message_t video_format;
+	glc_audio_format_message_t audio_format;
+	glc_video_frame_header_t pic;
+	glc_audio_data_header_t audio;
+	unsigned int frame, s;
+	size_t packet = 0;
+	int ret;
+
+	for (s = 0; s < bench->video_streams; s++) {
+		video_format.id = s + 1;
+		video_format.flags = 0;
+		video_format.width = bench->width;
+		video_format.height = bench->height;
+		video_format.format = bench->picture_format;
+		if (bench->picture_format == GLC_VIDEO_YCBCR_420JPEG) {
+			video_format.width -= video_format.width % 2;
+			video_format.height -= video_format.height % 2;
+		}
+		if ((ret = bench_write_message(to, GLC_MESSAGE_VIDEO_FORMAT,
+					       &video_format, sizeof(glc_video_format_message_t),
+					       NULL, 0)))
+			return ret;
+	}
+
+	for (s = 0; s < bench->audio_streams; s++) {
+		audio_format.id = s + 1;
+		audio_format.flags = GLC_AUDIO_INTERLEAVED;
+		audio_format.rate = BENCH_AUDIO_RATE;
+		audio_format.channels = BENCH_AUDIO_CHANNELS;
+		audio_format.format = GLC_AUDIO_S16_LE;
+		if ((ret = bench_write_message(to, GLC_MESSAGE_AUDIO_FORMAT,
+					       &audio_format, sizeof(glc_audio_format_message_t),
+					       NULL, 0)))
+			return ret;
+	}
+
+	for (frame = 0; frame < bench->frames; frame++) {
+		for (s = 0; s < bench->video_streams; s++) {
+			pic.id = s + 1;
+			pic.time = (glc_utime_t) frame * 1000000 / BENCH_FPS;
+			bench->sent[packet++] = glc_time(&bench->glc);
+			if ((ret = bench_write_message(to, GLC_MESSAGE_VIDEO_FRAME,
+						       &pic, sizeof(glc_video_frame_header_t),
+						       bench->picture[(frame + s) % BENCH_PICTURES],
+						       bench->picture_size)))
+				return ret;
+			bench->in_bytes += sizeof(glc_video_frame_header_t) + bench->picture_size;
+		}
+
+		for (s = 0; s < bench->audio_streams; s++) {
+			audio.id = s + 1;
+			audio.time = (glc_utime_t) frame * 1000000 / BENCH_FPS;
+			audio.size = bench->audio_size;
+			bench->sent[packet++] = glc_time(&bench->glc);
+			if ((ret = bench_write_message(to, GLC_MESSAGE_AUDIO_DATA,
+						       &audio, sizeof(glc_audio_data_header_t),
+						       bench->audio, bench->audio_size)))
+				return ret;
+			bench->in_bytes += sizeof(glc_audio_data_header_t) + bench->audio_size;
+		}
+	}
+
+	return glc_util_write_end_of_stream(&bench->glc, to);
+}
+
+int bench_write_replay(struct bench_s *bench, ps_buffer_t *to,
+		       struct bench_packet_s *replay)
+{
+	glc_message_header_t *hdr;
+	size_t packet = 0;
+	int ret;
+
+	for (; replay != NULL; replay = replay->next) {
+		hdr = (glc_message_header_t *) replay->data;
+		if (bench_is_data(hdr->type))
+			bench->sent[packet++] = glc_time(&bench->glc);
+
+		if ((ret = bench_write_message(to, hdr->type,
+					       &replay->data[sizeof(glc_message_header_t)],
+					       replay->size - sizeof(glc_message_header_t),
+					       NULL, 0)))
+			return ret;
+		bench->in_bytes += replay->size - sizeof(glc_message_header_t);
+	}
+
+	return glc_util_write_end_of_stream(&bench->glc, to);
+}
+
+int bench_write_message(ps_buffer_t *to, glc_message_type_t type,
+			void *message, size_t message_size,
+			void *data, size_t data_size)
+{
+	glc_message_header_t hdr;
+	ps_packet_t packet;
+	int ret;
+
+	hdr.type = type;
+	if ((ret = ps_packet_init(&packet, to)))
+		return ret;
+	if ((ret = ps_packet_open(&packet, PS_PACKET_WRITE)))
+		goto finish;
+	if ((ret = ps_packet_write(&packet, &hdr, sizeof(glc_message_header_t))))
+		goto finish;
+	if ((ret = ps_packet_write(&packet, message, message_size)))
+		goto finish;
+	if (data_size) {
+		if ((ret = ps_packet_write(&packet, data, data_size)))
+			goto finish;
+	}
+	ret = ps_packet_close(&packet);
+
+finish:
+	ps_packet_destroy(&packet);
+	return ret;
+}
+
+int bench_sink_read_callback(glc_thread_state_t *state)
+{
+	struct bench_s *bench = (struct bench_s *) state->ptr;
+	struct bench_packet_s *copy;
+
+	if (state->header.type == GLC_MESSAGE_CLOSE)
+		return 0;
+
+	if ((bench_is_data(state->header.type)) && (bench->received < bench->packets)) {
+		bench->latency[bench->received] = glc_time(&bench->glc) -
+						  bench->sent[bench->received];
+		bench->received++;
+	}
+	bench->out_bytes += state->read_size;
+
+	if (bench->keep) {
+		if (!(copy = (struct bench_packet_s *) malloc(sizeof(struct bench_packet_s) +
+							       sizeof(glc_message_header_t) +
+							       state->read_size)))
+			return ENOMEM;
+		copy->size = sizeof(glc_message_header_t) + state->read_size;
+		copy->next = NULL;
+		memcpy(copy->data, &state->header, sizeof(glc_message_header_t));
+		memcpy(&copy->data[sizeof(glc_message_header_t)], state->read_data,
+		       state->read_size);
+
+		*bench->kept_tail = copy;
+		bench->kept_tail = &copy->next;
+	}
+
+	return 0;
+}
+
+int bench_compare_time(const void *a, const void *b)
+{
+	glc_utime_t ta = *(const glc_utime_t *) a, tb = *(const glc_utime_t *) b;
+	return (ta > tb) - (ta < tb);
+}
+
+void bench_report(struct bench_s *bench, const char *name, glc_utime_t elapsed)
+{
+	glc_utime_t *video;
+	size_t i, frames = 0;
+	struct rusage usage;
+	double sec, p50 = 0, p90 = 0, p99 = 0, max = 0;
+
+	/* latency of pictures, audio packets are small */
+	video = (glc_utime_t *) malloc(sizeof(glc_utime_t) * (bench->received + 1));
+	for (i = 0; i < bench->received; i++) {
+		if ((bench_is_video(bench, i)) || (!bench->video_streams))
+			video[frames++] = bench->latency[i];
+	}
+
+	if (frames) {
+		qsort(video, frames, sizeof(glc_utime_t), bench_compare_time);
+		p50 = video[frames * 50 / 100] / 1000.0;
+		p90 = video[frames * 90 / 100] / 1000.0;
+		p99 = video[frames * 99 / 100] / 1000.0;
+		max = video[frames - 1] / 1000.0;
+	}
+	free(video);
+
+	/* peak of whole process so far */
+	getrusage(RUSAGE_SELF, &usage);
+
+	sec = elapsed / 1000000.0;
+	if (sec <= 0)
+		sec = 1e-6;
+
+	printf("%-14s %10.1f %10.1f %10.1f %8.2f %8.2f %8.2f %8.2f %7.3f %9ld\n",
+	       name, frames / sec,
+	       bench->in_bytes / sec / (1024.0 * 1024.0),
+	       bench->out_bytes / sec / (1024.0 * 1024.0),
+	       p50, p90, p99, max,
+	       bench->in_bytes ? (double) bench->out_bytes / bench->in_bytes : 0.0,
+	       usage.ru_maxrss / 1024);
+	fflush(stdout);
+}
+
+void bench_free_packets(struct bench_packet_s *packet)
+{
+	struct bench_packet_s *next;
+
+	while (packet != NULL) {
+		next = packet->next;
+		free(packet);
+		packet = next;
+	}
+}
+
+int bench_is_data(glc_message_type_t type)
+{
+	return (type != GLC_MESSAGE_VIDEO_FORMAT) &&
+	       (type != GLC_MESSAGE_AUDIO_FORMAT) &&
+	       (type != GLC_MESSAGE_COLOR) &&
+	       (type != GLC_MESSAGE_CLOSE);
+}
+
+int bench_is_video(struct bench_s *bench, size_t packet)
+{
+	/* frame of each video stream, then each audio stream */
+	return (packet % (bench->video_streams + bench->audio_streams)) <
+	       bench->video_streams;
+}
@@ -0,0 +1,340 @@
+/**
+ * \file bench_gl.c
+ * \brief capture overhead benchmark
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/*
+ Renders given number of frames into a window and measures time
+ spent in glXSwapBuffers(), which is where libglc-hook captures.
+ Rendering is finished with glFinish() before timing starts so
+ only swap and capture are measured. Run it with and without
+ glc-capture to get the overhead; scripts/bench-hook.sh does that
+ for several capture modes, under Xvfb if there is no display.
+
+ If GLC_CONTROL is set, hook's control socket is asked for dropped
+ frames after last frame.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <X11/Xlib.h>
+#include <GL/gl.h>
+#include <GL/glx.h>
+
+enum bench_content {content_clear, content_quads, content_noise};
+
+struct bench_gl_s {
+	unsigned int width, height;
+	unsigned int frames, warmup;
+	unsigned int quads;
+	enum bench_content content;
+
+	Display *dpy;
+	Window win;
+	GLXContext ctx;
+
+	unsigned int *noise;
+	u_int32_t seed;
+};
+
+int bench_gl_open(struct bench_gl_s *bench);
+void bench_gl_close(struct bench_gl_s *bench);
+void bench_gl_render(struct bench_gl_s *bench, unsigned int frame);
+unsigned long long bench_gl_time();
+int bench_gl_compare(const void *a, const void *b);
+void bench_gl_report(struct bench_gl_s *bench, unsigned long long *swap,
+		     unsigned long long elapsed);
+int bench_gl_dropped();
+
+int main(int argc, char *argv[])
+{
+	struct bench_gl_s bench;
+	unsigned long long *swap, start, t;
+	unsigned int frame;
+	int opt, option_index;
+
+	struct option long_options[] = {
+		{"size",		1, NULL, 's'},
+		{"frames",		1, NULL, 'n'},
+		{"warmup",		1, NULL, 'w'},
+		{"content",		1, NULL, 'c'},
+		{"quads",		1, NULL, 'q'},
+		{"help",		0, NULL, 'h'},
+		{0, 0, 0, 0}
+	};
+	option_index = 0;
+
+	memset(&bench, 0, sizeof(struct bench_gl_s));
+	bench.width = 1280;
+	bench.height = 720;
+	bench.frames = 600;
+	bench.warmup = 30;
+	bench.quads = 200;
+	bench.content = content_quads;
+	bench.seed = 0x474c43;
+
+	while ((opt = getopt_long(argc, argv, "s:n:w:c:q:h",
+				  long_options, &option_index)) != -1) {
+		switch(opt) {
+		case 's':
+			if (sscanf(optarg, "%ux%u", &bench.width, &bench.height) != 2)
+				goto usage;
+			if ((!bench.width) | (!bench.height))
+				goto usage;
+			break;
+		case 'n':
+			bench.frames = atoi(optarg);
+			if (!bench.frames)
+				goto usage;
+			break;
+		case 'w':
+			bench.warmup = atoi(optarg);
+			break;
+		case 'c':
+			if (!strcmp(optarg, "clear"))
+				bench.content = content_clear;
+			else if (!strcmp(optarg, "quads"))
+				bench.content = content_quads;
+			else if (!strcmp(optarg, "noise"))
+				bench.content = content_noise;
+			else
+				goto usage;
+			break;
+		case 'q':
+			bench.quads = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			goto usage;
+		}
+	}
+
+	if (bench_gl_open(&bench))
+		return EXIT_FAILURE;
+
+	swap = (unsigned long long *) malloc(sizeof(unsigned long long) * bench.frames);
+
+	for (frame = 0; frame < bench.warmup; frame++) {
+		bench_gl_render(&bench, frame);
+		glXSwapBuffers(bench.dpy, bench.win);
+	}
+
+	start = bench_gl_time();
+	for (frame = 0; frame < bench.frames; frame++) {
+		bench_gl_render(&bench, bench.warmup + frame);
+		glFinish();
+
+		t = bench_gl_time();
+		glXSwapBuffers(bench.dpy, bench.win);
+		swap[frame] = bench_gl_time() - t;
+	}
+
+	bench_gl_report(&bench, swap, bench_gl_time() - start);
+
+	free(swap);
+	bench_gl_close(&bench);
+	return EXIT_SUCCESS;
+
+usage:
+	printf("%s [option]...\n", argv[0]);
+	printf("  -s, --size=WxH           window size, default is 1280x720\n"
+	       "  -n, --frames=N           measured frames, default is 600\n"
+	       "  -w, --warmup=N           frames rendered before measuring,\n"
+	       "                             default is 30\n"
+	       "  -c, --content=TYPE       'clear', 'quads' or 'noise', default\n"
+	       "                             is 'quads'\n"
+	       "  -q, --quads=N            moving quads per frame, default is 200\n"
+	       "  -h, --help               show help\n");
+	return EXIT_FAILURE;
+}
+
+int bench_gl_open(struct bench_gl_s *bench)
+{
+	XSetWindowAttributes attr;
+	XVisualInfo *visual;
+	int visual_attr[] = {GLX_RGBA, GLX_DOUBLEBUFFER,
+			     GLX_RED_SIZE, 8, GLX_GREEN_SIZE, 8, GLX_BLUE_SIZE, 8,
+			     None};
+
+	if (!(bench->dpy = XOpenDisplay(NULL))) {
+		fprintf(stderr, "can't open display\n");
+		return EINVAL;
+	}
+
+	if (!(visual = glXChooseVisual(bench->dpy, DefaultScreen(bench->dpy), visual_attr))) {
+		fprintf(stderr, "no double-buffered RGB visual\n");
+		return ENOTSUP;
+	}
+
+	attr.colormap = XCreateColormap(bench->dpy, RootWindow(bench->dpy, visual->screen),
+					visual->visual, AllocNone);
+	attr.border_pixel = 0;
+	bench->win = XCreateWindow(bench->dpy, RootWindow(bench->dpy, visual->screen),
+				   0, 0, bench->width, bench->height, 0,
+				   visual->depth, InputOutput, visual->visual,
+				   CWColormap | CWBorderPixel, &attr);
+	XStoreName(bench->dpy, bench->win, "glc-bench-gl");
+	XMapWindow(bench->dpy, bench->win);
+
+	bench->ctx = glXCreateContext(bench->dpy, visual, NULL, True);
+	XFree(visual);
+	if (!bench->ctx) {
+		fprintf(stderr, "can't create GLX context\n");
+		return ENOTSUP;
+	}
+	glXMakeCurrent(bench->dpy, bench->win, bench->ctx);
+	XSync(bench->dpy, False);
+
+	glViewport(0, 0, bench->width, bench->height);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0, bench->width, 0, bench->height, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	if (bench->content == content_noise) {
+		bench->noise = (unsigned int *) malloc(sizeof(unsigned int) *
+						       bench->width * bench->height);
+		if (!bench->noise)
+			return ENOMEM;
+	}
+
+	return 0;
+}
+
+void bench_gl_close(struct bench_gl_s *bench)
+{
+	if (bench_gl_dropped() < 0)
+		printf("dropped      unknown\n");
+
+	glXMakeCurrent(bench->dpy, None, NULL);
+	glXDestroyContext(bench->dpy, bench->ctx);
+	XDestroyWindow(bench->dpy, bench->win);
+	XCloseDisplay(bench->dpy);
+	free(bench->noise);
+}
+
+void bench_gl_render(struct bench_gl_s *bench, unsigned int frame)
+{
+	unsigned int i, x, y, size;
+
+	glClearColor((frame % 256) / 255.0, 0.25, 0.5, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	if (bench->content == content_quads) {
+		/* typical game content, compresses moderately */
+		size = bench->height / 16;
+		glBegin(GL_QUADS);
+		for (i = 0; i < bench->quads; i++) {
+			x = (i * 97 + frame * (i % 7 + 1)) % bench->width;
+			y = (i * 61 + frame * (i % 5 + 1)) % bench->height;
+			glColor3ub(i * 37, i * 59, i * 83);
+			glVertex2i(x, y);
+			glVertex2i(x + size, y);
+			glVertex2i(x + size, y + size);
+			glVertex2i(x, y + size);
+		}
+		glEnd();
+	} else if (bench->content == content_noise) {
+		/* worst case for compression */
+		for (i = 0; i < bench->width * bench->height; i++) {
+			bench->seed = bench->seed * 1103515245 + 12345;
+			bench->noise[i] = bench->seed;
+		}
+		glRasterPos2i(0, 0);
+		glDrawPixels(bench->width, bench->height, GL_RGBA, GL_UNSIGNED_BYTE,
+			     bench->noise);
+	}
+}
+
+unsigned long long bench_gl_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int bench_gl_compare(const void *a, const void *b)
+{
+	unsigned long long ta = *(const unsigned long long *) a;
+	unsigned long long tb = *(const unsigned long long *) b;
+	return (ta > tb) - (ta < tb);
+}
+
+void bench_gl_report(struct bench_gl_s *bench, unsigned long long *swap,
+		     unsigned long long elapsed)
+{
+	unsigned long long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < bench->frames; i++)
+		sum += swap[i];
+	qsort(swap, bench->frames, sizeof(unsigned long long), bench_gl_compare);
+
+	/* times in ms, easy to parse: name value */
+	printf("frames       %u\n", bench->frames);
+	printf("fps          %.2f\n", bench->frames / (elapsed / 1e9));
+	printf("swap_mean    %.3f\n", sum / (double) bench->frames / 1e6);
+	printf("swap_p50     %.3f\n", swap[bench->frames * 50 / 100] / 1e6);
+	printf("swap_p90     %.3f\n", swap[bench->frames * 90 / 100] / 1e6);
+	printf("swap_p99     %.3f\n", swap[bench->frames * 99 / 100] / 1e6);
+	printf("swap_max     %.3f\n", swap[bench->frames - 1] / 1e6);
+	fflush(stdout);
+}
+
+int bench_gl_dropped()
+{
+	struct sockaddr_un addr;
+	char buf[8192], *line, *end;
+	size_t have = 0;
+	ssize_t ret;
+	int fd, found = -1;
+
+	if (!getenv("GLC_CONTROL"))
+		return -1;
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), getenv("GLC_CONTROL"), getpid());
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if ((connect(fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un))) ||
+	    (write(fd, "stats\n", 6) != 6)) {
+		close(fd);
+		return -1;
+	}
+
+	/* answer ends with 'ok' line */
+	while (have < sizeof(buf) - 1) {
+		if ((ret = read(fd, &buf[have], sizeof(buf) - 1 - have)) <= 0)
+			break;
+		have += ret;
+		buf[have] = '\0';
+		if ((strstr(buf, "\nok\n")) || (!strncmp(buf, "ok\n", 3)))
+			break;
+	}
+	close(fd);
+	buf[have] = '\0';
+
+	for (line = buf; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+		*end = '\0';
+		if (!strncmp(line, "video_dropped ", 14)) {
+			printf("dropped      %s\n", &line[14]);
+			found = 0;
+		} else if (!strncmp(line, "audio_dropped ", 14))
+			printf("audio_dropped %s\n", &line[14]);
+	}
+
+	return found;
+}
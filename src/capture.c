@@ -46,21 +46,61 @@ int main(int argc, char *argv[])
 		{'o', "out",			"GLC_FILE",			NULL},
 		{'f', "fps",			"GLC_FPS",			NULL},
 		{'r', "resize",			"GLC_SCALE",			NULL},
+		{ 0 , "resize-filter",		"GLC_SCALE_FILTER",		NULL},
 		{'c', "crop",			"GLC_CROP",			NULL},
 		{'a', "record-audio",		"GLC_AUDIO_RECORD",		NULL},
 		{'s', "start",			"GLC_START",			 "1"},
 		{'e', "colorspace",		"GLC_COLORSPACE",		NULL},
 		{'k', "hotkey",			"GLC_HOTKEY",			NULL},
 		{ 0 , "reload",			"GLC_RELOAD_HOTKEY",		NULL},
+		{ 0 , "replay",			"GLC_REPLAY",			NULL},
+		{ 0 , "replay-size",		"GLC_REPLAY_SIZE",		NULL},
+		{ 0 , "replay-hotkey",		"GLC_REPLAY_HOTKEY",		NULL},
 		{'n', "lock-fps",		"GLC_LOCK_FPS",			 "1"},
+		{ 0 , "pacing",			"GLC_LOCK_FPS_PACING",		NULL},
 		{ 0 , "pbo",			"GLC_TRY_PBO",			 "1"},
+		{ 0 , "pbo-count",		"GLC_PBO_COUNT",		NULL},
+		{ 0 , "pbo-worker",		"GLC_PBO_WORKER",		 "1"},
+		{ 0 , "persistent-pbo",		"GLC_PERSISTENT_PBO",		 "1"},
+		{ 0 , "gpu-convert",		"GLC_GPU_CONVERT",		 "1"},
+		{ 0 , "gpu-scale",		"GLC_GPU_SCALE",		 "1"},
 		{'z', "compression",		"GLC_COMPRESS",			NULL},
+		{ 0 , "compression-level",	"GLC_COMPRESS_LEVEL",		NULL},
+		{ 0 , "compression-headroom",	"GLC_COMPRESS_HEADROOM",	NULL},
+		{ 0 , "delta",			"GLC_DELTA",			NULL},
+		{ 0 , "delta-tiles",		"GLC_DELTA_TILES",		 "1"},
+		{ 0 , "audio-lpc",		"GLC_AUDIO_LPC",		 "1"},
+		{ 0 , "compression-block",	"GLC_COMPRESS_BLOCK_SIZE",	NULL},
 		{ 0 , "sync",			"GLC_SYNC",			 "1"},
+		{ 0 , "file-buffer",		"GLC_FILE_BUFFER",		NULL},
+		{ 0 , "file-flush",		"GLC_FILE_FLUSH",		NULL},
+		{ 0 , "direct-io",		"GLC_FILE_DIRECT",		 "1"},
+		{ 0 , "io-uring",		"GLC_FILE_URING",		NULL},
+		{ 0 , "index-interval",		"GLC_INDEX_INTERVAL",		NULL},
+		{ 0 , "segment-size",		"GLC_FILE_SEGMENT_SIZE",	NULL},
+		{ 0 , "segment-time",		"GLC_FILE_SEGMENT_TIME",	NULL},
+		{ 0 , "encode",			"GLC_ENCODE",			 "1"},
+		{ 0 , "encode-file",		"GLC_ENCODE_FILE",		NULL},
+		{ 0 , "encoder",		"GLC_ENCODER",			NULL},
+		{ 0 , "encode-preset",		"GLC_ENCODE_PRESET",		NULL},
+		{ 0 , "encode-quality",		"GLC_ENCODE_QUALITY",		NULL},
+		{ 0 , "encode-bitrate",		"GLC_ENCODE_BITRATE",		NULL},
+		{ 0 , "encode-threads",		"GLC_ENCODE_THREADS",		NULL},
+		{ 0 , "daemon",			"GLC_DAEMON",			NULL},
+		{ 0 , "daemon-ring",		"GLC_DAEMON_RING",		NULL},
 		{ 0 , "byte-aligned",		"GLC_CAPTURE_DWORD_ALIGNED",	 "0"},
 		{'i', "draw-indicator",		"GLC_INDICATOR",		 "1"},
+		{ 0 , "detect-repeat",		"GLC_DETECT_REPEAT",		 "1"},
 		{'v', "log",			"GLC_LOG",			NULL},
 		{'l', "log-file",		"GLC_LOG_FILE",			NULL},
+		{ 0 , "stats-file",		"GLC_STATS_FILE",		NULL},
+		{ 0 , "stats-interval",		"GLC_STATS_INTERVAL",		NULL},
+		{ 0 , "stream-stats",		"GLC_STREAM_STATS",		NULL},
+		{ 0 , "control",		"GLC_CONTROL",			NULL},
 		{ 0 , "audio-skip",		"GLC_AUDIO_SKIP",		 "1"},
+		{ 0 , "audio-batch",		"GLC_AUDIO_BATCH",		NULL},
+		{ 0 , "audio-batch-size",	"GLC_AUDIO_BATCH_SIZE",		NULL},
+		{ 0 , "audio-batch-latency",	"GLC_AUDIO_BATCH_LATENCY",	NULL},
 		{ 0 , "disable-audio",		"GLC_AUDIO",			 "0"},
 		{ 0 , "sighandler",		"GLC_SIGHANDLER",		 "1"},
 		{'g', "glfinish",		"GLC_CAPTURE_GLFINISH",		 "1"},
@@ -69,6 +109,19 @@ int main(int argc, char *argv[])
 		{ 0 , "compressed",		"GLC_COMPRESSED_BUFFER_SIZE",	NULL},
 		{ 0 , "uncompressed",		"GLC_UNCOMPRESSED_BUFFER_SIZE",	NULL},
 		{ 0 , "unscaled",		"GLC_UNSCALED_BUFFER_SIZE",	NULL},
+		{ 0 , "buffer-auto",		"GLC_BUFFER_AUTO",		NULL},
+		{ 0 , "cpus",			"GLC_CPUS",			NULL},
+		{ 0 , "pack-cpus",		"GLC_PACK_CPUS",		NULL},
+		{ 0 , "file-cpus",		"GLC_FILE_CPUS",		NULL},
+		{ 0 , "slices",			"GLC_SLICES",			NULL},
+		{ 0 , "no-simd",		"GLC_SIMD",			 "0"},
+		{ 0 , "sched",			"GLC_SCHED",			NULL},
+		{ 0 , "nice",			"GLC_NICE",			NULL},
+		{ 0 , "numa-node",		"GLC_NUMA_NODE",		NULL},
+		{ 0 , "buffer-hugepages",	"GLC_BUFFER_HUGEPAGES",		 "1"},
+		{ 0 , "buffer-prefault",	"GLC_BUFFER_PREFAULT",		 "1"},
+		{ 0 , "buffer-lock",		"GLC_BUFFER_LOCK",		 "1"},
+		{ 0 , "buffer-mirror",		"GLC_BUFFER_MIRROR",		 "1"},
 		{ 0 , NULL,			NULL,				NULL}
 	};
 
@@ -151,8 +204,12 @@ usage:
 	       "                                 %%min%%:     2-digit minute\n"
 	       "                                 %%sec%%:     2-digit second\n"
 	       "                               default value is %%app%%-%%pid%%-%%capture%%.glc\n"
+	       "                               tcp://HOST:PORT sends stream to glc-play\n"
+	       "                               listening there\n"
 	       "  -f, --fps=FPS              capture at FPS, default value is 30\n"
 	       "  -r, --resize=FACTOR        resize pictures with scale factor FACTOR\n"
+	       "      --resize-filter=FILTER 'bilinear', 'bicubic' or 'lanczos' resize,\n"
+	       "                               default is 'bilinear'\n"
 	       "  -c, --crop=WxH+X+Y         capture only [width]x[height][+[x][+[y]]]\n"
 	       "  -a, --record-audio=CONFIG  record specified alsa devices\n"
 	       "                               format is device,rate,channels;device2...\n"
@@ -163,15 +220,65 @@ usage:
 	       "                               supported, default hotkey is '<Shift>F8'\n"
 	       "      --reload=HOTKEY        reload hotkey, switches to next capture file\n"
 	       "                               default reload key is '<Shift>F9'\n"
+	       "      --replay=SEC           keep last SEC seconds in memory instead of\n"
+	       "                               writing to file\n"
+	       "      --replay-size=MiB      memory limit for replay, default is no limit\n"
+	       "      --replay-hotkey=HOTKEY save replay to next capture file, default\n"
+	       "                               replay key is '<Shift>F10'\n"
 	       "  -n, --lock-fps             lock fps when capturing\n"
+	       "      --pacing=METHOD        pace locked fps using 'sleep', 'hybrid'\n"
+	       "                               or 'vblank', default is 'sleep'\n"
 	       "      --pbo                  use GL_ARB_pixel_buffer_object if available\n"
+	       "      --pbo-count=N          number of PBOs per video stream, default is 3\n"
+	       "      --pbo-worker           map PBOs in a separate thread\n"
+	       "      --persistent-pbo       compress pictures straight from mapped PBOs\n"
+	       "      --gpu-convert          convert to '420jpeg' on GPU if supported\n"
+	       "      --gpu-scale            resize pictures on GPU before readback\n"
 	       "  -z, --compression=METHOD   compress stream using METHOD\n"
-	       "                               'none', 'quicklz' and 'lzo' are supported\n"
+	       "                               'none', 'quicklz', 'lzo', 'lzjb', 'lz4'\n"
+	       "                               and 'zstd' are supported\n"
+	       "                               'adaptive' picks one based on load\n"
 	       "                               'quicklz' is used by default\n"
+	       "      --compression-level=N  'zstd' compression level, default is 1\n"
+	       "                               negative 'lz4' level sets acceleration\n"
+	       "      --compression-headroom=N\n"
+	       "                             share of time 'adaptive' keeps compression\n"
+	       "                               threads idle, default is 0.15\n"
+	       "      --delta=N              write pictures as delta to previous picture\n"
+	       "                               with a key frame every N pictures\n"
+	       "      --delta-tiles          between key frames write only 64x64 tiles\n"
+	       "                               that changed, needs --delta\n"
+	       "      --audio-lpc            code audio losslessly instead of compressing\n"
+	       "      --compression-block=KiB\n"
+	       "                             compress large pictures in blocks of this\n"
+	       "                               size in parallel, 0 disables, uses --slices\n"
 	       "      --sync                 force synchronized write mode\n"
+	       "      --file-buffer=KiB      stream file write buffer size, default is 1024\n"
+	       "      --file-flush=MS        write buffered data at least this often,\n"
+	       "                               default is 1000, 0 writes only full buffers\n"
+	       "      --direct-io            write stream file with O_DIRECT\n"
+	       "      --io-uring=N           write with io_uring, N buffers in flight\n"
+	       "      --index-interval=MS    seek index entry interval, default is 1000,\n"
+	       "                               0 writes no index\n"
+	       "      --segment-size=MiB     start new file after this much data\n"
+	       "      --segment-time=SEC     start new file after this many seconds,\n"
+	       "                               '%%segment%%' in file name is segment number\n"
+	       "      --encode               encode with libavcodec while capturing\n"
+	       "                               instead of writing a glc stream\n"
+	       "      --encode-file=FILE     encoded file, container is chosen by extension\n"
+	       "                               default is %%app%%-%%pid%%-%%capture%%.mkv\n"
+	       "      --encoder=CODEC        video encoder, default is 'libx264'\n"
+	       "      --encode-preset=NAME   video encoder preset, f.ex. 'veryfast'\n"
+	       "      --encode-quality=CRF   constant quality, default is 23\n"
+	       "      --encode-bitrate=KBITS video bitrate instead of constant quality\n"
+	       "      --encode-threads=N     encoder threads, 0 picks automatically\n"
+	       "      --daemon=SOCKET        hand raw stream to glc-daemon listening\n"
+	       "                               at SOCKET instead of writing a file\n"
+	       "      --daemon-ring=MiB      shared memory ring size, default is 32 MiB\n"
 	       "      --byte-aligned         use GL_PACK_ALIGNMENT 1 instead of 8\n"
 	       "  -i, --draw-indicator       draw indicator when capturing\n"
 	       "                               indicator does not work with -b 'front'\n"
+	       "      --detect-repeat        write only a short message for repeated pictures\n"
 	       "  -v, --log=LEVEL            log >=LEVEL messages\n"
 	       "                               0: errors\n"
 	       "                               1: warnings\n"
@@ -179,8 +286,23 @@ usage:
 	       "                               3: information\n"
 	       "                               4: debug\n"
 	       "  -l, --log-file=FILE        write log to FILE, pid-%%d.log by default\n"
-	       "      --audio-skip           skip audio packets if buffer is full\n"
-	       "                               or capture thread is busy\n"
+	       "      --stats-file=FILE      write pipeline statistics to FILE\n"
+	       "      --stats-interval=SEC   pipeline statistics interval, default is 5\n"
+	       "      --stream-stats=SEC     write dropped frames and pipeline statistics\n"
+	       "                               into stream every SEC seconds, shown by\n"
+	       "                               glc-play -i, default is 1, 0 disables\n"
+	       "                               (GLC_STREAM_STATS=0 when preloading)\n"
+	       "      --control=SOCKET       accept stats queries and fps, compression\n"
+	       "                               and scale changes on unix socket\n"
+	       "                               SOCKET, %%d is replaced with pid\n"
+	       "      --audio-skip           don't warn about audio packets dropped\n"
+	       "                               when capture thread is busy\n"
+	       "      --audio-batch=MS       coalesce audio into MS long packets\n"
+	       "                               default is 20, 0 disables\n"
+	       "      --audio-batch-size=BYTES\n"
+	       "                             maximum audio packet size, default is 65536\n"
+	       "      --audio-batch-latency=MS\n"
+	       "                             maximum audio batching delay, default is 50\n"
 	       "      --disable-audio        don't capture audio\n"
 	       "      --sighandler           use custom signal handler\n"
 	       "  -g, --glfinish             capture at glFinish()\n"
@@ -193,8 +315,30 @@ usage:
 	       "                               default is 25 MiB\n"
 	       "      --unscaled=SIZE        unscaled picture stream buffer size in MiB,\n"
 	       "                               default is 25 MiB\n"
+	       "      --buffer-auto=MS       size stream buffers to hold MS milliseconds\n"
+	       "                               of pictures once window size is known,\n"
+	       "                               overrides sizes above\n"
+	       "      --cpus=LIST            run glc threads on CPUs in LIST, eg. '2-3'\n"
+	       "      --pack-cpus=LIST       run compression threads on CPUs in LIST\n"
+	       "      --file-cpus=LIST       run file writer thread on CPUs in LIST\n"
+	       "      --slices=N             split pictures into N slices processed\n"
+	       "                               in parallel when scaling or converting\n"
+	       "      --no-simd              scale and convert pictures with plain C\n"
+	       "                               loops instead of SSSE3/AVX2/NEON kernels\n"
+	       "      --sched=POLICY         glc thread scheduling policy, 'normal',\n"
+	       "                               'batch' or 'idle'\n"
+	       "      --nice=N               nice value for glc threads\n"
+	       "      --numa-node=NODE       allocate stream buffers on NUMA node NODE\n"
+	       "      --buffer-hugepages     back stream buffers with transparent hugepages\n"
+	       "      --buffer-prefault      touch stream buffers before capture starts\n"
+	       "      --buffer-lock          lock stream buffers into memory, limited\n"
+	       "                               by RLIMIT_MEMLOCK ('ulimit -l')\n"
+	       "      --buffer-mirror        keep captured pictures in a mirrored ring,\n"
+	       "                               uncompressed buffer holds references only\n"
 	       "  -V, --version              print glc version and exit\n"
-	       "  -h, --help                 show this help\n");
+	       "  -h, --help                 show this help\n"
+	       "Options are passed to capture library as GLC_* environment variables,\n"
+	       "see scripts/capture.sh for their names.\n");
 	return EXIT_FAILURE;
 }
 
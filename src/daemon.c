@@ -0,0 +1,296 @@
+/**
+ * \file daemon.c
+ * \brief capture daemon
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+
+#include <glc/common/glc.h>
+#include <glc/common/core.h>
+#include <glc/common/log.h>
+#include <glc/common/util.h>
+#include <glc/common/state.h>
+
+#include <glc/core/file.h>
+#include <glc/core/pack.h>
+#include <glc/core/ipc.h>
+
+struct daemon_s {
+	glc_t glc;
+
+	const char *socket_path;
+	const char *filename_format;
+	char *filename;
+	double fps;
+
+	int compression, compression_level;
+	size_t compressed_size, uncompressed_size;
+	int log_level;
+
+	ps_buffer_t uncompressed, compressed;
+	file_t file;
+	pack_t pack;
+	ipc_t ipc;
+};
+
+int daemon_parse_compression(struct daemon_s *daemon, const char *spec);
+int daemon_run(struct daemon_s *daemon);
+
+int main(int argc, char *argv[])
+{
+	struct daemon_s daemon;
+	int opt, option_index;
+
+	struct option long_options[] = {
+		{"out",			1, NULL, 'o'},
+		{"socket",		1, NULL, 's'},
+		{"compression",		1, NULL, 'z'},
+		{"fps",			1, NULL, 'f'},
+		{"compressed",		1, NULL, 'c'},
+		{"uncompressed",	1, NULL, 'u'},
+		{"verbosity",		1, NULL, 'v'},
+		{"help",		0, NULL, 'h'},
+		{"version",		0, NULL, 'V'},
+		{0, 0, 0, 0}
+	};
+	option_index = 0;
+
+	memset(&daemon, 0, sizeof(struct daemon_s));
+	daemon.socket_path = "/tmp/glc-daemon";
+	daemon.filename_format = "glc-daemon-%pid%-%capture%.glc";
+	daemon.fps = 30.0;
+
+	daemon.compression = PACK_LZ4;
+	daemon.compression_level = 1;
+
+	/* every client has its own ring, so these can be larger */
+	daemon.compressed_size = 50 * 1024 * 1024;
+	daemon.uncompressed_size = 50 * 1024 * 1024;
+
+	while ((opt = getopt_long(argc, argv, "o:s:z:f:c:u:v:hV",
+				  long_options, &option_index)) != -1) {
+		switch(opt) {
+		case 'o':
+			daemon.filename_format = optarg;
+			break;
+		case 's':
+			daemon.socket_path = optarg;
+			break;
+		case 'z':
+			if (daemon_parse_compression(&daemon, optarg))
+				goto usage;
+			break;
+		case 'f':
+			daemon.fps = atof(optarg);
+			if (daemon.fps <= 0)
+				goto usage;
+			break;
+		case 'c':
+			daemon.compressed_size = (size_t) atoi(optarg) * 1024 * 1024;
+			if (daemon.compressed_size <= 0)
+				goto usage;
+			break;
+		case 'u':
+			daemon.uncompressed_size = (size_t) atoi(optarg) * 1024 * 1024;
+			if (daemon.uncompressed_size <= 0)
+				goto usage;
+			break;
+		case 'v':
+			daemon.log_level = atoi(optarg);
+			if (daemon.log_level < 0)
+				goto usage;
+			break;
+		case 'V':
+			printf("glc version %s\n", glc_version());
+			return EXIT_SUCCESS;
+		case 'h':
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc)
+		goto usage;
+
+	glc_init(&daemon.glc);
+	glc_log_set_level(&daemon.glc, daemon.log_level);
+	glc_util_log_version(&daemon.glc);
+	glc_state_init(&daemon.glc);
+
+	if (daemon_run(&daemon))
+		return EXIT_FAILURE;
+
+	glc_state_destroy(&daemon.glc);
+	glc_destroy(&daemon.glc);
+
+	return EXIT_SUCCESS;
+
+usage:
+	printf("%s [option]...\n", argv[0]);
+	printf("  -o, --out=FILE           write stream to FILE\n"
+	       "                             default is glc-daemon-%%pid%%-%%capture%%.glc\n"
+	       "  -s, --socket=PATH        listen for glc-capture --daemon at PATH\n"
+	       "                             default is /tmp/glc-daemon\n"
+	       "  -z, --compression=CODEC  quicklz, lzo, lzjb, lz4 or zstd, optionally\n"
+	       "                             followed by :LEVEL, default is lz4\n"
+	       "  -f, --fps=FPS            stream fps, default is 30\n"
+	       "  -c, --compressed=SIZE    compressed stream buffer size in MiB\n"
+	       "                             default is 50 MiB\n"
+	       "  -u, --uncompressed=SIZE  uncompressed stream buffer size in MiB\n"
+	       "                             default is 50 MiB\n"
+	       "  -v, --verbosity=LEVEL    verbosity level\n"
+	       "  -V, --version            print glc version and exit\n"
+	       "  -h, --help               show help\n");
+
+	return EXIT_FAILURE;
+}
+
+int daemon_parse_compression(struct daemon_s *daemon, const char *spec)
+{
+	char name[16];
+	size_t len = strcspn(spec, ":");
+
+	if (len >= sizeof(name))
+		return EINVAL;
+	memcpy(name, spec, len);
+	name[len] = '\0';
+
+	if (!strcmp(name, "quicklz"))
+		daemon->compression = PACK_QUICKLZ;
+	else if (!strcmp(name, "lzo"))
+		daemon->compression = PACK_LZO;
+	else if (!strcmp(name, "lzjb"))
+		daemon->compression = PACK_LZJB;
+	else if (!strcmp(name, "lz4"))
+		daemon->compression = PACK_LZ4;
+	else if (!strcmp(name, "zstd"))
+		daemon->compression = PACK_ZSTD;
+	else
+		return EINVAL;
+
+	if (spec[len] == ':')
+		daemon->compression_level = atoi(&spec[len + 1]);
+	return 0;
+}
+
+int daemon_run(struct daemon_s *daemon)
+{
+	/*
+	 Daemon uses following pipeline:
+
+	 ipc -(uncompressed)->     one reader thread per client
+	 pack -(compressed)->      compresses in parallel
+	 file                      writes single stream file
+
+	 Clients come and go while daemon is running, each one only
+	 adds streams. SIGINT, SIGTERM or SIGHUP ends stream.
+	*/
+
+	ps_bufferattr_t attr;
+	glc_stream_info_t *stream_info;
+	char *info_name, *info_date;
+	sigset_t signals;
+	int ret, signum;
+
+	/* threads inherit mask, signals are taken with sigwait() */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGHUP);
+	if ((ret = pthread_sigmask(SIG_BLOCK, &signals, NULL)))
+		goto err;
+
+	if ((ret = ps_bufferattr_init(&attr)))
+		goto err;
+	if ((ret = ps_bufferattr_setsize(&attr, daemon->compressed_size)))
+		goto err;
+	if ((ret = ps_buffer_init(&daemon->compressed, &attr)))
+		goto err;
+	if ((ret = ps_bufferattr_setsize(&attr, daemon->uncompressed_size)))
+		goto err;
+	if ((ret = ps_buffer_init(&daemon->uncompressed, &attr)))
+		goto err;
+	if ((ret = ps_bufferattr_destroy(&attr)))
+		goto err;
+
+	/* stream info describes daemon, streams are named in log */
+	glc_util_info_fps(&daemon->glc, daemon->fps);
+	daemon->filename = glc_util_format_filename(daemon->filename_format, 0);
+
+	if ((ret = file_init(&daemon->file, &daemon->glc)))
+		goto err;
+	file_set_index(daemon->file, 1000000);
+	if ((ret = file_open_target(daemon->file, daemon->filename)))
+		goto err;
+	glc_util_info_create(&daemon->glc, &stream_info, &info_name, &info_date);
+	ret = file_write_info(daemon->file, stream_info, info_name, info_date);
+	free(stream_info);
+	free(info_name);
+	free(info_date);
+	if (ret)
+		goto err;
+
+	if ((ret = pack_init(&daemon->pack, &daemon->glc)))
+		goto err;
+	if ((ret = pack_set_compression(daemon->pack, daemon->compression)))
+		goto err;
+	if ((ret = pack_set_compression_level(daemon->pack, daemon->compression_level)))
+		goto err;
+	pack_set_stamp(daemon->pack, 1);
+
+	if ((ret = ipc_init(&daemon->ipc, &daemon->glc)))
+		goto err;
+	if ((ret = ipc_listen(daemon->ipc, daemon->socket_path)))
+		goto err;
+
+	if ((ret = file_write_process_start(daemon->file, &daemon->compressed)))
+		goto err;
+	if ((ret = pack_process_start(daemon->pack, &daemon->uncompressed, &daemon->compressed)))
+		goto err;
+	if ((ret = ipc_read_process_start(daemon->ipc, &daemon->uncompressed)))
+		goto err;
+
+	glc_log(&daemon->glc, GLC_INFORMATION, "glc-daemon",
+		 "writing %s, listening at %s", daemon->filename, daemon->socket_path);
+
+	if ((ret = sigwait(&signals, &signum)))
+		goto err;
+	glc_log(&daemon->glc, GLC_INFORMATION, "glc-daemon",
+		 "got signal %d, closing stream", signum);
+
+	/* clients still capturing are drained, not waited for */
+	if ((ret = ipc_read_process_stop(daemon->ipc)))
+		goto err;
+	if ((ret = glc_util_write_end_of_stream(&daemon->glc, &daemon->uncompressed)))
+		goto err;
+
+	pack_process_wait(daemon->pack);
+	file_write_process_wait(daemon->file);
+
+	/* writes index */
+	if ((ret = file_close_target(daemon->file)))
+		goto err;
+
+	ipc_destroy(daemon->ipc);
+	pack_destroy(daemon->pack);
+	file_destroy(daemon->file);
+	free(daemon->filename);
+
+	ps_buffer_destroy(&daemon->compressed);
+	ps_buffer_destroy(&daemon->uncompressed);
+
+	return 0;
+err:
+	glc_log(&daemon->glc, GLC_ERROR, "glc-daemon", "%s (%d)", strerror(ret), ret);
+	return ret;
+}
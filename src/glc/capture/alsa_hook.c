@@ -25,6 +25,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <sched.h>
+#include <time.h>
 
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
@@ -37,6 +38,23 @@
 #define ALSA_HOOK_CAPTURING    0x1
 #define ALSA_HOOK_ALLOW_SKIP   0x2
 
+/* ring holds this much audio */
+#define ALSA_HOOK_RING_MS      500
+/* but at least this many bytes */
+#define ALSA_HOOK_RING_MIN     (64 * 1024)
+/* and this many periods */
+#define ALSA_HOOK_RING_PERIODS 4
+/* latency cap is kept well below what ring can hold */
+#define ALSA_HOOK_BATCH_LATENCY_MAX (ALSA_HOOK_RING_MS * 1000 / 4)
+
+/**
+ * \brief audio chunk in ring, data follows
+ */
+struct alsa_hook_record_s {
+	glc_utime_t time;
+	size_t size;
+};
+
 struct alsa_hook_stream_s {
 	alsa_hook_t alsa_hook;
 	glc_state_audio_t state_audio;
@@ -50,6 +68,8 @@ struct alsa_hook_stream_s {
 
 	unsigned int channels;
 	unsigned int rate;
+	snd_pcm_uframes_t period_size;
+	size_t bytes_per_sec;
 	glc_flags_t flags;
 	int complex;
 
@@ -62,19 +82,25 @@ struct alsa_hook_stream_s {
 	sem_t capture_finished;
 	int capture_running;
 
-	/* for communicating with capture thread */
-	sem_t capture_empty, capture_full;
+	/* posted when ring gets data and thread is waiting */
+	sem_t capture_full;
+	int capture_waiting;
 
-	/* for locking access */
+	/* for locking configuration changes */
 	pthread_mutex_t write_mutex;
 	pthread_spinlock_t write_spinlock;
 
-	/* for busy waiting */
-	int capture_ready;
+	/*
+	 single-producer single-consumer ring, application writes
+	 at head and capture thread reads at tail. Positions only
+	 grow, ring_size is a power of two.
+	*/
+	char *ring;
+	size_t ring_size;
+	unsigned long ring_head, ring_tail;
 
-	char *capture_data;
-	size_t capture_size, capture_data_size;
-	glc_utime_t capture_time;
+	/* chunks dropped because ring was full */
+	unsigned long dropped, dropped_bytes, reported;
 
 	struct alsa_hook_stream_s *next;
 };
@@ -86,6 +112,10 @@ struct alsa_hook_s {
 
 	int started;
 
+	/* records are coalesced into packets up to these limits */
+	glc_utime_t batch_duration, batch_latency;
+	size_t batch_size;
+
 	struct alsa_hook_stream_s *stream;
 };
 
@@ -93,13 +123,24 @@ int alsa_hook_init_streams(alsa_hook_t alsa_hook);
 int alsa_hook_get_stream(alsa_hook_t alsa_hook, snd_pcm_t *pcm, struct alsa_hook_stream_s **stream);
 int alsa_hook_stream_init(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream);
 void *alsa_hook_mmap_pos(const snd_pcm_channel_area_t *area, snd_pcm_uframes_t offset);
-int alsa_hook_complex_to_interleaved(struct alsa_hook_stream_s *stream, const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames, char *to);
+int alsa_hook_complex_to_interleaved(struct alsa_hook_stream_s *stream, const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames);
 
-int alsa_hook_wait_for_thread(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream);
 int alsa_hook_lock_write(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream);
 int alsa_hook_unlock_write(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream);
-int alsa_hook_set_data_size(struct alsa_hook_stream_s *stream, size_t size);
 void *alsa_hook_thread(void *argptr);
+void alsa_hook_thread_stop(struct alsa_hook_stream_s *stream);
+
+int alsa_hook_ring_init(struct alsa_hook_stream_s *stream);
+int alsa_hook_ring_reserve(struct alsa_hook_stream_s *stream, size_t size);
+void alsa_hook_ring_put(struct alsa_hook_stream_s *stream, size_t offset,
+			const void *data, size_t size);
+void alsa_hook_ring_commit(struct alsa_hook_stream_s *stream, size_t size, glc_utime_t time);
+void alsa_hook_ring_get(struct alsa_hook_stream_s *stream, unsigned long pos,
+			void *to, size_t size);
+int alsa_hook_ring_send(struct alsa_hook_stream_s *stream, unsigned long pos,
+			unsigned long end, glc_utime_t time, size_t size);
+glc_utime_t alsa_hook_duration(struct alsa_hook_stream_s *stream, size_t size);
+void alsa_hook_report_dropped(struct alsa_hook_stream_s *stream);
 
 glc_audio_format_t pcm_fmt_to_glc_fmt(snd_pcm_format_t pcm_fmt);
 
@@ -132,6 +173,25 @@ int alsa_hook_allow_skip(alsa_hook_t alsa_hook, int allow_skip)
 	return 0;
 }
 
+int alsa_hook_set_batch(alsa_hook_t alsa_hook, glc_utime_t duration,
+			size_t size, glc_utime_t latency)
+{
+	if (alsa_hook->started)
+		return EALREADY;
+
+	if (latency > ALSA_HOOK_BATCH_LATENCY_MAX) {
+		glc_log(alsa_hook->glc, GLC_WARNING, "alsa_hook",
+			"batch latency cap limited to %d ms",
+			ALSA_HOOK_BATCH_LATENCY_MAX / 1000);
+		latency = ALSA_HOOK_BATCH_LATENCY_MAX;
+	}
+
+	alsa_hook->batch_duration = duration;
+	alsa_hook->batch_size = size;
+	alsa_hook->batch_latency = latency;
+	return 0;
+}
+
 int alsa_hook_start(alsa_hook_t alsa_hook)
 {
 	if (!alsa_hook->to) {
@@ -167,6 +227,20 @@ int alsa_hook_stop(alsa_hook_t alsa_hook)
 	return 0;
 }
 
+int alsa_hook_dropped(alsa_hook_t alsa_hook, unsigned long *chunks, unsigned long *bytes)
+{
+	struct alsa_hook_stream_s *stream = __atomic_load_n(&alsa_hook->stream, __ATOMIC_ACQUIRE);
+
+	*chunks = *bytes = 0;
+	while (stream != NULL) {
+		*chunks += __atomic_load_n(&stream->dropped, __ATOMIC_RELAXED);
+		*bytes += __atomic_load_n(&stream->dropped_bytes, __ATOMIC_RELAXED);
+		stream = stream->next;
+	}
+
+	return 0;
+}
+
 int alsa_hook_init_streams(alsa_hook_t alsa_hook)
 {
 	struct alsa_hook_stream_s *stream = alsa_hook->stream;
@@ -199,25 +273,17 @@ int alsa_hook_destroy(alsa_hook_t alsa_hook)
 		del = alsa_hook->stream;
 		alsa_hook->stream = alsa_hook->stream->next;
 
-		if (del->capture_running) {
-			del->capture_running = 0;
-
-			/* tell thread to quit */
-			sem_post(&del->capture_full);
-
-			sem_wait(&del->capture_finished);
-		}
+		if (del->capture_running)
+			alsa_hook_thread_stop(del);
 
 		sem_destroy(&del->capture_finished);
-
 		sem_destroy(&del->capture_full);
-		sem_destroy(&del->capture_empty);
 
 		pthread_mutex_destroy(&del->write_mutex);
 		pthread_spin_destroy(&del->write_spinlock);
 
-		if (del->capture_data)
-			free(del->capture_data);
+		if (del->ring)
+			free(del->ring);
 		if (del->initialized)
 			ps_packet_destroy(&del->packet);
 		free(del);
@@ -260,15 +326,15 @@ int alsa_hook_get_stream(alsa_hook_t alsa_hook, snd_pcm_t *pcm, struct alsa_hook
 		sem_init(&find->capture_finished, 0, 0);
 
 		sem_init(&find->capture_full, 0, 0);
-		sem_init(&find->capture_empty, 0, 1);
 
 		pthread_mutex_init(&find->write_mutex, NULL);
 		pthread_spin_init(&find->write_spinlock, 0);
 
 		find->alsa_hook = alsa_hook;
 
+		/* alsa_hook_dropped() walks the list without locks */
 		find->next = alsa_hook->stream;
-		alsa_hook->stream = find;
+		__atomic_store_n(&alsa_hook->stream, find, __ATOMIC_RELEASE);
 	}
 
 	*stream = find;
@@ -278,68 +344,272 @@ int alsa_hook_get_stream(alsa_hook_t alsa_hook, snd_pcm_t *pcm, struct alsa_hook
 void *alsa_hook_thread(void *argptr)
 {
 	struct alsa_hook_stream_s *stream = (struct alsa_hook_stream_s *) argptr;
-	glc_audio_data_header_t hdr;
+	alsa_hook_t alsa_hook = stream->alsa_hook;
+	struct alsa_hook_record_s record, first;
+	unsigned long head, tail, end;
+	size_t size;
+	glc_utime_t now, duration;
+	struct timespec ts;
+	int ret = 0, full, running;
+
+	tail = stream->ring_tail;
+	while (1) {
+		running = __atomic_load_n(&stream->capture_running, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&stream->ring_head, __ATOMIC_ACQUIRE);
+
+		/*
+		 collect committed records into a batch. Records stay in
+		 ring until batch is sent, so nothing is copied here.
+		*/
+		end = tail;
+		size = 0;
+		full = 0;
+		while (end != head) {
+			alsa_hook_ring_get(stream, end, &record, sizeof(struct alsa_hook_record_s));
+
+			if (end == tail)
+				first = record;
+			else if (((alsa_hook->batch_size) &&
+				  (size + record.size > alsa_hook->batch_size)) ||
+				 (alsa_hook_duration(stream, size + record.size) >
+				  alsa_hook->batch_duration) ||
+				 (record.time > first.time + alsa_hook_duration(stream, size) +
+						alsa_hook->batch_latency)) {
+				/* over limits or not continuous with batch */
+				full = 1;
+				break;
+			}
+
+			size += record.size;
+			end += sizeof(struct alsa_hook_record_s) + record.size;
+
+			duration = alsa_hook_duration(stream, size);
+			if ((duration >= alsa_hook->batch_duration) ||
+			    ((alsa_hook->batch_size) && (size >= alsa_hook->batch_size))) {
+				full = 1;
+				break;
+			}
+		}
+
+		if (end != tail) {
+			now = glc_state_time(alsa_hook->glc);
+			if ((full) || (!running) ||
+			    (now >= first.time + alsa_hook->batch_latency)) {
+				if ((ret = alsa_hook_ring_send(stream, tail, end, first.time, size)))
+					goto err;
+
+				tail = end;
+				/* space is given back batch by batch */
+				__atomic_store_n(&stream->ring_tail, tail, __ATOMIC_RELEASE);
+				alsa_hook_report_dropped(stream);
+				continue;
+			}
+		} else if (!running)
+			break; /* everything is sent before quitting */
+
+		/* producer posts only if it sees us waiting */
+		__atomic_store_n(&stream->capture_waiting, 1, __ATOMIC_SEQ_CST);
+		if ((__atomic_load_n(&stream->ring_head, __ATOMIC_SEQ_CST) == head) &&
+		    (__atomic_load_n(&stream->capture_running, __ATOMIC_SEQ_CST))) {
+			if (end == tail)
+				sem_wait(&stream->capture_full);
+			else {
+				/* partial batch is sent when latency cap is reached */
+				clock_gettime(CLOCK_REALTIME, &ts);
+				duration = first.time + alsa_hook->batch_latency - now;
+				ts.tv_sec += duration / 1000000;
+				ts.tv_nsec += (duration % 1000000) * 1000;
+				if (ts.tv_nsec >= 1000000000) {
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000;
+				}
+				sem_timedwait(&stream->capture_full, &ts);
+			}
+		}
+		__atomic_store_n(&stream->capture_waiting, 0, __ATOMIC_SEQ_CST);
+	}
+
+	alsa_hook_report_dropped(stream);
+	sem_post(&stream->capture_finished);
+	return NULL;
+err:
+	glc_log(stream->alsa_hook->glc, GLC_ERROR, "alsa_hook",
+		"thread failed: %s (%d)", strerror(ret), ret);
+	sem_post(&stream->capture_finished);
+	return NULL;
+}
+
+void alsa_hook_thread_stop(struct alsa_hook_stream_s *stream)
+{
+	__atomic_store_n(&stream->capture_running, 0, __ATOMIC_SEQ_CST);
+
+	/* tell thread to quit */
+	sem_post(&stream->capture_full);
+	sem_wait(&stream->capture_finished);
+	pthread_join(stream->capture_thread, NULL);
+}
+
+int alsa_hook_ring_send(struct alsa_hook_stream_s *stream, unsigned long pos,
+			unsigned long end, glc_utime_t time, size_t size)
+{
 	glc_message_header_t msg_hdr;
-	int ret = 0;
+	glc_audio_data_header_t hdr;
+	struct alsa_hook_record_s record;
+	size_t start, first;
+	int ret;
 
 	msg_hdr.type = GLC_MESSAGE_AUDIO_DATA;
 	hdr.id = stream->id;
+	hdr.time = time; /* first sample of batch */
+	hdr.size = size;
 
-	stream->capture_ready = 1;
-	while (1) {
-		sem_wait(&stream->capture_full);
-		stream->capture_ready = 0;
+	if ((ret = ps_packet_open(&stream->packet, PS_PACKET_WRITE)))
+		return ret;
+	if ((ret = ps_packet_write(&stream->packet, &msg_hdr, sizeof(glc_message_header_t))))
+		return ret;
+	if ((ret = ps_packet_write(&stream->packet, &hdr, sizeof(glc_audio_data_header_t))))
+		return ret;
 
-		if (!stream->capture_running)
-			break;
+	/* data is written straight from ring, in two parts if it wraps */
+	while (pos != end) {
+		alsa_hook_ring_get(stream, pos, &record, sizeof(struct alsa_hook_record_s));
+		pos += sizeof(struct alsa_hook_record_s);
+
+		start = pos & (stream->ring_size - 1);
+		first = stream->ring_size - start;
+		if (first > record.size)
+			first = record.size;
+
+		if ((ret = ps_packet_write(&stream->packet, &stream->ring[start], first)))
+			return ret;
+		if ((record.size > first) &&
+		    (ret = ps_packet_write(&stream->packet, stream->ring, record.size - first)))
+			return ret;
+		pos += record.size;
+	}
 
-		hdr.time = stream->capture_time;
-		hdr.size = stream->capture_size;
+	return ps_packet_close(&stream->packet);
+}
 
-		if ((ret = ps_packet_open(&stream->packet, PS_PACKET_WRITE)))
-			break;
-		if ((ret = ps_packet_write(&stream->packet, &msg_hdr, sizeof(glc_message_header_t))))
-			break;
-		if ((ret = ps_packet_write(&stream->packet, &hdr, sizeof(glc_audio_data_header_t))))
-			break;
-		if ((ret = ps_packet_write(&stream->packet, stream->capture_data, hdr.size)))
-			break;
-		if ((ret = ps_packet_close(&stream->packet)))
-			break;
+glc_utime_t alsa_hook_duration(struct alsa_hook_stream_s *stream, size_t size)
+{
+	return (glc_utime_t) size * 1000000 / stream->bytes_per_sec;
+}
 
-		if (!(stream->mode & SND_PCM_ASYNC))
-			sem_post(&stream->capture_empty);
-		stream->capture_ready = 1;
-	}
+void alsa_hook_report_dropped(struct alsa_hook_stream_s *stream)
+{
+	unsigned long dropped = __atomic_load_n(&stream->dropped, __ATOMIC_RELAXED);
 
-	if (ret != 0)
-		glc_log(stream->alsa_hook->glc, GLC_ERROR, "alsa_hook",
-			"thread failed: %s (%d)", strerror(ret), ret);
+	if (dropped == stream->reported)
+		return;
 
-	sem_post(&stream->capture_finished);
-	return NULL;
+	glc_log(stream->alsa_hook->glc,
+		stream->alsa_hook->flags & ALSA_HOOK_ALLOW_SKIP ? GLC_DEBUG : GLC_WARNING,
+		"alsa_hook", "stream %d: dropped %lu audio chunks (%lu bytes total), "
+		"capture thread not ready", stream->id, dropped - stream->reported,
+		__atomic_load_n(&stream->dropped_bytes, __ATOMIC_RELAXED));
+	stream->reported = dropped;
 }
 
-int alsa_hook_wait_for_thread(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream)
+int alsa_hook_ring_init(struct alsa_hook_stream_s *stream)
 {
-	if (stream->mode & SND_PCM_ASYNC) {
-		/**
-		* \note this is ugly, but snd_pcm_...() functions can be called from
-		*       signal handler (f.ex. async mode)
-		*/
-		while (!stream->capture_ready) {
-			if (alsa_hook->flags & ALSA_HOOK_ALLOW_SKIP)
-				goto busy;
-			sched_yield();
-		}
-	} else
-		sem_wait(&stream->capture_empty);
+	size_t want, size;
+
+	want = snd_pcm_frames_to_bytes(stream->pcm, stream->rate * ALSA_HOOK_RING_MS / 1000);
+	if (want < snd_pcm_frames_to_bytes(stream->pcm,
+					   stream->period_size * ALSA_HOOK_RING_PERIODS))
+		want = snd_pcm_frames_to_bytes(stream->pcm,
+					       stream->period_size * ALSA_HOOK_RING_PERIODS);
+
+	size = ALSA_HOOK_RING_MIN;
+	while (size < want)
+		size <<= 1;
+
+	stream->bytes_per_sec = snd_pcm_frames_to_bytes(stream->pcm, stream->rate);
+	stream->ring_head = stream->ring_tail = 0;
+	if (size == stream->ring_size)
+		return 0;
+
+	if (stream->ring)
+		free(stream->ring);
+	stream->ring_size = 0;
+	if (!(stream->ring = (char *) malloc(size)))
+		return ENOMEM;
+	stream->ring_size = size;
+
+	return 0;
+}
+
+int alsa_hook_ring_reserve(struct alsa_hook_stream_s *stream, size_t size)
+{
+	unsigned long tail = __atomic_load_n(&stream->ring_tail, __ATOMIC_ACQUIRE);
+
+	/* application is never blocked, chunk is dropped instead */
+	if (sizeof(struct alsa_hook_record_s) + size >
+	    stream->ring_size - (stream->ring_head - tail)) {
+		__atomic_add_fetch(&stream->dropped_bytes, size, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stream->dropped, 1, __ATOMIC_RELAXED);
+		return EBUSY;
+	}
 
 	return 0;
-busy:
-	glc_log(alsa_hook->glc, GLC_WARNING, "alsa_hook",
-		 "dropped audio data, capture thread not ready");
-	return EBUSY;
+}
+
+void alsa_hook_ring_put(struct alsa_hook_stream_s *stream, size_t offset,
+			const void *data, size_t size)
+{
+	size_t start, first;
+
+	start = (stream->ring_head + sizeof(struct alsa_hook_record_s) + offset) &
+		(stream->ring_size - 1);
+	first = stream->ring_size - start;
+	if (first > size)
+		first = size;
+
+	memcpy(&stream->ring[start], data, first);
+	if (size > first)
+		memcpy(stream->ring, &((const char *) data)[first], size - first);
+}
+
+void alsa_hook_ring_commit(struct alsa_hook_stream_s *stream, size_t size, glc_utime_t time)
+{
+	struct alsa_hook_record_s record;
+	size_t start, first;
+
+	record.time = time;
+	record.size = size;
+
+	start = stream->ring_head & (stream->ring_size - 1);
+	first = stream->ring_size - start;
+	if (first > sizeof(struct alsa_hook_record_s))
+		first = sizeof(struct alsa_hook_record_s);
+	memcpy(&stream->ring[start], &record, first);
+	if (first < sizeof(struct alsa_hook_record_s))
+		memcpy(stream->ring, &((char *) &record)[first],
+		       sizeof(struct alsa_hook_record_s) - first);
+
+	__atomic_store_n(&stream->ring_head,
+			 stream->ring_head + sizeof(struct alsa_hook_record_s) + size,
+			 __ATOMIC_SEQ_CST);
+
+	/* sem_post() is safe in signal handlers and never blocks */
+	if (__atomic_exchange_n(&stream->capture_waiting, 0, __ATOMIC_SEQ_CST))
+		sem_post(&stream->capture_full);
+}
+
+void alsa_hook_ring_get(struct alsa_hook_stream_s *stream, unsigned long pos,
+			void *to, size_t size)
+{
+	size_t start, first;
+
+	start = pos & (stream->ring_size - 1);
+	first = stream->ring_size - start;
+	if (first > size)
+		first = size;
+
+	memcpy(to, &stream->ring[start], first);
+	if (size > first)
+		memcpy(&((char *) to)[first], stream->ring, size - first);
 }
 
 int alsa_hook_lock_write(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream)
@@ -362,25 +632,6 @@ int alsa_hook_unlock_write(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *str
 	return ret;
 }
 
-int alsa_hook_set_data_size(struct alsa_hook_stream_s *stream, size_t size)
-{
-	stream->capture_size = size;
-	if (size <= stream->capture_data_size)
-		return 0;
-
-	stream->capture_data_size = size;
-
-	if (stream->capture_data)
-		stream->capture_data = (char *) realloc(stream->capture_data, stream->capture_data_size);
-	else
-		stream->capture_data = (char *) malloc(stream->capture_data_size);
-
-	if (!stream->capture_data)
-		return ENOMEM;
-
-	return 0;
-}
-
 int alsa_hook_open(alsa_hook_t alsa_hook, snd_pcm_t *pcm, const char *name,
 			 snd_pcm_stream_t pcm_stream, int mode)
 {
@@ -415,78 +666,60 @@ int alsa_hook_writei(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 		     const void *buffer, snd_pcm_uframes_t size)
 {
 	struct alsa_hook_stream_s *stream;
-	int ret = 0;
+	glc_utime_t time;
+	size_t bytes;
+	int ret;
 
 	if (!(alsa_hook->flags & ALSA_HOOK_CAPTURING))
 		return 0;
 
 	alsa_hook_get_stream(alsa_hook, pcm, &stream);
 
-	if (!stream->initialized) {
-		ret = EINVAL;
-		goto unlock;
-	}
+	if (!stream->initialized)
+		return EINVAL;
 
-	if ((ret = alsa_hook_lock_write(alsa_hook, stream)))
+	time = glc_state_time(alsa_hook->glc);
+	bytes = snd_pcm_frames_to_bytes(pcm, size);
+	if ((ret = alsa_hook_ring_reserve(stream, bytes)))
 		return ret;
 
-	if ((ret = alsa_hook_wait_for_thread(alsa_hook, stream)))
-		goto unlock;
-
-	if ((ret = alsa_hook_set_data_size(stream, snd_pcm_frames_to_bytes(pcm, size))))
-		goto unlock;
-
-	stream->capture_time = glc_state_time(alsa_hook->glc);
-	memcpy(stream->capture_data, buffer, stream->capture_size);
-	sem_post(&stream->capture_full);
-
-unlock:
-	alsa_hook_unlock_write(alsa_hook, stream);
-	return ret;
+	alsa_hook_ring_put(stream, 0, buffer, bytes);
+	alsa_hook_ring_commit(stream, bytes, time);
+	return 0;
 }
 
 int alsa_hook_writen(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 		     void **bufs, snd_pcm_uframes_t size)
 {
 	struct alsa_hook_stream_s *stream;
-	int c, ret = 0;
+	glc_utime_t time;
+	size_t bytes;
+	int c, ret;
 
 	if (!(alsa_hook->flags & ALSA_HOOK_CAPTURING))
 		return 0;
 
 	alsa_hook_get_stream(alsa_hook, pcm, &stream);
 
-	if (!stream->initialized) {
-		ret = EINVAL;
-		goto unlock;
-	}
-
-	if ((ret = alsa_hook_lock_write(alsa_hook, stream)))
-		return ret;
+	if (!stream->initialized)
+		return EINVAL;
 
 	if (stream->flags & GLC_AUDIO_INTERLEAVED) {
 		glc_log(alsa_hook->glc, GLC_ERROR, "alsa_hook",
 			 "stream format (interleaved) incompatible with snd_pcm_writen()");
-		ret = EINVAL;
-		goto unlock;
+		return EINVAL;
 	}
 
-	if ((ret = alsa_hook_wait_for_thread(alsa_hook, stream)))
-		goto unlock;
-
-	if ((ret = alsa_hook_set_data_size(stream, snd_pcm_frames_to_bytes(pcm, size))))
-		goto unlock;
+	time = glc_state_time(alsa_hook->glc);
+	if ((ret = alsa_hook_ring_reserve(stream, snd_pcm_frames_to_bytes(pcm, size))))
+		return ret;
 
-	stream->capture_time = glc_state_time(alsa_hook->glc);
+	bytes = snd_pcm_samples_to_bytes(pcm, size);
 	for (c = 0; c < stream->channels; c++)
-		memcpy(&stream->capture_data[c * snd_pcm_samples_to_bytes(pcm, size)], bufs[c],
-		       snd_pcm_samples_to_bytes(pcm, size));
-
-	sem_post(&stream->capture_full);
+		alsa_hook_ring_put(stream, c * bytes, bufs[c], bytes);
 
-unlock:
-	alsa_hook_unlock_write(alsa_hook, stream);
-	return ret;
+	alsa_hook_ring_commit(stream, snd_pcm_frames_to_bytes(pcm, size), time);
+	return 0;
 }
 
 int alsa_hook_mmap_begin(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
@@ -501,10 +734,8 @@ int alsa_hook_mmap_begin(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 
 	alsa_hook_get_stream(alsa_hook, pcm, &stream);
 
-	if (!stream->initialized) {
-		alsa_hook_unlock_write(alsa_hook, stream);
+	if (!stream->initialized)
 		return EINVAL;
-	}
 
 	if ((ret = alsa_hook_lock_write(alsa_hook, stream)))
 		return ret;
@@ -521,58 +752,49 @@ int alsa_hook_mmap_commit(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 				snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
 {
 	struct alsa_hook_stream_s *stream;
+	glc_utime_t time;
 	unsigned int c;
-	int ret = 0;
+	size_t bytes;
+	int ret;
 
 	if (!(alsa_hook->flags & ALSA_HOOK_CAPTURING))
 		return 0;
 
 	alsa_hook_get_stream(alsa_hook, pcm, &stream);
 
-	if ((ret = alsa_hook_lock_write(alsa_hook, stream)))
-		return ret;
-
-	if (stream->channels == 0)
-		goto unlock; /* 0 channels :P */
+	if ((!stream->initialized) || (stream->channels == 0))
+		return 0; /* 0 channels :P */
 
 	if (!stream->mmap_areas) {
 		/* this might actually happen */
 		glc_log(alsa_hook->glc, GLC_WARNING, "alsa_hook",
 			 "snd_pcm_mmap_commit() before snd_pcm_mmap_begin()");
-		return EINVAL; /* not locked */
+		return EINVAL;
 	}
 
 	if (offset != stream->offset)
 		glc_log(alsa_hook->glc, GLC_WARNING, "alsa_hook",
 			 "offset=%lu != stream->offset=%lu", offset, stream->offset);
 
-	if ((ret = alsa_hook_wait_for_thread(alsa_hook, stream)))
-		goto unlock;
-
-	if ((ret = alsa_hook_set_data_size(stream, snd_pcm_frames_to_bytes(pcm, frames))))
-		goto unlock;
-
-	stream->capture_time = glc_state_time(alsa_hook->glc);
+	time = glc_state_time(alsa_hook->glc);
+	if ((ret = alsa_hook_ring_reserve(stream, snd_pcm_frames_to_bytes(pcm, frames))))
+		return ret;
 
 	if (stream->flags & GLC_AUDIO_INTERLEAVED) {
-		memcpy(stream->capture_data,
-		       alsa_hook_mmap_pos(stream->mmap_areas, offset),
-		       stream->capture_size);
+		alsa_hook_ring_put(stream, 0, alsa_hook_mmap_pos(stream->mmap_areas, offset),
+				   snd_pcm_frames_to_bytes(pcm, frames));
 	} else if (stream->complex) {
-		alsa_hook_complex_to_interleaved(stream, stream->mmap_areas, offset,
-		                                  frames, stream->capture_data);
+		alsa_hook_complex_to_interleaved(stream, stream->mmap_areas, offset, frames);
 	} else {
+		bytes = snd_pcm_samples_to_bytes(pcm, frames);
 		for (c = 0; c < stream->channels; c++)
-			memcpy(&stream->capture_data[c * snd_pcm_samples_to_bytes(stream->pcm, frames)],
-			       alsa_hook_mmap_pos(&stream->mmap_areas[c], offset),
-			       snd_pcm_samples_to_bytes(stream->pcm, frames));
+			alsa_hook_ring_put(stream, c * bytes,
+					   alsa_hook_mmap_pos(&stream->mmap_areas[c], offset),
+					   bytes);
 	}
 
-	sem_post(&stream->capture_full);
-
-unlock:
-	alsa_hook_unlock_write(alsa_hook, stream);
-	return ret;
+	alsa_hook_ring_commit(stream, snd_pcm_frames_to_bytes(pcm, frames), time);
+	return 0;
 }
 
 void *alsa_hook_mmap_pos(const snd_pcm_channel_area_t *area, snd_pcm_uframes_t offset)
@@ -583,7 +805,7 @@ void *alsa_hook_mmap_pos(const snd_pcm_channel_area_t *area, snd_pcm_uframes_t o
 	return addr;
 }
 
-int alsa_hook_complex_to_interleaved(struct alsa_hook_stream_s *stream, const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames, char *to)
+int alsa_hook_complex_to_interleaved(struct alsa_hook_stream_s *stream, const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
 {
 	/** \todo test this... :D */
 	/** \note this is quite expensive operation */
@@ -594,9 +816,10 @@ int alsa_hook_complex_to_interleaved(struct alsa_hook_stream_s *stream, const sn
 	ssize = snd_pcm_samples_to_bytes(stream->pcm, 1);
 
 	for (c = 0; c < stream->channels; c++) {
-		off = add * c;
+		off = ssize * c;
 		for (s = 0; s < frames; s++) {
-			memcpy(&to[off], alsa_hook_mmap_pos(&areas[c], offset + s), ssize);
+			alsa_hook_ring_put(stream, off, alsa_hook_mmap_pos(&areas[c], offset + s),
+					   ssize);
 			off += add;
 		}
 	}
@@ -638,6 +861,7 @@ int alsa_hook_hw_params(alsa_hook_t alsa_hook, snd_pcm_t *pcm, snd_pcm_hw_params
 		goto err;
 	if ((ret = snd_pcm_hw_params_get_period_size(params, &period_size, NULL)) < 0)
 		goto err;
+	stream->period_size = period_size;
 	if ((ret = snd_pcm_hw_params_get_access(params, &access)) < 0)
 		goto err;
 	if ((access == SND_PCM_ACCESS_RW_INTERLEAVED) | (access == SND_PCM_ACCESS_MMAP_INTERLEAVED))
@@ -678,10 +902,15 @@ int alsa_hook_stream_init(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stre
 {
 	glc_message_header_t msg_hdr;
 	glc_audio_format_message_t fmt_msg;
+	int initialized, ret;
 
 	if (!stream->fmt)
 		return EINVAL;
 
+	/* writes are ignored while ring is replaced */
+	initialized = stream->initialized;
+	__atomic_store_n(&stream->initialized, 0, __ATOMIC_SEQ_CST);
+
 	/* we need proper id for the stream */
 	if (stream->id < 1)
 		glc_state_audio_new(alsa_hook->glc, &stream->id, &stream->state_audio);
@@ -689,8 +918,12 @@ int alsa_hook_stream_init(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stre
 	glc_log(alsa_hook->glc, GLC_INFORMATION, "alsa_hook",
 		 "%p: initializing stream %d", stream->pcm, stream->id);
 
+	/* old thread sends what it has before format changes */
+	if (stream->capture_running)
+		alsa_hook_thread_stop(stream);
+
 	/* init packet */
-	if (stream->initialized)
+	if (initialized)
 		ps_packet_destroy(&stream->packet);
 	ps_packet_init(&stream->packet, alsa_hook->to);
 
@@ -706,17 +939,17 @@ int alsa_hook_stream_init(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stre
 	ps_packet_write(&stream->packet, &fmt_msg, sizeof(glc_audio_format_message_t));
 	ps_packet_close(&stream->packet);
 
-	if (stream->capture_running) {
-		/* kill old thread */
-		stream->capture_running = 0;
-		sem_post(&stream->capture_full);
-		sem_wait(&stream->capture_finished);
+	if ((ret = alsa_hook_ring_init(stream))) {
+		glc_log(alsa_hook->glc, GLC_ERROR, "alsa_hook",
+			 "%p: can't allocate ring: %s (%d)", stream->pcm, strerror(ret), ret);
+		ps_packet_destroy(&stream->packet);
+		return ret;
 	}
 
 	stream->capture_running = 1;
 	pthread_create(&stream->capture_thread, NULL, alsa_hook_thread, stream);
 
-	stream->initialized = 1;
+	__atomic_store_n(&stream->initialized, 1, __ATOMIC_SEQ_CST);
 	return 0;
 }
 
@@ -42,14 +42,39 @@ __PUBLIC int alsa_hook_init(alsa_hook_t *alsa_hook, glc_t *glc);
 /**
  * \brief allow audio skipping in some cases
  *
- * If audio_skip is enabled, alsa_hook may skip some audio data
- * if buffer is not ready and pcm is opened in asynchronous mode.
+ * Application hands audio to capture thread through a ring
+ * that holds about half a second of audio. If ring is full,
+ * chunk is dropped instead of blocking the application. Drops
+ * are counted and logged as warnings unless audio_skip is
+ * enabled.
  * \param alsa_hook alsa_hook object
  * \param allow_skip 1 allows skipping, 0 disallows
  * \return 0 on success otherwise an error code
  */
 __PUBLIC int alsa_hook_allow_skip(alsa_hook_t alsa_hook, int allow_skip);
 
+/**
+ * \brief set audio batching
+ *
+ * Capture thread coalesces consecutive chunks into one
+ * audio data packet until batch holds duration worth of
+ * audio or size bytes. Partial batch is sent when its first
+ * sample is older than latency. Packet timestamp is that of
+ * first sample in batch. Chunks that don't follow previous
+ * one within latency start a new batch.
+ *
+ * By default batching is disabled and every chunk
+ * is sent as its own packet. Latency is limited to
+ * a quarter of ring size.
+ * \param alsa_hook alsa_hook object
+ * \param duration batch duration in microseconds, 0 disables
+ * \param size maximum batch size in bytes, 0 is unlimited
+ * \param latency maximum delay for first sample in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int alsa_hook_set_batch(alsa_hook_t alsa_hook, glc_utime_t duration,
+				 size_t size, glc_utime_t latency);
+
 /**
  * \brief set target buffer
  * \param alsa_hook alsa_hook object
@@ -72,6 +97,18 @@ __PUBLIC int alsa_hook_start(alsa_hook_t alsa_hook);
  */
 __PUBLIC int alsa_hook_stop(alsa_hook_t alsa_hook);
 
+/**
+ * \brief audio dropped because capture thread was not ready
+ *
+ * Safe to call from any thread.
+ * \param alsa_hook alsa_hook object
+ * \param chunks returned number of dropped chunks
+ * \param bytes returned number of dropped bytes
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int alsa_hook_dropped(alsa_hook_t alsa_hook, unsigned long *chunks,
+			       unsigned long *bytes);
+
 /**
  * \brief destroy alsa_hook object
  * \param alsa_hook alsa_hook object
@@ -43,9 +43,22 @@ struct audio_capture_s {
 	glc_state_audio_t state_audio;
 
 	glc_utime_t time;
+
+	/* pending batch, timestamp is for its first sample */
+	char *batch;
+	size_t batch_fill, batch_capacity;
+	glc_utime_t batch_time;
+
+	glc_utime_t batch_duration, batch_latency;
+	size_t batch_max;
 };
 
 int audio_capture_write_cfg(audio_capture_t audio_capture);
+int audio_capture_write(audio_capture_t audio_capture, glc_utime_t time,
+			void *data, size_t size);
+int audio_capture_batch(audio_capture_t audio_capture, glc_utime_t time,
+			void *data, size_t size);
+glc_utime_t audio_capture_duration(audio_capture_t audio_capture, size_t size);
 
 int audio_capture_init(audio_capture_t *audio_capture, glc_t *glc)
 {
@@ -62,6 +75,8 @@ int audio_capture_destroy(audio_capture_t audio_capture)
 	if (audio_capture->target)
 		ps_packet_destroy(&audio_capture->packet);
 
+	if (audio_capture->batch)
+		free(audio_capture->batch);
 	free(audio_capture);
 	return 0;
 }
@@ -141,6 +156,21 @@ int audio_capture_ignore_time(audio_capture_t audio_capture, int ignore_time)
 	return 0;
 }
 
+int audio_capture_set_batch(audio_capture_t audio_capture, glc_utime_t duration,
+			    size_t size, glc_utime_t latency)
+{
+	int ret;
+
+	/* pending data is sent with old limits */
+	if ((ret = audio_capture_flush(audio_capture)))
+		return ret;
+
+	audio_capture->batch_duration = duration;
+	audio_capture->batch_max = size;
+	audio_capture->batch_latency = latency;
+	return 0;
+}
+
 size_t audio_capture_samples_to_bytes(audio_capture_t audio_capture,
 				      unsigned int samples)
 {
@@ -187,6 +217,7 @@ int audio_capture_stop(audio_capture_t audio_capture)
 	if (!(audio_capture->flags & AUDIO_CAPTURE_CAPTURING))
 		return EAGAIN;
 
+	audio_capture_flush(audio_capture);
 	audio_capture->flags &= ~AUDIO_CAPTURE_CAPTURING;
 	return 0;
 }
@@ -233,14 +264,16 @@ err:
 int audio_capture_data(audio_capture_t audio_capture,
 		       void *data, size_t size)
 {
-	glc_message_header_t msg_hdr;
-	glc_audio_data_header_t audio_hdr;
-
+	glc_utime_t time;
 	int ret;
+
 	if (!(audio_capture->flags & AUDIO_CAPTURE_CAPTURING))
 		return 0;
 
 	if (audio_capture->flags & AUDIO_CAPTURE_CFG_CHANGED) {
+		/* batch belongs to old configuration */
+		if ((ret = audio_capture_flush(audio_capture)))
+			return ret;
 		if ((ret = audio_capture_write_cfg(audio_capture)))
 			return ret;
 		audio_capture->flags &= ~AUDIO_CAPTURE_CFG_CHANGED;
@@ -249,15 +282,102 @@ int audio_capture_data(audio_capture_t audio_capture,
 	if (!(audio_capture->flags & AUDIO_CAPTURE_IGNORE_TIME))
 		audio_capture->time = glc_state_time(audio_capture->glc);
 
+	time = audio_capture->time;
+
+	if (audio_capture->flags & AUDIO_CAPTURE_IGNORE_TIME)
+		audio_capture->time += audio_capture_duration(audio_capture, size);
+
+	if (!audio_capture->batch_duration)
+		return audio_capture_write(audio_capture, time, data, size);
+	return audio_capture_batch(audio_capture, time, data, size);
+}
+
+int audio_capture_flush(audio_capture_t audio_capture)
+{
+	int ret;
+
+	if (!audio_capture->batch_fill)
+		return 0;
+
+	ret = audio_capture_write(audio_capture, audio_capture->batch_time,
+				  audio_capture->batch, audio_capture->batch_fill);
+	audio_capture->batch_fill = 0;
+	return ret;
+}
+
+glc_utime_t audio_capture_duration(audio_capture_t audio_capture, size_t size)
+{
+	return ((glc_utime_t) size * (glc_utime_t) 1000000) /
+	       (glc_utime_t) (audio_capture_frames_to_bytes(audio_capture, 1) *
+			      audio_capture->rate);
+}
+
+int audio_capture_batch(audio_capture_t audio_capture, glc_utime_t time,
+			void *data, size_t size)
+{
+	size_t fill = audio_capture->batch_fill;
+	int ret;
+
+	/* chunk must continue pending batch and fit in it */
+	if ((fill) &&
+	    (((audio_capture->batch_max) && (fill + size > audio_capture->batch_max)) ||
+	     (audio_capture_duration(audio_capture, fill + size) >
+	      audio_capture->batch_duration) ||
+	     (time > audio_capture->batch_time + audio_capture_duration(audio_capture, fill) +
+		     audio_capture->batch_latency))) {
+		if ((ret = audio_capture_flush(audio_capture)))
+			return ret;
+		fill = 0;
+	}
+
+	/* chunk that fills a batch alone is not copied */
+	if ((!fill) &&
+	    (((audio_capture->batch_max) && (size >= audio_capture->batch_max)) ||
+	     (audio_capture_duration(audio_capture, size) >= audio_capture->batch_duration)))
+		return audio_capture_write(audio_capture, time, data, size);
+
+	if (fill + size > audio_capture->batch_capacity) {
+		audio_capture->batch_capacity = fill + size;
+		if (audio_capture->batch_max > audio_capture->batch_capacity)
+			audio_capture->batch_capacity = audio_capture->batch_max;
+		if (!(audio_capture->batch = (char *) realloc(audio_capture->batch,
+							     audio_capture->batch_capacity))) {
+			audio_capture->batch_capacity = audio_capture->batch_fill = 0;
+			return ENOMEM;
+		}
+	}
+
+	if (!fill)
+		audio_capture->batch_time = time;
+	memcpy(&audio_capture->batch[fill], data, size);
+	audio_capture->batch_fill = fill + size;
+
+	/*
+	 there is no thread to send a partial batch, so latency
+	 cap is checked when data arrives
+	*/
+	if (((audio_capture->batch_max) &&
+	     (audio_capture->batch_fill >= audio_capture->batch_max)) ||
+	    (audio_capture_duration(audio_capture, audio_capture->batch_fill) >=
+	     audio_capture->batch_duration) ||
+	    (glc_state_time(audio_capture->glc) >=
+	     audio_capture->batch_time + audio_capture->batch_latency))
+		return audio_capture_flush(audio_capture);
+
+	return 0;
+}
+
+int audio_capture_write(audio_capture_t audio_capture, glc_utime_t time,
+			void *data, size_t size)
+{
+	glc_message_header_t msg_hdr;
+	glc_audio_data_header_t audio_hdr;
+	int ret;
+
 	msg_hdr.type = GLC_MESSAGE_AUDIO_DATA;
 	audio_hdr.id = audio_capture->id; /* should be set to valid one */
 	audio_hdr.size = size;
-	audio_hdr.time = audio_capture->time;
-
-	if (audio_capture->flags & AUDIO_CAPTURE_IGNORE_TIME)
-		audio_capture->time += ((glc_utime_t) size * (glc_utime_t) 1000000) /
-					(glc_utime_t) (audio_capture_frames_to_bytes(audio_capture, 1) *
-						       audio_capture->rate);
+	audio_hdr.time = time;
 
 	if ((ret = ps_packet_open(&audio_capture->packet, PS_PACKET_WRITE)))
 		goto err;
@@ -102,6 +102,35 @@ __PUBLIC int audio_capture_set_channels(audio_capture_t audio_capture,
  */
 __PUBLIC int audio_capture_ignore_time(audio_capture_t audio_capture, int ignore_time);
 
+/**
+ * \brief set audio batching
+ *
+ * Consecutive audio_capture_data() calls are coalesced into
+ * one audio data packet until batch holds duration worth of
+ * audio or size bytes. Packet timestamp is that of first
+ * sample in batch. Data that doesn't follow batch within
+ * latency starts a new batch.
+ *
+ * Partial batch is sent when data arrives after its first
+ * sample is older than latency, on configuration change and
+ * when capturing stops. Use audio_capture_flush() to send it
+ * earlier. By default batching is disabled.
+ * \param audio_capture audio_capture object
+ * \param duration batch duration in microseconds, 0 disables
+ * \param size maximum batch size in bytes, 0 is unlimited
+ * \param latency maximum delay for first sample in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int audio_capture_set_batch(audio_capture_t audio_capture, glc_utime_t duration,
+				     size_t size, glc_utime_t latency);
+
+/**
+ * \brief send pending batch
+ * \param audio_capture audio_capture object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int audio_capture_flush(audio_capture_t audio_capture);
+
 /**
  * \brief start capturing
  *
@@ -25,12 +25,14 @@
 #include <pthread.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <time.h>
 
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/state.h>
 #include <glc/common/util.h>
+#include <glc/common/ring.h>
 
 #include "gl_capture.h"
 
@@ -41,6 +43,45 @@
 #define GL_CAPTURE_CROP            0x10
 #define GL_CAPTURE_LOCK_FPS        0x20
 #define GL_CAPTURE_IGNORE_TIME     0x40
+#define GL_CAPTURE_USE_SYNC        0x80
+#define GL_CAPTURE_CONVERT_YCBCR  0x100
+#define GL_CAPTURE_TRY_FBO        0x200
+#define GL_CAPTURE_USE_FBO        0x400
+#define GL_CAPTURE_SCALE          0x800
+#define GL_CAPTURE_DETECT_REPEAT 0x1000
+#define GL_CAPTURE_TRY_WORKER    0x2000
+#define GL_CAPTURE_TRY_REFS      0x4000
+#define GL_CAPTURE_USE_REFS      0x8000
+
+#ifndef GL_ARB_sync
+typedef struct __GLsync *GLsync;
+typedef u_int64_t GLuint64;
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_ALREADY_SIGNALED           0x911A
+#define GL_TIMEOUT_EXPIRED            0x911B
+#define GL_CONDITION_SATISFIED        0x911C
+#define GL_WAIT_FAILED                0x911D
+#define GL_SYNC_FLUSH_COMMANDS_BIT    0x00000001
+#endif
+
+#ifndef GL_ARB_buffer_storage
+#define GL_MAP_PERSISTENT_BIT         0x0040
+#define GL_MAP_COHERENT_BIT           0x0080
+#define GL_CLIENT_STORAGE_BIT         0x0200
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT               0x0001
+#define GL_MAP_WRITE_BIT              0x0002
+#endif
+
+/* room for message headers before picture in persistent PBOs */
+#define GL_CAPTURE_PBO_OFFSET           64
+
+/* time spun before deadline in hybrid pacing, in microseconds */
+#define GL_CAPTURE_PACE_SPIN           500
+
+#define GL_CAPTURE_WORKER_QUIT      0x1
+#define GL_CAPTURE_WORKER_STARTED   0x2
 
 typedef void (*FuncPtr)(void);
 typedef FuncPtr (*GLXGetProcAddressProc)(const GLubyte *procName);
@@ -57,6 +98,112 @@ typedef void (*glBindBufferProc)(GLenum target,
 typedef GLvoid *(*glMapBufferProc)(GLenum target,
                                    GLenum access);
 typedef GLboolean (*glUnmapBufferProc)(GLenum target);
+typedef GLsync (*glFenceSyncProc)(GLenum condition,
+                                  GLbitfield flags);
+typedef GLenum (*glClientWaitSyncProc)(GLsync sync,
+                                       GLbitfield flags,
+                                       GLuint64 timeout);
+typedef void (*glDeleteSyncProc)(GLsync sync);
+typedef void (*glBufferStorageProc)(GLenum target,
+                                    GLsizeiptr size,
+                                    const GLvoid *data,
+                                    GLbitfield flags);
+typedef GLvoid *(*glMapBufferRangeProc)(GLenum target,
+                                        GLintptr offset,
+                                        GLsizeiptr length,
+                                        GLbitfield access);
+
+/* draws a quad covering the whole viewport */
+static const char *gl_capture_vertex_shader =
+	"void main()\n"
+	"{\n"
+	"	gl_Position = gl_Vertex;\n"
+	"}\n";
+
+/*
+ Writes scaled picture as it is. Source is sampled between pixels
+ with linear filtering, which gives a 2x2 box filter at half size.
+*/
+static const char *gl_capture_rgb_shader =
+	"#extension GL_ARB_texture_rectangle : enable\n"
+	"uniform sampler2DRect frame;\n"
+	"uniform vec2 ratio;\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 src = (floor(gl_FragCoord.xy) + 0.5) * ratio;\n"
+	"	gl_FragColor = texture2DRect(frame, src);\n"
+	"}\n";
+
+/*
+ Writes planar Y'CbCr 420JPEG (see ycbcr.c) one byte per fragment.
+ Fragment row y selects output row from top of the picture: first
+ size.y rows are Y', rest contain Cb and Cr planes packed tightly.
+ Chroma is sampled between four source pixels, so that linear
+ filtering gives their average. Output coordinates are mapped
+ to source by ratio when scaling.
+*/
+static const char *gl_capture_ycbcr_shader =
+	"#extension GL_ARB_texture_rectangle : enable\n"
+	"uniform sampler2DRect frame;\n"
+	"uniform vec2 size;\n"
+	"uniform vec2 ratio;\n"
+	"uniform float height;\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 pos = floor(gl_FragCoord.xy);\n"
+	"	vec2 src;\n"
+	"	vec3 coef;\n"
+	"	float bias, off, plane, cw, cy;\n"
+	"	if (pos.y < size.y) {\n"
+	"		src = pos + 0.5;\n"
+	"		coef = vec3(0.299, 0.587, 0.114);\n"
+	"		bias = 0.0;\n"
+	"	} else {\n"
+	"		cw = size.x * 0.5;\n"
+	"		plane = cw * size.y * 0.5;\n"
+	"		off = (pos.y - size.y) * size.x + pos.x;\n"
+	"		if (off < plane) {\n"
+	"			coef = vec3(-0.168736, -0.331264, 0.5);\n"
+	"		} else {\n"
+	"			off -= plane;\n"
+	"			coef = vec3(0.5, -0.418688, -0.081312);\n"
+	"		}\n"
+	"		cy = floor((off + 0.5) / cw);\n"
+	"		src = vec2(off - cy * cw, cy) * 2.0 + 1.0;\n"
+	"		bias = 128.0 / 255.0;\n"
+	"	}\n"
+	"	src *= ratio;\n"
+	"	src.y = height - src.y;\n"
+	"	gl_FragColor = vec4(dot(texture2DRect(frame, src).rgb, coef) + bias,\n"
+	"			    0.0, 0.0, 1.0);\n"
+	"}\n";
+
+struct gl_capture_video_stream_s;
+
+struct gl_capture_pbo_s {
+	GLuint buffer;
+	GLsync fence;
+	glc_utime_t time;
+
+	struct gl_capture_video_stream_s *video;
+	char *map;
+	int referenced;
+};
+
+struct gl_capture_worker_s {
+	gl_capture_t gl_capture;
+	struct gl_capture_video_stream_s *video;
+
+	pthread_t thread;
+	/* Xlib connections are not shared between threads */
+	Display *dpy;
+	GLXContext ctx;
+	ps_packet_t packet;
+
+	/* protected by PBO ring mutex */
+	int flags;
+	int ret;
+};
 
 struct gl_capture_video_stream_s {
 	glc_state_video_t state_video;
@@ -69,10 +216,14 @@ struct gl_capture_video_stream_s {
 	GLXDrawable drawable;
 	Window attribWin;
 	ps_packet_t packet;
-	glc_utime_t last, pbo_time;
+	glc_utime_t last;
 
 	unsigned int w, h;
 	unsigned int cw, ch, row, cx, cy;
+	unsigned int ow, oh;
+	size_t size;
+	/* set by gl_capture_refresh_format() */
+	int refresh_format;
 
 	float brightness, contrast;
 	float gamma_red, gamma_green, gamma_blue;
@@ -81,8 +232,26 @@ struct gl_capture_video_stream_s {
 
 	struct gl_capture_video_stream_s *next;
 
-	GLuint pbo;
-	int pbo_active;
+	struct gl_capture_pbo_s *pbo;
+	unsigned int pbo_count, pbo_first, pbo_active, pbo_pending;
+	size_t pbo_offset;
+
+	/* protects ring position, worker and pack modify it too */
+	pthread_mutex_t pbo_mutex;
+	pthread_cond_t pbo_cond;
+
+	u_int64_t frame_hash;
+	int frame_hashed;
+
+	struct gl_capture_worker_s *worker;
+
+	GLuint fbo, fbo_texture, source_texture;
+	unsigned int fbo_w, fbo_h;
+	GLuint program;
+	GLint program_frame, program_size, program_ratio, program_height;
+
+	int pacing;
+	glc_stime_t pace_overshoot;
 };
 
 struct gl_capture_s {
@@ -96,12 +265,19 @@ struct gl_capture_s {
 	struct gl_capture_video_stream_s *video;
 
 	ps_buffer_t *to;
+	glc_ring_t ring;
 
 	pthread_mutex_t init_pbo_mutex;
 
 	unsigned int bpp;
 	GLenum format;
 	GLint pack_alignment;
+	unsigned int pbo_count;
+	double scale;
+	int pacing;
+
+	/* frames lost because target buffer or PBOs were busy */
+	unsigned long long dropped;
 
 	unsigned int crop_x, crop_y;
 	unsigned int crop_w, crop_h;
@@ -114,6 +290,35 @@ struct gl_capture_s {
 	glBindBufferProc glBindBuffer;
 	glMapBufferProc glMapBuffer;
 	glUnmapBufferProc glUnmapBuffer;
+	glFenceSyncProc glFenceSync;
+	glClientWaitSyncProc glClientWaitSync;
+	glDeleteSyncProc glDeleteSync;
+	glBufferStorageProc glBufferStorage;
+	glMapBufferRangeProc glMapBufferRange;
+	PFNGLXGETVIDEOSYNCSGIPROC glXGetVideoSyncSGI;
+	PFNGLXWAITVIDEOSYNCSGIPROC glXWaitVideoSyncSGI;
+
+	PFNGLGENFRAMEBUFFERSEXTPROC glGenFramebuffers;
+	PFNGLDELETEFRAMEBUFFERSEXTPROC glDeleteFramebuffers;
+	PFNGLBINDFRAMEBUFFEREXTPROC glBindFramebuffer;
+	PFNGLFRAMEBUFFERTEXTURE2DEXTPROC glFramebufferTexture2D;
+	PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC glCheckFramebufferStatus;
+	PFNGLACTIVETEXTUREARBPROC glActiveTexture;
+	PFNGLCREATESHADERPROC glCreateShader;
+	PFNGLDELETESHADERPROC glDeleteShader;
+	PFNGLSHADERSOURCEPROC glShaderSource;
+	PFNGLCOMPILESHADERPROC glCompileShader;
+	PFNGLGETSHADERIVPROC glGetShaderiv;
+	PFNGLCREATEPROGRAMPROC glCreateProgram;
+	PFNGLDELETEPROGRAMPROC glDeleteProgram;
+	PFNGLATTACHSHADERPROC glAttachShader;
+	PFNGLLINKPROGRAMPROC glLinkProgram;
+	PFNGLGETPROGRAMIVPROC glGetProgramiv;
+	PFNGLUSEPROGRAMPROC glUseProgram;
+	PFNGLGETUNIFORMLOCATIONPROC glGetUniformLocation;
+	PFNGLUNIFORM1IPROC glUniform1i;
+	PFNGLUNIFORM1FPROC glUniform1f;
+	PFNGLUNIFORM2FPROC glUniform2f;
 };
 
 int gl_capture_get_video_stream(gl_capture_t gl_capture,
@@ -129,16 +334,54 @@ int gl_capture_get_geometry(gl_capture_t gl_capture,
 int gl_capture_calc_geometry(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
 			     unsigned int w, unsigned int h);
 int gl_capture_update_screen(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_update_format(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 int gl_capture_update_color(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 
+int gl_capture_read_pixels(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video, GLvoid *to);
+u_int64_t gl_capture_hash(const unsigned char *data, size_t size);
+int gl_capture_is_repeat(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			 const unsigned char *data);
+int gl_capture_write_repeat(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			    glc_utime_t time, int flags);
 int gl_capture_get_pixels(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video, char *to);
 int gl_capture_gen_indicator_list(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 
 int gl_capture_init_pbo(gl_capture_t gl);
+int gl_capture_init_sync(gl_capture_t gl_capture);
+int gl_capture_init_persistent(gl_capture_t gl_capture);
 int gl_capture_create_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
 int gl_capture_destroy_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
-int gl_capture_start_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
-int gl_capture_read_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_start_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			 glc_utime_t time);
+int gl_capture_pbo_ready(gl_capture_t gl_capture, struct gl_capture_pbo_s *pbo);
+struct gl_capture_pbo_s *gl_capture_pending_pbo(struct gl_capture_video_stream_s *video);
+void gl_capture_retire_pbo(struct gl_capture_video_stream_s *video);
+void gl_capture_release_pbo(void *arg);
+int gl_capture_write_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			 int flags);
+int gl_capture_read_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			int flags);
+int gl_capture_wait_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			unsigned int active);
+int gl_capture_wait_slot(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_flush_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_flush_stopped(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable);
+
+int gl_capture_create_worker(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_destroy_worker(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+void *gl_capture_worker_thread(void *argptr);
+
+int gl_capture_init_fbo(gl_capture_t gl_capture);
+int gl_capture_compile_shader(gl_capture_t gl_capture, GLenum type,
+			      const char *source, GLuint *shader);
+int gl_capture_create_program(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_create_fbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_destroy_fbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_render_fbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+
+int gl_capture_init_vblank(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video);
+int gl_capture_pace(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+		    glc_utime_t deadline);
 
 int gl_capture_init(gl_capture_t *gl_capture, glc_t *glc)
 {
@@ -151,6 +394,9 @@ int gl_capture_init(gl_capture_t *gl_capture, glc_t *glc)
 	(*gl_capture)->format = GL_BGRA;		/* capture as BGRA data by default */
 	(*gl_capture)->bpp = 4;				/* since we use BGRA */
 	(*gl_capture)->capture_buffer = GL_FRONT;	/* front buffer is default */
+	(*gl_capture)->pbo_count = 3;			/* triple-buffered readback */
+	(*gl_capture)->scale = 1.0;			/* no scaling by default */
+	(*gl_capture)->pacing = GL_CAPTURE_PACE_SLEEP;	/* plain sleep with lock fps */
 
 	pthread_mutex_init(&(*gl_capture)->init_pbo_mutex, NULL);
 	pthread_rwlock_init(&(*gl_capture)->videolist_lock, NULL);
@@ -164,6 +410,7 @@ int gl_capture_set_buffer(gl_capture_t gl_capture, ps_buffer_t *buffer)
 		return EALREADY;
 
 	gl_capture->to = buffer;
+	gl_capture->ring = glc_ring_lookup(buffer);
 	return 0;
 }
 
@@ -234,6 +481,47 @@ int gl_capture_try_pbo(gl_capture_t gl_capture, int try_pbo)
 	return 0;
 }
 
+int gl_capture_set_pbo_count(gl_capture_t gl_capture, unsigned int count)
+{
+	if (!count) {
+		glc_log(gl_capture->glc, GLC_ERROR, "gl_capture",
+			 "at least one PBO is required");
+		return EINVAL;
+	}
+
+	glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+		 "using %u PBOs per video stream", count);
+	gl_capture->pbo_count = count;
+	return 0;
+}
+
+int gl_capture_try_worker(gl_capture_t gl_capture, int try_worker)
+{
+	if (try_worker)
+		gl_capture->flags |= GL_CAPTURE_TRY_WORKER;
+	else
+		gl_capture->flags &= ~GL_CAPTURE_TRY_WORKER;
+
+	return 0;
+}
+
+int gl_capture_try_frame_refs(gl_capture_t gl_capture, int try_refs)
+{
+	if (try_refs) {
+		gl_capture->flags |= GL_CAPTURE_TRY_REFS;
+	} else {
+		if (gl_capture->flags & GL_CAPTURE_USE_REFS) {
+			glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+				 "can't disable frame references; they are in use");
+			return EAGAIN;
+		}
+
+		gl_capture->flags &= ~GL_CAPTURE_TRY_REFS;
+	}
+
+	return 0;
+}
+
 int gl_capture_set_pixel_format(gl_capture_t gl_capture, GLenum format)
 {
 	if (format == GL_BGRA) {
@@ -254,6 +542,95 @@ int gl_capture_set_pixel_format(gl_capture_t gl_capture, GLenum format)
 	return 0;
 }
 
+int gl_capture_convert_ycbcr_420jpeg(gl_capture_t gl_capture, int convert)
+{
+	if (convert) {
+		gl_capture->flags |= GL_CAPTURE_CONVERT_YCBCR | GL_CAPTURE_TRY_FBO;
+	} else {
+		if (gl_capture->flags & GL_CAPTURE_USE_FBO) {
+			glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+				 "can't disable Y'CbCr conversion; it is in use");
+			return EAGAIN;
+		}
+
+		gl_capture->flags &= ~GL_CAPTURE_CONVERT_YCBCR;
+		if (!(gl_capture->flags & GL_CAPTURE_SCALE))
+			gl_capture->flags &= ~GL_CAPTURE_TRY_FBO;
+	}
+
+	return 0;
+}
+
+int gl_capture_set_scale(gl_capture_t gl_capture, double scale)
+{
+	if (scale <= 0)
+		return EINVAL;
+
+	if (gl_capture->flags & GL_CAPTURE_USE_FBO) {
+		glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+			 "can't change scale; FBO is in use");
+		return EAGAIN;
+	}
+
+	if (scale == 1.0) {
+		gl_capture->flags &= ~GL_CAPTURE_SCALE;
+		if (!(gl_capture->flags & GL_CAPTURE_CONVERT_YCBCR))
+			gl_capture->flags &= ~GL_CAPTURE_TRY_FBO;
+	} else {
+		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+			 "scaling pictures with factor %f on GPU", scale);
+		gl_capture->flags |= GL_CAPTURE_SCALE | GL_CAPTURE_TRY_FBO;
+	}
+
+	gl_capture->scale = scale;
+	return 0;
+}
+
+int gl_capture_detect_repeat(gl_capture_t gl_capture, int detect_repeat)
+{
+	if (detect_repeat)
+		gl_capture->flags |= GL_CAPTURE_DETECT_REPEAT;
+	else
+		gl_capture->flags &= ~GL_CAPTURE_DETECT_REPEAT;
+
+	return 0;
+}
+
+int gl_capture_reset_repeat(gl_capture_t gl_capture)
+{
+	struct gl_capture_video_stream_s *video;
+
+	pthread_rwlock_rdlock(&gl_capture->videolist_lock);
+	video = gl_capture->video;
+	while (video != NULL) {
+		video->frame_hashed = 0;
+		video = video->next;
+	}
+	pthread_rwlock_unlock(&gl_capture->videolist_lock);
+
+	return 0;
+}
+
+int gl_capture_refresh_format(gl_capture_t gl_capture)
+{
+	struct gl_capture_video_stream_s *video;
+
+	pthread_rwlock_rdlock(&gl_capture->videolist_lock);
+	video = gl_capture->video;
+	while (video != NULL) {
+		__atomic_store_n(&video->refresh_format, 1, __ATOMIC_RELEASE);
+		video = video->next;
+	}
+	pthread_rwlock_unlock(&gl_capture->videolist_lock);
+
+	return 0;
+}
+
+unsigned long long gl_capture_dropped(gl_capture_t gl_capture)
+{
+	return __atomic_load_n(&gl_capture->dropped, __ATOMIC_RELAXED);
+}
+
 int gl_capture_draw_indicator(gl_capture_t gl_capture, int draw_indicator)
 {
 	if (draw_indicator) {
@@ -304,6 +681,32 @@ int gl_capture_lock_fps(gl_capture_t gl_capture, int lock_fps)
 	return 0;
 }
 
+int gl_capture_set_pacing(gl_capture_t gl_capture, int pacing)
+{
+	if ((pacing != GL_CAPTURE_PACE_SLEEP) &&
+	    (pacing != GL_CAPTURE_PACE_HYBRID) &&
+	    (pacing != GL_CAPTURE_PACE_VBLANK))
+		return EINVAL;
+
+	gl_capture->pacing = pacing;
+	return 0;
+}
+
+int gl_capture_set_stream_pacing(gl_capture_t gl_capture, Display *dpy,
+				 GLXDrawable drawable, int pacing)
+{
+	struct gl_capture_video_stream_s *video;
+
+	if ((pacing != GL_CAPTURE_PACE_SLEEP) &&
+	    (pacing != GL_CAPTURE_PACE_HYBRID) &&
+	    (pacing != GL_CAPTURE_PACE_VBLANK))
+		return EINVAL;
+
+	gl_capture_get_video_stream(gl_capture, &video, dpy, drawable);
+	video->pacing = pacing;
+	return 0;
+}
+
 int gl_capture_start(gl_capture_t gl_capture)
 {
 	if (!gl_capture->to) {
@@ -326,6 +729,9 @@ int gl_capture_start(gl_capture_t gl_capture)
 
 int gl_capture_stop(gl_capture_t gl_capture)
 {
+	struct gl_capture_video_stream_s *video;
+	int ret = 0;
+
 	if (gl_capture->flags & GL_CAPTURE_CAPTURING)
 		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
 			 "stopping capturing");
@@ -334,7 +740,31 @@ int gl_capture_stop(gl_capture_t gl_capture)
 			 "capturing is already stopped");
 
 	gl_capture->flags &= ~GL_CAPTURE_CAPTURING;
-	return 0;
+
+	/* pictures already being read back belong to this capture */
+	if (glc_state_test(gl_capture->glc, GLC_STATE_CANCEL))
+		return 0;
+
+	pthread_rwlock_rdlock(&gl_capture->videolist_lock);
+	for (video = gl_capture->video; video != NULL; video = video->next) {
+		if (!video->pbo_active)
+			continue;
+
+		/*
+		 Without worker PBOs are mapped in application's context. If
+		 that isn't current here, they are written at next frame.
+		*/
+		if ((!video->worker) &&
+		    ((glXGetCurrentDisplay() != video->dpy) ||
+		     (glXGetCurrentDrawable() != video->drawable)))
+			continue;
+
+		if ((ret = gl_capture_flush_pbo(gl_capture, video)))
+			break;
+	}
+	pthread_rwlock_unlock(&gl_capture->videolist_lock);
+
+	return ret;
 }
 
 void gl_capture_error(gl_capture_t gl_capture, int err)
@@ -342,12 +772,13 @@ void gl_capture_error(gl_capture_t gl_capture, int err)
 	glc_log(gl_capture->glc, GLC_ERROR, "gl_capture",
 		"%s (%d)", strerror(err), err);
 
+	/* cancel glc, stop doesn't write pending pictures after this */
+	glc_state_set(gl_capture->glc, GLC_STATE_CANCEL);
+
 	/* stop capturing */
 	if (gl_capture->flags & GL_CAPTURE_CAPTURING)
 		gl_capture_stop(gl_capture);
 
-	/* cancel glc */
-	glc_state_set(gl_capture->glc, GLC_STATE_CANCEL);
 	if (gl_capture->to)
 		ps_buffer_cancel(gl_capture->to);
 }
@@ -364,10 +795,26 @@ int gl_capture_destroy(gl_capture_t gl_capture)
 		if (del->indicator_list)
 			glDeleteLists(del->indicator_list, 1);
 
-		if (del->pbo)
+		if (del->worker)
+			gl_capture_destroy_worker(gl_capture, del);
+		if (del->pbo) {
+			/* drop pending transfers, but pack may still read written ones */
+			pthread_mutex_lock(&del->pbo_mutex);
+			del->pbo_active -= del->pbo_pending;
+			del->pbo_pending = 0;
+			pthread_mutex_unlock(&del->pbo_mutex);
+
+			gl_capture_wait_pbo(gl_capture, del, 0);
 			gl_capture_destroy_pbo(gl_capture, del);
+		}
+		if (del->fbo)
+			gl_capture_destroy_fbo(gl_capture, del);
+		if (del->program)
+			gl_capture->glDeleteProgram(del->program);
 
 		ps_packet_destroy(&del->packet);
+		pthread_cond_destroy(&del->pbo_cond);
+		pthread_mutex_destroy(&del->pbo_mutex);
 		free(del);
 	}
 
@@ -403,6 +850,8 @@ int gl_capture_update_screen(gl_capture_t gl_capture, struct gl_capture_video_st
 int gl_capture_calc_geometry(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
 			     unsigned int w, unsigned int h)
 {
+	unsigned int sw, sh;
+
 	video->w = w;
 	video->h = h;
 
@@ -440,21 +889,93 @@ int gl_capture_calc_geometry(gl_capture_t gl_capture, struct gl_capture_video_st
 		 "calculated capture area for video %d is %ux%u+%u+%u",
 		 video->id, video->cw, video->ch, video->cx, video->cy);
 
-	video->row = video->cw * gl_capture->bpp;
-	if (video->row % gl_capture->pack_alignment != 0)
-		video->row += gl_capture->pack_alignment - video->row % gl_capture->pack_alignment;
+	/* scaling is done when rendering into FBO */
+	if ((gl_capture->flags & GL_CAPTURE_SCALE) &&
+	    (gl_capture->flags & GL_CAPTURE_USE_FBO)) {
+		sw = video->cw * gl_capture->scale;
+		sh = video->ch * gl_capture->scale;
+	} else {
+		sw = video->cw;
+		sh = video->ch;
+	}
+
+	if (video->format == GLC_VIDEO_YCBCR_420JPEG) {
+		/* planes are rendered one byte per texel, Y' on top of CbCr */
+		video->ow = sw - sw % 2;
+		video->oh = sh - sh % 2;
+		video->row = video->ow;
+
+		video->fbo_w = video->ow;
+		video->fbo_h = video->oh + video->oh / 2;
+		video->size = video->fbo_w * video->fbo_h;
+	} else {
+		video->ow = sw;
+		video->oh = sh;
+
+		video->row = video->ow * gl_capture->bpp;
+		if (video->row % gl_capture->pack_alignment != 0)
+			video->row += gl_capture->pack_alignment - video->row % gl_capture->pack_alignment;
+		video->size = video->row * video->oh;
+
+		video->fbo_w = video->ow;
+		video->fbo_h = video->oh;
+	}
+
+	return 0;
+}
+
+int gl_capture_update_format(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	video->flags = 0;
+
+	if ((gl_capture->flags & GL_CAPTURE_CONVERT_YCBCR) &&
+	    (gl_capture->flags & GL_CAPTURE_USE_FBO)) {
+		video->format = GLC_VIDEO_YCBCR_420JPEG;
+		return 0;
+	}
+
+	if (gl_capture->format == GL_BGRA)
+		video->format = GLC_VIDEO_BGRA;
+	else if (gl_capture->format == GL_BGR)
+		video->format = GLC_VIDEO_BGR;
+	else
+		return EINVAL;
+
+	if (gl_capture->pack_alignment == 8)
+		video->flags |= GLC_VIDEO_DWORD_ALIGNED;
 
 	return 0;
 }
 
-int gl_capture_get_pixels(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video, char *to)
+int gl_capture_read_pixels(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video, GLvoid *to)
 {
+	GLint framebuffer;
+
+	if (video->fbo)
+		gl_capture_render_fbo(gl_capture, video);
+
 	glPushAttrib(GL_PIXEL_MODE_BIT);
 	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
 
-	glReadBuffer(gl_capture->capture_buffer);
-	glPixelStorei(GL_PACK_ALIGNMENT, gl_capture->pack_alignment);
-	glReadPixels(video->cx, video->cy, video->cw, video->ch, gl_capture->format, GL_UNSIGNED_BYTE, to);
+	if (video->fbo) {
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &framebuffer);
+		gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, video->fbo);
+
+		glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+		if (video->format == GLC_VIDEO_YCBCR_420JPEG) {
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glReadPixels(0, 0, video->fbo_w, video->fbo_h, GL_RED, GL_UNSIGNED_BYTE, to);
+		} else {
+			glPixelStorei(GL_PACK_ALIGNMENT, gl_capture->pack_alignment);
+			glReadPixels(0, 0, video->fbo_w, video->fbo_h, gl_capture->format, GL_UNSIGNED_BYTE, to);
+		}
+
+		gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, framebuffer);
+	} else {
+		glReadBuffer(gl_capture->capture_buffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, gl_capture->pack_alignment);
+		glReadPixels(video->cx, video->cy, video->cw, video->ch, gl_capture->format, GL_UNSIGNED_BYTE, to);
+	}
 
 	glPopClientAttrib();
 	glPopAttrib();
@@ -462,6 +983,75 @@ int gl_capture_get_pixels(gl_capture_t gl_capture, struct gl_capture_video_strea
 	return 0;
 }
 
+int gl_capture_get_pixels(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video, char *to)
+{
+	return gl_capture_read_pixels(gl_capture, video, to);
+}
+
+u_int64_t gl_capture_hash(const unsigned char *data, size_t size)
+{
+	/* four independent lanes keep multiplier busy */
+	u_int64_t a = 0x9e3779b97f4a7c15ULL, b = 0xc2b2ae3d27d4eb4fULL;
+	u_int64_t c = 0x165667b19e3779f9ULL, d = 0x27d4eb2f165667c5ULL;
+	u_int64_t w[4];
+	const u_int64_t m = 0x100000001b3ULL;
+	size_t i;
+
+	for (i = 0; i + sizeof(w) <= size; i += sizeof(w)) {
+		memcpy(w, &data[i], sizeof(w)); /* data might not be aligned */
+		a = (a ^ w[0]) * m;
+		b = (b ^ w[1]) * m;
+		c = (c ^ w[2]) * m;
+		d = (d ^ w[3]) * m;
+	}
+
+	for (; i < size; i++)
+		a = (a ^ data[i]) * m;
+
+	return a ^ (b << 16 | b >> 48) ^ (c << 32 | c >> 32) ^ (d << 48 | d >> 16);
+}
+
+int gl_capture_is_repeat(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			 const unsigned char *data)
+{
+	u_int64_t hash = gl_capture_hash(data, video->size);
+
+	if ((video->frame_hashed) && (video->frame_hash == hash))
+		return 1;
+
+	video->frame_hash = hash;
+	video->frame_hashed = 1;
+	return 0;
+}
+
+int gl_capture_write_repeat(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			    glc_utime_t time, int flags)
+{
+	glc_message_header_t msg;
+	glc_video_frame_header_t pic;
+	int ret;
+
+	msg.type = GLC_MESSAGE_VIDEO_REPEAT;
+	pic.id = video->id;
+	pic.time = time;
+
+	if ((ret = ps_packet_open(&video->packet, flags))) {
+		/* readers fill gaps with previous picture anyway */
+		if (ret == EBUSY)
+			return 0;
+		return ret;
+	}
+	if ((ret = ps_packet_write(&video->packet, &msg, sizeof(glc_message_header_t))))
+		goto cancel;
+	if ((ret = ps_packet_write(&video->packet, &pic, sizeof(glc_video_frame_header_t))))
+		goto cancel;
+
+	return ps_packet_close(&video->packet);
+cancel:
+	ps_packet_cancel(&video->packet);
+	return ret;
+}
+
 int gl_capture_gen_indicator_list(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
 {
 	int size;
@@ -502,15 +1092,20 @@ int gl_capture_init_pbo(gl_capture_t gl_capture)
 	if (!strstr(gl_extensions, "GL_ARB_pixel_buffer_object"))
 		return ENOTSUP;
 	
-	gl_capture->libGL_handle = dlopen("libGL.so.1", RTLD_LAZY);
-	if (!gl_capture->libGL_handle)
-		return ENOTSUP;
-	gl_capture->glXGetProcAddress =
-		(GLXGetProcAddressProc)
-		dlsym(gl_capture->libGL_handle, "glXGetProcAddressARB");
-	if (!gl_capture->glXGetProcAddress)
-		return ENOTSUP;
-	
+	if (!gl_capture->libGL_handle) {
+		gl_capture->libGL_handle = dlopen("libGL.so.1", RTLD_LAZY);
+		if (!gl_capture->libGL_handle)
+			return ENOTSUP;
+	}
+	if (!gl_capture->glXGetProcAddress) {
+		gl_capture->glXGetProcAddress =
+			(GLXGetProcAddressProc)
+			dlsym(gl_capture->libGL_handle, "glXGetProcAddressARB");
+		if (!gl_capture->glXGetProcAddress)
+			return ENOTSUP;
+	}
+
+
 	gl_capture->glGenBuffers =
 		(glGenBuffersProc)
 		gl_capture->glXGetProcAddress((const GLubyte *) "glGenBuffersARB");
@@ -545,87 +1140,1001 @@ int gl_capture_init_pbo(gl_capture_t gl_capture)
 	glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
 		 "using GL_ARB_pixel_buffer_object");
 
+	/* fences are optional, without them PBOs are mapped in order */
+	if (!gl_capture_init_sync(gl_capture))
+		gl_capture->flags |= GL_CAPTURE_USE_SYNC;
+
+	if (gl_capture->flags & GL_CAPTURE_TRY_REFS) {
+		/* pictures in persistent PBOs are complete only after their fences */
+		if ((gl_capture->flags & GL_CAPTURE_USE_SYNC) &&
+		    (!gl_capture_init_persistent(gl_capture)))
+			gl_capture->flags |= GL_CAPTURE_USE_REFS;
+		else {
+			glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+				 "persistent PBOs are not supported, copying pictures");
+			gl_capture->flags &= ~GL_CAPTURE_TRY_REFS;
+		}
+	}
+
 	return 0;
 }
 
-int gl_capture_create_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+int gl_capture_init_sync(gl_capture_t gl_capture)
 {
-	GLint binding;
+	const char *gl_extensions = (const char *) glGetString(GL_EXTENSIONS);
 
-	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture", "creating PBO");
+	if (gl_extensions == NULL)
+		return EINVAL;
 
-	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
-	glPushAttrib(GL_ALL_ATTRIB_BITS);
+	if (!strstr(gl_extensions, "GL_ARB_sync"))
+		return ENOTSUP;
+
+	/* GL_ARB_sync entry points don't have ARB suffix */
+	gl_capture->glFenceSync =
+		(glFenceSyncProc)
+		gl_capture->glXGetProcAddress((const GLubyte *) "glFenceSync");
+	if (!gl_capture->glFenceSync)
+		return ENOTSUP;
+	gl_capture->glClientWaitSync =
+		(glClientWaitSyncProc)
+		gl_capture->glXGetProcAddress((const GLubyte *) "glClientWaitSync");
+	if (!gl_capture->glClientWaitSync)
+		return ENOTSUP;
+	gl_capture->glDeleteSync =
+		(glDeleteSyncProc)
+		gl_capture->glXGetProcAddress((const GLubyte *) "glDeleteSync");
+	if (!gl_capture->glDeleteSync)
+		return ENOTSUP;
 
-	gl_capture->glGenBuffers(1, &video->pbo);
-	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo);
-	gl_capture->glBufferData(GL_PIXEL_PACK_BUFFER_ARB, video->row * video->ch,
-		         NULL, GL_STREAM_READ);
+	glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+		 "using GL_ARB_sync");
 
-	glPopAttrib();
-	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
 	return 0;
 }
 
-int gl_capture_destroy_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+int gl_capture_init_persistent(gl_capture_t gl_capture)
 {
-	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture", "destroying PBO");
+	const char *gl_extensions = (const char *) glGetString(GL_EXTENSIONS);
+
+	if (gl_extensions == NULL)
+		return EINVAL;
+
+	if (!strstr(gl_extensions, "GL_ARB_buffer_storage"))
+		return ENOTSUP;
+
+	gl_capture->glBufferStorage =
+		(glBufferStorageProc)
+		gl_capture->glXGetProcAddress((const GLubyte *) "glBufferStorage");
+	if (!gl_capture->glBufferStorage)
+		return ENOTSUP;
+	gl_capture->glMapBufferRange =
+		(glMapBufferRangeProc)
+		gl_capture->glXGetProcAddress((const GLubyte *) "glMapBufferRange");
+	if (!gl_capture->glMapBufferRange)
+		return ENOTSUP;
+
+	glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+		 "using GL_ARB_buffer_storage");
 
-	gl_capture->glDeleteBuffers(1, &video->pbo);
 	return 0;
 }
 
-int gl_capture_start_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+int gl_capture_create_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
 {
 	GLint binding;
+	GLsizeiptr size;
+	unsigned int i;
+	int ret = 0;
 
-	if (video->pbo_active)
-		return EAGAIN;
+	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture", "creating %u PBOs",
+		 gl_capture->pbo_count);
 
-	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
-	glPushAttrib(GL_PIXEL_MODE_BIT);
-	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+	video->pbo = (struct gl_capture_pbo_s *)
+		malloc(sizeof(struct gl_capture_pbo_s) * gl_capture->pbo_count);
+	if (!video->pbo)
+		return ENOMEM;
+	memset(video->pbo, 0, sizeof(struct gl_capture_pbo_s) * gl_capture->pbo_count);
+	video->pbo_count = gl_capture->pbo_count;
+	video->pbo_first = video->pbo_active = video->pbo_pending = 0;
 
-	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo);
+	/* leave room for frame header in front of picture */
+	video->pbo_offset = (gl_capture->flags & GL_CAPTURE_USE_REFS) ? GL_CAPTURE_PBO_OFFSET : 0;
+	size = video->pbo_offset + video->size;
 
-	glReadBuffer(gl_capture->capture_buffer);
-	glPixelStorei(GL_PACK_ALIGNMENT, gl_capture->pack_alignment);
-	/* to = ((char *)NULL + (offset)) */
-	glReadPixels(video->cx, video->cy, video->cw, video->ch, gl_capture->format, GL_UNSIGNED_BYTE, NULL);
+	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
+	glPushAttrib(GL_ALL_ATTRIB_BITS);
 
-	video->pbo_active = 1;
+	for (i = 0; i < video->pbo_count; i++) {
+		video->pbo[i].video = video;
+		gl_capture->glGenBuffers(1, &video->pbo[i].buffer);
+		gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo[i].buffer);
+
+		if (gl_capture->flags & GL_CAPTURE_USE_REFS) {
+			/* mapped once, pack reads pictures from here */
+			gl_capture->glBufferStorage(GL_PIXEL_PACK_BUFFER_ARB, size, NULL,
+						    GL_MAP_READ_BIT | GL_MAP_WRITE_BIT |
+						    GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT |
+						    GL_CLIENT_STORAGE_BIT);
+			video->pbo[i].map = (char *)
+				gl_capture->glMapBufferRange(GL_PIXEL_PACK_BUFFER_ARB, 0, size,
+							     GL_MAP_READ_BIT | GL_MAP_WRITE_BIT |
+							     GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+			if (!video->pbo[i].map) {
+				ret = ENOTSUP;
+				break;
+			}
+		} else
+			gl_capture->glBufferData(GL_PIXEL_PACK_BUFFER_ARB, video->size,
+					 NULL, GL_STREAM_READ);
+	}
 
-	glPopClientAttrib();
 	glPopAttrib();
 	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
-	return 0;
+
+	if (ret)
+		gl_capture_destroy_pbo(gl_capture, video);
+	return ret;
 }
 
-int gl_capture_read_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+int gl_capture_destroy_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
 {
-	GLvoid *buf;
-	GLint binding;
-	
-	if (!video->pbo_active)
-		return EAGAIN;
+	unsigned int i;
+
+	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture", "destroying PBOs");
+
+	/* deleting a buffer unmaps it as well */
+	for (i = 0; i < video->pbo_count; i++) {
+		if (video->pbo[i].fence)
+			gl_capture->glDeleteSync(video->pbo[i].fence);
+		if (video->pbo[i].buffer)
+			gl_capture->glDeleteBuffers(1, &video->pbo[i].buffer);
+	}
+
+	free(video->pbo);
+	video->pbo = NULL;
+	video->pbo_count = video->pbo_first = video->pbo_active = video->pbo_pending = 0;
+	return 0;
+}
+
+struct gl_capture_pbo_s *gl_capture_pending_pbo(struct gl_capture_video_stream_s *video)
+{
+	/* oldest transfer that hasn't been written yet */
+	return &video->pbo[(video->pbo_first + video->pbo_active - video->pbo_pending)
+			   % video->pbo_count];
+}
+
+void gl_capture_retire_pbo(struct gl_capture_video_stream_s *video)
+{
+	/* free written slots in order, referenced ones are still being read */
+	while ((video->pbo_active > video->pbo_pending) &&
+	       (!video->pbo[video->pbo_first].referenced)) {
+		video->pbo_first = (video->pbo_first + 1) % video->pbo_count;
+		video->pbo_active--;
+	}
+}
+
+void gl_capture_release_pbo(void *arg)
+{
+	struct gl_capture_pbo_s *pbo = (struct gl_capture_pbo_s *) arg;
+	struct gl_capture_video_stream_s *video = pbo->video;
+
+	pthread_mutex_lock(&video->pbo_mutex);
+	pbo->referenced = 0;
+	gl_capture_retire_pbo(video);
+	pthread_cond_broadcast(&video->pbo_cond);
+	pthread_mutex_unlock(&video->pbo_mutex);
+}
+
+int gl_capture_start_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			 glc_utime_t time)
+{
+	struct gl_capture_pbo_s *pbo;
+	GLint binding;
+	unsigned int active, first;
+
+	/* worker and pack only move first slot forward */
+	pthread_mutex_lock(&video->pbo_mutex);
+	active = video->pbo_active;
+	first = video->pbo_first;
+	pthread_mutex_unlock(&video->pbo_mutex);
+
+	/* all transfers are still in flight */
+	if (active == video->pbo_count)
+		return EBUSY;
+
+	pbo = &video->pbo[(first + active) % video->pbo_count];
 
 	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
 
-	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo);
-	buf = gl_capture->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY);
-	if (!buf)
-		return EINVAL;
+	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbo->buffer);
+	/* to = ((char *)NULL + (offset)) */
+	gl_capture_read_pixels(gl_capture, video, (GLvoid *) ((char *) NULL + video->pbo_offset));
 
-	ps_packet_write(&video->packet, buf, video->row * video->ch);
+	if (gl_capture->flags & GL_CAPTURE_USE_SYNC)
+		pbo->fence = gl_capture->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
-	gl_capture->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+	/* picture is written with the time it was read, not mapped */
+	pbo->time = time;
+
+	/* fence must reach GPU before other context can wait for it */
+	if (video->worker)
+		glFlush();
+
+	pthread_mutex_lock(&video->pbo_mutex);
+	video->pbo_active++;
+	video->pbo_pending++;
+	pthread_cond_broadcast(&video->pbo_cond);
+	pthread_mutex_unlock(&video->pbo_mutex);
 
-	video->pbo_active = 0;
-	
 	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
 	return 0;
 }
 
+int gl_capture_pbo_ready(gl_capture_t gl_capture, struct gl_capture_pbo_s *pbo)
+{
+	GLenum status;
+
+	if (!pbo->fence)
+		return 1;
+
+	/* just poll, flush so that the fence actually gets signaled */
+	status = gl_capture->glClientWaitSync(pbo->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	return (status == GL_ALREADY_SIGNALED) | (status == GL_CONDITION_SATISFIED);
+}
+
+int gl_capture_write_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			 int flags)
+{
+	struct gl_capture_pbo_s *pbo;
+	ps_packet_t *packet = video->worker ? &video->worker->packet : &video->packet;
+	glc_message_header_t msg;
+	glc_video_frame_header_t pic;
+	glc_video_frame_ref_t ref;
+	char *buf;
+	GLint binding;
+	GLenum status;
+	int ret;
+
+	pthread_mutex_lock(&video->pbo_mutex);
+	pbo = video->pbo_pending ? gl_capture_pending_pbo(video) : NULL;
+	pthread_mutex_unlock(&video->pbo_mutex);
+
+	if (!pbo)
+		return EAGAIN;
+
+	pic.id = video->id;
+	pic.time = pbo->time;
+
+	if ((ret = ps_packet_open(packet, flags)))
+		return ret;
+
+	if (pbo->map) {
+		/* coherent mapping, but picture is there only after the fence */
+		do {
+			status = gl_capture->glClientWaitSync(pbo->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+							      100000000);
+		} while (status == GL_TIMEOUT_EXPIRED);
+
+		if (status == GL_WAIT_FAILED) {
+			ret = EINVAL;
+			goto cancel;
+		}
+		buf = &pbo->map[video->pbo_offset];
+	} else {
+		glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
+
+		gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbo->buffer);
+		buf = (char *) gl_capture->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY);
+		if (!buf) {
+			gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
+			ret = EINVAL;
+			goto cancel;
+		}
+	}
+
+	if ((gl_capture->flags & GL_CAPTURE_DETECT_REPEAT) &&
+	    (gl_capture_is_repeat(gl_capture, video, (unsigned char *) buf)))
+		msg.type = GLC_MESSAGE_VIDEO_REPEAT;
+	else if (pbo->map)
+		msg.type = GLC_MESSAGE_VIDEO_FRAME_REF;
+	else
+		msg.type = GLC_MESSAGE_VIDEO_FRAME;
+
+	if ((ret = ps_packet_write(packet, &msg, sizeof(glc_message_header_t))))
+		goto unmap;
+
+	if (msg.type == GLC_MESSAGE_VIDEO_FRAME_REF) {
+		/* header goes right before picture, so pack sees a complete frame */
+		memcpy(buf - sizeof(glc_video_frame_header_t), &pic, sizeof(glc_video_frame_header_t));
+		ref.data = buf - sizeof(glc_video_frame_header_t);
+		ref.size = sizeof(glc_video_frame_header_t) + video->size;
+		ref.release = &gl_capture_release_pbo;
+		ref.arg = pbo;
+
+		ret = ps_packet_write(packet, &ref, sizeof(glc_video_frame_ref_t));
+		goto unmap;
+	}
+
+	if ((ret = ps_packet_write(packet, &pic, sizeof(glc_video_frame_header_t))))
+		goto unmap;
+
+	if (msg.type == GLC_MESSAGE_VIDEO_FRAME) {
+		/* is this safe, what happens if this is called simultaneously? */
+		if ((ret = ps_packet_setsize(packet, video->size
+							     + sizeof(glc_message_header_t)
+							     + sizeof(glc_video_frame_header_t))))
+			goto unmap;
+
+		ret = ps_packet_write(packet, buf, video->size);
+	}
+
+unmap:
+	if (!pbo->map) {
+		gl_capture->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+		gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
+	}
+
+	if (ret)
+		goto cancel;
+
+	/* slot can be released as soon as packet is closed */
+	pbo->referenced = (msg.type == GLC_MESSAGE_VIDEO_FRAME_REF);
+	if ((ret = ps_packet_close(packet))) {
+		pbo->referenced = 0;
+		return ret;
+	}
+
+	if (pbo->fence) {
+		gl_capture->glDeleteSync(pbo->fence);
+		pbo->fence = NULL;
+	}
+
+	pthread_mutex_lock(&video->pbo_mutex);
+	video->pbo_pending--;
+	gl_capture_retire_pbo(video);
+	pthread_cond_broadcast(&video->pbo_cond);
+	pthread_mutex_unlock(&video->pbo_mutex);
+	return 0;
+
+cancel:
+	ps_packet_cancel(packet);
+	return ret;
+}
+
+int gl_capture_read_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			int flags)
+{
+	struct gl_capture_pbo_s *pbo;
+	unsigned int active;
+	int ret = 0;
+
+	/* write completed transfers, oldest first */
+	for (;;) {
+		pthread_mutex_lock(&video->pbo_mutex);
+		pbo = video->pbo_pending ? gl_capture_pending_pbo(video) : NULL;
+		active = video->pbo_active;
+		pthread_mutex_unlock(&video->pbo_mutex);
+
+		if (!pbo)
+			break;
+
+		if (gl_capture->flags & GL_CAPTURE_USE_SYNC) {
+			if (!gl_capture_pbo_ready(gl_capture, pbo))
+				break;
+		} else if (active < video->pbo_count)
+			break; /* no fences, so map only when a slot is needed */
+
+		if ((ret = gl_capture_write_pbo(gl_capture, video, flags)))
+			break;
+	}
+
+	if (ret == EBUSY) {
+		/* leave the transfer in place and try again at next frame */
+		glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture",
+			 "buffer not ready, deferring PBO");
+		ret = 0;
+	}
+
+	return ret;
+}
+
+int gl_capture_wait_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			unsigned int active)
+{
+	struct timespec abstime;
+	int ret = 0;
+
+	/* wait until at most 'active' slots are in use */
+	pthread_mutex_lock(&video->pbo_mutex);
+	while (video->pbo_active > active) {
+		/* worker has already reported the error */
+		if ((video->worker) && (video->worker->ret)) {
+			ret = EINTR;
+			break;
+		}
+
+		/* pack doesn't release references after cancel */
+		if (glc_state_test(gl_capture->glc, GLC_STATE_CANCEL)) {
+			ret = EINTR;
+			break;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &abstime);
+		abstime.tv_nsec += 100000000;
+		if (abstime.tv_nsec >= 1000000000) {
+			abstime.tv_sec++;
+			abstime.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&video->pbo_cond, &video->pbo_mutex, &abstime);
+	}
+	pthread_mutex_unlock(&video->pbo_mutex);
+
+	return ret;
+}
+
+int gl_capture_wait_slot(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	int ret;
+
+	/* nobody else writes pending pictures without worker */
+	if ((!video->worker) && (video->pbo_active == video->pbo_count)) {
+		ret = gl_capture_write_pbo(gl_capture, video, PS_PACKET_WRITE);
+		if ((ret) && (ret != EAGAIN))
+			return ret;
+	}
+
+	return gl_capture_wait_pbo(gl_capture, video, video->pbo_count - 1);
+}
+
+int gl_capture_flush_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	int ret;
+
+	if (!video->worker) {
+		while (!(ret = gl_capture_write_pbo(gl_capture, video, PS_PACKET_WRITE)));
+		if (ret != EAGAIN)
+			return ret;
+	}
+
+	/* and wait until pack has released referenced pictures */
+	return gl_capture_wait_pbo(gl_capture, video, 0);
+}
+
+int gl_capture_flush_stopped(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable)
+{
+	struct gl_capture_video_stream_s *video;
+	int ret;
+
+	/* capturing not active, write what stop couldn't */
+	pthread_rwlock_rdlock(&gl_capture->videolist_lock);
+	for (video = gl_capture->video; video != NULL; video = video->next) {
+		if ((video->drawable == drawable) && (video->dpy == dpy))
+			break;
+	}
+	pthread_rwlock_unlock(&gl_capture->videolist_lock);
+
+	if ((!video) || (!video->pbo_active) ||
+	    (glc_state_test(gl_capture->glc, GLC_STATE_CANCEL)))
+		return 0;
+
+	if ((ret = gl_capture_flush_pbo(gl_capture, video)))
+		gl_capture_error(gl_capture, ret);
+	return ret;
+}
+
+int gl_capture_create_worker(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	struct gl_capture_worker_s *worker;
+	GLXContext share = glXGetCurrentContext();
+	GLXFBConfig *configs;
+	int attribs[] = {GLX_FBCONFIG_ID, 0, None};
+	int count, ret;
+
+	/* worker waits for fences created by this context */
+	if (!(gl_capture->flags & GL_CAPTURE_USE_SYNC))
+		return ENOTSUP;
+	if (!share)
+		return EINVAL;
+
+	/* worker context must be compatible with the application's one */
+	if (glXQueryContext(video->dpy, share, GLX_FBCONFIG_ID, &attribs[1]) != Success)
+		return ENOTSUP;
+
+	worker = (struct gl_capture_worker_s *) malloc(sizeof(struct gl_capture_worker_s));
+	memset(worker, 0, sizeof(struct gl_capture_worker_s));
+	worker->gl_capture = gl_capture;
+	worker->video = video;
+
+	/* application may use its Display while worker runs */
+	if (!(worker->dpy = XOpenDisplay(DisplayString(video->dpy)))) {
+		free(worker);
+		return ENOTSUP;
+	}
+
+	configs = glXChooseFBConfig(worker->dpy, video->screen, attribs, &count);
+	if ((!configs) | (count < 1)) {
+		if (configs)
+			XFree(configs);
+		XCloseDisplay(worker->dpy);
+		free(worker);
+		return ENOTSUP;
+	}
+
+	worker->ctx = glXCreateNewContext(worker->dpy, configs[0], GLX_RGBA_TYPE, share, True);
+	XFree(configs);
+	if (!worker->ctx) {
+		XCloseDisplay(worker->dpy);
+		free(worker);
+		return ENOTSUP;
+	}
+
+	ps_packet_init(&worker->packet, gl_capture->to);
+
+	if ((ret = pthread_create(&worker->thread, NULL, gl_capture_worker_thread, worker)))
+		goto err;
+
+	/* wait until worker has made its context current */
+	pthread_mutex_lock(&video->pbo_mutex);
+	while (!(worker->flags & GL_CAPTURE_WORKER_STARTED))
+		pthread_cond_wait(&video->pbo_cond, &video->pbo_mutex);
+	ret = worker->ret;
+	pthread_mutex_unlock(&video->pbo_mutex);
+
+	if (ret) {
+		pthread_join(worker->thread, NULL);
+		goto err;
+	}
+
+	glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+		 "transferring video %d in worker thread", video->id);
+	video->worker = worker;
+	return 0;
+
+err:
+	ps_packet_destroy(&worker->packet);
+	glXDestroyContext(worker->dpy, worker->ctx);
+	XCloseDisplay(worker->dpy);
+	free(worker);
+	return ret;
+}
+
+int gl_capture_destroy_worker(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	struct gl_capture_worker_s *worker = video->worker;
+
+	/* pending transfers are dropped, just as without worker */
+	pthread_mutex_lock(&video->pbo_mutex);
+	worker->flags |= GL_CAPTURE_WORKER_QUIT;
+	pthread_cond_broadcast(&video->pbo_cond);
+	pthread_mutex_unlock(&video->pbo_mutex);
+
+	pthread_join(worker->thread, NULL);
+
+	glXDestroyContext(worker->dpy, worker->ctx);
+	XCloseDisplay(worker->dpy);
+	ps_packet_destroy(&worker->packet);
+
+	free(worker);
+	video->worker = NULL;
+	return 0;
+}
+
+void *gl_capture_worker_thread(void *argptr)
+{
+	struct gl_capture_worker_s *worker = (struct gl_capture_worker_s *) argptr;
+	struct gl_capture_video_stream_s *video = worker->video;
+	gl_capture_t gl_capture = worker->gl_capture;
+	struct gl_capture_pbo_s *pbo;
+	GLenum status;
+	int ret = 0;
+
+	if (!glXMakeContextCurrent(worker->dpy, video->drawable, video->drawable, worker->ctx))
+		ret = ENOTSUP;
+
+	pthread_mutex_lock(&video->pbo_mutex);
+	worker->ret = ret;
+	worker->flags |= GL_CAPTURE_WORKER_STARTED;
+	pthread_cond_broadcast(&video->pbo_cond);
+	pthread_mutex_unlock(&video->pbo_mutex);
+
+	if (ret)
+		return NULL;
+
+	for (;;) {
+		pthread_mutex_lock(&video->pbo_mutex);
+		while ((!video->pbo_pending) && (!(worker->flags & GL_CAPTURE_WORKER_QUIT)))
+			pthread_cond_wait(&video->pbo_cond, &video->pbo_mutex);
+		if (worker->flags & GL_CAPTURE_WORKER_QUIT) {
+			pthread_mutex_unlock(&video->pbo_mutex);
+			break;
+		}
+		pbo = gl_capture_pending_pbo(video);
+		pthread_mutex_unlock(&video->pbo_mutex);
+
+		/* wait in small steps so that quit requests are noticed */
+		do {
+			status = gl_capture->glClientWaitSync(pbo->fence, 0, 100000000);
+		} while ((status == GL_TIMEOUT_EXPIRED) &&
+			 (!(worker->flags & GL_CAPTURE_WORKER_QUIT)));
+
+		if (status == GL_WAIT_FAILED)
+			ret = EINVAL;
+		else if (status == GL_TIMEOUT_EXPIRED)
+			continue; /* quitting */
+		else
+			ret = gl_capture_write_pbo(gl_capture, video, PS_PACKET_WRITE);
+
+		if (ret) {
+			if (ret != EINTR)
+				gl_capture_error(gl_capture, ret);
+
+			pthread_mutex_lock(&video->pbo_mutex);
+			worker->ret = ret;
+			pthread_cond_broadcast(&video->pbo_cond);
+			pthread_mutex_unlock(&video->pbo_mutex);
+			break;
+		}
+	}
+
+	glXMakeContextCurrent(worker->dpy, None, None, NULL);
+	return NULL;
+}
+
+int gl_capture_init_fbo(gl_capture_t gl_capture)
+{
+	const char *gl_extensions = (const char *) glGetString(GL_EXTENSIONS);
+
+	if (gl_extensions == NULL)
+		return EINVAL;
+
+	if ((!strstr(gl_extensions, "GL_EXT_framebuffer_object")) |
+	    (!strstr(gl_extensions, "GL_ARB_texture_rectangle")) |
+	    (!strstr(gl_extensions, "GL_ARB_fragment_shader")) |
+	    (!strstr(gl_extensions, "GL_ARB_vertex_shader")))
+		return ENOTSUP;
+
+	if (!gl_capture->libGL_handle) {
+		gl_capture->libGL_handle = dlopen("libGL.so.1", RTLD_LAZY);
+		if (!gl_capture->libGL_handle)
+			return ENOTSUP;
+	}
+	if (!gl_capture->glXGetProcAddress) {
+		gl_capture->glXGetProcAddress =
+			(GLXGetProcAddressProc)
+			dlsym(gl_capture->libGL_handle, "glXGetProcAddressARB");
+		if (!gl_capture->glXGetProcAddress)
+			return ENOTSUP;
+	}
+
+#define GL_CAPTURE_GET_PROC(type, func, name) \
+	gl_capture->func = (type) gl_capture->glXGetProcAddress((const GLubyte *) name); \
+	if (!gl_capture->func) \
+		return ENOTSUP;
+
+	GL_CAPTURE_GET_PROC(PFNGLGENFRAMEBUFFERSEXTPROC, glGenFramebuffers, "glGenFramebuffersEXT")
+	GL_CAPTURE_GET_PROC(PFNGLDELETEFRAMEBUFFERSEXTPROC, glDeleteFramebuffers, "glDeleteFramebuffersEXT")
+	GL_CAPTURE_GET_PROC(PFNGLBINDFRAMEBUFFEREXTPROC, glBindFramebuffer, "glBindFramebufferEXT")
+	GL_CAPTURE_GET_PROC(PFNGLFRAMEBUFFERTEXTURE2DEXTPROC, glFramebufferTexture2D, "glFramebufferTexture2DEXT")
+	GL_CAPTURE_GET_PROC(PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC, glCheckFramebufferStatus, "glCheckFramebufferStatusEXT")
+	GL_CAPTURE_GET_PROC(PFNGLACTIVETEXTUREARBPROC, glActiveTexture, "glActiveTextureARB")
+	GL_CAPTURE_GET_PROC(PFNGLCREATESHADERPROC, glCreateShader, "glCreateShader")
+	GL_CAPTURE_GET_PROC(PFNGLDELETESHADERPROC, glDeleteShader, "glDeleteShader")
+	GL_CAPTURE_GET_PROC(PFNGLSHADERSOURCEPROC, glShaderSource, "glShaderSource")
+	GL_CAPTURE_GET_PROC(PFNGLCOMPILESHADERPROC, glCompileShader, "glCompileShader")
+	GL_CAPTURE_GET_PROC(PFNGLGETSHADERIVPROC, glGetShaderiv, "glGetShaderiv")
+	GL_CAPTURE_GET_PROC(PFNGLCREATEPROGRAMPROC, glCreateProgram, "glCreateProgram")
+	GL_CAPTURE_GET_PROC(PFNGLDELETEPROGRAMPROC, glDeleteProgram, "glDeleteProgram")
+	GL_CAPTURE_GET_PROC(PFNGLATTACHSHADERPROC, glAttachShader, "glAttachShader")
+	GL_CAPTURE_GET_PROC(PFNGLLINKPROGRAMPROC, glLinkProgram, "glLinkProgram")
+	GL_CAPTURE_GET_PROC(PFNGLGETPROGRAMIVPROC, glGetProgramiv, "glGetProgramiv")
+	GL_CAPTURE_GET_PROC(PFNGLUSEPROGRAMPROC, glUseProgram, "glUseProgram")
+	GL_CAPTURE_GET_PROC(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation, "glGetUniformLocation")
+	GL_CAPTURE_GET_PROC(PFNGLUNIFORM1IPROC, glUniform1i, "glUniform1i")
+	GL_CAPTURE_GET_PROC(PFNGLUNIFORM1FPROC, glUniform1f, "glUniform1f")
+	GL_CAPTURE_GET_PROC(PFNGLUNIFORM2FPROC, glUniform2f, "glUniform2f")
+
+#undef GL_CAPTURE_GET_PROC
+
+	glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+		 "using GL_EXT_framebuffer_object and GLSL");
+
+	return 0;
+}
+
+int gl_capture_compile_shader(gl_capture_t gl_capture, GLenum type,
+			      const char *source, GLuint *shader)
+{
+	GLint status;
+
+	*shader = gl_capture->glCreateShader(type);
+	gl_capture->glShaderSource(*shader, 1, (const GLchar **) &source, NULL);
+	gl_capture->glCompileShader(*shader);
+	gl_capture->glGetShaderiv(*shader, GL_COMPILE_STATUS, &status);
+
+	if (!status) {
+		gl_capture->glDeleteShader(*shader);
+		*shader = 0;
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+int gl_capture_create_program(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	GLuint vertex, fragment;
+	GLint status;
+	int ret;
+
+	if ((ret = gl_capture_compile_shader(gl_capture, GL_VERTEX_SHADER,
+					     gl_capture_vertex_shader, &vertex)))
+		return ret;
+	if ((ret = gl_capture_compile_shader(gl_capture, GL_FRAGMENT_SHADER,
+					     video->format == GLC_VIDEO_YCBCR_420JPEG ?
+					     gl_capture_ycbcr_shader : gl_capture_rgb_shader,
+					     &fragment))) {
+		gl_capture->glDeleteShader(vertex);
+		return ret;
+	}
+
+	video->program = gl_capture->glCreateProgram();
+	gl_capture->glAttachShader(video->program, vertex);
+	gl_capture->glAttachShader(video->program, fragment);
+	gl_capture->glLinkProgram(video->program);
+
+	/* program keeps references to shaders */
+	gl_capture->glDeleteShader(vertex);
+	gl_capture->glDeleteShader(fragment);
+
+	gl_capture->glGetProgramiv(video->program, GL_LINK_STATUS, &status);
+	if (!status) {
+		gl_capture->glDeleteProgram(video->program);
+		video->program = 0;
+		return EINVAL;
+	}
+
+	video->program_frame = gl_capture->glGetUniformLocation(video->program, "frame");
+	video->program_size = gl_capture->glGetUniformLocation(video->program, "size");
+	video->program_ratio = gl_capture->glGetUniformLocation(video->program, "ratio");
+	video->program_height = gl_capture->glGetUniformLocation(video->program, "height");
+
+	return 0;
+}
+
+int gl_capture_create_fbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	GLint framebuffer, texture, program;
+	GLenum status;
+	int ret = 0;
+
+	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture",
+		 "creating %ux%u FBO", video->fbo_w, video->fbo_h);
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &framebuffer);
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	glPushAttrib(GL_ALL_ATTRIB_BITS);
+	gl_capture->glActiveTexture(GL_TEXTURE0_ARB);
+	glGetIntegerv(GL_TEXTURE_BINDING_RECTANGLE_ARB, &texture);
+
+	if ((!video->program) &&
+	    (ret = gl_capture_create_program(gl_capture, video)))
+		goto finish;
+
+	gl_capture->glUseProgram(video->program);
+	gl_capture->glUniform1i(video->program_frame, 0);
+	gl_capture->glUniform2f(video->program_size, video->ow, video->oh);
+	if (gl_capture->flags & GL_CAPTURE_SCALE)
+		gl_capture->glUniform2f(video->program_ratio,
+					1.0 / gl_capture->scale, 1.0 / gl_capture->scale);
+	else
+		gl_capture->glUniform2f(video->program_ratio, 1.0, 1.0);
+	gl_capture->glUniform1f(video->program_height, video->ch);
+
+	/* source picture is copied from read buffer */
+	glGenTextures(1, &video->source_texture);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, video->source_texture);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA8, video->cw, video->ch, 0,
+		     GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+
+	/* and converted into this one */
+	glGenTextures(1, &video->fbo_texture);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, video->fbo_texture);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA8, video->fbo_w, video->fbo_h, 0,
+		     GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+
+	gl_capture->glGenFramebuffers(1, &video->fbo);
+	gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, video->fbo);
+	gl_capture->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+					   GL_TEXTURE_RECTANGLE_ARB, video->fbo_texture, 0);
+
+	status = gl_capture->glCheckFramebufferStatus(GL_FRAMEBUFFER_EXT);
+	if (status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+		glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture",
+			 "FBO is not complete (0x%04x)", status);
+		ret = ENOTSUP;
+	}
+
+finish:
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texture);
+	glPopAttrib();
+	gl_capture->glUseProgram(program);
+	gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, framebuffer);
+
+	if (ret)
+		gl_capture_destroy_fbo(gl_capture, video);
+	return ret;
+}
+
+int gl_capture_destroy_fbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture", "destroying FBO");
+
+	if (video->fbo)
+		gl_capture->glDeleteFramebuffers(1, &video->fbo);
+	if (video->fbo_texture)
+		glDeleteTextures(1, &video->fbo_texture);
+	if (video->source_texture)
+		glDeleteTextures(1, &video->source_texture);
+
+	video->fbo = video->fbo_texture = video->source_texture = 0;
+	return 0;
+}
+
+int gl_capture_render_fbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	GLint framebuffer, texture, program;
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &framebuffer);
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	glPushAttrib(GL_ALL_ATTRIB_BITS);
+	gl_capture->glActiveTexture(GL_TEXTURE0_ARB);
+	glGetIntegerv(GL_TEXTURE_BINDING_RECTANGLE_ARB, &texture);
+
+	/* copy capture area from the window */
+	gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+	glReadBuffer(gl_capture->capture_buffer);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, video->source_texture);
+	glCopyTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, 0, 0,
+			    video->cx, video->cy, video->cw, video->ch);
+
+	/* and run it through the conversion shader */
+	gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, video->fbo);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	glViewport(0, 0, video->fbo_w, video->fbo_h);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glDisable(GL_ALPHA_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_DITHER);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	gl_capture->glUseProgram(video->program);
+
+	glBegin(GL_QUADS);
+	glVertex2f(-1.0f, -1.0f);
+	glVertex2f( 1.0f, -1.0f);
+	glVertex2f( 1.0f,  1.0f);
+	glVertex2f(-1.0f,  1.0f);
+	glEnd();
+
+	gl_capture->glUseProgram(program);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texture);
+	glPopAttrib();
+	gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, framebuffer);
+
+	return 0;
+}
+
+int gl_capture_init_vblank(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	const char *glx_extensions = glXQueryExtensionsString(video->dpy, video->screen);
+
+	if (glx_extensions == NULL)
+		return EINVAL;
+
+	if (!strstr(glx_extensions, "GLX_SGI_video_sync"))
+		return ENOTSUP;
+
+	if (!gl_capture->libGL_handle) {
+		gl_capture->libGL_handle = dlopen("libGL.so.1", RTLD_LAZY);
+		if (!gl_capture->libGL_handle)
+			return ENOTSUP;
+	}
+	if (!gl_capture->glXGetProcAddress) {
+		gl_capture->glXGetProcAddress =
+			(GLXGetProcAddressProc)
+			dlsym(gl_capture->libGL_handle, "glXGetProcAddressARB");
+		if (!gl_capture->glXGetProcAddress)
+			return ENOTSUP;
+	}
+
+	gl_capture->glXGetVideoSyncSGI =
+		(PFNGLXGETVIDEOSYNCSGIPROC)
+		gl_capture->glXGetProcAddress((const GLubyte *) "glXGetVideoSyncSGI");
+	if (!gl_capture->glXGetVideoSyncSGI)
+		return ENOTSUP;
+	gl_capture->glXWaitVideoSyncSGI =
+		(PFNGLXWAITVIDEOSYNCSGIPROC)
+		gl_capture->glXGetProcAddress((const GLubyte *) "glXWaitVideoSyncSGI");
+	if (!gl_capture->glXWaitVideoSyncSGI)
+		return ENOTSUP;
+
+	glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+		 "using GLX_SGI_video_sync");
+
+	return 0;
+}
+
+int gl_capture_pace(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+		    glc_utime_t deadline)
+{
+	struct timespec ts;
+	glc_utime_t now, wake;
+	glc_stime_t margin, late;
+	unsigned int count;
+
+	if ((video->pacing == GL_CAPTURE_PACE_VBLANK) &&
+	    (!gl_capture->glXWaitVideoSyncSGI)) {
+		if (gl_capture_init_vblank(gl_capture, video)) {
+			glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+				 "vblank pacing is not supported, using hybrid pacing for video %d",
+				 video->id);
+			video->pacing = GL_CAPTURE_PACE_HYBRID;
+		}
+	}
+
+	now = glc_state_time(gl_capture->glc);
+	if (now < deadline) {
+		/* wake up early by the amount we have overslept before */
+		margin = video->pace_overshoot;
+		if (video->pacing != GL_CAPTURE_PACE_SLEEP)
+			margin += GL_CAPTURE_PACE_SPIN;
+
+		if (deadline - now > margin) {
+			wake = deadline - margin;
+
+			/* absolute deadline, so signals don't make us drift */
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_sec += (wake - now) / 1000000;
+			ts.tv_nsec += ((wake - now) % 1000000) * 1000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+			/* track scheduler latency, 1/8 weight for new sample */
+			now = glc_state_time(gl_capture->glc);
+			late = (glc_stime_t) now - (glc_stime_t) wake;
+			video->pace_overshoot += (late - video->pace_overshoot) / 8;
+			if (video->pace_overshoot < 0)
+				video->pace_overshoot = 0;
+			else if (video->pace_overshoot > gl_capture->fps / 2)
+				video->pace_overshoot = gl_capture->fps / 2;
+		}
+
+		/* spin the rest */
+		if (video->pacing != GL_CAPTURE_PACE_SLEEP) {
+			while (glc_state_time(gl_capture->glc) < deadline);
+		}
+	}
+
+	/* and let the swap land right after vertical blank */
+	if (video->pacing == GL_CAPTURE_PACE_VBLANK) {
+		if (!gl_capture->glXGetVideoSyncSGI(&count))
+			gl_capture->glXWaitVideoSyncSGI(2, (count + 1) % 2, &count);
+	}
+
+	return 0;
+}
+
 int gl_capture_get_video_stream(gl_capture_t gl_capture, struct gl_capture_video_stream_s **video, Display *dpy, GLXDrawable drawable)
 {
 	struct gl_capture_video_stream_s *fvideo;
@@ -647,6 +2156,9 @@ int gl_capture_get_video_stream(gl_capture_t gl_capture, struct gl_capture_video
 		fvideo->dpy = dpy;
 		fvideo->drawable = drawable;
 		ps_packet_init(&fvideo->packet, gl_capture->to);
+		pthread_mutex_init(&fvideo->pbo_mutex, NULL);
+		pthread_cond_init(&fvideo->pbo_cond, NULL);
+		fvideo->pacing = gl_capture->pacing;
 
 		glc_state_video_new(gl_capture->glc, &fvideo->id, &fvideo->state_video);
 
@@ -669,6 +2181,7 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 	glc_message_header_t msg;
 	glc_video_format_message_t format_msg;
 	unsigned int w, h;
+	int ret;
 
 	/* initialize PBO if not already done */
 	if ((!(gl_capture->flags & GL_CAPTURE_USE_PBO)) &&
@@ -683,6 +2196,22 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 		pthread_mutex_unlock(&gl_capture->init_pbo_mutex);
 	}
 
+	/* and FBO for conversion */
+	if ((!(gl_capture->flags & GL_CAPTURE_USE_FBO)) &&
+	    (gl_capture->flags & GL_CAPTURE_TRY_FBO)) {
+		pthread_mutex_lock(&gl_capture->init_pbo_mutex);
+
+		if (!gl_capture_init_fbo(gl_capture))
+			gl_capture->flags |= GL_CAPTURE_USE_FBO;
+		else {
+			glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+				 "GPU conversion and scaling are not supported");
+			gl_capture->flags &= ~GL_CAPTURE_TRY_FBO;
+		}
+
+		pthread_mutex_unlock(&gl_capture->init_pbo_mutex);
+	}
+
 	gl_capture_get_geometry(gl_capture, video->dpy,
 				video->attribWin ? video->attribWin : video->drawable,
 				&w, &h);
@@ -694,29 +2223,52 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 		/* reset gamma values */
 		video->gamma_red = video->gamma_green = video->gamma_blue = 1.0;
 
-		if (gl_capture->format == GL_BGRA)
-			video->format = GLC_VIDEO_BGRA;
-		else if (gl_capture->format == GL_BGR)
-			video->format = GLC_VIDEO_BGR;
-		else
-			return EINVAL;
-
-		if (gl_capture->pack_alignment == 8)
-			video->flags |= GLC_VIDEO_DWORD_ALIGNED;
+		if ((ret = gl_capture_update_format(gl_capture, video)))
+			return ret;
 	}
 
-	if ((w != video->w) | (h != video->h)) {
+	if ((w != video->w) | (h != video->h) |
+	    (__atomic_exchange_n(&video->refresh_format, 0, __ATOMIC_ACQ_REL))) {
+		/* pending transfers still have old geometry */
+		if (video->pbo_active) {
+			if ((ret = gl_capture_flush_pbo(gl_capture, video)))
+				return ret;
+		}
+
 		gl_capture_calc_geometry(gl_capture, video, w, h);
 
+		if (video->fbo)
+			gl_capture_destroy_fbo(gl_capture, video);
+
+		if ((video->format == GLC_VIDEO_YCBCR_420JPEG) |
+		    ((gl_capture->flags & GL_CAPTURE_USE_FBO) &&
+		     (gl_capture->flags & GL_CAPTURE_SCALE))) {
+			if (gl_capture_create_fbo(gl_capture, video)) {
+				/* fall back to reading pixels as they are */
+				glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+					 "can't process video %d on GPU", video->id);
+				gl_capture->flags &= ~(GL_CAPTURE_TRY_FBO | GL_CAPTURE_USE_FBO);
+				if (video->program) {
+					gl_capture->glDeleteProgram(video->program);
+					video->program = 0;
+				}
+				gl_capture_update_format(gl_capture, video);
+				gl_capture_calc_geometry(gl_capture, video, w, h);
+			}
+		}
+
 		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
 			 "creating/updating configuration for video %d", video->id);
 
+		/* first picture in new format must be complete */
+		video->frame_hashed = 0;
+
 		msg.type = GLC_MESSAGE_VIDEO_FORMAT;
 		format_msg.flags = video->flags;
 		format_msg.format = video->format;
 		format_msg.id = video->id;
-		format_msg.width = video->cw;
-		format_msg.height = video->ch;
+		format_msg.width = video->ow;
+		format_msg.height = video->oh;
 
 		ps_packet_open(&video->packet, PS_PACKET_WRITE);
 		ps_packet_write(&video->packet, &msg, sizeof(glc_message_header_t));
@@ -725,7 +2277,7 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 
 		glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture",
 			 "video %d: %ux%u (%ux%u), 0x%02x flags", video->id,
-			 video->cw, video->ch, video->w, video->h, video->flags);
+			 video->ow, video->oh, video->w, video->h, video->flags);
 
 		/* how about color correction? */
 		gl_capture_update_color(gl_capture, video);
@@ -734,12 +2286,32 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 			if (video->pbo)
 				gl_capture_destroy_pbo(gl_capture, video);
 
-			if (gl_capture_create_pbo(gl_capture, video)) {
+			ret = gl_capture_create_pbo(gl_capture, video);
+			if ((ret) && (gl_capture->flags & GL_CAPTURE_USE_REFS)) {
+				/* copy pictures from ordinary PBOs instead */
+				glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+					 "can't map PBOs of video %d persistently", video->id);
+				gl_capture->flags &= ~(GL_CAPTURE_TRY_REFS | GL_CAPTURE_USE_REFS);
+				ret = gl_capture_create_pbo(gl_capture, video);
+			}
+
+			if (ret) {
 				gl_capture->flags &= ~(GL_CAPTURE_TRY_PBO | GL_CAPTURE_USE_PBO);
 				/** \todo destroy pbo stuff? */
 				/** \todo race condition? */
 			}
 		}
+
+		/* worker keeps running over geometry changes */
+		if ((gl_capture->flags & GL_CAPTURE_USE_PBO) &&
+		    (gl_capture->flags & GL_CAPTURE_TRY_WORKER) &&
+		    (!video->worker)) {
+			if (gl_capture_create_worker(gl_capture, video)) {
+				glc_log(gl_capture->glc, GLC_WARNING, "gl_capture",
+					 "can't create worker thread for video %d", video->id);
+				gl_capture->flags &= ~GL_CAPTURE_TRY_WORKER;
+			}
+		}
 	}
 
 
@@ -755,12 +2327,14 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 	struct gl_capture_video_stream_s *video;
 	glc_message_header_t msg;
 	glc_video_frame_header_t pic;
+	glc_shared_ref_t ref;
 	glc_utime_t now;
 	char *dma;
+	int packet_flags, has_ref = 0;
 	int ret = 0;
 
 	if (!(gl_capture->flags & GL_CAPTURE_CAPTURING))
-		return 0; /* capturing not active */
+		return gl_capture_flush_stopped(gl_capture, dpy, drawable);
 
 	gl_capture_get_video_stream(gl_capture, &video, dpy, drawable);
 
@@ -772,12 +2346,7 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 		now = video->last + gl_capture->fps;
 	else
 		now = glc_state_time(gl_capture->glc);
-
-	/* if we are using PBO we will actually write previous picture to buffer */
-	if (gl_capture->flags & GL_CAPTURE_USE_PBO)
-		pic.time = video->pbo_time;
-	else
-		pic.time = now;
+	pic.time = now;
 
 	/* has gl_capture->fps microseconds elapsed since last capture */
 	if ((now - video->last < gl_capture->fps) &&
@@ -789,51 +2358,89 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 	if ((ret = gl_capture_update_video_stream(gl_capture, video)))
 		goto finish;
 
-	/* if PBO is not active, just start transfer and finish */
-	if ((gl_capture->flags & GL_CAPTURE_USE_PBO) && (!video->pbo_active)) {
-		ret = gl_capture_start_pbo(gl_capture, video);
-		video->pbo_time = now;
-
-		goto finish;
-	}
-
-	if (ps_packet_open(&video->packet, ((gl_capture->flags & GL_CAPTURE_LOCK_FPS) |
-					    (gl_capture->flags & GL_CAPTURE_IGNORE_TIME)) ?
-					   (PS_PACKET_WRITE) :
-					   (PS_PACKET_WRITE | PS_PACKET_TRY)))
-		goto finish;
-	if ((ret = ps_packet_write(&video->packet, &msg, sizeof(glc_message_header_t))))
-		goto cancel;
-	if ((ret = ps_packet_write(&video->packet, &pic, sizeof(glc_video_frame_header_t))))
-		goto cancel;
+	packet_flags = ((gl_capture->flags & GL_CAPTURE_LOCK_FPS) |
+			(gl_capture->flags & GL_CAPTURE_IGNORE_TIME)) ?
+		       (PS_PACKET_WRITE) :
+		       (PS_PACKET_WRITE | PS_PACKET_TRY);
 
 	if (gl_capture->flags & GL_CAPTURE_USE_PBO) {
-		/* is this safe, what happens if this is called simultaneously? */
-		if ((ret = ps_packet_setsize(&video->packet, video->row * video->ch
-								+ sizeof(glc_message_header_t)
-								+ sizeof(glc_video_frame_header_t))))
-			goto cancel;
-
-		if ((ret = gl_capture_read_pbo(gl_capture, video)))
-			goto cancel;
+		/* write previous pictures that are ready to buffer */
+		if ((!video->worker) &&
+		    (ret = gl_capture_read_pbo(gl_capture, video, packet_flags)))
+			goto finish;
+
+		if (!(packet_flags & PS_PACKET_TRY)) {
+			/* dropping is not allowed, make room for this picture */
+			if ((ret = gl_capture_wait_slot(gl_capture, video))) {
+				if (ret == EINTR)
+					ret = 0; /* cancelled, error is already reported */
+				goto finish;
+			}
+		}
 
-		ret = gl_capture_start_pbo(gl_capture, video);
-		video->pbo_time = now;
+		/* and start transfer for this one */
+		if (gl_capture_start_pbo(gl_capture, video, now) == EBUSY) {
+			__atomic_add_fetch(&gl_capture->dropped, 1, __ATOMIC_RELAXED);
+			glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
+				 "dropped frame, all PBOs are busy");
+			goto finish;
+		}
 	} else {
-		if ((ret = ps_packet_dma(&video->packet, (void *) &dma,
-					video->row * video->ch, PS_ACCEPT_FAKE_DMA)))
-		goto cancel;
+		if (ps_packet_open(&video->packet, packet_flags))
+			goto finish;
+
+		if (gl_capture->ring) {
+			/* pixels go to mirrored ring, buffer gets only a reference */
+			if ((ret = glc_ring_alloc(gl_capture->ring, GLC_MESSAGE_VIDEO_FRAME,
+						  sizeof(glc_video_frame_header_t) + video->size,
+						  packet_flags & PS_PACKET_TRY, &ref)))
+				goto cancel;
+			has_ref = 1;
+			memcpy(ref.data, &pic, sizeof(glc_video_frame_header_t));
+			dma = (char *) ref.data + sizeof(glc_video_frame_header_t);
+		} else {
+			if ((ret = ps_packet_write(&video->packet, &msg,
+						   sizeof(glc_message_header_t))))
+				goto cancel;
+			if ((ret = ps_packet_write(&video->packet, &pic,
+						   sizeof(glc_video_frame_header_t))))
+				goto cancel;
+			if ((ret = ps_packet_dma(&video->packet, (void *) &dma,
+						video->size, PS_ACCEPT_FAKE_DMA)))
+				goto cancel;
+		}
+
+		if ((ret = gl_capture_get_pixels(gl_capture, video, dma)))
+			goto cancel;
 
-		ret = gl_capture_get_pixels(gl_capture, video, dma);
+		if ((gl_capture->flags & GL_CAPTURE_DETECT_REPEAT) &&
+		    (gl_capture_is_repeat(gl_capture, video, (unsigned char *) dma))) {
+			/* replace picture with a repeat message */
+			ps_packet_cancel(&video->packet);
+			if (has_ref) {
+				has_ref = 0;
+				ref.release(ref.arg);
+			}
+			if ((ret = gl_capture_write_repeat(gl_capture, video, now, packet_flags)))
+				goto finish;
+		} else if (has_ref) {
+			has_ref = 0;
+			msg.type = GLC_MESSAGE_SHARED_REF;
+			if ((ret = ps_packet_write(&video->packet, &msg,
+						   sizeof(glc_message_header_t))) ||
+			    (ret = ps_packet_write(&video->packet, &ref,
+						   sizeof(glc_shared_ref_t)))) {
+				ref.release(ref.arg);
+				goto cancel;
+			}
+			ps_packet_close(&video->packet);
+		} else
+			ps_packet_close(&video->packet);
 	}
 
 	if ((gl_capture->flags & GL_CAPTURE_LOCK_FPS) &&
-	    !(gl_capture->flags & GL_CAPTURE_IGNORE_TIME)) {
-		now = glc_state_time(gl_capture->glc);
-
-		if (now - video->last < gl_capture->fps)
-			usleep(gl_capture->fps + video->last - now);
-	}
+	    !(gl_capture->flags & GL_CAPTURE_IGNORE_TIME))
+		gl_capture_pace(gl_capture, video, video->last + gl_capture->fps);
 
 	/* increment by 1/fps seconds */
 	video->last += gl_capture->fps;
@@ -849,8 +2456,6 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 			video->last = now - 0.5 * gl_capture->fps;
 	}
 
-	ps_packet_close(&video->packet);
-
 finish:
 	if (ret != 0)
 		gl_capture_error(gl_capture, ret);
@@ -862,9 +2467,12 @@ finish:
 cancel:
 	if (ret == EBUSY) {
 		ret = 0;
+		__atomic_add_fetch(&gl_capture->dropped, 1, __ATOMIC_RELAXED);
 		glc_log(gl_capture->glc, GLC_INFORMATION, "gl_capture",
 			 "dropped frame, buffer not ready");
 	}
+	if (has_ref)
+		ref.release(ref.arg);
 	ps_packet_cancel(&video->packet);
 	goto finish;
 }
@@ -84,6 +84,87 @@ __PUBLIC int gl_capture_set_pack_alignment(gl_capture_t gl_capture,
  */
 __PUBLIC int gl_capture_try_pbo(gl_capture_t gl_capture, int try_pbo);
 
+/**
+ * \brief set number of PBOs per video stream
+ *
+ * Pictures are read into a ring of PBOs and written to target
+ * buffer only when GPU has finished the transfer. If GL_ARB_sync
+ * is not supported, oldest PBO is mapped when all of them are in use.
+ *
+ * Default is 3. Takes effect when video stream is (re)configured.
+ * \param gl_capture gl_capture object
+ * \param count number of PBOs, at least 1
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_pbo_count(gl_capture_t gl_capture, unsigned int count);
+
+/**
+ * \brief map PBOs in a worker thread
+ *
+ * Each video stream gets a thread with a GLX context shared with
+ * the application's one. Rendering thread only starts transfers and
+ * worker waits for them, maps PBOs and writes pictures to target
+ * buffer. Requires GL_ARB_sync and GLX 1.3. PBOs are
+ * mapped in rendering thread if worker can't be created.
+ *
+ * Worker uses application's X Display when making its context
+ * current, while rendering thread waits for it.
+ * \param gl_capture gl_capture object
+ * \param try_worker 1 means gl_capture tries to use worker thread,
+ *                   0 maps PBOs in rendering thread
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_try_worker(gl_capture_t gl_capture, int try_worker);
+
+/**
+ * \brief pass references to persistently mapped PBOs
+ *
+ * PBOs are allocated with GL_ARB_buffer_storage and mapped once.
+ * Instead of copying pictures, gl_capture writes small
+ * GLC_MESSAGE_VIDEO_FRAME_REF messages that point into mapped
+ * memory, and PBO is reused only after reader has released it.
+ * Requires GL_ARB_sync. Pictures are copied as usual if persistent
+ * mapping is not supported.
+ *
+ * Target buffer must be read by pack, which resolves references.
+ * gl_capture_destroy() waits until all references are released.
+ * \param gl_capture gl_capture object
+ * \param try_refs 1 means gl_capture tries to pass references,
+ *                 0 copies pictures to target buffer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_try_frame_refs(gl_capture_t gl_capture, int try_refs);
+
+/**
+ * \brief convert pictures to Y'CbCr 420JPEG on GPU
+ *
+ * Picture is rendered into a framebuffer object with a fragment
+ * shader that does the conversion and only converted planes are
+ * read back. Requires GL_EXT_framebuffer_object and GLSL. If they
+ * are not supported, pictures are captured in selected pixel format.
+ *
+ * Odd width or height is rounded down.
+ * \param gl_capture gl_capture object
+ * \param convert 1 means pictures are converted when possible,
+ *                0 disables conversion
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_convert_ycbcr_420jpeg(gl_capture_t gl_capture, int convert);
+
+/**
+ * \brief scale pictures on GPU
+ *
+ * Cropped area is rendered into a framebuffer object of scaled
+ * size before readback, so only scaled picture is transferred.
+ * Video format message reports scaled size. Requirements are same
+ * as with gl_capture_convert_ycbcr_420jpeg(). If they are not met,
+ * pictures are captured unscaled.
+ * \param gl_capture gl_capture object
+ * \param scale scale factor, 1.0 disables scaling
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_scale(gl_capture_t gl_capture, double scale);
+
 /**
  * \brief set pixel format
  *
@@ -94,6 +175,50 @@ __PUBLIC int gl_capture_try_pbo(gl_capture_t gl_capture, int try_pbo);
  */
 __PUBLIC int gl_capture_set_pixel_format(gl_capture_t gl_capture, GLenum format);
 
+/**
+ * \brief detect repeated pictures
+ *
+ * Each picture is hashed after readback and if it matches the
+ * previous picture in same video stream, only a
+ * GLC_MESSAGE_VIDEO_REPEAT message is written.
+ * \param gl_capture gl_capture object
+ * \param detect_repeat 1 means repeated pictures are detected,
+ *                      0 writes all pictures
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_detect_repeat(gl_capture_t gl_capture, int detect_repeat);
+
+/**
+ * \brief forget previous pictures
+ *
+ * Next picture in each video stream is written completely.
+ * Call this when stream target changes, so that new target
+ * doesn't start with a repeat message.
+ * \param gl_capture gl_capture object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_reset_repeat(gl_capture_t gl_capture);
+
+/**
+ * \brief write video format again
+ *
+ * Geometry of each video stream is recalculated and format
+ * message written before next picture. Call this after changing
+ * scale of a later stage, so that it sees the change.
+ * \param gl_capture gl_capture object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_refresh_format(gl_capture_t gl_capture);
+
+/**
+ * \brief number of dropped frames
+ *
+ * Frames are dropped when target buffer or all PBOs are busy.
+ * \param gl_capture gl_capture object
+ * \return frames dropped since gl_capture_init()
+ */
+__PUBLIC unsigned long long gl_capture_dropped(gl_capture_t gl_capture);
+
 /**
  * \brief draw indicator when capturing
  *
@@ -143,6 +268,40 @@ __PUBLIC int gl_capture_crop(gl_capture_t gl_capture, unsigned int x, unsigned i
  */
 __PUBLIC int gl_capture_lock_fps(gl_capture_t gl_capture, int lock_fps);
 
+/** sleep until next picture is due */
+#define GL_CAPTURE_PACE_SLEEP          0x1
+/** sleep and spin last fraction of a millisecond */
+#define GL_CAPTURE_PACE_HYBRID         0x2
+/** hybrid pacing followed by wait for vertical blank */
+#define GL_CAPTURE_PACE_VBLANK         0x3
+
+/**
+ * \brief set how locked fps is paced
+ *
+ * Rendering thread sleeps until an absolute deadline, waking up
+ * early by how much it has overslept before. Hybrid pacing spins
+ * the last 0.5 ms for sub-millisecond accuracy. Vblank pacing needs
+ * GLX_SGI_video_sync and falls back to hybrid pacing without it.
+ *
+ * This only sets default for new video streams. Default is
+ * GL_CAPTURE_PACE_SLEEP.
+ * \param gl_capture gl_capture object
+ * \param pacing pacing method
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_pacing(gl_capture_t gl_capture, int pacing);
+
+/**
+ * \brief set pacing for one video stream
+ * \param gl_capture gl_capture object
+ * \param dpy display
+ * \param drawable drawable
+ * \param pacing pacing method
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_stream_pacing(gl_capture_t gl_capture, Display *dpy,
+					  GLXDrawable drawable, int pacing);
+
 /**
  * \brief start capturing
  * \param gl_capture gl_capture object
@@ -152,6 +311,11 @@ __PUBLIC int gl_capture_start(gl_capture_t gl_capture);
 
 /**
  * \brief stop capturing
+ *
+ * Pictures that are still being transferred through PBOs are
+ * written before this returns. Without a worker thread that needs
+ * the application's context to be current, otherwise they are
+ * written at the next gl_capture_frame() for the drawable.
  * \param gl_capture gl_capture object
  * \return 0 on success otherwise an error code
  */
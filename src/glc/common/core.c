@@ -12,21 +12,45 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
 
 #include "glc.h"
 #include "core.h"
 #include "log.h"
 #include "util.h"
+#include "slice.h"
+
+#define GLC_CORE_STAGES               16
+
+struct glc_core_stage_s {
+	char name[32];
+	glc_thread_attr_t attr;
+};
 
 struct glc_core_s {
-	struct timeval init_time;
+	/* clock_gettime() is served from vDSO, raw clock is not slewed */
+	clockid_t clock;
+	glc_utime_t init_time;
 	long int threads_hint;
+	glc_flags_t cpu_features, cpu_supported;
+
+	glc_thread_attr_t thread_attr;
+	struct glc_core_stage_s stage[GLC_CORE_STAGES];
+	unsigned int stages;
 };
 
+glc_flags_t glc_core_detect_cpu();
+
 const char *glc_version()
 {
 	return GLC_VERSION;
@@ -34,6 +58,7 @@ const char *glc_version()
 
 int glc_init(glc_t *glc)
 {
+	struct timespec ts;
 	int ret = 0;
 
 	/* clear 'em */
@@ -41,23 +66,35 @@ int glc_init(glc_t *glc)
 	glc->state = NULL;
 	glc->util = NULL;
 	glc->log = NULL;
+	glc->slice = NULL;
 
 	glc->core = (glc_core_t) malloc(sizeof(struct glc_core_s));
 	memset(glc->core, 0, sizeof(struct glc_core_s));
 
-	gettimeofday(&glc->core->init_time, NULL);
+	glc->core->clock = CLOCK_MONOTONIC;
+#ifdef CLOCK_MONOTONIC_RAW
+	if (!clock_gettime(CLOCK_MONOTONIC_RAW, &ts))
+		glc->core->clock = CLOCK_MONOTONIC_RAW;
+#endif
+	glc->core->init_time = 0;
+	glc->core->init_time = glc_time_ns(glc);
 	glc->core->threads_hint = sysconf(_SC_NPROCESSORS_ONLN);
+	glc->core->cpu_features = glc->core->cpu_supported = glc_core_detect_cpu();
+	glc_thread_attr_init(&glc->core->thread_attr);
 
 	if ((ret = glc_log_init(glc)))
 		return ret;
 	if ((ret = glc_util_init(glc)))
 		return ret;
+	if ((ret = glc_slice_init(glc)))
+		return ret;
 
 	return 0;
 }
 
 int glc_destroy(glc_t *glc)
 {
+	glc_slice_destroy(glc);
 	glc_util_destroy(glc);
 	glc_log_destroy(glc);
 
@@ -68,25 +105,23 @@ int glc_destroy(glc_t *glc)
 	glc->state = NULL;
 	glc->util = NULL;
 	glc->log = NULL;
+	glc->slice = NULL;
 
 	return 0;
 }
 
 glc_utime_t glc_time(glc_t *glc)
 {
-	struct timeval tv;
-
-	gettimeofday(&tv, NULL);
-
-	tv.tv_sec -= glc->core->init_time.tv_sec;
-	tv.tv_usec -= glc->core->init_time.tv_usec;
+	return glc_time_ns(glc) / 1000;
+}
 
-	if (tv.tv_usec < 0) {
-		tv.tv_sec--;
-		tv.tv_usec += 1000000;
-	}
+glc_utime_t glc_time_ns(glc_t *glc)
+{
+	struct timespec ts;
 
-	return (glc_utime_t) tv.tv_sec * (glc_utime_t) 1000000 + (glc_utime_t) tv.tv_usec;
+	clock_gettime(glc->core->clock, &ts);
+	return (glc_utime_t) ts.tv_sec * (glc_utime_t) 1000000000 + (glc_utime_t) ts.tv_nsec
+	       - glc->core->init_time;
 }
 
 long int glc_threads_hint(glc_t *glc)
@@ -102,4 +137,186 @@ int glc_set_threads_hint(glc_t *glc, long int count)
 	return 0;
 }
 
+glc_flags_t glc_core_detect_cpu()
+{
+	glc_flags_t features = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		features |= GLC_CPU_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+		features |= GLC_CPU_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+		features |= GLC_CPU_AVX2;
+#endif
+#ifdef __ARM_NEON
+	features |= GLC_CPU_NEON;
+#endif
+
+	return features;
+}
+
+glc_flags_t glc_cpu_features(glc_t *glc)
+{
+	return glc->core->cpu_features;
+}
+
+int glc_set_cpu_features(glc_t *glc, glc_flags_t features)
+{
+	glc->core->cpu_features = features & glc->core->cpu_supported;
+	return 0;
+}
+
+int glc_thread_attr_init(glc_thread_attr_t *attr)
+{
+	CPU_ZERO(&attr->cpus);
+	attr->policy = SCHED_OTHER;
+	attr->nice = 0;
+	attr->numa_node = -1;
+	return 0;
+}
+
+int glc_thread_attr_set_cpus(glc_thread_attr_t *attr, const char *list)
+{
+	unsigned int first, last;
+	int len;
+
+	CPU_ZERO(&attr->cpus);
+	while (*list != '\0') {
+		if (sscanf(list, "%u%n", &first, &len) < 1)
+			return EINVAL;
+		list += len;
+
+		last = first;
+		if (*list == '-') {
+			list++;
+			if (sscanf(list, "%u%n", &last, &len) < 1)
+				return EINVAL;
+			list += len;
+		}
+
+		if ((last < first) | (last >= CPU_SETSIZE))
+			return EINVAL;
+		for (; first <= last; first++)
+			CPU_SET(first, &attr->cpus);
+
+		if (*list == ',')
+			list++;
+		else if (*list != '\0')
+			return EINVAL;
+	}
+
+	return 0;
+}
+
+int glc_set_thread_attr(glc_t *glc, const char *stage, const glc_thread_attr_t *attr)
+{
+	unsigned int i;
+
+	if (stage == NULL) {
+		memcpy(&glc->core->thread_attr, attr, sizeof(glc_thread_attr_t));
+		return 0;
+	}
+
+	for (i = 0; i < glc->core->stages; i++) {
+		if (!strcmp(glc->core->stage[i].name, stage))
+			break;
+	}
+
+	if (i == glc->core->stages) {
+		if ((i == GLC_CORE_STAGES) |
+		    (strlen(stage) >= sizeof(glc->core->stage[i].name)))
+			return ENOMEM;
+		strcpy(glc->core->stage[i].name, stage);
+		glc->core->stages++;
+	}
+
+	memcpy(&glc->core->stage[i].attr, attr, sizeof(glc_thread_attr_t));
+	return 0;
+}
+
+int glc_get_thread_attr(glc_t *glc, const char *stage, glc_thread_attr_t *attr)
+{
+	unsigned int i;
+
+	if (stage != NULL) {
+		for (i = 0; i < glc->core->stages; i++) {
+			if (!strcmp(glc->core->stage[i].name, stage)) {
+				memcpy(attr, &glc->core->stage[i].attr, sizeof(glc_thread_attr_t));
+				return 0;
+			}
+		}
+	}
+
+	memcpy(attr, &glc->core->thread_attr, sizeof(glc_thread_attr_t));
+	return 0;
+}
+
+int glc_apply_thread_attr(glc_t *glc, const glc_thread_attr_t *attr)
+{
+	struct sched_param param;
+	int ret, err = 0;
+
+	if (CPU_COUNT(&attr->cpus)) {
+		if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &attr->cpus))) {
+			glc_log(glc, GLC_WARNING, "core",
+				 "can't set CPU affinity: %s (%d)", strerror(ret), ret);
+			err = ret;
+		}
+	}
+
+	if (attr->policy != SCHED_OTHER) {
+		memset(&param, 0, sizeof(struct sched_param));
+		if ((ret = pthread_setschedparam(pthread_self(), attr->policy, &param))) {
+			glc_log(glc, GLC_WARNING, "core",
+				 "can't set scheduling policy: %s (%d)", strerror(ret), ret);
+			err = ret;
+		}
+	}
+
+	/* on Linux nice value is a per-thread property */
+	if (attr->nice) {
+		if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), attr->nice)) {
+			ret = errno;
+			glc_log(glc, GLC_WARNING, "core",
+				 "can't set nice value: %s (%d)", strerror(ret), ret);
+			err = ret;
+		}
+	}
+
+	if (attr->numa_node >= 0) {
+		if ((ret = glc_prefer_numa_node(glc, attr->numa_node)))
+			err = ret;
+	}
+
+	return err;
+}
+
+int glc_prefer_numa_node(glc_t *glc, int node)
+{
+	unsigned long mask;
+	int ret;
+
+	/* set_mempolicy() without libnuma */
+	if (node < 0) {
+		if (syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0))
+			return errno;
+		return 0;
+	}
+
+	if (node >= sizeof(mask) * 8)
+		return EINVAL;
+	mask = 1UL << node;
+
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1)) {
+		ret = errno;
+		glc_log(glc, GLC_WARNING, "core",
+			 "can't prefer NUMA node %d: %s (%d)", node, strerror(ret), ret);
+		return ret;
+	}
+
+	return 0;
+}
+
 /**  \} */
@@ -16,6 +16,7 @@
 #ifndef _CORE_H
 #define _CORE_H
 
+#include <sched.h>
 #include <glc/common/glc.h>
 
 #ifdef __cplusplus
@@ -55,6 +56,16 @@ __PUBLIC int glc_destroy(glc_t *glc);
  */
 __PUBLIC glc_utime_t glc_time(glc_t *glc);
 
+/**
+ * \brief current time in nanoseconds since initialization
+ *
+ * Time comes from CLOCK_MONOTONIC_RAW if kernel has it, so it
+ * does not jump or get slewed by NTP.
+ * \param glc glc
+ * \return time elapsed since initialization
+ */
+__PUBLIC glc_utime_t glc_time_ns(glc_t *glc);
+
 /**
  * \brief thread count hint
  *
@@ -77,6 +88,117 @@ __PUBLIC long int glc_threads_hint(glc_t *glc);
  */
 __PUBLIC int glc_set_threads_hint(glc_t *glc, long int count);
 
+/** SSE2 is available */
+#define GLC_CPU_SSE2                   0x1
+/** SSSE3 is available */
+#define GLC_CPU_SSSE3                  0x2
+/** AVX2 is available */
+#define GLC_CPU_AVX2                   0x4
+/** NEON is available */
+#define GLC_CPU_NEON                   0x8
+
+/**
+ * \brief CPU features filters may use
+ *
+ * Filters pick their kernels from these when a stream is
+ * configured, and fall back to plain C loops that produce
+ * identical output otherwise.
+ * \param glc glc
+ * \return GLC_CPU_* flags
+ */
+__PUBLIC glc_flags_t glc_cpu_features(glc_t *glc);
+
+/**
+ * \brief restrict CPU features filters may use
+ *
+ * Features CPU doesn't support can't be enabled, so 0 makes
+ * all filters use plain C loops. Set before starting processing.
+ * \param glc glc
+ * \param features GLC_CPU_* flags
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_set_cpu_features(glc_t *glc, glc_flags_t features);
+
+/**
+ * \brief thread placement and scheduling
+ */
+typedef struct {
+	/** CPUs threads may run on, empty set means all */
+	cpu_set_t cpus;
+	/** scheduling policy, SCHED_OTHER, SCHED_BATCH or SCHED_IDLE */
+	int policy;
+	/** nice value */
+	int nice;
+	/** preferred NUMA node for memory, -1 means no preference */
+	int numa_node;
+} glc_thread_attr_t;
+
+/**
+ * \brief initialize thread attributes to defaults
+ *
+ * Defaults don't change anything: all CPUs, SCHED_OTHER,
+ * nice 0 and no NUMA preference.
+ * \param attr thread attributes
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_thread_attr_init(glc_thread_attr_t *attr);
+
+/**
+ * \brief set CPUs from a list
+ * \param attr thread attributes
+ * \param list comma-separated CPU numbers or ranges, eg. "0-3,8"
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_thread_attr_set_cpus(glc_thread_attr_t *attr, const char *list);
+
+/**
+ * \brief set thread attributes for a processing stage
+ *
+ * Threads created by glc_thread use attributes of their stage,
+ * eg. "pack" or "file", or default attributes if stage
+ * has none. Set before starting processing.
+ * \param glc glc
+ * \param stage stage name, NULL sets default attributes
+ * \param attr thread attributes
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_set_thread_attr(glc_t *glc, const char *stage,
+				 const glc_thread_attr_t *attr);
+
+/**
+ * \brief get thread attributes for a processing stage
+ * \param glc glc
+ * \param stage stage name, NULL gets default attributes
+ * \param attr returned thread attributes
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_get_thread_attr(glc_t *glc, const char *stage,
+				 glc_thread_attr_t *attr);
+
+/**
+ * \brief apply thread attributes to calling thread
+ *
+ * Failures are logged as warnings and processing can continue.
+ * Lowering priority (a higher nice value) and SCHED_BATCH/SCHED_IDLE
+ * don't need privileges. Raising it, e.g. with negative nice values,
+ * needs CAP_SYS_NICE or a high enough RLIMIT_NICE.
+ * \param glc glc
+ * \param attr thread attributes
+ * \return 0 on success otherwise last error code
+ */
+__PUBLIC int glc_apply_thread_attr(glc_t *glc, const glc_thread_attr_t *attr);
+
+/**
+ * \brief prefer memory from a NUMA node in calling thread
+ *
+ * Affects pages allocated after this call, including buffers.
+ * Threads created afterwards inherit the preference.
+ * \param glc glc
+ * \param node NUMA node, -1 restores default policy
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_prefer_numa_node(glc_t *glc, int node);
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,9 +66,11 @@ extern "C" {
  */
 
 /** stream version */
-#define GLC_STREAM_VERSION                  0x4
+#define GLC_STREAM_VERSION                  0xa
 /** file signature = "GLC" */
 #define GLC_SIGNATURE                0x00434c47
+/** index trailer signature = "GLCI" */
+#define GLC_INDEX_SIGNATURE          0x49434c47
 
 /** unsigned time in microseconds */
 typedef u_int64_t glc_utime_t;
@@ -100,6 +102,8 @@ typedef struct glc_util_s* glc_util_t;
 typedef struct glc_log_s* glc_log_t;
 /** glc state */
 typedef struct glc_state_s* glc_state_t;
+/** glc slice workers */
+typedef struct glc_slice_s* glc_slice_t;
 
 /**
  * \brief glc structure
@@ -115,6 +119,8 @@ typedef struct {
 	glc_state_t state;
 	/** state flags */
 	glc_flags_t state_flags;
+	/** slice workers internal state */
+	glc_slice_t slice;
 } glc_t;
 
 /** error */
@@ -166,6 +172,43 @@ typedef struct {
 	u_int64_t reserved2;
 } __attribute__((packed)) glc_stream_info_t;
 
+/**
+ * \brief seek index entry
+ *
+ * Stream can be read starting from offset after state
+ * messages stored at state_offset have been read.
+ */
+typedef struct {
+	/** stream time of video key frame at offset */
+	glc_utime_t time;
+	/** stream id of video key frame at offset */
+	u_int32_t id;
+	/** packet offset in file */
+	glc_size_t offset;
+	/** state messages offset in index state area */
+	glc_size_t state_offset;
+	/** state messages size */
+	glc_size_t state_size;
+} __attribute__((packed)) glc_index_entry_t;
+
+/**
+ * \brief seek index trailer
+ *
+ * Optional, follows GLC_MESSAGE_CLOSE. Entries sorted by time
+ * start at index_offset, followed by state area consisting of
+ * messages in on-disk format. Trailer is last thing in file.
+ */
+typedef struct {
+	/** index signature */
+	u_int32_t signature;
+	/** number of entries */
+	u_int32_t entries;
+	/** offset of first entry */
+	glc_size_t index_offset;
+	/** size of state area */
+	glc_size_t state_size;
+} __attribute__((packed)) glc_index_trailer_t;
+
 /** stream message type */
 typedef u_int8_t glc_message_type_t;
 /** end of stream */
@@ -190,6 +233,28 @@ typedef u_int8_t glc_message_type_t;
 #define GLC_MESSAGE_LZJB               0x0a
 /** callback request */
 #define GLC_CALLBACK_REQUEST           0x0b
+/** previous video frame repeated, glc_video_frame_header_t without data */
+#define GLC_MESSAGE_VIDEO_REPEAT       0x0c
+/** reference to video frame in capture memory, glc_video_frame_ref_t */
+#define GLC_MESSAGE_VIDEO_FRAME_REF    0x0d
+/** lz4-compressed packet */
+#define GLC_MESSAGE_LZ4                0x0e
+/** zstd-compressed packet */
+#define GLC_MESSAGE_ZSTD               0x0f
+/** video frame as delta to previous frame, glc_video_delta_header_t */
+#define GLC_MESSAGE_VIDEO_DELTA        0x10
+/** packet compressed in independent blocks */
+#define GLC_MESSAGE_BLOCKS             0x11
+/** message shared by several readers, glc_shared_ref_t */
+#define GLC_MESSAGE_SHARED_REF         0x12
+/** losslessly coded audio data, glc_audio_lpc_header_t */
+#define GLC_MESSAGE_AUDIO_LPC          0x13
+/** capture statistics, glc_stats_message_t */
+#define GLC_MESSAGE_STATS              0x14
+/** changed tiles of video frame, glc_video_tiles_header_t */
+#define GLC_MESSAGE_VIDEO_TILES        0x15
+/** message tagged with stream id and time, glc_stamp_header_t */
+#define GLC_MESSAGE_STAMP              0x16
 
 /**
  * \brief stream message header
@@ -229,6 +294,46 @@ typedef struct {
 	glc_message_header_t header;
 } __attribute__((packed)) glc_lzjb_header_t;
 
+/**
+ * \brief lz4-compressed message header
+ */
+typedef struct {
+	/** uncompressed data size */
+	glc_size_t size;
+	/** original message header */
+	glc_message_header_t header;
+} __attribute__((packed)) glc_lz4_header_t;
+
+/**
+ * \brief zstd-compressed message header
+ */
+typedef struct {
+	/** uncompressed data size */
+	glc_size_t size;
+	/** original message header */
+	glc_message_header_t header;
+} __attribute__((packed)) glc_zstd_header_t;
+
+/**
+ * \brief block-compressed data header
+ *
+ * Followed by u_int32_t compressed size of each block and then
+ * the blocks. All blocks but last hold block_size bytes of
+ * uncompressed data.
+ */
+typedef struct {
+	/** uncompressed data size */
+	glc_size_t size;
+	/** uncompressed block size */
+	u_int32_t block_size;
+	/** number of blocks */
+	u_int32_t blocks;
+	/** block compression, GLC_MESSAGE_LZO etc. */
+	glc_message_type_t compression;
+	/** original message header */
+	glc_message_header_t header;
+} __attribute__((packed)) glc_blocks_header_t;
+
 /** video format type */
 typedef u_int8_t glc_video_format_t;
 /** 24bit BGR, last row first */
@@ -239,6 +344,8 @@ typedef u_int8_t glc_video_format_t;
 #define GLC_VIDEO_YCBCR_420JPEG         0x3
 /** 24bit RGB, last row first */
 #define GLC_VIDEO_RGB                   0x4
+/** semi-planar NV12 420jpeg, Y' plane and interleaved CbCr plane */
+#define GLC_VIDEO_NV12                  0x5
 
 /**
  * \brief video format message
@@ -269,6 +376,65 @@ typedef struct {
 	glc_utime_t time;
 } __attribute__((packed)) glc_video_frame_header_t;
 
+/** picture is stored as is */
+#define GLC_VIDEO_DELTA_KEY             0x1
+
+/**
+ * \brief video delta header
+ *
+ * Picture data follows, XORed with previous picture of the
+ * same stream unless this is a key frame. Starts like
+ * glc_video_frame_header_t.
+ */
+typedef struct {
+	/** stream identifier */
+	glc_stream_id_t id;
+	/** time */
+	glc_utime_t time;
+	/** frame number in stream, delta is to frame - 1 */
+	u_int32_t frame;
+	/** flags */
+	u_int8_t flags;
+} __attribute__((packed)) glc_video_delta_header_t;
+
+/**
+ * \brief video tiles header
+ *
+ * Picture is rows of row bytes, cut to tiles of tile_width bytes
+ * and tile_height rows. Planar pictures are cut as if their
+ * planes were rows of luma width. Followed by a bitmap with a bit
+ * for each tile, lowest bit first and tiles in row order, and then
+ * the changed tiles row by row, XORed with previous picture of the
+ * same stream. Only data after this header is compressed.
+ *
+ * Starts like glc_video_delta_header_t and shares frame numbers
+ * with it, key frames are written as GLC_MESSAGE_VIDEO_DELTA.
+ */
+typedef struct {
+	/** stream identifier */
+	glc_stream_id_t id;
+	/** time */
+	glc_utime_t time;
+	/** frame number in stream, tiles are to frame - 1 */
+	u_int32_t frame;
+	/** flags */
+	u_int8_t flags;
+	/** picture size, row * rows */
+	glc_size_t size;
+	/** bytes per row */
+	u_int32_t row;
+	/** number of rows */
+	u_int32_t rows;
+	/** tile width in bytes */
+	u_int32_t tile_width;
+	/** tile height in rows */
+	u_int32_t tile_height;
+	/** compression of bitmap and tiles, GLC_MESSAGE_LZO etc. or 0 */
+	glc_message_type_t compression;
+	/** size of bitmap and tiles before compression */
+	glc_size_t data_size;
+} __attribute__((packed)) glc_video_tiles_header_t;
+
 /** audio format type */
 typedef u_int8_t glc_audio_format_t;
 /** signed 16bit little-endian */
@@ -309,6 +475,26 @@ typedef struct {
 	glc_size_t size;
 } __attribute__((packed)) glc_audio_data_header_t;
 
+/**
+ * \brief losslessly coded audio data header
+ *
+ * Followed by original glc_audio_data_header_t and then
+ * samples coded with lpc_encode() using format, flags and
+ * channels given here.
+ */
+typedef struct {
+	/** uncompressed data size, with audio data header */
+	glc_size_t size;
+	/** sample format */
+	glc_audio_format_t format;
+	/** format flags */
+	glc_flags_t flags;
+	/** number of channels */
+	u_int32_t channels;
+	/** original message header */
+	glc_message_header_t header;
+} __attribute__((packed)) glc_audio_lpc_header_t;
+
 /**
  * \brief color correction information message
  */
@@ -327,6 +513,47 @@ typedef struct {
 	float blue;
 } __attribute__((packed)) glc_color_message_t;
 
+/** stage name length in glc_stats_stage_t, including terminating null */
+#define GLC_STATS_NAME_LEN              16
+
+/**
+ * \brief capture statistics message
+ *
+ * Written periodically by capture. Followed by 'stages'
+ * glc_stats_stage_t structures. Counters are totals since
+ * capture was started.
+ */
+typedef struct {
+	/** stream time */
+	glc_utime_t time;
+	/** dropped video frames */
+	u_int64_t video_dropped;
+	/** dropped audio chunks */
+	u_int64_t audio_dropped;
+	/** dropped audio bytes */
+	u_int64_t audio_dropped_bytes;
+	/** number of stages following */
+	u_int32_t stages;
+} __attribute__((packed)) glc_stats_message_t;
+
+/**
+ * \brief processing stage statistics
+ */
+typedef struct {
+	/** stage name, eg. 'pack' */
+	char name[GLC_STATS_NAME_LEN];
+	/** packets processed */
+	u_int64_t packets;
+	/** bytes read */
+	u_int64_t read_bytes;
+	/** bytes written */
+	u_int64_t write_bytes;
+	/** time spent in callbacks, in microseconds */
+	u_int64_t callback;
+	/** estimated bytes waiting in target buffer, -1 if not known */
+	int64_t queued;
+} __attribute__((packed)) glc_stats_stage_t;
+
 /**
  * \brief container message header
  */
@@ -350,6 +577,70 @@ typedef struct {
 	void *arg;
 } glc_callback_request_t;
 
+/**
+ * \brief video frame reference
+ * \note only for program internal use (not in on-disk stream)
+ * \note may change without stream version bump
+ * Points to glc_video_frame_header_t and picture data that
+ * are owned by capture. Reader must call release when it
+ * no longer needs the data.
+ */
+typedef struct {
+	/** frame header and picture */
+	char *data;
+	/** size of data */
+	glc_size_t size;
+	/** called when data is no longer used */
+	callback_request_func_t release;
+	/** argument for release */
+	void *arg;
+} glc_video_frame_ref_t;
+
+/**
+ * \brief shared message reference
+ * \note only for program internal use (not in on-disk stream)
+ * \note may change without stream version bump
+ * Points to message data in a shared packet pool. glc_thread
+ * substitutes type and data transparently and calls release
+ * when packet is closed.
+ */
+typedef struct {
+	/** original message type */
+	glc_message_type_t type;
+	/** message data */
+	char *data;
+	/** size of data */
+	glc_size_t size;
+	/** called when data is no longer used */
+	callback_request_func_t release;
+	/** argument for release */
+	void *arg;
+} glc_shared_ref_t;
+
+/** stamped message is a video key frame */
+#define GLC_STAMP_KEY                   0x1
+/** stamped message is a video picture */
+#define GLC_STAMP_VIDEO                 0x2
+
+/**
+ * \brief stream id and time of message
+ * \note only for program internal use (not in on-disk stream)
+ * \note may change without stream version bump
+ * Pack prepends this to data messages it writes, as compression
+ * hides their own headers. Original message follows. File strips
+ * it and uses id and time of key frames for seek index.
+ */
+typedef struct {
+	/** stream identifier */
+	glc_stream_id_t id;
+	/** time */
+	glc_utime_t time;
+	/** flags */
+	u_int8_t flags;
+	/** original message header */
+	glc_message_header_t header;
+} __attribute__((packed)) glc_stamp_header_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,23 +15,112 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <time.h>
 #include <pthread.h>
 
 #include "glc.h"
 #include "core.h"
 #include "log.h"
 
+/* queued messages, power of two */
+#define GLC_LOG_RING            256
+/* captured arguments and string bytes per message */
+#define GLC_LOG_ARGS             12
+#define GLC_LOG_STRINGS         256
+/* longest conversion specification */
+#define GLC_LOG_SPEC             32
+/* rate limited call sites, power of two */
+#define GLC_LOG_SITES           256
+#define GLC_LOG_SITE_PROBES      16
+/* messages from one call site written per report interval */
+#define GLC_LOG_BURST            10
+#define GLC_LOG_REPORT      1000000
+/* drain thread wakes up this often, in nanoseconds */
+#define GLC_LOG_DRAIN      10000000
+
+#define GLC_LOG_DRAIN_STOPPED     0
+#define GLC_LOG_DRAIN_RUNNING     1
+#define GLC_LOG_DRAIN_FAILED      2
+
+enum glc_log_arg_type {arg_int, arg_long, arg_llong, arg_size, arg_intmax,
+		       arg_ptrdiff, arg_double, arg_ptr, arg_str};
+
+union glc_log_arg_u {
+	int i;
+	long l;
+	long long ll;
+	size_t z;
+	intmax_t j;
+	ptrdiff_t t;
+	double d;
+	void *p;
+};
+
+struct glc_log_entry_s {
+	u_int64_t seq;
+
+	int level;
+	const char *module;
+	const char *format;
+	glc_utime_t time;
+
+	/* format could not be captured and was printed into string */
+	int formatted;
+	unsigned int args;
+	union glc_log_arg_u arg[GLC_LOG_ARGS];
+	size_t strings;
+	char string[GLC_LOG_STRINGS];
+};
+
+struct glc_log_site_s {
+	const char *format;
+	const char *module;
+	int level;
+	u_int32_t count;
+};
+
 struct glc_log_s {
 	int level;
 	FILE *stream;
 	FILE *default_stream;
 	pthread_mutex_t log_mutex;
+
+	/* producers reserve slots with head, drain owns tail */
+	struct glc_log_entry_s ring[GLC_LOG_RING];
+	u_int64_t head, tail;
+	u_int32_t lost;
+
+	struct glc_log_site_s site[GLC_LOG_SITES];
+	glc_utime_t report_time;
+
+	pthread_t drain_thread;
+	pthread_cond_t drain_cond;
+	int drain, drain_stop;
+
+	FILE *stats_stream;
+	glc_utime_t stats_interval;
+	pthread_mutex_t stats_mutex;
+	int stats_collect;
 };
 
-void glc_log_write_prefix(glc_t *glc, FILE *stream, int level, const char *module);
+void glc_log_write_prefix(glc_t *glc, FILE *stream, int level, const char *module,
+			  glc_utime_t time);
+int glc_log_start_drain(glc_t *glc);
+void *glc_log_drain_thread(void *argptr);
+void glc_log_drain(glc_t *glc);
+void glc_log_report(glc_t *glc, glc_utime_t time, int force);
+int glc_log_limit(glc_t *glc, int level, const char *module, const char *format);
+const char *glc_log_parse(const char *p, int *stars, enum glc_log_arg_type *type);
+int glc_log_capture(struct glc_log_entry_s *entry, const char *format, va_list ap);
+void glc_log_write_entry(glc_t *glc, FILE *stream, struct glc_log_entry_s *entry);
 
 int glc_log_init(glc_t *glc)
 {
+	unsigned int i;
+
 	glc->log = (glc_log_t) malloc(sizeof(struct glc_log_s));
 	memset(glc->log, 0, sizeof(struct glc_log_s));
 
@@ -39,11 +128,35 @@ int glc_log_init(glc_t *glc)
 	glc->log->default_stream = stderr;
 	glc->log->stream = glc->log->default_stream;
 
+	for (i = 0; i < GLC_LOG_RING; i++)
+		glc->log->ring[i].seq = i;
+	pthread_cond_init(&glc->log->drain_cond, NULL);
+
+	pthread_mutex_init(&glc->log->stats_mutex, NULL);
+	glc->log->stats_interval = 5000000;
+
 	return 0;
 }
 
 int glc_log_destroy(glc_t *glc)
 {
+	pthread_mutex_lock(&glc->log->log_mutex);
+	glc->log->drain_stop = 1;
+	pthread_cond_signal(&glc->log->drain_cond);
+	pthread_mutex_unlock(&glc->log->log_mutex);
+
+	if (glc->log->drain == GLC_LOG_DRAIN_RUNNING)
+		pthread_join(glc->log->drain_thread, NULL);
+
+	/* anything logged after drain thread quit */
+	glc_log_drain(glc);
+	glc_log_report(glc, glc_time(glc), 1);
+	fflush(glc->log->stream);
+
+	if (glc->log->stats_stream)
+		glc_log_close_stats_file(glc);
+	pthread_cond_destroy(&glc->log->drain_cond);
+	pthread_mutex_destroy(&glc->log->stats_mutex);
 	pthread_mutex_destroy(&glc->log->log_mutex);
 	free(glc->log);
 	return 0;
@@ -70,7 +183,12 @@ int glc_log_set_stream(glc_t *glc, FILE *stream)
 	/** \todo check that stream is good */
 	if (!stream)
 		return EINVAL;
+
+	/* queued messages go to old stream */
+	pthread_mutex_lock(&glc->log->log_mutex);
+	glc_log_drain(glc);
 	glc->log->stream = stream;
+	pthread_mutex_unlock(&glc->log->log_mutex);
 	return 0;
 }
 
@@ -84,36 +202,430 @@ int glc_log_set_level(glc_t *glc, int level)
 
 int glc_log_close(glc_t *glc)
 {
+	int ret = 0;
+
 	glc_log(glc, GLC_INFORMATION, "log", "log closed");
+
+	pthread_mutex_lock(&glc->log->log_mutex);
+	glc_log_drain(glc);
 	if (fclose(glc->log->stream))
-		return errno;
+		ret = errno;
 	glc->log->stream = glc->log->default_stream;
+	pthread_mutex_unlock(&glc->log->log_mutex);
 
-	return 0;
+	return ret;
 }
 
 void glc_log(glc_t *glc, int level, const char *module, const char *format, ...)
 {
+	struct glc_log_entry_s *entry;
+	u_int64_t pos, seq;
 	va_list ap;
 
 	if (level > glc->log->level)
 		return;
 
+	/*
+	 Caller only copies arguments into ring, formatting and
+	 writing is left to drain thread. Repeating messages are
+	 just counted.
+	*/
+	if (glc_log_limit(glc, level, module, format))
+		return;
+
+	if ((__atomic_load_n(&glc->log->drain, __ATOMIC_ACQUIRE) != GLC_LOG_DRAIN_RUNNING) &&
+	    (glc_log_start_drain(glc))) {
+		/* no drain thread, write directly */
+		struct glc_log_entry_s direct;
+		direct.level = level;
+		direct.module = module;
+		direct.format = format;
+		direct.time = glc_time(glc);
+		va_start(ap, format);
+		glc_log_capture(&direct, format, ap);
+		va_end(ap);
+
+		pthread_mutex_lock(&glc->log->log_mutex);
+		glc_log_report(glc, direct.time, 0);
+		glc_log_write_entry(glc, glc->log->stream, &direct);
+		pthread_mutex_unlock(&glc->log->log_mutex);
+		return;
+	}
+
+	/* reserve slot, multiple producers */
+	pos = __atomic_load_n(&glc->log->head, __ATOMIC_RELAXED);
+	for (;;) {
+		entry = &glc->log->ring[pos & (GLC_LOG_RING - 1)];
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&glc->log->head, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((int64_t) (seq - pos) < 0) {
+			/* ring is full */
+			__atomic_add_fetch(&glc->log->lost, 1, __ATOMIC_RELAXED);
+			return;
+		} else
+			pos = __atomic_load_n(&glc->log->head, __ATOMIC_RELAXED);
+	}
+
+	entry->level = level;
+	entry->module = module;
+	entry->format = format;
+	entry->time = glc_time(glc);
 	va_start(ap, format);
+	glc_log_capture(entry, format, ap);
+	va_end(ap);
+
+	__atomic_store_n(&entry->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+int glc_log_start_drain(glc_t *glc)
+{
+	int ret = 0;
 
-	/* this is highly threaded application and we want
-	   non-corrupted logs */
 	pthread_mutex_lock(&glc->log->log_mutex);
-	glc_log_write_prefix(glc, glc->log->stream, level, module);
-	vfprintf(glc->log->stream, format, ap);
-	fputc('\n', glc->log->stream);
+	if (glc->log->drain == GLC_LOG_DRAIN_STOPPED) {
+		if (pthread_create(&glc->log->drain_thread, NULL, glc_log_drain_thread, glc))
+			glc->log->drain = GLC_LOG_DRAIN_FAILED;
+		else
+			__atomic_store_n(&glc->log->drain, GLC_LOG_DRAIN_RUNNING, __ATOMIC_RELEASE);
+	}
+	if (glc->log->drain != GLC_LOG_DRAIN_RUNNING)
+		ret = EAGAIN;
+	pthread_mutex_unlock(&glc->log->log_mutex);
+
+	return ret;
+}
+
+void *glc_log_drain_thread(void *argptr)
+{
+	glc_t *glc = (glc_t *) argptr;
+	struct timespec ts;
+
+	pthread_mutex_lock(&glc->log->log_mutex);
+	glc->log->report_time = glc_time(glc);
+
+	while (!glc->log->drain_stop) {
+		glc_log_drain(glc);
+		glc_log_report(glc, glc_time(glc), 0);
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += GLC_LOG_DRAIN;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&glc->log->drain_cond, &glc->log->log_mutex, &ts);
+	}
 
 	pthread_mutex_unlock(&glc->log->log_mutex);
+	return NULL;
+}
 
-	va_end(ap);
+void glc_log_drain(glc_t *glc)
+{
+	struct glc_log_entry_s *entry;
+	u_int32_t lost;
+	int written = 0;
+
+	/* caller holds log_mutex or is last user, only one consumer */
+	for (;;) {
+		entry = &glc->log->ring[glc->log->tail & (GLC_LOG_RING - 1)];
+		if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != glc->log->tail + 1)
+			break;
+
+		glc_log_write_entry(glc, glc->log->stream, entry);
+		written = 1;
+
+		__atomic_store_n(&entry->seq, glc->log->tail + GLC_LOG_RING, __ATOMIC_RELEASE);
+		glc->log->tail++;
+	}
+
+	if ((lost = __atomic_exchange_n(&glc->log->lost, 0, __ATOMIC_RELAXED))) {
+		glc_log_write_prefix(glc, glc->log->stream, GLC_WARNING, "log", glc_time(glc));
+		fprintf(glc->log->stream, "log queue full, lost %u messages\n", lost);
+		written = 1;
+	}
+
+	if (written)
+		fflush(glc->log->stream);
+}
+
+void glc_log_report(glc_t *glc, glc_utime_t time, int force)
+{
+	struct glc_log_site_s *site;
+	u_int32_t count;
+	unsigned int i;
+
+	if ((!force) && (time - glc->log->report_time < GLC_LOG_REPORT))
+		return;
+
+	for (i = 0; i < GLC_LOG_SITES; i++) {
+		site = &glc->log->site[i];
+		if (!__atomic_load_n(&site->format, __ATOMIC_ACQUIRE))
+			continue;
+		count = __atomic_exchange_n(&site->count, 0, __ATOMIC_RELAXED);
+		if (count <= GLC_LOG_BURST)
+			continue;
+
+		glc_log_write_prefix(glc, glc->log->stream, site->level,
+				     site->module ? site->module : "log", time);
+		fprintf(glc->log->stream, "suppressed %u messages like \"%s\" in last %.2f s\n",
+			count - GLC_LOG_BURST, site->format,
+			(double) (time - glc->log->report_time) / 1000000.0);
+	}
+
+	fflush(glc->log->stream);
+	glc->log->report_time = time;
 }
 
-void glc_log_write_prefix(glc_t *glc, FILE *stream, int level, const char *module)
+int glc_log_limit(glc_t *glc, int level, const char *module, const char *format)
+{
+	struct glc_log_site_s *site;
+	const char *found;
+	uintptr_t hash;
+	unsigned int i;
+
+	/* format and module strings are constants, pointers identify call site */
+	hash = ((uintptr_t) format ^ ((uintptr_t) module << 7)) * 0x9e3779b1;
+	for (i = 0; i < GLC_LOG_SITE_PROBES; i++) {
+		site = &glc->log->site[(hash + i) & (GLC_LOG_SITES - 1)];
+		found = __atomic_load_n(&site->format, __ATOMIC_ACQUIRE);
+
+		if (!found) {
+			if (!__atomic_compare_exchange_n(&site->format, &found, format, 0,
+							 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				continue; /* someone else took it, recheck */
+			site->level = level;
+			__atomic_store_n(&site->module, module, __ATOMIC_RELEASE);
+			found = format;
+		}
+
+		if ((found == format) &&
+		    (__atomic_load_n(&site->module, __ATOMIC_ACQUIRE) == module))
+			return __atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) > GLC_LOG_BURST;
+	}
+
+	/* table is full, not limited */
+	return 0;
+}
+
+const char *glc_log_parse(const char *p, int *stars, enum glc_log_arg_type *type)
+{
+	char length = 0;
+
+	/* flags, width, precision and length of conversion after % */
+	*stars = 0;
+	while ((*p) && (strchr("-+ #0", *p)))
+		p++;
+	if (*p == '*') {
+		(*stars)++;
+		p++;
+	} else while (isdigit(*p))
+		p++;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			(*stars)++;
+			p++;
+		} else while (isdigit(*p))
+			p++;
+	}
+
+	if (*p == 'h') {
+		p++;
+		if (*p == 'h')
+			p++;
+	} else if (*p == 'l') {
+		length = *p++;
+		if (*p == 'l') {
+			length = 'q';
+			p++;
+		}
+	} else if ((*p) && (strchr("qzjt", *p)))
+		length = *p++;
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		if (length == 'l')
+			*type = arg_long;
+		else if (length == 'q')
+			*type = arg_llong;
+		else if (length == 'z')
+			*type = arg_size;
+		else if (length == 'j')
+			*type = arg_intmax;
+		else if (length == 't')
+			*type = arg_ptrdiff;
+		else
+			*type = arg_int;
+		break;
+	case 'c':
+		if (length)
+			return NULL;
+		*type = arg_int;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		if ((length) && (length != 'l'))
+			return NULL;
+		*type = arg_double;
+		break;
+	case 's':
+		if (length)
+			return NULL;
+		*type = arg_str;
+		break;
+	case 'p':
+		*type = arg_ptr;
+		break;
+	default:
+		return NULL;
+	}
+
+	return p + 1;
+}
+
+int glc_log_capture(struct glc_log_entry_s *entry, const char *format, va_list ap)
+{
+	enum glc_log_arg_type type;
+	const char *p = format, *conv, *str;
+	size_t len;
+	va_list copy;
+	int stars;
+
+	va_copy(copy, ap);
+	entry->formatted = 0;
+	entry->args = 0;
+	entry->strings = 0;
+
+	while ((conv = strchr(p, '%'))) {
+		if (conv[1] == '%') {
+			p = conv + 2;
+			continue;
+		}
+		if (!(p = glc_log_parse(conv + 1, &stars, &type)))
+			goto format;
+		if ((entry->args + stars + 1 > GLC_LOG_ARGS) || (p - conv >= GLC_LOG_SPEC))
+			goto format;
+
+		while (stars--)
+			entry->arg[entry->args++].i = va_arg(ap, int);
+
+		if (type == arg_int)
+			entry->arg[entry->args].i = va_arg(ap, int);
+		else if (type == arg_long)
+			entry->arg[entry->args].l = va_arg(ap, long);
+		else if (type == arg_llong)
+			entry->arg[entry->args].ll = va_arg(ap, long long);
+		else if (type == arg_size)
+			entry->arg[entry->args].z = va_arg(ap, size_t);
+		else if (type == arg_intmax)
+			entry->arg[entry->args].j = va_arg(ap, intmax_t);
+		else if (type == arg_ptrdiff)
+			entry->arg[entry->args].t = va_arg(ap, ptrdiff_t);
+		else if (type == arg_double)
+			entry->arg[entry->args].d = va_arg(ap, double);
+		else if (type == arg_ptr)
+			entry->arg[entry->args].p = va_arg(ap, void *);
+		else {
+			/* strings may not outlive the call, long ones are cut */
+			if (!(str = va_arg(ap, const char *)))
+				str = "(null)";
+			len = strlen(str);
+			if (len > GLC_LOG_STRINGS - 1 - entry->strings)
+				len = GLC_LOG_STRINGS - 1 - entry->strings;
+			memcpy(&entry->string[entry->strings], str, len);
+			entry->string[entry->strings + len] = '\0';
+			entry->arg[entry->args].z = entry->strings;
+			entry->strings += len + 1;
+			if (entry->strings >= GLC_LOG_STRINGS)
+				entry->strings = GLC_LOG_STRINGS - 1;
+		}
+		entry->args++;
+	}
+
+	va_end(copy);
+	return 0;
+
+format:
+	/* conversions that are not captured are formatted right away */
+	vsnprintf(entry->string, GLC_LOG_STRINGS, format, copy);
+	entry->formatted = 1;
+	va_end(copy);
+	return 0;
+}
+
+void glc_log_write_entry(glc_t *glc, FILE *stream, struct glc_log_entry_s *entry)
+{
+	enum glc_log_arg_type type;
+	union glc_log_arg_u *arg = entry->arg;
+	const char *p = entry->format, *conv;
+	char spec[GLC_LOG_SPEC];
+	int stars, star[2];
+
+	glc_log_write_prefix(glc, stream, entry->level, entry->module, entry->time);
+
+	if (entry->formatted) {
+		fputs(entry->string, stream);
+		fputc('\n', stream);
+		return;
+	}
+
+	while ((conv = strchr(p, '%'))) {
+		fwrite(p, 1, conv - p, stream);
+		if (conv[1] == '%') {
+			fputc('%', stream);
+			p = conv + 2;
+			continue;
+		}
+
+		p = glc_log_parse(conv + 1, &stars, &type);
+		if ((!p) || (p - conv >= sizeof(spec)))
+			return; /* capture made sure this does not happen */
+		memcpy(spec, conv, p - conv);
+		spec[p - conv] = '\0';
+
+		star[0] = stars > 0 ? (arg++)->i : 0;
+		star[1] = stars > 1 ? (arg++)->i : 0;
+
+#define GLC_LOG_PRINT(value) \
+		if (stars == 2) \
+			fprintf(stream, spec, star[0], star[1], value); \
+		else if (stars == 1) \
+			fprintf(stream, spec, star[0], value); \
+		else \
+			fprintf(stream, spec, value);
+
+		if (type == arg_int) {
+			GLC_LOG_PRINT(arg->i)
+		} else if (type == arg_long) {
+			GLC_LOG_PRINT(arg->l)
+		} else if (type == arg_llong) {
+			GLC_LOG_PRINT(arg->ll)
+		} else if (type == arg_size) {
+			GLC_LOG_PRINT(arg->z)
+		} else if (type == arg_intmax) {
+			GLC_LOG_PRINT(arg->j)
+		} else if (type == arg_ptrdiff) {
+			GLC_LOG_PRINT(arg->t)
+		} else if (type == arg_double) {
+			GLC_LOG_PRINT(arg->d)
+		} else if (type == arg_ptr) {
+			GLC_LOG_PRINT(arg->p)
+		} else {
+			GLC_LOG_PRINT(&entry->string[arg->z])
+		}
+#undef GLC_LOG_PRINT
+		arg++;
+	}
+
+	fputs(p, stream);
+	fputc('\n', stream);
+}
+
+void glc_log_write_prefix(glc_t *glc, FILE *stream, int level, const char *module,
+			  glc_utime_t time)
 {
 	const char *level_str = NULL;
 
@@ -140,7 +652,86 @@ void glc_log_write_prefix(glc_t *glc, FILE *stream, int level, const char *modul
 	}
 
 	fprintf(stream, "[%7.2fs %10s %5s ] ",
-		(double) glc_time(glc) / 1000000.0, module, level_str);
+		(double) time / 1000000.0, module, level_str);
+}
+
+int glc_log_open_stats_file(glc_t *glc, const char *filename)
+{
+	FILE *stream = fopen(filename, "w");
+	if (!stream)
+		return errno;
+
+	pthread_mutex_lock(&glc->log->stats_mutex);
+	if (glc->log->stats_stream)
+		fclose(glc->log->stats_stream);
+	glc->log->stats_stream = stream;
+	fprintf(stream, "# time stage packets read_bytes write_bytes "
+			"read_wait_us write_wait_us callback_us queued_bytes\n");
+	pthread_mutex_unlock(&glc->log->stats_mutex);
+
+	glc_log(glc, GLC_INFORMATION, "log", "opened %s for stats", filename);
+	return 0;
+}
+
+int glc_log_close_stats_file(glc_t *glc)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&glc->log->stats_mutex);
+	if (!glc->log->stats_stream)
+		ret = EINVAL;
+	else if (fclose(glc->log->stats_stream))
+		ret = errno;
+	glc->log->stats_stream = NULL;
+	pthread_mutex_unlock(&glc->log->stats_mutex);
+
+	return ret;
+}
+
+int glc_log_set_stats_interval(glc_t *glc, glc_utime_t interval)
+{
+	if (interval == 0)
+		return EINVAL;
+	glc->log->stats_interval = interval;
+	return 0;
+}
+
+glc_utime_t glc_log_stats_interval(glc_t *glc)
+{
+	return glc->log->stats_interval;
+}
+
+int glc_log_collect_stats(glc_t *glc, int collect)
+{
+	glc->log->stats_collect = collect;
+	return 0;
+}
+
+int glc_log_stats_enabled(glc_t *glc)
+{
+	return (glc->log->level >= GLC_PERFORMANCE) || (glc->log->stats_stream != NULL) ||
+	       (glc->log->stats_collect);
+}
+
+void glc_log_stats(glc_t *glc, const char *format, ...)
+{
+	va_list ap;
+
+	if (!glc->log->stats_stream)
+		return;
+
+	va_start(ap, format);
+
+	pthread_mutex_lock(&glc->log->stats_mutex);
+	if (glc->log->stats_stream) {
+		fprintf(glc->log->stats_stream, "%.3f ", (double) glc_time(glc) / 1000000.0);
+		vfprintf(glc->log->stats_stream, format, ap);
+		fputc('\n', glc->log->stats_stream);
+		fflush(glc->log->stats_stream);
+	}
+	pthread_mutex_unlock(&glc->log->stats_mutex);
+
+	va_end(ap);
 }
 
 /**  \} */
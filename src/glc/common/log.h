@@ -83,6 +83,13 @@ __PUBLIC int glc_log_close(glc_t *glc);
  * Message is actually written to log if level is
  * lesser than, or equal to current log verbosity level and
  * logging is enabled.
+ *
+ * Arguments are copied into a queue and message is formatted
+ * and written by a background thread, so calling this from
+ * render thread does not block on log stream. Module and format
+ * must be string constants. Same message from same place is
+ * written at most 10 times a second, rest are counted and
+ * reported as a single line.
  * \param glc glc
  * \param level message level
  * \param module module
@@ -92,6 +99,76 @@ __PUBLIC int glc_log_close(glc_t *glc);
 __PUBLIC void glc_log(glc_t *glc, int level, const char *module, const char *format, ...)
 	__attribute__((format(printf, 4, 5)));
 
+/**
+ * \brief open file for pipeline statistics
+ *
+ * Each processing stage appends a line with its cumulative
+ * counters to stats file every stats interval.
+ * \param glc glc
+ * \param filename stats file name
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_log_open_stats_file(glc_t *glc, const char *filename);
+
+/**
+ * \brief close stats file
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_log_close_stats_file(glc_t *glc);
+
+/**
+ * \brief set interval for pipeline statistics
+ *
+ * Default interval is 5 seconds.
+ * \param glc glc
+ * \param interval interval in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_log_set_stats_interval(glc_t *glc, glc_utime_t interval);
+
+/**
+ * \brief get interval for pipeline statistics
+ * \param glc glc
+ * \return interval in microseconds
+ */
+__PUBLIC glc_utime_t glc_log_stats_interval(glc_t *glc);
+
+/**
+ * \brief collect pipeline statistics without stats file
+ *
+ * Statistics can then be read with glc_thread_stats_write().
+ * Only affects threads created after this call.
+ * \param glc glc
+ * \param collect 1 collects statistics, 0 leaves it to log level
+ *                and stats file
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_log_collect_stats(glc_t *glc, int collect);
+
+/**
+ * \brief check if pipeline statistics are collected
+ *
+ * Statistics are collected if log level is at least
+ * GLC_PERFORMANCE, stats file is open or collecting was
+ * asked with glc_log_collect_stats().
+ * \param glc glc
+ * \return 1 if statistics are wanted, otherwise 0
+ */
+__PUBLIC int glc_log_stats_enabled(glc_t *glc);
+
+/**
+ * \brief write line to stats file
+ *
+ * Line is prefixed with current time. Nothing is written
+ * if stats file is not open.
+ * \param glc glc
+ * \param format passed to fprintf()
+ * \param ... passed to fprintf()
+ */
+__PUBLIC void glc_log_stats(glc_t *glc, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,192 @@
+/**
+ * \file glc/common/registry.c
+ * \brief per-stream state table
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup registry
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "glc.h"
+#include "registry.h"
+
+#define GLC_REGISTRY_MIN         16
+
+struct glc_registry_table_s {
+	size_t size;
+	void **entry;
+	/* replaced tables may still be read, so they live until destroy */
+	struct glc_registry_table_s *retired;
+};
+
+struct glc_registry_s {
+	struct glc_registry_table_s *table;
+	pthread_mutex_t mutex;
+
+	size_t entry_size;
+	glc_registry_callback_t init_callback, destroy_callback;
+	void *arg;
+};
+
+int glc_registry_grow(glc_registry_t registry, glc_stream_id_t id);
+
+int glc_registry_init(glc_registry_t *registry, size_t entry_size,
+		      glc_registry_callback_t init_callback,
+		      glc_registry_callback_t destroy_callback, void *arg)
+{
+	if (!(*registry = (glc_registry_t) malloc(sizeof(struct glc_registry_s))))
+		return ENOMEM;
+	memset(*registry, 0, sizeof(struct glc_registry_s));
+
+	pthread_mutex_init(&(*registry)->mutex, NULL);
+	(*registry)->entry_size = entry_size;
+	(*registry)->init_callback = init_callback;
+	(*registry)->destroy_callback = destroy_callback;
+	(*registry)->arg = arg;
+
+	return 0;
+}
+
+int glc_registry_destroy(glc_registry_t registry)
+{
+	glc_registry_clear(registry);
+	pthread_mutex_destroy(&registry->mutex);
+	free(registry);
+	return 0;
+}
+
+int glc_registry_clear(glc_registry_t registry)
+{
+	struct glc_registry_table_s *table = registry->table, *del;
+	size_t i;
+
+	if (table) {
+		for (i = 0; i < table->size; i++) {
+			if (!table->entry[i])
+				continue;
+			if (registry->destroy_callback)
+				registry->destroy_callback(table->entry[i], i, registry->arg);
+			free(table->entry[i]);
+		}
+	}
+
+	while (table) {
+		del = table;
+		table = table->retired;
+		free(del);
+	}
+
+	registry->table = NULL;
+	return 0;
+}
+
+void *glc_registry_lookup(glc_registry_t registry, glc_stream_id_t id)
+{
+	struct glc_registry_table_s *table;
+
+	if ((id < 0) || (id >= GLC_REGISTRY_MAX))
+		return NULL;
+
+	/* pairs with release stores in glc_registry_get() */
+	table = __atomic_load_n(&registry->table, __ATOMIC_ACQUIRE);
+	if ((!table) || (id >= table->size))
+		return NULL;
+	return __atomic_load_n(&table->entry[id], __ATOMIC_ACQUIRE);
+}
+
+int glc_registry_get(glc_registry_t registry, glc_stream_id_t id, void **entry)
+{
+	void *new_entry;
+	int ret = 0;
+
+	if ((*entry = glc_registry_lookup(registry, id)))
+		return 0;
+	if ((id < 0) || (id >= GLC_REGISTRY_MAX))
+		return EINVAL;
+
+	pthread_mutex_lock(&registry->mutex);
+
+	/* somebody may have added it meanwhile */
+	if ((*entry = glc_registry_lookup(registry, id)))
+		goto unlock;
+
+	if ((!registry->table) || (id >= registry->table->size)) {
+		if ((ret = glc_registry_grow(registry, id)))
+			goto unlock;
+	}
+
+	if (!(new_entry = malloc(registry->entry_size))) {
+		ret = ENOMEM;
+		goto unlock;
+	}
+	memset(new_entry, 0, registry->entry_size);
+
+	if ((registry->init_callback) &&
+	    ((ret = registry->init_callback(new_entry, id, registry->arg)))) {
+		free(new_entry);
+		goto unlock;
+	}
+
+	/* entry is complete before it becomes visible */
+	__atomic_store_n(&registry->table->entry[id], new_entry, __ATOMIC_RELEASE);
+	*entry = new_entry;
+unlock:
+	pthread_mutex_unlock(&registry->mutex);
+	return ret;
+}
+
+int glc_registry_grow(glc_registry_t registry, glc_stream_id_t id)
+{
+	struct glc_registry_table_s *table, *old = registry->table;
+	size_t size = old ? old->size : GLC_REGISTRY_MIN;
+
+	while (size <= id)
+		size *= 2;
+
+	if (!(table = (struct glc_registry_table_s *)
+	      malloc(sizeof(struct glc_registry_table_s) + sizeof(void *) * size)))
+		return ENOMEM;
+
+	table->size = size;
+	table->entry = (void **) &table[1];
+	memset(table->entry, 0, sizeof(void *) * size);
+	if (old)
+		memcpy(table->entry, old->entry, sizeof(void *) * old->size);
+	table->retired = old;
+
+	__atomic_store_n(&registry->table, table, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int glc_registry_iterate(glc_registry_t registry,
+			 glc_registry_callback_t callback, void *arg)
+{
+	struct glc_registry_table_s *table;
+	void *entry;
+	size_t i;
+	int ret;
+
+	table = __atomic_load_n(&registry->table, __ATOMIC_ACQUIRE);
+	if (!table)
+		return 0;
+
+	for (i = 0; i < table->size; i++) {
+		if (!(entry = __atomic_load_n(&table->entry[i], __ATOMIC_ACQUIRE)))
+			continue;
+		if ((ret = callback(entry, i, arg)))
+			return ret;
+	}
+
+	return 0;
+}
+
+/**  \} */
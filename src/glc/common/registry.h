@@ -0,0 +1,116 @@
+/**
+ * \file glc/common/registry.h
+ * \brief per-stream state table
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup common
+ *  \{
+ * \defgroup registry stream registry
+ *  \{
+ */
+
+#ifndef _REGISTRY_H
+#define _REGISTRY_H
+
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** largest stream id + 1 a registry can hold */
+#define GLC_REGISTRY_MAX      65536
+
+/**
+ * \brief registry object
+ *
+ * Holds one entry of per-stream state for each stream id, in a
+ * table indexed by id. Looking up an entry takes no locks and
+ * can be done by any number of threads while entries are being
+ * added. Entries are never removed before registry is destroyed.
+ */
+typedef struct glc_registry_s* glc_registry_t;
+
+/**
+ * \brief entry callback
+ * \param entry entry
+ * \param id stream id
+ * \param arg argument given to glc_registry_init()
+ * \return 0 on success otherwise an error code
+ */
+typedef int (*glc_registry_callback_t)(void *entry, glc_stream_id_t id, void *arg);
+
+/**
+ * \brief initialize registry
+ * \param registry registry
+ * \param entry_size size of entry structure, entries are zeroed
+ * \param init_callback called for a new entry before anyone else
+ *                      can see it, may be NULL
+ * \param destroy_callback called for every entry when registry is
+ *                         destroyed, may be NULL
+ * \param arg argument passed to callbacks
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_registry_init(glc_registry_t *registry, size_t entry_size,
+			       glc_registry_callback_t init_callback,
+			       glc_registry_callback_t destroy_callback, void *arg);
+
+/**
+ * \brief destroy registry and all entries
+ * \param registry registry
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_registry_destroy(glc_registry_t registry);
+
+/**
+ * \brief destroy all entries
+ *
+ * Registry can be used again afterwards. No other thread may
+ * use registry while it is being cleared.
+ * \param registry registry
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_registry_clear(glc_registry_t registry);
+
+/**
+ * \brief find entry
+ * \param registry registry
+ * \param id stream id
+ * \return entry or NULL if stream has none
+ */
+__PUBLIC void *glc_registry_lookup(glc_registry_t registry, glc_stream_id_t id);
+
+/**
+ * \brief find entry, adding it if stream has none
+ *
+ * Adding is serialized, lookups are not blocked meanwhile.
+ * \param registry registry
+ * \param id stream id
+ * \param entry returned entry
+ * \return 0 on success, EINVAL if id is out of range,
+ *         otherwise an error code
+ */
+__PUBLIC int glc_registry_get(glc_registry_t registry, glc_stream_id_t id, void **entry);
+
+/**
+ * \brief call callback for every entry in stream id order
+ * \param registry registry
+ * \param callback callback, iteration stops at first error
+ * \param arg argument passed to callback
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_registry_iterate(glc_registry_t registry,
+				  glc_registry_callback_t callback, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
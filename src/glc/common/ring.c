@@ -0,0 +1,298 @@
+/**
+ * \file glc/common/ring.c
+ * \brief mirrored message data ring
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup ring
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <packetstream.h>
+
+#include "glc.h"
+#include "core.h"
+#include "log.h"
+#include "state.h"
+#include "util.h"
+#include "ring.h"
+
+/* cancel is checked this often while waiting for space */
+#define GLC_RING_WAIT_NS             100000000
+/* blocks and data start at this alignment */
+#define GLC_RING_ALIGN               64
+/* rings attached to buffers at once */
+#define GLC_RING_BUFFERS             64
+
+struct glc_ring_block_s {
+	struct glc_ring_s *ring;
+	size_t size;
+	int released;
+};
+
+#define GLC_RING_HEADER_SIZE \
+	((sizeof(struct glc_ring_block_s) + GLC_RING_ALIGN - 1) & ~(GLC_RING_ALIGN - 1))
+
+struct glc_ring_s {
+	glc_t *glc;
+	int fd;
+	char *map;
+	size_t size;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t released;
+
+	/* free running, position in ring is modulo size */
+	size_t head, tail;
+
+	int destroyed;
+};
+
+struct glc_ring_attachment_s {
+	ps_buffer_t *buffer;
+	struct glc_ring_s *ring;
+};
+
+/* buffers are process-wide, so is the table */
+static pthread_mutex_t glc_ring_attach_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct glc_ring_attachment_s glc_ring_attachment[GLC_RING_BUFFERS];
+
+void glc_ring_release(void *arg);
+void glc_ring_free(struct glc_ring_s *ring);
+
+int glc_ring_init(glc_ring_t *ring, glc_t *glc, size_t size, glc_flags_t flags)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	int populate = (flags & GLC_UTIL_BUFFER_PREFAULT) ? MAP_POPULATE : 0;
+	char *map;
+	int fd, ret;
+
+	size = (size + page - 1) & ~(page - 1);
+	if (!size)
+		return EINVAL;
+
+	if ((fd = memfd_create("glc-ring", MFD_CLOEXEC)) < 0)
+		return errno;
+	if (ftruncate(fd, size)) {
+		ret = errno;
+		close(fd);
+		return ret;
+	}
+
+	/* reserve address space for both views, then map ring into each half */
+	map = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		ret = errno;
+		close(fd);
+		return ret;
+	}
+	if ((mmap(map, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | populate,
+		  fd, 0) == MAP_FAILED) ||
+	    (mmap(map + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | populate,
+		  fd, 0) == MAP_FAILED)) {
+		ret = errno;
+		munmap(map, size * 2);
+		close(fd);
+		return ret;
+	}
+
+#ifdef MADV_HUGEPAGE
+	if ((flags & GLC_UTIL_BUFFER_HUGEPAGES) && (madvise(map, size * 2, MADV_HUGEPAGE)))
+		glc_log(glc, GLC_WARNING, "ring",
+			 "can't use hugepages for ring: %s (%d)", strerror(errno), errno);
+#endif
+	if ((flags & GLC_UTIL_BUFFER_LOCK) && (mlock(map, size * 2)))
+		glc_log(glc, GLC_WARNING, "ring",
+			 "can't lock ring: %s (%d)", strerror(errno), errno);
+
+	if (!(*ring = (glc_ring_t) malloc(sizeof(struct glc_ring_s)))) {
+		munmap(map, size * 2);
+		close(fd);
+		return ENOMEM;
+	}
+	memset(*ring, 0, sizeof(struct glc_ring_s));
+
+	(*ring)->glc = glc;
+	(*ring)->fd = fd;
+	(*ring)->map = map;
+	(*ring)->size = size;
+	pthread_mutex_init(&(*ring)->mutex, NULL);
+	pthread_cond_init(&(*ring)->released, NULL);
+
+	glc_log(glc, GLC_DEBUG, "ring", "mirrored %zu bytes at %p", size, map);
+	return 0;
+}
+
+int glc_ring_destroy(glc_ring_t ring)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&glc_ring_attach_mutex);
+	for (i = 0; i < GLC_RING_BUFFERS; i++) {
+		if (glc_ring_attachment[i].ring == ring) {
+			glc_ring_attachment[i].buffer = NULL;
+			glc_ring_attachment[i].ring = NULL;
+		}
+	}
+	pthread_mutex_unlock(&glc_ring_attach_mutex);
+
+	pthread_mutex_lock(&ring->mutex);
+	ring->destroyed = 1;
+
+	/* references left in cancelled buffers are never read or released */
+	if ((ring->head != ring->tail) && (glc_state_test(ring->glc, GLC_STATE_CANCEL))) {
+		glc_log(ring->glc, GLC_DEBUG, "ring", "dropping %zu unreleased bytes",
+			 ring->head - ring->tail);
+		ring->tail = ring->head;
+	}
+
+	if (ring->head != ring->tail) {
+		/* last glc_ring_release() frees the ring */
+		pthread_mutex_unlock(&ring->mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&ring->mutex);
+
+	glc_ring_free(ring);
+	return 0;
+}
+
+void glc_ring_free(struct glc_ring_s *ring)
+{
+	munmap(ring->map, ring->size * 2);
+	close(ring->fd);
+
+	pthread_cond_destroy(&ring->released);
+	pthread_mutex_destroy(&ring->mutex);
+	free(ring);
+}
+
+int glc_ring_alloc(glc_ring_t ring, glc_message_type_t type, size_t size,
+		   int nowait, glc_shared_ref_t *ref)
+{
+	struct glc_ring_block_s *block;
+	struct timespec ts;
+	size_t need;
+
+	need = (GLC_RING_HEADER_SIZE + size + GLC_RING_ALIGN - 1) & ~(GLC_RING_ALIGN - 1);
+	if (need > ring->size)
+		return EMSGSIZE;
+
+	pthread_mutex_lock(&ring->mutex);
+	while (ring->head + need - ring->tail > ring->size) {
+		if (nowait) {
+			pthread_mutex_unlock(&ring->mutex);
+			return EBUSY;
+		}
+		if (glc_state_test(ring->glc, GLC_STATE_CANCEL)) {
+			pthread_mutex_unlock(&ring->mutex);
+			return EINTR;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += GLC_RING_WAIT_NS;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&ring->released, &ring->mutex, &ts);
+	}
+
+	/* second view makes block contiguous even if it wraps */
+	block = (struct glc_ring_block_s *) &ring->map[ring->head % ring->size];
+	/* header must be valid before glc_ring_release() can walk to it */
+	block->ring = ring;
+	block->size = need;
+	block->released = 0;
+	ring->head += need;
+	pthread_mutex_unlock(&ring->mutex);
+
+	ref->type = type;
+	ref->data = (char *) block + GLC_RING_HEADER_SIZE;
+	ref->size = size;
+	ref->release = &glc_ring_release;
+	ref->arg = block;
+
+	return 0;
+}
+
+void glc_ring_release(void *arg)
+{
+	struct glc_ring_block_s *block = (struct glc_ring_block_s *) arg;
+	struct glc_ring_s *ring = block->ring;
+	int destroy = 0;
+
+	pthread_mutex_lock(&ring->mutex);
+	block->released = 1;
+
+	/* space is reclaimed in allocation order */
+	while (ring->tail != ring->head) {
+		block = (struct glc_ring_block_s *) &ring->map[ring->tail % ring->size];
+		if (!block->released)
+			break;
+		ring->tail += block->size;
+	}
+
+	if ((ring->destroyed) && (ring->tail == ring->head))
+		destroy = 1;
+	else
+		pthread_cond_broadcast(&ring->released);
+	pthread_mutex_unlock(&ring->mutex);
+
+	if (destroy)
+		glc_ring_free(ring);
+}
+
+int glc_ring_attach(ps_buffer_t *buffer, glc_ring_t ring)
+{
+	unsigned int i, free_slot = GLC_RING_BUFFERS;
+
+	pthread_mutex_lock(&glc_ring_attach_mutex);
+	for (i = 0; i < GLC_RING_BUFFERS; i++) {
+		if (glc_ring_attachment[i].buffer == buffer)
+			break;
+		if ((!glc_ring_attachment[i].buffer) && (free_slot == GLC_RING_BUFFERS))
+			free_slot = i;
+	}
+
+	if (i == GLC_RING_BUFFERS) {
+		if ((!ring) || (free_slot == GLC_RING_BUFFERS)) {
+			pthread_mutex_unlock(&glc_ring_attach_mutex);
+			return ring ? ENOMEM : 0;
+		}
+		i = free_slot;
+	}
+
+	glc_ring_attachment[i].buffer = ring ? buffer : NULL;
+	glc_ring_attachment[i].ring = ring;
+	pthread_mutex_unlock(&glc_ring_attach_mutex);
+	return 0;
+}
+
+glc_ring_t glc_ring_lookup(ps_buffer_t *buffer)
+{
+	glc_ring_t ring = NULL;
+	unsigned int i;
+
+	pthread_mutex_lock(&glc_ring_attach_mutex);
+	for (i = 0; i < GLC_RING_BUFFERS; i++) {
+		if (glc_ring_attachment[i].buffer == buffer) {
+			ring = glc_ring_attachment[i].ring;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&glc_ring_attach_mutex);
+	return ring;
+}
+
+/**  \} */
@@ -0,0 +1,101 @@
+/**
+ * \file glc/common/ring.h
+ * \brief mirrored message data ring
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup common
+ *  \{
+ * \defgroup ring mirrored ring
+ *  \{
+ */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <packetstream.h>
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief mirrored ring
+ */
+typedef struct glc_ring_s* glc_ring_t;
+
+/** smaller messages are written to packet buffer as usual */
+#define GLC_RING_MIN                       (64 * 1024)
+
+/**
+ * \brief initialize mirrored ring
+ * Ring memory is a memfd mapped twice back to back, so data
+ * that wraps around the end of the ring is still contiguous.
+ * Every allocation can be used directly without copying.
+ * \param ring ring
+ * \param glc glc
+ * \param size ring size, rounded up to page size
+ * \param flags GLC_UTIL_BUFFER_* flags applied to ring memory
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_ring_init(glc_ring_t *ring, glc_t *glc, size_t size, glc_flags_t flags);
+
+/**
+ * \brief destroy mirrored ring
+ * Ring is detached from buffers. Memory is freed when last
+ * outstanding reference is released. If GLC_STATE_CANCEL is set,
+ * references left in cancelled buffers are dropped and memory is
+ * freed immediately, so threads using the ring must have finished.
+ * \param ring ring
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_ring_destroy(glc_ring_t ring);
+
+/**
+ * \brief allocate message data from ring
+ * Fills ref with GLC_MESSAGE_SHARED_REF payload pointing to
+ * size bytes of contiguous ring memory. Data is released with
+ * ref->release in any order, space is reused in allocation order.
+ * Returns EMSGSIZE if message can never fit into ring, EBUSY
+ * if nowait is set and ring is full, and EINTR if GLC_STATE_CANCEL
+ * is set while waiting for space.
+ * \param ring ring
+ * \param type message type
+ * \param size size of data
+ * \param nowait don't wait for space
+ * \param ref returned reference
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_ring_alloc(glc_ring_t ring, glc_message_type_t type, size_t size,
+			    int nowait, glc_shared_ref_t *ref);
+
+/**
+ * \brief attach ring to buffer
+ * Writers of buffer put messages of at least GLC_RING_MIN bytes
+ * into ring and write only a reference into buffer. Readers must
+ * understand GLC_MESSAGE_SHARED_REF, glc_thread does.
+ * \param buffer buffer
+ * \param ring ring, NULL detaches
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_ring_attach(ps_buffer_t *buffer, glc_ring_t ring);
+
+/**
+ * \brief find ring attached to buffer
+ * \param buffer buffer
+ * \return ring or NULL
+ */
+__PUBLIC glc_ring_t glc_ring_lookup(ps_buffer_t *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
@@ -0,0 +1,223 @@
+/**
+ * \file glc/common/shared.c
+ * \brief reference-counted shared packet pool
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup shared
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <packetstream.h>
+#include <errno.h>
+
+#include "glc.h"
+#include "core.h"
+#include "state.h"
+#include "shared.h"
+
+/* released blocks kept for reuse */
+#define GLC_SHARED_FREE_BLOCKS       8
+/* cancel is checked this often while waiting for space */
+#define GLC_SHARED_WAIT_NS           100000000
+/* block data starts at this alignment */
+#define GLC_SHARED_ALIGN             16
+
+struct glc_shared_block_s {
+	struct glc_shared_pool_s *pool;
+	unsigned int refs;
+	size_t capacity;
+	struct glc_shared_block_s *next;
+};
+
+#define GLC_SHARED_HEADER_SIZE \
+	((sizeof(struct glc_shared_block_s) + GLC_SHARED_ALIGN - 1) & ~(GLC_SHARED_ALIGN - 1))
+
+struct glc_shared_pool_s {
+	glc_t *glc;
+	size_t limit;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t released;
+
+	size_t used;
+	unsigned int blocks;
+	struct glc_shared_block_s *free;
+	unsigned int free_blocks;
+
+	int destroyed;
+};
+
+void glc_shared_release(void *arg);
+void glc_shared_free(struct glc_shared_pool_s *pool);
+
+int glc_shared_pool_init(glc_shared_pool_t *pool, glc_t *glc, size_t limit)
+{
+	if (!(*pool = (glc_shared_pool_t) malloc(sizeof(struct glc_shared_pool_s))))
+		return ENOMEM;
+	memset(*pool, 0, sizeof(struct glc_shared_pool_s));
+
+	(*pool)->glc = glc;
+	(*pool)->limit = limit;
+	pthread_mutex_init(&(*pool)->mutex, NULL);
+	pthread_cond_init(&(*pool)->released, NULL);
+
+	return 0;
+}
+
+int glc_shared_pool_destroy(glc_shared_pool_t pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->destroyed = 1;
+	if (pool->blocks) {
+		/* last glc_shared_release() frees the pool */
+		pthread_mutex_unlock(&pool->mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	glc_shared_free(pool);
+	return 0;
+}
+
+void glc_shared_free(struct glc_shared_pool_s *pool)
+{
+	struct glc_shared_block_s *del;
+
+	while (pool->free != NULL) {
+		del = pool->free;
+		pool->free = del->next;
+		free(del);
+	}
+
+	pthread_cond_destroy(&pool->released);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+int glc_shared_copy(glc_shared_pool_t pool, glc_message_type_t type,
+		    const char *data, size_t size, unsigned int refs,
+		    glc_shared_ref_t *ref)
+{
+	struct glc_shared_block_s *block, **prev;
+	struct timespec ts;
+
+	if (!refs)
+		return EINVAL;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	/* a single block larger than limit is let through alone */
+	while ((pool->limit) && (pool->blocks) && (pool->used + size > pool->limit)) {
+		if (glc_state_test(pool->glc, GLC_STATE_CANCEL)) {
+			pthread_mutex_unlock(&pool->mutex);
+			return EINTR;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += GLC_SHARED_WAIT_NS;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&pool->released, &pool->mutex, &ts);
+	}
+
+	/* reuse a free block that doesn't waste more than half */
+	block = NULL;
+	prev = &pool->free;
+	while (*prev != NULL) {
+		if (((*prev)->capacity >= size) && ((*prev)->capacity / 2 <= size)) {
+			block = *prev;
+			*prev = block->next;
+			pool->free_blocks--;
+			break;
+		}
+		prev = &(*prev)->next;
+	}
+
+	if (block == NULL) {
+		pthread_mutex_unlock(&pool->mutex);
+		if (!(block = malloc(GLC_SHARED_HEADER_SIZE + size)))
+			return ENOMEM;
+		block->pool = pool;
+		block->capacity = size;
+		pthread_mutex_lock(&pool->mutex);
+	}
+
+	pool->used += block->capacity;
+	pool->blocks++;
+	pthread_mutex_unlock(&pool->mutex);
+
+	block->refs = refs;
+	block->next = NULL;
+	memcpy((char *) block + GLC_SHARED_HEADER_SIZE, data, size);
+
+	ref->type = type;
+	ref->data = (char *) block + GLC_SHARED_HEADER_SIZE;
+	ref->size = size;
+	ref->release = &glc_shared_release;
+	ref->arg = block;
+
+	return 0;
+}
+
+void glc_shared_release(void *arg)
+{
+	struct glc_shared_block_s *block = (struct glc_shared_block_s *) arg;
+	struct glc_shared_pool_s *pool = block->pool;
+	int destroy = 0;
+
+	if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->used -= block->capacity;
+	pool->blocks--;
+
+	if ((!pool->destroyed) && (pool->free_blocks < GLC_SHARED_FREE_BLOCKS)) {
+		block->next = pool->free;
+		pool->free = block;
+		pool->free_blocks++;
+	} else
+		free(block);
+
+	if ((pool->destroyed) && (!pool->blocks))
+		destroy = 1;
+	else
+		pthread_cond_broadcast(&pool->released);
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (destroy)
+		glc_shared_free(pool);
+}
+
+int glc_shared_write(ps_packet_t *packet, glc_shared_ref_t *ref)
+{
+	glc_message_header_t hdr;
+	int ret;
+
+	hdr.type = GLC_MESSAGE_SHARED_REF;
+	if ((ret = ps_packet_open(packet, PS_PACKET_WRITE)))
+		goto err;
+	if ((ret = ps_packet_write(packet, &hdr, sizeof(glc_message_header_t))))
+		goto err;
+	if ((ret = ps_packet_write(packet, ref, sizeof(glc_shared_ref_t))))
+		goto err;
+	if ((ret = ps_packet_close(packet)))
+		goto err;
+
+	return 0;
+err:
+	ref->release(ref->arg);
+	return ret;
+}
+
+/**  \} */
@@ -0,0 +1,91 @@
+/**
+ * \file glc/common/shared.h
+ * \brief reference-counted shared packet pool
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup common
+ *  \{
+ * \defgroup shared shared packet pool
+ *  \{
+ */
+
+#ifndef _SHARED_H
+#define _SHARED_H
+
+#include <packetstream.h>
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief shared packet pool
+ */
+typedef struct glc_shared_pool_s* glc_shared_pool_t;
+
+/**
+ * \brief initialize shared packet pool
+ *
+ * Pool hands out reference-counted data blocks that several
+ * readers can share. Allocation blocks while more than limit
+ * bytes are held by readers.
+ * \param pool pool
+ * \param glc glc
+ * \param limit maximum bytes in use, 0 is unlimited
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_shared_pool_init(glc_shared_pool_t *pool, glc_t *glc, size_t limit);
+
+/**
+ * \brief destroy shared packet pool
+ *
+ * Memory is freed when last outstanding reference
+ * is released.
+ * \param pool pool
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_shared_pool_destroy(glc_shared_pool_t pool);
+
+/**
+ * \brief copy message into a shared block
+ *
+ * Fills ref with GLC_MESSAGE_SHARED_REF payload pointing to a
+ * copy of data. Block is released after refs calls to
+ * ref->release. Returns EINTR if GLC_STATE_CANCEL is set while
+ * waiting for space.
+ * \param pool pool
+ * \param type original message type
+ * \param data message data
+ * \param size size of data
+ * \param refs number of readers
+ * \param ref returned reference
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_shared_copy(glc_shared_pool_t pool, glc_message_type_t type,
+			     const char *data, size_t size, unsigned int refs,
+			     glc_shared_ref_t *ref);
+
+/**
+ * \brief write shared reference as a message
+ *
+ * Reference is consumed by reader of buffer. If writing fails,
+ * reference is released here.
+ * \param packet write packet, not open
+ * \param ref reference
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_shared_write(ps_packet_t *packet, glc_shared_ref_t *ref);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
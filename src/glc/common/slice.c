@@ -0,0 +1,283 @@
+/**
+ * \file glc/common/slice.c
+ * \brief intra-frame slice parallelism
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup slice
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "glc.h"
+#include "core.h"
+#include "log.h"
+#include "slice.h"
+
+#define GLC_SLICE_STARTED          0x1
+#define GLC_SLICE_QUIT             0x2
+
+/* smaller slices are not worth the synchronization */
+#define GLC_SLICE_MIN_ROWS          32
+
+struct glc_slice_job_s {
+	glc_slice_callback_t callback;
+	void *ptr;
+
+	unsigned int rows, band;
+	unsigned int next; /* first row not yet handed out */
+	unsigned int done; /* rows processed */
+
+	struct glc_slice_job_s *next_job;
+};
+
+struct glc_slice_s {
+	glc_t *glc;
+	glc_flags_t flags;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond, done_cond;
+
+	/* jobs that still have rows to hand out */
+	struct glc_slice_job_s *jobs;
+
+	unsigned int slices;
+	pthread_t *workers;
+	unsigned int running;
+};
+
+void *glc_slice_worker(void *argptr);
+int glc_slice_start(glc_slice_t slice);
+int glc_slice_take(glc_slice_t slice, struct glc_slice_job_s *job,
+		   unsigned int *y, unsigned int *rows);
+int glc_slice_queue(glc_slice_t slice, unsigned int rows, unsigned int band,
+		    glc_slice_callback_t callback, void *ptr);
+
+int glc_slice_init(glc_t *glc)
+{
+	glc->slice = (glc_slice_t) malloc(sizeof(struct glc_slice_s));
+	memset(glc->slice, 0, sizeof(struct glc_slice_s));
+
+	glc->slice->glc = glc;
+	glc->slice->slices = 1;
+
+	pthread_mutex_init(&glc->slice->mutex, NULL);
+	pthread_cond_init(&glc->slice->work_cond, NULL);
+	pthread_cond_init(&glc->slice->done_cond, NULL);
+
+	return 0;
+}
+
+int glc_slice_destroy(glc_t *glc)
+{
+	glc_slice_t slice = glc->slice;
+	unsigned int i;
+
+	if (slice->flags & GLC_SLICE_STARTED) {
+		pthread_mutex_lock(&slice->mutex);
+		slice->flags |= GLC_SLICE_QUIT;
+		pthread_cond_broadcast(&slice->work_cond);
+		pthread_mutex_unlock(&slice->mutex);
+
+		for (i = 0; i < slice->running; i++)
+			pthread_join(slice->workers[i], NULL);
+		free(slice->workers);
+	}
+
+	pthread_cond_destroy(&slice->done_cond);
+	pthread_cond_destroy(&slice->work_cond);
+	pthread_mutex_destroy(&slice->mutex);
+
+	free(slice);
+	glc->slice = NULL;
+	return 0;
+}
+
+int glc_slice_set_count(glc_t *glc, unsigned int slices)
+{
+	if (slices < 1)
+		return EINVAL;
+	if (glc->slice->flags & GLC_SLICE_STARTED)
+		return EALREADY;
+
+	glc->slice->slices = slices;
+	return 0;
+}
+
+unsigned int glc_slice_count(glc_t *glc)
+{
+	return glc->slice->slices;
+}
+
+int glc_slice_run(glc_t *glc, unsigned int rows, unsigned int align,
+		  glc_slice_callback_t callback, void *ptr)
+{
+	glc_slice_t slice = glc->slice;
+	unsigned int band;
+
+	if ((slice->slices < 2) || (rows < 2 * GLC_SLICE_MIN_ROWS)) {
+		callback(ptr, 0, rows);
+		return 0;
+	}
+
+	band = (rows + slice->slices - 1) / slice->slices;
+	if (band < GLC_SLICE_MIN_ROWS)
+		band = GLC_SLICE_MIN_ROWS;
+	if (align > 1)
+		band += (align - band % align) % align;
+
+	return glc_slice_queue(slice, rows, band, callback, ptr);
+}
+
+int glc_slice_run_blocks(glc_t *glc, unsigned int blocks,
+			 glc_slice_callback_t callback, void *ptr)
+{
+	glc_slice_t slice = glc->slice;
+
+	if ((slice->slices < 2) || (blocks < 2)) {
+		callback(ptr, 0, blocks);
+		return 0;
+	}
+
+	return glc_slice_queue(slice, blocks, (blocks + slice->slices - 1) / slice->slices,
+			       callback, ptr);
+}
+
+int glc_slice_queue(glc_slice_t slice, unsigned int rows, unsigned int band,
+		    glc_slice_callback_t callback, void *ptr)
+{
+	struct glc_slice_job_s job, **last;
+	unsigned int y, count;
+
+	pthread_mutex_lock(&slice->mutex);
+	if (!(slice->flags & GLC_SLICE_STARTED))
+		glc_slice_start(slice);
+	pthread_mutex_unlock(&slice->mutex);
+
+	if (!slice->running) {
+		callback(ptr, 0, rows);
+		return 0;
+	}
+
+	memset(&job, 0, sizeof(struct glc_slice_job_s));
+	job.callback = callback;
+	job.ptr = ptr;
+	job.rows = rows;
+	job.band = band;
+
+	pthread_mutex_lock(&slice->mutex);
+	for (last = &slice->jobs; *last != NULL; last = &(*last)->next_job);
+	*last = &job;
+	pthread_cond_broadcast(&slice->work_cond);
+
+	/* help with own picture instead of just waiting */
+	while (glc_slice_take(slice, &job, &y, &count)) {
+		pthread_mutex_unlock(&slice->mutex);
+		callback(ptr, y, count);
+		pthread_mutex_lock(&slice->mutex);
+		job.done += count;
+	}
+
+	while (job.done < job.rows)
+		pthread_cond_wait(&slice->done_cond, &slice->mutex);
+	pthread_mutex_unlock(&slice->mutex);
+
+	return 0;
+}
+
+int glc_slice_start(glc_slice_t slice)
+{
+	pthread_attr_t attr;
+	unsigned int i;
+	int ret = 0;
+
+	slice->flags |= GLC_SLICE_STARTED;
+
+	/* calling thread processes one slice */
+	slice->workers = (pthread_t *) malloc(sizeof(pthread_t) * (slice->slices - 1));
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	for (i = 0; i < slice->slices - 1; i++) {
+		if ((ret = pthread_create(&slice->workers[i], &attr, glc_slice_worker, slice))) {
+			glc_log(slice->glc, GLC_WARNING, "slice",
+				 "can't create slice worker: %s (%d)", strerror(ret), ret);
+			break;
+		}
+		slice->running++;
+	}
+
+	pthread_attr_destroy(&attr);
+
+	glc_log(slice->glc, GLC_DEBUG, "slice", "started %u slice workers", slice->running);
+	return ret;
+}
+
+int glc_slice_take(glc_slice_t slice, struct glc_slice_job_s *job,
+		   unsigned int *y, unsigned int *rows)
+{
+	struct glc_slice_job_s **prev;
+
+	if (job->next >= job->rows)
+		return 0;
+
+	*y = job->next;
+	*rows = (job->rows - job->next < job->band) ? (job->rows - job->next) : job->band;
+	job->next += *rows;
+
+	/* everything handed out, drop from queue */
+	if (job->next >= job->rows) {
+		for (prev = &slice->jobs; *prev != NULL; prev = &(*prev)->next_job) {
+			if (*prev == job) {
+				*prev = job->next_job;
+				break;
+			}
+		}
+	}
+
+	return 1;
+}
+
+void *glc_slice_worker(void *argptr)
+{
+	glc_slice_t slice = argptr;
+	struct glc_slice_job_s *job;
+	glc_thread_attr_t attr;
+	unsigned int y, rows;
+
+	glc_get_thread_attr(slice->glc, "slice", &attr);
+	glc_apply_thread_attr(slice->glc, &attr);
+
+	pthread_mutex_lock(&slice->mutex);
+	for (;;) {
+		while ((!(slice->flags & GLC_SLICE_QUIT)) && (slice->jobs == NULL))
+			pthread_cond_wait(&slice->work_cond, &slice->mutex);
+		if (slice->flags & GLC_SLICE_QUIT)
+			break;
+
+		job = slice->jobs;
+		if (!glc_slice_take(slice, job, &y, &rows))
+			continue;
+
+		pthread_mutex_unlock(&slice->mutex);
+		job->callback(job->ptr, y, rows);
+		pthread_mutex_lock(&slice->mutex);
+
+		job->done += rows;
+		if (job->done >= job->rows)
+			pthread_cond_broadcast(&slice->done_cond);
+	}
+	pthread_mutex_unlock(&slice->mutex);
+
+	return NULL;
+}
+
+/**  \} */
@@ -0,0 +1,106 @@
+/**
+ * \file glc/common/slice.h
+ * \brief intra-frame slice parallelism
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup common
+ *  \{
+ * \defgroup slice slice parallelism
+ *  \{
+ */
+
+#ifndef _SLICE_H
+#define _SLICE_H
+
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief slice callback
+ *
+ * Processes rows [y, y + rows) of a picture. Callbacks for
+ * different slices of the same picture run concurrently.
+ */
+typedef void (*glc_slice_callback_t)(void *ptr, unsigned int y, unsigned int rows);
+
+/**
+ * \brief initialize slice worker pool
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PRIVATE int glc_slice_init(glc_t *glc);
+
+/**
+ * \brief destroy slice worker pool
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PRIVATE int glc_slice_destroy(glc_t *glc);
+
+/**
+ * \brief set number of slices a picture is split into
+ *
+ * Default is 1, which processes pictures in the calling
+ * thread. Slice workers are started when first needed and
+ * use thread attributes of "slice" stage.
+ * \param glc glc
+ * \param slices number of slices
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_slice_set_count(glc_t *glc, unsigned int slices);
+
+/**
+ * \brief get number of slices
+ * \param glc glc
+ * \return number of slices
+ */
+__PUBLIC unsigned int glc_slice_count(glc_t *glc);
+
+/**
+ * \brief process picture in slices
+ *
+ * Splits rows into horizontal bands and runs callback for them
+ * in slice workers and in calling thread. Returns when all bands
+ * are done. Several threads can run pictures at the same time.
+ * \param glc glc
+ * \param rows number of rows
+ * \param align slices start at multiples of align
+ * \param callback slice callback
+ * \param ptr argument passed to callback
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_slice_run(glc_t *glc, unsigned int rows, unsigned int align,
+			   glc_slice_callback_t callback, void *ptr);
+
+/**
+ * \brief process independent blocks in slices
+ *
+ * Like glc_slice_run() but without minimum slice size, for
+ * work that is already split into large blocks. Blocks are
+ * handed out in runs of ceil(blocks / glc_slice_count()), so
+ * callback runs at most glc_slice_count() times and
+ * y / run identifies the run.
+ * \param glc glc
+ * \param blocks number of blocks
+ * \param callback slice callback, y and rows count blocks
+ * \param ptr argument passed to callback
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_slice_run_blocks(glc_t *glc, unsigned int blocks,
+				  glc_slice_callback_t callback, void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
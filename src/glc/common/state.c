@@ -21,6 +21,9 @@
 #include "log.h"
 #include "state.h"
 
+/* video streams that can have a playback deadline */
+#define GLC_STATE_DEADLINES          64
+
 struct glc_state_video_s {
 	glc_stream_id_t id;
 
@@ -36,13 +39,16 @@ struct glc_state_audio_s {
 struct glc_state_s {
 	pthread_rwlock_t state_rwlock;
 
-	pthread_rwlock_t time_rwlock;
+	/* nanoseconds, read and updated atomically */
 	glc_stime_t time_difference;
 
 	pthread_rwlock_t video_rwlock;
 	struct glc_state_video_s *video;
 	glc_stream_id_t video_count;
 
+	glc_utime_t deadline[GLC_STATE_DEADLINES];
+	unsigned int deadlines;
+
 	pthread_rwlock_t audio_rwlock;
 	struct glc_state_audio_s *audio;
 	glc_stream_id_t audio_count;
@@ -55,7 +61,6 @@ int glc_state_init(glc_t *glc)
 	memset(glc->state, 0, sizeof(struct glc_state_s));
 
 	pthread_rwlock_init(&glc->state->state_rwlock, NULL);
-	pthread_rwlock_init(&glc->state->time_rwlock, NULL);
 
 	pthread_rwlock_init(&glc->state->video_rwlock, NULL);
 	pthread_rwlock_init(&glc->state->audio_rwlock, NULL);
@@ -83,7 +88,6 @@ int glc_state_destroy(glc_t *glc)
 	}
 
 	pthread_rwlock_destroy(&glc->state->state_rwlock);
-	pthread_rwlock_destroy(&glc->state->time_rwlock);
 
 	pthread_rwlock_destroy(&glc->state->video_rwlock);
 	pthread_rwlock_destroy(&glc->state->audio_rwlock);
@@ -149,16 +153,59 @@ int glc_state_test(glc_t *glc, int flag)
 
 glc_utime_t glc_state_time(glc_t *glc)
 {
-	return glc_time(glc) - glc->state->time_difference;
+	return glc_state_time_ns(glc) / 1000;
+}
+
+glc_utime_t glc_state_time_ns(glc_t *glc)
+{
+	return glc_time_ns(glc) -
+	       __atomic_load_n(&glc->state->time_difference, __ATOMIC_ACQUIRE);
 }
 
 int glc_state_time_add_diff(glc_t *glc, glc_stime_t diff)
 {
 	glc_log(glc, GLC_DEBUG, "state", "applying %ld usec time difference", diff);
-	pthread_rwlock_wrlock(&glc->state->time_rwlock);
-	glc->state->time_difference += diff;
-	pthread_rwlock_unlock(&glc->state->time_rwlock);
+	/* single word, readers never see a torn value */
+	__atomic_add_fetch(&glc->state->time_difference, diff * 1000, __ATOMIC_ACQ_REL);
+	return 0;
+}
+
+int glc_state_video_set_deadline(glc_t *glc, glc_stream_id_t id,
+				 glc_utime_t threshold)
+{
+	glc_utime_t old;
+
+	if ((id < 1) || (id >= GLC_STATE_DEADLINES))
+		return EINVAL;
+
+	pthread_rwlock_wrlock(&glc->state->video_rwlock);
+	old = glc->state->deadline[id];
+	__atomic_store_n(&glc->state->deadline[id], threshold, __ATOMIC_RELEASE);
+
+	if ((!old) && (threshold)) {
+		if (!glc->state->deadlines++)
+			glc_state_set(glc, GLC_STATE_DEADLINE);
+	} else if ((old) && (!threshold)) {
+		if (!--glc->state->deadlines)
+			glc_state_clear(glc, GLC_STATE_DEADLINE);
+	}
+	pthread_rwlock_unlock(&glc->state->video_rwlock);
+
 	return 0;
 }
 
+int glc_state_video_late(glc_t *glc, glc_stream_id_t id, glc_utime_t time)
+{
+	glc_utime_t threshold;
+
+	if ((!glc_state_test(glc, GLC_STATE_DEADLINE)) ||
+	    (id < 1) || (id >= GLC_STATE_DEADLINES))
+		return 0;
+
+	threshold = __atomic_load_n(&glc->state->deadline[id], __ATOMIC_ACQUIRE);
+	if (!threshold)
+		return 0;
+	return (glc_state_time(glc) > time + threshold);
+}
+
 /**  \} */
@@ -24,6 +24,8 @@ extern "C" {
 
 /** all stream operations should cancel */
 #define GLC_STATE_CANCEL     0x1
+/** a player has set a playback deadline */
+#define GLC_STATE_DEADLINE   0x2
 
 /**
  * \brief video stream object
@@ -105,6 +107,13 @@ __PUBLIC __inline__ int glc_state_test(glc_t *glc, int flag);
  */
 __PUBLIC glc_utime_t glc_state_time(glc_t *glc);
 
+/**
+ * \brief get state time in nanoseconds
+ * \param glc glc
+ * \return current state time in nanoseconds
+ */
+__PUBLIC glc_utime_t glc_state_time_ns(glc_t *glc);
+
 /**
  * \brief add value to state time difference
  * \param glc glc
@@ -113,6 +122,30 @@ __PUBLIC glc_utime_t glc_state_time(glc_t *glc);
  */
 __PUBLIC int glc_state_time_add_diff(glc_t *glc, glc_stime_t diff);
 
+/**
+ * \brief set playback deadline for video stream
+ *
+ * Player announces that it drops frames of the stream that
+ * are more than threshold late in state time. Stages before
+ * it can then drop them with glc_state_video_late().
+ * \param glc glc
+ * \param id video stream identifier
+ * \param threshold allowed lateness in microseconds, 0 clears
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_state_video_set_deadline(glc_t *glc, glc_stream_id_t id,
+					  glc_utime_t threshold);
+
+/**
+ * \brief test if video frame is too late to be played
+ * \note doesn't acquire a lock
+ * \param glc glc
+ * \param id video stream identifier
+ * \param time frame time
+ * \return 1 if frame would be dropped by player, otherwise 0
+ */
+__PUBLIC int glc_state_video_late(glc_t *glc, glc_stream_id_t id, glc_utime_t time);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,14 +15,30 @@
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
 #include <packetstream.h>
 #include <errno.h>
 
 #include "glc.h"
+#include "core.h"
 #include "thread.h"
 #include "util.h"
 #include "log.h"
 #include "state.h"
+#include "ring.h"
+
+/* local counters are added to stage totals every n packets */
+#define GLC_THREAD_STATS_FLUSH       32
+
+/**
+ * \brief stage counters, times are in nanoseconds
+ */
+struct glc_thread_counters_s {
+	unsigned long long packets;
+	unsigned long long read_bytes, write_bytes;
+	unsigned long long read_wait, write_wait;
+	unsigned long long callback;
+};
 
 /**
  * \brief thread private variables
@@ -31,10 +47,24 @@ struct glc_thread_private_s {
 	glc_t *glc;
 	ps_buffer_t *from;
 	ps_buffer_t *to;
+	glc_ring_t ring;
 
 	pthread_t *pthread_thread;
 	pthread_mutex_t open, finish;
 
+	/* write turns for GLC_THREAD_CONCURRENT_READ */
+	pthread_mutex_t order;
+	pthread_cond_t order_cond;
+	unsigned long read_seq, write_seq;
+	int order_broken;
+
+	/* telemetry */
+	int stats;
+	pthread_mutex_t stats_mutex;
+	struct glc_thread_counters_s total, reported;
+	glc_utime_t stats_start, stats_time;
+	struct glc_thread_private_s *next;
+
 	glc_thread_t *thread;
 	size_t running_threads;
 
@@ -43,6 +73,20 @@ struct glc_thread_private_s {
 };
 
 void *glc_thread(void *argptr);
+int glc_thread_wait_turn(struct glc_thread_private_s *private, unsigned long seq);
+void glc_thread_next_turn(struct glc_thread_private_s *private);
+void glc_thread_break_order(struct glc_thread_private_s *private);
+
+unsigned long long glc_thread_clock(int stats);
+void glc_thread_stats_flush(struct glc_thread_private_s *private,
+			    struct glc_thread_counters_s *counters);
+void glc_thread_stats_report(struct glc_thread_private_s *private, int final);
+long long glc_thread_queued(struct glc_thread_private_s *private);
+long long glc_thread_queued_locked(struct glc_thread_private_s *private);
+
+/* running threads, needed for matching buffer reader and writer */
+static pthread_mutex_t glc_thread_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct glc_thread_private_s *glc_thread_list = NULL;
 
 int glc_thread_create(glc_t *glc, glc_thread_t *thread, ps_buffer_t *from, ps_buffer_t *to)
 {
@@ -64,8 +108,26 @@ int glc_thread_create(glc_t *glc, glc_thread_t *thread, ps_buffer_t *from, ps_bu
 	private->to = to;
 	private->thread = thread;
 
+	/* large messages go to mirrored ring if buffer has one */
+	if (to)
+		private->ring = glc_ring_lookup(to);
+
 	pthread_mutex_init(&private->open, NULL);
 	pthread_mutex_init(&private->finish, NULL);
+	pthread_mutex_init(&private->order, NULL);
+	pthread_cond_init(&private->order_cond, NULL);
+
+	/* decided once, so counting costs nothing when disabled */
+	private->stats = glc_log_stats_enabled(glc);
+	if (private->stats) {
+		pthread_mutex_init(&private->stats_mutex, NULL);
+		private->stats_start = private->stats_time = glc_time(glc);
+
+		pthread_mutex_lock(&glc_thread_list_mutex);
+		private->next = glc_thread_list;
+		glc_thread_list = private;
+		pthread_mutex_unlock(&glc_thread_list_mutex);
+	}
 
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
@@ -99,9 +161,25 @@ int glc_thread_wait(glc_thread_t *thread)
 		}
 	}
 
+	if (private->stats) {
+		struct glc_thread_private_s **p;
+
+		pthread_mutex_lock(&glc_thread_list_mutex);
+		for (p = &glc_thread_list; *p != NULL; p = &(*p)->next) {
+			if (*p == private) {
+				*p = private->next;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&glc_thread_list_mutex);
+		pthread_mutex_destroy(&private->stats_mutex);
+	}
+
 	free(private->pthread_thread);
 	pthread_mutex_destroy(&private->finish);
 	pthread_mutex_destroy(&private->open);
+	pthread_cond_destroy(&private->order_cond);
+	pthread_mutex_destroy(&private->order);
 	free(private);
 	thread->priv = NULL;
 
@@ -118,17 +196,27 @@ int glc_thread_wait(glc_thread_t *thread)
  */
 void *glc_thread(void *argptr)
 {
-	int has_locked, ret, write_size_set, packets_init;
+	int has_locked, has_seq, has_shared, has_ring, ordered, ret, write_size_set, packets_init;
+	unsigned long seq = 0;
+	unsigned long long t;
 
 	struct glc_thread_private_s *private = (struct glc_thread_private_s *) argptr;
 	glc_thread_t *thread = private->thread;
 	glc_thread_state_t state;
+	glc_thread_attr_t attr;
+	struct glc_thread_counters_s counters;
+	glc_shared_ref_t shared, ring_ref;
 
 	ps_packet_t read, write;
 
-	write_size_set = ret = has_locked = packets_init = 0;
+	write_size_set = ret = has_locked = has_seq = has_shared = has_ring = packets_init = 0;
 	state.flags = state.read_size = state.write_size = 0;
 	state.ptr = thread->ptr;
+	memset(&counters, 0, sizeof(struct glc_thread_counters_s));
+
+	/* placement and scheduling, failures are only warnings */
+	glc_get_thread_attr(private->glc, thread->name, &attr);
+	glc_apply_thread_attr(private->glc, &attr);
 
 	if (thread->flags & GLC_THREAD_READ) {
 		if ((ret = ps_packet_init(&read, private->from)))
@@ -152,45 +240,104 @@ void *glc_thread(void *argptr)
 	do {
 		/* open callback */
 		if (thread->open_callback) {
+			t = glc_thread_clock(private->stats);
 			if ((ret = thread->open_callback(&state)))
 				goto err;
+			counters.callback += glc_thread_clock(private->stats) - t;
 		}
 
+		t = glc_thread_clock(private->stats);
+		ordered = 0;
 		if ((thread->flags & GLC_THREAD_WRITE) && (thread->flags & GLC_THREAD_READ)) {
-			pthread_mutex_lock(&private->open); /* preserve packet order */
-			has_locked = 1;
+			if (thread->flags & GLC_THREAD_CONCURRENT_READ)
+				ordered = 1; /* order is preserved with write turns */
+			else {
+				pthread_mutex_lock(&private->open); /* preserve packet order */
+				has_locked = 1;
+			}
 		}
 
 		if ((thread->flags & GLC_THREAD_READ) && (!(state.flags & GLC_THREAD_STATE_SKIP_READ))) {
-			if ((ret = ps_packet_open(&read, PS_PACKET_READ)))
+			if (ordered) {
+				/* packets are numbered in the order they are read */
+				pthread_mutex_lock(&private->open);
+				if (!(ret = ps_packet_open(&read, PS_PACKET_READ))) {
+					seq = private->read_seq++;
+					has_seq = 1;
+				}
+				pthread_mutex_unlock(&private->open);
+				if (ret)
+					goto err;
+			} else if ((ret = ps_packet_open(&read, PS_PACKET_READ)))
 				goto err;
+			counters.read_wait += glc_thread_clock(private->stats) - t;
+
 			if ((ret = ps_packet_read(&read, &state.header, sizeof(glc_message_header_t))))
 				goto err;
 			if ((ret = ps_packet_getsize(&read, &state.read_size)))
 				goto err;
 			state.read_size -= sizeof(glc_message_header_t);
+
+			if (state.header.type == GLC_MESSAGE_SHARED_REF) {
+				/* callbacks see the shared message as it was */
+				if ((ret = ps_packet_read(&read, &shared, sizeof(glc_shared_ref_t))))
+					goto err;
+				has_shared = 1;
+				state.header.type = shared.type;
+				state.read_size = shared.size;
+			}
+
 			state.write_size = state.read_size;
+			counters.read_bytes += sizeof(glc_message_header_t) + state.read_size;
 
 			/* header callback */
 			if (thread->header_callback) {
+				t = glc_thread_clock(private->stats);
 				if ((ret = thread->header_callback(&state)))
 					goto err;
+				counters.callback += glc_thread_clock(private->stats) - t;
 			}
 
-			if ((ret = ps_packet_dma(&read, (void *) &state.read_data,
-						 state.read_size, PS_ACCEPT_FAKE_DMA)))
+			if (has_shared)
+				state.read_data = shared.data;
+			else if ((ret = ps_packet_dma(&read, (void *) &state.read_data,
+						      state.read_size, PS_ACCEPT_FAKE_DMA)))
 				goto err;
 
 			/* read callback */
 			if (thread->read_callback) {
+				t = glc_thread_clock(private->stats);
 				if ((ret = thread->read_callback(&state)))
 					goto err;
+				counters.callback += glc_thread_clock(private->stats) - t;
 			}
 		}
 
 		if ((thread->flags & GLC_THREAD_WRITE) && (!(state.flags & GLC_THREAD_STATE_SKIP_WRITE))) {
+			/* earlier packets must get their write packets first */
+			t = glc_thread_clock(private->stats);
+			if ((has_seq) && (ret = glc_thread_wait_turn(private, seq)))
+				goto err;
+
 			if ((ret = ps_packet_open(&write, PS_PACKET_WRITE)))
 				goto err;
+			counters.write_wait += glc_thread_clock(private->stats) - t;
+
+			/* ring space is taken in packet order, before giving up turn */
+			if ((private->ring) && (!(state.flags & GLC_THREAD_COPY)) &&
+			    (state.write_size >= GLC_RING_MIN)) {
+				ret = glc_ring_alloc(private->ring, state.header.type,
+						     state.write_size, 0, &ring_ref);
+				if (!ret)
+					has_ring = 1;
+				else if (ret != EMSGSIZE)
+					goto err;
+			}
+
+			if (has_seq) {
+				has_seq = 0;
+				glc_thread_next_turn(private);
+			}
 
 			if (has_locked) {
 				has_locked = 0;
@@ -201,7 +348,13 @@ void *glc_thread(void *argptr)
 			if ((ret = ps_packet_seek(&write, sizeof(glc_message_header_t))))
 				goto err;
 
-			if (!(state.flags & GLC_THREAD_STATE_UNKNOWN_FINAL_SIZE)) {
+			if (has_ring) {
+				/* only reference goes to buffer */
+				if ((ret = ps_packet_setsize(&write, sizeof(glc_message_header_t) +
+								     sizeof(glc_shared_ref_t))))
+					goto err;
+				write_size_set = 1;
+			} else if (!(state.flags & GLC_THREAD_STATE_UNKNOWN_FINAL_SIZE)) {
 				/* 'unlock' write */
 				if ((ret = ps_packet_setsize(&write,
 					                     sizeof(glc_message_header_t) + state.write_size)))
@@ -214,22 +367,49 @@ void *glc_thread(void *argptr)
 				if ((ret = ps_packet_write(&write, state.read_data, state.write_size)))
 					goto err;
 			} else {
-				if ((ret = ps_packet_dma(&write, (void *) &state.write_data,
-							 state.write_size, PS_ACCEPT_FAKE_DMA)))
-						goto err;
+				if (has_ring)
+					state.write_data = ring_ref.data;
+				else if ((ret = ps_packet_dma(&write, (void *) &state.write_data,
+							      state.write_size, PS_ACCEPT_FAKE_DMA)))
+					goto err;
 
 				/* write callback */
 				if (thread->write_callback) {
+					t = glc_thread_clock(private->stats);
 					if ((ret = thread->write_callback(&state)))
 						goto err;
+					counters.callback += glc_thread_clock(private->stats) - t;
 				}
 			}
 
-			/* write header */
-			if ((ret = ps_packet_seek(&write, 0)))
-				goto err;
-			if ((ret = ps_packet_write(&write, &state.header, sizeof(glc_message_header_t))))
-				goto err;
+			if (state.flags & GLC_THREAD_STATE_SKIP_WRITE) {
+				/* write callback dropped the message */
+				if (has_ring) {
+					has_ring = 0;
+					ring_ref.release(ring_ref.arg);
+				}
+				ps_packet_cancel(&write);
+			} else {
+				if (has_ring) {
+					/* callback may have changed type and final size */
+					ring_ref.type = state.header.type;
+					ring_ref.size = state.write_size;
+					if ((ret = ps_packet_write(&write, &ring_ref,
+								   sizeof(glc_shared_ref_t))))
+						goto err;
+					state.header.type = GLC_MESSAGE_SHARED_REF;
+				}
+
+				/* write header */
+				if ((ret = ps_packet_seek(&write, 0)))
+					goto err;
+				if ((ret = ps_packet_write(&write, &state.header,
+							   sizeof(glc_message_header_t))))
+					goto err;
+
+				if (has_ring)
+					state.header.type = ring_ref.type;
+			}
 		}
 
 		/* in case of we skipped writing */
@@ -238,10 +418,22 @@ void *glc_thread(void *argptr)
 			pthread_mutex_unlock(&private->open);
 		}
 
+		if (has_seq) {
+			has_seq = 0;
+			if ((ret = glc_thread_wait_turn(private, seq)))
+				goto err;
+			glc_thread_next_turn(private);
+		}
+
 		if ((thread->flags & GLC_THREAD_READ) && (!(state.flags & GLC_THREAD_STATE_SKIP_READ))) {
 			ps_packet_close(&read);
 			state.read_data = NULL;
 			state.read_size = 0;
+
+			if (has_shared) {
+				has_shared = 0;
+				shared.release(shared.arg);
+			}
 		}
 
 		if ((thread->flags & GLC_THREAD_WRITE) && (!(state.flags & GLC_THREAD_STATE_SKIP_WRITE))) {
@@ -251,16 +443,23 @@ void *glc_thread(void *argptr)
 					goto err;
 			}
 			ps_packet_close(&write);
+			has_ring = 0; /* reader releases it */
+			counters.write_bytes += sizeof(glc_message_header_t) + state.write_size;
 			state.write_data = NULL;
 		state.write_size = 0;
 		}
 
 		/* close callback */
 		if (thread->close_callback) {
+			t = glc_thread_clock(private->stats);
 			if ((ret = thread->close_callback(&state)))
 				goto err;
+			counters.callback += glc_thread_clock(private->stats) - t;
 		}
 
+		if ((private->stats) && (++counters.packets >= GLC_THREAD_STATS_FLUSH))
+			glc_thread_stats_flush(private, &counters);
+
 		if (state.flags & GLC_THREAD_STOP)
 			break; /* no error, just stop, please */
 
@@ -271,6 +470,11 @@ void *glc_thread(void *argptr)
 		 (!private->stop));
 
 finish:
+	if (has_shared)
+		shared.release(shared.arg);
+	if (has_ring)
+		ring_ref.release(ring_ref.arg);
+
 	if (packets_init) {
 		if (thread->flags & GLC_THREAD_READ)
 			ps_packet_destroy(&read);
@@ -278,6 +482,10 @@ finish:
 			ps_packet_destroy(&write);
 	}
 
+	/* threads waiting for their turn won't get it */
+	if (has_seq)
+		glc_thread_break_order(private);
+
 	/* wake up remaining threads */
 	if ((thread->flags & GLC_THREAD_READ) && (!private->stop)) {
 		private->stop = 1;
@@ -290,6 +498,9 @@ finish:
 			ps_buffer_cancel(private->to);
 	}
 
+	if (private->stats)
+		glc_thread_stats_flush(private, &counters);
+
 	/* thread finish callback */
 	if (thread->thread_finish_callback)
 		thread->thread_finish_callback(state.ptr, state.threadptr, ret);
@@ -309,6 +520,9 @@ finish:
 	/* it is safe to unlock now */
 	pthread_mutex_unlock(&private->finish);
 
+	if (private->stats)
+		glc_thread_stats_report(private, 1);
+
 	/* finish callback */
 	if (thread->finish_callback)
 		thread->finish_callback(state.ptr, private->ret);
@@ -329,4 +543,230 @@ err:
 	goto finish;
 }
 
+int glc_thread_wait_turn(struct glc_thread_private_s *private, unsigned long seq)
+{
+	int ret;
+
+	pthread_mutex_lock(&private->order);
+	while ((private->write_seq != seq) && (!private->order_broken))
+		pthread_cond_wait(&private->order_cond, &private->order);
+	ret = private->order_broken ? EINTR : 0;
+	pthread_mutex_unlock(&private->order);
+
+	return ret;
+}
+
+void glc_thread_next_turn(struct glc_thread_private_s *private)
+{
+	pthread_mutex_lock(&private->order);
+	private->write_seq++;
+	pthread_cond_broadcast(&private->order_cond);
+	pthread_mutex_unlock(&private->order);
+}
+
+void glc_thread_break_order(struct glc_thread_private_s *private)
+{
+	pthread_mutex_lock(&private->order);
+	private->order_broken = 1;
+	pthread_cond_broadcast(&private->order_cond);
+	pthread_mutex_unlock(&private->order);
+}
+
+unsigned long long glc_thread_clock(int stats)
+{
+	struct timespec ts;
+
+	if (!stats)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void glc_thread_stats_flush(struct glc_thread_private_s *private,
+			    struct glc_thread_counters_s *counters)
+{
+	int report = 0;
+
+	pthread_mutex_lock(&private->stats_mutex);
+	private->total.packets += counters->packets;
+	private->total.read_bytes += counters->read_bytes;
+	private->total.write_bytes += counters->write_bytes;
+	private->total.read_wait += counters->read_wait;
+	private->total.write_wait += counters->write_wait;
+	private->total.callback += counters->callback;
+
+	if (glc_time(private->glc) - private->stats_time >=
+	    glc_log_stats_interval(private->glc))
+		report = 1;
+	pthread_mutex_unlock(&private->stats_mutex);
+
+	memset(counters, 0, sizeof(struct glc_thread_counters_s));
+
+	if (report)
+		glc_thread_stats_report(private, 0);
+}
+
+long long glc_thread_queued(struct glc_thread_private_s *private)
+{
+	long long queued;
+
+	pthread_mutex_lock(&glc_thread_list_mutex);
+	queued = glc_thread_queued_locked(private);
+	pthread_mutex_unlock(&glc_thread_list_mutex);
+
+	return queued;
+}
+
+long long glc_thread_queued_locked(struct glc_thread_private_s *private)
+{
+	struct glc_thread_private_s *reader;
+	long long queued = -1;
+
+	if (!private->to)
+		return -1;
+
+	/* only known if the next stage is a glc_thread too */
+	for (reader = glc_thread_list; reader != NULL; reader = reader->next) {
+		if ((reader->glc != private->glc) || (reader->from != private->to))
+			continue;
+
+		pthread_mutex_lock(&private->stats_mutex);
+		queued = private->total.write_bytes;
+		pthread_mutex_unlock(&private->stats_mutex);
+
+		pthread_mutex_lock(&reader->stats_mutex);
+		queued -= reader->total.read_bytes;
+		pthread_mutex_unlock(&reader->stats_mutex);
+
+		/* totals are updated lazily */
+		if (queued < 0)
+			queued = 0;
+		break;
+	}
+
+	return queued;
+}
+
+int glc_thread_stats_write(glc_t *glc, FILE *stream)
+{
+	struct glc_thread_private_s *private;
+	struct glc_thread_counters_s total;
+	const char *name;
+	int stages = 0;
+
+	pthread_mutex_lock(&glc_thread_list_mutex);
+	for (private = glc_thread_list; private != NULL; private = private->next) {
+		if (private->glc != glc)
+			continue;
+		name = private->thread->name ? private->thread->name : "glc_thread";
+
+		pthread_mutex_lock(&private->stats_mutex);
+		memcpy(&total, &private->total, sizeof(struct glc_thread_counters_s));
+		pthread_mutex_unlock(&private->stats_mutex);
+
+		fprintf(stream, "%s %llu %llu %llu %llu %llu %llu %lld\n",
+			name, total.packets, total.read_bytes, total.write_bytes,
+			total.read_wait / 1000, total.write_wait / 1000, total.callback / 1000,
+			glc_thread_queued_locked(private));
+		stages++;
+	}
+	pthread_mutex_unlock(&glc_thread_list_mutex);
+
+	return stages;
+}
+
+unsigned int glc_thread_stats_get(glc_t *glc, glc_stats_stage_t *stages,
+				  unsigned int max)
+{
+	struct glc_thread_private_s *private;
+	unsigned int count = 0;
+	const char *name;
+
+	pthread_mutex_lock(&glc_thread_list_mutex);
+	for (private = glc_thread_list; (private != NULL) && (count < max);
+	     private = private->next) {
+		if (private->glc != glc)
+			continue;
+		name = private->thread->name ? private->thread->name : "glc_thread";
+
+		memset(&stages[count], 0, sizeof(glc_stats_stage_t));
+		strncpy(stages[count].name, name, GLC_STATS_NAME_LEN - 1);
+
+		pthread_mutex_lock(&private->stats_mutex);
+		stages[count].packets = private->total.packets;
+		stages[count].read_bytes = private->total.read_bytes;
+		stages[count].write_bytes = private->total.write_bytes;
+		stages[count].callback = private->total.callback / 1000;
+		pthread_mutex_unlock(&private->stats_mutex);
+
+		stages[count].queued = glc_thread_queued_locked(private);
+		count++;
+	}
+	pthread_mutex_unlock(&glc_thread_list_mutex);
+
+	return count;
+}
+
+void glc_thread_stats_report(struct glc_thread_private_s *private, int final)
+{
+	struct glc_thread_counters_s total, delta;
+	const char *name = private->thread->name ? private->thread->name : "glc_thread";
+	glc_utime_t now, elapsed;
+	long long queued;
+
+	now = glc_time(private->glc);
+
+	pthread_mutex_lock(&private->stats_mutex);
+	memcpy(&total, &private->total, sizeof(struct glc_thread_counters_s));
+	if (final) {
+		/* whole run */
+		memcpy(&delta, &total, sizeof(struct glc_thread_counters_s));
+		elapsed = now - private->stats_start;
+	} else {
+		/* another thread of this stage beat us to it */
+		if (now - private->stats_time < glc_log_stats_interval(private->glc)) {
+			pthread_mutex_unlock(&private->stats_mutex);
+			return;
+		}
+
+		delta.packets = total.packets - private->reported.packets;
+		delta.read_bytes = total.read_bytes - private->reported.read_bytes;
+		delta.write_bytes = total.write_bytes - private->reported.write_bytes;
+		delta.read_wait = total.read_wait - private->reported.read_wait;
+		delta.write_wait = total.write_wait - private->reported.write_wait;
+		delta.callback = total.callback - private->reported.callback;
+		elapsed = now - private->stats_time;
+
+		memcpy(&private->reported, &total, sizeof(struct glc_thread_counters_s));
+		private->stats_time = now;
+	}
+	pthread_mutex_unlock(&private->stats_mutex);
+
+	if (elapsed == 0)
+		elapsed = 1;
+	queued = glc_thread_queued(private);
+
+	glc_log(private->glc, GLC_PERFORMANCE, name,
+		 "%s%llu packets (%.1f/s), %.2f MiB in, %.2f MiB out",
+		 final ? "total " : "", delta.packets,
+		 (double) delta.packets * 1000000.0 / (double) elapsed,
+		 (double) delta.read_bytes / (1024.0 * 1024.0),
+		 (double) delta.write_bytes / (1024.0 * 1024.0));
+	glc_log(private->glc, GLC_PERFORMANCE, name,
+		 "waited %.1f ms for read, %.1f ms for write, %.1f ms in callbacks (%.1f%% busy)",
+		 (double) delta.read_wait / 1000000.0,
+		 (double) delta.write_wait / 1000000.0,
+		 (double) delta.callback / 1000000.0,
+		 (double) delta.callback / (10.0 * (double) elapsed * private->thread->threads));
+	if (queued >= 0)
+		glc_log(private->glc, GLC_PERFORMANCE, name,
+			 "~%.2f MiB queued in target buffer", (double) queued / (1024.0 * 1024.0));
+
+	glc_log_stats(private->glc, "%s %llu %llu %llu %llu %llu %llu %lld",
+		      name, total.packets, total.read_bytes, total.write_bytes,
+		      total.read_wait / 1000, total.write_wait / 1000, total.callback / 1000,
+		      queued);
+}
+
 /**  \} */
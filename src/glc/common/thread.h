@@ -16,6 +16,7 @@
 #ifndef _THREAD_H
 #define _THREAD_H
 
+#include <stdio.h>
 #include <packetstream.h>
 #include <glc/common/glc.h>
 
@@ -32,7 +33,8 @@ extern "C" {
 #define GLC_THREAD_STATE_UNKNOWN_FINAL_SIZE   4
 /** thread wants to skip reading a packet */
 #define GLC_THREAD_STATE_SKIP_READ            8
-/** thread wants to skip writing a packet */
+/** thread wants to skip writing a packet, write callback may set
+    this to drop the message */
 #define GLC_THREAD_STATE_SKIP_WRITE          16
 /** just copy data to write packet, skip write callback */
 #define GLC_THREAD_COPY                      32
@@ -71,6 +73,11 @@ typedef struct {
 #define GLC_THREAD_READ                       1
 /** thread does write operations */
 #define GLC_THREAD_WRITE                      2
+/**
+ * read callbacks may run concurrently in different threads,
+ * write packets are still opened in read order
+ */
+#define GLC_THREAD_CONCURRENT_READ            4
 /**
  * \brief thread vtable
  *
@@ -79,12 +86,15 @@ typedef struct {
  * If callback is NULL, it is ignored.
  */
 typedef struct {
-	/** flags, GLC_THREAD_READ or GLC_THREAD_WRITE or both */
+	/** flags, GLC_THREAD_READ or GLC_THREAD_WRITE or both,
+	    optionally GLC_THREAD_CONCURRENT_READ */
 	glc_flags_t flags;
 	/** global argument pointer */
 	void *ptr;
 	/** number of threads to create */
 	size_t threads;
+	/** stage name for thread attributes, see glc_set_thread_attr() */
+	const char *name;
 	/** implementation specific */
 	void *priv;
 
@@ -116,6 +126,8 @@ typedef struct {
  * \brief create thread
  *
  * Creates thread.threads threads (glc_thread()).
+ * GLC_MESSAGE_SHARED_REF messages are unwrapped before
+ * callbacks see them and released when read is closed.
  * \param glc glc
  * \param thread thread information structure
  * \param from buffer where data is read from
@@ -131,6 +143,35 @@ __PUBLIC int glc_thread_create(glc_t *glc, glc_thread_t *thread, ps_buffer_t *fr
  */
 __PUBLIC int glc_thread_wait(glc_thread_t *thread);
 
+/**
+ * \brief write statistics of running threads
+ *
+ * Writes a line for each stage of glc that collects statistics
+ * (see glc_log_stats_enabled()):
+ *  name packets read_bytes write_bytes read_wait write_wait
+ *  callback queued
+ * Counters are totals since thread was created, times are in
+ * microseconds. queued estimates bytes waiting in target buffer,
+ * -1 if it is not known.
+ * \param glc glc
+ * \param stream target stream
+ * \return number of stages written
+ */
+__PUBLIC int glc_thread_stats_write(glc_t *glc, FILE *stream);
+
+/**
+ * \brief get statistics of running threads
+ *
+ * Same counters as glc_thread_stats_write() writes, in
+ * GLC_MESSAGE_STATS format.
+ * \param glc glc
+ * \param stages array to fill
+ * \param max size of stages
+ * \return number of stages filled
+ */
+__PUBLIC unsigned int glc_thread_stats_get(glc_t *glc, glc_stats_stage_t *stages,
+					   unsigned int max);
+
 #ifdef __cplusplus
 }
 #endif
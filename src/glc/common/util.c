@@ -17,6 +17,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
 #include "glc.h"
 #include "core.h"
@@ -51,6 +53,25 @@ int glc_util_app_name(glc_t *glc, char **path, u_int32_t *path_size);
  */
 int glc_util_utc_date(glc_t *glc, char **date, u_int32_t *date_size);
 
+/**
+ * \brief write and read back packets until buffer has been cycled
+ * \param buffer empty buffer
+ * \param size buffer size
+ * \param touch write every byte of packet data
+ * \param start lowest packet data address seen
+ * \param end highest packet data end address seen
+ * \return 0 on success otherwise an error code
+ */
+int glc_util_buffer_cycle(ps_buffer_t *buffer, size_t size, int touch,
+			  uintptr_t *start, uintptr_t *end);
+
+/* packet size used for cycling buffer */
+#define GLC_UTIL_CYCLE_CHUNK             (64 * 1024)
+/* largest pictures auto-sized buffer must hold */
+#define GLC_UTIL_AUTO_MIN_FRAMES         2
+/* room for audio and messages in auto-sized buffer */
+#define GLC_UTIL_AUTO_SLACK              (1024 * 1024)
+
 int glc_util_init(glc_t *glc)
 {
 	glc->util = (glc_util_t) malloc(sizeof(struct glc_util_s));
@@ -147,6 +168,166 @@ finish:
 	return ret;
 }
 
+int glc_util_buffer_prepare(glc_t *glc, ps_buffer_t *buffer,
+			    size_t size, glc_flags_t flags)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = UINTPTR_MAX, end = 0, unused_start, unused_end;
+	int ret;
+
+	if (!flags)
+		return 0;
+
+	/* first pass only finds the memory, hugepages must be
+	   requested before pages are touched */
+	if ((ret = glc_util_buffer_cycle(buffer, size, 0, &start, &end)))
+		return ret;
+
+	/* whole pages inside packet data only */
+	start = (start + page - 1) & ~(page - 1);
+	end &= ~(page - 1);
+	if (end <= start)
+		return 0;
+
+#ifdef MADV_HUGEPAGE
+	if ((flags & GLC_UTIL_BUFFER_HUGEPAGES) &&
+	    (madvise((void *) start, end - start, MADV_HUGEPAGE)))
+		glc_log(glc, GLC_WARNING, "util",
+			 "can't use hugepages for buffer: %s (%d)",
+			 strerror(errno), errno);
+#endif
+
+	unused_start = UINTPTR_MAX;
+	unused_end = 0;
+	if ((flags & GLC_UTIL_BUFFER_PREFAULT) &&
+	    ((ret = glc_util_buffer_cycle(buffer, size, 1, &unused_start, &unused_end))))
+		return ret;
+
+	/* mlock() faults pages in too */
+	if ((flags & GLC_UTIL_BUFFER_LOCK) &&
+	    (mlock((void *) start, end - start)))
+		glc_log(glc, GLC_WARNING, "util",
+			 "can't lock buffer: %s (%d)", strerror(errno), errno);
+
+	glc_log(glc, GLC_DEBUG, "util", "prepared %zu bytes at %p:%s%s%s",
+		 (size_t) (end - start), (void *) start,
+		 flags & GLC_UTIL_BUFFER_HUGEPAGES ? " hugepages" : "",
+		 flags & GLC_UTIL_BUFFER_PREFAULT ? " prefault" : "",
+		 flags & GLC_UTIL_BUFFER_LOCK ? " lock" : "");
+	return 0;
+}
+
+size_t glc_util_buffer_auto_size(size_t frame_size, size_t max_frame_size,
+				 double fps, unsigned int ms)
+{
+	size_t size, min_size;
+
+	size = (size_t) ((double) frame_size * fps * (double) ms / 1000.0);
+	min_size = max_frame_size * GLC_UTIL_AUTO_MIN_FRAMES;
+	if (size < min_size)
+		size = min_size;
+	size += GLC_UTIL_AUTO_SLACK;
+
+	return (size + 1024 * 1024 - 1) & ~((size_t) 1024 * 1024 - 1);
+}
+
+int glc_util_message_time(glc_message_type_t type, const char *data, size_t size,
+			  glc_stream_id_t *id, glc_utime_t *time)
+{
+	/* all of them start like glc_video_frame_header_t */
+	if ((type != GLC_MESSAGE_VIDEO_FRAME) && (type != GLC_MESSAGE_VIDEO_REPEAT) &&
+	    (type != GLC_MESSAGE_VIDEO_DELTA) && (type != GLC_MESSAGE_VIDEO_TILES) &&
+	    (type != GLC_MESSAGE_AUDIO_DATA))
+		return ENOTSUP;
+	if (size < sizeof(glc_video_frame_header_t))
+		return ENOTSUP;
+
+	*id = ((const glc_video_frame_header_t *) data)->id;
+	*time = ((const glc_video_frame_header_t *) data)->time;
+	return 0;
+}
+
+int glc_util_message_video(glc_message_type_t type, const char *data, size_t size,
+			   glc_stream_id_t *id, int *key)
+{
+	const glc_stamp_header_t *stamp = (const glc_stamp_header_t *) data;
+
+	if (type == GLC_MESSAGE_STAMP) {
+		if ((size < sizeof(glc_stamp_header_t)) || (!(stamp->flags & GLC_STAMP_VIDEO)))
+			return ENOTSUP;
+		*id = stamp->id;
+		*key = (stamp->flags & GLC_STAMP_KEY) ? 1 : 0;
+		return 0;
+	}
+
+	if ((type != GLC_MESSAGE_VIDEO_FRAME) && (type != GLC_MESSAGE_VIDEO_REPEAT) &&
+	    (type != GLC_MESSAGE_VIDEO_DELTA) && (type != GLC_MESSAGE_VIDEO_TILES))
+		return ENOTSUP;
+	if (size < sizeof(glc_video_frame_header_t))
+		return ENOTSUP;
+
+	*id = ((const glc_video_frame_header_t *) data)->id;
+	*key = (type == GLC_MESSAGE_VIDEO_FRAME) ||
+	       ((type == GLC_MESSAGE_VIDEO_DELTA) && (size >= sizeof(glc_video_delta_header_t)) &&
+		(((const glc_video_delta_header_t *) data)->flags & GLC_VIDEO_DELTA_KEY));
+	return 0;
+}
+
+int glc_util_buffer_cycle(ps_buffer_t *buffer, size_t size, int touch,
+			  uintptr_t *start, uintptr_t *end)
+{
+	ps_packet_t write, read;
+	size_t done;
+	char *dma;
+	int ret, fake;
+
+	if ((ret = ps_packet_init(&write, buffer)))
+		return ret;
+	if ((ret = ps_packet_init(&read, buffer))) {
+		ps_packet_destroy(&write);
+		return ret;
+	}
+
+	/* extra chunk covers the packet that wraps around */
+	for (done = 0; done < size + GLC_UTIL_CYCLE_CHUNK; done += GLC_UTIL_CYCLE_CHUNK) {
+		if ((ret = ps_packet_open(&write, PS_PACKET_WRITE | PS_PACKET_TRY)))
+			break;
+
+		fake = 0;
+		if (ps_packet_dma(&write, (void *) &dma, GLC_UTIL_CYCLE_CHUNK, 0)) {
+			/* wraps around, copied into buffer on close */
+			fake = 1;
+			if ((ret = ps_packet_cancel(&write)))
+				break;
+			if ((ret = ps_packet_open(&write, PS_PACKET_WRITE | PS_PACKET_TRY)))
+				break;
+			if ((ret = ps_packet_dma(&write, (void *) &dma, GLC_UTIL_CYCLE_CHUNK,
+						 PS_ACCEPT_FAKE_DMA)))
+				break;
+		}
+
+		if (touch)
+			memset(dma, 0, GLC_UTIL_CYCLE_CHUNK);
+		if ((!fake) && ((uintptr_t) dma < *start))
+			*start = (uintptr_t) dma;
+		if ((!fake) && ((uintptr_t) dma + GLC_UTIL_CYCLE_CHUNK > *end))
+			*end = (uintptr_t) dma + GLC_UTIL_CYCLE_CHUNK;
+
+		if ((ret = ps_packet_close(&write)))
+			break;
+
+		/* leave buffer empty */
+		if ((ret = ps_packet_open(&read, PS_PACKET_READ)))
+			break;
+		if ((ret = ps_packet_close(&read)))
+			break;
+	}
+
+	ps_packet_destroy(&read);
+	ps_packet_destroy(&write);
+	return ret;
+}
+
 int glc_util_log_info(glc_t *glc)
 {
 	char *name, *date;
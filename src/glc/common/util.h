@@ -79,6 +79,78 @@ __PUBLIC int glc_util_log_info(glc_t *glc);
  */
 __PUBLIC int glc_util_write_end_of_stream(glc_t *glc, ps_buffer_t *to);
 
+/** back buffer with transparent hugepages */
+#define GLC_UTIL_BUFFER_HUGEPAGES          0x1
+/** touch every page of buffer */
+#define GLC_UTIL_BUFFER_PREFAULT           0x2
+/** lock buffer into memory */
+#define GLC_UTIL_BUFFER_LOCK               0x4
+
+/**
+ * \brief prepare buffer memory before capture starts
+ *
+ * packetstream allocates buffer memory itself, so memory is found
+ * by writing and reading back packets until whole buffer has been
+ * cycled. Buffer must be empty and have no readers or writers yet,
+ * it is left empty.
+ *
+ * Hugepages and locking are hints, failures are only logged.
+ * \param glc glc
+ * \param buffer buffer
+ * \param size buffer size, as given to ps_bufferattr_setsize()
+ * \param flags GLC_UTIL_BUFFER_* flags
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_util_buffer_prepare(glc_t *glc, ps_buffer_t *buffer,
+				     size_t size, glc_flags_t flags);
+
+/**
+ * \brief calculate buffer size for picture stream
+ *
+ * Buffer holds given time of pictures, but always at least
+ * two of largest possible pictures so that stream keeps
+ * flowing if picture grows later. Some room is left for
+ * audio and messages.
+ * \param frame_size size of one picture in bytes
+ * \param max_frame_size size of largest possible picture
+ * \param fps pictures per second
+ * \param ms time to hold, in milliseconds
+ * \return buffer size in bytes, a multiple of MiB
+ */
+__PUBLIC size_t glc_util_buffer_auto_size(size_t frame_size, size_t max_frame_size,
+					  double fps, unsigned int ms);
+
+/**
+ * \brief stream id and time of data message
+ *
+ * Video frames, repeats, deltas, tiles and audio data start
+ * with stream id and time.
+ * \param type message type
+ * \param data message
+ * \param size message size
+ * \param id returned stream id
+ * \param time returned stream time
+ * \return 0 on success, ENOTSUP if message has no stream time
+ */
+__PUBLIC int glc_util_message_time(glc_message_type_t type, const char *data, size_t size,
+				   glc_stream_id_t *id, glc_utime_t *time);
+
+/**
+ * \brief stream id of video picture and whether it is a key frame
+ *
+ * Key frames are whole pictures and key deltas, decoding can
+ * start from them. Pictures stamped by pack are recognized
+ * from glc_stamp_header_t.
+ * \param type message type
+ * \param data message
+ * \param size message size
+ * \param id returned stream id
+ * \param key returned 1 for key frame, 0 otherwise
+ * \return 0 on success, ENOTSUP if message is not a picture
+ */
+__PUBLIC int glc_util_message_video(glc_message_type_t type, const char *data, size_t size,
+				    glc_stream_id_t *id, int *key);
+
 /**
  * \brief replace all occurences of string with another string
  * \param str string to manipulate
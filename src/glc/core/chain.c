@@ -0,0 +1,381 @@
+/**
+ * \file glc/core/chain.c
+ * \brief fused filter chain
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup chain
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <packetstream.h>
+#include <errno.h>
+
+#include <glc/common/glc.h>
+#include <glc/common/core.h>
+#include <glc/common/log.h>
+#include <glc/common/thread.h>
+#include <glc/common/util.h>
+#include <glc/common/state.h>
+
+#include "chain.h"
+
+#define CHAIN_RUNNING      0x1
+
+#define CHAIN_FILTERS        8
+/* output rows per band, small enough for every stage to stay in cache */
+#define CHAIN_BAND_ROWS     16
+
+struct chain_stage_s {
+	chain_filter_t *filter;
+	void *ctx;
+	int whole;
+
+	chain_rows_t from, to;
+	unsigned int y, rows;
+
+	unsigned char *scratch;
+	size_t scratch_size;
+};
+
+struct chain_thread_s {
+	struct chain_stage_s stage[CHAIN_FILTERS];
+	unsigned int active;
+};
+
+struct chain_s {
+	glc_t *glc;
+	glc_flags_t flags;
+	glc_thread_t thread;
+
+	chain_filter_t filter[CHAIN_FILTERS];
+	unsigned int filters;
+};
+
+int chain_thread_create_callback(void *ptr, void **threadptr);
+void chain_thread_finish_callback(void *ptr, void *threadptr, int err);
+int chain_read_callback(glc_thread_state_t *state);
+int chain_write_callback(glc_thread_state_t *state);
+void chain_finish_callback(void *ptr, int err);
+
+size_t chain_rows_size(chain_rows_t *rows, unsigned int count);
+void chain_clamp(chain_rows_t *from, unsigned int *y, unsigned int *rows);
+int chain_band(chain_t chain, struct chain_thread_s *thread,
+	       unsigned int y, unsigned int rows, int whole);
+
+int chain_init(chain_t *chain, glc_t *glc)
+{
+	*chain = (chain_t) malloc(sizeof(struct chain_s));
+	memset(*chain, 0, sizeof(struct chain_s));
+
+	(*chain)->glc = glc;
+
+	(*chain)->thread.flags = GLC_THREAD_READ | GLC_THREAD_WRITE;
+	(*chain)->thread.thread_create_callback = &chain_thread_create_callback;
+	(*chain)->thread.thread_finish_callback = &chain_thread_finish_callback;
+	(*chain)->thread.read_callback = &chain_read_callback;
+	(*chain)->thread.write_callback = &chain_write_callback;
+	(*chain)->thread.finish_callback = &chain_finish_callback;
+	(*chain)->thread.ptr = *chain;
+	(*chain)->thread.threads = glc_threads_hint(glc);
+	(*chain)->thread.name = "chain";
+
+	return 0;
+}
+
+int chain_destroy(chain_t chain)
+{
+	free(chain);
+	return 0;
+}
+
+int chain_add_filter(chain_t chain, chain_filter_t *filter)
+{
+	if (chain->flags & CHAIN_RUNNING)
+		return EALREADY;
+	if (chain->filters >= CHAIN_FILTERS)
+		return ENOSPC;
+
+	memcpy(&chain->filter[chain->filters++], filter, sizeof(chain_filter_t));
+	return 0;
+}
+
+int chain_process_start(chain_t chain, ps_buffer_t *from, ps_buffer_t *to)
+{
+	int ret;
+	if (chain->flags & CHAIN_RUNNING)
+		return EAGAIN;
+
+	if ((ret = glc_thread_create(chain->glc, &chain->thread, from, to)))
+		return ret;
+	chain->flags |= CHAIN_RUNNING;
+
+	return 0;
+}
+
+int chain_process_wait(chain_t chain)
+{
+	if (!(chain->flags & CHAIN_RUNNING))
+		return EAGAIN;
+
+	glc_thread_wait(&chain->thread);
+	chain->flags &= ~CHAIN_RUNNING;
+
+	return 0;
+}
+
+int chain_thread_create_callback(void *ptr, void **threadptr)
+{
+	struct chain_thread_s *thread;
+
+	if (!(thread = malloc(sizeof(struct chain_thread_s))))
+		return ENOMEM;
+	memset(thread, 0, sizeof(struct chain_thread_s));
+
+	*threadptr = thread;
+	return 0;
+}
+
+void chain_thread_finish_callback(void *ptr, void *threadptr, int err)
+{
+	struct chain_thread_s *thread = threadptr;
+	unsigned int i;
+
+	if (!thread)
+		return;
+
+	for (i = 0; i < CHAIN_FILTERS; i++) {
+		if (thread->stage[i].scratch)
+			free(thread->stage[i].scratch);
+	}
+	free(thread);
+}
+
+void chain_finish_callback(void *ptr, int err)
+{
+	chain_t chain = ptr;
+	unsigned int i;
+
+	if (err)
+		glc_log(chain->glc, GLC_ERROR, "chain", "%s (%d)", strerror(err), err);
+
+	/* filters clean up their stream data */
+	for (i = 0; i < chain->filters; i++) {
+		if (chain->filter[i].finish_callback)
+			chain->filter[i].finish_callback(chain->filter[i].ptr, err);
+	}
+}
+
+int chain_read_callback(glc_thread_state_t *state)
+{
+	chain_t chain = state->ptr;
+	struct chain_thread_s *thread = state->threadptr;
+	struct chain_stage_s *stage;
+	glc_video_frame_header_t *pic_hdr;
+	unsigned int i;
+	int ret;
+
+	if (state->header.type != GLC_MESSAGE_VIDEO_FRAME) {
+		/* messages pass filters in order, as they would through buffers */
+		for (i = 0; i < chain->filters; i++) {
+			if (!chain->filter[i].message_callback)
+				continue;
+			if ((ret = chain->filter[i].message_callback(chain->filter[i].ptr, state)))
+				return ret;
+			if (state->flags & GLC_THREAD_STATE_SKIP_WRITE)
+				return 0;
+		}
+
+		state->flags |= GLC_THREAD_COPY;
+		return 0;
+	}
+
+	pic_hdr = (glc_video_frame_header_t *) state->read_data;
+	if (glc_state_video_late(chain->glc, pic_hdr->id, pic_hdr->time)) {
+		/* player would drop it anyway */
+		state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
+		return 0;
+	}
+
+	thread->active = 0;
+
+	for (i = 0; i < chain->filters; i++) {
+		stage = &thread->stage[thread->active];
+		stage->whole = 0;
+
+		if ((ret = chain->filter[i].frame_callback(chain->filter[i].ptr, pic_hdr->id,
+							   &stage->from, &stage->to,
+							   &stage->whole, &stage->ctx)))
+			goto err;
+
+		if (stage->ctx == NULL)
+			continue; /* filter passes this stream through */
+
+		stage->filter = &chain->filter[i];
+		thread->active++;
+	}
+
+	if (!thread->active) {
+		state->flags |= GLC_THREAD_COPY;
+		return 0;
+	}
+
+	stage = &thread->stage[thread->active - 1];
+	state->write_size = sizeof(glc_video_frame_header_t) +
+			    chain_rows_size(&stage->to, stage->to.h);
+
+	return 0;
+err:
+	for (i = 0; i < thread->active; i++)
+		thread->stage[i].filter->done_callback(thread->stage[i].filter->ptr,
+						       thread->stage[i].ctx);
+	thread->active = 0;
+	return ret;
+}
+
+int chain_write_callback(glc_thread_state_t *state)
+{
+	chain_t chain = state->ptr;
+	struct chain_thread_s *thread = state->threadptr;
+	struct chain_stage_s *first, *last;
+	unsigned int y, rows, band, i;
+	int whole = 0, ret = 0;
+
+	memcpy(state->write_data, state->read_data, sizeof(glc_video_frame_header_t));
+
+	first = &thread->stage[0];
+	last = &thread->stage[thread->active - 1];
+
+	/* first filter reads the whole picture from packet... */
+	first->from.data = (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)];
+	first->from.y = 0;
+	first->from.rows = first->from.h;
+
+	/* ...and last one writes straight into target packet */
+	last->to.data = (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)];
+	last->to.y = 0;
+	last->to.rows = last->to.h;
+
+	for (i = 0; i < thread->active; i++) {
+		if (thread->stage[i].whole)
+			whole = 1;
+	}
+
+	band = whole ? last->to.h : CHAIN_BAND_ROWS;
+	for (y = 0; y < last->to.h; y += band) {
+		rows = (last->to.h - y < band) ? (last->to.h - y) : band;
+		if ((ret = chain_band(chain, thread, y, rows, whole)))
+			break;
+	}
+
+	for (i = 0; i < thread->active; i++)
+		thread->stage[i].filter->done_callback(thread->stage[i].filter->ptr,
+						       thread->stage[i].ctx);
+	thread->active = 0;
+
+	return ret;
+}
+
+int chain_band(chain_t chain, struct chain_thread_s *thread,
+	       unsigned int y, unsigned int rows, int whole)
+{
+	struct chain_stage_s *stage, *next;
+	unsigned int i;
+	size_t size;
+
+	/* work backwards to find out which rows each stage has to produce */
+	stage = &thread->stage[thread->active - 1];
+	stage->y = y;
+	stage->rows = rows;
+
+	for (i = thread->active - 1; i > 0; i--) {
+		stage = &thread->stage[i];
+		next = &thread->stage[i - 1];
+
+		if (whole) {
+			next->y = 0;
+			next->rows = next->to.h;
+		} else if (stage->rows == 0) {
+			next->y = next->rows = 0;
+		} else {
+			stage->filter->need_callback(stage->filter->ptr, stage->ctx,
+						     stage->y, stage->rows,
+						     &next->y, &next->rows);
+			chain_clamp(&stage->from, &next->y, &next->rows);
+		}
+	}
+
+	/* and then run them in order */
+	for (i = 0; i < thread->active; i++) {
+		stage = &thread->stage[i];
+
+		if (i < thread->active - 1) {
+			/* intermediate rows go to per-thread scratch */
+			size = chain_rows_size(&stage->to, stage->rows);
+			if (size > stage->scratch_size) {
+				if (stage->scratch)
+					free(stage->scratch);
+				if (!(stage->scratch = malloc(size))) {
+					stage->scratch_size = 0;
+					return ENOMEM;
+				}
+				stage->scratch_size = size;
+			}
+
+			stage->to.data = stage->scratch;
+			stage->to.y = stage->y;
+			stage->to.rows = stage->rows;
+		}
+
+		if (stage->rows)
+			stage->filter->rows_callback(stage->filter->ptr, stage->ctx,
+						     &stage->from, &stage->to,
+						     stage->y, stage->rows);
+
+		if (i < thread->active - 1) {
+			next = &thread->stage[i + 1];
+			next->from.data = stage->to.data;
+			next->from.y = stage->to.y;
+			next->from.rows = stage->to.rows;
+		}
+	}
+
+	return 0;
+}
+
+size_t chain_rows_size(chain_rows_t *rows, unsigned int count)
+{
+	if (rows->format == GLC_VIDEO_YCBCR_420JPEG)
+		return count * rows->row + 2 * ((count / 2) * (rows->row / 2));
+	else if (rows->format == GLC_VIDEO_NV12)
+		return count * rows->row + (count / 2) * rows->row;
+	return count * rows->row;
+}
+
+void chain_clamp(chain_rows_t *from, unsigned int *y, unsigned int *rows)
+{
+	unsigned int end = *y + *rows;
+
+	if (end > from->h)
+		end = from->h;
+	if (*y > end)
+		*y = end;
+
+	/* chroma rows are shared by two Y' rows */
+	if ((from->format == GLC_VIDEO_YCBCR_420JPEG) |
+	    (from->format == GLC_VIDEO_NV12)) {
+		*y -= *y % 2;
+		end += end % 2;
+	}
+
+	*rows = end - *y;
+}
+
+/**  \} */
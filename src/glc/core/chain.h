@@ -0,0 +1,156 @@
+/**
+ * \file glc/core/chain.h
+ * \brief fused filter chain
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup core
+ *  \{
+ * \defgroup chain fused filter chain
+ *  \{
+ */
+
+#ifndef _CHAIN_H
+#define _CHAIN_H
+
+#include <packetstream.h>
+#include <glc/common/glc.h>
+#include <glc/common/thread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief rows of a picture
+ *
+ * Holds rows [y, y + rows) of a picture. Y'CbCr 4:2:0 planes
+ * are stored one after another as in a full frame, so rows
+ * covering the whole picture are laid out exactly like a frame.
+ * NV12 has a single CbCr plane after Y' plane.
+ * Y'CbCr rows always start at an even row.
+ */
+typedef struct {
+	/** picture format */
+	glc_video_format_t format;
+	/** picture width and height */
+	unsigned int w, h;
+	/** bytes per row, Y' plane width for Y'CbCr */
+	unsigned int row;
+	/** first row held */
+	unsigned int y;
+	/** number of rows held */
+	unsigned int rows;
+	/** data */
+	unsigned char *data;
+} chain_rows_t;
+
+/** pointer to row n, or to Y' row n of Y'CbCr picture */
+#define CHAIN_ROW(r, n) \
+	(&(r)->data[((n) - (r)->y) * (r)->row])
+/** pointer to Cb row n (n is a chroma row) */
+#define CHAIN_CB_ROW(r, n) \
+	(&(r)->data[(r)->rows * (r)->row + ((n) - (r)->y / 2) * ((r)->row / 2)])
+/** pointer to Cr row n (n is a chroma row) */
+#define CHAIN_CR_ROW(r, n) \
+	(&CHAIN_CB_ROW(r, n)[((r)->rows / 2) * ((r)->row / 2)])
+/** pointer to interleaved CbCr row n of NV12 picture */
+#define CHAIN_UV_ROW(r, n) \
+	(&(r)->data[(r)->rows * (r)->row + ((n) - (r)->y / 2) * (r)->row])
+
+/**
+ * \brief filter vtable
+ *
+ * Filters (rgb, scale, color, ycbcr) fill this in so chain can
+ * run their kernels on a band of rows at a time.
+ */
+typedef struct {
+	/** filter object */
+	void *ptr;
+
+	/** called for every message that is not a video frame,
+	    may modify message and set GLC_THREAD_STATE_SKIP_WRITE */
+	int (*message_callback)(void *ptr, glc_thread_state_t *state);
+	/** locks video stream for a frame, ctx is set to NULL if
+	    filter does nothing to frames in this stream, otherwise
+	    source and target picture geometry is filled in and whole
+	    is set if filter can only process whole pictures */
+	int (*frame_callback)(void *ptr, glc_stream_id_t id,
+			      chain_rows_t *from, chain_rows_t *to,
+			      int *whole, void **ctx);
+	/** source rows needed for producing rows [y, y + rows) */
+	void (*need_callback)(void *ptr, void *ctx, unsigned int y, unsigned int rows,
+			      unsigned int *from_y, unsigned int *from_rows);
+	/** produce rows [y, y + rows) into to */
+	void (*rows_callback)(void *ptr, void *ctx, chain_rows_t *from, chain_rows_t *to,
+			      unsigned int y, unsigned int rows);
+	/** unlocks video stream */
+	void (*done_callback)(void *ptr, void *ctx);
+	/** releases stream data when chain has finished */
+	void (*finish_callback)(void *ptr, int err);
+} chain_filter_t;
+
+/**
+ * \brief chain object
+ */
+typedef struct chain_s* chain_t;
+
+/**
+ * \brief initialize chain object
+ * \param chain chain object
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int chain_init(chain_t *chain, glc_t *glc);
+
+/**
+ * \brief destroy chain object
+ * \param chain chain object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int chain_destroy(chain_t chain);
+
+/**
+ * \brief append filter to chain
+ *
+ * Filters are applied in the order they are added. A filter
+ * in chain must not be started on its own.
+ * \param chain chain object
+ * \param filter filter, see rgb_filter(), scale_filter(),
+ *               color_filter() and ycbcr_filter()
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int chain_add_filter(chain_t chain, chain_filter_t *filter);
+
+/**
+ * \brief start chain process
+ *
+ * Each worker applies all filters to a band of rows at a time
+ * while the data is still in cache, so no intermediate buffers
+ * between filters are needed. Output is identical to running
+ * the filters in separate processes.
+ * \param chain chain object
+ * \param from source buffer
+ * \param to target buffer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int chain_process_start(chain_t chain, ps_buffer_t *from, ps_buffer_t *to);
+
+/**
+ * \brief block until process has finished
+ * \param chain chain object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int chain_process_wait(chain_t chain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
@@ -20,11 +20,19 @@
 #include <errno.h>
 #include <math.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define COLOR_X86
+#endif
+
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/thread.h>
 #include <glc/common/util.h>
+#include <glc/common/state.h>
+#include <glc/common/slice.h>
+#include <glc/common/registry.h>
 
 #include "color.h"
 
@@ -37,10 +45,32 @@
 #define COLOR_RUNNING     0x1
 #define COLOR_OVERRIDE    0x2
 
+/* Y'CbCr -> R'G'B', 14-bit fixed point */
+#define COLOR_RGB_BITS       14
+#define COLOR_RGB_ROUND      (1 << (COLOR_RGB_BITS - 1))
+#define COLOR_Cr_R        22970
+#define COLOR_Cb_G        -5638
+#define COLOR_Cr_G       -11700
+#define COLOR_Cb_B        29032
+
+/* R'G'B' -> Y'CbCr, 16-bit fixed point, rows sum to 65536 and 0 */
+#define COLOR_YCBCR_BITS     16
+#define COLOR_YCBCR_ROUND    (1 << (COLOR_YCBCR_BITS - 1))
+#define COLOR_R_Y         19595
+#define COLOR_G_Y         38470
+#define COLOR_B_Y          7471
+#define COLOR_R_Cb       -11059
+#define COLOR_G_Cb       -21709
+#define COLOR_B_Cb        32768
+#define COLOR_R_Cr        32768
+#define COLOR_G_Cr       -27439
+#define COLOR_B_Cr        -5329
+
 struct color_video_stream_s;
 
 typedef void (*color_proc)(color_t color, struct color_video_stream_s *video,
-			   unsigned char *from, unsigned char *to);
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows);
 
 struct color_video_stream_s {
 	glc_stream_id_t id;
@@ -53,10 +83,11 @@ struct color_video_stream_s {
 	float red_gamma, green_gamma, blue_gamma;
 
 	unsigned char *lookup_table;
+	/* per-channel curves for separable Y'CbCr correction */
+	int curve[3][256];
 	color_proc proc;
 
 	pthread_rwlock_t update;
-	struct color_video_stream_s *next;
 };
 
 struct color_s {
@@ -64,18 +95,27 @@ struct color_s {
 	glc_flags_t flags;
 	glc_thread_t thread;
 
-	struct color_video_stream_s *video;
+	glc_registry_t video;
 
 	float brightness, contrast;
 	float red_gamma, green_gamma, blue_gamma;
 };
 
+struct color_slice_s {
+	color_t color;
+	struct color_video_stream_s *video;
+	chain_rows_t from, to;
+};
+
 int color_read_callback(glc_thread_state_t *state);
 int color_write_callback(glc_thread_state_t *state);
+void color_slice_callback(void *ptr, unsigned int y, unsigned int rows);
 void color_finish_callback(void *ptr, int err);
 
-void color_get_video_stream(color_t color, glc_stream_id_t id,
-		   struct color_video_stream_s **video);
+int color_get_video_stream(color_t color, glc_stream_id_t id,
+			   struct color_video_stream_s **video);
+int color_video_stream_init(void *entry, glc_stream_id_t id, void *arg);
+int color_video_stream_destroy(void *entry, glc_stream_id_t id, void *arg);
 
 int color_video_format_msg(color_t color, glc_video_format_message_t *msg);
 int color_color_msg(color_t color, glc_color_message_t *msg);
@@ -84,11 +124,44 @@ int color_generate_ycbcr_lookup_table(color_t color,
 				      struct color_video_stream_s *video);
 int color_generate_rgb_lookup_table(color_t color,
 				    struct color_video_stream_s *video);
+int color_generate_ycbcr_curves(color_t color,
+				struct color_video_stream_s *video);
+void color_ycbcr_init(color_t color, struct color_video_stream_s *video);
 
 void color_ycbcr(color_t color, struct color_video_stream_s *video,
-		 unsigned char *from, unsigned char *to);
-void color_bgr(color_t color, struct color_video_stream_s *video,
-	       unsigned char *from, unsigned char *to);
+		 chain_rows_t *from, chain_rows_t *to,
+		 unsigned int y, unsigned int rows);
+color_proc color_bgr_proc(struct color_video_stream_s *video);
+void color_bgr_bgr(color_t color, struct color_video_stream_s *video,
+		   chain_rows_t *from, chain_rows_t *to,
+		   unsigned int y, unsigned int rows);
+void color_bgr_bgra(color_t color, struct color_video_stream_s *video,
+		    chain_rows_t *from, chain_rows_t *to,
+		    unsigned int y, unsigned int rows);
+void color_ycbcr_curves(color_t color, struct color_video_stream_s *video,
+			chain_rows_t *from, chain_rows_t *to,
+			unsigned int y, unsigned int rows);
+void color_ycbcr_row(struct color_video_stream_s *video,
+		     unsigned char **Y_from, unsigned char *Cb_from, unsigned char *Cr_from,
+		     unsigned char **Y_to, unsigned char *Cb_to, unsigned char *Cr_to,
+		     unsigned int x);
+
+#ifdef COLOR_X86
+void color_ycbcr_avx2(color_t color, struct color_video_stream_s *video,
+		      chain_rows_t *from, chain_rows_t *to,
+		      unsigned int y, unsigned int rows);
+#endif
+
+int color_message_callback(void *ptr, glc_thread_state_t *state);
+int color_frame_callback(void *ptr, glc_stream_id_t id,
+			 chain_rows_t *from, chain_rows_t *to,
+			 int *whole, void **ctx);
+void color_need_callback(void *ptr, void *ctx, unsigned int y, unsigned int rows,
+			 unsigned int *from_y, unsigned int *from_rows);
+void color_rows_callback(void *ptr, void *ctx, chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows);
+void color_done_callback(void *ptr, void *ctx);
+void color_get_rows(struct color_video_stream_s *video, chain_rows_t *rows);
 
 /* unfortunately over- and underflows will occur */
 __inline__ unsigned char color_clamp(int val)
@@ -102,10 +175,18 @@ __inline__ unsigned char color_clamp(int val)
 
 int color_init(color_t *color, glc_t *glc)
 {
+	int ret;
+
 	*color = malloc(sizeof(struct color_s));
 	memset(*color, 0, sizeof(struct color_s));
 
 	(*color)->glc = glc;
+	if ((ret = glc_registry_init(&(*color)->video, sizeof(struct color_video_stream_s),
+				     &color_video_stream_init, &color_video_stream_destroy,
+				     *color))) {
+		free(*color);
+		return ret;
+	}
 
 	(*color)->thread.flags = GLC_THREAD_READ | GLC_THREAD_WRITE;
 	(*color)->thread.read_callback = &color_read_callback;
@@ -113,12 +194,14 @@ int color_init(color_t *color, glc_t *glc)
 	(*color)->thread.finish_callback = &color_finish_callback;
 	(*color)->thread.ptr = *color;
 	(*color)->thread.threads = glc_threads_hint(glc);
+	(*color)->thread.name = "color";
 
 	return 0;
 }
 
 int color_destroy(color_t color)
 {
+	glc_registry_destroy(color->video);
 	free(color);
 	return 0;
 }
@@ -147,6 +230,23 @@ int color_process_wait(color_t color)
 	return 0;
 }
 
+int color_filter(color_t color, chain_filter_t *filter)
+{
+	if (color->flags & COLOR_RUNNING)
+		return EALREADY;
+
+	memset(filter, 0, sizeof(chain_filter_t));
+	filter->ptr = color;
+	filter->message_callback = &color_message_callback;
+	filter->frame_callback = &color_frame_callback;
+	filter->need_callback = &color_need_callback;
+	filter->rows_callback = &color_rows_callback;
+	filter->done_callback = &color_done_callback;
+	filter->finish_callback = &color_finish_callback;
+
+	return 0;
+}
+
 int color_override(color_t color, float brightness, float contrast,
 			    float red, float green, float blue)
 {
@@ -169,20 +269,11 @@ int color_override_clear(color_t color)
 void color_finish_callback(void *ptr, int err)
 {
 	color_t color = (color_t) ptr;
-	struct color_video_stream_s *del;
 
 	if (err)
 		glc_log(color->glc, GLC_ERROR, "color", "%s (%d)", strerror(err), err);
 
-	while (color->video != NULL) {
-		del = color->video;
-		color->video = color->video->next;
-
-		pthread_rwlock_destroy(&del->update);
-		if (del->lookup_table)
-			free(del->lookup_table);
-		free(del);
-	}
+	glc_registry_clear(color->video);
 }
 
 int color_read_callback(glc_thread_state_t *state)
@@ -190,6 +281,7 @@ int color_read_callback(glc_thread_state_t *state)
 	color_t color = (color_t) state->ptr;
 	struct color_video_stream_s *video;
 	glc_video_frame_header_t *pic_hdr;
+	int ret;
 
 	if (state->header.type == GLC_MESSAGE_COLOR) {
 		color_color_msg(color, (glc_color_message_t *) state->read_data);
@@ -204,7 +296,13 @@ int color_read_callback(glc_thread_state_t *state)
 
 	if (state->header.type == GLC_MESSAGE_VIDEO_FRAME) {
 		pic_hdr = (glc_video_frame_header_t *) state->read_data;
-		color_get_video_stream(color, pic_hdr->id, &video);
+		if (glc_state_video_late(color->glc, pic_hdr->id, pic_hdr->time)) {
+			/* player would drop it anyway */
+			state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
+			return 0;
+		}
+		if ((ret = color_get_video_stream(color, pic_hdr->id, &video)))
+			return ret;
 		state->threadptr = video;
 
 		pthread_rwlock_rdlock(&video->update);
@@ -221,47 +319,133 @@ int color_read_callback(glc_thread_state_t *state)
 
 int color_write_callback(glc_thread_state_t *state)
 {
-	struct color_video_stream_s *video = state->threadptr;
+	struct color_slice_s slice;
 
 	memcpy(state->write_data, state->read_data, sizeof(glc_video_frame_header_t));
-	video->proc(state->ptr, video,
-		  (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
-		  (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)]);
 
-	pthread_rwlock_unlock(&video->update);
+	slice.color = (color_t) state->ptr;
+	slice.video = state->threadptr;
+	color_get_rows(slice.video, &slice.from);
+	color_get_rows(slice.video, &slice.to);
+	slice.from.data = (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)];
+	slice.to.data = (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)];
+	glc_slice_run(slice.color->glc, slice.video->h, 2, &color_slice_callback, &slice);
+
+	pthread_rwlock_unlock(&slice.video->update);
 	return 0;
 }
 
-void color_get_video_stream(color_t color, glc_stream_id_t id,
-		   struct color_video_stream_s **video)
+void color_slice_callback(void *ptr, unsigned int y, unsigned int rows)
 {
-	/* this function is called from read callback so it is never
-	   called in parallel */
-	*video = color->video;
+	struct color_slice_s *slice = ptr;
+	slice->video->proc(slice->color, slice->video, &slice->from, &slice->to, y, rows);
+}
 
-	while (*video != NULL) {
-		if ((*video)->id == id)
-			break;
-		*video = (*video)->next;
-	}
+int color_message_callback(void *ptr, glc_thread_state_t *state)
+{
+	color_t color = (color_t) ptr;
+
+	if (state->header.type == GLC_MESSAGE_COLOR) {
+		color_color_msg(color, (glc_color_message_t *) state->read_data);
 
-	if (*video == NULL) {
-		*video = malloc(sizeof(struct color_video_stream_s));
-		memset(*video, 0, sizeof(struct color_video_stream_s));
+		/* color correction is done here */
+		state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
+	} else if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
+		color_video_format_msg(color, (glc_video_format_message_t *) state->read_data);
+
+	return 0;
+}
+
+int color_frame_callback(void *ptr, glc_stream_id_t id,
+			 chain_rows_t *from, chain_rows_t *to,
+			 int *whole, void **ctx)
+{
+	struct color_video_stream_s *video;
+	int ret;
 
-		(*video)->next = color->video;
-		color->video = *video;
-		(*video)->id = id;
-		pthread_rwlock_init(&(*video)->update, NULL);
+	if ((ret = color_get_video_stream((color_t) ptr, id, &video)))
+		return ret;
+	pthread_rwlock_rdlock(&video->update);
+
+	if (video->proc == NULL) {
+		pthread_rwlock_unlock(&video->update);
+		*ctx = NULL;
+		return 0;
 	}
+
+	color_get_rows(video, from);
+	color_get_rows(video, to);
+	*ctx = video;
+	return 0;
+}
+
+void color_need_callback(void *ptr, void *ctx, unsigned int y, unsigned int rows,
+			 unsigned int *from_y, unsigned int *from_rows)
+{
+	*from_y = y;
+	*from_rows = rows;
+}
+
+void color_rows_callback(void *ptr, void *ctx, chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows)
+{
+	struct color_video_stream_s *video = ctx;
+	video->proc((color_t) ptr, video, from, to, y, rows);
+}
+
+void color_done_callback(void *ptr, void *ctx)
+{
+	struct color_video_stream_s *video = ctx;
+	pthread_rwlock_unlock(&video->update);
+}
+
+void color_get_rows(struct color_video_stream_s *video, chain_rows_t *rows)
+{
+	memset(rows, 0, sizeof(chain_rows_t));
+	rows->format = video->format;
+	rows->w = video->w;
+	rows->h = video->h;
+	rows->rows = video->h;
+
+	if (video->format == GLC_VIDEO_YCBCR_420JPEG)
+		rows->row = video->w;
+	else
+		rows->row = video->row;
+}
+
+int color_get_video_stream(color_t color, glc_stream_id_t id,
+			   struct color_video_stream_s **video)
+{
+	return glc_registry_get(color->video, id, (void **) video);
+}
+
+int color_video_stream_init(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct color_video_stream_s *video = entry;
+
+	video->id = id;
+	pthread_rwlock_init(&video->update, NULL);
+	return 0;
+}
+
+int color_video_stream_destroy(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct color_video_stream_s *video = entry;
+
+	pthread_rwlock_destroy(&video->update);
+	if (video->lookup_table)
+		free(video->lookup_table);
+	return 0;
 }
 
 int color_video_format_msg(color_t color, glc_video_format_message_t *msg)
 {
 	struct color_video_stream_s *video;
 	glc_video_format_t old_format;
+	int ret;
 
-	color_get_video_stream(color, msg->id, &video);
+	if ((ret = color_get_video_stream(color, msg->id, &video)))
+		return ret;
 	pthread_rwlock_wrlock(&video->update);
 
 	old_format = video->format;
@@ -305,11 +489,10 @@ int color_video_format_msg(color_t color, glc_video_format_message_t *msg)
 			glc_log(color->glc, GLC_INFORMATION, "color", "skipping color correction");
 			video->proc = NULL;
 		} else if (video->format == GLC_VIDEO_YCBCR_420JPEG) {
-			color_generate_ycbcr_lookup_table(color, video);
-			video->proc = &color_ycbcr;
+			color_ycbcr_init(color, video);
 		} else if ((video->format == GLC_VIDEO_BGR) | (video->format == GLC_VIDEO_BGRA)) {
 			color_generate_rgb_lookup_table(color, video);
-			video->proc = &color_bgr;
+			video->proc = color_bgr_proc(video);
 		} else {
 			/* set proc NULL -> no conversion done */
 			glc_log(color->glc, GLC_WARNING, "color", "unsupported video %d", msg->id);
@@ -320,15 +503,17 @@ int color_video_format_msg(color_t color, glc_video_format_message_t *msg)
 		   (msg->format == GLC_VIDEO_YCBCR_420JPEG)) {
 		glc_log(color->glc, GLC_WARNING, "color",
 			 "colorspace switched from RGB to Y'CbCr, recalculating lookup table");
-		color_generate_ycbcr_lookup_table(color, video);
-		video->proc = &color_ycbcr;
+		color_ycbcr_init(color, video);
 	} else if (((msg->format == GLC_VIDEO_BGR) |
 		    (msg->format == GLC_VIDEO_BGRA)) &&
 		   (old_format == GLC_VIDEO_YCBCR_420JPEG)) {
 		glc_log(color->glc, GLC_WARNING, "color",
 			 "colorspace switched from Y'CbCr to RGB, recalculating lookup table");
 		color_generate_rgb_lookup_table(color, video);
-		video->proc = &color_bgr;
+		video->proc = color_bgr_proc(video);
+	} else if ((video->proc == &color_bgr_bgr) | (video->proc == &color_bgr_bgra)) {
+		/* pixel size may have changed */
+		video->proc = color_bgr_proc(video);
 	}
 
 	pthread_rwlock_unlock(&video->update);
@@ -338,11 +523,13 @@ int color_video_format_msg(color_t color, glc_video_format_message_t *msg)
 int color_color_msg(color_t color, glc_color_message_t *msg)
 {
 	struct color_video_stream_s *video;
+	int ret;
 
 	if (color->flags & COLOR_OVERRIDE)
 		return 0; /* ignore */
 
-	color_get_video_stream(color, msg->id, &video);
+	if ((ret = color_get_video_stream(color, msg->id, &video)))
+		return ret;
 	pthread_rwlock_wrlock(&video->update);
 
 	video->brightness = msg->brightness;
@@ -364,12 +551,11 @@ int color_color_msg(color_t color, glc_color_message_t *msg)
 		glc_log(color->glc, GLC_INFORMATION, "color", "skipping color correction");
 		video->proc = NULL;
 	} else if (video->format == GLC_VIDEO_YCBCR_420JPEG) {
-		color_generate_ycbcr_lookup_table(color, video);
-		video->proc = &color_ycbcr;
+		color_ycbcr_init(color, video);
 	} else if ((video->format == GLC_VIDEO_BGR) |
 		   (video->format == GLC_VIDEO_BGRA)) {
 		color_generate_rgb_lookup_table(color, video);
-		video->proc = &color_bgr;
+		video->proc = color_bgr_proc(video);
 	} else
 		video->proc = NULL; /* don't attempt anything... */
 
@@ -377,33 +563,59 @@ int color_color_msg(color_t color, glc_color_message_t *msg)
 	return 0;
 }
 
-void color_ycbcr(color_t color,
-		 struct color_video_stream_s *video,
-		 unsigned char *from, unsigned char *to)
+void color_ycbcr_init(color_t color, struct color_video_stream_s *video)
 {
-	unsigned int x, y, Cpix, Y;
-	unsigned int pos;
-	unsigned char *Y_from, *Cb_from, *Cr_from;
-	unsigned char *Y_to, *Cb_to, *Cr_to;
+	glc_flags_t cpu = glc_cpu_features(color->glc);
+
+	/* without a vector unit the original lookup table is used */
+	if (!cpu) {
+		color_generate_ycbcr_lookup_table(color, video);
+		video->proc = &color_ycbcr;
+		return;
+	}
 
-	Y_from = from;
-	Cb_from = &from[video->h * video->w];
-	Cr_from = &from[video->h * video->w + (video->h / 2) * (video->w / 2)];
+	if (video->lookup_table) {
+		free(video->lookup_table);
+		video->lookup_table = NULL;
+	}
 
-	Y_to = to;
-	Cb_to = &to[video->h * video->w];
-	Cr_to = &to[video->h * video->w + (video->h / 2) * (video->w / 2)];
+	color_generate_ycbcr_curves(color, video);
+	video->proc = &color_ycbcr_curves;
+#ifdef COLOR_X86
+	if (cpu & GLC_CPU_AVX2)
+		video->proc = &color_ycbcr_avx2;
+#endif
+}
 
-	Cpix = 0;
+void color_ycbcr(color_t color,
+		 struct color_video_stream_s *video,
+		 chain_rows_t *from, chain_rows_t *to,
+		 unsigned int y, unsigned int rows)
+{
+	unsigned int x, yy, Cpix, Y;
+	unsigned int pos;
+	unsigned char *Y_from[2], *Cb_from, *Cr_from;
+	unsigned char *Y_to[2], *Cb_to, *Cr_to;
 
 #define CONVERT_Y(xadd, yadd) 								\
-	pos = YCBCR_LOOKUP_POS(Y_from[(x + (xadd)) + (y + (yadd)) * video->w],		\
+	pos = YCBCR_LOOKUP_POS(Y_from[yadd][x + (xadd)],				\
 			       Cb_from[Cpix], Cr_from[Cpix]);				\
-	Y_to[(x + (xadd)) + (y + (yadd)) * video->w] = video->lookup_table[pos + 0];	\
+	Y_to[yadd][x + (xadd)] = video->lookup_table[pos + 0];				\
 	Y += video->lookup_table[pos + 0];
 
-	for (y = 0; y < video->h; y += 2) {
-		for (x = 0; x < video->w; x += 2) {
+	/* rows always start at even row and come in pairs */
+	for (yy = y; yy < y + rows; yy += 2) {
+		Y_from[0] = CHAIN_ROW(from, yy);
+		Y_from[1] = CHAIN_ROW(from, yy + 1);
+		Cb_from = CHAIN_CB_ROW(from, yy / 2);
+		Cr_from = CHAIN_CR_ROW(from, yy / 2);
+
+		Y_to[0] = CHAIN_ROW(to, yy);
+		Y_to[1] = CHAIN_ROW(to, yy + 1);
+		Cb_to = CHAIN_CB_ROW(to, yy / 2);
+		Cr_to = CHAIN_CR_ROW(to, yy / 2);
+
+		for (x = 0, Cpix = 0; x < video->w; x += 2, Cpix++) {
 			Y = 0;
 
 			CONVERT_Y(0, 0)
@@ -414,27 +626,47 @@ void color_ycbcr(color_t color,
 			pos = YCBCR_LOOKUP_POS(Y >> 2, Cb_from[Cpix], Cr_from[Cpix]);
 			Cb_to[Cpix] = video->lookup_table[pos + 1];
 			Cr_to[Cpix] = video->lookup_table[pos + 2];
-
-			Cpix++;
 		}
 	}
+
+#undef CONVERT_Y
 }
 
-void color_bgr(color_t color,
-	       struct color_video_stream_s *video,
-	       unsigned char *from, unsigned char *to)
-{
-	unsigned int x, y, p;
+/*
+ * Instantiated at build time for BGR and BGRA, so pixel size is a
+ * constant and compiler can unroll and vectorize inner loop.
+ */
+#define COLOR_BGR(fmt, bpp) \
+void color_bgr_##fmt(color_t color, struct color_video_stream_s *video, \
+		     chain_rows_t *from, chain_rows_t *to, \
+		     unsigned int y, unsigned int rows) \
+{ \
+	const unsigned char *lookup = video->lookup_table; \
+	unsigned int x, p, w = video->w; \
+	unsigned char *src, *dst; \
+ \
+	for (; rows > 0; rows--, y++) { \
+		src = CHAIN_ROW(from, y); \
+		dst = CHAIN_ROW(to, y); \
+ \
+		for (x = 0; x < w; x++) { \
+			p = x * (bpp); \
+ \
+			dst[p + 0] = lookup[256 + 256 + src[p + 0]]; \
+			dst[p + 1] = lookup[256       + src[p + 1]]; \
+			dst[p + 2] = lookup[            src[p + 2]]; \
+		} \
+	} \
+}
 
-	for (y = 0; y < video->h; y++) {
-		for (x = 0; x < video->w; x++) {
-			p = video->row * y + x * video->bpp;
+COLOR_BGR(bgr, 3)
+COLOR_BGR(bgra, 4)
 
-			to[p + 0] = video->lookup_table[256 + 256 + from[p + 0]];
-			to[p + 1] = video->lookup_table[256       + from[p + 1]];
-			to[p + 2] = video->lookup_table[            from[p + 2]];
-		}
-	}
+#undef COLOR_BGR
+
+color_proc color_bgr_proc(struct color_video_stream_s *video)
+{
+	return (video->bpp == 4) ? &color_bgr_bgra : &color_bgr_bgr;
 }
 
 #define CLAMP_256(val) \
@@ -474,6 +706,8 @@ int color_generate_ycbcr_lookup_table(color_t color,
 
 	glc_log(color->glc, GLC_INFORMATION, "color",
 		 "using %d bit lookup table (%zd bytes)", LOOKUP_BITS, lookup_size);
+	if (video->lookup_table)
+		free(video->lookup_table);
 	video->lookup_table = malloc(lookup_size);
 
 #define CALC(value, brightness, contrast, gamma) \
@@ -504,11 +738,39 @@ int color_generate_ycbcr_lookup_table(color_t color,
 	return 0;
 }
 
+int color_generate_ycbcr_curves(color_t color,
+				struct color_video_stream_s *video)
+{
+	unsigned int c;
+
+	glc_log(color->glc, GLC_INFORMATION, "color",
+		 "using separable correction (%zd bytes)", sizeof(video->curve));
+
+#define CALC(value, brightness, contrast, gamma) \
+	((pow((double) value / 255.0, 1.0 / gamma) - 0.5) * (1.0 + contrast) \
+	 + brightness + 0.5) * 255.0
+
+	for (c = 0; c < 256; c++) {
+		video->curve[0][c] = color_clamp(CALC(c, video->brightness, video->contrast,
+						      video->red_gamma));
+		video->curve[1][c] = color_clamp(CALC(c, video->brightness, video->contrast,
+						      video->green_gamma));
+		video->curve[2][c] = color_clamp(CALC(c, video->brightness, video->contrast,
+						      video->blue_gamma));
+	}
+
+#undef CALC
+
+	return 0;
+}
+
 int color_generate_rgb_lookup_table(color_t color,
 				    struct color_video_stream_s *video)
 {
 	unsigned int c;
 
+	if (video->lookup_table)
+		free(video->lookup_table);
 	video->lookup_table = malloc(256 + 256 + 256);
 
 #define CALC(value, brightness, contrast, gamma) \
@@ -531,4 +793,224 @@ int color_generate_rgb_lookup_table(color_t color,
 	return 0;
 }
 
+/*
+ * Separable Y'CbCr correction: Y'CbCr is converted to R'G'B' with
+ * a fixed-point 3x3 matrix, every channel goes through its own 256-entry
+ * curve and the result is converted back with another 3x3 matrix.
+ * Chroma is corrected from the average of the four corrected Y'
+ * samples, like the lookup table version does.
+ */
+
+void color_ycbcr_curves(color_t color,
+			struct color_video_stream_s *video,
+			chain_rows_t *from, chain_rows_t *to,
+			unsigned int y, unsigned int rows)
+{
+	unsigned char *Y_from[2], *Y_to[2];
+	unsigned int yy;
+
+	/* rows always start at even row and come in pairs */
+	for (yy = y; yy < y + rows; yy += 2) {
+		Y_from[0] = CHAIN_ROW(from, yy);
+		Y_from[1] = CHAIN_ROW(from, yy + 1);
+		Y_to[0] = CHAIN_ROW(to, yy);
+		Y_to[1] = CHAIN_ROW(to, yy + 1);
+
+		color_ycbcr_row(video, Y_from, CHAIN_CB_ROW(from, yy / 2), CHAIN_CR_ROW(from, yy / 2),
+				Y_to, CHAIN_CB_ROW(to, yy / 2), CHAIN_CR_ROW(to, yy / 2), 0);
+	}
+}
+
+void color_ycbcr_row(struct color_video_stream_s *video,
+		     unsigned char **Y_from, unsigned char *Cb_from, unsigned char *Cr_from,
+		     unsigned char **Y_to, unsigned char *Cb_to, unsigned char *Cr_to,
+		     unsigned int x)
+{
+	int cb, cr, dR, dG, dB, R, G, B, Y, Ysum;
+	unsigned int Cpix;
+
+#define CURVES(Yval) \
+	R = video->curve[0][color_clamp((Yval) + dR)]; \
+	G = video->curve[1][color_clamp((Yval) + dG)]; \
+	B = video->curve[2][color_clamp((Yval) + dB)];
+
+#define CONVERT_Y(xadd, yadd) \
+	CURVES(Y_from[yadd][x + (xadd)]) \
+	Y = (COLOR_R_Y * R + COLOR_G_Y * G + COLOR_B_Y * B + COLOR_YCBCR_ROUND) \
+	    >> COLOR_YCBCR_BITS; \
+	Y_to[yadd][x + (xadd)] = Y; \
+	Ysum += Y;
+
+	for (Cpix = x / 2; x < video->w; x += 2, Cpix++) {
+		cb = Cb_from[Cpix] - 128;
+		cr = Cr_from[Cpix] - 128;
+		dR = (COLOR_Cr_R * cr + COLOR_RGB_ROUND) >> COLOR_RGB_BITS;
+		dG = (COLOR_Cb_G * cb + COLOR_Cr_G * cr + COLOR_RGB_ROUND) >> COLOR_RGB_BITS;
+		dB = (COLOR_Cb_B * cb + COLOR_RGB_ROUND) >> COLOR_RGB_BITS;
+
+		Ysum = 0;
+		CONVERT_Y(0, 0)
+		CONVERT_Y(0, 1)
+		CONVERT_Y(1, 0)
+		CONVERT_Y(1, 1)
+
+		CURVES(Ysum >> 2)
+		Cb_to[Cpix] = color_clamp(128 + ((COLOR_R_Cb * R + COLOR_G_Cb * G + COLOR_B_Cb * B +
+						  COLOR_YCBCR_ROUND) >> COLOR_YCBCR_BITS));
+		Cr_to[Cpix] = color_clamp(128 + ((COLOR_R_Cr * R + COLOR_G_Cr * G + COLOR_B_Cr * B +
+						  COLOR_YCBCR_ROUND) >> COLOR_YCBCR_BITS));
+	}
+
+#undef CONVERT_Y
+#undef CURVES
+}
+
+#ifdef COLOR_X86
+
+/*
+ * AVX2 kernel gathers curve values 8 at a time and does exactly the
+ * same 32-bit math as color_ycbcr_row(), which finishes the rows.
+ */
+
+__attribute__ ((target ("avx2")))
+static inline void color_curves_avx2(struct color_video_stream_s *video, __m256i Y,
+				     __m256i dR, __m256i dG, __m256i dB,
+				     __m256i *R, __m256i *G, __m256i *B)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max = _mm256_set1_epi32(255);
+
+#define CURVE(c, d) \
+	_mm256_i32gather_epi32(video->curve[c], \
+			       _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(Y, d), \
+								 zero), max), 4)
+
+	*R = CURVE(0, dR);
+	*G = CURVE(1, dG);
+	*B = CURVE(2, dB);
+
+#undef CURVE
+}
+
+__attribute__ ((target ("avx2")))
+static inline __m256i color_dot_avx2(__m256i R, __m256i G, __m256i B,
+				     int r, int g, int b)
+{
+	return _mm256_srai_epi32(_mm256_add_epi32(
+		_mm256_add_epi32(_mm256_mullo_epi32(R, _mm256_set1_epi32(r)),
+				 _mm256_mullo_epi32(G, _mm256_set1_epi32(g))),
+		_mm256_add_epi32(_mm256_mullo_epi32(B, _mm256_set1_epi32(b)),
+				 _mm256_set1_epi32(COLOR_YCBCR_ROUND))), COLOR_YCBCR_BITS);
+}
+
+/* 8 even and 8 odd Y' samples of one row */
+__attribute__ ((target ("avx2")))
+static inline __m256i color_luma_avx2(struct color_video_stream_s *video,
+				      unsigned char *from, unsigned char *to,
+				      __m256i dR, __m256i dG, __m256i dB)
+{
+	const __m128i split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+					    1, 3, 5, 7, 9, 11, 13, 15);
+	const __m256i pack = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
+					      -1, -1, -1, -1, -1, -1, -1, -1,
+					      0, 1, 4, 5, 8, 9, 12, 13,
+					      -1, -1, -1, -1, -1, -1, -1, -1);
+	__m128i in;
+	__m256i even, odd, R, G, B;
+
+	in = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) from), split);
+
+	color_curves_avx2(video, _mm256_cvtepu8_epi32(in), dR, dG, dB, &R, &G, &B);
+	even = color_dot_avx2(R, G, B, COLOR_R_Y, COLOR_G_Y, COLOR_B_Y);
+	color_curves_avx2(video, _mm256_cvtepu8_epi32(_mm_srli_si128(in, 8)),
+			  dR, dG, dB, &R, &G, &B);
+	odd = color_dot_avx2(R, G, B, COLOR_R_Y, COLOR_G_Y, COLOR_B_Y);
+
+	/* interleave back, both fit in a byte */
+	in = _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+		_mm256_shuffle_epi8(_mm256_or_si256(even, _mm256_slli_epi32(odd, 8)), pack),
+		0x08));
+	_mm_storeu_si128((__m128i *) to, in);
+
+	return _mm256_add_epi32(even, odd);
+}
+
+/* low bytes of 8 32-bit values */
+__attribute__ ((target ("avx2")))
+static inline void color_store_avx2(unsigned char *to, __m256i v)
+{
+	const __m256i pack = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+					      -1, -1, -1, -1, -1, -1, -1, -1,
+					      0, 4, 8, 12, -1, -1, -1, -1,
+					      -1, -1, -1, -1, -1, -1, -1, -1);
+
+	v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pack),
+					_mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1));
+	_mm_storel_epi64((__m128i *) to, _mm256_castsi256_si128(v));
+}
+
+__attribute__ ((target ("avx2")))
+void color_ycbcr_avx2(color_t color,
+		      struct color_video_stream_s *video,
+		      chain_rows_t *from, chain_rows_t *to,
+		      unsigned int y, unsigned int rows)
+{
+	const __m256i half = _mm256_set1_epi32(128);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max = _mm256_set1_epi32(255);
+	const __m256i round = _mm256_set1_epi32(COLOR_RGB_ROUND);
+	unsigned char *Y_from[2], *Cb_from, *Cr_from;
+	unsigned char *Y_to[2], *Cb_to, *Cr_to;
+	__m256i cb, cr, dR, dG, dB, Ysum, R, G, B;
+	unsigned int yy, x;
+
+	for (yy = y; yy < y + rows; yy += 2) {
+		Y_from[0] = CHAIN_ROW(from, yy);
+		Y_from[1] = CHAIN_ROW(from, yy + 1);
+		Cb_from = CHAIN_CB_ROW(from, yy / 2);
+		Cr_from = CHAIN_CR_ROW(from, yy / 2);
+
+		Y_to[0] = CHAIN_ROW(to, yy);
+		Y_to[1] = CHAIN_ROW(to, yy + 1);
+		Cb_to = CHAIN_CB_ROW(to, yy / 2);
+		Cr_to = CHAIN_CR_ROW(to, yy / 2);
+
+		for (x = 0; x + 16 <= video->w; x += 16) {
+			cb = _mm256_sub_epi32(_mm256_cvtepu8_epi32(
+				_mm_loadl_epi64((__m128i *) &Cb_from[x / 2])), half);
+			cr = _mm256_sub_epi32(_mm256_cvtepu8_epi32(
+				_mm_loadl_epi64((__m128i *) &Cr_from[x / 2])), half);
+
+			dR = _mm256_srai_epi32(_mm256_add_epi32(
+				_mm256_mullo_epi32(cr, _mm256_set1_epi32(COLOR_Cr_R)), round),
+				COLOR_RGB_BITS);
+			dG = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(
+				_mm256_mullo_epi32(cb, _mm256_set1_epi32(COLOR_Cb_G)),
+				_mm256_mullo_epi32(cr, _mm256_set1_epi32(COLOR_Cr_G))), round),
+				COLOR_RGB_BITS);
+			dB = _mm256_srai_epi32(_mm256_add_epi32(
+				_mm256_mullo_epi32(cb, _mm256_set1_epi32(COLOR_Cb_B)), round),
+				COLOR_RGB_BITS);
+
+			Ysum = _mm256_add_epi32(
+				color_luma_avx2(video, &Y_from[0][x], &Y_to[0][x], dR, dG, dB),
+				color_luma_avx2(video, &Y_from[1][x], &Y_to[1][x], dR, dG, dB));
+
+			color_curves_avx2(video, _mm256_srai_epi32(Ysum, 2), dR, dG, dB, &R, &G, &B);
+			color_store_avx2(&Cb_to[x / 2], _mm256_min_epi32(_mm256_max_epi32(
+				_mm256_add_epi32(half, color_dot_avx2(R, G, B, COLOR_R_Cb,
+								      COLOR_G_Cb, COLOR_B_Cb)),
+				zero), max));
+			color_store_avx2(&Cr_to[x / 2], _mm256_min_epi32(_mm256_max_epi32(
+				_mm256_add_epi32(half, color_dot_avx2(R, G, B, COLOR_R_Cr,
+								      COLOR_G_Cr, COLOR_B_Cr)),
+				zero), max));
+		}
+
+		color_ycbcr_row(video, Y_from, Cb_from, Cr_from, Y_to, Cb_to, Cr_to, x);
+	}
+}
+
+#endif /* COLOR_X86 */
+
 /**  \} */
@@ -18,6 +18,7 @@
 
 #include <packetstream.h>
 #include <glc/common/glc.h>
+#include <glc/core/chain.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -82,6 +83,16 @@ __PUBLIC int color_process_start(color_t color, ps_buffer_t *from, ps_buffer_t *
  */
 __PUBLIC int color_process_wait(color_t color);
 
+/**
+ * \brief get color filter for chain
+ *
+ * color must not be started on its own if it is used in a chain.
+ * \param color color object
+ * \param filter filter vtable is written here
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int color_filter(color_t color, chain_filter_t *filter);
+
 #ifdef __cplusplus
 }
 #endif
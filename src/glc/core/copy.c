@@ -24,13 +24,20 @@
 #include <glc/common/log.h>
 #include <glc/common/state.h>
 #include <glc/common/util.h>
+#include <glc/common/shared.h>
 
 #include "copy.h"
 
+/* messages wanted by several targets are shared from this size up */
+#define COPY_SHARED_MIN              4096
+/* shared data held by targets at most */
+#define COPY_SHARED_LIMIT            (1024 * 1024 * 32)
+
 struct copy_target_s {
 	ps_buffer_t *buffer;
 	ps_packet_t packet;
 	glc_message_type_t type;
+	glc_stream_id_t id;
 
 	struct copy_target_s *next;
 };
@@ -42,18 +49,30 @@ struct copy_s {
 	pthread_t copy_thread;
 	int running;
 
+	glc_shared_pool_t shared;
 	struct copy_target_s *copy_target;
 };
 
 void *copy_thread(void *argptr);
+int copy_wanted(struct copy_target_s *target, glc_message_header_t *hdr,
+		void *data, size_t size);
+int copy_write(struct copy_target_s *target, glc_message_header_t *hdr,
+	       void *data, size_t size);
 
 int copy_init(copy_t *copy, glc_t *glc)
 {
+	int ret;
+
 	*copy = (copy_t) malloc(sizeof(struct copy_s));
 	memset(*copy, 0, sizeof(struct copy_s));
 
 	(*copy)->glc = glc;
 
+	if ((ret = glc_shared_pool_init(&(*copy)->shared, glc, COPY_SHARED_LIMIT))) {
+		free(*copy);
+		return ret;
+	}
+
 	return 0;
 }
 
@@ -69,17 +88,26 @@ int copy_destroy(copy_t copy)
 		free(del);
 	}
 
+	/* readers may still hold shared messages */
+	glc_shared_pool_destroy(copy->shared);
 	free(copy);
 	return 0;
 }
 
 int copy_add(copy_t copy, ps_buffer_t *target, glc_message_type_t type)
+{
+	return copy_add_stream(copy, target, type, 0);
+}
+
+int copy_add_stream(copy_t copy, ps_buffer_t *target,
+		    glc_message_type_t type, glc_stream_id_t id)
 {
 	struct copy_target_s *newtarget = malloc(sizeof(struct copy_target_s));
 	memset(newtarget, 0, sizeof(struct copy_target_s));
 
 	newtarget->buffer = target;
 	newtarget->type = type;
+	newtarget->id = id;
 
 	/** \todo one packet per buffer */
 	ps_packet_init(&newtarget->packet, newtarget->buffer);
@@ -128,9 +156,11 @@ void *copy_thread(void *argptr)
 	copy_t copy = (copy_t) argptr;
 	struct copy_target_s *target;
 	glc_message_header_t msg_hdr;
+	glc_shared_ref_t ref, in;
+	unsigned int wanted;
 	size_t data_size;
 	void *data;
-	int ret = 0;
+	int ret = 0, has_in = 0;
 
 	ps_packet_t read;
 
@@ -146,31 +176,68 @@ void *copy_thread(void *argptr)
 		if ((ret = ps_packet_getsize(&read, &data_size)))
 			goto err;
 		data_size -= sizeof(glc_message_header_t);
-		if ((ret = ps_packet_dma(&read, &data, data_size, PS_ACCEPT_FAKE_DMA)))
+
+		if (msg_hdr.type == GLC_MESSAGE_SHARED_REF) {
+			/* resolve references from mirrored ring */
+			if ((ret = ps_packet_read(&read, &in, sizeof(glc_shared_ref_t))))
+				goto err;
+			has_in = 1;
+			msg_hdr.type = in.type;
+			data = in.data;
+			data_size = in.size;
+		} else if ((ret = ps_packet_dma(&read, &data, data_size, PS_ACCEPT_FAKE_DMA)))
 			goto err;
 
-		target = copy->copy_target;
-		while (target != NULL) {
-			if ((target->type == 0) |
-			    (target->type == msg_hdr.type)) {
-				if ((ret = ps_packet_open(&target->packet, PS_PACKET_WRITE)))
-					goto err;
-				if ((ret = ps_packet_write(&target->packet, &msg_hdr,
-							   sizeof(glc_message_header_t))))
-					goto err;
-				if ((ret = ps_packet_write(&target->packet, data, data_size)))
-					goto err;
-				if ((ret = ps_packet_close(&target->packet)))
+		wanted = 0;
+		if (data_size >= COPY_SHARED_MIN) {
+			target = copy->copy_target;
+			while (target != NULL) {
+				if (copy_wanted(target, &msg_hdr, data, data_size))
+					wanted++;
+				target = target->next;
+			}
+		}
+
+		if (wanted > 1) {
+			/* one copy, every target gets a reference to it */
+			if ((ret = glc_shared_copy(copy->shared, msg_hdr.type, data, data_size,
+						   wanted, &ref)))
+				goto err;
+
+			target = copy->copy_target;
+			while (target != NULL) {
+				if (copy_wanted(target, &msg_hdr, data, data_size)) {
+					wanted--;
+					if ((ret = glc_shared_write(&target->packet, &ref))) {
+						while (wanted--)
+							ref.release(ref.arg);
+						goto err;
+					}
+				}
+				target = target->next;
+			}
+		} else {
+			target = copy->copy_target;
+			while (target != NULL) {
+				if ((copy_wanted(target, &msg_hdr, data, data_size)) &&
+				    ((ret = copy_write(target, &msg_hdr, data, data_size))))
 					goto err;
+				target = target->next;
 			}
-			target = target->next;
 		}
 
 		ps_packet_close(&read);
+
+		if (has_in) {
+			has_in = 0;
+			in.release(in.arg);
+		}
 	} while ((!glc_state_test(copy->glc, GLC_STATE_CANCEL)) &&
 		 (msg_hdr.type != GLC_MESSAGE_CLOSE));
 
 finish:
+	if (has_in)
+		in.release(in.arg);
 	ps_packet_destroy(&read);
 
 	if (glc_state_test(copy->glc, GLC_STATE_CANCEL)) {
@@ -192,4 +259,42 @@ err:
 	goto finish;
 }
 
+int copy_write(struct copy_target_s *target, glc_message_header_t *hdr,
+	       void *data, size_t size)
+{
+	int ret;
+
+	if ((ret = ps_packet_open(&target->packet, PS_PACKET_WRITE)))
+		return ret;
+	if ((ret = ps_packet_write(&target->packet, hdr, sizeof(glc_message_header_t))))
+		return ret;
+	if ((ret = ps_packet_write(&target->packet, data, size)))
+		return ret;
+	return ps_packet_close(&target->packet);
+}
+
+int copy_wanted(struct copy_target_s *target, glc_message_header_t *hdr,
+		void *data, size_t size)
+{
+	if ((target->type != 0) && (target->type != hdr->type))
+		return 0;
+	if (target->id == 0)
+		return 1;
+
+	/* these start with stream id */
+	if ((hdr->type != GLC_MESSAGE_VIDEO_FORMAT) &&
+	    (hdr->type != GLC_MESSAGE_VIDEO_FRAME) &&
+	    (hdr->type != GLC_MESSAGE_VIDEO_REPEAT) &&
+	    (hdr->type != GLC_MESSAGE_VIDEO_DELTA) &&
+	    (hdr->type != GLC_MESSAGE_VIDEO_TILES) &&
+	    (hdr->type != GLC_MESSAGE_COLOR) &&
+	    (hdr->type != GLC_MESSAGE_AUDIO_FORMAT) &&
+	    (hdr->type != GLC_MESSAGE_AUDIO_DATA))
+		return 1;
+
+	if (size < sizeof(glc_stream_id_t))
+		return 1;
+	return (*((glc_stream_id_t *) data) == target->id);
+}
+
 /**  \} */
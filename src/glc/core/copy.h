@@ -61,8 +61,28 @@ __PUBLIC int copy_destroy(copy_t copy);
  */
 __PUBLIC int copy_add(copy_t copy, ps_buffer_t *target, glc_message_type_t type);
 
+/**
+ * \brief add copy target for one stream
+ *
+ * Like copy_add() but messages that belong to a stream (format,
+ * picture, repeat, color and audio messages) are copied only
+ * if they are for stream id. Audio and video streams have
+ * separate ids, so give the message types explicitly.
+ * \param copy copy object
+ * \param target target buffer
+ * \param type message type or 0 for all types
+ * \param id stream id, 0 copies all streams
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int copy_add_stream(copy_t copy, ps_buffer_t *target,
+			     glc_message_type_t type, glc_stream_id_t id);
+
 /**
  * \brief start copy process
+ *
+ * Large messages wanted by several targets are copied once
+ * and targets receive GLC_MESSAGE_SHARED_REF to the same data,
+ * so target buffers must be read with glc_thread.
  * \param copy copy object
  * \param from source buffer
  * \return 0 on success otherwise an error code
@@ -23,7 +23,20 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <netdb.h>
+#include <poll.h>
 #include <fcntl.h>
+#include <stdint.h>
+
+#ifdef __IO_URING
+# include <liburing.h>
+#endif
 
 #include <glc/common/glc.h>
 #include <glc/common/state.h>
@@ -31,6 +44,7 @@
 #include <glc/common/log.h>
 #include <glc/common/thread.h>
 #include <glc/common/util.h>
+#include <glc/common/ring.h>
 
 #include <glc/core/tracker.h>
 
@@ -42,6 +56,43 @@
 #define FILE_INFO_WRITTEN  0x8
 #define FILE_INFO_READ    0x10
 #define FILE_INFO_VALID   0x20
+#define FILE_EOF_WRITTEN  0x40
+#define FILE_NET          0x80
+#define FILE_NET_DOWN    0x100
+
+/* O_DIRECT needs buffers, sizes and offsets aligned to this */
+#define FILE_ALIGN       4096
+#define FILE_IOV_MAX        4
+/* maximum number of staging buffers in flight */
+#define FILE_URING_MAX     16
+/* connection attempts time out and are retried this often */
+#define FILE_NET_RETRY    1000000
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+# define FILE_ZEROCOPY
+#endif
+
+/* mapping is prefetched and released in windows of this size */
+#define FILE_MAP_WINDOW    (4 * 1024 * 1024)
+/* smaller payloads are copied, larger are passed as references */
+#define FILE_MAP_REF_MIN   (64 * 1024)
+
+/* mapping outlives file_read() while packets still point to it */
+struct file_map_s {
+	unsigned char *data;
+	size_t size;
+
+	pthread_mutex_t mutex;
+	/* file_read() holds one reference, every packet another */
+	unsigned int refs;
+	/* packets per window, windows in use are not dropped */
+	unsigned int *windows;
+};
+
+struct file_map_ref_s {
+	struct file_map_s *map;
+	size_t first, last;
+};
 
 struct file_s {
 	glc_t *glc;
@@ -52,11 +103,129 @@ struct file_s {
 	u_int32_t stream_version;
 	callback_request_func_t callback;
 	tracker_t state_tracker;
+
+	/* staging buffer for writes */
+	size_t buffer_size;
+	unsigned char *buffer;
+	size_t buffered;
+	glc_utime_t flush_interval, buffered_time;
+	int direct;
+
+	/* logical write position, including staged data */
+	glc_size_t position;
+
+	/* seek index */
+	glc_utime_t index_interval, index_next;
+	glc_index_entry_t *entry;
+	unsigned int entries, entries_size;
+	char *state;
+	size_t state_size, state_alloc;
+	glc_size_t last_state_offset, last_state_size;
+
+	/* output is split into segments, next one is opened in background */
+	glc_size_t segment_size;
+	glc_utime_t segment_time, segment_begin;
+	char *segment_name, *segment_next_name;
+	unsigned int segment;
+	pthread_t segment_thread;
+	int segment_pending, segment_fd, segment_ret;
+
+	/* copy of stream information, each segment starts with it */
+	glc_stream_info_t info;
+	char *info_name, *info_date;
+
+	/* target is a TCP connection, reopened when it breaks */
+	char *net_host, *net_port;
+	glc_utime_t net_retry;
+	int net_zerocopy;
+	/* staging buffers are swapped, kernel may still read the other one */
+	unsigned char *net_buffer;
+	u_int32_t net_sent, net_done, net_buffer_send;
+
+	/* source is read through a read-only mapping */
+	int mmap;
+	struct file_map_s *map;
+	size_t map_pos, map_ahead, map_behind;
+
+	/* only first bytes of pictures and audio are read */
+	size_t scan;
+	char *scan_data;
+
+	/* state messages to send before seek position */
+	char *seek_state;
+	size_t seek_state_size;
+
+	/* reading stops at this offset, 0 if not limited */
+	off_t read_end;
+
+	/* staging buffers are written asynchronously with io_uring */
+	unsigned int uring;
+#ifdef __IO_URING
+	struct io_uring ring;
+	unsigned int ring_count, ring_current, inflight;
+	int ring_fixed, ring_active;
+	unsigned char *ring_buffer[FILE_URING_MAX];
+	size_t ring_size[FILE_URING_MAX];
+	size_t ring_done[FILE_URING_MAX];
+	off_t ring_offset[FILE_URING_MAX];
+	int ring_busy[FILE_URING_MAX];
+	off_t offset;
+#endif
 };
 
 void file_finish_callback(void *ptr, int err);
 int file_read_callback(glc_thread_state_t *state);
+int file_write(file_t file, struct iovec *iov, int iovcnt);
+int file_writev(file_t file, struct iovec *iov, int iovcnt);
+int file_flush(file_t file, int final);
+
+int file_message_key(glc_message_header_t *header, char **data, size_t *size,
+		     glc_stream_id_t *id, glc_utime_t *time);
+int file_index_point(file_t file, glc_stream_id_t id, glc_utime_t time);
+int file_write_data(file_t file, glc_message_header_t *header, char *data, size_t size);
+int file_index_state_callback(glc_message_header_t *header, void *message, size_t message_size, void *arg);
+int file_write_index(file_t file);
+int file_map_source(file_t file);
+void file_unmap_source(file_t file);
+void file_map_put(struct file_map_s *map);
+void file_map_prefetch(file_t file, size_t size);
+void file_map_advance(file_t file, size_t size);
+int file_map_ref(file_t file, glc_message_type_t type, size_t size, glc_shared_ref_t *ref);
+void file_map_release(void *arg);
+int file_read_data(file_t file, void *data, size_t size);
+int file_skip_data(file_t file, size_t size);
+int file_scan_cut(glc_message_type_t type, const char *data, size_t size);
+
+int file_read_index_trailer(file_t file, glc_index_trailer_t *trailer);
+int file_read_index_entry(file_t file, glc_index_trailer_t *trailer,
+			  unsigned int n, glc_index_entry_t *entry);
+off_t file_read_position(file_t file);
+
+int file_parse_address(const char *address, char **host, char **port);
+int file_net_connect(file_t file, int *fd);
+int file_net_reconnect(file_t file);
+void file_net_lost(file_t file, int err);
+int file_net_send(file_t file, struct iovec *iov, int iovcnt, int zerocopy);
+int file_net_reap(file_t file, int wait);
+
+#ifdef __IO_URING
+int file_uring_init(file_t file);
+void file_uring_destroy(file_t file);
+int file_uring_write(file_t file, size_t size);
+int file_uring_submit(file_t file, unsigned int i, size_t done);
+int file_uring_reap(file_t file);
+int file_uring_drain(file_t file);
+#endif
 int file_write_message(file_t file, glc_message_header_t *header, void *message, size_t message_size);
+
+int file_attach_target(file_t file, int fd);
+int file_detach_target(file_t file);
+void file_preallocate(file_t file, int fd);
+char *file_segment_name(file_t file, unsigned int segment);
+void file_prepare_segment(file_t file);
+void file_cancel_segment(file_t file);
+void *file_segment_thread(void *argptr);
+int file_next_segment(file_t file);
 int file_write_state_callback(glc_message_header_t *header, void *message, size_t message_size, void *arg);
 
 int file_init(file_t *file, glc_t *glc)
@@ -67,12 +236,14 @@ int file_init(file_t *file, glc_t *glc)
 	(*file)->glc = glc;
 	(*file)->fd = -1;
 	(*file)->sync = 0;
+	(*file)->segment_fd = -1;
 
 	(*file)->thread.flags = GLC_THREAD_READ;
 	(*file)->thread.ptr = *file;
 	(*file)->thread.read_callback = &file_read_callback;
 	(*file)->thread.finish_callback = &file_finish_callback;
 	(*file)->thread.threads = 1;
+	(*file)->thread.name = "file";
 
 	tracker_init(&(*file)->state_tracker, (*file)->glc);
 
@@ -82,6 +253,27 @@ int file_init(file_t *file, glc_t *glc)
 int file_destroy(file_t file)
 {
 	tracker_destroy(file->state_tracker);
+#ifdef __IO_URING
+	file_uring_destroy(file);
+#endif
+	if (file->buffer)
+		free(file->buffer);
+	if (file->entry)
+		free(file->entry);
+	if (file->state)
+		free(file->state);
+	if (file->seek_state)
+		free(file->seek_state);
+	if (file->scan_data)
+		free(file->scan_data);
+	if (file->segment_name)
+		free(file->segment_name);
+	if (file->info_name)
+		free(file->info_name);
+	if (file->info_date)
+		free(file->info_date);
+	if (file->net_buffer)
+		free(file->net_buffer);
 	free(file);
 	return 0;
 }
@@ -92,6 +284,90 @@ int file_set_sync(file_t file, int sync)
 	return 0;
 }
 
+int file_set_write_buffer(file_t file, size_t size)
+{
+	if (file->fd >= 0)
+		return EBUSY;
+
+	if (file->buffer)
+		free(file->buffer);
+	file->buffer = NULL;
+
+	/* whole blocks, so O_DIRECT can write full buffers */
+	file->buffer_size = size + (FILE_ALIGN - size % FILE_ALIGN) % FILE_ALIGN;
+	return 0;
+}
+
+int file_set_flush_interval(file_t file, glc_utime_t interval)
+{
+	file->flush_interval = interval;
+	return 0;
+}
+
+int file_set_direct(file_t file, int direct)
+{
+	if (file->fd >= 0)
+		return EBUSY;
+
+	file->direct = direct;
+	return 0;
+}
+
+int file_set_index(file_t file, glc_utime_t interval)
+{
+	if (file->flags & FILE_RUNNING)
+		return EBUSY;
+
+	file->index_interval = interval;
+	return 0;
+}
+
+int file_set_uring(file_t file, unsigned int buffers)
+{
+	if (file->fd >= 0)
+		return EBUSY;
+#ifdef __IO_URING
+	if (file->ring_count)
+		return EALREADY;
+#endif
+	if (buffers > FILE_URING_MAX)
+		return EINVAL;
+
+	file->uring = buffers;
+	return 0;
+}
+
+int file_set_segment(file_t file, glc_size_t size, glc_utime_t time)
+{
+	if (file->flags & FILE_WRITING)
+		return EALREADY;
+
+	file->segment_size = size;
+	file->segment_time = time;
+	return 0;
+}
+
+int file_set_mmap(file_t file, int mmap)
+{
+	file->mmap = mmap;
+	return 0;
+}
+
+int file_set_scan(file_t file, size_t size)
+{
+	if (file->flags & FILE_RUNNING)
+		return EALREADY;
+
+	if (file->scan_data)
+		free(file->scan_data);
+	file->scan_data = NULL;
+
+	file->scan = size;
+	if ((size) && (!(file->scan_data = (char *) malloc(size))))
+		return ENOMEM;
+	return 0;
+}
+
 int file_set_callback(file_t file, callback_request_func_t callback)
 {
 	file->callback = callback;
@@ -101,30 +377,86 @@ int file_set_callback(file_t file, callback_request_func_t callback)
 int file_open_target(file_t file, const char *filename)
 {
 	int fd, ret = 0;
+	char *name;
 	if (file->fd >= 0)
 		return EBUSY;
 
+	/* later segments are named after first one */
+	if (file->segment_name)
+		free(file->segment_name);
+	file->segment_name = NULL;
+	if ((file->segment_size) || (file->segment_time)) {
+		file->segment_name = strdup(filename);
+		file->segment = 0;
+		name = file_segment_name(file, 0);
+	} else
+		name = strdup(filename);
+
 	glc_log(file->glc, GLC_INFORMATION, "file",
 		 "opening %s for writing stream (%s)",
-		 filename,
+		 name,
 		 file->sync ? "sync" : "no sync");
 
-	fd = open(filename, O_CREAT | O_WRONLY | (file->sync ? O_SYNC : 0), 0644);
+	fd = open(name, O_CREAT | O_WRONLY | (file->sync ? O_SYNC : 0), 0644);
 
 	if (fd == -1) {
+		ret = errno;
 		glc_log(file->glc, GLC_ERROR, "file", "can't open %s: %s (%d)",
-			 filename, strerror(errno), errno);
-		return errno;
+			 name, strerror(ret), ret);
+		goto err;
+	}
+
+	if ((ret = file_set_target(file, fd))) {
+		close(fd);
+		goto err;
+	}
+
+	if (file->segment_name)
+		file_prepare_segment(file);
+err:
+	if ((ret) && (file->segment_name)) {
+		free(file->segment_name);
+		file->segment_name = NULL;
+	}
+	free(name);
+	return ret;
+}
+
+int file_connect_target(file_t file, const char *address)
+{
+	int fd, ret;
+	if (file->fd >= 0)
+		return EBUSY;
+
+	if ((ret = file_parse_address(address, &file->net_host, &file->net_port))) {
+		glc_log(file->glc, GLC_ERROR, "file", "invalid address %s", address);
+		return ret;
 	}
 
-	if ((ret = file_set_target(file, fd)))
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "connecting to %s port %s for writing stream",
+		 file->net_host, file->net_port);
+
+	file->flags |= FILE_NET;
+	if ((ret = file_net_connect(file, &fd)))
+		goto err;
+	if ((ret = file_attach_target(file, fd))) {
 		close(fd);
+		goto err;
+	}
 
+	return 0;
+err:
+	free(file->net_host);
+	free(file->net_port);
+	file->net_host = file->net_port = NULL;
+	file->flags &= ~FILE_NET;
 	return ret;
 }
 
 int file_set_target(file_t file, int fd)
 {
+	int ret;
 	if (file->fd >= 0)
 		return EBUSY;
 
@@ -135,8 +467,77 @@ int file_set_target(file_t file, int fd)
 	}
 
 	/* truncate file when we have locked it */
-	lseek(file->fd, 0, SEEK_SET);
-	ftruncate(file->fd, 0);
+	lseek(fd, 0, SEEK_SET);
+	ftruncate(fd, 0);
+	file_preallocate(file, fd);
+
+	if ((ret = file_attach_target(file, fd))) {
+		flock(fd, LOCK_UN);
+		return ret;
+	}
+	return 0;
+}
+
+int file_attach_target(file_t file, int fd)
+{
+	int ret, on = 1;
+
+	if ((file->buffer_size) && (!file->buffer)) {
+		if ((ret = posix_memalign((void **) &file->buffer, FILE_ALIGN, file->buffer_size)))
+			return ret;
+	}
+	file->buffered = 0;
+	file->segment_begin = glc_state_time(file->glc);
+
+	/* index offsets are relative to file start */
+	if ((off_t) (file->position = lseek(fd, 0, SEEK_CUR)) == -1)
+		file->position = 0;
+	file->entries = 0;
+	file->state_size = 0;
+	file->last_state_size = 0;
+	file->index_next = 0;
+
+#ifdef __IO_URING
+	/* writes are submitted with explicit offsets, so file must be seekable */
+	file->ring_active = 0;
+	if ((file->uring) && (file->buffer) && (!(file->flags & FILE_NET))) {
+		if ((file->offset = lseek(fd, 0, SEEK_CUR)) == -1)
+			glc_log(file->glc, GLC_WARNING, "file",
+				 "target is not seekable, not using io_uring");
+		else if (!file_uring_init(file))
+			file->ring_active = 1;
+	}
+#else
+	if (file->uring)
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "io_uring not supported, using blocking writes");
+#endif
+
+#ifdef FILE_ZEROCOPY
+	/* big staged sends are worth pinning instead of copying */
+	file->net_zerocopy = 0;
+	if ((file->flags & FILE_NET) && (file->buffer)) {
+		if ((!file->net_buffer) &&
+		    (posix_memalign((void **) &file->net_buffer, FILE_ALIGN, file->buffer_size)))
+			file->net_buffer = NULL;
+		if ((file->net_buffer) &&
+		    (!setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)))) {
+			file->net_zerocopy = 1;
+			file->net_sent = file->net_done = file->net_buffer_send = 0;
+			glc_log(file->glc, GLC_DEBUG, "file", "using MSG_ZEROCOPY");
+		}
+	}
+#endif
+
+	/* O_DIRECT bypasses page cache, and only works with staging buffer */
+	if ((file->direct) && (file->buffer) && (!(file->flags & FILE_NET))) {
+		if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == -1)
+			glc_log(file->glc, GLC_WARNING, "file",
+				 "can't use O_DIRECT: %s (%d)", strerror(errno), errno);
+		else
+			glc_log(file->glc, GLC_INFORMATION, "file",
+				 "using O_DIRECT with %zd KiB blocks", file->buffer_size / 1024);
+	}
 
 	file->fd = fd;
 	file->flags |= FILE_WRITING;
@@ -145,12 +546,58 @@ int file_set_target(file_t file, int fd)
 
 int file_close_target(file_t file)
 {
+	if ((file->fd < 0) && (file->flags & FILE_NET_DOWN)) {
+		/* connection was lost and never came back */
+		file->flags &= ~(FILE_WRITING | FILE_INFO_WRITTEN | FILE_EOF_WRITTEN);
+		goto net;
+	}
+
 	if ((file->fd < 0) | (file->flags & FILE_RUNNING) |
 	    (!(file->flags & FILE_WRITING)))
 		return EAGAIN;
 
+	file_cancel_segment(file);
+	file_detach_target(file);
+net:
+	if (file->flags & FILE_NET) {
+		free(file->net_host);
+		free(file->net_port);
+		file->net_host = file->net_port = NULL;
+		file->flags &= ~(FILE_NET | FILE_NET_DOWN);
+	}
+	return 0;
+}
+
+int file_detach_target(file_t file)
+{
+	struct stat st;
+	int ret;
+
+	/* index follows eof, so readers without index support stop before it */
+	if ((file->flags & FILE_EOF_WRITTEN) && (file->entries)) {
+		if ((ret = file_write_index(file)))
+			glc_log(file->glc, GLC_ERROR, "file",
+				 "can't write index: %s (%d)",
+				 strerror(ret), ret);
+	}
+
+	if ((ret = file_flush(file, 1)))
+		glc_log(file->glc, GLC_ERROR, "file",
+			 "can't write buffered data: %s (%d)",
+			 strerror(ret), ret);
+
+	/* release preallocated space that was not used */
+	if (((file->segment_size) || (file->segment_time)) && (!fstat(file->fd, &st)))
+		ftruncate(file->fd, st.st_size);
+
+#ifdef FILE_ZEROCOPY
+	/* pinned pages must not be freed while kernel reads them */
+	if (file->net_zerocopy)
+		file_net_reap(file, file->net_sent);
+#endif
+
 	/* try to remove lock */
-	if (flock(file->fd, LOCK_UN) == -1)
+	if ((!(file->flags & FILE_NET)) && (flock(file->fd, LOCK_UN) == -1))
 		glc_log(file->glc, GLC_WARNING,
 			 "file", "can't unlock file: %s (%d)",
 			 strerror(errno), errno);
@@ -161,7 +608,7 @@ int file_close_target(file_t file)
 			 strerror(errno), errno);
 
 	file->fd = -1;
-	file->flags &= ~(FILE_RUNNING | FILE_WRITING | FILE_INFO_WRITTEN);
+	file->flags &= ~(FILE_RUNNING | FILE_WRITING | FILE_INFO_WRITTEN | FILE_EOF_WRITTEN);
 
 	return 0;
 }
@@ -169,43 +616,239 @@ int file_close_target(file_t file)
 int file_write_info(file_t file, glc_stream_info_t *info,
 		    const char *info_name, const char *info_date)
 {
+	struct iovec iov[3];
+	int ret;
+
 	if ((file->fd < 0) | (file->flags & FILE_RUNNING) |
 	    (!(file->flags & FILE_WRITING)))
 		return EAGAIN;
 
-	if (write(file->fd, info, sizeof(glc_stream_info_t)) != sizeof(glc_stream_info_t))
-		goto err;
-	if (write(file->fd, info_name, info->name_size) != info->name_size)
-		goto err;
-	if (write(file->fd, info_date, info->date_size) != info->date_size)
+	iov[0].iov_base = info;
+	iov[0].iov_len = sizeof(glc_stream_info_t);
+	iov[1].iov_base = (void *) info_name;
+	iov[1].iov_len = info->name_size;
+	iov[2].iov_base = (void *) info_date;
+	iov[2].iov_len = info->date_size;
+
+	if ((ret = file_write(file, iov, 3)))
 		goto err;
 
+	/* keep a copy for next segments */
+	if (info != &file->info) {
+		memcpy(&file->info, info, sizeof(glc_stream_info_t));
+		if (file->info_name)
+			free(file->info_name);
+		if (file->info_date)
+			free(file->info_date);
+		file->info_name = (char *) malloc(info->name_size);
+		file->info_date = (char *) malloc(info->date_size);
+		memcpy(file->info_name, info_name, info->name_size);
+		memcpy(file->info_date, info_date, info->date_size);
+	}
+
 	file->flags |= FILE_INFO_WRITTEN;
 	return 0;
 err:
 	glc_log(file->glc, GLC_ERROR, "file",
 		 "can't write stream information: %s (%d)",
-		 strerror(errno), errno);
-	return errno;
+		 strerror(ret), ret);
+	return ret;
 }
 
 int file_write_message(file_t file, glc_message_header_t *header, void *message, size_t message_size)
 {
 	glc_size_t glc_size = (glc_size_t) message_size;
+	struct iovec iov[3];
 
-	if (write(file->fd, &glc_size, sizeof(glc_size_t)) != sizeof(glc_size_t))
-		goto err;
-	if (write(file->fd, header, sizeof(glc_message_header_t))
-		!= sizeof(glc_message_header_t))
-		goto err;
-	if (message_size > 0) {
-		if (write(file->fd, message, message_size) != message_size)
-			goto err;
+	iov[0].iov_base = &glc_size;
+	iov[0].iov_len = sizeof(glc_size_t);
+	iov[1].iov_base = header;
+	iov[1].iov_len = sizeof(glc_message_header_t);
+	iov[2].iov_base = message;
+	iov[2].iov_len = message_size;
+
+	return file_write(file, iov, (message_size > 0) ? 3 : 2);
+}
+
+int file_write(file_t file, struct iovec *iov, int iovcnt)
+{
+	struct iovec gather[FILE_IOV_MAX + 1];
+	size_t size = 0, len;
+	char *data;
+	int i, ret;
+
+	/* stream is dropped until connection comes back */
+	if (file->flags & FILE_NET_DOWN)
+		return 0;
+
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+	file->position += size;
+
+	if (!file->buffer)
+		return file_writev(file, iov, iovcnt);
+
+	/* large messages go out with staged data in one writev() */
+	if ((!file->direct) &&
+#ifdef __IO_URING
+	    (!file->ring_active) &&
+#endif
+	    (file->buffered + size > file->buffer_size)) {
+		gather[0].iov_base = file->buffer;
+		gather[0].iov_len = file->buffered;
+		memcpy(&gather[1], iov, sizeof(struct iovec) * iovcnt);
+
+		file->buffered = 0;
+		return file_writev(file, gather, iovcnt + 1);
+	}
+
+	if (!file->buffered)
+		file->buffered_time = glc_time(file->glc);
+
+	/* O_DIRECT writes only whole aligned buffers */
+	for (i = 0; i < iovcnt; i++) {
+		data = iov[i].iov_base;
+		len = iov[i].iov_len;
+
+		while (len > 0) {
+			size = file->buffer_size - file->buffered;
+			if (size > len)
+				size = len;
+
+			memcpy(&file->buffer[file->buffered], data, size);
+			file->buffered += size;
+			data += size;
+			len -= size;
+
+			if (file->buffered == file->buffer_size) {
+				if ((ret = file_flush(file, 0)))
+					return ret;
+			}
+		}
 	}
 
 	return 0;
-err:
-	return errno;
+}
+
+int file_writev(file_t file, struct iovec *iov, int iovcnt)
+{
+	ssize_t written;
+	int ret;
+
+	/* broken connection is not an error, receiver may come back */
+	if (file->flags & FILE_NET) {
+		if ((ret = file_net_send(file, iov, iovcnt, 0)))
+			file_net_lost(file, ret);
+		return 0;
+	}
+
+	/* iov is consumed as it is written */
+	while (iovcnt > 0) {
+		if ((written = writev(file->fd, iov, iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+
+		while ((iovcnt > 0) && (written >= iov->iov_len)) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return 0;
+}
+
+int file_flush(file_t file, int final)
+{
+	struct iovec iov;
+	size_t size = file->buffered;
+	int ret;
+
+	if (!size)
+		return 0;
+
+	/* partial block stays staged until it is full or file is closed */
+	if (file->direct)
+		size -= size % FILE_ALIGN;
+
+#ifdef __IO_URING
+	if (file->ring_active) {
+		if ((size) && ((ret = file_uring_write(file, size))))
+			return ret;
+
+		if (final) {
+			/* everything before tail must be on disk before switching modes */
+			if ((ret = file_uring_drain(file)))
+				return ret;
+			file->ring_active = 0;
+
+			if (lseek(file->fd, file->offset, SEEK_SET) == -1)
+				return errno;
+			size = 0;
+		} else {
+			file->buffered_time = glc_time(file->glc);
+			return 0;
+		}
+	}
+#endif
+
+#ifdef FILE_ZEROCOPY
+	if ((file->net_zerocopy) && (!(file->flags & FILE_NET_DOWN))) {
+		iov.iov_base = file->buffer;
+		iov.iov_len = size;
+		if ((ret = file_net_send(file, &iov, 1, 1))) {
+			file_net_lost(file, ret);
+			file->buffered = 0;
+			return 0;
+		}
+
+		/* keep filling the other buffer while this one is sent */
+		iov.iov_base = file->buffer;
+		file->buffer = file->net_buffer;
+		file->net_buffer = iov.iov_base;
+		ret = file->net_buffer_send;
+		file->net_buffer_send = file->net_sent;
+		file->buffered = 0;
+		if ((ret = file_net_reap(file, ret)))
+			file_net_lost(file, ret);
+
+		file->buffered_time = glc_time(file->glc);
+		return 0;
+	}
+#endif
+
+	if (size) {
+		iov.iov_base = file->buffer;
+		iov.iov_len = size;
+		if ((ret = file_writev(file, &iov, 1)))
+			return ret;
+		if (file->flags & FILE_NET_DOWN)
+			return 0;
+
+		file->buffered -= size;
+		if (file->buffered)
+			memmove(file->buffer, &file->buffer[size], file->buffered);
+	}
+
+	if ((final) && (file->buffered)) {
+		/* last partial block can't be written with O_DIRECT */
+		fcntl(file->fd, F_SETFL, fcntl(file->fd, F_GETFL) & ~O_DIRECT);
+
+		iov.iov_base = file->buffer;
+		iov.iov_len = file->buffered;
+		if ((ret = file_writev(file, &iov, 1)))
+			return ret;
+		file->buffered = 0;
+	}
+
+	file->buffered_time = glc_time(file->glc);
+	return 0;
 }
 
 int file_write_eof(file_t file)
@@ -214,6 +857,10 @@ int file_write_eof(file_t file)
 	glc_message_header_t hdr;
 	hdr.type = GLC_MESSAGE_CLOSE;
 
+	/* nobody is listening */
+	if (file->flags & FILE_NET_DOWN)
+		return 0;
+
 	if ((file->fd < 0) | (file->flags & FILE_RUNNING) |
 	    (!(file->flags & FILE_WRITING))) {
 	    ret = EAGAIN;
@@ -223,6 +870,7 @@ int file_write_eof(file_t file)
 	if ((ret = file_write_message(file, &hdr, NULL, 0)))
 		goto err;
 
+	file->flags |= FILE_EOF_WRITTEN;
 	return 0;
 err:
 	glc_log(file->glc, GLC_ERROR, "file",
@@ -286,6 +934,187 @@ int file_write_process_wait(file_t file)
 	return 0;
 }
 
+#ifdef __IO_URING
+int file_uring_init(file_t file)
+{
+	struct iovec iov[FILE_URING_MAX];
+	unsigned int i;
+	int ret;
+
+	/* ring and buffers are kept for all targets */
+	if (file->ring_count)
+		return 0;
+
+	if ((ret = io_uring_queue_init(file->uring * 2, &file->ring, 0)) < 0) {
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "io_uring not available, using blocking writes: %s (%d)",
+			 strerror(-ret), -ret);
+		file->uring = 0;
+		return -ret;
+	}
+
+	file->ring_buffer[0] = file->buffer;
+	for (file->ring_count = 1; file->ring_count < file->uring; file->ring_count++) {
+		if (posix_memalign((void **) &file->ring_buffer[file->ring_count],
+				   FILE_ALIGN, file->buffer_size))
+			break;
+	}
+
+	for (i = 0; i < file->ring_count; i++) {
+		iov[i].iov_base = file->ring_buffer[i];
+		iov[i].iov_len = file->buffer_size;
+		file->ring_busy[i] = 0;
+	}
+
+	/* registered buffers save page pinning on every write */
+	file->ring_fixed = (io_uring_register_buffers(&file->ring, iov, file->ring_count) == 0);
+	file->ring_current = 0;
+	file->inflight = 0;
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "using io_uring with %u %zd KiB buffers%s", file->ring_count,
+		 file->buffer_size / 1024, file->ring_fixed ? " (registered)" : "");
+	return 0;
+}
+
+void file_uring_destroy(file_t file)
+{
+	unsigned int i;
+
+	if (!file->ring_count)
+		return;
+
+	file_uring_drain(file);
+	io_uring_queue_exit(&file->ring);
+
+	/* first buffer is file->buffer */
+	for (i = 1; i < file->ring_count; i++)
+		free(file->ring_buffer[i]);
+	file->buffer = file->ring_buffer[0];
+	file->ring_count = 0;
+}
+
+int file_uring_write(file_t file, size_t size)
+{
+	unsigned int i = file->ring_current, next;
+	int ret;
+
+	file->ring_size[i] = size;
+	file->ring_offset[i] = file->offset;
+	file->offset += size;
+
+	if ((ret = file_uring_submit(file, i, 0)))
+		return ret;
+
+	/* continue in next free buffer */
+	next = (i + 1) % file->ring_count;
+	while (file->ring_busy[next]) {
+		if ((ret = file_uring_reap(file)))
+			return ret;
+	}
+
+	/* unaligned rest, with O_DIRECT */
+	file->buffered -= size;
+	if (file->buffered)
+		memcpy(file->ring_buffer[next], &file->ring_buffer[i][size], file->buffered);
+
+	file->ring_current = next;
+	file->buffer = file->ring_buffer[next];
+	return 0;
+}
+
+int file_uring_submit(file_t file, unsigned int i, size_t done)
+{
+	struct io_uring_sqe *sqe;
+	int ret;
+
+	/* queue is twice the buffer count, so there is always room */
+	sqe = io_uring_get_sqe(&file->ring);
+	if (file->ring_fixed)
+		io_uring_prep_write_fixed(sqe, file->fd, &file->ring_buffer[i][done],
+					  file->ring_size[i] - done,
+					  file->ring_offset[i] + done, i);
+	else
+		io_uring_prep_write(sqe, file->fd, &file->ring_buffer[i][done],
+				    file->ring_size[i] - done, file->ring_offset[i] + done);
+	io_uring_sqe_set_data(sqe, (void *) (uintptr_t) i);
+
+	file->ring_done[i] = done;
+	file->ring_busy[i] = 1;
+	file->inflight++;
+
+	if ((ret = io_uring_submit(&file->ring)) < 0)
+		return -ret;
+	return 0;
+}
+
+int file_uring_reap(file_t file)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int i;
+	ssize_t written;
+	size_t done;
+	int ret, res;
+
+	while ((ret = io_uring_wait_cqe(&file->ring, &cqe)) == -EINTR);
+	if (ret < 0)
+		return -ret;
+
+	i = (uintptr_t) io_uring_cqe_get_data(cqe);
+	res = cqe->res;
+	io_uring_cqe_seen(&file->ring, cqe);
+
+	file->ring_busy[i] = 0;
+	file->inflight--;
+
+	if (res < 0) {
+		glc_log(file->glc, GLC_ERROR, "file", "write failed: %s (%d)",
+			 strerror(-res), -res);
+		return -res;
+	}
+
+	done = file->ring_done[i] + res;
+	if (done == file->ring_size[i])
+		return 0;
+	if (!res)
+		return EIO;
+
+	/* short writes are rare, aligned rest can go through the ring again */
+	if ((!file->direct) || (!(done % FILE_ALIGN)))
+		return file_uring_submit(file, i, done);
+
+	/* unaligned rest can't be written with O_DIRECT, finish it synchronously */
+	fcntl(file->fd, F_SETFL, fcntl(file->fd, F_GETFL) & ~O_DIRECT);
+	for (ret = 0; done < file->ring_size[i]; done += written) {
+		if ((written = pwrite(file->fd, &file->ring_buffer[i][done],
+				      file->ring_size[i] - done,
+				      file->ring_offset[i] + done)) < 0) {
+			if (errno == EINTR) {
+				written = 0;
+				continue;
+			}
+			ret = errno;
+			break;
+		}
+	}
+	fcntl(file->fd, F_SETFL, fcntl(file->fd, F_GETFL) | O_DIRECT);
+
+	return ret;
+}
+
+int file_uring_drain(file_t file)
+{
+	int ret;
+
+	while (file->inflight) {
+		if ((ret = file_uring_reap(file)))
+			return ret;
+	}
+
+	return 0;
+}
+#endif
+
 void file_finish_callback(void *ptr, int err)
 {
 	file_t file = (file_t) ptr;
@@ -297,9 +1126,33 @@ void file_finish_callback(void *ptr, int err)
 int file_read_callback(glc_thread_state_t *state)
 {
 	file_t file = (file_t) state->ptr;
-	glc_container_message_header_t *container;
-	glc_size_t glc_size;
 	glc_callback_request_t *callback_req;
+	glc_stream_id_t id;
+	glc_utime_t time;
+	int key, ret;
+
+	/* try to get receiver back, stream continues with current state */
+	if ((file->flags & FILE_NET_DOWN) && (glc_time(file->glc) >= file->net_retry))
+		file_net_reconnect(file);
+
+	key = !file_message_key(&state->header, &state->read_data, &state->read_size,
+				&id, &time);
+
+	/* start next segment with this message */
+	if ((file->segment_name) && (state->header.type != GLC_CALLBACK_REQUEST) &&
+	    (((file->segment_size) && (file->position >= file->segment_size)) ||
+	     ((file->segment_time) &&
+	      (glc_state_time(file->glc) - file->segment_begin >= file->segment_time)))) {
+		if ((ret = file_next_segment(file)))
+			goto err;
+	}
+
+	/* snapshot state before this message changes it */
+	if ((file->index_interval) && (!(file->flags & FILE_NET)) &&
+	    (key) && (time >= file->index_next)) {
+		if ((ret = file_index_point(file, id, time)))
+			goto err;
+	}
 
 	/* let state tracker to process this message */
 	tracker_submit(file->state_tracker, &state->header, state->read_data, state->read_size);
@@ -313,34 +1166,494 @@ int file_read_callback(glc_thread_state_t *state)
 			file->callback(callback_req->arg);
 			file->flags |= FILE_RUNNING;
 		}
-	} else if (state->header.type == GLC_MESSAGE_CONTAINER) {
-		container = (glc_container_message_header_t *) state->read_data;
-		if (write(file->fd, state->read_data, sizeof(glc_container_message_header_t) + container->size)
-		    != (sizeof(glc_container_message_header_t) + container->size))
-			goto err;
-	} else {
-		/* emulate container message */
-		glc_size = state->read_size;
-		if (write(file->fd, &glc_size, sizeof(glc_size_t)) != sizeof(glc_size_t))
-			goto err;
-		if (write(file->fd, &state->header, sizeof(glc_message_header_t))
-		    != sizeof(glc_message_header_t))
-			goto err;
-		if (write(file->fd, state->read_data, state->read_size) != state->read_size)
-			goto err;
-	}
+	} else if ((ret = file_write_data(file, &state->header,
+					  state->read_data, state->read_size)))
+		goto err;
 
 	return 0;
 
 err:
-	glc_log(file->glc, GLC_ERROR, "file", "%s (%d)", strerror(errno), errno);
-	return errno;
+	glc_log(file->glc, GLC_ERROR, "file", "%s (%d)", strerror(ret), ret);
+	return ret;
 }
 
-int file_open_source(file_t file, const char *filename)
+int file_write_packet(file_t file, glc_message_header_t *header,
+		      void *message, size_t message_size)
 {
-	int fd, ret = 0;
-	if (file->fd >= 0)
+	glc_message_header_t msg_header = *header;
+	char *data = (char *) message;
+	glc_stream_id_t id;
+	glc_utime_t time;
+	int ret;
+
+	if ((file->fd < 0) | (file->flags & FILE_RUNNING) |
+	    (!(file->flags & FILE_WRITING)) |
+	    (!(file->flags & FILE_INFO_WRITTEN)))
+		return EAGAIN;
+
+	if ((!file_message_key(&msg_header, &data, &message_size, &id, &time)) &&
+	    (file->index_interval) && (time >= file->index_next)) {
+		if ((ret = file_index_point(file, id, time)))
+			return ret;
+	}
+
+	tracker_submit(file->state_tracker, &msg_header, data, message_size);
+	return file_write_data(file, &msg_header, data, message_size);
+}
+
+int file_message_key(glc_message_header_t *header, char **data, size_t *size,
+		     glc_stream_id_t *id, glc_utime_t *time)
+{
+	glc_stamp_header_t *stamp = (glc_stamp_header_t *) *data;
+	int key;
+
+	if ((header->type != GLC_MESSAGE_STAMP) || (*size < sizeof(glc_stamp_header_t))) {
+		/* reading can start only where a picture needs no earlier ones */
+		if ((glc_util_message_time(header->type, *data, *size, id, time)) ||
+		    (glc_util_message_video(header->type, *data, *size, id, &key)) || (!key))
+			return ENOTSUP;
+		return 0;
+	}
+
+	/* only message itself is written */
+	*id = stamp->id;
+	*time = stamp->time;
+	header->type = stamp->header.type;
+	*data += sizeof(glc_stamp_header_t);
+	*size -= sizeof(glc_stamp_header_t);
+	return (stamp->flags & GLC_STAMP_KEY) ? 0 : ENOTSUP;
+}
+
+int file_write_data(file_t file, glc_message_header_t *header, char *data, size_t size)
+{
+	glc_container_message_header_t *container;
+	glc_size_t glc_size;
+	struct iovec iov[3];
+	int ret;
+
+	if (header->type == GLC_MESSAGE_CONTAINER) {
+		container = (glc_container_message_header_t *) data;
+		iov[0].iov_base = data;
+		iov[0].iov_len = sizeof(glc_container_message_header_t) + container->size;
+		if ((ret = file_write(file, iov, 1)))
+			return ret;
+	} else {
+		/* emulate container message, in one syscall */
+		glc_size = size;
+		iov[0].iov_base = &glc_size;
+		iov[0].iov_len = sizeof(glc_size_t);
+		iov[1].iov_base = header;
+		iov[1].iov_len = sizeof(glc_message_header_t);
+		iov[2].iov_base = data;
+		iov[2].iov_len = size;
+		if ((ret = file_write(file, iov, 3)))
+			return ret;
+	}
+
+	/* don't let staged data get too old */
+	if ((file->buffered) && (file->flush_interval) &&
+	    (glc_time(file->glc) - file->buffered_time >= file->flush_interval)) {
+		if ((ret = file_flush(file, 0)))
+			return ret;
+	}
+
+	return 0;
+}
+
+void file_preallocate(file_t file, int fd)
+{
+	/* extents are allocated up front, file size stays the same */
+	if ((file->segment_size) &&
+	    (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, file->segment_size) == -1))
+		glc_log(file->glc, GLC_DEBUG, "file",
+			 "can't preallocate segment: %s (%d)", strerror(errno), errno);
+}
+
+char *file_segment_name(file_t file, unsigned int segment)
+{
+	char num[16], *name;
+
+	snprintf(num, sizeof(num), "%u", segment);
+	if (strstr(file->segment_name, "%segment%"))
+		return glc_util_str_replace(file->segment_name, "%segment%", num);
+	if (!segment)
+		return strdup(file->segment_name);
+
+	/* first segment keeps its name, others get a suffix */
+	name = (char *) malloc(strlen(file->segment_name) + strlen(num) + 2);
+	sprintf(name, "%s.%s", file->segment_name, num);
+	return name;
+}
+
+void file_prepare_segment(file_t file)
+{
+	file->segment_next_name = file_segment_name(file, file->segment + 1);
+	file->segment_fd = -1;
+	file->segment_ret = 0;
+
+	if (pthread_create(&file->segment_thread, NULL, file_segment_thread, file)) {
+		free(file->segment_next_name);
+		file->segment_next_name = NULL;
+		return;
+	}
+	file->segment_pending = 1;
+}
+
+void *file_segment_thread(void *argptr)
+{
+	file_t file = argptr;
+	int fd;
+
+	/* opening, locking and allocating can block for a long time */
+	if ((fd = open(file->segment_next_name, O_CREAT | O_WRONLY | O_TRUNC |
+		       (file->sync ? O_SYNC : 0), 0644)) == -1) {
+		file->segment_ret = errno;
+		return NULL;
+	}
+
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		file->segment_ret = errno;
+		close(fd);
+		return NULL;
+	}
+
+	file_preallocate(file, fd);
+	file->segment_fd = fd;
+	return NULL;
+}
+
+void file_cancel_segment(file_t file)
+{
+	if (!file->segment_pending)
+		return;
+
+	pthread_join(file->segment_thread, NULL);
+	file->segment_pending = 0;
+
+	/* unused segment */
+	if (file->segment_fd >= 0) {
+		flock(file->segment_fd, LOCK_UN);
+		close(file->segment_fd);
+		unlink(file->segment_next_name);
+		file->segment_fd = -1;
+	}
+
+	free(file->segment_next_name);
+	file->segment_next_name = NULL;
+}
+
+int file_next_segment(file_t file)
+{
+	int ret;
+
+	/* next segment should have been ready long ago */
+	if (!file->segment_pending)
+		return EAGAIN;
+	pthread_join(file->segment_thread, NULL);
+	file->segment_pending = 0;
+
+	if (file->segment_fd < 0) {
+		glc_log(file->glc, GLC_ERROR, "file", "can't open %s: %s (%d)",
+			 file->segment_next_name, strerror(file->segment_ret), file->segment_ret);
+		free(file->segment_next_name);
+		file->segment_next_name = NULL;
+		return file->segment_ret;
+	}
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "starting segment %s", file->segment_next_name);
+	free(file->segment_next_name);
+	file->segment_next_name = NULL;
+
+	/* these refuse to work while running */
+	file->flags &= ~FILE_RUNNING;
+
+	if ((ret = file_write_eof(file)))
+		goto err;
+	file_detach_target(file);
+
+	if ((ret = file_attach_target(file, file->segment_fd))) {
+		flock(file->segment_fd, LOCK_UN);
+		close(file->segment_fd);
+		file->segment_fd = -1;
+		goto err;
+	}
+	file->segment_fd = -1;
+
+	/* every segment is playable on its own */
+	if ((ret = file_write_info(file, &file->info, file->info_name, file->info_date)))
+		goto err;
+	if ((ret = file_write_state(file)))
+		goto err;
+
+	file->segment++;
+	file_prepare_segment(file);
+
+	file->flags |= FILE_RUNNING;
+	return 0;
+err:
+	file->flags |= FILE_RUNNING;
+	return ret;
+}
+
+int file_index_point(file_t file, glc_stream_id_t id, glc_utime_t time)
+{
+	glc_index_entry_t *entry;
+	size_t start = file->state_size;
+	int ret;
+
+	if (file->entries == file->entries_size) {
+		file->entries_size = file->entries_size ? file->entries_size * 2 : 1024;
+		if (!(entry = (glc_index_entry_t *) realloc(file->entry,
+				sizeof(glc_index_entry_t) * file->entries_size)))
+			return ENOMEM;
+		file->entry = entry;
+	}
+
+	if ((ret = tracker_iterate_state(file->state_tracker, &file_index_state_callback, file)))
+		return ret;
+
+	/* state rarely changes, so share identical snapshots */
+	if ((file->last_state_size == file->state_size - start) &&
+	    (!memcmp(&file->state[file->last_state_offset], &file->state[start],
+		     file->last_state_size)))
+		file->state_size = start;
+	else {
+		file->last_state_offset = start;
+		file->last_state_size = file->state_size - start;
+	}
+
+	entry = &file->entry[file->entries++];
+	entry->time = time;
+	entry->id = id;
+	entry->offset = file->position;
+	entry->state_offset = file->last_state_offset;
+	entry->state_size = file->last_state_size;
+
+	file->index_next = entry->time + file->index_interval;
+	return 0;
+}
+
+int file_index_state_callback(glc_message_header_t *header, void *message, size_t message_size, void *arg)
+{
+	file_t file = arg;
+	glc_size_t glc_size = (glc_size_t) message_size;
+	size_t size = sizeof(glc_size_t) + sizeof(glc_message_header_t) + message_size;
+	char *data;
+
+	if (file->state_size + size > file->state_alloc) {
+		file->state_alloc = (file->state_size + size) * 2;
+		if (!(data = (char *) realloc(file->state, file->state_alloc)))
+			return ENOMEM;
+		file->state = data;
+	}
+
+	/* same format as in stream */
+	memcpy(&file->state[file->state_size], &glc_size, sizeof(glc_size_t));
+	file->state_size += sizeof(glc_size_t);
+	memcpy(&file->state[file->state_size], header, sizeof(glc_message_header_t));
+	file->state_size += sizeof(glc_message_header_t);
+	memcpy(&file->state[file->state_size], message, message_size);
+	file->state_size += message_size;
+
+	return 0;
+}
+
+int file_write_index(file_t file)
+{
+	glc_index_trailer_t trailer;
+	struct iovec iov[3];
+
+	trailer.signature = GLC_INDEX_SIGNATURE;
+	trailer.entries = file->entries;
+	trailer.index_offset = file->position;
+	trailer.state_size = file->state_size;
+
+	iov[0].iov_base = file->entry;
+	iov[0].iov_len = sizeof(glc_index_entry_t) * file->entries;
+	iov[1].iov_base = file->state;
+	iov[1].iov_len = file->state_size;
+	iov[2].iov_base = &trailer;
+	iov[2].iov_len = sizeof(glc_index_trailer_t);
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "writing index with %u entries", file->entries);
+
+	file->entries = 0;
+	return file_write(file, iov, 3);
+}
+
+int file_seek_time(file_t file, glc_utime_t time, glc_utime_t *seek_time)
+{
+	glc_index_trailer_t trailer;
+	glc_index_entry_t entry;
+	unsigned int low, high, mid;
+	off_t cur;
+	int ret;
+
+	if ((file->fd < 0) | (!(file->flags & FILE_READING)) |
+	    (!(file->flags & FILE_INFO_VALID)))
+		return EAGAIN;
+
+	if ((cur = lseek(file->fd, 0, SEEK_CUR)) == -1)
+		return errno;
+
+	if ((ret = file_read_index_trailer(file, &trailer)))
+		goto err;
+
+	/* last entry not after time */
+	low = 0;
+	high = trailer.entries;
+	while (high - low > 1) {
+		mid = low + (high - low) / 2;
+		if ((ret = file_read_index_entry(file, &trailer, mid, &entry)))
+			goto err;
+		if (entry.time <= time)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	if ((ret = file_read_index_entry(file, &trailer, low, &entry)))
+		goto err;
+	if ((entry.offset < cur) || (entry.offset > trailer.index_offset) ||
+	    (entry.state_offset + entry.state_size > trailer.state_size)) {
+		ret = EINVAL;
+		goto err;
+	}
+
+	/* state is sent before first packet */
+	if (file->seek_state)
+		free(file->seek_state);
+	file->seek_state = NULL;
+	file->seek_state_size = entry.state_size;
+	if (entry.state_size) {
+		file->seek_state = (char *) malloc(entry.state_size);
+		if (pread(file->fd, file->seek_state, entry.state_size,
+			  trailer.index_offset + trailer.entries * sizeof(glc_index_entry_t) +
+			  entry.state_offset) != entry.state_size) {
+			ret = EBADMSG;
+			goto err;
+		}
+	}
+
+	if (lseek(file->fd, entry.offset, SEEK_SET) == -1) {
+		ret = errno;
+		goto err;
+	}
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "seeked to %.3f s", (double) entry.time / 1000000.0);
+	if (seek_time)
+		*seek_time = entry.time;
+	return 0;
+
+err:
+	lseek(file->fd, cur, SEEK_SET);
+	return ret;
+}
+
+int file_set_read_end(file_t file, glc_utime_t time, glc_utime_t *end_time)
+{
+	glc_index_trailer_t trailer;
+	glc_index_entry_t entry;
+	unsigned int low, high, mid;
+	int ret;
+
+	if ((file->fd < 0) | (!(file->flags & FILE_READING)) |
+	    (!(file->flags & FILE_INFO_VALID)))
+		return EAGAIN;
+
+	if ((ret = file_read_index_trailer(file, &trailer)))
+		return ret;
+
+	/* first entry after time */
+	low = 0;
+	high = trailer.entries;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if ((ret = file_read_index_entry(file, &trailer, mid, &entry)))
+			return ret;
+		if (entry.time <= time)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	file->read_end = 0;
+	if (end_time)
+		*end_time = 0;
+	if (low == trailer.entries)
+		return 0; /* read until eof */
+
+	if ((ret = file_read_index_entry(file, &trailer, low, &entry)))
+		return ret;
+	if (entry.offset > trailer.index_offset)
+		return EINVAL;
+
+	file->read_end = entry.offset;
+	if (end_time)
+		*end_time = entry.time;
+	return 0;
+}
+
+int file_index_span(file_t file, glc_utime_t *first, glc_utime_t *last)
+{
+	glc_index_trailer_t trailer;
+	glc_index_entry_t entry;
+	int ret;
+
+	if ((file->fd < 0) | (!(file->flags & FILE_READING)) |
+	    (!(file->flags & FILE_INFO_VALID)))
+		return EAGAIN;
+
+	if ((ret = file_read_index_trailer(file, &trailer)))
+		return ret;
+
+	if ((ret = file_read_index_entry(file, &trailer, 0, &entry)))
+		return ret;
+	*first = entry.time;
+	if ((ret = file_read_index_entry(file, &trailer, trailer.entries - 1, &entry)))
+		return ret;
+	*last = entry.time;
+	return 0;
+}
+
+int file_read_index_trailer(file_t file, glc_index_trailer_t *trailer)
+{
+	struct stat st;
+	off_t end;
+
+	/* trailer is last in file, read position is kept */
+	if (fstat(file->fd, &st))
+		return errno;
+	end = st.st_size;
+	if ((end < sizeof(glc_index_trailer_t)) ||
+	    (pread(file->fd, trailer, sizeof(glc_index_trailer_t),
+		   end - sizeof(glc_index_trailer_t)) != sizeof(glc_index_trailer_t)) ||
+	    (trailer->signature != GLC_INDEX_SIGNATURE) || (!trailer->entries) ||
+	    (trailer->index_offset + trailer->entries * sizeof(glc_index_entry_t) +
+	     trailer->state_size + sizeof(glc_index_trailer_t) != end)) {
+		glc_log(file->glc, GLC_INFORMATION, "file", "stream has no index");
+		return ENOENT;
+	}
+	return 0;
+}
+
+int file_read_index_entry(file_t file, glc_index_trailer_t *trailer,
+			  unsigned int n, glc_index_entry_t *entry)
+{
+	if (pread(file->fd, entry, sizeof(glc_index_entry_t),
+		  trailer->index_offset + n * sizeof(glc_index_entry_t))
+	    != sizeof(glc_index_entry_t))
+		return EBADMSG;
+	return 0;
+}
+
+int file_open_source(file_t file, const char *filename)
+{
+	int fd, ret = 0;
+	if (file->fd >= 0)
 		return EBUSY;
 
 	glc_log(file->glc, GLC_INFORMATION, "file",
@@ -360,6 +1673,65 @@ int file_open_source(file_t file, const char *filename)
 	return ret;
 }
 
+int file_listen_source(file_t file, const char *address)
+{
+	struct addrinfo hints, *res;
+	char *host, *port;
+	int sock, fd, on = 1, ret;
+
+	if (file->fd >= 0)
+		return EBUSY;
+
+	if ((ret = file_parse_address(address, &host, &port))) {
+		glc_log(file->glc, GLC_ERROR, "file", "invalid address %s", address);
+		return ret;
+	}
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ((ret = getaddrinfo(host[0] ? host : NULL, port, &hints, &res))) {
+		glc_log(file->glc, GLC_ERROR, "file", "can't resolve %s: %s",
+			 address, gai_strerror(ret));
+		ret = EINVAL;
+		goto free;
+	}
+
+	if ((sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1) {
+		ret = errno;
+		goto res;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if ((bind(sock, res->ai_addr, res->ai_addrlen) == -1) ||
+	    (listen(sock, 1) == -1)) {
+		ret = errno;
+		goto sock;
+	}
+
+	glc_log(file->glc, GLC_INFORMATION, "file",
+		 "waiting for stream on port %s", port);
+	while (((fd = accept(sock, NULL, NULL)) == -1) && (errno == EINTR));
+	if (fd == -1) {
+		ret = errno;
+		goto sock;
+	}
+
+	if ((ret = file_set_source(file, fd)))
+		close(fd);
+sock:
+	close(sock);
+res:
+	freeaddrinfo(res);
+free:
+	if (ret)
+		glc_log(file->glc, GLC_ERROR, "file", "can't receive stream: %s (%d)",
+			 strerror(ret), ret);
+	free(host);
+	free(port);
+	return ret;
+}
+
 int file_set_source(file_t file, int fd)
 {
 	if (file->fd >= 0)
@@ -394,6 +1766,39 @@ int file_test_stream_version(u_int32_t version)
 	/* current version is always supported */
 	if (version == GLC_STREAM_VERSION) {
 		return 0;
+	} else if (version == 0x09) {
+		/*
+		 0x0a added GLC_MESSAGE_STATS.
+		*/
+		return 0;
+	} else if (version == 0x08) {
+		/*
+		 0x09 added GLC_MESSAGE_VIDEO_TILES.
+		*/
+		return 0;
+	} else if (version == 0x07) {
+		/*
+		 0x08 added GLC_MESSAGE_AUDIO_LPC.
+		*/
+		return 0;
+	} else if (version == 0x06) {
+		/*
+		 0x07 added seek index trailer after
+		 GLC_MESSAGE_CLOSE.
+		*/
+		return 0;
+	} else if (version == 0x05) {
+		/*
+		 0x06 added GLC_MESSAGE_LZ4, GLC_MESSAGE_ZSTD,
+		 GLC_MESSAGE_VIDEO_DELTA and GLC_MESSAGE_BLOCKS.
+		*/
+		return 0;
+	} else if (version == 0x04) {
+		/*
+		 0x05 added GLC_MESSAGE_VIDEO_REPEAT, otherwise
+		 streams are identical.
+		*/
+		return 0;
 	} else if (version == 0x03) {
 		/*
 		 0.5.5 was last version to use 0x03.
@@ -411,7 +1816,7 @@ int file_read_info(file_t file, glc_stream_info_t *info,
 	if ((file->fd < 0) | (!(file->flags & FILE_READING)))
 		return EAGAIN;
 
-	if (read(file->fd, info, sizeof(glc_stream_info_t)) != sizeof(glc_stream_info_t)) {
+	if (file_read_data(file, info, sizeof(glc_stream_info_t))) {
 		glc_log(file->glc, GLC_ERROR, "file",
 			 "can't read stream info header");
 		return errno;
@@ -435,14 +1840,14 @@ int file_read_info(file_t file, glc_stream_info_t *info,
 
 	if (info->name_size > 0) {
 		*info_name = (char *) malloc(info->name_size);
-		if (read(file->fd, *info_name, info->name_size) != info->name_size)
-			return errno;
+		if (file_read_data(file, *info_name, info->name_size))
+			return EBADMSG;
 	}
 
 	if (info->date_size > 0) {
 		*info_date = (char *) malloc(info->date_size);
-		if (read(file->fd, *info_date, info->date_size) != info->date_size)
-			return errno;
+		if (file_read_data(file, *info_date, info->date_size))
+			return EBADMSG;
 	}
 
 	file->flags |= FILE_INFO_VALID;
@@ -451,12 +1856,14 @@ int file_read_info(file_t file, glc_stream_info_t *info,
 
 int file_read(file_t file, ps_buffer_t *to)
 {
-	int ret = 0;
+	int ret = 0, has_ref = 0, mapped = 0;
 	glc_message_header_t header;
-	size_t packet_size = 0;
+	size_t packet_size = 0, have, skip;
 	ps_packet_t packet;
-	char *dma;
+	char *dma, *seek;
 	glc_size_t glc_ps;
+	glc_shared_ref_t ref;
+	glc_ring_t ring;
 
 	if ((file->fd < 0) | (!(file->flags & FILE_READING)))
 		return EAGAIN;
@@ -475,66 +1882,632 @@ int file_read(file_t file, ps_buffer_t *to)
 	}
 
 	ps_packet_init(&packet, to);
+	ring = glc_ring_lookup(to);
+
+	/* state at seek position */
+	seek = file->seek_state;
+	while (file->seek_state_size >= sizeof(glc_size_t) + sizeof(glc_message_header_t)) {
+		memcpy(&glc_ps, seek, sizeof(glc_size_t));
+		memcpy(&header, &seek[sizeof(glc_size_t)], sizeof(glc_message_header_t));
+		packet_size = sizeof(glc_size_t) + sizeof(glc_message_header_t) + glc_ps;
+		if (packet_size > file->seek_state_size)
+			break;
+
+		if ((ret = ps_packet_open(&packet, PS_PACKET_WRITE)))
+			goto err;
+		if ((ret = ps_packet_write(&packet, &header, sizeof(glc_message_header_t))))
+			goto err;
+		if ((ret = ps_packet_write(&packet, &seek[packet_size - glc_ps], glc_ps)))
+			goto err;
+		if ((ret = ps_packet_close(&packet)))
+			goto err;
+
+		seek += packet_size;
+		file->seek_state_size -= packet_size;
+	}
+	file->seek_state_size = 0;
+
+	/*
+	 Pipes and files that don't fit in address space are read().
+	 Scan touches only first page of each packet and readahead
+	 of the mapping would bring in everything else too.
+	*/
+	if ((file->mmap) && (!file->scan))
+		file_map_source(file);
 
 	do {
+		/* next range starts from here */
+		if ((file->read_end) && (file_read_position(file) >= file->read_end))
+			goto send_close;
+
 		if (file->stream_version == 0x03) {
 			/* old order */
-			if (read(file->fd, &header, sizeof(glc_message_header_t)) != sizeof(glc_message_header_t))
+			if (file_read_data(file, &header, sizeof(glc_message_header_t)))
 				goto send_eof;
-			if (read(file->fd, &glc_ps, sizeof(glc_size_t)) != sizeof(glc_size_t))
+			if (file_read_data(file, &glc_ps, sizeof(glc_size_t)))
 				goto send_eof;
 		} else {
 			/* same header format as in container messages */
-			if (read(file->fd, &glc_ps, sizeof(glc_size_t)) != sizeof(glc_size_t))
+			if (file_read_data(file, &glc_ps, sizeof(glc_size_t)))
 				goto send_eof;
-			if (read(file->fd, &header, sizeof(glc_message_header_t)) != sizeof(glc_message_header_t))
+			if (file_read_data(file, &header, sizeof(glc_message_header_t)))
 				goto send_eof;
 		}
 
 		packet_size = glc_ps;
+		have = skip = 0;
+
+		/* rest of payload is skipped when first bytes carry the header */
+		if ((file->scan) && (packet_size > file->scan)) {
+			if (file_read_data(file, file->scan_data, file->scan))
+				goto read_fail;
+			have = file->scan;
+			if (file_scan_cut(header.type, file->scan_data, have)) {
+				skip = packet_size - have;
+				packet_size = have;
+			}
+		}
 
 		if ((ret = ps_packet_open(&packet, PS_PACKET_WRITE)))
 			goto err;
-		if ((ret = ps_packet_write(&packet, &header, sizeof(glc_message_header_t))))
-			goto err;
-		if ((ret = ps_packet_dma(&packet, (void *) &dma, packet_size, PS_ACCEPT_FAKE_DMA)))
-			goto err;
 
-		if (read(file->fd, dma, packet_size) != packet_size)
-			goto read_fail;
+		mapped = 0;
+		if ((file->map) && (packet_size >= FILE_MAP_REF_MIN)) {
+			/* payload is not copied, reader gets it from the mapping */
+			if ((ret = file_map_ref(file, header.type, packet_size, &ref))) {
+				if (ret == EBADMSG)
+					goto read_fail;
+				goto err;
+			}
+			has_ref = mapped = 1;
+		} else if ((ring) && (packet_size >= GLC_RING_MIN)) {
+			/* payload is read straight into mirrored ring */
+			ret = glc_ring_alloc(ring, header.type, packet_size, 0, &ref);
+			if (!ret) {
+				has_ref = 1;
+				dma = ref.data;
+			} else if (ret != EMSGSIZE)
+				goto err;
+		}
+
+		if (!has_ref) {
+			if ((ret = ps_packet_write(&packet, &header, sizeof(glc_message_header_t))))
+				goto err;
+			if ((ret = ps_packet_dma(&packet, (void *) &dma, packet_size,
+						 PS_ACCEPT_FAKE_DMA)))
+				goto err;
+		}
+
+		if (!mapped) {
+			if (have)
+				memcpy(dma, file->scan_data, have);
+			if (file_read_data(file, &dma[have], packet_size - have))
+				goto read_fail;
+			if ((skip) && (file_skip_data(file, skip)))
+				goto read_fail;
+		}
+
+		if (has_ref) {
+			/* only reference goes to buffer */
+			header.type = GLC_MESSAGE_SHARED_REF;
+			if (!(ret = ps_packet_write(&packet, &header, sizeof(glc_message_header_t))))
+				ret = ps_packet_write(&packet, &ref, sizeof(glc_shared_ref_t));
+			header.type = ref.type;
+			if (ret)
+				goto err;
+		}
 
 		if ((ret = ps_packet_close(&packet)))
 			goto err;
+		has_ref = 0; /* reader releases it */
 	} while ((header.type != GLC_MESSAGE_CLOSE) &&
 		 (!glc_state_test(file->glc, GLC_STATE_CANCEL)));
 
 finish:
 	ps_packet_destroy(&packet);
+	file_unmap_source(file);
 
+	file->read_end = 0;
 	file->flags &= ~(FILE_INFO_READ | FILE_INFO_VALID);
 	return 0;
 
 send_eof:
+	glc_log(file->glc, GLC_ERROR, "file", "unexpected EOF");
+send_close:
 	header.type = GLC_MESSAGE_CLOSE;
 	ps_packet_open(&packet, PS_PACKET_WRITE);
 	ps_packet_write(&packet, &header, sizeof(glc_message_header_t));
 	ps_packet_close(&packet);
-
-	glc_log(file->glc, GLC_ERROR, "file", "unexpected EOF");
 	goto finish;
 
 read_fail:
 	ret = EBADMSG;
 err:
+	if (has_ref)
+		ref.release(ref.arg);
 	if (ret == EINTR)
 		goto finish; /* just cancel */
 
 	glc_log(file->glc, GLC_ERROR, "file", "%s (%d)", strerror(ret), ret);
 	glc_log(file->glc, GLC_DEBUG, "file", "packet size is %zd", packet_size);
 	ps_buffer_cancel(to);
+	file_unmap_source(file);
 
 	file->flags &= ~(FILE_INFO_READ | FILE_INFO_VALID);
 	return ret;
 }
 
+off_t file_read_position(file_t file)
+{
+	if (file->map)
+		return file->map_pos;
+	return lseek(file->fd, 0, SEEK_CUR);
+}
+
+int file_map_source(file_t file)
+{
+	struct file_map_s *map;
+	struct stat st;
+	off_t pos;
+
+	if ((fstat(file->fd, &st)) || (!S_ISREG(st.st_mode)))
+		return ENOTSUP;
+	if ((pos = lseek(file->fd, 0, SEEK_CUR)) == -1)
+		return errno;
+	if ((st.st_size <= pos) || ((unsigned long long) st.st_size > SIZE_MAX))
+		return ENOTSUP;
+
+	if (!(map = (struct file_map_s *) malloc(sizeof(struct file_map_s))))
+		return ENOMEM;
+	memset(map, 0, sizeof(struct file_map_s));
+	map->size = st.st_size;
+	if (!(map->windows = (unsigned int *) calloc(map->size / FILE_MAP_WINDOW + 1,
+						     sizeof(unsigned int)))) {
+		free(map);
+		return ENOMEM;
+	}
+
+	map->data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, file->fd, 0);
+	if (map->data == MAP_FAILED) {
+		glc_log(file->glc, GLC_WARNING, "file",
+			 "can't map stream: %s (%d)", strerror(errno), errno);
+		free(map->windows);
+		free(map);
+		return errno;
+	}
+
+	/* kernel reads ahead aggressively and drops pages behind us */
+	madvise(map->data, map->size, MADV_SEQUENTIAL);
+
+	pthread_mutex_init(&map->mutex, NULL);
+	map->refs = 1;
+	file->map = map;
+
+	file->map_pos = pos;
+	file->map_behind = pos - pos % FILE_MAP_WINDOW;
+	file->map_ahead = file->map_behind;
+
+	glc_log(file->glc, GLC_DEBUG, "file", "reading mapped stream");
+	return 0;
+}
+
+void file_unmap_source(file_t file)
+{
+	if (!file->map)
+		return;
+
+	/* leave descriptor where reading stopped */
+	lseek(file->fd, file->map_pos, SEEK_SET);
+	file_map_put(file->map);
+	file->map = NULL;
+}
+
+void file_map_put(struct file_map_s *map)
+{
+	unsigned int refs;
+
+	pthread_mutex_lock(&map->mutex);
+	refs = --map->refs;
+	pthread_mutex_unlock(&map->mutex);
+
+	if (refs)
+		return;
+
+	munmap(map->data, map->size);
+	pthread_mutex_destroy(&map->mutex);
+	free(map->windows);
+	free(map);
+}
+
+void file_map_prefetch(file_t file, size_t size)
+{
+	size_t ahead;
+
+	/* next window is prefetched while this one is being used */
+	if ((file->map_ahead < file->map->size) &&
+	    (file->map_pos + size + FILE_MAP_WINDOW > file->map_ahead)) {
+		ahead = file->map_pos + size + FILE_MAP_WINDOW;
+		ahead += FILE_MAP_WINDOW - ahead % FILE_MAP_WINDOW;
+		if (ahead > file->map->size)
+			ahead = file->map->size;
+		madvise(&file->map->data[file->map_ahead], ahead - file->map_ahead,
+			MADV_WILLNEED);
+		file->map_ahead = ahead;
+	}
+}
+
+void file_map_advance(file_t file, size_t size)
+{
+	struct file_map_s *map = file->map;
+
+	file->map_pos += size;
+
+	/*
+	 Whole windows behind read position are not needed anymore,
+	 unless a packet that hasn't been released points into them.
+	*/
+	pthread_mutex_lock(&map->mutex);
+	while ((file->map_pos - file->map_behind >= 2 * FILE_MAP_WINDOW) &&
+	       (!map->windows[file->map_behind / FILE_MAP_WINDOW])) {
+		madvise(&map->data[file->map_behind], FILE_MAP_WINDOW, MADV_DONTNEED);
+		file->map_behind += FILE_MAP_WINDOW;
+	}
+	pthread_mutex_unlock(&map->mutex);
+}
+
+int file_map_ref(file_t file, glc_message_type_t type, size_t size, glc_shared_ref_t *ref)
+{
+	struct file_map_s *map = file->map;
+	struct file_map_ref_s *map_ref;
+	size_t w;
+
+	if (size > map->size - file->map_pos)
+		return EBADMSG;
+	if (!(map_ref = (struct file_map_ref_s *) malloc(sizeof(struct file_map_ref_s))))
+		return ENOMEM;
+
+	file_map_prefetch(file, size);
+
+	map_ref->map = map;
+	map_ref->first = file->map_pos / FILE_MAP_WINDOW;
+	map_ref->last = (file->map_pos + size - 1) / FILE_MAP_WINDOW;
+
+	pthread_mutex_lock(&map->mutex);
+	map->refs++;
+	for (w = map_ref->first; w <= map_ref->last; w++)
+		map->windows[w]++;
+	pthread_mutex_unlock(&map->mutex);
+
+	ref->type = type;
+	ref->data = (char *) &map->data[file->map_pos];
+	ref->size = size;
+	ref->release = &file_map_release;
+	ref->arg = map_ref;
+
+	file_map_advance(file, size);
+	return 0;
+}
+
+void file_map_release(void *arg)
+{
+	struct file_map_ref_s *map_ref = (struct file_map_ref_s *) arg;
+	struct file_map_s *map = map_ref->map;
+	size_t w;
+
+	pthread_mutex_lock(&map->mutex);
+	for (w = map_ref->first; w <= map_ref->last; w++)
+		map->windows[w]--;
+	pthread_mutex_unlock(&map->mutex);
+
+	/* last reference unmaps, even after file_read() has returned */
+	file_map_put(map);
+	free(map_ref);
+}
+
+int file_read_data(file_t file, void *data, size_t size)
+{
+	ssize_t got;
+
+	/* sockets and pipes return what they have */
+	while ((!file->map) && (size > 0)) {
+		if ((got = read(file->fd, data, size)) <= 0) {
+			if ((got < 0) && (errno == EINTR))
+				continue;
+			return EBADMSG;
+		}
+		data = (char *) data + got;
+		size -= got;
+	}
+	if (!file->map)
+		return 0;
+
+	if (size > file->map->size - file->map_pos)
+		return EBADMSG;
+
+	file_map_prefetch(file, size);
+	memcpy(data, &file->map->data[file->map_pos], size);
+	file_map_advance(file, size);
+
+	return 0;
+}
+
+int file_skip_data(file_t file, size_t size)
+{
+	char scrap[FILE_ALIGN];
+	size_t len;
+
+	if (file->map) {
+		if (size > file->map->size - file->map_pos)
+			return EBADMSG;
+		file_map_advance(file, size);
+		return 0;
+	}
+
+	/* skipping past end is noticed when next header is read */
+	if (lseek(file->fd, size, SEEK_CUR) != -1)
+		return 0;
+	if (errno != ESPIPE)
+		return errno;
+
+	/* pipes and sockets are read through */
+	while (size > 0) {
+		len = size < sizeof(scrap) ? size : sizeof(scrap);
+		if (file_read_data(file, scrap, len))
+			return EBADMSG;
+		size -= len;
+	}
+
+	return 0;
+}
+
+int file_scan_cut(glc_message_type_t type, const char *data, size_t size)
+{
+	glc_blocks_header_t *blocks = (glc_blocks_header_t *) data;
+	glc_message_type_t original;
+
+	/* header is stored as is */
+	if ((type == GLC_MESSAGE_VIDEO_FRAME) |
+	    (type == GLC_MESSAGE_VIDEO_DELTA) |
+	    (type == GLC_MESSAGE_VIDEO_TILES) |
+	    (type == GLC_MESSAGE_AUDIO_DATA) |
+	    (type == GLC_MESSAGE_AUDIO_LPC))
+		return 1;
+
+	/*
+	 unpack can decode first bytes of these from a prefix, QuickLZ
+	 and Zstandard need whole packet. Codec headers share layout.
+	*/
+	if ((type == GLC_MESSAGE_LZO) |
+	    (type == GLC_MESSAGE_LZJB) |
+	    (type == GLC_MESSAGE_LZ4)) {
+		if (size < sizeof(glc_lz4_header_t))
+			return 0;
+		original = ((glc_lz4_header_t *) data)->header.type;
+	} else if (type == GLC_MESSAGE_BLOCKS) {
+		if ((size < sizeof(glc_blocks_header_t)) ||
+		    (sizeof(glc_blocks_header_t) + blocks->blocks * sizeof(u_int32_t) > size))
+			return 0;
+		if ((blocks->compression != GLC_MESSAGE_LZO) &&
+		    (blocks->compression != GLC_MESSAGE_LZJB) &&
+		    (blocks->compression != GLC_MESSAGE_LZ4))
+			return 0;
+		original = blocks->header.type;
+	} else
+		return 0;
+
+	return (original == GLC_MESSAGE_VIDEO_FRAME) |
+	       (original == GLC_MESSAGE_VIDEO_DELTA) |
+	       (original == GLC_MESSAGE_AUDIO_DATA);
+}
+
+int file_parse_address(const char *address, char **host, char **port)
+{
+	const char *sep;
+
+	/* [v6 address]:port or host:port */
+	if (address[0] == '[') {
+		if (!(sep = strstr(address, "]:")))
+			return EINVAL;
+		*host = strndup(&address[1], sep - &address[1]);
+		sep++;
+	} else {
+		if (!(sep = strrchr(address, ':')))
+			return EINVAL;
+		*host = strndup(address, sep - address);
+	}
+
+	if (!sep[1]) {
+		free(*host);
+		return EINVAL;
+	}
+	*port = strdup(&sep[1]);
+	return 0;
+}
+
+int file_net_connect(file_t file, int *fd)
+{
+	struct addrinfo hints, *res, *addr;
+	struct pollfd pfd;
+	socklen_t len;
+	int on = 1, ret, err;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((ret = getaddrinfo(file->net_host, file->net_port, &hints, &res))) {
+		glc_log(file->glc, GLC_ERROR, "file", "can't resolve %s: %s",
+			 file->net_host, gai_strerror(ret));
+		return EHOSTUNREACH;
+	}
+
+	ret = ECONNREFUSED;
+	for (addr = res; addr != NULL; addr = addr->ai_next) {
+		if ((*fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK,
+				  addr->ai_protocol)) == -1) {
+			ret = errno;
+			continue;
+		}
+
+		/* unreachable receiver must not hang file thread for minutes */
+		if (connect(*fd, addr->ai_addr, addr->ai_addrlen) == -1) {
+			if (errno != EINPROGRESS) {
+				ret = errno;
+				close(*fd);
+				continue;
+			}
+
+			pfd.fd = *fd;
+			pfd.events = POLLOUT;
+			len = sizeof(err);
+			if (poll(&pfd, 1, FILE_NET_RETRY / 1000) <= 0)
+				err = ETIMEDOUT;
+			else if (getsockopt(*fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+				err = errno;
+			if (err) {
+				ret = err;
+				close(*fd);
+				continue;
+			}
+		}
+
+		/* writes block, which is what gives backpressure */
+		fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) & ~O_NONBLOCK);
+		/* data is already batched */
+		setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		ret = 0;
+		break;
+	}
+
+	freeaddrinfo(res);
+	return ret;
+}
+
+int file_net_reconnect(file_t file)
+{
+	int fd, ret;
+
+	if ((ret = file_net_connect(file, &fd))) {
+		file->net_retry = glc_time(file->glc) + FILE_NET_RETRY;
+		return ret;
+	}
+
+	if ((ret = file_attach_target(file, fd))) {
+		close(fd);
+		file->net_retry = glc_time(file->glc) + FILE_NET_RETRY;
+		return ret;
+	}
+	file->flags &= ~FILE_NET_DOWN;
+	glc_log(file->glc, GLC_INFORMATION, "file", "reconnected to %s", file->net_host);
+
+	/* receiver sees a new stream */
+	file->flags &= ~FILE_RUNNING;
+	if (!(ret = file_write_info(file, &file->info, file->info_name, file->info_date)))
+		ret = file_write_state(file);
+	file->flags |= FILE_RUNNING;
+	return ret;
+}
+
+void file_net_lost(file_t file, int err)
+{
+	glc_log(file->glc, GLC_WARNING, "file",
+		 "lost connection to %s: %s (%d), dropping stream until it is back",
+		 file->net_host, strerror(err), err);
+
+	close(file->fd);
+	file->fd = -1;
+	file->buffered = 0;
+#ifdef FILE_ZEROCOPY
+	file->net_zerocopy = 0;
+#endif
+	file->flags |= FILE_NET_DOWN;
+	file->net_retry = glc_time(file->glc) + FILE_NET_RETRY;
+}
+
+int file_net_send(file_t file, struct iovec *iov, int iovcnt, int zerocopy)
+{
+	struct msghdr msg;
+	ssize_t sent;
+	int flags = MSG_NOSIGNAL;
+
+#ifdef FILE_ZEROCOPY
+	if (zerocopy)
+		flags |= MSG_ZEROCOPY;
+#endif
+
+	memset(&msg, 0, sizeof(struct msghdr));
+	while (iovcnt > 0) {
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		if ((sent = sendmsg(file->fd, &msg, flags)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+#ifdef FILE_ZEROCOPY
+		/* every successful zerocopy send gets its own completion */
+		if (zerocopy)
+			file->net_sent++;
+#endif
+
+		while ((iovcnt > 0) && (sent >= iov->iov_len)) {
+			sent -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + sent;
+			iov->iov_len -= sent;
+		}
+	}
+
+	return 0;
+}
+
+int file_net_reap(file_t file, int wait)
+{
+#ifdef FILE_ZEROCOPY
+	struct sock_extended_err *err;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct pollfd pfd;
+	char control[128];
+
+	/* completions arrive on error queue, as ranges of send numbers */
+	while ((int) (wait - file->net_done) > 0) {
+		memset(&msg, 0, sizeof(struct msghdr));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(file->fd, &msg, MSG_ERRQUEUE) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return errno;
+
+			pfd.fd = file->fd;
+			pfd.events = 0;
+			if (poll(&pfd, 1, FILE_NET_RETRY / 1000) <= 0)
+				return ETIMEDOUT;
+			continue;
+		}
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			err = (struct sock_extended_err *) CMSG_DATA(cmsg);
+			if ((err->ee_errno != 0) || (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+				continue;
+			if ((int) (err->ee_data + 1 - file->net_done) > 0)
+				file->net_done = err->ee_data + 1;
+
+			/* kernel had to copy anyway, eg. loopback */
+			if ((err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && (file->net_zerocopy)) {
+				glc_log(file->glc, GLC_DEBUG, "file",
+					 "MSG_ZEROCOPY falls back to copying, not using it");
+				file->net_zerocopy = 0;
+			}
+		}
+	}
+#endif
+	return 0;
+}
+
 /**  \} */
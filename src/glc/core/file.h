@@ -82,6 +82,77 @@ __PUBLIC int file_init(file_t *file, glc_t *glc);
  */
 __PUBLIC int file_set_sync(file_t file, int sync);
 
+/**
+ * \brief set write staging buffer size
+ *
+ * Messages are collected to an aligned staging buffer and
+ * written a full buffer at a time. Messages that don't fit are
+ * written together with staged data with one writev(). Without
+ * buffer every message is written with one writev().
+ * \note this must be set before opening file
+ * \param file file object
+ * \param size buffer size, rounded up to 4 KiB, 0 disables buffer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_write_buffer(file_t file, size_t size);
+
+/**
+ * \brief set how long data may stay in staging buffer
+ *
+ * Buffer is also flushed when it fills up and when target is
+ * closed. In sync mode each flush is written through to device,
+ * so interval sets how much data can be lost.
+ * \param file file object
+ * \param interval interval in microseconds, 0 flushes only full buffer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_flush_interval(file_t file, glc_utime_t interval);
+
+/**
+ * \brief write with O_DIRECT
+ *
+ * Data bypasses page cache, so long captures don't push out
+ * everything else. Requires staging buffer, and only full
+ * 4 KiB blocks are written until target is closed.
+ * \note this must be set before opening file
+ * \param file file object
+ * \param direct 0 = page cache, 1 = O_DIRECT
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_direct(file_t file, int direct);
+
+/**
+ * \brief write staging buffers with io_uring
+ *
+ * File thread fills next staging buffer while previous ones are
+ * being written, so slow writes stall capture only when all
+ * buffers are in flight. Packets are copied into buffers, so
+ * they are released immediately. Falls back to blocking writes
+ * if io_uring is not available or target is not seekable.
+ * Requires staging buffer, see file_set_write_buffer().
+ * \note this must be set before opening file
+ * \param file file object
+ * \param buffers number of staging buffers, at most 16, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_uring(file_t file, unsigned int buffers);
+
+/**
+ * \brief write seek index
+ *
+ * Every interval an index entry pointing to next packet and
+ * a snapshot of stream state is recorded. Index is written
+ * after end of stream when target is closed, so only streams
+ * ended with file_write_eof() get one. Entries point to video
+ * key frames, where decoding can start, and carry their stream
+ * id and time. Compressed packets are known only if pack stamps
+ * them, see pack_set_stamp().
+ * \param file file object
+ * \param interval interval in microseconds, 0 disables index
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_index(file_t file, glc_utime_t interval);
+
 /**
  * \brief set callback function
  * Callback is called when callback_request message is encountered
@@ -112,6 +183,23 @@ __PUBLIC int file_open_target(file_t file, const char *filename);
  */
 __PUBLIC int file_set_target(file_t file, int fd);
 
+/**
+ * \brief connect to stream receiver
+ *
+ * Stream is sent over TCP in the same format as it would be
+ * written to a file, batched through write buffer. Sends block
+ * when receiver or network can't keep up, so buffers before file
+ * fill up as they would with slow disk. If connection breaks,
+ * stream is dropped and connection retried every second; after
+ * reconnecting stream information and state are sent again, so
+ * receiver gets a complete stream.
+ * \note index, O_DIRECT and io_uring are not used with network target
+ * \param file file object
+ * \param address receiver address, "host:port" or "[v6 address]:port"
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_connect_target(file_t file, const char *address);
+
 /**
  * \brief close target file descriptor
  * \param file file object
@@ -130,6 +218,21 @@ __PUBLIC int file_close_target(file_t file);
 __PUBLIC int file_write_info(file_t file, glc_stream_info_t *info,
 			     const char *info_name, const char *info_date);
 
+/**
+ * \brief write single message
+ *
+ * For writers that don't run file process. Message is written,
+ * tracked and indexed as if it had arrived to file process.
+ * Output is not split into segments.
+ * \param file file object
+ * \param header message header
+ * \param message message
+ * \param message_size message size
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_write_packet(file_t file, glc_message_header_t *header,
+			       void *message, size_t message_size);
+
 /**
  * \brief write EOF message to file
  * \param file file object
@@ -179,6 +282,17 @@ __PUBLIC int file_open_source(file_t file, const char *filename);
  */
 __PUBLIC int file_set_source(file_t file, int fd);
 
+/**
+ * \brief receive stream over network
+ *
+ * Waits for one connection from file_connect_target() and reads
+ * stream from it.
+ * \param file file object
+ * \param address local address to listen on, "host:port" or ":port"
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_listen_source(file_t file, const char *address);
+
 /**
  * \brief close source file
  * \param file file object
@@ -214,6 +328,96 @@ __PUBLIC int file_test_stream_version(u_int32_t version);
  */
 __PUBLIC int file_read(file_t file, ps_buffer_t *to);
 
+/**
+ * \brief read source through memory mapping
+ *
+ * Regular files are mapped read-only. Large packets are not
+ * copied at all: target buffer gets GLC_MESSAGE_SHARED_REF
+ * messages pointing into the mapping, which glc_thread readers
+ * unwrap transparently. Mapping stays alive until the last of
+ * these is released. Headers and small packets are copied
+ * straight from page cache. Mapping is read sequentially with
+ * kernel readahead hints and released behind read position
+ * once no packet points there. Source that can't be mapped is
+ * read normally.
+ * \param file file object
+ * \param mmap 1 enables, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_mmap(file_t file, int mmap);
+
+/**
+ * \brief read only headers of pictures and audio
+ *
+ * Only first size bytes of picture and audio packets are read
+ * and the rest is skipped with lseek(). Packets are passed on
+ * truncated, so this is meant for unpack_set_scan() and info.
+ * Compressed packets are cut only if unpack can decode header
+ * from a prefix, QuickLZ and Zstandard are read whole.
+ * \param file file object
+ * \param size bytes to read from each packet, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_scan(file_t file, size_t size);
+
+/**
+ * \brief split output into segments
+ *
+ * When segment has grown to size or has covered time, writing
+ * continues to next segment. Each segment is a complete stream
+ * that starts with stream information and current stream state.
+ * Segment 0 is the file given to file_open_target(); '%segment%'
+ * in its name is replaced with segment number, otherwise
+ * later segments get number as suffix.
+ *
+ * Next segment is opened, locked and preallocated with fallocate()
+ * in a background thread while current one is being written.
+ * \note this works only with file_open_target()
+ * \param file file object
+ * \param size segment size in bytes, 0 disables size limit
+ * \param time segment duration in microseconds, 0 disables time limit
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_set_segment(file_t file, glc_size_t size, glc_utime_t time);
+
+/**
+ * \brief move read position to given stream time
+ *
+ * Finds last index entry not after time with binary search
+ * and moves there. file_read() then sends stream state at that
+ * position before continuing from there.
+ * \note this must be called after file_read_info() and before file_read()
+ * \param file file object
+ * \param time stream time in microseconds
+ * \param seek_time time of index entry, may be NULL
+ * \return 0 on success, ENOENT if stream has no index, otherwise an error code
+ */
+__PUBLIC int file_seek_time(file_t file, glc_utime_t time, glc_utime_t *seek_time);
+
+/**
+ * \brief stop reading at index entry after given stream time
+ *
+ * file_read() sends close message and returns when it reaches
+ * first index entry after time, which is where a range started
+ * with file_seek_time() at that entry's time would begin. If
+ * there is no such entry, stream is read until eof.
+ * \note this must be called after file_read_info() and before file_read()
+ * \param file file object
+ * \param time stream time in microseconds
+ * \param end_time time of index entry, 0 if read until eof, may be NULL
+ * \return 0 on success, ENOENT if stream has no index, otherwise an error code
+ */
+__PUBLIC int file_set_read_end(file_t file, glc_utime_t time, glc_utime_t *end_time);
+
+/**
+ * \brief get times of first and last index entry
+ * \param file file object
+ * \param first time of first entry
+ * \param last time of last entry
+ * \return 0 on success, ENOENT if stream has no index, otherwise an error code
+ */
+__PUBLIC int file_index_span(file_t file, glc_utime_t *first, glc_utime_t *last);
+
 /**
  * \brief destroy file object
  * \param file file object
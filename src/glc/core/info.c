@@ -32,6 +32,8 @@
 #define INFO_AUDIO_DETAILED         5
 #define INFO_PICTURE                5
 #define INFO_DETAILED_PICTURE       6
+#define INFO_STATS                  3
+#define INFO_DETAILED_STATS         4
 
 struct info_video_stream_s {
 	glc_stream_id_t id;
@@ -40,6 +42,7 @@ struct info_video_stream_s {
 	unsigned int w, h;
 
 	unsigned long pictures;
+	unsigned long repeats;
 	size_t bytes;
 
 	unsigned long fps;
@@ -67,6 +70,10 @@ struct info_s {
 
 	struct info_video_stream_s *video_list;
 	struct info_audio_stream_s *audio_list;
+
+	/* last GLC_MESSAGE_STATS */
+	unsigned long stats_messages;
+	glc_stats_message_t *stats;
 };
 
 int info_get_video_stream(info_t info, struct info_video_stream_s **video,
@@ -79,9 +86,13 @@ int info_read_callback();
 
 void video_format_info(info_t info, glc_video_format_message_t *video_message);
 void video_frame_info(info_t info, glc_video_frame_header_t *pic_header);
+void video_repeat_info(info_t info, glc_video_frame_header_t *pic_header);
 void audio_format_info(info_t info, glc_audio_format_message_t *fmt_message);
 void audio_data_info(info_t info, glc_audio_data_header_t *audio_header);
 void color_info(info_t info, glc_color_message_t *color_msg);
+void stats_info(info_t info, glc_stats_message_t *stats_msg, size_t size);
+void stats_summary(info_t info);
+glc_stats_stage_t *stats_stage(glc_stats_message_t *stats_msg, const char *name);
 
 void print_time(FILE *stream, glc_utime_t time);
 void print_bytes(FILE *stream, size_t bytes);
@@ -103,12 +114,14 @@ int info_init(info_t *info, glc_t *glc)
 	(*info)->thread.read_callback = &info_read_callback;
 	(*info)->thread.finish_callback = &info_finish_callback;
 	(*info)->thread.threads = 1;
+	(*info)->thread.name = "info";
 
 	return 0;
 }
 
 int info_destroy(info_t info)
 {
+	free(info->stats);
 	free(info);
 	return 0;
 }
@@ -168,6 +181,7 @@ void info_finish_callback(void *ptr, int err)
 
 		fprintf(info->stream, "video stream %d\n", video->id);
 		fprintf(info->stream, "  frames      = %lu\n", video->pictures);
+		fprintf(info->stream, "  repeated    = %lu\n", video->repeats);
 		fprintf(info->stream, "  fps         = %04.2f\n",
 		       (double) (video->pictures * 1000000) / (double) (info->time));
 		fprintf(info->stream, "  bytes       = ");
@@ -193,6 +207,9 @@ void info_finish_callback(void *ptr, int err)
 
 		free(audio);
 	}
+
+	if (info->stats)
+		stats_summary(info);
 }
 
 int info_read_callback(glc_thread_state_t *state)
@@ -203,12 +220,16 @@ int info_read_callback(glc_thread_state_t *state)
 		video_format_info(info, (glc_video_format_message_t *) state->read_data);
 	else if (state->header.type == GLC_MESSAGE_VIDEO_FRAME)
 		video_frame_info(info, (glc_video_frame_header_t *) state->read_data);
+	else if (state->header.type == GLC_MESSAGE_VIDEO_REPEAT)
+		video_repeat_info(info, (glc_video_frame_header_t *) state->read_data);
 	else if (state->header.type == GLC_MESSAGE_AUDIO_FORMAT)
 		audio_format_info(info, (glc_audio_format_message_t *) state->read_data);
 	else if (state->header.type == GLC_MESSAGE_AUDIO_DATA)
 		audio_data_info(info, (glc_audio_data_header_t *) state->read_data);
 	else if (state->header.type == GLC_MESSAGE_COLOR)
 		color_info(info, (glc_color_message_t *) state->read_data);
+	else if (state->header.type == GLC_MESSAGE_STATS)
+		stats_info(info, (glc_stats_message_t *) state->read_data, state->read_size);
 	else if (state->header.type == GLC_MESSAGE_CLOSE) {
 		print_time(info->stream, info->time);
 		fprintf(info->stream, "end of stream\n");
@@ -303,6 +324,9 @@ void video_format_info(info_t info, glc_video_format_message_t *format_message)
 			case GLC_VIDEO_YCBCR_420JPEG:
 				fprintf(info->stream, "GLC_VIDEO_YCBCR_420JPEG\n");
 				break;
+			case GLC_VIDEO_NV12:
+				fprintf(info->stream, "GLC_VIDEO_NV12\n");
+				break;
 			default:
 				fprintf(info->stream, "unknown format 0x%02x\n", video->format);
 		}
@@ -345,7 +369,8 @@ void video_frame_info(info_t info, glc_video_frame_header_t *pic_header)
 		video->bytes += video->w * video->h * 4;
 		if (video->flags & GLC_VIDEO_DWORD_ALIGNED)
 			video->bytes += video->h * (8 - (video->w * 4) % 8);
-	} else if (video->format == GLC_VIDEO_YCBCR_420JPEG)
+	} else if ((video->format == GLC_VIDEO_YCBCR_420JPEG) |
+		   (video->format == GLC_VIDEO_NV12))
 		video->bytes += (video->w * video->h * 3) / 2;
 
 	if ((info->level >= INFO_FPS) && (pic_header->time - video->fps_time >= 1000000)) {
@@ -358,6 +383,30 @@ void video_frame_info(info_t info, glc_video_frame_header_t *pic_header)
 	}
 }
 
+void video_repeat_info(info_t info, glc_video_frame_header_t *pic_header)
+{
+	struct info_video_stream_s *video;
+	info->time = pic_header->time;
+
+	info_get_video_stream(info, &video, pic_header->id);
+
+	if (info->level >= INFO_DETAILED_PICTURE) {
+		print_time(info->stream, info->time);
+		fprintf(info->stream, "repeated picture\n");
+
+		fprintf(info->stream, "  stream id   = %d\n", pic_header->id);
+		fprintf(info->stream, "  time        = %lu\n", pic_header->time);
+	} else if (info->level >= INFO_PICTURE) {
+		print_time(info->stream, info->time);
+		fprintf(info->stream, "repeated picture (video %d)\n", pic_header->id);
+	}
+
+	/* repeated pictures count as frames but carry no data */
+	video->pictures++;
+	video->repeats++;
+	video->fps++;
+}
+
 void audio_format_info(info_t info, glc_audio_format_message_t *fmt_message)
 {
 	INFO_FLAGS
@@ -426,6 +475,102 @@ void color_info(info_t info, glc_color_message_t *color_msg)
 		fprintf(info->stream, "color correction information for video %d\n", color_msg->id);
 }
 
+glc_stats_stage_t *stats_stage(glc_stats_message_t *stats_msg, const char *name)
+{
+	glc_stats_stage_t *stage = (glc_stats_stage_t *) &stats_msg[1];
+	u_int32_t i;
+
+	for (i = 0; i < stats_msg->stages; i++) {
+		if (!strncmp(stage[i].name, name, GLC_STATS_NAME_LEN))
+			return &stage[i];
+	}
+
+	return NULL;
+}
+
+void stats_info(info_t info, glc_stats_message_t *stats_msg, size_t size)
+{
+	glc_stats_stage_t *stage = (glc_stats_stage_t *) &stats_msg[1];
+	glc_stats_stage_t *prev, *pack;
+	glc_utime_t elapsed;
+	u_int64_t dropped = 0;
+	double sec;
+	u_int32_t i;
+
+	if ((size < sizeof(glc_stats_message_t)) ||
+	    (size < sizeof(glc_stats_message_t) + stats_msg->stages * sizeof(glc_stats_stage_t))) {
+		print_time(info->stream, info->time);
+		fprintf(info->stream, "error: truncated statistics message\n");
+		return;
+	}
+
+	/* timeline shows changes since previous message */
+	if ((info->stats) && (stats_msg->time > info->stats->time)) {
+		elapsed = stats_msg->time - info->stats->time;
+		dropped = stats_msg->video_dropped - info->stats->video_dropped;
+	} else
+		elapsed = stats_msg->time;
+	sec = elapsed ? (double) elapsed / 1000000.0 : 1.0;
+
+	info->time = stats_msg->time;
+	if (info->level >= INFO_STATS) {
+		print_time(info->stream, info->time);
+		fprintf(info->stream, "statistics: %lu frames dropped (+%lu), %lu audio chunks dropped",
+			stats_msg->video_dropped, dropped, stats_msg->audio_dropped);
+		if (((pack = stats_stage(stats_msg, "pack"))) && (pack->read_bytes))
+			fprintf(info->stream, ", compression %.3f",
+				(double) pack->write_bytes / (double) pack->read_bytes);
+		fprintf(info->stream, "\n");
+	}
+
+	if (info->level >= INFO_DETAILED_STATS) {
+		for (i = 0; i < stats_msg->stages; i++) {
+			prev = info->stats ? stats_stage(info->stats, stage[i].name) : NULL;
+			fprintf(info->stream, "  %-11.*s = %.1f packets/s, %.2f MiB/s in, %.2f MiB/s out, "
+				"%.1f ms/s in callbacks",
+				GLC_STATS_NAME_LEN, stage[i].name,
+				(double) (stage[i].packets - (prev ? prev->packets : 0)) / sec,
+				(double) (stage[i].read_bytes - (prev ? prev->read_bytes : 0)) /
+					(1024.0 * 1024.0 * sec),
+				(double) (stage[i].write_bytes - (prev ? prev->write_bytes : 0)) /
+					(1024.0 * 1024.0 * sec),
+				(double) (stage[i].callback - (prev ? prev->callback : 0)) /
+					(1000.0 * sec));
+			if (stage[i].queued >= 0)
+				fprintf(info->stream, ", %.2f MiB queued",
+					(double) stage[i].queued / (1024.0 * 1024.0));
+			fprintf(info->stream, "\n");
+		}
+	}
+
+	info->stats_messages++;
+	free(info->stats);
+	info->stats = (glc_stats_message_t *) malloc(size);
+	memcpy(info->stats, stats_msg, size);
+}
+
+void stats_summary(info_t info)
+{
+	glc_stats_stage_t *stage = (glc_stats_stage_t *) &info->stats[1];
+	glc_stats_stage_t *pack;
+	u_int32_t i;
+
+	fprintf(info->stream, "capture statistics\n");
+	fprintf(info->stream, "  messages    = %lu\n", info->stats_messages);
+	fprintf(info->stream, "  dropped     = %lu frames\n", info->stats->video_dropped);
+	fprintf(info->stream, "  audio drops = %lu chunks, ", info->stats->audio_dropped);
+	print_bytes(info->stream, info->stats->audio_dropped_bytes);
+	if (((pack = stats_stage(info->stats, "pack"))) && (pack->read_bytes))
+		fprintf(info->stream, "  compression = %.3f\n",
+			(double) pack->write_bytes / (double) pack->read_bytes);
+
+	for (i = 0; i < info->stats->stages; i++) {
+		fprintf(info->stream, "  %-11.*s = %lu packets, ",
+			GLC_STATS_NAME_LEN, stage[i].name, stage[i].packets);
+		print_bytes(info->stream, stage[i].read_bytes);
+	}
+}
+
 /*
 void stream_info(info_t info)
 {
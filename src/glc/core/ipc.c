@@ -0,0 +1,860 @@
+/**
+ * \file glc/core/ipc.c
+ * \brief shared memory transport between capture and glc-daemon
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup ipc
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <packetstream.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include <glc/common/glc.h>
+#include <glc/common/core.h>
+#include <glc/common/log.h>
+#include <glc/common/state.h>
+#include <glc/common/thread.h>
+#include <glc/common/util.h>
+
+#include "ipc.h"
+
+#define IPC_CONNECTED       0x1
+#define IPC_RUNNING         0x2
+#define IPC_LISTENING       0x4
+#define IPC_READING         0x8
+
+/* 'GIPC' */
+#define IPC_SIGNATURE       0x43504947
+#define IPC_VERSION         0x1
+/* cancel and stop are checked this often while waiting */
+#define IPC_WAIT_MS         100
+/* messages start at this alignment in ring */
+#define IPC_ALIGN           8
+#define IPC_NAME_LEN        64
+
+#define IPC_MESSAGE_SIZE(size) \
+	((sizeof(glc_size_t) + sizeof(glc_message_header_t) + (size) + IPC_ALIGN - 1) & \
+	 ~((size_t) IPC_ALIGN - 1))
+
+/**
+ * \brief ring control, first page of shared memory
+ *
+ * Data follows at next page and is mapped twice, so messages
+ * are always contiguous. head is written only by client and
+ * tail only by daemon, both run freely and position in data is
+ * taken modulo size. Each side sets its waiting flag before
+ * sleeping, and the other side signals only if it was set.
+ */
+struct ipc_ring_s {
+	u_int32_t signature;
+	u_int32_t version;
+	u_int64_t size;
+
+	u_int64_t head __attribute__((aligned(64)));
+	u_int32_t reader_waiting;
+
+	u_int64_t tail __attribute__((aligned(64)));
+	u_int32_t writer_waiting;
+};
+
+/* sent by client with memfd, data eventfd and space eventfd */
+struct ipc_hello_s {
+	u_int32_t pid;
+	glc_utime_t time;
+	u_int64_t size;
+	char name[IPC_NAME_LEN];
+} __attribute__((packed));
+
+struct ipc_map_s {
+	struct ipc_ring_s *ring;
+	char *data;
+	size_t size;
+	size_t map_size;
+	int data_fd, space_fd;
+};
+
+struct ipc_client_s {
+	ipc_t ipc;
+	unsigned int num;
+	int sock;
+	struct ipc_map_s map;
+	glc_stime_t time_offset;
+
+	/* global ids, indexed by client's id */
+	glc_stream_id_t *video, *audio;
+	unsigned int videos, audios;
+
+	pthread_t thread;
+	int done;
+	struct ipc_client_s *next;
+};
+
+struct ipc_s {
+	glc_t *glc;
+	glc_flags_t flags;
+	size_t ring_size;
+
+	/* client */
+	int sock;
+	struct ipc_map_s map;
+	glc_thread_t thread;
+
+	/* daemon */
+	int listen_sock;
+	char *path;
+	ps_buffer_t *to;
+	pthread_t accept_thread;
+	struct ipc_client_s *clients;
+	unsigned int client_count;
+	int stop;
+};
+
+int ipc_map(struct ipc_map_s *map, int memfd, size_t size);
+void ipc_unmap(struct ipc_map_s *map);
+int ipc_wait(glc_t *glc, int fd, int sock);
+void ipc_signal(int fd);
+
+int ipc_write_callback(glc_thread_state_t *state);
+int ipc_push(ipc_t ipc, glc_message_header_t *header, char *data, size_t size);
+
+void *ipc_accept_thread(void *argptr);
+int ipc_client_add(ipc_t ipc, int sock);
+void ipc_client_reap(ipc_t ipc, int all);
+void *ipc_client_thread(void *argptr);
+int ipc_client_forward(struct ipc_client_s *client, ps_packet_t *packet,
+		       glc_message_header_t *header, char *data, size_t size);
+glc_stream_id_t ipc_client_video(struct ipc_client_s *client, glc_stream_id_t id);
+glc_stream_id_t ipc_client_audio(struct ipc_client_s *client, glc_stream_id_t id);
+
+int ipc_init(ipc_t *ipc, glc_t *glc)
+{
+	*ipc = (ipc_t) malloc(sizeof(struct ipc_s));
+	memset(*ipc, 0, sizeof(struct ipc_s));
+
+	(*ipc)->glc = glc;
+	(*ipc)->ring_size = 32 * 1024 * 1024;
+	(*ipc)->sock = (*ipc)->listen_sock = -1;
+	(*ipc)->map.data_fd = (*ipc)->map.space_fd = -1;
+
+	(*ipc)->thread.flags = GLC_THREAD_READ;
+	(*ipc)->thread.ptr = *ipc;
+	(*ipc)->thread.read_callback = &ipc_write_callback;
+	(*ipc)->thread.threads = 1;
+	(*ipc)->thread.name = "ipc";
+
+	return 0;
+}
+
+int ipc_destroy(ipc_t ipc)
+{
+	if (ipc->flags & IPC_READING)
+		ipc_read_process_stop(ipc);
+
+	if (ipc->flags & IPC_LISTENING) {
+		close(ipc->listen_sock);
+		unlink(ipc->path);
+		free(ipc->path);
+	}
+
+	if (ipc->flags & IPC_CONNECTED) {
+		close(ipc->sock);
+		ipc_unmap(&ipc->map);
+	}
+
+	free(ipc);
+	return 0;
+}
+
+int ipc_set_ring_size(ipc_t ipc, size_t size)
+{
+	if ((ipc->flags & IPC_CONNECTED) || (size < 1024 * 1024))
+		return EINVAL;
+
+	ipc->ring_size = size;
+	return 0;
+}
+
+int ipc_map(struct ipc_map_s *map, int memfd, size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	char *base;
+
+	/* control page, data and data again */
+	map->map_size = page + size * 2;
+	base = mmap(NULL, map->map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return errno;
+
+	if ((mmap(base, page + size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_FIXED, memfd, 0) == MAP_FAILED) ||
+	    (mmap(base + page + size, size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_FIXED, memfd, page) == MAP_FAILED)) {
+		munmap(base, map->map_size);
+		return errno;
+	}
+
+	map->ring = (struct ipc_ring_s *) base;
+	map->data = base + page;
+	map->size = size;
+	return 0;
+}
+
+void ipc_unmap(struct ipc_map_s *map)
+{
+	munmap(map->ring, map->map_size);
+	close(map->data_fd);
+	close(map->space_fd);
+}
+
+int ipc_wait(glc_t *glc, int fd, int sock)
+{
+	struct pollfd pfd[2];
+	u_int64_t val;
+
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sock;
+	pfd[1].events = POLLIN;
+
+	if ((poll(pfd, 2, IPC_WAIT_MS) < 0) && (errno != EINTR))
+		return errno;
+
+	if (glc_state_test(glc, GLC_STATE_CANCEL))
+		return EINTR;
+	/* nothing is sent after handshake, so other side is gone */
+	if (pfd[1].revents)
+		return EPIPE;
+	if (pfd[0].revents & POLLIN)
+		read(fd, &val, sizeof(u_int64_t));
+
+	return 0;
+}
+
+void ipc_signal(int fd)
+{
+	u_int64_t val = 1;
+	write(fd, &val, sizeof(u_int64_t));
+}
+
+int ipc_connect(ipc_t ipc, const char *path)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	struct sockaddr_un addr;
+	struct ipc_hello_s hello;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(int) * 3)];
+	u_int32_t status;
+	int memfd = -1, fds[3], ret;
+
+	if (ipc->flags & (IPC_CONNECTED | IPC_LISTENING))
+		return EALREADY;
+
+	ipc->map.data_fd = ipc->map.space_fd = -1;
+	ipc->ring_size = (ipc->ring_size + page - 1) & ~(page - 1);
+
+	if ((memfd = memfd_create("glc-ipc", MFD_CLOEXEC)) < 0)
+		return errno;
+	if (ftruncate(memfd, page + ipc->ring_size)) {
+		ret = errno;
+		goto err;
+	}
+	if ((ret = ipc_map(&ipc->map, memfd, ipc->ring_size)))
+		goto err;
+
+	memset(ipc->map.ring, 0, sizeof(struct ipc_ring_s));
+	ipc->map.ring->signature = IPC_SIGNATURE;
+	ipc->map.ring->version = IPC_VERSION;
+	ipc->map.ring->size = ipc->ring_size;
+
+	if (((ipc->map.data_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) ||
+	    ((ipc->map.space_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)) {
+		ret = errno;
+		goto err;
+	}
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if ((ipc->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		ret = errno;
+		goto err;
+	}
+	if (connect(ipc->sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un))) {
+		ret = errno;
+		glc_log(ipc->glc, GLC_ERROR, "ipc", "can't connect to daemon at %s: %s (%d)",
+			 path, strerror(ret), ret);
+		goto err;
+	}
+
+	memset(&hello, 0, sizeof(struct ipc_hello_s));
+	hello.pid = getpid();
+	hello.time = glc_state_time(ipc->glc);
+	hello.size = ipc->ring_size;
+	strncpy(hello.name, program_invocation_short_name, IPC_NAME_LEN - 1);
+
+	fds[0] = memfd;
+	fds[1] = ipc->map.data_fd;
+	fds[2] = ipc->map.space_fd;
+
+	iov.iov_base = &hello;
+	iov.iov_len = sizeof(struct ipc_hello_s);
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * 3);
+
+	if (sendmsg(ipc->sock, &msg, MSG_NOSIGNAL) != sizeof(struct ipc_hello_s)) {
+		ret = errno ? errno : EPIPE;
+		goto err;
+	}
+	if (recv(ipc->sock, &status, sizeof(u_int32_t), MSG_WAITALL) != sizeof(u_int32_t)) {
+		ret = EPIPE;
+		goto err;
+	}
+	if (status) {
+		ret = status;
+		glc_log(ipc->glc, GLC_ERROR, "ipc", "daemon refused connection: %s (%d)",
+			 strerror(ret), ret);
+		goto err;
+	}
+
+	/* daemon has its own mapping */
+	close(memfd);
+
+	ipc->flags |= IPC_CONNECTED;
+	glc_log(ipc->glc, GLC_INFORMATION, "ipc", "connected to daemon at %s, %zu KiB ring",
+		 path, ipc->ring_size / 1024);
+	return 0;
+err:
+	if (ipc->sock >= 0)
+		close(ipc->sock);
+	ipc->sock = -1;
+	if (ipc->map.ring)
+		ipc_unmap(&ipc->map);
+	else {
+		if (ipc->map.data_fd >= 0)
+			close(ipc->map.data_fd);
+		if (ipc->map.space_fd >= 0)
+			close(ipc->map.space_fd);
+	}
+	memset(&ipc->map, 0, sizeof(struct ipc_map_s));
+	close(memfd);
+	return ret;
+}
+
+int ipc_write_process_start(ipc_t ipc, ps_buffer_t *from)
+{
+	int ret;
+	if ((!(ipc->flags & IPC_CONNECTED)) || (ipc->flags & IPC_RUNNING))
+		return EAGAIN;
+
+	if ((ret = glc_thread_create(ipc->glc, &ipc->thread, from, NULL)))
+		return ret;
+	ipc->flags |= IPC_RUNNING;
+
+	return 0;
+}
+
+int ipc_write_process_wait(ipc_t ipc)
+{
+	if (!(ipc->flags & IPC_RUNNING))
+		return EAGAIN;
+
+	glc_thread_wait(&ipc->thread);
+	ipc->flags &= ~IPC_RUNNING;
+
+	return 0;
+}
+
+int ipc_write_callback(glc_thread_state_t *state)
+{
+	ipc_t ipc = (ipc_t) state->ptr;
+
+	/* pointers are meaningless to daemon */
+	if ((state->header.type == GLC_CALLBACK_REQUEST) ||
+	    (state->header.type == GLC_MESSAGE_VIDEO_FRAME_REF))
+		return 0;
+
+	return ipc_push(ipc, &state->header, state->read_data, state->read_size);
+}
+
+int ipc_push(ipc_t ipc, glc_message_header_t *header, char *data, size_t size)
+{
+	struct ipc_ring_s *ring = ipc->map.ring;
+	size_t need = IPC_MESSAGE_SIZE(size);
+	u_int64_t head = ring->head;
+	glc_size_t glc_size = size;
+	char *p;
+	int ret;
+
+	if (need > ipc->map.size)
+		return EMSGSIZE;
+
+	while (ipc->map.size - (head - __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST)) < need) {
+		__atomic_store_n(&ring->writer_waiting, 1, __ATOMIC_SEQ_CST);
+		if (ipc->map.size - (head - __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST)) >= need)
+			break;
+		if ((ret = ipc_wait(ipc->glc, ipc->map.space_fd, ipc->sock)))
+			return ret;
+	}
+	__atomic_store_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST);
+
+	/* same layout as container messages */
+	p = &ipc->map.data[head % ipc->map.size];
+	memcpy(p, &glc_size, sizeof(glc_size_t));
+	memcpy(&p[sizeof(glc_size_t)], header, sizeof(glc_message_header_t));
+	memcpy(&p[sizeof(glc_size_t) + sizeof(glc_message_header_t)], data, size);
+
+	__atomic_store_n(&ring->head, head + need, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&ring->reader_waiting, 0, __ATOMIC_SEQ_CST))
+		ipc_signal(ipc->map.data_fd);
+
+	return 0;
+}
+
+int ipc_listen(ipc_t ipc, const char *path)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int ret = 0;
+
+	if (ipc->flags & (IPC_CONNECTED | IPC_LISTENING))
+		return EALREADY;
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return ENAMETOOLONG;
+	strcpy(addr.sun_path, path);
+
+	if ((ipc->listen_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return errno;
+
+	/* left behind by a daemon that didn't exit cleanly */
+	unlink(path);
+	/* clients hand over their streams, only owner may connect */
+	mask = umask(S_IRWXG | S_IRWXO);
+	if (bind(ipc->listen_sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)))
+		ret = errno;
+	umask(mask);
+	if ((!ret) && ((chmod(path, S_IRUSR | S_IWUSR)) || (listen(ipc->listen_sock, 16))))
+		ret = errno;
+	if (ret) {
+		glc_log(ipc->glc, GLC_ERROR, "ipc", "can't listen at %s: %s (%d)",
+			 path, strerror(ret), ret);
+		close(ipc->listen_sock);
+		ipc->listen_sock = -1;
+		return ret;
+	}
+
+	ipc->path = strdup(path);
+	ipc->flags |= IPC_LISTENING;
+	glc_log(ipc->glc, GLC_INFORMATION, "ipc", "listening at %s", path);
+	return 0;
+}
+
+int ipc_read_process_start(ipc_t ipc, ps_buffer_t *to)
+{
+	int ret;
+	if ((!(ipc->flags & IPC_LISTENING)) || (ipc->flags & IPC_READING))
+		return EAGAIN;
+
+	ipc->to = to;
+	ipc->stop = 0;
+	if ((ret = pthread_create(&ipc->accept_thread, NULL, ipc_accept_thread, ipc)))
+		return ret;
+	ipc->flags |= IPC_READING;
+
+	return 0;
+}
+
+int ipc_read_process_stop(ipc_t ipc)
+{
+	if (!(ipc->flags & IPC_READING))
+		return EAGAIN;
+
+	__atomic_store_n(&ipc->stop, 1, __ATOMIC_SEQ_CST);
+	pthread_join(ipc->accept_thread, NULL);
+	ipc_client_reap(ipc, 1);
+
+	ipc->flags &= ~IPC_READING;
+	return 0;
+}
+
+void *ipc_accept_thread(void *argptr)
+{
+	ipc_t ipc = (ipc_t) argptr;
+	struct pollfd pfd;
+	int sock, ret;
+
+	pfd.fd = ipc->listen_sock;
+	pfd.events = POLLIN;
+
+	while ((!__atomic_load_n(&ipc->stop, __ATOMIC_SEQ_CST)) &&
+	       (!glc_state_test(ipc->glc, GLC_STATE_CANCEL))) {
+		/* ended clients are joined here */
+		ipc_client_reap(ipc, 0);
+
+		if (poll(&pfd, 1, IPC_WAIT_MS) <= 0)
+			continue;
+		if ((sock = accept4(ipc->listen_sock, NULL, NULL, SOCK_CLOEXEC)) < 0)
+			continue;
+
+		if ((ret = ipc_client_add(ipc, sock))) {
+			glc_log(ipc->glc, GLC_WARNING, "ipc", "can't accept client: %s (%d)",
+				 strerror(ret), ret);
+			close(sock);
+		}
+	}
+
+	return NULL;
+}
+
+int ipc_client_add(ipc_t ipc, int sock)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	struct ipc_client_s *client;
+	struct ipc_hello_s hello;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	struct stat st;
+	char control[CMSG_SPACE(sizeof(int) * 3)];
+	int fds[3] = {-1, -1, -1};
+	struct timeval timeout;
+	struct ucred cred;
+	socklen_t cred_size = sizeof(struct ucred);
+	u_int32_t status;
+	int ret;
+
+	/* socket mode is not checked on every system */
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_size))
+		return errno;
+	if (cred.uid != geteuid())
+		return EPERM;
+
+	/* client that never says hello must not block accepting */
+	timeout.tv_sec = 1;
+	timeout.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval));
+
+	iov.iov_base = &hello;
+	iov.iov_len = sizeof(struct ipc_hello_s);
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(struct ipc_hello_s))
+		return EPROTO;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ((!cmsg) || (cmsg->cmsg_type != SCM_RIGHTS) ||
+	    (cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 3)))
+		return EPROTO;
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * 3);
+	hello.name[IPC_NAME_LEN - 1] = '\0';
+
+	client = (struct ipc_client_s *) malloc(sizeof(struct ipc_client_s));
+	memset(client, 0, sizeof(struct ipc_client_s));
+	client->ipc = ipc;
+	client->sock = sock;
+	client->map.data_fd = fds[1];
+	client->map.space_fd = fds[2];
+
+	/* don't trust size in hello further than the memfd goes */
+	if ((fstat(fds[0], &st)) || (hello.size % page) ||
+	    ((size_t) st.st_size != page + hello.size)) {
+		ret = EPROTO;
+		goto err;
+	}
+	if ((ret = ipc_map(&client->map, fds[0], hello.size)))
+		goto err;
+	close(fds[0]);
+	fds[0] = -1;
+
+	if ((client->map.ring->signature != IPC_SIGNATURE) ||
+	    (client->map.ring->version != IPC_VERSION)) {
+		ipc_unmap(&client->map);
+		ret = EPROTO;
+		goto err_unmapped;
+	}
+
+	/* client's stream time is moved to ours */
+	client->time_offset = (glc_stime_t) glc_state_time(ipc->glc) - (glc_stime_t) hello.time;
+	client->num = ++ipc->client_count;
+
+	if ((ret = pthread_create(&client->thread, NULL, ipc_client_thread, client))) {
+		ipc_unmap(&client->map);
+		goto err_unmapped;
+	}
+
+	client->next = ipc->clients;
+	ipc->clients = client;
+
+	status = 0;
+	send(sock, &status, sizeof(u_int32_t), MSG_NOSIGNAL);
+
+	glc_log(ipc->glc, GLC_INFORMATION, "ipc", "client %u: %s (pid %u), %llu KiB ring",
+		 client->num, hello.name, hello.pid,
+		 (unsigned long long) hello.size / 1024);
+	return 0;
+err:
+	close(fds[0]);
+	close(fds[1]);
+	close(fds[2]);
+err_unmapped:
+	status = ret;
+	send(sock, &status, sizeof(u_int32_t), MSG_NOSIGNAL);
+	free(client);
+	return ret;
+}
+
+void ipc_client_reap(ipc_t ipc, int all)
+{
+	struct ipc_client_s **p = &ipc->clients, *client;
+
+	while (*p != NULL) {
+		client = *p;
+		if ((!all) && (!__atomic_load_n(&client->done, __ATOMIC_ACQUIRE))) {
+			p = &client->next;
+			continue;
+		}
+
+		pthread_join(client->thread, NULL);
+		*p = client->next;
+
+		free(client->video);
+		free(client->audio);
+		free(client);
+	}
+}
+
+void *ipc_client_thread(void *argptr)
+{
+	struct ipc_client_s *client = (struct ipc_client_s *) argptr;
+	ipc_t ipc = client->ipc;
+	struct ipc_ring_s *ring = client->map.ring;
+	glc_message_header_t header;
+	glc_size_t glc_size;
+	u_int64_t head, tail;
+	ps_packet_t packet;
+	size_t need;
+	char *p;
+	int ret = 0, gone = 0, closed = 0;
+
+	ps_packet_init(&packet, ipc->to);
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+
+	while (!closed) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+		if (head == tail) {
+			/* whatever client pushed before leaving is still written */
+			if ((gone) || (__atomic_load_n(&ipc->stop, __ATOMIC_SEQ_CST)))
+				break;
+
+			__atomic_store_n(&ring->reader_waiting, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail)
+				continue;
+
+			if ((ret = ipc_wait(ipc->glc, client->map.data_fd, client->sock))) {
+				if (ret != EPIPE)
+					goto err;
+				gone = 1;
+				ret = 0;
+			}
+			continue;
+		}
+
+		p = &client->map.data[tail % client->map.size];
+		memcpy(&glc_size, p, sizeof(glc_size_t));
+		memcpy(&header, &p[sizeof(glc_size_t)], sizeof(glc_message_header_t));
+		need = IPC_MESSAGE_SIZE(glc_size);
+		if ((glc_size > client->map.size) || (need > head - tail)) {
+			ret = EBADMSG;
+			goto err;
+		}
+
+		if (header.type == GLC_MESSAGE_CLOSE)
+			closed = 1; /* stream goes on without this client */
+		else if ((ret = ipc_client_forward(client, &packet, &header,
+						   &p[sizeof(glc_size_t) +
+						      sizeof(glc_message_header_t)],
+						   glc_size)))
+			goto err;
+
+		tail += need;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+		if (__atomic_exchange_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST))
+			ipc_signal(client->map.space_fd);
+	}
+
+finish:
+	glc_log(ipc->glc, GLC_INFORMATION, "ipc", "client %u ended", client->num);
+
+	ps_packet_destroy(&packet);
+	ipc_unmap(&client->map);
+	close(client->sock);
+
+	__atomic_store_n(&client->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+err:
+	if (ret != EINTR)
+		glc_log(ipc->glc, GLC_ERROR, "ipc", "client %u: %s (%d)",
+			 client->num, strerror(ret), ret);
+	goto finish;
+}
+
+int ipc_client_forward(struct ipc_client_s *client, ps_packet_t *packet,
+		       glc_message_header_t *header, char *data, size_t size)
+{
+	size_t min;
+	char *dma;
+	int ret;
+
+	switch (header->type) {
+	case GLC_MESSAGE_VIDEO_FORMAT:
+		min = sizeof(glc_video_format_message_t);
+		break;
+	case GLC_MESSAGE_VIDEO_FRAME:
+	case GLC_MESSAGE_VIDEO_REPEAT:
+		min = sizeof(glc_video_frame_header_t);
+		break;
+	case GLC_MESSAGE_COLOR:
+		min = sizeof(glc_color_message_t);
+		break;
+	case GLC_MESSAGE_AUDIO_FORMAT:
+		min = sizeof(glc_audio_format_message_t);
+		break;
+	case GLC_MESSAGE_AUDIO_DATA:
+		min = sizeof(glc_audio_data_header_t);
+		break;
+	case GLC_MESSAGE_STATS:
+		min = sizeof(glc_stats_message_t);
+		break;
+	default:
+		/* capture sends only raw messages */
+		glc_log(client->ipc->glc, GLC_DEBUG, "ipc",
+			 "client %u: dropped message 0x%02x", client->num, header->type);
+		return 0;
+	}
+
+	if (size < min)
+		return EBADMSG;
+
+	if ((ret = ps_packet_open(packet, PS_PACKET_WRITE)))
+		return ret;
+	if ((ret = ps_packet_write(packet, header, sizeof(glc_message_header_t))))
+		goto cancel;
+	if ((ret = ps_packet_dma(packet, (void *) &dma, size, PS_ACCEPT_FAKE_DMA)))
+		goto cancel;
+	memcpy(dma, data, size);
+
+	/* every message above starts with stream id, if it has one */
+	switch (header->type) {
+	case GLC_MESSAGE_VIDEO_FRAME:
+	case GLC_MESSAGE_VIDEO_REPEAT:
+		((glc_video_frame_header_t *) dma)->time += client->time_offset;
+		/* fall through */
+	case GLC_MESSAGE_VIDEO_FORMAT:
+	case GLC_MESSAGE_COLOR:
+		*(glc_stream_id_t *) dma = ipc_client_video(client, *(glc_stream_id_t *) dma);
+		break;
+	case GLC_MESSAGE_AUDIO_DATA:
+		((glc_audio_data_header_t *) dma)->time += client->time_offset;
+		/* fall through */
+	case GLC_MESSAGE_AUDIO_FORMAT:
+		*(glc_stream_id_t *) dma = ipc_client_audio(client, *(glc_stream_id_t *) dma);
+		break;
+	case GLC_MESSAGE_STATS:
+		((glc_stats_message_t *) dma)->time += client->time_offset;
+		break;
+	}
+
+	return ps_packet_close(packet);
+cancel:
+	ps_packet_cancel(packet);
+	return ret;
+}
+
+glc_stream_id_t ipc_client_video(struct ipc_client_s *client, glc_stream_id_t id)
+{
+	glc_state_video_t state;
+	unsigned int count;
+
+	if ((id < 1) || (id > 0xffff))
+		return id;
+
+	if ((unsigned int) id >= client->videos) {
+		count = id + 1;
+		client->video = (glc_stream_id_t *) realloc(client->video,
+							    sizeof(glc_stream_id_t) * count);
+		memset(&client->video[client->videos], 0,
+		       sizeof(glc_stream_id_t) * (count - client->videos));
+		client->videos = count;
+	}
+
+	if (!client->video[id]) {
+		glc_state_video_new(client->ipc->glc, &client->video[id], &state);
+		glc_log(client->ipc->glc, GLC_INFORMATION, "ipc",
+			 "client %u video %d is stream video %d",
+			 client->num, id, client->video[id]);
+	}
+
+	return client->video[id];
+}
+
+glc_stream_id_t ipc_client_audio(struct ipc_client_s *client, glc_stream_id_t id)
+{
+	glc_state_audio_t state;
+	unsigned int count;
+
+	if ((id < 1) || (id > 0xffff))
+		return id;
+
+	if ((unsigned int) id >= client->audios) {
+		count = id + 1;
+		client->audio = (glc_stream_id_t *) realloc(client->audio,
+							    sizeof(glc_stream_id_t) * count);
+		memset(&client->audio[client->audios], 0,
+		       sizeof(glc_stream_id_t) * (count - client->audios));
+		client->audios = count;
+	}
+
+	if (!client->audio[id]) {
+		glc_state_audio_new(client->ipc->glc, &client->audio[id], &state);
+		glc_log(client->ipc->glc, GLC_INFORMATION, "ipc",
+			 "client %u audio %d is stream audio %d",
+			 client->num, id, client->audio[id]);
+	}
+
+	return client->audio[id];
+}
+
+/**  \} */
@@ -0,0 +1,141 @@
+/**
+ * \file glc/core/ipc.h
+ * \brief shared memory transport between capture and glc-daemon
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup core
+ *  \{
+ * \defgroup ipc shared memory transport
+ *  \{
+ */
+
+#ifndef _IPC_H
+#define _IPC_H
+
+#include <packetstream.h>
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief ipc object
+ *
+ * Captured processes don't compress or write anything in
+ * daemon mode. Each one pushes its raw stream into a shared
+ * memory ring of its own, and glc-daemon reads all rings into
+ * one buffer that is compressed and written by a single
+ * pipeline. Daemon gives every stream a new, globally unique id
+ * and moves times to its own clock.
+ *
+ * Ring is a memfd passed to daemon over a unix socket with
+ * two eventfds, one for each direction. Daemon and clients only
+ * signal when the other side is known to be waiting.
+ */
+typedef struct ipc_s* ipc_t;
+
+/**
+ * \brief initialize ipc object
+ * \param ipc ipc object
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ipc_init(ipc_t *ipc, glc_t *glc);
+
+/**
+ * \brief destroy ipc object
+ *
+ * Closes connection or listening socket.
+ * \param ipc ipc object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ipc_destroy(ipc_t ipc);
+
+/**
+ * \brief set shared memory ring size
+ *
+ * Only used by clients, set before ipc_connect().
+ * \param ipc ipc object
+ * \param size ring size in bytes, default is 32 MiB
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ipc_set_ring_size(ipc_t ipc, size_t size);
+
+/**
+ * \brief connect to daemon
+ *
+ * Creates shared memory ring and hands it to daemon
+ * listening at path.
+ * \param ipc ipc object
+ * \param path daemon socket
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ipc_connect(ipc_t ipc, const char *path);
+
+/**
+ * \brief start pushing stream to daemon
+ *
+ * Messages from source buffer are copied into shared memory
+ * ring. Callback requests are dropped. Process ends after
+ * GLC_MESSAGE_CLOSE has been pushed.
+ * \param ipc ipc object
+ * \param from source buffer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ipc_write_process_start(ipc_t ipc, ps_buffer_t *from);
+
+/**
+ * \brief block until write process has finished
+ * \param ipc ipc object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ipc_write_process_wait(ipc_t ipc);
+
+/**
+ * \brief listen for clients
+ *
+ * Socket is accessible only to owner, and clients running as
+ * another user are refused.
+ * \param ipc ipc object
+ * \param path socket path, stale socket is replaced
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ipc_listen(ipc_t ipc, const char *path);
+
+/**
+ * \brief start reading clients
+ *
+ * Every client gets a thread that moves messages from its
+ * ring to target buffer. GLC_MESSAGE_CLOSE from a client only
+ * ends that client.
+ * \param ipc ipc object
+ * \param to target buffer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ipc_read_process_start(ipc_t ipc, ps_buffer_t *to);
+
+/**
+ * \brief stop reading clients
+ *
+ * Stops accepting new clients and waits until connected ones
+ * have ended or, if they are still capturing, until their rings
+ * are empty. Nothing is written to target buffer, so caller
+ * can end stream with glc_util_write_end_of_stream().
+ * \param ipc ipc object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ipc_read_process_stop(ipc_t ipc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
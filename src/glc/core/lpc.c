@@ -0,0 +1,442 @@
+/**
+ * \file glc/core/lpc.c
+ * \brief lossless audio codec
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup lpc
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <glc/common/glc.h>
+
+#include "lpc.h"
+
+/* frames in independently predicted block */
+#define LPC_BLOCK                 4096
+/* residuals that share a Rice parameter */
+#define LPC_PARTITION              256
+#define LPC_PARTITIONS            (LPC_BLOCK / LPC_PARTITION)
+
+#define LPC_ORDER_MAX                4
+/* order code for a block stored as is */
+#define LPC_VERBATIM                 7
+#define LPC_ORDER_BITS               3
+#define LPC_RICE_BITS                6
+
+/* quotient this large is written as escape and raw residual */
+#define LPC_ESCAPE                  24
+/* zigzagged order 4 residual of 32 bit samples fits in this */
+#define LPC_RAW_BITS                40
+
+struct lpc_bits_s {
+	unsigned char *p, *end;
+	u_int64_t acc;
+	unsigned int n;
+	int overflow;
+};
+
+struct lpc_layout_s {
+	size_t sample_size;
+	size_t frames;
+	/* bytes between consecutive samples of a channel */
+	size_t step;
+	/* bytes between first samples of consecutive channels */
+	size_t channel_step;
+};
+
+void lpc_layout(struct lpc_layout_s *layout, size_t size, glc_audio_format_t format,
+		glc_flags_t flags, u_int32_t channels);
+int64_t lpc_get(const char *from, size_t sample_size);
+void lpc_set(char *to, size_t sample_size, int64_t value);
+int64_t lpc_residual(const int64_t *x, unsigned int i, unsigned int order);
+u_int64_t lpc_rice_cost(const u_int64_t *u, unsigned int count, unsigned int k);
+
+void lpc_write(struct lpc_bits_s *bits, u_int64_t value, unsigned int count);
+void lpc_flush(struct lpc_bits_s *bits);
+u_int64_t lpc_read(struct lpc_bits_s *bits, unsigned int count);
+
+int lpc_encode_block(struct lpc_bits_s *bits, const struct lpc_layout_s *layout,
+		     const char *from, unsigned int frames);
+int lpc_decode_block(struct lpc_bits_s *bits, const struct lpc_layout_s *layout,
+		     char *to, unsigned int frames);
+
+int lpc_supported(glc_audio_format_t format)
+{
+	return (format == GLC_AUDIO_S16_LE) |
+	       (format == GLC_AUDIO_S24_LE) |
+	       (format == GLC_AUDIO_S32_LE);
+}
+
+size_t lpc_bound(size_t size, glc_audio_format_t format, u_int32_t channels)
+{
+	struct lpc_layout_s layout;
+	size_t blocks;
+
+	lpc_layout(&layout, size, format, GLC_AUDIO_INTERLEAVED, channels);
+	blocks = (layout.frames + LPC_BLOCK - 1) / LPC_BLOCK;
+
+	/* stored blocks only add order codes */
+	return size + (blocks * channels * LPC_ORDER_BITS + 7) / 8 + 1;
+}
+
+void lpc_layout(struct lpc_layout_s *layout, size_t size, glc_audio_format_t format,
+		glc_flags_t flags, u_int32_t channels)
+{
+	/* 24 bit samples are in 32 bit words */
+	layout->sample_size = (format == GLC_AUDIO_S16_LE) ? 2 : 4;
+	layout->frames = channels ? size / (layout->sample_size * channels) : 0;
+
+	if (flags & GLC_AUDIO_INTERLEAVED) {
+		layout->step = layout->sample_size * channels;
+		layout->channel_step = layout->sample_size;
+	} else {
+		layout->step = layout->sample_size;
+		layout->channel_step = layout->sample_size * layout->frames;
+	}
+}
+
+int64_t lpc_get(const char *from, size_t sample_size)
+{
+	int16_t s16;
+	int32_t s32;
+
+	if (sample_size == 2) {
+		memcpy(&s16, from, sizeof(int16_t));
+		return s16;
+	}
+	memcpy(&s32, from, sizeof(int32_t));
+	return s32;
+}
+
+void lpc_set(char *to, size_t sample_size, int64_t value)
+{
+	int16_t s16;
+	int32_t s32;
+
+	if (sample_size == 2) {
+		s16 = (int16_t) value;
+		memcpy(to, &s16, sizeof(int16_t));
+	} else {
+		s32 = (int32_t) value;
+		memcpy(to, &s32, sizeof(int32_t));
+	}
+}
+
+int64_t lpc_residual(const int64_t *x, unsigned int i, unsigned int order)
+{
+	/* first samples of block use as many predecessors as they have */
+	if (order > i)
+		order = i;
+
+	switch (order) {
+	case 0:
+		return x[i];
+	case 1:
+		return x[i] - x[i - 1];
+	case 2:
+		return x[i] - 2 * x[i - 1] + x[i - 2];
+	case 3:
+		return x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+	default:
+		return x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+	}
+}
+
+u_int64_t lpc_rice_cost(const u_int64_t *u, unsigned int count, unsigned int k)
+{
+	u_int64_t bits = LPC_RICE_BITS, q;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		q = u[i] >> k;
+		if (q < LPC_ESCAPE)
+			bits += q + 1 + k;
+		else
+			bits += LPC_ESCAPE + LPC_RAW_BITS;
+	}
+
+	return bits;
+}
+
+void lpc_write(struct lpc_bits_s *bits, u_int64_t value, unsigned int count)
+{
+	/* at most 32 bits are added to accumulator at a time */
+	if (count > 32) {
+		lpc_write(bits, value >> 32, count - 32);
+		count = 32;
+	}
+	if (!count)
+		return;
+
+	bits->acc = (bits->acc << count) | (value & (((u_int64_t) 1 << count) - 1));
+	bits->n += count;
+
+	while (bits->n >= 8) {
+		bits->n -= 8;
+		if (bits->p == bits->end) {
+			bits->overflow = 1;
+			continue;
+		}
+		*bits->p++ = (unsigned char) (bits->acc >> bits->n);
+	}
+}
+
+void lpc_flush(struct lpc_bits_s *bits)
+{
+	if (bits->n)
+		lpc_write(bits, 0, 8 - bits->n);
+}
+
+u_int64_t lpc_read(struct lpc_bits_s *bits, unsigned int count)
+{
+	u_int64_t high = 0;
+
+	if (count > 32) {
+		high = lpc_read(bits, count - 32) << 32;
+		count = 32;
+	}
+
+	while (bits->n < count) {
+		if (bits->p == bits->end) {
+			bits->overflow = 1;
+			bits->acc <<= 8;
+		} else
+			bits->acc = (bits->acc << 8) | *bits->p++;
+		bits->n += 8;
+	}
+
+	bits->n -= count;
+	return high | ((bits->acc >> bits->n) & (((u_int64_t) 1 << count) - 1));
+}
+
+int lpc_encode_block(struct lpc_bits_s *bits, const struct lpc_layout_s *layout,
+		     const char *from, unsigned int frames)
+{
+	int64_t x[LPC_BLOCK];
+	u_int64_t u[LPC_BLOCK], sum[LPC_ORDER_MAX + 1], coded, s, cost;
+	unsigned int k[LPC_PARTITIONS];
+	unsigned int i, j, order, part, count, best, k_best;
+	int64_t r;
+
+	for (i = 0; i < frames; i++)
+		x[i] = lpc_get(&from[i * layout->step], layout->sample_size);
+
+	/* pick predictor with smallest residuals */
+	memset(sum, 0, sizeof(sum));
+	for (i = LPC_ORDER_MAX; i < frames; i++) {
+		for (order = 0; order <= LPC_ORDER_MAX; order++) {
+			r = lpc_residual(x, i, order);
+			sum[order] += (r < 0) ? -r : r;
+		}
+	}
+	best = 0;
+	for (order = 1; order <= LPC_ORDER_MAX; order++) {
+		if (sum[order] < sum[best])
+			best = order;
+	}
+
+	for (i = 0; i < frames; i++) {
+		r = lpc_residual(x, i, best);
+		u[i] = ((u_int64_t) r << 1) ^ (u_int64_t) (r >> 63);
+	}
+
+	/* Rice parameter for each partition, from mean and its neighbours */
+	coded = LPC_ORDER_BITS;
+	for (part = 0; part * LPC_PARTITION < frames; part++) {
+		count = frames - part * LPC_PARTITION;
+		if (count > LPC_PARTITION)
+			count = LPC_PARTITION;
+
+		s = 0;
+		for (i = 0; i < count; i++)
+			s += u[part * LPC_PARTITION + i];
+
+		k[part] = 0;
+		while ((k[part] < LPC_RAW_BITS - 1) && (((u_int64_t) count << (k[part] + 1)) <= s))
+			k[part]++;
+
+		k_best = k[part];
+		s = lpc_rice_cost(&u[part * LPC_PARTITION], count, k_best);
+		for (j = (k[part] ? k[part] - 1 : 0); j <= k[part] + 1; j++) {
+			if ((j == k[part]) || (j >= LPC_RAW_BITS))
+				continue;
+			cost = lpc_rice_cost(&u[part * LPC_PARTITION], count, j);
+			if (cost < s) {
+				s = cost;
+				k_best = j;
+			}
+		}
+		k[part] = k_best;
+		coded += s;
+	}
+
+	if (coded >= LPC_ORDER_BITS + (u_int64_t) frames * layout->sample_size * 8) {
+		lpc_write(bits, LPC_VERBATIM, LPC_ORDER_BITS);
+		for (i = 0; i < frames; i++)
+			lpc_write(bits, (u_int64_t) x[i], layout->sample_size * 8);
+		return 0;
+	}
+
+	lpc_write(bits, best, LPC_ORDER_BITS);
+
+	for (i = 0; i < frames; i++) {
+		part = i / LPC_PARTITION;
+		if (i % LPC_PARTITION == 0)
+			lpc_write(bits, k[part], LPC_RICE_BITS);
+
+		s = u[i] >> k[part];
+		if (s < LPC_ESCAPE) {
+			/* quotient in unary, ones terminate */
+			lpc_write(bits, 1, s + 1);
+			lpc_write(bits, u[i], k[part]);
+		} else {
+			lpc_write(bits, 0, LPC_ESCAPE);
+			lpc_write(bits, u[i], LPC_RAW_BITS);
+		}
+	}
+
+	return 0;
+}
+
+int lpc_decode_block(struct lpc_bits_s *bits, const struct lpc_layout_s *layout,
+		     char *to, unsigned int frames)
+{
+	int64_t x[LPC_BLOCK];
+	unsigned int i, order, k = 0, q;
+	u_int64_t u;
+	int64_t r;
+
+	order = lpc_read(bits, LPC_ORDER_BITS);
+
+	if (order == LPC_VERBATIM) {
+		for (i = 0; i < frames; i++)
+			lpc_set(&to[i * layout->step], layout->sample_size,
+				(int64_t) lpc_read(bits, layout->sample_size * 8));
+		return 0;
+	} else if (order > LPC_ORDER_MAX)
+		return EINVAL;
+
+	for (i = 0; i < frames; i++) {
+		if (i % LPC_PARTITION == 0) {
+			k = lpc_read(bits, LPC_RICE_BITS);
+			if (k >= LPC_RAW_BITS)
+				return EINVAL;
+		}
+
+		q = 0;
+		while ((q < LPC_ESCAPE) && (!lpc_read(bits, 1)))
+			q++;
+
+		if (q < LPC_ESCAPE)
+			u = ((u_int64_t) q << k) | lpc_read(bits, k);
+		else
+			u = lpc_read(bits, LPC_RAW_BITS);
+
+		if (bits->overflow)
+			return EINVAL;
+
+		r = (int64_t) ((u >> 1) ^ (~(u & 1) + 1));
+
+		/* residual of a zero sample is minus prediction */
+		x[i] = 0;
+		x[i] = r - lpc_residual(x, i, order);
+		lpc_set(&to[i * layout->step], layout->sample_size, x[i]);
+	}
+
+	return 0;
+}
+
+int lpc_encode(const char *from, size_t size, glc_audio_format_t format,
+	       glc_flags_t flags, u_int32_t channels,
+	       char *to, size_t *to_size)
+{
+	struct lpc_layout_s layout;
+	struct lpc_bits_s bits;
+	size_t block, frames, rest;
+	u_int32_t c;
+	int ret;
+
+	if (!lpc_supported(format))
+		return EINVAL;
+	lpc_layout(&layout, size, format, flags, channels);
+
+	memset(&bits, 0, sizeof(struct lpc_bits_s));
+	bits.p = (unsigned char *) to;
+	bits.end = (unsigned char *) &to[lpc_bound(size, format, channels)];
+
+	for (block = 0; block < layout.frames; block += LPC_BLOCK) {
+		frames = layout.frames - block;
+		if (frames > LPC_BLOCK)
+			frames = LPC_BLOCK;
+
+		for (c = 0; c < channels; c++) {
+			if ((ret = lpc_encode_block(&bits, &layout,
+						    &from[block * layout.step +
+							  c * layout.channel_step],
+						    frames)))
+				return ret;
+		}
+	}
+	lpc_flush(&bits);
+
+	/* partial frame is copied as is */
+	rest = size - layout.frames * layout.sample_size * channels;
+	if ((bits.overflow) || (bits.p + rest > bits.end))
+		return ENOSPC;
+	memcpy(bits.p, &from[size - rest], rest);
+
+	*to_size = (char *) bits.p + rest - to;
+	return 0;
+}
+
+int lpc_decode(const char *from, size_t from_size, glc_audio_format_t format,
+	       glc_flags_t flags, u_int32_t channels,
+	       char *to, size_t size)
+{
+	struct lpc_layout_s layout;
+	struct lpc_bits_s bits;
+	size_t block, frames, rest;
+	u_int32_t c;
+	int ret;
+
+	if (!lpc_supported(format))
+		return EINVAL;
+	lpc_layout(&layout, size, format, flags, channels);
+
+	memset(&bits, 0, sizeof(struct lpc_bits_s));
+	bits.p = (unsigned char *) from;
+	bits.end = (unsigned char *) &from[from_size];
+
+	for (block = 0; block < layout.frames; block += LPC_BLOCK) {
+		frames = layout.frames - block;
+		if (frames > LPC_BLOCK)
+			frames = LPC_BLOCK;
+
+		for (c = 0; c < channels; c++) {
+			if ((ret = lpc_decode_block(&bits, &layout,
+						    &to[block * layout.step +
+							c * layout.channel_step],
+						    frames)))
+				return ret;
+		}
+	}
+
+	/* padding bits of last byte are skipped */
+	rest = size - layout.frames * layout.sample_size * channels;
+	if ((bits.overflow) || (bits.p + rest != bits.end))
+		return EINVAL;
+	memcpy(&to[size - rest], bits.p, rest);
+
+	return 0;
+}
+
+/**  \} */
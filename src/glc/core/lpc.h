@@ -0,0 +1,92 @@
+/**
+ * \file glc/core/lpc.h
+ * \brief lossless audio codec
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup core
+ *  \{
+ * \defgroup lpc lossless audio codec
+ *  \{
+ */
+
+#ifndef _LPC_H
+#define _LPC_H
+
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief check if format can be coded
+ *
+ * GLC_AUDIO_S16_LE samples are coded as 16 bit words,
+ * GLC_AUDIO_S24_LE and GLC_AUDIO_S32_LE as 32 bit words.
+ * \param format audio format
+ * \return 1 if format is supported, otherwise 0
+ */
+__PUBLIC int lpc_supported(glc_audio_format_t format);
+
+/**
+ * \brief worst case size of coded audio
+ * \param size audio data size in bytes
+ * \param format audio format
+ * \param channels number of channels
+ * \return maximum coded size in bytes
+ */
+__PUBLIC size_t lpc_bound(size_t size, glc_audio_format_t format, u_int32_t channels);
+
+/**
+ * \brief code audio data
+ *
+ * Each channel is split into blocks. Every block is predicted
+ * with the best fixed polynomial predictor (orders 0-4, as in
+ * FLAC) and residuals are Rice coded in partitions with their
+ * own parameter. Blocks that don't get smaller are stored as is.
+ * Bytes that don't fill a whole frame are copied after the
+ * coded data.
+ *
+ * Format, flags and channels must be given to lpc_decode() too.
+ * They only affect compression ratio, any data is restored
+ * exactly.
+ * \param from audio data
+ * \param size audio data size in bytes
+ * \param format audio format
+ * \param flags GLC_AUDIO_INTERLEAVED if data is interleaved
+ * \param channels number of channels
+ * \param to target, at least lpc_bound() bytes
+ * \param to_size returned coded size
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int lpc_encode(const char *from, size_t size, glc_audio_format_t format,
+			glc_flags_t flags, u_int32_t channels,
+			char *to, size_t *to_size);
+
+/**
+ * \brief restore audio data
+ * \param from coded data
+ * \param from_size coded size
+ * \param format audio format
+ * \param flags format flags
+ * \param channels number of channels
+ * \param to target
+ * \param size audio data size in bytes
+ * \return 0 on success, EINVAL if coded data is corrupted
+ */
+__PUBLIC int lpc_decode(const char *from, size_t from_size, glc_audio_format_t format,
+			glc_flags_t flags, u_int32_t channels,
+			char *to, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
@@ -17,14 +17,28 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define PACK_X86
+#endif
+#ifdef __ARM_NEON
+# include <arm_neon.h>
+#endif
 
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/thread.h>
 #include <glc/common/util.h>
+#include <glc/common/state.h>
+#include <glc/common/slice.h>
+#include <glc/common/registry.h>
 
 #include "pack.h"
+#include "lpc.h"
 
 #ifdef __MINILZO
 # include <minilzo.h>
@@ -49,31 +63,302 @@
 # include <lzjb.h>
 #endif
 
+#ifdef __LZ4
+# include <lz4.h>
+#endif
+
+#ifdef __ZSTD
+# include <zstd.h>
+#endif
+
+#define PACK_LADDER_MAX               8
+/* adaptive decisions are made this often */
+#define PACK_ADAPTIVE_WINDOW     250000
+/* failed step up is not retried for this many windows */
+#define PACK_ADAPTIVE_HOLD           20
+/* share of time spent waiting for compressed buffer that
+   means file can't keep up */
+#define PACK_ADAPTIVE_WAIT          0.5
+
+/* waits for previous delta frame are this long, in ms */
+#define PACK_DELTA_WAIT             100
+/* after this many waits unpack gives up on a missing frame */
+#define UNPACK_DELTA_TRIES           20
+/* tiles are this many pixels wide and high */
+#define PACK_TILE_SIZE               64
+
+#define UNPACK_FILTERS               16
+
+struct pack_codec_s {
+	int compression;
+	int level;
+};
+
+/* audio stream format, packed to one word that is read without locks */
+struct pack_audio_s {
+	u_int64_t format;
+};
+
+#define PACK_AUDIO_FORMAT(format, flags, channels) \
+	(((u_int64_t) (channels) << 32) | (((flags) & 0xff) << 8) | (format))
+
+/* compression switched at runtime, packed to one word as well */
+#define PACK_SWITCH_SET       0x8000000000000000ULL
+#define PACK_SWITCH(compression, level) \
+	(PACK_SWITCH_SET | ((u_int64_t) (u_int32_t) (level) << 8) | (compression))
+#define PACK_SWITCH_COMPRESSION(sw)   ((int) ((sw) & 0xff))
+#define PACK_SWITCH_LEVEL(sw)         ((int) (u_int32_t) ((sw) >> 8))
+
+/* previous picture of a video stream */
+struct pack_stream_s {
+	glc_stream_id_t id;
+
+	/* numbering, done in read order */
+	u_int32_t frames;
+	size_t size;
+
+	/* frames before 'done' have passed through reference */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	u_int32_t done;
+	unsigned char *ref;
+	size_t ref_size;
+
+	/* tile geometry from format message, 0 if not tiled */
+	u_int32_t row, rows, tile_width;
+
+	/* unpack: frames dropped while waiting for key frame */
+	u_int32_t dropped;
+
+	struct pack_stream_s *next;
+};
+
 struct pack_s {
 	glc_t *glc;
 	glc_thread_t thread;
 	size_t compress_min;
 	int running;
 	int compression;
+	int level;
+	int (*write_callback)(glc_thread_state_t *state);
+	/* pack_switch_compression(), 0 if not switched */
+	u_int64_t sw;
+
+	/* delta frames */
+	unsigned int delta_interval;
+	struct pack_stream_s *stream;
+
+	/* only changed tiles of delta frames are written */
+	int tiles;
+	int (*tile_differs)(const unsigned char *a, const unsigned char *b, size_t size);
+
+	/* large packets are compressed in independent blocks */
+	size_t block_size;
+
+	/* lossless audio codec, formats of audio streams */
+	int audio_lpc;
+	glc_registry_t audio;
+
+	/* written data messages carry glc_stamp_header_t */
+	int stamp;
+
+	/* adaptive compression, from fastest to strongest */
+	pthread_mutex_t adaptive_mutex;
+	struct pack_codec_s ladder[PACK_LADDER_MAX];
+	unsigned int ladder_count;
+	unsigned int current, ceiling, hold;
+	double headroom;
+	glc_utime_t window_start;
+	glc_utime_t idle, busy, wait;
+};
+
+struct pack_thread_s {
+	void *work;
+	size_t work_size;
+	void *lz4;
+#ifdef __ZSTD
+	ZSTD_CCtx *zstd;
+#endif
+	glc_video_frame_ref_t ref;
+	int has_ref;
+
+	int compression, level;
+	int switched;
+	glc_utime_t read_time, last_close, busy;
+
+	int delta, key;
+	struct pack_stream_s *stream;
+	u_int32_t frame;
+
+	/* tile geometry when this frame is written as tiles */
+	int tiles;
+	u_int32_t row, rows, tile_width;
+
+	/* stamp written in front of this packet */
+	int stamp;
+	glc_stream_id_t stamp_id;
+	glc_utime_t stamp_time;
+	u_int8_t stamp_flags;
+
+	/* audio data is coded with lpc in this format */
+	int lpc;
+	u_int64_t lpc_format;
+	unsigned char *scratch;
+	size_t scratch_size;
+
+	/* compressor state for each run of blocks, first is this thread */
+	unsigned int blocks;
+	struct pack_thread_s **slot;
+	unsigned int slots;
+};
+
+struct pack_blocks_s {
+	pack_t pack;
+	struct pack_thread_s **slot;
+	unsigned int run;
+
+	int compression, level;
+	const char *from;
+	size_t size, block_size;
+	char *to;
+	size_t bound;
+	u_int32_t *sizes;
+
+	int ret;
 };
 
 struct unpack_s {
 	glc_t *glc;
 	glc_thread_t thread;
 	int running;
+
+	pthread_mutex_t stream_mutex;
+	struct pack_stream_s *stream;
+
+	/* wanted streams, everything when empty */
+	struct {
+		glc_message_type_t type;
+		glc_stream_id_t id;
+	} filter[UNPACK_FILTERS];
+	unsigned int filters;
+
+	int scan;
+};
+
+struct unpack_thread_s {
+#ifdef __ZSTD
+	ZSTD_DCtx *zstd;
+#endif
+	size_t delta_size;
+	unsigned char *scratch;
+	size_t scratch_size;
+
+	/* header decoded in read callback when scanning */
+	glc_message_type_t scan_type;
+	size_t scan_size;
+	char scan[sizeof(glc_video_delta_header_t) + sizeof(glc_audio_data_header_t)];
+
+	struct unpack_thread_s **slot;
+	unsigned int slots;
+};
+
+struct unpack_blocks_s {
+	unpack_t unpack;
+	struct unpack_thread_s **slot;
+	unsigned int run;
+
+	glc_message_type_t compression;
+	const u_int32_t *sizes;
+	const char *from;
+	char *to;
+	size_t size, block_size;
+
+	int ret;
 };
 
 int pack_thread_create_callback(void *ptr, void **threadptr);
 void pack_thread_finish_callback(void *ptr, void *threadptr, int err);
+int pack_thread_prepare(struct pack_thread_s *pack_thread, int compression);
+int pack_codec_write_callback(glc_thread_state_t *state);
+int pack_available(int compression);
 int pack_read_callback(glc_thread_state_t *state);
+int pack_message_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state);
+int pack_close_callback(glc_thread_state_t *state);
 int pack_quicklz_write_callback(glc_thread_state_t *state);
 int pack_lzo_write_callback(glc_thread_state_t *state);
 int pack_lzjb_write_callback(glc_thread_state_t *state);
+int pack_lz4_write_callback(glc_thread_state_t *state);
+int pack_zstd_write_callback(glc_thread_state_t *state);
+int pack_adaptive_write_callback(glc_thread_state_t *state);
+int pack_write_callback(glc_thread_state_t *state);
+int pack_message_write(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state);
 void pack_finish_callback(void *ptr, int err);
 
+void pack_audio_format(pack_t pack, glc_thread_state_t *state);
+int pack_audio_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state);
+int pack_audio_write_callback(glc_thread_state_t *state);
+
+void pack_get_stream(pack_t pack, glc_stream_id_t id, struct pack_stream_s **stream);
+void pack_delta_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state);
+int pack_delta_write(pack_t pack, struct pack_thread_s *pack_thread,
+		     const char *from, char *to);
+int pack_delta_wait(glc_t *glc, struct pack_stream_s *stream, u_int32_t frame, int tries);
+void pack_delta_done(struct pack_stream_s *stream, u_int32_t frame);
+void pack_delta_xor(unsigned char *to, const unsigned char *from, unsigned char *ref,
+		    size_t size, int decode);
+int pack_scratch(unsigned char **scratch, size_t *scratch_size, size_t size);
+void pack_stream_free(struct pack_stream_s *stream);
+
+void pack_tiles_simd(pack_t pack);
+void pack_tiles_format(pack_t pack, glc_thread_state_t *state);
+void pack_tiles_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state);
+int pack_tiles_write(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state);
+int pack_tile_differs(const unsigned char *a, const unsigned char *b, size_t size);
+#ifdef PACK_X86
+int pack_tile_differs_sse2(const unsigned char *a, const unsigned char *b, size_t size);
+int pack_tile_differs_avx2(const unsigned char *a, const unsigned char *b, size_t size);
+#endif
+#ifdef __ARM_NEON
+int pack_tile_differs_neon(const unsigned char *a, const unsigned char *b, size_t size);
+#endif
+
+size_t pack_bound(int compression, size_t size);
+void pack_blocks_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state);
+int pack_blocks_write_callback(glc_thread_state_t *state);
+void pack_block_callback(void *ptr, unsigned int y, unsigned int rows);
+int pack_block_compress(pack_t pack, struct pack_thread_s *slot, int compression, int level,
+			const char *from, size_t size, char *to, size_t *compressed_size);
+
+int pack_uses(pack_t pack, int compression);
+void pack_adaptive_init(pack_t pack);
+void pack_adaptive_update(pack_t pack, struct pack_thread_s *pack_thread);
+void pack_adaptive_decide(pack_t pack);
+const char *pack_compression_name(int compression);
+
+int unpack_thread_create_callback(void *ptr, void **threadptr);
+void unpack_thread_finish_callback(void *ptr, void *threadptr, int err);
 int unpack_read_callback(glc_thread_state_t *state);
 int unpack_write_callback(glc_thread_state_t *state);
 void unpack_finish_callback(void *ptr, int err);
+int unpack_delta(unpack_t unpack, const char *from, size_t size, char *to);
+int unpack_picture(glc_thread_state_t *state, int ret);
+void unpack_drop(unpack_t unpack, struct pack_stream_s *stream, u_int32_t frame);
+struct pack_stream_s *unpack_get_stream(unpack_t unpack, glc_stream_id_t id, u_int32_t frame);
+int unpack_tiles(unpack_t unpack, struct unpack_thread_s *unpack_thread,
+		 const char *from, size_t from_size, char *to);
+int unpack_audio(unpack_t unpack, const char *from, size_t from_size, char *to, size_t size);
+int unpack_wanted(unpack_t unpack, glc_message_type_t type, const char *data, size_t size);
+int unpack_peek(glc_thread_state_t *state, char *data, size_t size);
+int unpack_peek_block(struct unpack_thread_s *unpack_thread, glc_message_type_t compression,
+		      const char *from, size_t from_size, size_t to_size, char *data, size_t size);
+int unpack_scan(unpack_t unpack, glc_thread_state_t *state, glc_message_header_t *header);
+int unpack_late(unpack_t unpack, glc_message_type_t type, const char *data, size_t size);
+int unpack_blocks(unpack_t unpack, struct unpack_thread_s *unpack_thread,
+		  const char *from, size_t from_size, char *to, size_t size);
+void unpack_block_callback(void *ptr, unsigned int y, unsigned int rows);
+int unpack_block_decompress(unpack_t unpack, struct unpack_thread_s *slot,
+			    glc_message_type_t compression, const char *from, size_t from_size,
+			    char *to, size_t size);
 
 int pack_init(pack_t *pack, glc_t *glc)
 {
@@ -82,14 +367,27 @@ int pack_init(pack_t *pack, glc_t *glc)
 
 	(*pack)->glc = glc;
 	(*pack)->compress_min = 1024;
+	(*pack)->level = 1;
+	(*pack)->headroom = 0.15;
+	pthread_mutex_init(&(*pack)->adaptive_mutex, NULL);
+	if (glc_registry_init(&(*pack)->audio, sizeof(struct pack_audio_s), NULL, NULL, NULL)) {
+		free(*pack);
+		return ENOMEM;
+	}
 
-	(*pack)->thread.flags = GLC_THREAD_WRITE | GLC_THREAD_READ;
+	/* read callback keeps no shared state, so it can run in parallel */
+	(*pack)->thread.flags = GLC_THREAD_WRITE | GLC_THREAD_READ | GLC_THREAD_CONCURRENT_READ;
 	(*pack)->thread.ptr = *pack;
 	(*pack)->thread.thread_create_callback = &pack_thread_create_callback;
 	(*pack)->thread.thread_finish_callback = &pack_thread_finish_callback;
 	(*pack)->thread.read_callback = &pack_read_callback;
+	(*pack)->thread.write_callback = &pack_write_callback;
+	(*pack)->thread.close_callback = &pack_close_callback;
 	(*pack)->thread.finish_callback = &pack_finish_callback;
 	(*pack)->thread.threads = glc_threads_hint(glc);
+	(*pack)->thread.name = "pack";
+
+	pack_tiles_simd(*pack);
 
 #ifdef __QUICKLZ
 	pack_set_compression(*pack, PACK_QUICKLZ);
@@ -97,6 +395,10 @@ int pack_init(pack_t *pack, glc_t *glc)
 	pack_set_compression(*pack, PACK_LZO);
 #elif defined __LZJB
 	pack_set_compression(*pack, PACK_LZJB);
+#elif defined __LZ4
+	pack_set_compression(*pack, PACK_LZ4);
+#elif defined __ZSTD
+	pack_set_compression(*pack, PACK_ZSTD);
 #else
 	glc_log((*pack)->glc, GLC_ERROR, "pack",
 		 "no supported compression algorithms found");
@@ -113,7 +415,7 @@ int pack_set_compression(pack_t pack, int compression)
 
 	if (compression == PACK_QUICKLZ) {
 #ifdef __QUICKLZ
-		pack->thread.write_callback = &pack_quicklz_write_callback;
+		pack->write_callback = &pack_quicklz_write_callback;
 		glc_log(pack->glc, GLC_INFORMATION, "pack",
 			 "compressing using QuickLZ");
 #else
@@ -123,7 +425,7 @@ int pack_set_compression(pack_t pack, int compression)
 #endif
 	} else if (compression == PACK_LZO) {
 #ifdef __LZO
-		pack->thread.write_callback = &pack_lzo_write_callback;
+		pack->write_callback = &pack_lzo_write_callback;
 		glc_log(pack->glc, GLC_INFORMATION, "pack",
 			 "compressing using LZO");
 		lzo_init();
@@ -134,13 +436,47 @@ int pack_set_compression(pack_t pack, int compression)
 #endif
 	} else if (compression == PACK_LZJB) {
 #ifdef __LZJB
-		pack->thread.write_callback = &pack_lzjb_write_callback;
+		pack->write_callback = &pack_lzjb_write_callback;
 		glc_log(pack->glc, GLC_INFORMATION, "pack",
 			"compressing using LZJB");
 #else
 		glc_log(pack->glc, GLC_ERROR, "pack",
 			"LZJB not supported");
 		return ENOTSUP;
+#endif
+	} else if (compression == PACK_LZ4) {
+#ifdef __LZ4
+		pack->write_callback = &pack_lz4_write_callback;
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "compressing using LZ4");
+#else
+		glc_log(pack->glc, GLC_ERROR, "pack",
+			 "LZ4 not supported");
+		return ENOTSUP;
+#endif
+	} else if (compression == PACK_ZSTD) {
+#ifdef __ZSTD
+		pack->write_callback = &pack_zstd_write_callback;
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "compressing using Zstandard");
+#else
+		glc_log(pack->glc, GLC_ERROR, "pack",
+			 "Zstandard not supported");
+		return ENOTSUP;
+#endif
+	} else if (compression == PACK_ADAPTIVE) {
+		pack_adaptive_init(pack);
+		if (pack->ladder_count < 2) {
+			glc_log(pack->glc, GLC_ERROR, "pack",
+				 "no compression algorithms for adaptive compression");
+			return ENOTSUP;
+		}
+		pack->write_callback = &pack_adaptive_write_callback;
+		glc_log(pack->glc, GLC_INFORMATION, "pack",
+			 "adaptive compression, starting with %s",
+			 pack_compression_name(pack->ladder[pack->current].compression));
+#ifdef __LZO
+		lzo_init();
 #endif
 	} else {
 		glc_log(pack->glc, GLC_ERROR, "pack",
@@ -153,6 +489,117 @@ int pack_set_compression(pack_t pack, int compression)
 	return 0;
 }
 
+int pack_set_compression_level(pack_t pack, int level)
+{
+	if (pack->running)
+		return EALREADY;
+
+#ifdef __ZSTD
+	if (level > ZSTD_maxCLevel())
+		return EINVAL;
+#endif
+
+	pack->level = level;
+	return 0;
+}
+
+int pack_switch_compression(pack_t pack, int compression, int level)
+{
+	u_int64_t sw = 0;
+
+	if (compression == PACK_ADAPTIVE) {
+		/* ladder is only set up by pack_set_compression() */
+		if (pack->compression != PACK_ADAPTIVE)
+			return ENOTSUP;
+	} else if (!pack_available(compression))
+		return ENOTSUP;
+	else
+		sw = PACK_SWITCH(compression, level);
+
+#ifdef __ZSTD
+	if ((compression == PACK_ZSTD) && (level > ZSTD_maxCLevel()))
+		return EINVAL;
+#endif
+#ifdef __LZO
+	if (compression == PACK_LZO)
+		lzo_init();
+#endif
+
+	__atomic_store_n(&pack->sw, sw, __ATOMIC_RELEASE);
+	glc_log(pack->glc, GLC_INFORMATION, "pack", "switched to %s",
+		 compression == PACK_ADAPTIVE ? "adaptive compression" :
+		 pack_compression_name(compression));
+	return 0;
+}
+
+int pack_set_delta(pack_t pack, unsigned int keyframe_interval)
+{
+	if (pack->running)
+		return EALREADY;
+
+	pack->delta_interval = keyframe_interval;
+
+	/* frames are numbered in read callback */
+	if (keyframe_interval)
+		pack->thread.flags &= ~GLC_THREAD_CONCURRENT_READ;
+	else
+		pack->thread.flags |= GLC_THREAD_CONCURRENT_READ;
+
+	return 0;
+}
+
+int pack_set_delta_tiles(pack_t pack, int tiles)
+{
+	if (pack->running)
+		return EALREADY;
+
+	pack->tiles = tiles;
+	return 0;
+}
+
+int pack_set_audio_lpc(pack_t pack, int audio_lpc)
+{
+	if (pack->running)
+		return EALREADY;
+
+	pack->audio_lpc = audio_lpc;
+	return 0;
+}
+
+int pack_set_stamp(pack_t pack, int stamp)
+{
+	if (pack->running)
+		return EALREADY;
+
+	pack->stamp = stamp;
+	return 0;
+}
+
+int pack_set_block_size(pack_t pack, size_t block_size)
+{
+	if (pack->running)
+		return EALREADY;
+
+	/* larger block sizes don't fit to index */
+	if ((block_size) && ((block_size < 4096) || (block_size > 0x40000000)))
+		return EINVAL;
+
+	pack->block_size = block_size;
+	return 0;
+}
+
+int pack_set_adaptive_headroom(pack_t pack, double headroom)
+{
+	if (pack->running)
+		return EALREADY;
+
+	if ((headroom <= 0.0) || (headroom >= 0.5))
+		return EINVAL;
+
+	pack->headroom = headroom;
+	return 0;
+}
+
 int pack_set_minimum_size(pack_t pack, size_t min_size)
 {
 	if (pack->running)
@@ -191,6 +638,9 @@ int pack_process_wait(pack_t pack)
 
 int pack_destroy(pack_t pack)
 {
+	pack_stream_free(pack->stream);
+	glc_registry_destroy(pack->audio);
+	pthread_mutex_destroy(&pack->adaptive_mutex);
 	free(pack);
 	return 0;
 }
@@ -206,35 +656,192 @@ void pack_finish_callback(void *ptr, int err)
 int pack_thread_create_callback(void *ptr, void **threadptr)
 {
 	pack_t pack = (pack_t) ptr;
+	struct pack_thread_s *pack_thread;
+	int compression, ret;
+
+	pack_thread = (struct pack_thread_s *) malloc(sizeof(struct pack_thread_s));
+	if (!pack_thread)
+		return ENOMEM;
+	memset(pack_thread, 0, sizeof(struct pack_thread_s));
+
+	for (compression = PACK_QUICKLZ; compression <= PACK_ZSTD; compression++) {
+		if ((pack_uses(pack, compression)) &&
+		    (ret = pack_thread_prepare(pack_thread, compression))) {
+			pack_thread_finish_callback(pack, pack_thread, ret);
+			return ret;
+		}
+	}
+
+	*threadptr = pack_thread;
+	return 0;
+}
 
-	if (pack->compression == PACK_QUICKLZ) {
+int pack_thread_prepare(struct pack_thread_s *pack_thread, int compression)
+{
+	size_t work_size = 0;
+
+	/* QuickLZ and LZO share work memory */
 #ifdef __QUICKLZ
-		*threadptr = malloc(__quicklz_hashtable);
+	if (compression == PACK_QUICKLZ)
+		work_size = __quicklz_hashtable;
 #endif
-	} else if (pack->compression == PACK_LZO) {
 #ifdef __LZO
-		*threadptr = malloc(__lzo_wrk_mem);
+	if (compression == PACK_LZO)
+		work_size = __lzo_wrk_mem;
 #endif
+	if (work_size > pack_thread->work_size) {
+		if (pack_thread->work)
+			free(pack_thread->work);
+		pack_thread->work_size = 0;
+		if (!(pack_thread->work = malloc(work_size)))
+			return ENOMEM;
+		pack_thread->work_size = work_size;
 	}
 
+#ifdef __LZ4
+	if ((compression == PACK_LZ4) && (!pack_thread->lz4)) {
+		if (!(pack_thread->lz4 = malloc(LZ4_sizeofState())))
+			return ENOMEM;
+	}
+#endif
+#ifdef __ZSTD
+	if ((compression == PACK_ZSTD) && (!pack_thread->zstd)) {
+		if (!(pack_thread->zstd = ZSTD_createCCtx()))
+			return ENOMEM;
+	}
+#endif
 	return 0;
 }
 
 void pack_thread_finish_callback(void *ptr, void *threadptr, int err)
 {
-	if (threadptr)
-		free(threadptr);
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) threadptr;
+	unsigned int i;
+
+	if (!pack_thread)
+		return;
+
+	if (pack_thread->slot) {
+		for (i = 1; i < pack_thread->slots; i++)
+			pack_thread_finish_callback(ptr, pack_thread->slot[i], err);
+		free(pack_thread->slot);
+	}
+
+	/* don't leave capture waiting for the frame */
+	if (pack_thread->has_ref)
+		pack_thread->ref.release(pack_thread->ref.arg);
+
+	if (pack_thread->work)
+		free(pack_thread->work);
+	if (pack_thread->lz4)
+		free(pack_thread->lz4);
+	if (pack_thread->scratch)
+		free(pack_thread->scratch);
+#ifdef __ZSTD
+	if (pack_thread->zstd)
+		ZSTD_freeCCtx(pack_thread->zstd);
+#endif
+	free(pack_thread);
 }
 
 int pack_read_callback(glc_thread_state_t *state)
 {
 	pack_t pack = (pack_t) state->ptr;
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) state->threadptr;
+	u_int64_t sw;
+	glc_stream_id_t id;
+	int timed, video, key, ret;
+
+	pack_thread->compression = pack->compression;
+	pack_thread->level = pack->level;
+	pack_thread->delta = 0;
+	pack_thread->tiles = 0;
+	pack_thread->blocks = 0;
+	pack_thread->switched = 0;
+	if ((sw = __atomic_load_n(&pack->sw, __ATOMIC_ACQUIRE))) {
+		pack_thread->compression = PACK_SWITCH_COMPRESSION(sw);
+		pack_thread->level = PACK_SWITCH_LEVEL(sw);
+		pack_thread->switched = 1;
+
+		/* this thread may not have used the codec before */
+		if (pack_thread_prepare(pack_thread, pack_thread->compression))
+			pack_thread->compression = PACK_STORE;
+	} else if (pack->compression == PACK_ADAPTIVE) {
+		pack_thread->read_time = glc_time(pack->glc);
+		pack_thread->busy = 0;
+
+		pthread_mutex_lock(&pack->adaptive_mutex);
+		pack_thread->compression = pack->ladder[pack->current].compression;
+		pack_thread->level = pack->ladder[pack->current].level;
+		pthread_mutex_unlock(&pack->adaptive_mutex);
+	}
+
+	if (state->header.type == GLC_MESSAGE_VIDEO_FRAME_REF) {
+		/* read picture straight from capture memory */
+		memcpy(&pack_thread->ref, state->read_data, sizeof(glc_video_frame_ref_t));
+		pack_thread->has_ref = 1;
+
+		state->header.type = GLC_MESSAGE_VIDEO_FRAME;
+		state->read_data = pack_thread->ref.data;
+		state->read_size = state->write_size = pack_thread->ref.size;
+	}
+
+	/* id and time are readable only before compression */
+	timed = (pack->stamp) &&
+		(!glc_util_message_time(state->header.type, state->read_data, state->read_size,
+					&pack_thread->stamp_id, &pack_thread->stamp_time));
+	video = (timed) &&
+		(!glc_util_message_video(state->header.type, state->read_data, state->read_size,
+					 &id, &key));
+
+	if ((ret = pack_message_read(pack, pack_thread, state)))
+		return ret;
+
+	/* copied messages keep their headers */
+	pack_thread->stamp = (timed) && (!(state->flags & GLC_THREAD_COPY));
+	if (pack_thread->stamp)
+		state->write_size += sizeof(glc_stamp_header_t);
+
+	/* whole pictures and key deltas don't need earlier ones */
+	pack_thread->stamp_flags = 0;
+	if (video)
+		pack_thread->stamp_flags |= GLC_STAMP_VIDEO;
+	if ((video) && (key) && ((!pack_thread->delta) || (pack_thread->key)))
+		pack_thread->stamp_flags |= GLC_STAMP_KEY;
+
+	return 0;
+}
+
+int pack_message_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state)
+{
+	if ((pack->delta_interval) && (state->header.type == GLC_MESSAGE_VIDEO_FRAME))
+		pack_delta_read(pack, pack_thread, state);
+	else if ((pack->delta_interval) && (pack->tiles) &&
+		 (state->header.type == GLC_MESSAGE_VIDEO_FORMAT))
+		pack_tiles_format(pack, state);
+
+	if (pack_thread->tiles) {
+		pack_tiles_read(pack, pack_thread, state);
+		return 0;
+	}
+
+	pack_thread->lpc = 0;
+	if (pack->audio_lpc) {
+		if (state->header.type == GLC_MESSAGE_AUDIO_FORMAT)
+			pack_audio_format(pack, state);
+		else if ((state->header.type == GLC_MESSAGE_AUDIO_DATA) &&
+			 (state->read_size > pack->compress_min) &&
+			 (pack_thread->compression != PACK_STORE) &&
+			 (pack_audio_read(pack, pack_thread, state)))
+			return 0;
+	}
 
 	/* compress only audio and pictures */
-	if ((state->read_size > pack->compress_min) &&
-	    ((state->header.type == GLC_MESSAGE_VIDEO_FRAME) |
-	     (state->header.type == GLC_MESSAGE_AUDIO_DATA))) {
-		if (pack->compression == PACK_QUICKLZ) {
+	if ((pack_thread->delta) ||
+	    ((state->read_size > pack->compress_min) &&
+	     ((state->header.type == GLC_MESSAGE_VIDEO_FRAME) |
+	      (state->header.type == GLC_MESSAGE_AUDIO_DATA)))) {
+		if (pack_thread->compression == PACK_QUICKLZ) {
 #ifdef __QUICKLZ
 			state->write_size = sizeof(glc_container_message_header_t)
 					    + sizeof(glc_quicklz_header_t)
@@ -242,7 +849,7 @@ int pack_read_callback(glc_thread_state_t *state)
 #else
 			goto copy;
 #endif
-		} else if (pack->compression == PACK_LZO) {
+		} else if (pack_thread->compression == PACK_LZO) {
 #ifdef __LZO
 			state->write_size = sizeof(glc_container_message_header_t)
 					    + sizeof(glc_lzo_header_t)
@@ -250,24 +857,67 @@ int pack_read_callback(glc_thread_state_t *state)
 #else
 			goto copy;
 #endif
-		} else if (pack->compression == PACK_LZJB) {
+		} else if (pack_thread->compression == PACK_LZJB) {
 #ifdef __LZJB
 			state->write_size = sizeof(glc_container_message_header_t)
 					    + sizeof(glc_lzjb_header_t)
 					    + __lzjb_worstcase(state->read_size);
 #else
 			goto copy;
+#endif
+		} else if (pack_thread->compression == PACK_LZ4) {
+#ifdef __LZ4
+			state->write_size = sizeof(glc_container_message_header_t)
+					    + sizeof(glc_lz4_header_t)
+					    + LZ4_compressBound(state->read_size);
+#else
+			goto copy;
+#endif
+		} else if (pack_thread->compression == PACK_ZSTD) {
+#ifdef __ZSTD
+			state->write_size = sizeof(glc_container_message_header_t)
+					    + sizeof(glc_zstd_header_t)
+					    + ZSTD_compressBound(state->read_size);
+#else
+			goto copy;
 #endif
 		} else
 			goto copy;
 
+		if ((pack->block_size) && (state->read_size >= 2 * pack->block_size))
+			pack_blocks_read(pack, pack_thread, state);
+
 		return 0;
 	}
 copy:
+	if (pack_thread->delta) {
+		/* delta is written uncompressed */
+		pack_thread->compression = PACK_STORE;
+		state->write_size = state->read_size;
+		return 0;
+	}
+
 	state->flags |= GLC_THREAD_COPY;
 	return 0;
 }
 
+int pack_close_callback(glc_thread_state_t *state)
+{
+	pack_t pack = (pack_t) state->ptr;
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) state->threadptr;
+
+	/* frame has been written, capture can reuse the memory */
+	if (pack_thread->has_ref) {
+		pack_thread->has_ref = 0;
+		pack_thread->ref.release(pack_thread->ref.arg);
+	}
+
+	if ((pack->compression == PACK_ADAPTIVE) && (!pack_thread->switched))
+		pack_adaptive_update(pack, pack_thread);
+
+	return 0;
+}
+
 int pack_lzo_write_callback(glc_thread_state_t *state)
 {
 #ifdef __LZO
@@ -279,7 +929,7 @@ int pack_lzo_write_callback(glc_thread_state_t *state)
 	__lzo_compress((unsigned char *) state->read_data, state->read_size,
 		       (unsigned char *) &state->write_data[sizeof(glc_lzo_header_t) +
 		       					    sizeof(glc_container_message_header_t)],
-		       &compressed_size, (lzo_voidp) state->threadptr);
+		       &compressed_size, (lzo_voidp) ((struct pack_thread_s *) state->threadptr)->work);
 
 	lzo_header->size = (glc_size_t) state->read_size;
 	memcpy(&lzo_header->header, &state->header, sizeof(glc_message_header_t));
@@ -307,7 +957,7 @@ int pack_quicklz_write_callback(glc_thread_state_t *state)
 			 (unsigned char *) &state->write_data[sizeof(glc_quicklz_header_t) +
 			 				      sizeof(glc_container_message_header_t)],
 			 state->read_size, &compressed_size,
-			 (uintptr_t *) state->threadptr);
+			 (uintptr_t *) ((struct pack_thread_s *) state->threadptr)->work);
 
 	quicklz_header->size = (glc_size_t) state->read_size;
 	memcpy(&quicklz_header->header, &state->header, sizeof(glc_message_header_t));
@@ -349,110 +999,1345 @@ int pack_lzjb_write_callback(glc_thread_state_t *state)
 #endif
 }
 
-int unpack_init(unpack_t *unpack, glc_t *glc)
+int pack_lz4_write_callback(glc_thread_state_t *state)
 {
-	*unpack = (unpack_t) malloc(sizeof(struct unpack_s));
-	memset(*unpack, 0, sizeof(struct unpack_s));
+#ifdef __LZ4
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) state->threadptr;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	glc_lz4_header_t *lz4_header =
+		(glc_lz4_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	int compressed_size;
+
+	compressed_size = LZ4_compress_fast_extState(pack_thread->lz4,
+						     state->read_data,
+						     &state->write_data[sizeof(glc_lz4_header_t) +
+						     			sizeof(glc_container_message_header_t)],
+						     state->read_size,
+						     LZ4_compressBound(state->read_size),
+						     (pack_thread->level < 0) ? -pack_thread->level : 1);
+	if (compressed_size <= 0)
+		return EINVAL;
 
-	(*unpack)->glc = glc;
+	lz4_header->size = (glc_size_t) state->read_size;
+	memcpy(&lz4_header->header, &state->header, sizeof(glc_message_header_t));
 
-	(*unpack)->thread.flags = GLC_THREAD_WRITE | GLC_THREAD_READ;
-	(*unpack)->thread.ptr = *unpack;
-	(*unpack)->thread.read_callback = &unpack_read_callback;
-	(*unpack)->thread.write_callback = &unpack_write_callback;
-	(*unpack)->thread.finish_callback = &unpack_finish_callback;
-	(*unpack)->thread.threads = glc_threads_hint(glc);
+	container->size = compressed_size + sizeof(glc_lz4_header_t);
+	container->header.type = GLC_MESSAGE_LZ4;
 
-#ifdef __LZO
-	lzo_init();
+	state->header.type = GLC_MESSAGE_CONTAINER;
+
+	return 0;
+#else
+	return ENOTSUP;
 #endif
+}
+
+int pack_zstd_write_callback(glc_thread_state_t *state)
+{
+#ifdef __ZSTD
+	pack_t pack = (pack_t) state->ptr;
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) state->threadptr;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	glc_zstd_header_t *zstd_header =
+		(glc_zstd_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	size_t compressed_size;
+
+	compressed_size = ZSTD_compressCCtx(pack_thread->zstd,
+					    &state->write_data[sizeof(glc_zstd_header_t) +
+					    		       sizeof(glc_container_message_header_t)],
+					    ZSTD_compressBound(state->read_size),
+					    state->read_data, state->read_size,
+					    pack_thread->level);
+	if (ZSTD_isError(compressed_size)) {
+		glc_log(pack->glc, GLC_ERROR, "pack", "%s",
+			 ZSTD_getErrorName(compressed_size));
+		return EINVAL;
+	}
+
+	zstd_header->size = (glc_size_t) state->read_size;
+	memcpy(&zstd_header->header, &state->header, sizeof(glc_message_header_t));
+
+	container->size = compressed_size + sizeof(glc_zstd_header_t);
+	container->header.type = GLC_MESSAGE_ZSTD;
+
+	state->header.type = GLC_MESSAGE_CONTAINER;
 
 	return 0;
+#else
+	return ENOTSUP;
+#endif
 }
 
-int unpack_process_start(unpack_t unpack, ps_buffer_t *from, ps_buffer_t *to)
+int pack_write_callback(glc_thread_state_t *state)
 {
+	pack_t pack = (pack_t) state->ptr;
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) state->threadptr;
+	glc_stamp_header_t *stamp = (glc_stamp_header_t *) state->write_data;
 	int ret;
-	if (unpack->running)
-		return EAGAIN;
 
-	if ((ret = glc_thread_create(unpack->glc, &unpack->thread, from, to)))
+	if (!pack_thread->stamp)
+		return pack_message_write(pack, pack_thread, state);
+
+	/* message is written after stamp */
+	state->write_data += sizeof(glc_stamp_header_t);
+	ret = pack_message_write(pack, pack_thread, state);
+	state->write_data -= sizeof(glc_stamp_header_t);
+	if (ret)
 		return ret;
-	unpack->running = 1;
+
+	stamp->id = pack_thread->stamp_id;
+	stamp->time = pack_thread->stamp_time;
+	stamp->flags = pack_thread->stamp_flags;
+	memcpy(&stamp->header, &state->header, sizeof(glc_message_header_t));
+	state->header.type = GLC_MESSAGE_STAMP;
+
+	/* final size was set by writer */
+	if (state->flags & GLC_THREAD_STATE_UNKNOWN_FINAL_SIZE)
+		state->write_size += sizeof(glc_stamp_header_t);
 
 	return 0;
 }
 
-int unpack_process_wait(unpack_t unpack)
+int pack_message_write(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state)
 {
-	if (!unpack->running)
-		return EAGAIN;
+	char *to;
+	int ret;
 
-	glc_thread_wait(&unpack->thread);
-	unpack->running = 0;
+	if (pack_thread->lpc)
+		return pack_audio_write_callback(state);
 
-	return 0;
+	if (pack_thread->tiles)
+		return pack_tiles_write(pack, pack_thread, state);
+
+	if (pack_thread->delta) {
+		/* stored delta goes straight to target packet */
+		if (pack_thread->compression == PACK_STORE)
+			to = state->write_data;
+		else {
+			if ((ret = pack_scratch(&pack_thread->scratch, &pack_thread->scratch_size,
+						state->read_size)))
+				return ret;
+			to = (char *) pack_thread->scratch;
+		}
+
+		if ((ret = pack_delta_write(pack, pack_thread, state->read_data, to)))
+			return ret;
+
+		/* and compress delta instead of picture */
+		state->header.type = GLC_MESSAGE_VIDEO_DELTA;
+		state->read_data = to;
+
+		if (pack_thread->compression == PACK_STORE)
+			return 0;
+	}
+
+	if (pack_thread->blocks)
+		return pack_blocks_write_callback(state);
+
+	if (pack_thread->switched)
+		return pack_codec_write_callback(state);
+	return pack->write_callback(state);
 }
 
-int unpack_destroy(unpack_t unpack)
+void pack_audio_format(pack_t pack, glc_thread_state_t *state)
 {
-	free(unpack);
-	return 0;
+	glc_audio_format_message_t *fmt_msg = (glc_audio_format_message_t *) state->read_data;
+	struct pack_audio_s *audio;
+
+	if (state->read_size < sizeof(glc_audio_format_message_t))
+		return;
+	if (glc_registry_get(pack->audio, fmt_msg->id, (void **) &audio))
+		return;
+
+	/*
+	 Data read concurrently may still see old format. That only
+	 costs ratio, lpc restores any data in format it was told.
+	*/
+	__atomic_store_n(&audio->format,
+			 lpc_supported(fmt_msg->format) && fmt_msg->channels ?
+			 PACK_AUDIO_FORMAT(fmt_msg->format, fmt_msg->flags,
+					   fmt_msg->channels) : 0,
+			 __ATOMIC_RELEASE);
 }
 
-void unpack_finish_callback(void *ptr, int err)
+int pack_audio_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state)
 {
-	unpack_t unpack = (unpack_t) ptr;
+	glc_audio_data_header_t *audio_hdr = (glc_audio_data_header_t *) state->read_data;
+	struct pack_audio_s *audio;
+	u_int64_t format;
 
-	if (err)
-		glc_log(unpack->glc, GLC_ERROR, "unpack", "%s (%d)", strerror(err), err);
+	if (state->read_size < sizeof(glc_audio_data_header_t))
+		return 0;
+	if (!(audio = glc_registry_lookup(pack->audio, audio_hdr->id)))
+		return 0;
+	if (!(format = __atomic_load_n(&audio->format, __ATOMIC_ACQUIRE)))
+		return 0;
+
+	pack_thread->lpc = 1;
+	pack_thread->lpc_format = format;
+
+	state->write_size = sizeof(glc_container_message_header_t)
+			    + sizeof(glc_audio_lpc_header_t)
+			    + sizeof(glc_audio_data_header_t)
+			    + lpc_bound(state->read_size - sizeof(glc_audio_data_header_t),
+					format & 0xff, format >> 32);
+	return 1;
 }
 
-int unpack_read_callback(glc_thread_state_t *state)
+int pack_audio_write_callback(glc_thread_state_t *state)
 {
-	if (state->header.type == GLC_MESSAGE_LZO) {
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) state->threadptr;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	glc_audio_lpc_header_t *lpc_header =
+		(glc_audio_lpc_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	char *to = &state->write_data[sizeof(glc_container_message_header_t) +
+				      sizeof(glc_audio_lpc_header_t)];
+	size_t coded_size;
+	int ret;
+
+	lpc_header->size = (glc_size_t) state->read_size;
+	lpc_header->format = pack_thread->lpc_format & 0xff;
+	lpc_header->flags = (pack_thread->lpc_format >> 8) & 0xff;
+	lpc_header->channels = pack_thread->lpc_format >> 32;
+	memcpy(&lpc_header->header, &state->header, sizeof(glc_message_header_t));
+
+	/* stream id and time stay readable */
+	memcpy(to, state->read_data, sizeof(glc_audio_data_header_t));
+	if ((ret = lpc_encode(&state->read_data[sizeof(glc_audio_data_header_t)],
+			      state->read_size - sizeof(glc_audio_data_header_t),
+			      lpc_header->format, lpc_header->flags, lpc_header->channels,
+			      &to[sizeof(glc_audio_data_header_t)], &coded_size)))
+		return ret;
+
+	container->size = sizeof(glc_audio_lpc_header_t) + sizeof(glc_audio_data_header_t)
+			  + coded_size;
+	container->header.type = GLC_MESSAGE_AUDIO_LPC;
+
+	state->header.type = GLC_MESSAGE_CONTAINER;
+
+	return 0;
+}
+
+size_t pack_bound(int compression, size_t size)
+{
+#ifdef __QUICKLZ
+	if (compression == PACK_QUICKLZ)
+		return __quicklz_worstcase(size);
+#endif
+#ifdef __LZO
+	if (compression == PACK_LZO)
+		return __lzo_worstcase(size);
+#endif
+#ifdef __LZJB
+	if (compression == PACK_LZJB)
+		return __lzjb_worstcase(size);
+#endif
+#ifdef __LZ4
+	if (compression == PACK_LZ4)
+		return LZ4_compressBound(size);
+#endif
+#ifdef __ZSTD
+	if (compression == PACK_ZSTD)
+		return ZSTD_compressBound(size);
+#endif
+	return size;
+}
+
+void pack_blocks_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state)
+{
+	pack_thread->blocks = (state->read_size + pack->block_size - 1) / pack->block_size;
+
+	/* every block is compressed to its own worst case slot */
+	state->write_size = sizeof(glc_container_message_header_t)
+			    + sizeof(glc_blocks_header_t)
+			    + pack_thread->blocks * sizeof(u_int32_t)
+			    + pack_thread->blocks * pack_bound(pack_thread->compression,
+							       pack->block_size);
+}
+
+int pack_blocks_write_callback(glc_thread_state_t *state)
+{
+	pack_t pack = (pack_t) state->ptr;
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) state->threadptr;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	glc_blocks_header_t *blocks_header =
+		(glc_blocks_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	unsigned int i, slots = glc_slice_count(pack->glc);
+	glc_utime_t start = glc_time(pack->glc);
+	struct pack_blocks_s blocks;
+	struct pack_thread_s **slot;
+	size_t compressed_size = 0;
+	int ret;
+
+	/* blocks run concurrently, each run needs its own compressor state */
+	if (pack_thread->slots < slots) {
+		if (!(slot = (struct pack_thread_s **) realloc(pack_thread->slot,
+				sizeof(struct pack_thread_s *) * slots)))
+			return ENOMEM;
+		pack_thread->slot = slot;
+
+		pack_thread->slot[0] = pack_thread;
+		if (!pack_thread->slots)
+			pack_thread->slots = 1;
+		for (; pack_thread->slots < slots; pack_thread->slots++) {
+			if ((ret = pack_thread_create_callback(pack,
+				(void **) &pack_thread->slot[pack_thread->slots])))
+				return ret;
+		}
+	}
+
+	/* switched codec may be new to the slots */
+	if (pack_thread->switched) {
+		for (i = 1; i < slots; i++) {
+			if ((ret = pack_thread_prepare(pack_thread->slot[i],
+						       pack_thread->compression)))
+				return ret;
+		}
+	}
+
+	memset(&blocks, 0, sizeof(struct pack_blocks_s));
+	blocks.pack = pack;
+	blocks.slot = pack_thread->slot;
+	blocks.run = (pack_thread->blocks + slots - 1) / slots;
+	blocks.compression = pack_thread->compression;
+	blocks.level = pack_thread->level;
+	blocks.from = state->read_data;
+	blocks.size = state->read_size;
+	blocks.block_size = pack->block_size;
+	blocks.bound = pack_bound(pack_thread->compression, pack->block_size);
+	blocks.sizes = (u_int32_t *) &state->write_data[sizeof(glc_container_message_header_t) +
+							sizeof(glc_blocks_header_t)];
+	blocks.to = (char *) &blocks.sizes[pack_thread->blocks];
+
+	if ((ret = glc_slice_run_blocks(pack->glc, pack_thread->blocks,
+					&pack_block_callback, &blocks)))
+		return ret;
+	if (blocks.ret)
+		return blocks.ret;
+
+	/* close gaps left by worst case slots */
+	for (i = 0; i < pack_thread->blocks; i++) {
+		if (compressed_size != i * blocks.bound)
+			memmove(&blocks.to[compressed_size], &blocks.to[i * blocks.bound],
+				blocks.sizes[i]);
+		compressed_size += blocks.sizes[i];
+	}
+
+	blocks_header->size = (glc_size_t) state->read_size;
+	blocks_header->block_size = (u_int32_t) pack->block_size;
+	blocks_header->blocks = pack_thread->blocks;
+	if (pack_thread->compression == PACK_QUICKLZ)
+		blocks_header->compression = GLC_MESSAGE_QUICKLZ;
+	else if (pack_thread->compression == PACK_LZO)
+		blocks_header->compression = GLC_MESSAGE_LZO;
+	else if (pack_thread->compression == PACK_LZJB)
+		blocks_header->compression = GLC_MESSAGE_LZJB;
+	else if (pack_thread->compression == PACK_LZ4)
+		blocks_header->compression = GLC_MESSAGE_LZ4;
+	else
+		blocks_header->compression = GLC_MESSAGE_ZSTD;
+	memcpy(&blocks_header->header, &state->header, sizeof(glc_message_header_t));
+
+	container->size = sizeof(glc_blocks_header_t)
+			  + pack_thread->blocks * sizeof(u_int32_t)
+			  + compressed_size;
+	container->header.type = GLC_MESSAGE_BLOCKS;
+
+	state->header.type = GLC_MESSAGE_CONTAINER;
+
+	if (pack->compression == PACK_ADAPTIVE)
+		pack_thread->busy = glc_time(pack->glc) - start;
+
+	return 0;
+}
+
+void pack_block_callback(void *ptr, unsigned int y, unsigned int rows)
+{
+	struct pack_blocks_s *blocks = (struct pack_blocks_s *) ptr;
+	struct pack_thread_s *slot = blocks->slot[y / blocks->run];
+	size_t size, compressed_size;
+	unsigned int i;
+	int ret;
+
+	for (i = y; i < y + rows; i++) {
+		size = blocks->size - i * blocks->block_size;
+		if (size > blocks->block_size)
+			size = blocks->block_size;
+
+		if ((ret = pack_block_compress(blocks->pack, slot,
+					       blocks->compression, blocks->level,
+					       &blocks->from[i * blocks->block_size], size,
+					       &blocks->to[i * blocks->bound], &compressed_size))) {
+			blocks->ret = ret;
+			return;
+		}
+		blocks->sizes[i] = (u_int32_t) compressed_size;
+	}
+}
+
+int pack_block_compress(pack_t pack, struct pack_thread_s *slot, int compression, int level,
+			const char *from, size_t size, char *to, size_t *compressed_size)
+{
+#ifdef __QUICKLZ
+	if (compression == PACK_QUICKLZ) {
+		quicklz_compress((const unsigned char *) from, (unsigned char *) to,
+				 size, compressed_size, (uintptr_t *) slot->work);
+		return 0;
+	}
+#endif
 #ifdef __LZO
-		state->write_size = ((glc_lzo_header_t *) state->read_data)->size;
+	if (compression == PACK_LZO) {
+		lzo_uint lzo_size;
+		__lzo_compress((unsigned char *) from, size, (unsigned char *) to,
+			       &lzo_size, (lzo_voidp) slot->work);
+		*compressed_size = lzo_size;
+		return 0;
+	}
+#endif
+#ifdef __LZJB
+	if (compression == PACK_LZJB) {
+		*compressed_size = lzjb_compress((char *) from, to, size);
+		return 0;
+	}
+#endif
+#ifdef __LZ4
+	if (compression == PACK_LZ4) {
+		int lz4_size = LZ4_compress_fast_extState(slot->lz4, from, to, size,
+							  LZ4_compressBound(size),
+							  (level < 0) ? -level : 1);
+		if (lz4_size <= 0)
+			return EINVAL;
+		*compressed_size = lz4_size;
 		return 0;
+	}
+#endif
+#ifdef __ZSTD
+	if (compression == PACK_ZSTD) {
+		*compressed_size = ZSTD_compressCCtx(slot->zstd, to, ZSTD_compressBound(size),
+						     from, size, level);
+		if (ZSTD_isError(*compressed_size)) {
+			glc_log(pack->glc, GLC_ERROR, "pack", "%s",
+				 ZSTD_getErrorName(*compressed_size));
+			return EINVAL;
+		}
+		return 0;
+	}
+#endif
+	return ENOTSUP;
+}
+
+int pack_adaptive_write_callback(glc_thread_state_t *state)
+{
+	pack_t pack = (pack_t) state->ptr;
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) state->threadptr;
+	glc_utime_t start = glc_time(pack->glc);
+	int ret;
+
+	ret = pack_codec_write_callback(state);
+
+	pack_thread->busy = glc_time(pack->glc) - start;
+	return ret;
+}
+
+int pack_codec_write_callback(glc_thread_state_t *state)
+{
+	struct pack_thread_s *pack_thread = (struct pack_thread_s *) state->threadptr;
+
+	/* codec was chosen, and packet sized, in read callback */
+	if (pack_thread->compression == PACK_QUICKLZ)
+		return pack_quicklz_write_callback(state);
+	else if (pack_thread->compression == PACK_LZO)
+		return pack_lzo_write_callback(state);
+	else if (pack_thread->compression == PACK_LZJB)
+		return pack_lzjb_write_callback(state);
+	else if (pack_thread->compression == PACK_LZ4)
+		return pack_lz4_write_callback(state);
+	else if (pack_thread->compression == PACK_ZSTD)
+		return pack_zstd_write_callback(state);
+	return ENOTSUP;
+}
+
+int pack_available(int compression)
+{
+	if (compression == PACK_STORE)
+		return 1;
+#ifdef __QUICKLZ
+	if (compression == PACK_QUICKLZ)
+		return 1;
+#endif
+#ifdef __LZO
+	if (compression == PACK_LZO)
+		return 1;
+#endif
+#ifdef __LZJB
+	if (compression == PACK_LZJB)
+		return 1;
+#endif
+#ifdef __LZ4
+	if (compression == PACK_LZ4)
+		return 1;
+#endif
+#ifdef __ZSTD
+	if (compression == PACK_ZSTD)
+		return 1;
+#endif
+	return 0;
+}
+
+int pack_uses(pack_t pack, int compression)
+{
+	unsigned int i;
+
+	if (pack->compression == compression)
+		return 1;
+
+	if (pack->compression == PACK_ADAPTIVE) {
+		for (i = 0; i < pack->ladder_count; i++) {
+			if (pack->ladder[i].compression == compression)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+void pack_adaptive_init(pack_t pack)
+{
+	struct pack_codec_s *ladder = pack->ladder;
+	unsigned int n = 0;
+
+	ladder[n].compression = PACK_STORE;
+	ladder[n++].level = 0;
+#ifdef __LZ4
+	ladder[n].compression = PACK_LZ4;
+	ladder[n++].level = -8;
+	ladder[n].compression = PACK_LZ4;
+	ladder[n++].level = 1;
+#endif
+#ifdef __QUICKLZ
+	ladder[n].compression = PACK_QUICKLZ;
+	ladder[n++].level = 0;
+#endif
+#ifdef __LZO
+	ladder[n].compression = PACK_LZO;
+	ladder[n++].level = 0;
+#endif
+#ifdef __ZSTD
+	ladder[n].compression = PACK_ZSTD;
+	ladder[n++].level = 1;
+	ladder[n].compression = PACK_ZSTD;
+	ladder[n++].level = 3;
+	ladder[n].compression = PACK_ZSTD;
+	ladder[n++].level = 6;
+#endif
+
+	pack->ladder_count = n;
+	pack->ceiling = n - 1;
+	pack->hold = 0;
+
+	/* start from a fast codec and let the load decide */
+	pack->current = (n > 2) ? 2 : n - 1;
+	pack->window_start = glc_time(pack->glc);
+	pack->idle = pack->busy = pack->wait = 0;
+}
+
+void pack_adaptive_update(pack_t pack, struct pack_thread_s *pack_thread)
+{
+	glc_utime_t now = glc_time(pack->glc);
+	glc_utime_t total, idle = 0;
+
+	/* time since last packet went mostly to waiting for input */
+	if ((pack_thread->last_close) && (pack_thread->read_time > pack_thread->last_close))
+		idle = pack_thread->read_time - pack_thread->last_close;
+	total = now - pack_thread->read_time;
+	pack_thread->last_close = now;
+
+	pthread_mutex_lock(&pack->adaptive_mutex);
+	pack->idle += idle;
+	pack->busy += pack_thread->busy;
+	/* rest is write turn and waiting for compressed buffer */
+	if (total > pack_thread->busy)
+		pack->wait += total - pack_thread->busy;
+
+	if (now - pack->window_start >= PACK_ADAPTIVE_WINDOW) {
+		pack_adaptive_decide(pack);
+		pack->window_start = now;
+		pack->idle = pack->busy = pack->wait = 0;
+	}
+	pthread_mutex_unlock(&pack->adaptive_mutex);
+}
+
+void pack_adaptive_decide(pack_t pack)
+{
+	glc_utime_t sum = pack->idle + pack->busy + pack->wait;
+	unsigned int prev = pack->current;
+	double idle, wait;
+
+	if (!sum)
+		return;
+	idle = (double) pack->idle / (double) sum;
+	wait = (double) pack->wait / (double) sum;
+
+	if ((pack->hold) && (!--pack->hold))
+		pack->ceiling = pack->ladder_count - 1;
+
+	if (wait > PACK_ADAPTIVE_WAIT) {
+		/* file can't keep up, compress harder */
+		if (pack->current < pack->ceiling)
+			pack->current++;
+	} else if (idle < pack->headroom) {
+		/* workers are saturated and uncompressed buffer fills up,
+		   which is when capture starts dropping frames */
+		if (pack->current > 0) {
+			pack->current--;
+			pack->ceiling = pack->current;
+			pack->hold = PACK_ADAPTIVE_HOLD;
+		}
+	} else if (idle > 2 * pack->headroom) {
+		/* plenty of time left, save disk */
+		if (pack->current < pack->ceiling)
+			pack->current++;
+	}
+
+	if (pack->current != prev)
+		glc_log(pack->glc, GLC_PERFORMANCE, "pack",
+			 "switching to %s (level %d), %.0f%% idle, %.0f%% waiting for output",
+			 pack_compression_name(pack->ladder[pack->current].compression),
+			 pack->ladder[pack->current].level, idle * 100.0, wait * 100.0);
+}
+
+void pack_get_stream(pack_t pack, glc_stream_id_t id, struct pack_stream_s **stream)
+{
+	/* only read callbacks touch the list, and they run one at a time */
+	*stream = pack->stream;
+	while (*stream != NULL) {
+		if ((*stream)->id == id)
+			return;
+		*stream = (*stream)->next;
+	}
+
+	*stream = (struct pack_stream_s *) malloc(sizeof(struct pack_stream_s));
+	memset(*stream, 0, sizeof(struct pack_stream_s));
+
+	(*stream)->id = id;
+	pthread_mutex_init(&(*stream)->mutex, NULL);
+	pthread_cond_init(&(*stream)->cond, NULL);
+
+	(*stream)->next = pack->stream;
+	pack->stream = *stream;
+}
+
+void pack_delta_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state)
+{
+	glc_video_frame_header_t *pic = (glc_video_frame_header_t *) state->read_data;
+	size_t size = state->read_size - sizeof(glc_video_frame_header_t);
+
+	pack_get_stream(pack, pic->id, &pack_thread->stream);
+
+	/* read callbacks run in packet order, so frames are numbered in order */
+	pack_thread->frame = pack_thread->stream->frames++;
+	pack_thread->key = ((pack_thread->frame % pack->delta_interval) == 0) ||
+			   (size != pack_thread->stream->size);
+	pack_thread->stream->size = size;
+
+	/* picture is replaced with delta in write callback */
+	pack_thread->delta = 1;
+	state->read_size = sizeof(glc_video_delta_header_t) + size;
+
+	/* key frames stay whole, they are where playback can start */
+	if ((pack->tiles) && (!pack_thread->key) && (pack_thread->stream->tile_width) &&
+	    ((size_t) pack_thread->stream->row * pack_thread->stream->rows == size)) {
+		pack_thread->tiles = 1;
+		pack_thread->row = pack_thread->stream->row;
+		pack_thread->rows = pack_thread->stream->rows;
+		pack_thread->tile_width = pack_thread->stream->tile_width;
+	}
+}
+
+int pack_delta_write(pack_t pack, struct pack_thread_s *pack_thread,
+		     const char *from, char *to)
+{
+	glc_video_frame_header_t *pic = (glc_video_frame_header_t *) from;
+	glc_video_delta_header_t *delta = (glc_video_delta_header_t *) to;
+	struct pack_stream_s *stream = pack_thread->stream;
+	const unsigned char *data = (const unsigned char *) &from[sizeof(glc_video_frame_header_t)];
+	unsigned char *delta_data = (unsigned char *) &to[sizeof(glc_video_delta_header_t)];
+	size_t size = stream->size;
+	int ret;
+
+	delta->id = pic->id;
+	delta->time = pic->time;
+	delta->frame = pack_thread->frame;
+	delta->flags = pack_thread->key ? GLC_VIDEO_DELTA_KEY : 0;
+
+	/* reference must hold previous picture */
+	if ((ret = pack_delta_wait(pack->glc, stream, pack_thread->frame, 0)))
+		return ret;
+
+	if (pack_thread->key) {
+		if ((ret = pack_scratch(&stream->ref, &stream->ref_size, size))) {
+			pack_delta_done(stream, pack_thread->frame);
+			return ret;
+		}
+		memcpy(stream->ref, data, size);
+		memcpy(delta_data, data, size);
+	} else
+		pack_delta_xor(delta_data, data, stream->ref, size, 0);
+
+	pack_delta_done(stream, pack_thread->frame);
+	return 0;
+}
+
+int pack_delta_wait(glc_t *glc, struct pack_stream_s *stream, u_int32_t frame, int tries)
+{
+	struct timeval now;
+	struct timespec abstime;
+	int ret = 0, waits = 0;
+
+	pthread_mutex_lock(&stream->mutex);
+	while (stream->done != frame) {
+		/* earlier frame is not coming, eg. stream was cut */
+		if ((frame < stream->done) || ((tries) && (waits++ >= tries))) {
+			ret = EAGAIN;
+			break;
+		}
+		if (glc_state_test(glc, GLC_STATE_CANCEL)) {
+			ret = EINTR;
+			break;
+		}
+
+		gettimeofday(&now, NULL);
+		abstime.tv_sec = now.tv_sec + (now.tv_usec + PACK_DELTA_WAIT * 1000) / 1000000;
+		abstime.tv_nsec = ((now.tv_usec + PACK_DELTA_WAIT * 1000) % 1000000) * 1000;
+		pthread_cond_timedwait(&stream->cond, &stream->mutex, &abstime);
+	}
+	pthread_mutex_unlock(&stream->mutex);
+
+	return ret;
+}
+
+void pack_delta_done(struct pack_stream_s *stream, u_int32_t frame)
+{
+	pthread_mutex_lock(&stream->mutex);
+	stream->done = frame + 1;
+	pthread_cond_broadcast(&stream->cond);
+	pthread_mutex_unlock(&stream->mutex);
+}
+
+void pack_delta_xor(unsigned char *to, const unsigned char *from, unsigned char *ref,
+		    size_t size, int decode)
+{
+	unsigned long f, r, t;
+	size_t i;
+
+	/* delta is stored in to, and reference updated to current picture */
+	for (i = 0; i + sizeof(unsigned long) <= size; i += sizeof(unsigned long)) {
+		memcpy(&f, &from[i], sizeof(unsigned long));
+		memcpy(&r, &ref[i], sizeof(unsigned long));
+		t = f ^ r;
+		memcpy(&to[i], &t, sizeof(unsigned long));
+		memcpy(&ref[i], decode ? &t : &f, sizeof(unsigned long));
+	}
+
+	for (; i < size; i++) {
+		to[i] = from[i] ^ ref[i];
+		ref[i] = decode ? to[i] : from[i];
+	}
+}
+
+int pack_scratch(unsigned char **scratch, size_t *scratch_size, size_t size)
+{
+	if (size <= *scratch_size)
+		return 0;
+
+	if (*scratch)
+		free(*scratch);
+	if (!(*scratch = (unsigned char *) malloc(size))) {
+		*scratch_size = 0;
+		return ENOMEM;
+	}
+	*scratch_size = size;
+
+	return 0;
+}
+
+void pack_stream_free(struct pack_stream_s *stream)
+{
+	struct pack_stream_s *del;
+
+	while (stream != NULL) {
+		del = stream;
+		stream = stream->next;
+
+		pthread_cond_destroy(&del->cond);
+		pthread_mutex_destroy(&del->mutex);
+		if (del->ref)
+			free(del->ref);
+		free(del);
+	}
+}
+
+void pack_tiles_simd(pack_t pack)
+{
+	glc_flags_t cpu = glc_cpu_features(pack->glc);
+
+	/* memcmp() is vectorized too, but stops to find where bytes differ */
+	pack->tile_differs = &pack_tile_differs;
+
+#ifdef PACK_X86
+	if (cpu & GLC_CPU_AVX2)
+		pack->tile_differs = &pack_tile_differs_avx2;
+	else if (cpu & GLC_CPU_SSE2)
+		pack->tile_differs = &pack_tile_differs_sse2;
+#endif
+
+#ifdef __ARM_NEON
+	if (cpu & GLC_CPU_NEON)
+		pack->tile_differs = &pack_tile_differs_neon;
+#endif
+}
+
+void pack_tiles_format(pack_t pack, glc_thread_state_t *state)
+{
+	glc_video_format_message_t *fmt_msg = (glc_video_format_message_t *) state->read_data;
+	struct pack_stream_s *stream;
+	u_int32_t bpp;
+
+	if (state->read_size < sizeof(glc_video_format_message_t))
+		return;
+
+	pack_get_stream(pack, fmt_msg->id, &stream);
+	stream->row = stream->rows = stream->tile_width = 0;
+
+	if ((fmt_msg->format == GLC_VIDEO_YCBCR_420JPEG) ||
+	    (fmt_msg->format == GLC_VIDEO_NV12)) {
+		/* chroma planes are half as many rows of luma width */
+		if ((fmt_msg->width % 2) || (fmt_msg->height % 2))
+			return;
+		stream->row = fmt_msg->width;
+		stream->rows = fmt_msg->height + fmt_msg->height / 2;
+		stream->tile_width = PACK_TILE_SIZE;
+		return;
+	} else if ((fmt_msg->format == GLC_VIDEO_BGR) ||
+		   (fmt_msg->format == GLC_VIDEO_RGB))
+		bpp = 3;
+	else if (fmt_msg->format == GLC_VIDEO_BGRA)
+		bpp = 4;
+	else
+		return;
+
+	stream->row = fmt_msg->width * bpp;
+	if ((fmt_msg->flags & GLC_VIDEO_DWORD_ALIGNED) && (stream->row % 8 != 0))
+		stream->row += 8 - stream->row % 8;
+	stream->rows = fmt_msg->height;
+	stream->tile_width = PACK_TILE_SIZE * bpp;
+}
+
+void pack_tiles_read(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state)
+{
+	size_t tiles = ((pack_thread->row + pack_thread->tile_width - 1) / pack_thread->tile_width) *
+		       ((pack_thread->rows + PACK_TILE_SIZE - 1) / PACK_TILE_SIZE);
+	size_t data_size = (tiles + 7) / 8 + (size_t) pack_thread->row * pack_thread->rows;
+
+	/* header stays uncompressed so unpack knows picture size */
+	if ((pack_thread->compression == PACK_STORE) ||
+	    (!pack_available(pack_thread->compression)) ||
+	    (data_size <= pack->compress_min))
+		pack_thread->compression = PACK_STORE;
+
+	state->write_size = sizeof(glc_video_tiles_header_t) +
+			    pack_bound(pack_thread->compression, data_size);
+	if (state->write_size < sizeof(glc_video_tiles_header_t) + data_size)
+		state->write_size = sizeof(glc_video_tiles_header_t) + data_size;
+
+	/* usually only a few tiles are written */
+	state->flags |= GLC_THREAD_STATE_UNKNOWN_FINAL_SIZE;
+}
+
+int pack_tiles_write(pack_t pack, struct pack_thread_s *pack_thread, glc_thread_state_t *state)
+{
+	glc_video_frame_header_t *pic = (glc_video_frame_header_t *) state->read_data;
+	glc_video_tiles_header_t *tiles = (glc_video_tiles_header_t *) state->write_data;
+	const unsigned char *data = (const unsigned char *)
+				    &state->read_data[sizeof(glc_video_frame_header_t)];
+	char *payload = &state->write_data[sizeof(glc_video_tiles_header_t)];
+	struct pack_stream_s *stream = pack_thread->stream;
+	u_int32_t row = pack_thread->row, rows = pack_thread->rows;
+	u_int32_t tile_width = pack_thread->tile_width;
+	u_int32_t tiles_x = (row + tile_width - 1) / tile_width;
+	u_int32_t tiles_y = (rows + PACK_TILE_SIZE - 1) / PACK_TILE_SIZE;
+	u_int32_t tx, ty, x, y, w, h, tile, changed = 0;
+	size_t bitmap_size = ((size_t) tiles_x * tiles_y + 7) / 8;
+	size_t start, end, offset, data_size, compressed_size;
+	unsigned char *bitmap, *to;
+	int ret;
+
+	tiles->id = pic->id;
+	tiles->time = pic->time;
+	tiles->frame = pack_thread->frame;
+	tiles->flags = 0;
+	tiles->size = (glc_size_t) row * rows;
+	tiles->row = row;
+	tiles->rows = rows;
+	tiles->tile_width = tile_width;
+	tiles->tile_height = PACK_TILE_SIZE;
+
+	/* stored tiles go straight to target packet */
+	if (pack_thread->compression == PACK_STORE)
+		bitmap = (unsigned char *) payload;
+	else {
+		if ((ret = pack_scratch(&pack_thread->scratch, &pack_thread->scratch_size,
+					bitmap_size + tiles->size)))
+			return ret;
+		bitmap = pack_thread->scratch;
+	}
+	memset(bitmap, 0, bitmap_size);
+	to = &bitmap[bitmap_size];
+
+	/* reference must hold previous picture */
+	if ((ret = pack_delta_wait(pack->glc, stream, pack_thread->frame, 0)))
+		return ret;
+
+	for (ty = 0, tile = 0; ty < tiles_y; ty++) {
+		y = ty * PACK_TILE_SIZE;
+		h = rows - y < PACK_TILE_SIZE ? rows - y : PACK_TILE_SIZE;
+
+		for (tx = 0; tx < tiles_x; tx++, tile++) {
+			x = tx * tile_width;
+			w = row - x < tile_width ? row - x : tile_width;
+
+			start = (size_t) y * row + x;
+			end = (size_t) (y + h) * row;
+			for (offset = start; offset < end; offset += row) {
+				if (pack->tile_differs(&data[offset], &stream->ref[offset], w))
+					break;
+			}
+			if (offset >= end)
+				continue;
+
+			/* whole tile is written, rows that didn't change are zeros */
+			bitmap[tile / 8] |= 1 << (tile % 8);
+			for (offset = start; offset < end; offset += row, to += w)
+				pack_delta_xor(to, &data[offset], &stream->ref[offset], w, 0);
+			changed++;
+		}
+	}
+
+	pack_delta_done(stream, pack_thread->frame);
+	data_size = to - bitmap;
+
+	glc_log(pack->glc, GLC_DEBUG, "pack", "video %d: frame %u has %u/%u tiles changed",
+		 pic->id, pack_thread->frame, changed, tiles_x * tiles_y);
+
+	tiles->compression = 0;
+	tiles->data_size = data_size;
+	state->write_size = sizeof(glc_video_tiles_header_t) + data_size;
+	state->header.type = GLC_MESSAGE_VIDEO_TILES;
+
+	if ((pack_thread->compression == PACK_STORE) || (data_size <= pack->compress_min))
+		goto store;
+
+	if ((ret = pack_block_compress(pack, pack_thread, pack_thread->compression,
+				       pack_thread->level, (const char *) bitmap, data_size,
+				       payload, &compressed_size)))
+		return ret;
+	if (compressed_size >= data_size)
+		goto store;
+
+	if (pack_thread->compression == PACK_QUICKLZ)
+		tiles->compression = GLC_MESSAGE_QUICKLZ;
+	else if (pack_thread->compression == PACK_LZO)
+		tiles->compression = GLC_MESSAGE_LZO;
+	else if (pack_thread->compression == PACK_LZJB)
+		tiles->compression = GLC_MESSAGE_LZJB;
+	else if (pack_thread->compression == PACK_LZ4)
+		tiles->compression = GLC_MESSAGE_LZ4;
+	else
+		tiles->compression = GLC_MESSAGE_ZSTD;
+	state->write_size = sizeof(glc_video_tiles_header_t) + compressed_size;
+	return 0;
+store:
+	if (bitmap != (unsigned char *) payload)
+		memcpy(payload, bitmap, data_size);
+	return 0;
+}
+
+int pack_tile_differs(const unsigned char *a, const unsigned char *b, size_t size)
+{
+	return memcmp(a, b, size) != 0;
+}
+
+#ifdef PACK_X86
+
+__attribute__ ((target ("sse2")))
+int pack_tile_differs_sse2(const unsigned char *a, const unsigned char *b, size_t size)
+{
+	__m128i acc = _mm_setzero_si128();
+	size_t i;
+
+	for (i = 0; i + 16 <= size; i += 16)
+		acc = _mm_or_si128(acc, _mm_xor_si128(_mm_loadu_si128((const __m128i *) &a[i]),
+						      _mm_loadu_si128((const __m128i *) &b[i])));
+
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff)
+		return 1;
+	return pack_tile_differs(&a[i], &b[i], size - i);
+}
+
+__attribute__ ((target ("avx2")))
+int pack_tile_differs_avx2(const unsigned char *a, const unsigned char *b, size_t size)
+{
+	__m256i acc = _mm256_setzero_si256();
+	size_t i;
+
+	for (i = 0; i + 32 <= size; i += 32)
+		acc = _mm256_or_si256(acc, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &a[i]),
+							    _mm256_loadu_si256((const __m256i *) &b[i])));
+
+	if (!_mm256_testz_si256(acc, acc))
+		return 1;
+	return pack_tile_differs(&a[i], &b[i], size - i);
+}
+
+#endif /* PACK_X86 */
+
+#ifdef __ARM_NEON
+
+int pack_tile_differs_neon(const unsigned char *a, const unsigned char *b, size_t size)
+{
+	uint8x16_t acc = vdupq_n_u8(0);
+	uint8x8_t fold;
+	size_t i;
+
+	for (i = 0; i + 16 <= size; i += 16)
+		acc = vorrq_u8(acc, veorq_u8(vld1q_u8(&a[i]), vld1q_u8(&b[i])));
+
+	fold = vorr_u8(vget_low_u8(acc), vget_high_u8(acc));
+	if (vget_lane_u64(vreinterpret_u64_u8(fold), 0))
+		return 1;
+	return pack_tile_differs(&a[i], &b[i], size - i);
+}
+
+#endif /* __ARM_NEON */
+
+const char *pack_compression_name(int compression)
+{
+	if (compression == PACK_QUICKLZ)
+		return "QuickLZ";
+	else if (compression == PACK_LZO)
+		return "LZO";
+	else if (compression == PACK_LZJB)
+		return "LZJB";
+	else if (compression == PACK_LZ4)
+		return "LZ4";
+	else if (compression == PACK_ZSTD)
+		return "Zstandard";
+	return "no compression";
+}
+
+int unpack_init(unpack_t *unpack, glc_t *glc)
+{
+	*unpack = (unpack_t) malloc(sizeof(struct unpack_s));
+	memset(*unpack, 0, sizeof(struct unpack_s));
+
+	(*unpack)->glc = glc;
+
+	/* read callback only peeks at headers */
+	(*unpack)->thread.flags = GLC_THREAD_WRITE | GLC_THREAD_READ | GLC_THREAD_CONCURRENT_READ;
+	(*unpack)->thread.ptr = *unpack;
+	(*unpack)->thread.thread_create_callback = &unpack_thread_create_callback;
+	(*unpack)->thread.thread_finish_callback = &unpack_thread_finish_callback;
+	(*unpack)->thread.read_callback = &unpack_read_callback;
+	(*unpack)->thread.write_callback = &unpack_write_callback;
+	(*unpack)->thread.finish_callback = &unpack_finish_callback;
+	(*unpack)->thread.threads = glc_threads_hint(glc);
+	(*unpack)->thread.name = "unpack";
+
+	pthread_mutex_init(&(*unpack)->stream_mutex, NULL);
+
+#ifdef __LZO
+	lzo_init();
+#endif
+
+	return 0;
+}
+
+int unpack_process_start(unpack_t unpack, ps_buffer_t *from, ps_buffer_t *to)
+{
+	int ret;
+	if (unpack->running)
+		return EAGAIN;
+
+	if ((ret = glc_thread_create(unpack->glc, &unpack->thread, from, to)))
+		return ret;
+	unpack->running = 1;
+
+	return 0;
+}
+
+int unpack_process_wait(unpack_t unpack)
+{
+	if (!unpack->running)
+		return EAGAIN;
+
+	glc_thread_wait(&unpack->thread);
+	unpack->running = 0;
+
+	return 0;
+}
+
+int unpack_set_filter(unpack_t unpack, glc_message_type_t type, glc_stream_id_t id)
+{
+	if (unpack->running)
+		return EALREADY;
+
+	if ((type != GLC_MESSAGE_VIDEO_FRAME) && (type != GLC_MESSAGE_AUDIO_DATA))
+		return EINVAL;
+	if (unpack->filters >= UNPACK_FILTERS)
+		return ENOSPC;
+
+	unpack->filter[unpack->filters].type = type;
+	unpack->filter[unpack->filters].id = id;
+	unpack->filters++;
+
+	return 0;
+}
+
+int unpack_set_scan(unpack_t unpack, int scan)
+{
+	if (unpack->running)
+		return EALREADY;
+	unpack->scan = scan;
+	return 0;
+}
+
+int unpack_destroy(unpack_t unpack)
+{
+	pack_stream_free(unpack->stream);
+	pthread_mutex_destroy(&unpack->stream_mutex);
+	free(unpack);
+	return 0;
+}
+
+void unpack_finish_callback(void *ptr, int err)
+{
+	unpack_t unpack = (unpack_t) ptr;
+
+	if (err)
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "%s (%d)", strerror(err), err);
+}
+
+int unpack_thread_create_callback(void *ptr, void **threadptr)
+{
+	struct unpack_thread_s *unpack_thread;
+
+	unpack_thread = (struct unpack_thread_s *) malloc(sizeof(struct unpack_thread_s));
+	if (!unpack_thread)
+		return ENOMEM;
+	memset(unpack_thread, 0, sizeof(struct unpack_thread_s));
+
+#ifdef __ZSTD
+	if (!(unpack_thread->zstd = ZSTD_createDCtx())) {
+		free(unpack_thread);
+		return ENOMEM;
+	}
+#endif
+
+	*threadptr = unpack_thread;
+	return 0;
+}
+
+void unpack_thread_finish_callback(void *ptr, void *threadptr, int err)
+{
+	struct unpack_thread_s *unpack_thread = (struct unpack_thread_s *) threadptr;
+	unsigned int i;
+
+	if (!unpack_thread)
+		return;
+
+	if (unpack_thread->slot) {
+		for (i = 1; i < unpack_thread->slots; i++)
+			unpack_thread_finish_callback(ptr, unpack_thread->slot[i], err);
+		free(unpack_thread->slot);
+	}
+
+#ifdef __ZSTD
+	ZSTD_freeDCtx(unpack_thread->zstd);
+#endif
+	if (unpack_thread->scratch)
+		free(unpack_thread->scratch);
+	free(unpack_thread);
+}
+
+int unpack_read_callback(glc_thread_state_t *state)
+{
+	unpack_t unpack = (unpack_t) state->ptr;
+	struct unpack_thread_s *unpack_thread = (struct unpack_thread_s *) state->threadptr;
+	glc_message_header_t *header;
+	glc_size_t size;
+	char id[sizeof(glc_stream_id_t)];
+	char pic_hdr[sizeof(glc_video_frame_header_t)];
+
+	unpack_thread->delta_size = 0;
+	unpack_thread->scan_size = 0;
+
+	if (state->header.type == GLC_MESSAGE_LZO) {
+#ifdef __LZO
+		size = ((glc_lzo_header_t *) state->read_data)->size;
+		header = &((glc_lzo_header_t *) state->read_data)->header;
 #else
-		glc_log(((unpack_t) state->ptr)->glc,
+		glc_log(unpack->glc,
 			 GLC_ERROR, "unpack", "LZO not supported");
 		return ENOTSUP;
 #endif
 	} else if (state->header.type == GLC_MESSAGE_QUICKLZ) {
 #ifdef __QUICKLZ
-		state->write_size = ((glc_quicklz_header_t *) state->read_data)->size;
-		return 0;
+		size = ((glc_quicklz_header_t *) state->read_data)->size;
+		header = &((glc_quicklz_header_t *) state->read_data)->header;
 #else
-		glc_log(((unpack_t) state->ptr)->glc,
+		glc_log(unpack->glc,
 			 GLC_ERROR, "unpack", "QuickLZ not supported");
 		return ENOTSUP;
 #endif
 	} else if (state->header.type == GLC_MESSAGE_LZJB) {
 #ifdef __LZJB
-		state->write_size = ((glc_lzjb_header_t *) state->read_data)->size;
-		return 0;
+		size = ((glc_lzjb_header_t *) state->read_data)->size;
+		header = &((glc_lzjb_header_t *) state->read_data)->header;
 #else
-		glc_log(((unpack_t) state->ptr)->glc,
+		glc_log(unpack->glc,
 			GLC_ERROR, "unpack", "LZJB not supported");
 		return ENOTSUP;
 #endif
+	} else if (state->header.type == GLC_MESSAGE_LZ4) {
+#ifdef __LZ4
+		size = ((glc_lz4_header_t *) state->read_data)->size;
+		header = &((glc_lz4_header_t *) state->read_data)->header;
+#else
+		glc_log(unpack->glc,
+			 GLC_ERROR, "unpack", "LZ4 not supported");
+		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_ZSTD) {
+#ifdef __ZSTD
+		size = ((glc_zstd_header_t *) state->read_data)->size;
+		header = &((glc_zstd_header_t *) state->read_data)->header;
+#else
+		glc_log(unpack->glc,
+			 GLC_ERROR, "unpack", "Zstandard not supported");
+		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_BLOCKS) {
+		if (state->read_size < sizeof(glc_blocks_header_t))
+			return EINVAL;
+		size = ((glc_blocks_header_t *) state->read_data)->size;
+		header = &((glc_blocks_header_t *) state->read_data)->header;
+	} else if (state->header.type == GLC_MESSAGE_AUDIO_LPC) {
+		if (state->read_size < sizeof(glc_audio_lpc_header_t) +
+				       sizeof(glc_audio_data_header_t))
+			return EINVAL;
+		size = ((glc_audio_lpc_header_t *) state->read_data)->size;
+		header = &((glc_audio_lpc_header_t *) state->read_data)->header;
+		if (size < sizeof(glc_audio_data_header_t))
+			return EINVAL;
+	} else if (state->header.type == GLC_MESSAGE_VIDEO_DELTA) {
+		/* uncompressed delta */
+		size = state->read_size;
+		header = &state->header;
+	} else if (state->header.type == GLC_MESSAGE_VIDEO_TILES) {
+		/* header is never compressed */
+		if (state->read_size < sizeof(glc_video_tiles_header_t))
+			return EINVAL;
+		size = state->read_size;
+		header = &state->header;
+	} else {
+		if (!unpack_wanted(unpack, state->header.type, state->read_data, state->read_size))
+			goto skip;
+		if (unpack_late(unpack, state->header.type, state->read_data, state->read_size))
+			goto skip;
+		state->flags |= GLC_THREAD_COPY;
+		return 0;
+	}
+
+	/* decompress only streams that are wanted */
+	if (unpack->filters) {
+		if (!unpack_wanted(unpack, header->type, id, unpack_peek(state, id, sizeof(id))))
+			goto skip;
+	}
+
+	/* frames player would drop are not decompressed, deltas are needed */
+	if ((header->type == GLC_MESSAGE_VIDEO_FRAME) &&
+	    (glc_state_test(unpack->glc, GLC_STATE_DEADLINE)) &&
+	    (unpack_late(unpack, header->type, pic_hdr,
+			 unpack_peek(state, pic_hdr, sizeof(pic_hdr)))))
+		goto skip;
+
+	if ((unpack->scan) && (unpack_scan(unpack, state, header)))
+		return 0;
+
+	state->write_size = size;
+
+	if (header->type == GLC_MESSAGE_VIDEO_DELTA) {
+		if (size < sizeof(glc_video_delta_header_t))
+			return EINVAL;
+
+		/* delta is decompressed to scratch and picture rebuilt from there */
+		unpack_thread->delta_size = size;
+		state->write_size = size - sizeof(glc_video_delta_header_t)
+				    + sizeof(glc_video_frame_header_t);
+	} else if (header->type == GLC_MESSAGE_VIDEO_TILES) {
+		/* picture is rebuilt from reference */
+		state->write_size = ((glc_video_tiles_header_t *) state->read_data)->size
+				    + sizeof(glc_video_frame_header_t);
 	}
 
-	state->flags |= GLC_THREAD_COPY;
+	return 0;
+skip:
+	state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
 	return 0;
 }
 
 int unpack_write_callback(glc_thread_state_t *state)
 {
+	unpack_t unpack = (unpack_t) state->ptr;
+	struct unpack_thread_s *unpack_thread = (struct unpack_thread_s *) state->threadptr;
+	char *to = state->write_data;
+	size_t to_size = state->write_size;
+	int ret;
+
+	if (unpack_thread->scan_size) {
+		memcpy(state->write_data, unpack_thread->scan, state->write_size);
+		state->header.type = unpack_thread->scan_type;
+		return 0;
+	}
+
+	if (state->header.type == GLC_MESSAGE_VIDEO_DELTA) {
+		/* stored without compression */
+		ret = unpack_delta(unpack, state->read_data, state->read_size, state->write_data);
+		return unpack_picture(state, ret);
+	}
+
+	if (state->header.type == GLC_MESSAGE_VIDEO_TILES) {
+		ret = unpack_tiles(unpack, unpack_thread, state->read_data, state->read_size,
+				   state->write_data);
+		return unpack_picture(state, ret);
+	}
+
+	if (unpack_thread->delta_size) {
+		if ((ret = pack_scratch(&unpack_thread->scratch, &unpack_thread->scratch_size,
+					unpack_thread->delta_size)))
+			return ret;
+		to = (char *) unpack_thread->scratch;
+		to_size = unpack_thread->delta_size;
+	}
+
 	if (state->header.type == GLC_MESSAGE_LZO) {
 #ifdef __LZO
 		memcpy(&state->header, &((glc_lzo_header_t *) state->read_data)->header,
 		       sizeof(glc_message_header_t));
 		__lzo_decompress((unsigned char *) &state->read_data[sizeof(glc_lzo_header_t)],
 				state->read_size - sizeof(glc_lzo_header_t),
-				(unsigned char *) state->write_data,
-				(lzo_uintp) &state->write_size,
+				(unsigned char *) to,
+				(lzo_uintp) &to_size,
 				NULL);
 #else
 		return ENOTSUP;
@@ -462,8 +2347,8 @@ int unpack_write_callback(glc_thread_state_t *state)
 		memcpy(&state->header, &((glc_quicklz_header_t *) state->read_data)->header,
 		       sizeof(glc_message_header_t));
 		quicklz_decompress((const unsigned char *) &state->read_data[sizeof(glc_quicklz_header_t)],
-				   (unsigned char *) state->write_data,
-				   state->write_size);
+				   (unsigned char *) to,
+				   to_size);
 #else
 		return ENOTSUP;
 #endif
@@ -472,16 +2357,633 @@ int unpack_write_callback(glc_thread_state_t *state)
 		memcpy(&state->header, &((glc_quicklz_header_t *) state->read_data)->header,
 		       sizeof(glc_message_header_t));
 		lzjb_decompress(&state->read_data[sizeof(glc_lzjb_header_t)],
-				state->write_data,
+				to,
 				state->read_size - sizeof(glc_lzjb_header_t),
-				state->write_size);
+				to_size);
+#else
+		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_LZ4) {
+#ifdef __LZ4
+		memcpy(&state->header, &((glc_lz4_header_t *) state->read_data)->header,
+		       sizeof(glc_message_header_t));
+		if (LZ4_decompress_safe(&state->read_data[sizeof(glc_lz4_header_t)],
+					to,
+					state->read_size - sizeof(glc_lz4_header_t),
+					to_size) != to_size) {
+			glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted LZ4 packet");
+			return EINVAL;
+		}
 #else
 		return ENOTSUP;
 #endif
+	} else if (state->header.type == GLC_MESSAGE_ZSTD) {
+#ifdef __ZSTD
+		memcpy(&state->header, &((glc_zstd_header_t *) state->read_data)->header,
+		       sizeof(glc_message_header_t));
+		if (ZSTD_decompressDCtx(unpack_thread->zstd,
+					to, to_size,
+					&state->read_data[sizeof(glc_zstd_header_t)],
+					state->read_size - sizeof(glc_zstd_header_t))
+		    != to_size) {
+			glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted Zstandard packet");
+			return EINVAL;
+		}
+#else
+		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_BLOCKS) {
+		memcpy(&state->header, &((glc_blocks_header_t *) state->read_data)->header,
+		       sizeof(glc_message_header_t));
+		if ((ret = unpack_blocks(unpack, unpack_thread, state->read_data,
+					 state->read_size, to, to_size)))
+			return ret;
+	} else if (state->header.type == GLC_MESSAGE_AUDIO_LPC) {
+		if ((ret = unpack_audio(unpack, state->read_data, state->read_size, to, to_size)))
+			return ret;
+		memcpy(&state->header, &((glc_audio_lpc_header_t *) state->read_data)->header,
+		       sizeof(glc_message_header_t));
 	} else
 		return ENOTSUP;
 
+	if (unpack_thread->delta_size) {
+		ret = unpack_delta(unpack, to, to_size, state->write_data);
+		return unpack_picture(state, ret);
+	}
+
+	return 0;
+}
+
+int unpack_picture(glc_thread_state_t *state, int ret)
+{
+	/* frame without reference is not written at all */
+	if (ret == EAGAIN) {
+		state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
+		return 0;
+	} else if (ret)
+		return ret;
+
+	state->header.type = GLC_MESSAGE_VIDEO_FRAME;
 	return 0;
 }
 
+int unpack_audio(unpack_t unpack, const char *from, size_t from_size, char *to, size_t size)
+{
+	glc_audio_lpc_header_t *lpc_header = (glc_audio_lpc_header_t *) from;
+	int ret;
+
+	from += sizeof(glc_audio_lpc_header_t);
+	from_size -= sizeof(glc_audio_lpc_header_t);
+
+	/* audio data header is stored as is */
+	memcpy(to, from, sizeof(glc_audio_data_header_t));
+	if ((ret = lpc_decode(&from[sizeof(glc_audio_data_header_t)],
+			      from_size - sizeof(glc_audio_data_header_t),
+			      lpc_header->format, lpc_header->flags, lpc_header->channels,
+			      &to[sizeof(glc_audio_data_header_t)],
+			      size - sizeof(glc_audio_data_header_t)))) {
+		glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted audio packet");
+		return ret;
+	}
+
+	return 0;
+}
+
+int unpack_delta(unpack_t unpack, const char *from, size_t size, char *to)
+{
+	glc_video_delta_header_t *delta = (glc_video_delta_header_t *) from;
+	glc_video_frame_header_t *pic = (glc_video_frame_header_t *) to;
+	const unsigned char *delta_data = (const unsigned char *) &from[sizeof(glc_video_delta_header_t)];
+	unsigned char *data = (unsigned char *) &to[sizeof(glc_video_frame_header_t)];
+	struct pack_stream_s *stream;
+	int ret = 0;
+
+	size -= sizeof(glc_video_delta_header_t);
+	if (!(stream = unpack_get_stream(unpack, delta->id, delta->frame)))
+		return ENOMEM;
+
+	pic->id = delta->id;
+	pic->time = delta->time;
+
+	/* previous picture must be in reference */
+	if ((ret = pack_delta_wait(unpack->glc, stream, delta->frame, UNPACK_DELTA_TRIES))) {
+		if (ret == EINTR)
+			return ret;
+		glc_log(unpack->glc, GLC_WARNING, "unpack",
+			 "video %d: frame %u has no reference", delta->id, delta->frame);
+		ret = 0;
+	}
+
+	if (delta->flags & GLC_VIDEO_DELTA_KEY) {
+		if ((ret = pack_scratch(&stream->ref, &stream->ref_size, size)))
+			goto done;
+		memcpy(stream->ref, delta_data, size);
+		memcpy(data, delta_data, size);
+		stream->dropped = 0;
+	} else if (stream->ref_size == 0) {
+		/* eg. after seeking, nothing to show until next key frame */
+		unpack_drop(unpack, stream, delta->frame);
+		ret = EAGAIN;
+	} else if (stream->ref_size < size) {
+		glc_log(unpack->glc, GLC_ERROR, "unpack",
+			 "video %d: frame %u doesn't match reference", delta->id, delta->frame);
+		ret = EINVAL;
+	} else
+		pack_delta_xor(data, delta_data, stream->ref, size, 1);
+
+done:
+	pack_delta_done(stream, delta->frame);
+	return ret;
+}
+
+void unpack_drop(unpack_t unpack, struct pack_stream_s *stream, u_int32_t frame)
+{
+	if (!stream->dropped++)
+		glc_log(unpack->glc, GLC_WARNING, "unpack",
+			 "video %d: no key frame before frame %u, dropping until next",
+			 stream->id, frame);
+}
+
+struct pack_stream_s *unpack_get_stream(unpack_t unpack, glc_stream_id_t id, u_int32_t frame)
+{
+	struct pack_stream_s *stream, **last;
+
+	pthread_mutex_lock(&unpack->stream_mutex);
+	for (last = &unpack->stream; *last != NULL; last = &(*last)->next) {
+		if ((*last)->id == id)
+			break;
+	}
+	if ((*last == NULL) &&
+	    ((*last = (struct pack_stream_s *) malloc(sizeof(struct pack_stream_s))))) {
+		memset(*last, 0, sizeof(struct pack_stream_s));
+		(*last)->id = id;
+		(*last)->done = frame; /* stream may start from any key frame */
+		pthread_mutex_init(&(*last)->mutex, NULL);
+		pthread_cond_init(&(*last)->cond, NULL);
+	}
+	stream = *last;
+	pthread_mutex_unlock(&unpack->stream_mutex);
+
+	return stream;
+}
+
+int unpack_tiles(unpack_t unpack, struct unpack_thread_s *unpack_thread,
+		 const char *from, size_t from_size, char *to)
+{
+	glc_video_tiles_header_t *tiles = (glc_video_tiles_header_t *) from;
+	glc_video_frame_header_t *pic = (glc_video_frame_header_t *) to;
+	const unsigned char *bitmap = (const unsigned char *) &from[sizeof(glc_video_tiles_header_t)];
+	const unsigned char *tile_data;
+	struct pack_stream_s *stream;
+	u_int32_t tiles_x, tiles_y, tx, ty, x, y, w, h, tile;
+	size_t bitmap_size, offset, end, left;
+	int ret = 0;
+
+	/* geometry must describe exactly this picture */
+	if ((tiles->tile_width == 0) || (tiles->tile_height == 0) ||
+	    ((size_t) tiles->row * tiles->rows != tiles->size))
+		goto corrupted;
+	tiles_x = (tiles->row + tiles->tile_width - 1) / tiles->tile_width;
+	tiles_y = (tiles->rows + tiles->tile_height - 1) / tiles->tile_height;
+	bitmap_size = ((size_t) tiles_x * tiles_y + 7) / 8;
+	if (tiles->data_size < bitmap_size)
+		goto corrupted;
+	from_size -= sizeof(glc_video_tiles_header_t);
+
+	if (tiles->compression) {
+		if ((ret = pack_scratch(&unpack_thread->scratch, &unpack_thread->scratch_size,
+					tiles->data_size)))
+			return ret;
+		if ((ret = unpack_block_decompress(unpack, unpack_thread, tiles->compression,
+						   (const char *) bitmap, from_size,
+						   (char *) unpack_thread->scratch,
+						   tiles->data_size)))
+			return ret;
+		bitmap = unpack_thread->scratch;
+	} else if (from_size < tiles->data_size)
+		goto corrupted;
+
+	if (!(stream = unpack_get_stream(unpack, tiles->id, tiles->frame)))
+		return ENOMEM;
+
+	pic->id = tiles->id;
+	pic->time = tiles->time;
+
+	/* previous picture must be in reference */
+	if ((ret = pack_delta_wait(unpack->glc, stream, tiles->frame, UNPACK_DELTA_TRIES))) {
+		if (ret == EINTR)
+			return ret;
+		glc_log(unpack->glc, GLC_WARNING, "unpack",
+			 "video %d: frame %u has no reference", tiles->id, tiles->frame);
+		ret = 0;
+	}
+
+	if (stream->ref_size == 0) {
+		/* eg. after seeking, unchanged tiles are not known until next key frame */
+		unpack_drop(unpack, stream, tiles->frame);
+		ret = EAGAIN;
+		goto done;
+	} else if (stream->ref_size < tiles->size) {
+		glc_log(unpack->glc, GLC_ERROR, "unpack",
+			 "video %d: frame %u doesn't match reference", tiles->id, tiles->frame);
+		ret = EINVAL;
+		goto done;
+	}
+
+	tile_data = &bitmap[bitmap_size];
+	left = tiles->data_size - bitmap_size;
+	for (ty = 0, tile = 0; ty < tiles_y; ty++) {
+		y = ty * tiles->tile_height;
+		h = tiles->rows - y < tiles->tile_height ? tiles->rows - y : tiles->tile_height;
+
+		for (tx = 0; tx < tiles_x; tx++, tile++) {
+			if (!(bitmap[tile / 8] & (1 << (tile % 8))))
+				continue;
+
+			x = tx * tiles->tile_width;
+			w = tiles->row - x < tiles->tile_width ? tiles->row - x : tiles->tile_width;
+			if ((size_t) w * h > left) {
+				glc_log(unpack->glc, GLC_ERROR, "unpack",
+					 "video %d: frame %u is missing tiles", tiles->id, tiles->frame);
+				ret = EINVAL;
+				goto done;
+			}
+
+			/* reference becomes current picture */
+			end = (size_t) (y + h) * tiles->row;
+			for (offset = (size_t) y * tiles->row + x; offset < end;
+			     offset += tiles->row, tile_data += w, left -= w)
+				pack_delta_xor(&stream->ref[offset], tile_data,
+					       &stream->ref[offset], w, 1);
+		}
+	}
+
+	memcpy(&to[sizeof(glc_video_frame_header_t)], stream->ref, tiles->size);
+done:
+	pack_delta_done(stream, tiles->frame);
+	return ret;
+corrupted:
+	glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted tiles header");
+	return EINVAL;
+}
+
+int unpack_blocks(unpack_t unpack, struct unpack_thread_s *unpack_thread,
+		  const char *from, size_t from_size, char *to, size_t size)
+{
+	glc_blocks_header_t *header = (glc_blocks_header_t *) from;
+	unsigned int i, slots = glc_slice_count(unpack->glc);
+	struct unpack_blocks_s blocks;
+	struct unpack_thread_s **slot;
+	size_t index_size, compressed_size = 0;
+	int ret;
+
+	/* index must describe exactly this packet */
+	if ((header->block_size == 0) || (header->size != size) ||
+	    ((size + header->block_size - 1) / header->block_size != header->blocks))
+		goto corrupted;
+	index_size = sizeof(glc_blocks_header_t) + header->blocks * sizeof(u_int32_t);
+	if (index_size > from_size)
+		goto corrupted;
+
+	memset(&blocks, 0, sizeof(struct unpack_blocks_s));
+	blocks.sizes = (const u_int32_t *) &from[sizeof(glc_blocks_header_t)];
+	for (i = 0; i < header->blocks; i++)
+		compressed_size += blocks.sizes[i];
+	if (index_size + compressed_size > from_size)
+		goto corrupted;
+
+	if (unpack_thread->slots < slots) {
+		if (!(slot = (struct unpack_thread_s **) realloc(unpack_thread->slot,
+				sizeof(struct unpack_thread_s *) * slots)))
+			return ENOMEM;
+		unpack_thread->slot = slot;
+
+		unpack_thread->slot[0] = unpack_thread;
+		if (!unpack_thread->slots)
+			unpack_thread->slots = 1;
+		for (; unpack_thread->slots < slots; unpack_thread->slots++) {
+			if ((ret = unpack_thread_create_callback(unpack,
+				(void **) &unpack_thread->slot[unpack_thread->slots])))
+				return ret;
+		}
+	}
+
+	blocks.unpack = unpack;
+	blocks.slot = unpack_thread->slot;
+	blocks.run = (header->blocks + slots - 1) / slots;
+	blocks.compression = header->compression;
+	blocks.from = &from[index_size];
+	blocks.to = to;
+	blocks.size = size;
+	blocks.block_size = header->block_size;
+
+	if ((ret = glc_slice_run_blocks(unpack->glc, header->blocks,
+					&unpack_block_callback, &blocks)))
+		return ret;
+	return blocks.ret;
+
+corrupted:
+	glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted block index");
+	return EINVAL;
+}
+
+void unpack_block_callback(void *ptr, unsigned int y, unsigned int rows)
+{
+	struct unpack_blocks_s *blocks = (struct unpack_blocks_s *) ptr;
+	struct unpack_thread_s *slot = blocks->slot[y / blocks->run];
+	size_t offset = 0, size;
+	unsigned int i;
+	int ret;
+
+	/* runs are few, so summing index is cheaper than storing offsets */
+	for (i = 0; i < y; i++)
+		offset += blocks->sizes[i];
+
+	for (i = y; i < y + rows; i++) {
+		size = blocks->size - i * blocks->block_size;
+		if (size > blocks->block_size)
+			size = blocks->block_size;
+
+		if ((ret = unpack_block_decompress(blocks->unpack, slot, blocks->compression,
+						   &blocks->from[offset], blocks->sizes[i],
+						   &blocks->to[i * blocks->block_size], size))) {
+			blocks->ret = ret;
+			return;
+		}
+		offset += blocks->sizes[i];
+	}
+}
+
+int unpack_block_decompress(unpack_t unpack, struct unpack_thread_s *slot,
+			    glc_message_type_t compression, const char *from, size_t from_size,
+			    char *to, size_t size)
+{
+#ifdef __QUICKLZ
+	if (compression == GLC_MESSAGE_QUICKLZ) {
+		quicklz_decompress((const unsigned char *) from, (unsigned char *) to, size);
+		return 0;
+	}
+#endif
+#ifdef __LZO
+	if (compression == GLC_MESSAGE_LZO) {
+		lzo_uint lzo_size = size;
+		__lzo_decompress((unsigned char *) from, from_size,
+				 (unsigned char *) to, &lzo_size, NULL);
+		return 0;
+	}
+#endif
+#ifdef __LZJB
+	if (compression == GLC_MESSAGE_LZJB) {
+		lzjb_decompress((char *) from, to, from_size, size);
+		return 0;
+	}
+#endif
+#ifdef __LZ4
+	if (compression == GLC_MESSAGE_LZ4) {
+		if (LZ4_decompress_safe(from, to, from_size, size) != size) {
+			glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted LZ4 block");
+			return EINVAL;
+		}
+		return 0;
+	}
+#endif
+#ifdef __ZSTD
+	if (compression == GLC_MESSAGE_ZSTD) {
+		if (ZSTD_decompressDCtx(slot->zstd, to, size, from, from_size) != size) {
+			glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted Zstandard block");
+			return EINVAL;
+		}
+		return 0;
+	}
+#endif
+	glc_log(unpack->glc, GLC_ERROR, "unpack",
+		 "block compression 0x%02x not supported", compression);
+	return ENOTSUP;
+}
+
+int unpack_wanted(unpack_t unpack, glc_message_type_t type, const char *data, size_t size)
+{
+	unsigned int i;
+
+	if (!unpack->filters)
+		return 1;
+
+	/* only frames and audio data are dropped */
+	if ((type == GLC_MESSAGE_VIDEO_DELTA) || (type == GLC_MESSAGE_VIDEO_TILES))
+		type = GLC_MESSAGE_VIDEO_FRAME;
+	else if ((type != GLC_MESSAGE_VIDEO_FRAME) && (type != GLC_MESSAGE_AUDIO_DATA))
+		return 1;
+
+	for (i = 0; i < unpack->filters; i++) {
+		if (unpack->filter[i].type != type)
+			continue;
+
+		/* without stream id every stream of wanted type is kept */
+		if ((size < sizeof(glc_stream_id_t)) || (unpack->filter[i].id == 0) ||
+		    (unpack->filter[i].id == *((glc_stream_id_t *) data)))
+			return 1;
+	}
+
+	return 0;
+}
+
+int unpack_late(unpack_t unpack, glc_message_type_t type, const char *data, size_t size)
+{
+	glc_video_frame_header_t *pic_hdr = (glc_video_frame_header_t *) data;
+
+	if ((type != GLC_MESSAGE_VIDEO_FRAME) || (size < sizeof(glc_video_frame_header_t)))
+		return 0;
+	return glc_state_video_late(unpack->glc, pic_hdr->id, pic_hdr->time);
+}
+
+int unpack_peek(glc_thread_state_t *state, char *data, size_t size)
+{
+	struct unpack_thread_s *unpack_thread = (struct unpack_thread_s *) state->threadptr;
+	glc_message_type_t compression = state->header.type;
+	glc_blocks_header_t *blocks;
+	const char *from;
+	size_t from_size, to_size;
+
+	/*
+	 Frames, deltas and audio data all start with stream id. It can
+	 be read without decompressing only from uncompressed deltas,
+	 coded audio, and from codecs which can stop after first bytes.
+	*/
+	if ((state->header.type == GLC_MESSAGE_VIDEO_DELTA) ||
+	    (state->header.type == GLC_MESSAGE_VIDEO_TILES)) {
+		if (state->read_size < size)
+			return 0;
+		memcpy(data, state->read_data, size);
+		return size;
+	} else if (state->header.type == GLC_MESSAGE_AUDIO_LPC) {
+		if (state->read_size < sizeof(glc_audio_lpc_header_t) + size)
+			return 0;
+		memcpy(data, &state->read_data[sizeof(glc_audio_lpc_header_t)], size);
+		return size;
+	} else if (state->header.type == GLC_MESSAGE_BLOCKS) {
+		blocks = (glc_blocks_header_t *) state->read_data;
+		if ((state->read_size < sizeof(glc_blocks_header_t)) || (blocks->blocks == 0) ||
+		    (sizeof(glc_blocks_header_t) + blocks->blocks * sizeof(u_int32_t) >
+		     state->read_size))
+			return 0;
+		compression = blocks->compression;
+		from = &state->read_data[sizeof(glc_blocks_header_t) +
+					 blocks->blocks * sizeof(u_int32_t)];
+		from_size = ((u_int32_t *) &state->read_data[sizeof(glc_blocks_header_t)])[0];
+		to_size = blocks->size < blocks->block_size ? blocks->size : blocks->block_size;
+	} else {
+		/* codec headers share layout */
+		if (state->read_size < sizeof(glc_lz4_header_t))
+			return 0;
+		from = &state->read_data[sizeof(glc_lz4_header_t)];
+		from_size = state->read_size - sizeof(glc_lz4_header_t);
+		to_size = ((glc_lz4_header_t *) state->read_data)->size;
+	}
+
+	/* scan passes only first bytes of packet */
+	if (from + from_size > state->read_data + state->read_size)
+		from_size = state->read_data + state->read_size - from;
+	if (size > to_size)
+		return 0;
+
+	return unpack_peek_block(unpack_thread, compression, from, from_size, to_size,
+				 data, size);
+}
+
+int unpack_peek_block(struct unpack_thread_s *unpack_thread, glc_message_type_t compression,
+		      const char *from, size_t from_size, size_t to_size, char *data, size_t size)
+{
+#if defined(__LZ4) || defined(__LZJB)
+	char out[32];
+#endif
+#ifdef __LZO
+	const unsigned char *ip = (const unsigned char *) from;
+	const unsigned char *ip_end = ip + from_size;
+	lzo_uint t, out_len;
+#endif
+#ifdef __ZSTD
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer zout;
+	size_t zret, pos;
+#endif
+
+	if (!from_size)
+		return 0;
+
+#ifdef __LZ4
+	if ((compression == GLC_MESSAGE_LZ4) && (size <= sizeof(out)) &&
+	    (LZ4_decompress_safe_partial(from, out, from_size, size, sizeof(out)) >= (int) size)) {
+		memcpy(data, out, size);
+		return size;
+	}
+#endif
+#ifdef __LZJB
+	/* decoder stops at output size and reads few bytes per output byte */
+	if ((compression == GLC_MESSAGE_LZJB) && (size <= sizeof(out)) &&
+	    (from_size >= 3 * size)) {
+		lzjb_decompress((char *) from, out, from_size, size);
+		memcpy(data, out, size);
+		return size;
+	}
+#endif
+#ifdef __LZO
+	if (compression == GLC_MESSAGE_LZO) {
+		/* stream starts with a literal run, usually longer than header */
+		if (*ip > 17)
+			t = *ip++ - 17;
+		else if (*ip < 16) {
+			t = *ip++;
+			if (!t) {
+				while ((ip < ip_end) && (!*ip)) {
+					t += 255;
+					ip++;
+				}
+				if (ip >= ip_end)
+					return 0;
+				t += 15 + *ip++;
+			}
+			t += 3;
+		} else
+			return 0;
+
+		if ((t >= size) && (ip + size <= ip_end)) {
+			memcpy(data, ip, size);
+			return size;
+		}
+
+		/* safe decoder reports how much it got before running out of input */
+		if (pack_scratch(&unpack_thread->scratch, &unpack_thread->scratch_size, to_size))
+			return 0;
+		out_len = to_size;
+		lzo1x_decompress_safe((const unsigned char *) from, from_size,
+				      unpack_thread->scratch, &out_len, NULL);
+		if (out_len < size)
+			return 0;
+		memcpy(data, unpack_thread->scratch, size);
+		return size;
+	}
+#endif
+#ifdef __ZSTD
+	if (compression == GLC_MESSAGE_ZSTD) {
+		/* only first block is decoded */
+		ZSTD_DCtx_reset(unpack_thread->zstd, ZSTD_reset_session_only);
+		in.src = from;
+		in.size = from_size;
+		in.pos = 0;
+		zout.dst = data;
+		zout.size = size;
+		zout.pos = 0;
+		do {
+			pos = in.pos + zout.pos;
+			zret = ZSTD_decompressStream(unpack_thread->zstd, &zout, &in);
+		} while ((!ZSTD_isError(zret)) && (zout.pos < size) && (in.pos + zout.pos > pos));
+		return zout.pos == size ? size : 0;
+	}
+#endif
+	return 0;
+}
+
+int unpack_scan(unpack_t unpack, glc_thread_state_t *state, glc_message_header_t *header)
+{
+	struct unpack_thread_s *unpack_thread = (struct unpack_thread_s *) state->threadptr;
+	glc_message_type_t compression = state->header.type;
+	size_t size;
+
+	if (header->type == GLC_MESSAGE_VIDEO_FRAME)
+		size = sizeof(glc_video_frame_header_t);
+	else if (header->type == GLC_MESSAGE_VIDEO_DELTA)
+		size = sizeof(glc_video_delta_header_t);
+	else if (header->type == GLC_MESSAGE_VIDEO_TILES)
+		size = sizeof(glc_video_tiles_header_t);
+	else if (header->type == GLC_MESSAGE_AUDIO_DATA)
+		size = sizeof(glc_audio_data_header_t);
+	else
+		return 0;
+
+	if ((compression == GLC_MESSAGE_BLOCKS) && (state->read_size >= sizeof(glc_blocks_header_t)))
+		compression = ((glc_blocks_header_t *) state->read_data)->compression;
+
+	if (unpack_peek(state, unpack_thread->scan, size) != size) {
+		/* QuickLZ packets are read whole and can be decompressed */
+		if (compression == GLC_MESSAGE_QUICKLZ)
+			return 0;
+		glc_log(unpack->glc, GLC_WARNING, "unpack",
+			"can't decode header from packet type 0x%02x, skipping", compression);
+		state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
+		return 1;
+	}
+
+	/* delta and tiles headers start like picture header */
+	unpack_thread->scan_type = header->type;
+	if ((header->type == GLC_MESSAGE_VIDEO_DELTA) ||
+	    (header->type == GLC_MESSAGE_VIDEO_TILES)) {
+		unpack_thread->scan_type = GLC_MESSAGE_VIDEO_FRAME;
+		size = sizeof(glc_video_frame_header_t);
+	}
+
+	unpack_thread->scan_size = size;
+	state->write_size = size;
+	return 1;
+}
+
 /**  \} */
@@ -34,6 +34,14 @@ typedef struct pack_s* pack_t;
 #define PACK_LZO           0x2
 /** LZJB compression */
 #define PACK_LZJB          0x3
+/** LZ4 compression */
+#define PACK_LZ4           0x4
+/** Zstandard compression */
+#define PACK_ZSTD          0x5
+/** choose compression for each packet based on load */
+#define PACK_ADAPTIVE     0x10
+/** no compression, only for pack_switch_compression() */
+#define PACK_STORE         0x0
 
 /**
  * \brief unpack object
@@ -51,15 +59,151 @@ __PUBLIC int pack_init(pack_t *pack, glc_t *glc);
 /**
  * \brief set compression
  *
- * QuickLZ (PACK_QUICKLZ) and LZO (PACK_LZO) are currently supported.
- * Both are fast enough for stream compression.
- * LZO compresses marginally better but is slower. QuickLZ is default.
+ * QuickLZ (PACK_QUICKLZ), LZO (PACK_LZO), LZJB (PACK_LZJB),
+ * LZ4 (PACK_LZ4) and Zstandard (PACK_ZSTD) are supported if
+ * glc was built with them. QuickLZ is default.
+ *
+ * LZ4 compresses about as well as LZO but much faster and
+ * decompresses fastest. Zstandard compresses best and its
+ * level can be set with pack_set_compression_level().
+ *
+ * PACK_ADAPTIVE keeps switching between storing, LZ4, QuickLZ,
+ * LZO and Zstandard levels, whichever are available, based on how
+ * much time workers spend waiting for input, compressing and
+ * waiting for room in target buffer. Every packet is still tagged
+ * with the algorithm that compressed it, so unpack needs nothing
+ * special.
  * \param pack pack object
  * \param compression compression algorithm
  * \return 0 on success otherwise an error code
  */
 __PUBLIC int pack_set_compression(pack_t pack, int compression);
 
+/**
+ * \brief set compression level
+ *
+ * Used by Zstandard, where levels 1-19 trade speed for ratio and
+ * negative levels are faster still. Default is 1, which keeps up
+ * with 1080p60 on a couple of cores. For LZ4 a negative level
+ * sets acceleration, eg. -4 means LZ4 acceleration 4.
+ * Other algorithms ignore the level.
+ * \param pack pack object
+ * \param level compression level
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_compression_level(pack_t pack, int level);
+
+/**
+ * \brief switch compression while running
+ *
+ * Packets read after this call are compressed with given
+ * algorithm and level, PACK_STORE writes them uncompressed.
+ * PACK_ADAPTIVE returns to algorithm set with
+ * pack_set_compression(), and is only accepted if that was
+ * PACK_ADAPTIVE too. Readers see the change once, there is
+ * no need to lock anything. unpack handles any mix.
+ * \param pack pack object
+ * \param compression compression algorithm
+ * \param level compression level, see pack_set_compression_level()
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_switch_compression(pack_t pack, int compression, int level);
+
+/**
+ * \brief write pictures as delta to previous picture
+ *
+ * Consecutive pictures are mostly identical, which LZ compressors
+ * can't see when they get one picture at a time. With delta,
+ * pictures are XORed with the previous picture of the same
+ * stream and written as GLC_MESSAGE_VIDEO_DELTA, so unchanged
+ * areas become runs of zeros. Every keyframe_interval picture is
+ * written as is. unpack rebuilds the pictures.
+ *
+ * Costs one pass over each picture and a copy of the previous
+ * picture per stream.
+ * \param pack pack object
+ * \param keyframe_interval key frame interval, 0 disables delta
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_delta(pack_t pack, unsigned int keyframe_interval);
+
+/**
+ * \brief write only changed tiles of delta frames
+ *
+ * With delta enabled, pictures between key frames are cut to
+ * 64x64 pixel tiles and compared to the previous picture of the
+ * same stream. Only changed tiles and a bitmap of them are written
+ * as GLC_MESSAGE_VIDEO_TILES, so a picture where little changed
+ * costs little to compress and store. Key frames are still written
+ * whole. unpack rebuilds the pictures.
+ *
+ * Streams in formats that can't be tiled are written as delta.
+ * \param pack pack object
+ * \param tiles 1 enables, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_delta_tiles(pack_t pack, int tiles);
+
+/**
+ * \brief code audio with lossless audio codec
+ *
+ * LZ compressors barely compress PCM audio. When enabled, audio
+ * data of streams in GLC_AUDIO_S16_LE, GLC_AUDIO_S24_LE or
+ * GLC_AUDIO_S32_LE format is coded with linear prediction and
+ * Rice coding (see lpc_encode()) and written as
+ * GLC_MESSAGE_AUDIO_LPC. Audio of other streams is compressed
+ * as usual. unpack restores the exact samples.
+ *
+ * Default is disabled.
+ * \param pack pack object
+ * \param audio_lpc 1 enables, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_audio_lpc(pack_t pack, int audio_lpc);
+
+/**
+ * \brief compress large packets in independent blocks
+ *
+ * Packets at least twice block_size are split into blocks that
+ * are compressed by slice workers (see glc_slice_set_count()) in
+ * parallel, and written as GLC_MESSAGE_BLOCKS with an index of
+ * compressed block sizes. unpack decompresses the blocks in
+ * parallel too. Smaller blocks compress slightly worse.
+ * \param pack pack object
+ * \param block_size block size in bytes, 0 disables blocks
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_block_size(pack_t pack, size_t block_size);
+
+/**
+ * \brief set adaptive compression headroom
+ *
+ * Adaptive compression moves to a faster algorithm when workers
+ * are idle less than headroom of the time, since that is when
+ * source buffer fills up and capture starts dropping frames.
+ * Default is 0.15.
+ * \param pack pack object
+ * \param headroom share of time workers should be idle
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_adaptive_headroom(pack_t pack, double headroom);
+
+/**
+ * \brief stamp packets with stream id and time
+ *
+ * Compression hides headers of data messages. When enabled,
+ * compressed or otherwise rewritten data messages are written
+ * as GLC_MESSAGE_STAMP carrying their stream id and time, so
+ * that file can build seek index from them. Only file accepts
+ * stamped packets.
+ *
+ * Default is disabled.
+ * \param pack pack object
+ * \param stamp 1 enables, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_stamp(pack_t pack, int stamp);
+
 /**
  * \brief set compression threshold
  *
@@ -77,6 +221,10 @@ __PUBLIC int pack_set_minimum_size(pack_t pack, size_t min_size);
  * pack compresses all data that is practical to compress (currently
  * pictures and audio data) and wraps compressed data into container
  * packets.
+ *
+ * Video frame references (GLC_MESSAGE_VIDEO_FRAME_REF) are resolved
+ * and written as ordinary video frames. Referenced memory is released
+ * as soon as the frame has been written to target buffer.
  * \param pack pack object
  * \param from source buffer
  * \param to target buffer
@@ -119,6 +267,35 @@ __PUBLIC int unpack_init(unpack_t *unpack, glc_t *glc);
 __PUBLIC int unpack_process_start(unpack_t unpack, ps_buffer_t *from,
 				  ps_buffer_t *to);
 
+/**
+ * \brief unpack only given stream
+ *
+ * Once a filter is set, video frames and audio data of streams
+ * that were not asked for are dropped, compressed ones without
+ * decompressing them. Other messages pass as usual. Stream id
+ * is not visible in most compressed packets, so for them only
+ * type is checked.
+ * \param unpack unpack object
+ * \param type GLC_MESSAGE_VIDEO_FRAME or GLC_MESSAGE_AUDIO_DATA
+ * \param id stream id, 0 for all streams of type
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int unpack_set_filter(unpack_t unpack, glc_message_type_t type, glc_stream_id_t id);
+
+/**
+ * \brief pass only headers of pictures and audio
+ *
+ * Only first bytes of each compressed picture or audio packet
+ * are decoded and message is passed on with just its header.
+ * Deltas are not rebuilt and come out as picture headers.
+ * Packets may be truncated, see file_set_scan(). Other messages
+ * are decompressed as usual.
+ * \param unpack unpack object
+ * \param scan 1 enables, 0 disables
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int unpack_set_scan(unpack_t unpack, int scan);
+
 /**
  * \brief block until process has finished
  * \param unpack unpack object
@@ -0,0 +1,399 @@
+/**
+ * \file glc/core/replay.c
+ * \brief in-memory replay buffer
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup replay
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <packetstream.h>
+#include <errno.h>
+
+#include <glc/common/glc.h>
+#include <glc/common/core.h>
+#include <glc/common/log.h>
+#include <glc/common/state.h>
+#include <glc/common/thread.h>
+#include <glc/common/util.h>
+
+#include <glc/core/tracker.h>
+
+#include "replay.h"
+
+#define REPLAY_RUNNING      0x1
+#define REPLAY_SAVING       0x2
+#define REPLAY_SAVED        0x4
+
+struct replay_packet_s {
+	glc_utime_t time;
+	glc_message_header_t header;
+	size_t size;
+	/* video picture, key frame */
+	int video, key;
+	glc_stream_id_t id;
+	/* held by replay and by save in progress */
+	unsigned int refs;
+	struct replay_packet_s *next;
+	/* message follows */
+};
+
+struct replay_save_s {
+	replay_t replay;
+	file_t file;
+	tracker_t state_tracker;
+	struct replay_packet_s *first, *last;
+	/* video streams that have had a key frame */
+	glc_stream_id_t *keyed;
+	unsigned int keyed_count;
+};
+
+struct replay_s {
+	glc_t *glc;
+	glc_flags_t flags;
+	glc_thread_t thread;
+
+	glc_utime_t duration;
+	size_t max_size;
+
+	pthread_mutex_t mutex;
+	struct replay_packet_s *head, *tail;
+	size_t size;
+	/* video key frames held */
+	unsigned int keys;
+	/* state at head */
+	tracker_t state_tracker;
+
+	pthread_t save_thread;
+};
+
+int replay_read_callback(glc_thread_state_t *state);
+void replay_finish_callback(void *ptr, int err);
+
+void replay_release(replay_t replay, struct replay_packet_s *packet);
+void replay_evict(replay_t replay, glc_utime_t time);
+void replay_evict_head(replay_t replay);
+int replay_save_keyed(struct replay_save_s *save, struct replay_packet_s *packet);
+int replay_copy_state_callback(glc_message_header_t *header, void *message,
+			       size_t message_size, void *arg);
+int replay_write_state_callback(glc_message_header_t *header, void *message,
+				size_t message_size, void *arg);
+void *replay_save_thread(void *argptr);
+
+int replay_init(replay_t *replay, glc_t *glc)
+{
+	*replay = (replay_t) malloc(sizeof(struct replay_s));
+	memset(*replay, 0, sizeof(struct replay_s));
+
+	(*replay)->glc = glc;
+	(*replay)->duration = 60000000;
+
+	pthread_mutex_init(&(*replay)->mutex, NULL);
+	tracker_init(&(*replay)->state_tracker, glc);
+
+	(*replay)->thread.flags = GLC_THREAD_READ;
+	(*replay)->thread.ptr = *replay;
+	(*replay)->thread.read_callback = &replay_read_callback;
+	(*replay)->thread.finish_callback = &replay_finish_callback;
+	(*replay)->thread.threads = 1;
+	(*replay)->thread.name = "replay";
+
+	return 0;
+}
+
+int replay_destroy(replay_t replay)
+{
+	struct replay_packet_s *next;
+
+	if (replay->flags & REPLAY_SAVED)
+		pthread_join(replay->save_thread, NULL);
+
+	while (replay->head != NULL) {
+		next = replay->head->next;
+		replay_release(replay, replay->head);
+		replay->head = next;
+	}
+
+	tracker_destroy(replay->state_tracker);
+	pthread_mutex_destroy(&replay->mutex);
+	free(replay);
+	return 0;
+}
+
+int replay_set_duration(replay_t replay, glc_utime_t duration, size_t size)
+{
+	if (!duration)
+		return EINVAL;
+
+	replay->duration = duration;
+	replay->max_size = size;
+	return 0;
+}
+
+int replay_process_start(replay_t replay, ps_buffer_t *from)
+{
+	int ret;
+	if (replay->flags & REPLAY_RUNNING)
+		return EAGAIN;
+
+	if ((ret = glc_thread_create(replay->glc, &replay->thread, from, NULL)))
+		return ret;
+	replay->flags |= REPLAY_RUNNING;
+
+	return 0;
+}
+
+int replay_process_wait(replay_t replay)
+{
+	if (!(replay->flags & REPLAY_RUNNING))
+		return EAGAIN;
+
+	glc_thread_wait(&replay->thread);
+	replay->flags &= ~REPLAY_RUNNING;
+
+	return 0;
+}
+
+void replay_finish_callback(void *ptr, int err)
+{
+	replay_t replay = (replay_t) ptr;
+
+	if (err)
+		glc_log(replay->glc, GLC_ERROR, "replay", "%s (%d)", strerror(err), err);
+}
+
+int replay_read_callback(glc_thread_state_t *state)
+{
+	replay_t replay = (replay_t) state->ptr;
+	struct replay_packet_s *packet;
+
+	/* callbacks are meant for file, and there is none */
+	if ((state->header.type == GLC_CALLBACK_REQUEST) ||
+	    (state->header.type == GLC_MESSAGE_CLOSE))
+		return 0;
+
+	if (!(packet = (struct replay_packet_s *)
+	      malloc(sizeof(struct replay_packet_s) + state->read_size)))
+		return ENOMEM;
+
+	packet->time = glc_state_time(replay->glc);
+	memcpy(&packet->header, &state->header, sizeof(glc_message_header_t));
+	packet->size = state->read_size;
+	packet->refs = 1;
+	packet->next = NULL;
+	memcpy(&packet[1], state->read_data, state->read_size);
+
+	packet->video = !glc_util_message_video(state->header.type, state->read_data,
+						state->read_size, &packet->id, &packet->key);
+	if ((packet->video) && (packet->key))
+		replay->keys++;
+
+	pthread_mutex_lock(&replay->mutex);
+	if (replay->tail)
+		replay->tail->next = packet;
+	else
+		replay->head = packet;
+	replay->tail = packet;
+	replay->size += packet->size;
+
+	replay_evict(replay, packet->time);
+	pthread_mutex_unlock(&replay->mutex);
+
+	return 0;
+}
+
+void replay_evict(replay_t replay, glc_utime_t time)
+{
+	/* newest message is always kept */
+	while ((replay->head != replay->tail) &&
+	       ((time - replay->head->time > replay->duration) ||
+		((replay->max_size) && (replay->size > replay->max_size))))
+		replay_evict_head(replay);
+
+	/* saved replay starts on a key frame, deltas before it can't be decoded */
+	while ((replay->keys) && (replay->head != replay->tail) &&
+	       ((!replay->head->video) || (!replay->head->key)))
+		replay_evict_head(replay);
+}
+
+void replay_evict_head(replay_t replay)
+{
+	struct replay_packet_s *packet = replay->head;
+
+	replay->head = packet->next;
+	replay->size -= packet->size;
+	if ((packet->video) && (packet->key))
+		replay->keys--;
+
+	/* state survives the message that carried it */
+	tracker_submit(replay->state_tracker, &packet->header,
+		       &packet[1], packet->size);
+	replay_release(replay, packet);
+}
+
+void replay_release(replay_t replay, struct replay_packet_s *packet)
+{
+	if (!--packet->refs)
+		free(packet);
+}
+
+int replay_save(replay_t replay, file_t file)
+{
+	struct replay_save_s *save;
+	struct replay_packet_s *packet;
+	int ret = 0;
+
+	pthread_mutex_lock(&replay->mutex);
+	if (replay->flags & REPLAY_SAVING) {
+		ret = EBUSY;
+		goto unlock;
+	}
+	if (!replay->head) {
+		ret = EAGAIN;
+		goto unlock;
+	}
+
+	/* previous save has finished */
+	if (replay->flags & REPLAY_SAVED) {
+		pthread_join(replay->save_thread, NULL);
+		replay->flags &= ~REPLAY_SAVED;
+	}
+
+	save = (struct replay_save_s *) malloc(sizeof(struct replay_save_s));
+	save->replay = replay;
+	save->file = file;
+	save->keyed = NULL;
+	save->keyed_count = 0;
+	tracker_init(&save->state_tracker, replay->glc);
+	if ((ret = tracker_iterate_state(replay->state_tracker,
+					 &replay_copy_state_callback, save->state_tracker)))
+		goto free;
+
+	/* messages are only referenced, so eviction can go on */
+	save->first = replay->head;
+	save->last = replay->tail;
+	for (packet = save->first; packet != save->last; packet = packet->next)
+		packet->refs++;
+	save->last->refs++;
+
+	if ((ret = pthread_create(&replay->save_thread, NULL,
+				  &replay_save_thread, save))) {
+		for (packet = save->first; packet != save->last; packet = packet->next)
+			packet->refs--;
+		save->last->refs--;
+		goto free;
+	}
+
+	replay->flags |= REPLAY_SAVING | REPLAY_SAVED;
+	glc_log(replay->glc, GLC_INFORMATION, "replay", "saving %.1f s",
+		 (double) (save->last->time - save->first->time) / 1000000.0);
+	pthread_mutex_unlock(&replay->mutex);
+	return 0;
+
+free:
+	tracker_destroy(save->state_tracker);
+	free(save);
+unlock:
+	pthread_mutex_unlock(&replay->mutex);
+	return ret;
+}
+
+int replay_copy_state_callback(glc_message_header_t *header, void *message,
+			       size_t message_size, void *arg)
+{
+	return tracker_submit((tracker_t) arg, header, message, message_size);
+}
+
+int replay_write_state_callback(glc_message_header_t *header, void *message,
+				size_t message_size, void *arg)
+{
+	struct replay_save_s *save = (struct replay_save_s *) arg;
+	return file_write_packet(save->file, header, message, message_size);
+}
+
+void *replay_save_thread(void *argptr)
+{
+	struct replay_save_s *save = (struct replay_save_s *) argptr;
+	replay_t replay = save->replay;
+	struct replay_packet_s *packet, *next;
+	int ret;
+
+	if ((ret = tracker_iterate_state(save->state_tracker,
+					 &replay_write_state_callback, save)))
+		goto err;
+
+	/* list between first and last doesn't change while we hold it */
+	packet = save->first;
+	while (1) {
+		/* other video streams may still be waiting for their key frame */
+		if ((!packet->video) || (replay_save_keyed(save, packet))) {
+			if ((ret = file_write_packet(save->file, &packet->header,
+						     &packet[1], packet->size)))
+				goto err;
+		}
+		if (packet == save->last)
+			break;
+		packet = packet->next;
+	}
+
+	if ((ret = file_write_eof(save->file)))
+		goto err;
+	glc_log(replay->glc, GLC_INFORMATION, "replay", "replay saved");
+	goto finish;
+err:
+	glc_log(replay->glc, GLC_ERROR, "replay",
+		 "can't save replay: %s (%d)", strerror(ret), ret);
+finish:
+	file_close_target(save->file);
+	file_destroy(save->file);
+	tracker_destroy(save->state_tracker);
+	free(save->keyed);
+
+	pthread_mutex_lock(&replay->mutex);
+	packet = save->first;
+	while (1) {
+		next = packet->next;
+		if (packet == save->last) {
+			replay_release(replay, packet);
+			break;
+		}
+		replay_release(replay, packet);
+		packet = next;
+	}
+	replay->flags &= ~REPLAY_SAVING;
+	pthread_mutex_unlock(&replay->mutex);
+
+	free(save);
+	return NULL;
+}
+
+int replay_save_keyed(struct replay_save_s *save, struct replay_packet_s *packet)
+{
+	glc_stream_id_t *keyed;
+	unsigned int i;
+
+	for (i = 0; i < save->keyed_count; i++) {
+		if (save->keyed[i] == packet->id)
+			return 1;
+	}
+
+	if (!packet->key)
+		return 0;
+	if (!(keyed = (glc_stream_id_t *) realloc(save->keyed, sizeof(glc_stream_id_t) *
+						  (save->keyed_count + 1))))
+		return 1; /* better written than lost */
+	save->keyed = keyed;
+	save->keyed[save->keyed_count++] = packet->id;
+	return 1;
+}
+
+/**  \} */
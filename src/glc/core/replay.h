@@ -0,0 +1,110 @@
+/**
+ * \file glc/core/replay.h
+ * \brief in-memory replay buffer
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup core
+ *  \{
+ * \defgroup replay in-memory replay buffer
+ *  \{
+ */
+
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include <packetstream.h>
+#include <glc/common/glc.h>
+#include <glc/core/file.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief replay object
+ *
+ * Replay keeps last seconds of a stream in memory instead of
+ * writing it to disk. Older messages are dropped, but stream
+ * state they carried (formats, color correction) is kept,
+ * so whatever is currently held can be saved any time as a
+ * complete stream.
+ */
+typedef struct replay_s* replay_t;
+
+/**
+ * \brief initialize replay object
+ * \param replay replay object
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int replay_init(replay_t *replay, glc_t *glc);
+
+/**
+ * \brief destroy replay object
+ *
+ * Waits for save in progress.
+ * \param replay replay object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int replay_destroy(replay_t replay);
+
+/**
+ * \brief set how much stream is kept
+ * \param replay replay object
+ * \param duration duration in microseconds, default is 60 s
+ * \param size upper limit for memory used by messages in bytes,
+ *             0 means no limit
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int replay_set_duration(replay_t replay, glc_utime_t duration, size_t size);
+
+/**
+ * \brief start replay process
+ *
+ * Replay holds messages from source buffer until they are older
+ * than replay duration.
+ * \param replay replay object
+ * \param from source buffer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int replay_process_start(replay_t replay, ps_buffer_t *from);
+
+/**
+ * \brief block until process has finished
+ * \param replay replay object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int replay_process_wait(replay_t replay);
+
+/**
+ * \brief save replay
+ *
+ * Messages currently held are written to file in a background
+ * thread, preceded by stream state at the first of them. Replay
+ * keeps running meanwhile. File must have target open and
+ * stream information written. Held messages start at a video
+ * key frame, and pictures of other video streams are written from
+ * their first key frame on, so that every picture can be decoded.
+ * Pictures are recognized in compressed stream only if pack stamps
+ * them, see pack_set_stamp(). Replay owns file after this call:
+ * EOF is written, target closed and file destroyed when all
+ * messages have been written.
+ * \param replay replay object
+ * \param file file object
+ * \return 0 on success, EBUSY if previous save is still in progress,
+ *         otherwise an error code
+ */
+__PUBLIC int replay_save(replay_t replay, file_t file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
@@ -19,11 +19,22 @@
 #include <packetstream.h>
 #include <errno.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define RGB_X86
+#endif
+#ifdef __ARM_NEON
+# include <arm_neon.h>
+#endif
+
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/thread.h>
 #include <glc/common/util.h>
+#include <glc/common/state.h>
+#include <glc/common/slice.h>
+#include <glc/common/registry.h>
 
 #include "rgb.h"
 
@@ -79,6 +90,20 @@ unsigned char YCbCrJPEG_TO_RGB_Bd(unsigned char Y, unsigned char Cb, unsigned ch
 	return CLAMP_256(B);
 }
 
+/* same in 14-bit fixed point, rounded */
+#define RGB_BITS       14
+#define RGB_ROUND      (1 << (RGB_BITS - 1))
+#define RGB_Cr_R    22970
+#define RGB_Cb_G    -5638
+#define RGB_Cr_G   -11700
+#define RGB_Cb_B    29032
+
+struct rgb_video_stream_s;
+
+typedef void (*rgb_rows_proc)(rgb_t rgb, struct rgb_video_stream_s *video,
+			      chain_rows_t *from, chain_rows_t *to,
+			      unsigned int y, unsigned int rows);
+
 struct rgb_video_stream_s {
 	glc_stream_id_t id;
 	unsigned int w, h;
@@ -86,7 +111,6 @@ struct rgb_video_stream_s {
 	size_t size;
 	
 	pthread_rwlock_t update;
-	struct rgb_video_stream_s *next;
 };
 
 struct rgb_s {
@@ -94,34 +118,84 @@ struct rgb_s {
 	glc_thread_t thread;
 	int running;
 
+	/* lookup table is only built when rows is rgb_convert_lookup() */
 	unsigned char *lookup_table;
+	rgb_rows_proc rows;
+
+	glc_registry_t ctx;
+};
 
+struct rgb_slice_s {
+	rgb_t rgb;
 	struct rgb_video_stream_s *ctx;
+	chain_rows_t from, to;
 };
 
 int rgb_read_callback(glc_thread_state_t *state);
 int rgb_write_callback(glc_thread_state_t *state);
 void rgb_finish_callback(void *ptr, int err);
+void rgb_slice_callback(void *ptr, unsigned int y, unsigned int rows);
 
-void rgbget_video_stream(rgb_t rgb, glc_stream_id_t id,
-		struct rgb_video_stream_s **ctx);
+int rgbget_video_stream(rgb_t rgb, glc_stream_id_t id,
+			struct rgb_video_stream_s **ctx);
+int rgb_video_stream_init(void *entry, glc_stream_id_t id, void *arg);
+int rgb_video_stream_destroy(void *entry, glc_stream_id_t id, void *arg);
 
 int rgb_video_format_message(rgb_t rgb, glc_video_format_message_t *video_format_message);
 int rgb_convert(rgb_t rgb, struct rgb_video_stream_s *ctx,
 		unsigned char *from, unsigned char *to);
 
 int rgb_init_lookup(rgb_t rgb);
-int rgb_convert_lookup(rgb_t rgb, struct rgb_video_stream_s *ctx,
-		       unsigned char *from, unsigned char *to);
+void rgb_convert_lookup(rgb_t rgb, struct rgb_video_stream_s *ctx,
+			chain_rows_t *from, chain_rows_t *to,
+			unsigned int y, unsigned int rows);
+
+void rgb_jpeg420_row(unsigned char *Y, unsigned char *Cb, unsigned char *Cr,
+		     unsigned char *dst, unsigned int x, unsigned int w);
+void rgb_simd(rgb_t rgb);
+
+#ifdef RGB_X86
+void rgb_convert_rows_ssse3(rgb_t rgb, struct rgb_video_stream_s *video,
+			    chain_rows_t *from, chain_rows_t *to,
+			    unsigned int y, unsigned int rows);
+void rgb_convert_rows_avx2(rgb_t rgb, struct rgb_video_stream_s *video,
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows);
+#endif
+
+#ifdef __ARM_NEON
+void rgb_convert_rows_neon(rgb_t rgb, struct rgb_video_stream_s *video,
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows);
+#endif
+
+int rgb_message_callback(void *ptr, glc_thread_state_t *state);
+int rgb_frame_callback(void *ptr, glc_stream_id_t id,
+		       chain_rows_t *from, chain_rows_t *to,
+		       int *whole, void **ctx);
+void rgb_need_callback(void *ptr, void *ctx, unsigned int y, unsigned int rows,
+		       unsigned int *from_y, unsigned int *from_rows);
+void rgb_rows_callback(void *ptr, void *ctx, chain_rows_t *from, chain_rows_t *to,
+		       unsigned int y, unsigned int rows);
+void rgb_done_callback(void *ptr, void *ctx);
+void rgb_get_rows(struct rgb_video_stream_s *ctx, chain_rows_t *from, chain_rows_t *to);
 
 int rgb_init(rgb_t *rgb, glc_t *glc)
 {
+	int ret;
+
 	*rgb = (rgb_t) malloc(sizeof(struct rgb_s));
 	memset(*rgb, 0, sizeof(struct rgb_s));
 
 	(*rgb)->glc = glc;
+	if ((ret = glc_registry_init(&(*rgb)->ctx, sizeof(struct rgb_video_stream_s),
+				     &rgb_video_stream_init, &rgb_video_stream_destroy,
+				     *rgb))) {
+		free(*rgb);
+		return ret;
+	}
 
-	rgb_init_lookup(*rgb);
+	rgb_simd(*rgb);
 
 	(*rgb)->thread.flags = GLC_THREAD_READ | GLC_THREAD_WRITE;
 	(*rgb)->thread.read_callback = &rgb_read_callback;
@@ -129,6 +203,7 @@ int rgb_init(rgb_t *rgb, glc_t *glc)
 	(*rgb)->thread.finish_callback = &rgb_finish_callback;
 	(*rgb)->thread.ptr = *rgb;
 	(*rgb)->thread.threads = glc_threads_hint(glc);
+	(*rgb)->thread.name = "rgb";
 
 	return 0;
 }
@@ -137,6 +212,7 @@ int rgb_destroy(rgb_t rgb)
 {
 	if (rgb->lookup_table)
 		free(rgb->lookup_table);
+	glc_registry_destroy(rgb->ctx);
 	free(rgb);
 	return 0;
 }
@@ -165,21 +241,31 @@ int rgb_process_wait(rgb_t rgb)
 	return 0;
 }
 
+int rgb_filter(rgb_t rgb, chain_filter_t *filter)
+{
+	if (rgb->running)
+		return EALREADY;
+
+	memset(filter, 0, sizeof(chain_filter_t));
+	filter->ptr = rgb;
+	filter->message_callback = &rgb_message_callback;
+	filter->frame_callback = &rgb_frame_callback;
+	filter->need_callback = &rgb_need_callback;
+	filter->rows_callback = &rgb_rows_callback;
+	filter->done_callback = &rgb_done_callback;
+	filter->finish_callback = &rgb_finish_callback;
+
+	return 0;
+}
+
 void rgb_finish_callback(void *ptr, int err)
 {
 	rgb_t rgb = (rgb_t) ptr;
-	struct rgb_video_stream_s *del;
 
 	if (err)
 		glc_log(rgb->glc, GLC_ERROR, "rgb", "%s (%d)", strerror(err), err);
 
-	while (rgb->ctx != NULL) {
-		del = rgb->ctx;
-		rgb->ctx = rgb->ctx->next;
-
-		pthread_rwlock_destroy(&del->update);
-		free(del);
-	}
+	glc_registry_clear(rgb->ctx);
 }
 
 int rgb_read_callback(glc_thread_state_t *state)
@@ -187,13 +273,20 @@ int rgb_read_callback(glc_thread_state_t *state)
 	rgb_t rgb = (rgb_t) state->ptr;
 	struct rgb_video_stream_s *ctx;
 	glc_video_frame_header_t *pic_hdr;
+	int ret;
 
 	if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
 		rgb_video_format_message(rgb, (glc_video_format_message_t *) state->read_data);
 
 	if (state->header.type == GLC_MESSAGE_VIDEO_FRAME) {
 		pic_hdr = (glc_video_frame_header_t *) state->read_data;
-		rgbget_video_stream(rgb, pic_hdr->id, &ctx);
+		if (glc_state_video_late(rgb->glc, pic_hdr->id, pic_hdr->time)) {
+			/* player would drop it anyway */
+			state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
+			return 0;
+		}
+		if ((ret = rgbget_video_stream(rgb, pic_hdr->id, &ctx)))
+			return ret;
 		state->threadptr = ctx;
 
 		pthread_rwlock_rdlock(&ctx->update);
@@ -212,44 +305,127 @@ int rgb_read_callback(glc_thread_state_t *state)
 
 int rgb_write_callback(glc_thread_state_t *state)
 {
-	rgb_t rgb = (rgb_t) state->ptr;
-	struct rgb_video_stream_s *ctx = state->threadptr;
+	struct rgb_slice_s slice;
 
 	memcpy(state->write_data, state->read_data, sizeof(glc_video_frame_header_t));
-	rgb_convert_lookup(rgb, ctx,
-		    (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
-		    (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)]);
-	pthread_rwlock_unlock(&ctx->update);
+
+	slice.rgb = (rgb_t) state->ptr;
+	slice.ctx = state->threadptr;
+	rgb_get_rows(slice.ctx, &slice.from, &slice.to);
+	slice.from.data = (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)];
+	slice.to.data = (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)];
+	glc_slice_run(slice.rgb->glc, slice.ctx->h, 2, &rgb_slice_callback, &slice);
+
+	pthread_rwlock_unlock(&slice.ctx->update);
 
 	return 0;
 }
 
-void rgbget_video_stream(rgb_t rgb, glc_stream_id_t id,
-		struct rgb_video_stream_s **ctx)
+void rgb_slice_callback(void *ptr, unsigned int y, unsigned int rows)
 {
-	*ctx = rgb->ctx;
+	struct rgb_slice_s *slice = ptr;
+	slice->rgb->rows(slice->rgb, slice->ctx, &slice->from, &slice->to, y, rows);
+}
 
-	while (*ctx != NULL) {
-		if ((*ctx)->id == id)
-			break;
-		*ctx = (*ctx)->next;
-	}
+int rgb_message_callback(void *ptr, glc_thread_state_t *state)
+{
+	if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
+		rgb_video_format_message((rgb_t) ptr, (glc_video_format_message_t *) state->read_data);
+	return 0;
+}
 
-	if (*ctx == NULL) {
-		*ctx = malloc(sizeof(struct rgb_video_stream_s));
-		memset(*ctx, 0, sizeof(struct rgb_video_stream_s));
-		
-		(*ctx)->next = rgb->ctx;
-		rgb->ctx = *ctx;
-		(*ctx)->id = id;
-		pthread_rwlock_init(&(*ctx)->update, NULL);
+int rgb_frame_callback(void *ptr, glc_stream_id_t id,
+		       chain_rows_t *from, chain_rows_t *to,
+		       int *whole, void **ctx)
+{
+	struct rgb_video_stream_s *video;
+	int ret;
+
+	if ((ret = rgbget_video_stream((rgb_t) ptr, id, &video)))
+		return ret;
+	pthread_rwlock_rdlock(&video->update);
+
+	if (!video->convert) {
+		pthread_rwlock_unlock(&video->update);
+		*ctx = NULL;
+		return 0;
 	}
+
+	rgb_get_rows(video, from, to);
+	*ctx = video;
+	return 0;
+}
+
+void rgb_need_callback(void *ptr, void *ctx, unsigned int y, unsigned int rows,
+		       unsigned int *from_y, unsigned int *from_rows)
+{
+	struct rgb_video_stream_s *video = ctx;
+
+	/* picture is flipped */
+	*from_y = video->h - y - rows;
+	*from_rows = rows;
+}
+
+void rgb_rows_callback(void *ptr, void *ctx, chain_rows_t *from, chain_rows_t *to,
+		       unsigned int y, unsigned int rows)
+{
+	rgb_t rgb = (rgb_t) ptr;
+	rgb->rows(rgb, ctx, from, to, y, rows);
+}
+
+void rgb_done_callback(void *ptr, void *ctx)
+{
+	struct rgb_video_stream_s *video = ctx;
+	pthread_rwlock_unlock(&video->update);
+}
+
+void rgb_get_rows(struct rgb_video_stream_s *ctx, chain_rows_t *from, chain_rows_t *to)
+{
+	memset(from, 0, sizeof(chain_rows_t));
+	from->format = GLC_VIDEO_YCBCR_420JPEG;
+	from->w = ctx->w;
+	from->h = ctx->h;
+	from->row = ctx->w;
+	from->rows = ctx->h;
+
+	memset(to, 0, sizeof(chain_rows_t));
+	to->format = GLC_VIDEO_BGR;
+	to->w = ctx->w;
+	to->h = ctx->h;
+	to->row = ctx->w * 3;
+	to->rows = ctx->h;
+}
+
+int rgbget_video_stream(rgb_t rgb, glc_stream_id_t id,
+			struct rgb_video_stream_s **ctx)
+{
+	return glc_registry_get(rgb->ctx, id, (void **) ctx);
+}
+
+int rgb_video_stream_init(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct rgb_video_stream_s *ctx = entry;
+
+	ctx->id = id;
+	pthread_rwlock_init(&ctx->update, NULL);
+	return 0;
+}
+
+int rgb_video_stream_destroy(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct rgb_video_stream_s *ctx = entry;
+
+	pthread_rwlock_destroy(&ctx->update);
+	return 0;
 }
 
 int rgb_video_format_message(rgb_t rgb, glc_video_format_message_t *video_format_message)
 {
 	struct rgb_video_stream_s *video;
-	rgbget_video_stream(rgb, video_format_message->id, &video);
+	int ret;
+
+	if ((ret = rgbget_video_stream(rgb, video_format_message->id, &video)))
+		return ret;
 
 	if (video_format_message->format != GLC_VIDEO_YCBCR_420JPEG)
 		return 0; /* just don't convert */
@@ -325,41 +501,351 @@ int rgb_init_lookup(rgb_t rgb)
 	return 0;
 }
 
-int rgb_convert_lookup(rgb_t rgb, struct rgb_video_stream_s *video,
-		       unsigned char *from, unsigned char *to)
+void rgb_convert_lookup(rgb_t rgb, struct rgb_video_stream_s *video,
+			chain_rows_t *from, chain_rows_t *to,
+			unsigned int y, unsigned int rows)
 {
-	unsigned int x, y, Cpix;
-	unsigned int color;
-	unsigned char *Y, *Cb, *Cr;
+	unsigned int x, sy, color;
+	unsigned char *Y, *Cb, *Cr, *rgb_row;
+
+	for (; rows > 0; rows--, y++) {
+		/* BGR picture is stored bottom-up */
+		sy = video->h - 1 - y;
+		Y = CHAIN_ROW(from, sy);
+		Cb = CHAIN_CB_ROW(from, sy / 2);
+		Cr = CHAIN_CR_ROW(from, sy / 2);
+		rgb_row = CHAIN_ROW(to, y);
+
+		for (x = 0; x < video->w; x++) {
+			color = LOOKUP_POS(Y[x], Cb[x / 2], Cr[x / 2]);
+			rgb_row[x * 3 + 2] = rgb->lookup_table[color + 0];
+			rgb_row[x * 3 + 1] = rgb->lookup_table[color + 1];
+			rgb_row[x * 3 + 0] = rgb->lookup_table[color + 2];
+		}
+	}
+}
 
-	Y = from;
-	Cb = &from[video->h * video->w];
-	Cr = &from[video->h * video->w + (video->h / 2) * (video->w / 2)];
-	Cpix = 0;
+void rgb_jpeg420_row(unsigned char *Y, unsigned char *Cb, unsigned char *Cr,
+		     unsigned char *dst, unsigned int x, unsigned int w)
+{
+	int cb, cr, R, G, B;
 
-#define CONVERT(xadd, yrgbadd, yadd) 						\
-	color = LOOKUP_POS(Y[(x + (xadd)) + (y + (yadd)) * video->w],		\
-			   Cb[Cpix], Cr[Cpix]);					\
-	to[((x + (xadd)) + ((video->h - y) + (yrgbadd)) * video->w) * 3 + 2] =	\
-		rgb->lookup_table[color + 0];					\
-	to[((x + (xadd)) + ((video->h - y) + (yrgbadd)) * video->w) * 3 + 1] =	\
-		rgb->lookup_table[color + 1];					\
-	to[((x + (xadd)) + ((video->h - y) + (yrgbadd)) * video->w) * 3 + 0] =	\
-		rgb->lookup_table[color + 2];
+	for (; x < w; x++) {
+		cb = Cb[x / 2] - 128;
+		cr = Cr[x / 2] - 128;
 
-	/* YCBCR_420JPEG frame dimensions are always divisible by two */
-	for (y = 0; y < video->h; y += 2) {
-		for (x = 0; x < video->w; x += 2) {
-			CONVERT(0, -1, 0)
-			CONVERT(1, -1, 0)
-			CONVERT(0, -2, 1)
-			CONVERT(1, -2, 1)
-			
-			Cpix++;
-		}
+		R = Y[x] + ((RGB_Cr_R * cr + RGB_ROUND) >> RGB_BITS);
+		G = Y[x] + ((RGB_Cb_G * cb + RGB_Cr_G * cr + RGB_ROUND) >> RGB_BITS);
+		B = Y[x] + ((RGB_Cb_B * cb + RGB_ROUND) >> RGB_BITS);
+
+		dst[x * 3 + 2] = CLAMP_256(R);
+		dst[x * 3 + 1] = CLAMP_256(G);
+		dst[x * 3 + 0] = CLAMP_256(B);
 	}
-#undef CONVERT
-	return 0;
 }
 
+void rgb_simd(rgb_t rgb)
+{
+	glc_flags_t cpu = glc_cpu_features(rgb->glc);
+
+	rgb->rows = NULL;
+
+#ifdef RGB_X86
+	if (cpu & GLC_CPU_AVX2)
+		rgb->rows = &rgb_convert_rows_avx2;
+	else if (cpu & GLC_CPU_SSSE3)
+		rgb->rows = &rgb_convert_rows_ssse3;
+#endif
+
+#ifdef __ARM_NEON
+	if (cpu & GLC_CPU_NEON)
+		rgb->rows = &rgb_convert_rows_neon;
+#endif
+
+	/* no vector unit, fall back to lookup table */
+	if (rgb->rows == NULL) {
+		rgb_init_lookup(rgb);
+		rgb->rows = &rgb_convert_lookup;
+	}
+}
+
+/*
+ * Vector kernels below produce exactly the same output as
+ * rgb_jpeg420_row(), which also finishes the last pixels of each row.
+ * Chroma terms are computed once per chroma sample with the same
+ * 14-bit coefficients and rounding, and then added to both Y' samples.
+ */
+
+#ifdef RGB_X86
+
+/* 16 B, G and R bytes -> 48 bytes of BGR */
+__attribute__ ((target ("ssse3")))
+static inline void rgb_store_ssse3(unsigned char *dst, __m128i B, __m128i G, __m128i R)
+{
+	__m128i out;
+
+	out = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(B, _mm_setr_epi8( 0, -1, -1,  1, -1, -1,  2, -1,
+						  -1,  3, -1, -1,  4, -1, -1,  5)),
+		_mm_shuffle_epi8(G, _mm_setr_epi8(-1,  0, -1, -1,  1, -1, -1,  2,
+						  -1, -1,  3, -1, -1,  4, -1, -1))),
+		_mm_shuffle_epi8(R, _mm_setr_epi8(-1, -1,  0, -1, -1,  1, -1, -1,
+						   2, -1, -1,  3, -1, -1,  4, -1)));
+	_mm_storeu_si128((__m128i *) &dst[0], out);
+
+	out = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(B, _mm_setr_epi8(-1, -1,  6, -1, -1,  7, -1, -1,
+						   8, -1, -1,  9, -1, -1, 10, -1)),
+		_mm_shuffle_epi8(G, _mm_setr_epi8( 5, -1, -1,  6, -1, -1,  7, -1,
+						  -1,  8, -1, -1,  9, -1, -1, 10))),
+		_mm_shuffle_epi8(R, _mm_setr_epi8(-1,  5, -1, -1,  6, -1, -1,  7,
+						  -1, -1,  8, -1, -1,  9, -1, -1)));
+	_mm_storeu_si128((__m128i *) &dst[16], out);
+
+	out = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(B, _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13,
+						  -1, -1, 14, -1, -1, 15, -1, -1)),
+		_mm_shuffle_epi8(G, _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1,
+						  13, -1, -1, 14, -1, -1, 15, -1))),
+		_mm_shuffle_epi8(R, _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1,
+						  -1, 13, -1, -1, 14, -1, -1, 15)));
+	_mm_storeu_si128((__m128i *) &dst[32], out);
+}
+
+/* 8 chroma samples -> R, G and B terms, 16 bits */
+__attribute__ ((target ("ssse3")))
+static inline void rgb_chroma_ssse3(__m128i cb, __m128i cr,
+				    __m128i *dR, __m128i *dG, __m128i *dB)
+{
+	const __m128i round = _mm_set1_epi32(RGB_ROUND);
+	__m128i lo, hi;
+
+	/* (2c * k + (1 << 14)) >> 15 == (c * k + RGB_ROUND) >> RGB_BITS */
+	*dR = _mm_mulhrs_epi16(_mm_slli_epi16(cr, 1), _mm_set1_epi16(RGB_Cr_R));
+	*dB = _mm_mulhrs_epi16(_mm_slli_epi16(cb, 1), _mm_set1_epi16(RGB_Cb_B));
+
+	lo = _mm_madd_epi16(_mm_unpacklo_epi16(cb, cr),
+			    _mm_setr_epi16(RGB_Cb_G, RGB_Cr_G, RGB_Cb_G, RGB_Cr_G,
+					   RGB_Cb_G, RGB_Cr_G, RGB_Cb_G, RGB_Cr_G));
+	hi = _mm_madd_epi16(_mm_unpackhi_epi16(cb, cr),
+			    _mm_setr_epi16(RGB_Cb_G, RGB_Cr_G, RGB_Cb_G, RGB_Cr_G,
+					   RGB_Cb_G, RGB_Cr_G, RGB_Cb_G, RGB_Cr_G));
+	*dG = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, round), RGB_BITS),
+			      _mm_srai_epi32(_mm_add_epi32(hi, round), RGB_BITS));
+}
+
+/* 16 Y' samples + chroma terms of 8 samples -> 16 channel bytes */
+__attribute__ ((target ("ssse3")))
+static inline __m128i rgb_channel_ssse3(__m128i Y, __m128i d)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	return _mm_packus_epi16(_mm_add_epi16(_mm_unpacklo_epi8(Y, zero),
+					      _mm_unpacklo_epi16(d, d)),
+				_mm_add_epi16(_mm_unpackhi_epi8(Y, zero),
+					      _mm_unpackhi_epi16(d, d)));
+}
+
+__attribute__ ((target ("ssse3")))
+static inline unsigned int rgb_jpeg420_row_ssse3(unsigned char *Y, unsigned char *Cb,
+						 unsigned char *Cr, unsigned char *dst,
+						 unsigned int x, unsigned int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i half = _mm_set1_epi16(128);
+	__m128i y, cb, cr, dR, dG, dB;
+
+	for (; x + 16 <= w; x += 16) {
+		y = _mm_loadu_si128((__m128i *) &Y[x]);
+		cb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) &Cb[x / 2]),
+						     zero), half);
+		cr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) &Cr[x / 2]),
+						     zero), half);
+
+		rgb_chroma_ssse3(cb, cr, &dR, &dG, &dB);
+		rgb_store_ssse3(&dst[x * 3], rgb_channel_ssse3(y, dB),
+				rgb_channel_ssse3(y, dG), rgb_channel_ssse3(y, dR));
+	}
+
+	return x;
+}
+
+__attribute__ ((target ("ssse3")))
+void rgb_convert_rows_ssse3(rgb_t rgb, struct rgb_video_stream_s *video,
+			    chain_rows_t *from, chain_rows_t *to,
+			    unsigned int y, unsigned int rows)
+{
+	unsigned int x, sy;
+	unsigned char *Y, *Cb, *Cr, *rgb_row;
+
+	for (; rows > 0; rows--, y++) {
+		sy = video->h - 1 - y;
+		Y = CHAIN_ROW(from, sy);
+		Cb = CHAIN_CB_ROW(from, sy / 2);
+		Cr = CHAIN_CR_ROW(from, sy / 2);
+		rgb_row = CHAIN_ROW(to, y);
+
+		x = rgb_jpeg420_row_ssse3(Y, Cb, Cr, rgb_row, 0, video->w);
+		rgb_jpeg420_row(Y, Cb, Cr, rgb_row, x, video->w);
+	}
+}
+
+/* same as ssse3 helpers, 128-bit lanes keep both chroma and Y' in order */
+__attribute__ ((target ("avx2")))
+static inline void rgb_chroma_avx2(__m256i cb, __m256i cr,
+				   __m256i *dR, __m256i *dG, __m256i *dB)
+{
+	const __m256i round = _mm256_set1_epi32(RGB_ROUND);
+	const __m256i coef = _mm256_setr_epi16(RGB_Cb_G, RGB_Cr_G, RGB_Cb_G, RGB_Cr_G,
+					       RGB_Cb_G, RGB_Cr_G, RGB_Cb_G, RGB_Cr_G,
+					       RGB_Cb_G, RGB_Cr_G, RGB_Cb_G, RGB_Cr_G,
+					       RGB_Cb_G, RGB_Cr_G, RGB_Cb_G, RGB_Cr_G);
+	__m256i lo, hi;
+
+	*dR = _mm256_mulhrs_epi16(_mm256_slli_epi16(cr, 1), _mm256_set1_epi16(RGB_Cr_R));
+	*dB = _mm256_mulhrs_epi16(_mm256_slli_epi16(cb, 1), _mm256_set1_epi16(RGB_Cb_B));
+
+	lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(cb, cr), coef);
+	hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(cb, cr), coef);
+	*dG = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(lo, round), RGB_BITS),
+				 _mm256_srai_epi32(_mm256_add_epi32(hi, round), RGB_BITS));
+}
+
+__attribute__ ((target ("avx2")))
+static inline __m256i rgb_channel_avx2(__m256i Y, __m256i d)
+{
+	const __m256i zero = _mm256_setzero_si256();
+
+	return _mm256_packus_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(Y, zero),
+						    _mm256_unpacklo_epi16(d, d)),
+				   _mm256_add_epi16(_mm256_unpackhi_epi8(Y, zero),
+						    _mm256_unpackhi_epi16(d, d)));
+}
+
+__attribute__ ((target ("avx2")))
+static inline unsigned int rgb_jpeg420_row_avx2(unsigned char *Y, unsigned char *Cb,
+						unsigned char *Cr, unsigned char *dst,
+						unsigned int x, unsigned int w)
+{
+	const __m256i half = _mm256_set1_epi16(128);
+	__m256i y, cb, cr, dR, dG, dB, R, G, B;
+
+	for (; x + 32 <= w; x += 32) {
+		y = _mm256_loadu_si256((__m256i *) &Y[x]);
+		cb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(
+			_mm_loadu_si128((__m128i *) &Cb[x / 2])), half);
+		cr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(
+			_mm_loadu_si128((__m128i *) &Cr[x / 2])), half);
+
+		rgb_chroma_avx2(cb, cr, &dR, &dG, &dB);
+		B = rgb_channel_avx2(y, dB);
+		G = rgb_channel_avx2(y, dG);
+		R = rgb_channel_avx2(y, dR);
+
+		rgb_store_ssse3(&dst[x * 3], _mm256_castsi256_si128(B),
+				_mm256_castsi256_si128(G), _mm256_castsi256_si128(R));
+		rgb_store_ssse3(&dst[x * 3 + 48], _mm256_extracti128_si256(B, 1),
+				_mm256_extracti128_si256(G, 1), _mm256_extracti128_si256(R, 1));
+	}
+
+	return rgb_jpeg420_row_ssse3(Y, Cb, Cr, dst, x, w);
+}
+
+__attribute__ ((target ("avx2")))
+void rgb_convert_rows_avx2(rgb_t rgb, struct rgb_video_stream_s *video,
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows)
+{
+	unsigned int x, sy;
+	unsigned char *Y, *Cb, *Cr, *rgb_row;
+
+	for (; rows > 0; rows--, y++) {
+		sy = video->h - 1 - y;
+		Y = CHAIN_ROW(from, sy);
+		Cb = CHAIN_CB_ROW(from, sy / 2);
+		Cr = CHAIN_CR_ROW(from, sy / 2);
+		rgb_row = CHAIN_ROW(to, y);
+
+		x = rgb_jpeg420_row_avx2(Y, Cb, Cr, rgb_row, 0, video->w);
+		rgb_jpeg420_row(Y, Cb, Cr, rgb_row, x, video->w);
+	}
+}
+
+#endif /* RGB_X86 */
+
+#ifdef __ARM_NEON
+
+/* 8 chroma samples -> R, G and B terms, 16 bits */
+static inline void rgb_chroma_neon(uint8x8_t Cb, uint8x8_t Cr,
+				   int16x8_t *dR, int16x8_t *dG, int16x8_t *dB)
+{
+	const uint8x8_t half = vdup_n_u8(128);
+	int16x8_t cb = vreinterpretq_s16_u16(vsubl_u8(Cb, half));
+	int16x8_t cr = vreinterpretq_s16_u16(vsubl_u8(Cr, half));
+	int32x4_t lo, hi;
+
+	/* (2 * 2c * k + (1 << 15)) >> 16 == (c * k + RGB_ROUND) >> RGB_BITS */
+	*dR = vqrdmulhq_n_s16(vshlq_n_s16(cr, 1), RGB_Cr_R);
+	*dB = vqrdmulhq_n_s16(vshlq_n_s16(cb, 1), RGB_Cb_B);
+
+	lo = vmull_n_s16(vget_low_s16(cb), RGB_Cb_G);
+	lo = vmlal_n_s16(lo, vget_low_s16(cr), RGB_Cr_G);
+	hi = vmull_n_s16(vget_high_s16(cb), RGB_Cb_G);
+	hi = vmlal_n_s16(hi, vget_high_s16(cr), RGB_Cr_G);
+	*dG = vcombine_s16(vrshrn_n_s32(lo, RGB_BITS), vrshrn_n_s32(hi, RGB_BITS));
+}
+
+static inline uint8x16_t rgb_channel_neon(uint8x16_t Y, int16x8_t d)
+{
+	int16x8x2_t dd = vzipq_s16(d, d);
+
+	return vcombine_u8(
+		vqmovun_s16(vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(Y))),
+				      dd.val[0])),
+		vqmovun_s16(vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(Y))),
+				      dd.val[1])));
+}
+
+static inline unsigned int rgb_jpeg420_row_neon(unsigned char *Y, unsigned char *Cb,
+						unsigned char *Cr, unsigned char *dst,
+						unsigned int x, unsigned int w)
+{
+	int16x8_t dR, dG, dB;
+	uint8x16x3_t out;
+	uint8x16_t y;
+
+	for (; x + 16 <= w; x += 16) {
+		y = vld1q_u8(&Y[x]);
+		rgb_chroma_neon(vld1_u8(&Cb[x / 2]), vld1_u8(&Cr[x / 2]), &dR, &dG, &dB);
+
+		out.val[0] = rgb_channel_neon(y, dB);
+		out.val[1] = rgb_channel_neon(y, dG);
+		out.val[2] = rgb_channel_neon(y, dR);
+		vst3q_u8(&dst[x * 3], out);
+	}
+
+	return x;
+}
+
+void rgb_convert_rows_neon(rgb_t rgb, struct rgb_video_stream_s *video,
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows)
+{
+	unsigned int x, sy;
+	unsigned char *Y, *Cb, *Cr, *rgb_row;
+
+	for (; rows > 0; rows--, y++) {
+		sy = video->h - 1 - y;
+		Y = CHAIN_ROW(from, sy);
+		Cb = CHAIN_CB_ROW(from, sy / 2);
+		Cr = CHAIN_CR_ROW(from, sy / 2);
+		rgb_row = CHAIN_ROW(to, y);
+
+		x = rgb_jpeg420_row_neon(Y, Cb, Cr, rgb_row, 0, video->w);
+		rgb_jpeg420_row(Y, Cb, Cr, rgb_row, x, video->w);
+	}
+}
+
+#endif /* __ARM_NEON */
+
 /**  \} */
@@ -18,6 +18,7 @@
 
 #include <packetstream.h>
 #include <glc/common/glc.h>
+#include <glc/core/chain.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -62,6 +63,16 @@ __PUBLIC int rgb_process_start(rgb_t rgb, ps_buffer_t *from, ps_buffer_t *to);
  */
 __PUBLIC int rgb_process_wait(rgb_t rgb);
 
+/**
+ * \brief get rgb filter for chain
+ *
+ * rgb must not be started on its own if it is used in a chain.
+ * \param rgb rgb object
+ * \param filter filter vtable is written here
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int rgb_filter(rgb_t rgb, chain_filter_t *filter);
+
 #ifdef __cplusplus
 }
 #endif
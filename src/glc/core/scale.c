@@ -18,24 +18,56 @@
 #include <packetstream.h>
 #include <pthread.h>
 #include <errno.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define SCALE_X86
+#endif
+#ifdef __ARM_NEON
+# include <arm_neon.h>
+#endif
 
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/thread.h>
 #include <glc/common/util.h>
+#include <glc/common/state.h>
+#include <glc/common/slice.h>
+#include <glc/common/registry.h>
 
 #include "scale.h"
 
 #define SCALE_RUNNING      0x1
 #define SCALE_SIZE         0x2
 
+/* filter weights are fixed point with this many fraction bits */
+#define SCALE_BITS           14
+/* and so are results of vertical pass */
+#define SCALE_TMP_BITS        6
+#define SCALE_MAX_TAPS       32
+
 struct scale_video_stream_s;
 
+struct scale_taps_s {
+	/** output samples */
+	unsigned int size;
+	/** taps per output sample */
+	unsigned int taps;
+	/** first source sample for each output sample */
+	unsigned int *start;
+	/** taps weights per output sample, sum is 1 << SCALE_BITS */
+	short *weight;
+};
+
 typedef void (*scale_proc)(scale_t scale,
 			   struct scale_video_stream_s *video,
-			   unsigned char *from,
-			   unsigned char *to);
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows);
+typedef void (*scale_line_proc)(struct scale_taps_s *col, struct scale_taps_s *row,
+				unsigned int y, unsigned char *src, unsigned int stride,
+				unsigned int width, short *tmp, unsigned char *dst);
 
 struct scale_video_stream_s {
 	glc_stream_id_t id;
@@ -49,53 +81,152 @@ struct scale_video_stream_s {
 
 	unsigned int rw, rh, rx, ry;
 
-	unsigned int *pos;
-	float *factor;
+	/* polyphase filter for each output column and row */
+	struct scale_taps_s col, row_taps;
+	struct scale_taps_s chroma_col, chroma_row;
 
-	scale_proc proc;
+	/* proc is the C loop, kernel what actually runs */
+	scale_proc proc, kernel;
+	/* filter_line instance for pixel size */
+	scale_line_proc line;
 
 	pthread_rwlock_t update;
-	struct scale_video_stream_s *next;
 };
 
 struct scale_s {
 	glc_t *glc;
 	glc_flags_t flags;
-	struct scale_video_stream_s *video;
+	glc_registry_t video;
 	glc_thread_t thread;
 
 	double scale;
 	unsigned int width, height;
+	int interpolation;
+};
+
+struct scale_slice_s {
+	scale_t scale;
+	struct scale_video_stream_s *video;
+	chain_rows_t from, to;
 };
 
 int scale_read_callback(glc_thread_state_t *state);
 int scale_write_callback(glc_thread_state_t *state);
+void scale_slice_callback(void *ptr, unsigned int y, unsigned int rows);
 void scale_finish_callback(void *ptr, int err);
 
 int scale_video_format_message(scale_t scale, glc_video_format_message_t *format_message, glc_thread_state_t *state);
 int scale_get_video_stream(scale_t scale, glc_stream_id_t id, struct scale_video_stream_s **video);
-
-int scale_generate_rgb_map(scale_t scale, struct scale_video_stream_s *video);
-int scale_generate_ycbcr_map(scale_t scale, struct scale_video_stream_s *video);
+int scale_video_stream_init(void *entry, glc_stream_id_t id, void *arg);
+int scale_video_stream_destroy(void *entry, glc_stream_id_t id, void *arg);
+
+int scale_generate_map(scale_t scale, struct scale_video_stream_s *video);
+int scale_generate_taps(scale_t scale, struct scale_taps_s *taps,
+			unsigned int from, unsigned int to);
+void scale_free_taps(struct scale_taps_s *taps);
+float scale_taps_kernel(int interpolation, float x);
+void scale_filter_line_bgr(struct scale_taps_s *col, struct scale_taps_s *row,
+			   unsigned int y, unsigned char *src, unsigned int stride,
+			   unsigned int width, short *tmp, unsigned char *dst);
+void scale_filter_line_bgra(struct scale_taps_s *col, struct scale_taps_s *row,
+			    unsigned int y, unsigned char *src, unsigned int stride,
+			    unsigned int width, short *tmp, unsigned char *dst);
+void scale_filter_line_plane(struct scale_taps_s *col, struct scale_taps_s *row,
+			     unsigned int y, unsigned char *src, unsigned int stride,
+			     unsigned int width, short *tmp, unsigned char *dst);
+
+void scale_get_rows(struct scale_video_stream_s *video, chain_rows_t *from, chain_rows_t *to);
+void scale_need(scale_t scale, struct scale_video_stream_s *video,
+		unsigned int y, unsigned int rows,
+		unsigned int *from_y, unsigned int *from_rows);
 
 void scale_rgb_convert(scale_t scale, struct scale_video_stream_s *video,
-		       unsigned char *from, unsigned char *to);
+		       chain_rows_t *from, chain_rows_t *to,
+		       unsigned int y, unsigned int rows);
 void scale_rgb_half(scale_t scale, struct scale_video_stream_s *video,
-		    unsigned char *from, unsigned char *to);
+		    chain_rows_t *from, chain_rows_t *to,
+		    unsigned int y, unsigned int rows);
+void scale_rgb_half_bgr(scale_t scale, struct scale_video_stream_s *video,
+			chain_rows_t *from, chain_rows_t *to,
+			unsigned int y, unsigned int rows);
+void scale_rgb_half_bgra(scale_t scale, struct scale_video_stream_s *video,
+			 chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows);
 void scale_rgb_scale(scale_t scale, struct scale_video_stream_s *video,
-		     unsigned char *from, unsigned char *to);
+		     chain_rows_t *from, chain_rows_t *to,
+		     unsigned int y, unsigned int rows);
 
 void scale_ycbcr_half(scale_t scale, struct scale_video_stream_s *video,
-		      unsigned char *from, unsigned char *to);
+		      chain_rows_t *from, chain_rows_t *to,
+		      unsigned int y, unsigned int rows);
 void scale_ycbcr_scale(scale_t scale, struct scale_video_stream_s *video,
-		       unsigned char *from, unsigned char *to);
+		       chain_rows_t *from, chain_rows_t *to,
+		       unsigned int y, unsigned int rows);
+
+void scale_rgb_half_row(struct scale_video_stream_s *video,
+			unsigned char *row1, unsigned char *row2,
+			unsigned char *dst, unsigned int x);
+void scale_half_row(unsigned char *row1, unsigned char *row2,
+		    unsigned char *dst, unsigned int x, unsigned int w);
+void scale_half_chroma_row(unsigned char *row1, unsigned char *row2,
+			   unsigned char *dst, unsigned int x, unsigned int w);
+
+scale_proc scale_simd(scale_t scale, struct scale_video_stream_s *video);
+
+#ifdef SCALE_X86
+void scale_rgb_convert_ssse3(scale_t scale, struct scale_video_stream_s *video,
+			     chain_rows_t *from, chain_rows_t *to,
+			     unsigned int y, unsigned int rows);
+void scale_rgb_half_ssse3(scale_t scale, struct scale_video_stream_s *video,
+			  chain_rows_t *from, chain_rows_t *to,
+			  unsigned int y, unsigned int rows);
+void scale_rgb_half_avx2(scale_t scale, struct scale_video_stream_s *video,
+			 chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows);
+void scale_ycbcr_half_ssse3(scale_t scale, struct scale_video_stream_s *video,
+			    chain_rows_t *from, chain_rows_t *to,
+			    unsigned int y, unsigned int rows);
+void scale_ycbcr_half_avx2(scale_t scale, struct scale_video_stream_s *video,
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows);
+#endif
+
+#ifdef __ARM_NEON
+void scale_rgb_convert_neon(scale_t scale, struct scale_video_stream_s *video,
+			    chain_rows_t *from, chain_rows_t *to,
+			    unsigned int y, unsigned int rows);
+void scale_rgb_half_neon(scale_t scale, struct scale_video_stream_s *video,
+			 chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows);
+void scale_ycbcr_half_neon(scale_t scale, struct scale_video_stream_s *video,
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows);
+#endif
+
+int scale_message_callback(void *ptr, glc_thread_state_t *state);
+int scale_frame_callback(void *ptr, glc_stream_id_t id,
+			 chain_rows_t *from, chain_rows_t *to,
+			 int *whole, void **ctx);
+void scale_need_callback(void *ptr, void *ctx, unsigned int y, unsigned int rows,
+			 unsigned int *from_y, unsigned int *from_rows);
+void scale_rows_callback(void *ptr, void *ctx, chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows);
+void scale_done_callback(void *ptr, void *ctx);
 
 int scale_init(scale_t *scale, glc_t *glc)
 {
+	int ret;
+
 	*scale = malloc(sizeof(struct scale_s));
 	memset(*scale, 0, sizeof(struct scale_s));
 
 	(*scale)->glc = glc;
+	if ((ret = glc_registry_init(&(*scale)->video, sizeof(struct scale_video_stream_s),
+				     &scale_video_stream_init, &scale_video_stream_destroy,
+				     *scale))) {
+		free(*scale);
+		return ret;
+	}
 
 	(*scale)->thread.flags = GLC_THREAD_READ | GLC_THREAD_WRITE;
 	(*scale)->thread.read_callback = &scale_read_callback;
@@ -103,6 +234,7 @@ int scale_init(scale_t *scale, glc_t *glc)
 	(*scale)->thread.finish_callback = &scale_finish_callback;
 	(*scale)->thread.ptr = *scale;
 	(*scale)->thread.threads = glc_threads_hint(glc);
+	(*scale)->thread.name = "scale";
 	(*scale)->scale = 1.0;
 
 	return 0;
@@ -110,6 +242,7 @@ int scale_init(scale_t *scale, glc_t *glc)
 
 int scale_destroy(scale_t scale)
 {
+	glc_registry_destroy(scale->video);
 	free(scale);
 	return 0;
 }
@@ -124,6 +257,19 @@ int scale_set_scale(scale_t scale, double factor)
 	return 0;
 }
 
+int scale_set_interpolation(scale_t scale, int interpolation)
+{
+	if ((interpolation != SCALE_BILINEAR) &&
+	    (interpolation != SCALE_BICUBIC) &&
+	    (interpolation != SCALE_LANCZOS))
+		return EINVAL;
+	if (scale->flags & SCALE_RUNNING)
+		return EALREADY;
+
+	scale->interpolation = interpolation;
+	return 0;
+}
+
 int scale_set_size(scale_t scale, unsigned int width, unsigned int height)
 {
 	if ((!width) | (!height))
@@ -160,39 +306,51 @@ int scale_process_wait(scale_t scale)
 	return 0;
 }
 
+int scale_filter(scale_t scale, chain_filter_t *filter)
+{
+	if (scale->flags & SCALE_RUNNING)
+		return EALREADY;
+
+	memset(filter, 0, sizeof(chain_filter_t));
+	filter->ptr = scale;
+	filter->message_callback = &scale_message_callback;
+	filter->frame_callback = &scale_frame_callback;
+	filter->need_callback = &scale_need_callback;
+	filter->rows_callback = &scale_rows_callback;
+	filter->done_callback = &scale_done_callback;
+	filter->finish_callback = &scale_finish_callback;
+
+	return 0;
+}
+
 void scale_finish_callback(void *ptr, int err)
 {
 	scale_t scale = ptr;
-	struct scale_video_stream_s *del;
 
 	if (err)
 		glc_log(scale->glc, GLC_ERROR, "scale", "%s (%d)", strerror(err), err);
 
-	while (scale->video != NULL) {
-		del = scale->video;
-		scale->video = scale->video->next;
-
-		if (del->pos)
-			free(del->pos);
-		if (del->factor)
-			free(del->factor);
-
-		pthread_rwlock_destroy(&del->update);
-		free(del);
-	}
+	glc_registry_clear(scale->video);
 }
 
 int scale_read_callback(glc_thread_state_t *state) {
 	scale_t scale = (scale_t) state->ptr;
 	struct scale_video_stream_s *video;
 	glc_video_frame_header_t *video_frame_header;
+	int ret;
 
 	if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
 		return scale_video_format_message(scale, (glc_video_format_message_t *) state->read_data, state);
 
 	if (state->header.type == GLC_MESSAGE_VIDEO_FRAME) {
 		video_frame_header = (glc_video_frame_header_t *) state->read_data;
-		scale_get_video_stream(scale, video_frame_header->id, &video);
+		if (glc_state_video_late(scale->glc, video_frame_header->id, video_frame_header->time)) {
+			/* player would drop it anyway */
+			state->flags |= GLC_THREAD_STATE_SKIP_WRITE;
+			return 0;
+		}
+		if ((ret = scale_get_video_stream(scale, video_frame_header->id, &video)))
+			return ret;
 		state->threadptr = video;
 
 		pthread_rwlock_rdlock(&video->update);
@@ -210,247 +368,899 @@ int scale_read_callback(glc_thread_state_t *state) {
 }
 
 int scale_write_callback(glc_thread_state_t *state) {
-	scale_t scale = (scale_t) state->ptr;
-	struct scale_video_stream_s *video = state->threadptr;
+	struct scale_slice_s slice;
 
 	memcpy(state->write_data, state->read_data, sizeof(glc_video_frame_header_t));
-	video->proc(scale, video,
-		  (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
-		  (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)]);
-	pthread_rwlock_unlock(&video->update);
+
+	slice.scale = (scale_t) state->ptr;
+	slice.video = state->threadptr;
+	scale_get_rows(slice.video, &slice.from, &slice.to);
+	slice.from.data = (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)];
+	slice.to.data = (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)];
+	glc_slice_run(slice.scale->glc, slice.video->rh, 2, &scale_slice_callback, &slice);
+
+	pthread_rwlock_unlock(&slice.video->update);
 
 	return 0;
 }
 
-int scale_get_video_stream(scale_t scale, glc_stream_id_t id, struct scale_video_stream_s **video)
+void scale_slice_callback(void *ptr, unsigned int y, unsigned int rows)
 {
-	struct scale_video_stream_s *list = scale->video;
+	struct scale_slice_s *slice = ptr;
+	slice->video->kernel(slice->scale, slice->video, &slice->from, &slice->to, y, rows);
+}
 
-	while (list != NULL) {
-		if (list->id == id)
-			break;
-		list = list->next;
-	}
+int scale_message_callback(void *ptr, glc_thread_state_t *state)
+{
+	if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
+		return scale_video_format_message((scale_t) ptr,
+						  (glc_video_format_message_t *) state->read_data,
+						  state);
+	return 0;
+}
 
-	if (list == NULL) {
-		list = (struct scale_video_stream_s *) malloc(sizeof(struct scale_video_stream_s));
-		memset(list, 0, sizeof(struct scale_video_stream_s));
+int scale_frame_callback(void *ptr, glc_stream_id_t id,
+			 chain_rows_t *from, chain_rows_t *to,
+			 int *whole, void **ctx)
+{
+	struct scale_video_stream_s *video;
+	int ret;
+
+	if ((ret = scale_get_video_stream((scale_t) ptr, id, &video)))
+		return ret;
+	pthread_rwlock_rdlock(&video->update);
 
-		list->next = scale->video;
-		scale->video = list;
-		list->id = id;
-		pthread_rwlock_init(&list->update, NULL);
+	if (!video->proc) {
+		pthread_rwlock_unlock(&video->update);
+		*ctx = NULL;
+		return 0;
 	}
 
-	*video = list;
+	scale_get_rows(video, from, to);
+	*ctx = video;
 	return 0;
 }
 
-void scale_rgb_convert(scale_t scale, struct scale_video_stream_s *video,
-		       unsigned char *from, unsigned char *to)
+void scale_need_callback(void *ptr, void *ctx, unsigned int y, unsigned int rows,
+			 unsigned int *from_y, unsigned int *from_rows)
 {
-	unsigned int x, y, ox, oy, op, tp;
-	unsigned int swi = video->sw * 3;
-	unsigned int shi = video->sh * 3;
-	ox = oy = 0;
+	scale_need((scale_t) ptr, ctx, y, rows, from_y, from_rows);
+}
 
-	/* just convert from different bpp to 3 */
-	for (y = 0; y < shi; y += 3) {
-		for (x = 0; x < swi; x += 3) {
-			tp = x + y * video->sw;
-			op = ox + oy * video->row;
+void scale_rows_callback(void *ptr, void *ctx, chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows)
+{
+	struct scale_video_stream_s *video = ctx;
+	video->kernel((scale_t) ptr, video, from, to, y, rows);
+}
 
-			to[tp + 0] = from[op + 0];
-			to[tp + 1] = from[op + 1];
-			to[tp + 2] = from[op + 2];
+void scale_done_callback(void *ptr, void *ctx)
+{
+	struct scale_video_stream_s *video = ctx;
+	pthread_rwlock_unlock(&video->update);
+}
 
-			ox += video->bpp;
-		}
-		oy++;
-		ox = 0;
+int scale_get_video_stream(scale_t scale, glc_stream_id_t id, struct scale_video_stream_s **video)
+{
+	return glc_registry_get(scale->video, id, (void **) video);
+}
+
+int scale_video_stream_init(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct scale_video_stream_s *video = entry;
+
+	video->id = id;
+	pthread_rwlock_init(&video->update, NULL);
+	return 0;
+}
+
+int scale_video_stream_destroy(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct scale_video_stream_s *video = entry;
+
+	scale_free_taps(&video->col);
+	scale_free_taps(&video->row_taps);
+	scale_free_taps(&video->chroma_col);
+	scale_free_taps(&video->chroma_row);
+
+	pthread_rwlock_destroy(&video->update);
+	return 0;
+}
+
+void scale_get_rows(struct scale_video_stream_s *video, chain_rows_t *from, chain_rows_t *to)
+{
+	memset(from, 0, sizeof(chain_rows_t));
+	from->format = video->format;
+	from->w = video->w;
+	from->h = video->h;
+	from->rows = video->h;
+
+	memset(to, 0, sizeof(chain_rows_t));
+	to->w = video->rw;
+	to->h = video->rh;
+	to->rows = video->rh;
+
+	if (video->format == GLC_VIDEO_YCBCR_420JPEG) {
+		from->row = video->w;
+		to->format = GLC_VIDEO_YCBCR_420JPEG;
+		to->row = video->rw;
+	} else {
+		from->row = video->row;
+		to->format = GLC_VIDEO_BGR;
+		to->row = video->rw * 3;
 	}
 }
 
-void scale_rgb_half(scale_t scale, struct scale_video_stream_s *video,
-		    unsigned char *from, unsigned char *to)
-{
-	unsigned int ox, oy, op1, op2, op3, op4;
-
-	for (oy = 0; oy < video->h; oy += 2) {
-		for (ox = 0; ox < video->w; ox += 2) {
-			op1 = ox * video->bpp + oy * video->row;
-			op2 = op1 + video->bpp;
-			op3 = op1 + video->row;
-			op4 = op2 + video->row;
-
-			*to++ = (from[op1 + 0] +
-				 from[op2 + 0] +
-				 from[op3 + 0] +
-				 from[op4 + 0]) >> 2;
-			*to++ = (from[op1 + 1] +
-				 from[op2 + 1] +
-				 from[op3 + 1] +
-				 from[op4 + 1]) >> 2;
-			*to++ = (from[op1 + 2] +
-				 from[op2 + 2] +
-				 from[op3 + 2] +
-				 from[op4 + 2]) >> 2;
+void scale_need(scale_t scale, struct scale_video_stream_s *video,
+		unsigned int y, unsigned int rows,
+		unsigned int *from_y, unsigned int *from_rows)
+{
+	unsigned int first, last, cfirst, clast, ch;
+
+	if ((video->proc == scale_rgb_half) | (video->proc == scale_ycbcr_half)) {
+		*from_y = y * 2;
+		*from_rows = rows * 2;
+		return;
+	} else if (video->proc == scale_rgb_convert) {
+		*from_y = y;
+		*from_rows = rows;
+		return;
+	}
 
+	/* rows inside scaled picture */
+	first = (y > video->ry) ? (y - video->ry) : 0;
+	last = (y + rows > video->ry) ? (y + rows - video->ry) : 0;
+	if (last > video->sh)
+		last = video->sh;
+
+	if (video->proc == scale_rgb_scale) {
+		if (first >= last) {
+			*from_y = *from_rows = 0;
+			return;
 		}
+
+		/* filter windows never move backwards */
+		*from_y = video->row_taps.start[first];
+		*from_rows = video->row_taps.start[last - 1] + video->row_taps.taps - *from_y;
+		return;
 	}
+
+	/* scale_ycbcr_scale(), chroma rows may reach further than Y' rows */
+	ch = video->sh / 2;
+	cfirst = (y / 2 > video->ry / 2) ? (y / 2 - video->ry / 2) : 0;
+	clast = ((y + rows) / 2 > video->ry / 2) ? ((y + rows) / 2 - video->ry / 2) : 0;
+	if (clast > ch)
+		clast = ch;
+
+	*from_y = video->h;
+	*from_rows = 0;
+
+	if (first < last) {
+		*from_y = video->row_taps.start[first];
+		*from_rows = video->row_taps.start[last - 1] + video->row_taps.taps;
+	}
+
+	if (cfirst < clast) {
+		first = 2 * video->chroma_row.start[cfirst];
+		last = 2 * (video->chroma_row.start[clast - 1] + video->chroma_row.taps);
+		if (first < *from_y)
+			*from_y = first;
+		if (last > *from_rows)
+			*from_rows = last;
+	}
+
+	/* from_rows holds last row here */
+	if (*from_rows > *from_y)
+		*from_rows -= *from_y;
+	else
+		*from_y = *from_rows = 0;
 }
 
-void scale_rgb_scale(scale_t scale, struct scale_video_stream_s *video,
-		     unsigned char *from, unsigned char *to)
-{
-	unsigned int x, y, tp, sp;
-
-	if (scale->flags & SCALE_SIZE)
-		memset(to, 0, video->size);
-
-	for (y = 0; y < video->sh; y++) {
-		for (x = 0; x < video->sw; x++) {
-			sp = (x + y * video->sw) * 4;
-			tp = ((x + video->rx) + (y + video->ry) * video->rw) * 3;
-
-			to[tp + 0] = from[video->pos[sp + 0] + 0] * video->factor[sp + 0] +
-				     from[video->pos[sp + 1] + 0] * video->factor[sp + 1] +
-				     from[video->pos[sp + 2] + 0] * video->factor[sp + 2] +
-				     from[video->pos[sp + 3] + 0] * video->factor[sp + 3];
-			to[tp + 1] = from[video->pos[sp + 0] + 1] * video->factor[sp + 0] +
-				     from[video->pos[sp + 1] + 1] * video->factor[sp + 1] +
-				     from[video->pos[sp + 2] + 1] * video->factor[sp + 2] +
-				     from[video->pos[sp + 3] + 1] * video->factor[sp + 3];
-			to[tp + 2] = from[video->pos[sp + 0] + 2] * video->factor[sp + 0] +
-				     from[video->pos[sp + 1] + 2] * video->factor[sp + 1] +
-				     from[video->pos[sp + 2] + 2] * video->factor[sp + 2] +
-				     from[video->pos[sp + 3] + 2] * video->factor[sp + 3];
+void scale_rgb_convert(scale_t scale, struct scale_video_stream_s *video,
+		       chain_rows_t *from, chain_rows_t *to,
+		       unsigned int y, unsigned int rows)
+{
+	unsigned int x, ox, w = video->sw;
+	unsigned char *src, *dst;
+
+	/* only used for BGRA, so pixel size is known */
+	for (; rows > 0; rows--, y++) {
+		src = CHAIN_ROW(from, y);
+		dst = CHAIN_ROW(to, y);
+
+		for (x = 0, ox = 0; x < w; x++, ox += 4) {
+			dst[x * 3 + 0] = src[ox + 0];
+			dst[x * 3 + 1] = src[ox + 1];
+			dst[x * 3 + 2] = src[ox + 2];
 		}
 	}
 }
 
+/*
+ * C kernels are instantiated at build time for each pixel size, so
+ * that offsets are constants and compiler can unroll and vectorize
+ * inner loops. Instance is picked in scale_video_format_message().
+ */
+
+static inline __attribute__ ((always_inline))
+void scale_rgb_half_row_bpp(const unsigned int bpp, unsigned int w,
+			    const unsigned char *row1, const unsigned char *row2,
+			    unsigned char *dst, unsigned int x)
+{
+	unsigned int op1, op2;
+
+	for (dst = &dst[x * 3]; x < w; x++) {
+		op1 = x * 2 * bpp;
+		op2 = op1 + bpp;
+
+		*dst++ = (row1[op1 + 0] +
+			  row1[op2 + 0] +
+			  row2[op1 + 0] +
+			  row2[op2 + 0]) >> 2;
+		*dst++ = (row1[op1 + 1] +
+			  row1[op2 + 1] +
+			  row2[op1 + 1] +
+			  row2[op2 + 1]) >> 2;
+		*dst++ = (row1[op1 + 2] +
+			  row1[op2 + 2] +
+			  row2[op1 + 2] +
+			  row2[op2 + 2]) >> 2;
+	}
+}
+
+#define SCALE_RGB_HALF(fmt, bpp) \
+void scale_rgb_half_##fmt(scale_t scale, struct scale_video_stream_s *video, \
+			  chain_rows_t *from, chain_rows_t *to, \
+			  unsigned int y, unsigned int rows) \
+{ \
+	for (; rows > 0; rows--, y++) \
+		scale_rgb_half_row_bpp(bpp, video->sw, \
+				       CHAIN_ROW(from, y * 2), CHAIN_ROW(from, y * 2 + 1), \
+				       CHAIN_ROW(to, y), 0); \
+}
+
+SCALE_RGB_HALF(bgr, 3)
+SCALE_RGB_HALF(bgra, 4)
+
+#undef SCALE_RGB_HALF
+
+void scale_rgb_half(scale_t scale, struct scale_video_stream_s *video,
+		    chain_rows_t *from, chain_rows_t *to,
+		    unsigned int y, unsigned int rows)
+{
+	if (video->bpp == 4)
+		scale_rgb_half_bgra(scale, video, from, to, y, rows);
+	else
+		scale_rgb_half_bgr(scale, video, from, to, y, rows);
+}
+
+/* finishes rows for vector kernels */
+void scale_rgb_half_row(struct scale_video_stream_s *video,
+			unsigned char *row1, unsigned char *row2,
+			unsigned char *dst, unsigned int x)
+{
+	if (video->bpp == 4)
+		scale_rgb_half_row_bpp(4, video->sw, row1, row2, dst, x);
+	else
+		scale_rgb_half_row_bpp(3, video->sw, row1, row2, dst, x);
+}
+
+void scale_rgb_scale(scale_t scale, struct scale_video_stream_s *video,
+		     chain_rows_t *from, chain_rows_t *to,
+		     unsigned int y, unsigned int rows)
+{
+	unsigned char *dst;
+	short *tmp;
+
+	if (!(tmp = malloc(sizeof(short) * video->w * video->bpp)))
+		return;
+
+	for (; rows > 0; rows--, y++) {
+		dst = CHAIN_ROW(to, y);
+
+		if (scale->flags & SCALE_SIZE)
+			memset(dst, 0, video->rw * 3);
+
+		if ((y < video->ry) | (y >= video->ry + video->sh))
+			continue;
+
+		video->line(&video->col, &video->row_taps, y - video->ry,
+			    CHAIN_ROW(from, video->row_taps.start[y - video->ry]), from->row,
+			    video->w, tmp, &dst[video->rx * 3]);
+	}
+
+	free(tmp);
+}
+
 void scale_ycbcr_half(scale_t scale, struct scale_video_stream_s *video,
-		      unsigned char *from, unsigned char *to)
+		      chain_rows_t *from, chain_rows_t *to,
+		      unsigned int y, unsigned int rows)
 {
-	unsigned int x, y, ox, oy, cw_from, ch_from, cw_to, ch_to, op1, op2, op3, op4;
-	unsigned char *Cb_to, *Cr_to;
-	unsigned char *Cb_from, *Cr_from;
+	unsigned int c, cw_from, cw_to;
 
 	cw_from = video->w / 2;
-	ch_from = video->h / 2;
-	Cb_from = &from[video->w * video->h];
-	Cr_from = &Cb_from[cw_from * ch_from];
-
 	cw_to = video->sw / 2;
-	ch_to = video->sh / 2;
-	Cb_to = &to[video->sw * video->sh];
-	Cr_to = &Cb_to[cw_to * ch_to];
-
-	ox = oy = 0;
-	for (y = 0; y < ch_to; y++) {
-		for (x = 0; x < cw_to; x++) {
-			op1 = oy * cw_from + ox;
-			op2 = op1 + 1;
-			op3 = op2 + cw_from;
-			op4 = op2 + cw_from;
-
-			*Cb_to++ = (Cb_from[op1] +
-				    Cb_from[op2] +
-				    Cb_from[op3] +
-				    Cb_from[op4]) >> 2;
-			*Cr_to++ = (Cr_from[op1] +
-				    Cr_from[op2] +
-				    Cr_from[op3] +
-				    Cr_from[op4]) >> 2;
-
-			ox += 2;
-		}
-		ox = 0;
-		oy += 2;
+
+	for (c = y / 2; c < (y + rows) / 2; c++) {
+		scale_half_chroma_row(CHAIN_CB_ROW(from, c * 2), &CHAIN_CB_ROW(from, c * 2)[cw_from],
+				      CHAIN_CB_ROW(to, c), 0, cw_to);
+		scale_half_chroma_row(CHAIN_CR_ROW(from, c * 2), &CHAIN_CR_ROW(from, c * 2)[cw_from],
+				      CHAIN_CR_ROW(to, c), 0, cw_to);
 	}
 
-	ox = oy = 0;
-	for (y = 0; y < video->sh; y++) {
-		for (x = 0; x < video->sw; x++) {
-			op1 = oy * video->w + ox;
-			op2 = op1 + 1;
-			op3 = op1 + video->w;
-			op4 = op2 + video->w;
+	for (; rows > 0; rows--, y++)
+		scale_half_row(CHAIN_ROW(from, y * 2), CHAIN_ROW(from, y * 2 + 1),
+			       CHAIN_ROW(to, y), 0, video->sw);
+}
 
-			*to++ = (from[op1] +
-				 from[op2] +
-				 from[op3] +
-				 from[op4]) >> 2;
+void scale_half_row(unsigned char *row1, unsigned char *row2,
+		    unsigned char *dst, unsigned int x, unsigned int w)
+{
+	unsigned int op1, op2;
 
-			ox += 2;
-		}
-		ox = 0;
-		oy += 2;
+	for (; x < w; x++) {
+		op1 = x * 2;
+		op2 = op1 + 1;
+
+		dst[x] = (row1[op1] +
+			  row1[op2] +
+			  row2[op1] +
+			  row2[op2]) >> 2;
+	}
+}
+
+void scale_half_chroma_row(unsigned char *row1, unsigned char *row2,
+			   unsigned char *dst, unsigned int x, unsigned int w)
+{
+	unsigned int op1, op2;
+
+	/* second row contributes its odd samples twice */
+	for (; x < w; x++) {
+		op1 = x * 2;
+		op2 = op1 + 1;
+
+		dst[x] = (row1[op1] +
+			  row1[op2] +
+			  row2[op2] +
+			  row2[op2]) >> 2;
 	}
 }
 
 void scale_ycbcr_scale(scale_t scale, struct scale_video_stream_s *video,
-		       unsigned char *from, unsigned char *to)
+		       chain_rows_t *from, chain_rows_t *to,
+		       unsigned int y, unsigned int rows)
 {
-	unsigned int x, y, sp, cw, ch;
+	unsigned int c, sy, cw, ch;
 	unsigned char *Y_to, *Cb_to, *Cr_to;
-	unsigned char *Y_from, *Cb_from, *Cr_from;
+	short *tmp;
 
-	Y_from = from;
-	Cb_from = &from[video->w * video->h];
-	Cr_from = &Cb_from[(video->w / 2) * (video->h / 2)];
+	if (!(tmp = malloc(sizeof(short) * video->w)))
+		return;
 
-	cw = video->sw / 2;
+	cw = video->w / 2;
 	ch = video->sh / 2;
-	Y_to = to;
-	Cb_to = &to[video->rw * video->rh];
-	Cr_to = &Cb_to[(video->rw / 2) * (video->rh / 2)];
 
-	if (scale->flags & SCALE_SIZE) {
-		memset(Y_to, 0, video->rw * video->rh);
-		memset(Cb_to, 128, (video->rw / 2) * (video->rh / 2));
-		memset(Cr_to, 128, (video->rw / 2) * (video->rh / 2));
+	for (c = y / 2; c < (y + rows) / 2; c++) {
+		Cb_to = CHAIN_CB_ROW(to, c);
+		Cr_to = CHAIN_CR_ROW(to, c);
+
+		if (scale->flags & SCALE_SIZE) {
+			memset(Cb_to, 128, video->rw / 2);
+			memset(Cr_to, 128, video->rw / 2);
+		}
+
+		if ((c < video->ry / 2) | (c >= video->ry / 2 + ch))
+			continue;
+		sy = c - video->ry / 2;
+
+		scale_filter_line_plane(&video->chroma_col, &video->chroma_row, sy,
+					CHAIN_CB_ROW(from, video->chroma_row.start[sy]), from->row / 2,
+					cw, tmp, &Cb_to[video->rx / 2]);
+		scale_filter_line_plane(&video->chroma_col, &video->chroma_row, sy,
+					CHAIN_CR_ROW(from, video->chroma_row.start[sy]), from->row / 2,
+					cw, tmp, &Cr_to[video->rx / 2]);
 	}
 
-	for (y = 0; y < video->sh; y++) {
-		for (x = 0; x < video->sw; x++) {
-			sp = (x + y * video->sw) * 4;
+	for (; rows > 0; rows--, y++) {
+		Y_to = CHAIN_ROW(to, y);
+
+		if (scale->flags & SCALE_SIZE)
+			memset(Y_to, 0, video->rw);
 
-			Y_to[(x + video->rx) + (y + video->ry) * video->rw] =
-				Y_from[video->pos[sp + 0]] * video->factor[sp + 0] +
-				Y_from[video->pos[sp + 1]] * video->factor[sp + 1] +
-				Y_from[video->pos[sp + 2]] * video->factor[sp + 2] +
-				Y_from[video->pos[sp + 3]] * video->factor[sp + 3];
+		if ((y < video->ry) | (y >= video->ry + video->sh))
+			continue;
+		sy = y - video->ry;
+
+		scale_filter_line_plane(&video->col, &video->row_taps, sy,
+					CHAIN_ROW(from, video->row_taps.start[sy]), from->row,
+					video->w, tmp, &Y_to[video->rx]);
+	}
+
+	free(tmp);
+}
+
+static inline __attribute__ ((always_inline))
+void scale_filter_line_bpp(const unsigned int bpp, const unsigned int channels,
+			   struct scale_taps_s *col, struct scale_taps_s *row, unsigned int y,
+			   const unsigned char *src, unsigned int stride, unsigned int width,
+			   short *tmp, unsigned char *dst)
+{
+	const short *weight = &row->weight[y * row->taps];
+	unsigned int x, c, t, n = width * bpp;
+	short *p;
+	int sum;
+
+	/* vertical pass into tmp, with SCALE_TMP_BITS of fraction */
+	for (x = 0; x < n; x++) {
+		sum = 0;
+		for (t = 0; t < row->taps; t++)
+			sum += src[t * stride + x] * weight[t];
+		tmp[x] = (sum + (1 << (SCALE_BITS - SCALE_TMP_BITS - 1)))
+			 >> (SCALE_BITS - SCALE_TMP_BITS);
+	}
+
+	/* horizontal pass */
+	for (x = 0; x < col->size; x++) {
+		weight = &col->weight[x * col->taps];
+		p = &tmp[col->start[x] * bpp];
+
+		for (c = 0; c < channels; c++) {
+			sum = 0;
+			for (t = 0; t < col->taps; t++)
+				sum += p[t * bpp + c] * weight[t];
+			sum = (sum + (1 << (SCALE_BITS + SCALE_TMP_BITS - 1)))
+			      >> (SCALE_BITS + SCALE_TMP_BITS);
+
+			*dst++ = (sum < 0) ? 0 : ((sum > 255) ? 255 : sum);
 		}
 	}
+}
+
+#define SCALE_FILTER_LINE(fmt, bpp, channels) \
+void scale_filter_line_##fmt(struct scale_taps_s *col, struct scale_taps_s *row, \
+			     unsigned int y, unsigned char *src, unsigned int stride, \
+			     unsigned int width, short *tmp, unsigned char *dst) \
+{ \
+	scale_filter_line_bpp(bpp, channels, col, row, y, src, stride, width, tmp, dst); \
+}
+
+SCALE_FILTER_LINE(bgr, 3, 3)
+SCALE_FILTER_LINE(bgra, 4, 3)
+SCALE_FILTER_LINE(plane, 1, 1)
+
+#undef SCALE_FILTER_LINE
+
+scale_proc scale_simd(scale_t scale, struct scale_video_stream_s *video)
+{
+	glc_flags_t cpu = glc_cpu_features(scale->glc);
+
+#ifdef SCALE_X86
+	if (video->proc == &scale_rgb_half) {
+		if ((cpu & GLC_CPU_AVX2) && (video->bpp == 4))
+			return &scale_rgb_half_avx2;
+		if (cpu & GLC_CPU_SSSE3)
+			return &scale_rgb_half_ssse3;
+	} else if (video->proc == &scale_ycbcr_half) {
+		if (cpu & GLC_CPU_AVX2)
+			return &scale_ycbcr_half_avx2;
+		if (cpu & GLC_CPU_SSSE3)
+			return &scale_ycbcr_half_ssse3;
+	} else if (video->proc == &scale_rgb_convert) {
+		if (cpu & GLC_CPU_SSSE3)
+			return &scale_rgb_convert_ssse3;
+	}
+#endif
+
+#ifdef __ARM_NEON
+	if (cpu & GLC_CPU_NEON) {
+		if (video->proc == &scale_rgb_half)
+			return &scale_rgb_half_neon;
+		if (video->proc == &scale_ycbcr_half)
+			return &scale_ycbcr_half_neon;
+		if (video->proc == &scale_rgb_convert)
+			return &scale_rgb_convert_neon;
+	}
+#endif
+
+	/* C kernel instance for pixel size */
+	if (video->proc == &scale_rgb_half)
+		return (video->bpp == 4) ? &scale_rgb_half_bgra : &scale_rgb_half_bgr;
+
+	return video->proc;
+}
+
+/*
+ * Vector kernels below produce exactly the same output as the loops
+ * above, which also finish the last pixels of each row. Stores never
+ * go past the end of a row, since slice workers write neighbouring
+ * rows at the same time.
+ */
+
+#ifdef SCALE_X86
+
+/* 4 pixels on two rows -> sums of horizontal pairs, 2 pixels */
+__attribute__ ((target ("ssse3")))
+static inline __m128i scale_sum_ssse3(__m128i row1, __m128i row2)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo, hi;
+
+	lo = _mm_add_epi16(_mm_unpacklo_epi8(row1, zero), _mm_unpacklo_epi8(row2, zero));
+	hi = _mm_add_epi16(_mm_unpackhi_epi8(row1, zero), _mm_unpackhi_epi8(row2, zero));
+	return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+					    _mm_unpackhi_epi64(lo, hi)), 2);
+}
+
+__attribute__ ((target ("ssse3")))
+unsigned int scale_rgb_half_row_ssse3(struct scale_video_stream_s *video,
+				      unsigned char *row1, unsigned char *row2,
+				      unsigned char *dst, unsigned int x)
+{
+	/* BGR BGR BGR BGR -> BGR0 BGR0 BGR0 BGR0 */
+	const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+					     6, 7, 8, -1, 9, 10, 11, -1);
+	/* BGRx BGRx BGRx BGRx -> BGR BGR BGR BGR */
+	const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+					   10, 12, 13, 14, -1, -1, -1, -1);
+	__m128i a1, a2, b1, b2;
+
+	/* 4 pixels a round, 16 byte store */
+	for (; x + 6 <= video->sw; x += 4) {
+		if (video->bpp == 4) {
+			a1 = _mm_loadu_si128((__m128i *) &row1[x * 8]);
+			a2 = _mm_loadu_si128((__m128i *) &row2[x * 8]);
+			b1 = _mm_loadu_si128((__m128i *) &row1[x * 8 + 16]);
+			b2 = _mm_loadu_si128((__m128i *) &row2[x * 8 + 16]);
+		} else {
+			a1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) &row1[x * 6]), expand);
+			a2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) &row2[x * 6]), expand);
+			b1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) &row1[x * 6 + 12]), expand);
+			b2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) &row2[x * 6 + 12]), expand);
+		}
+
+		a1 = _mm_packus_epi16(scale_sum_ssse3(a1, a2), scale_sum_ssse3(b1, b2));
+		_mm_storeu_si128((__m128i *) &dst[x * 3], _mm_shuffle_epi8(a1, pack));
+	}
+
+	return x;
+}
+
+__attribute__ ((target ("ssse3")))
+void scale_rgb_half_ssse3(scale_t scale, struct scale_video_stream_s *video,
+			  chain_rows_t *from, chain_rows_t *to,
+			  unsigned int y, unsigned int rows)
+{
+	unsigned char *row1, *row2, *dst;
+	unsigned int x;
 
-	for (y = 0; y < ch; y++) {
-		for (x = 0; x < cw; x++) {
-			sp = video->sw * video->sh * 4 + (x + y * cw) * 4;
+	for (; rows > 0; rows--, y++) {
+		row1 = CHAIN_ROW(from, y * 2);
+		row2 = CHAIN_ROW(from, y * 2 + 1);
+		dst = CHAIN_ROW(to, y);
 
-			Cb_to[(x + video->rx / 2) + (y + video->ry / 2) * (video->rw / 2)] =
-				Cb_from[video->pos[sp + 0]] * video->factor[sp + 0] +
-				Cb_from[video->pos[sp + 1]] * video->factor[sp + 1] +
-				Cb_from[video->pos[sp + 2]] * video->factor[sp + 2] +
-				Cb_from[video->pos[sp + 3]] * video->factor[sp + 3];
+		x = scale_rgb_half_row_ssse3(video, row1, row2, dst, 0);
+		scale_rgb_half_row(video, row1, row2, dst, x);
+	}
+}
 
-			Cr_to[(x + video->rx / 2) + (y + video->ry / 2) * (video->rw / 2)] =
-				Cr_from[video->pos[sp + 0]] * video->factor[sp + 0] +
-				Cr_from[video->pos[sp + 1]] * video->factor[sp + 1] +
-				Cr_from[video->pos[sp + 2]] * video->factor[sp + 2] +
-				Cr_from[video->pos[sp + 3]] * video->factor[sp + 3];
+__attribute__ ((target ("avx2")))
+void scale_rgb_half_avx2(scale_t scale, struct scale_video_stream_s *video,
+			 chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+					      10, 12, 13, 14, -1, -1, -1, -1,
+					      0, 1, 2, 4, 5, 6, 8, 9,
+					      10, 12, 13, 14, -1, -1, -1, -1);
+	__m256i a1, a2, b1, b2, lo, hi;
+	unsigned char *row1, *row2, *dst;
+	unsigned int x;
+
+	/* only BGRA, BGR rows are left to SSSE3 */
+	for (; rows > 0; rows--, y++) {
+		row1 = CHAIN_ROW(from, y * 2);
+		row2 = CHAIN_ROW(from, y * 2 + 1);
+		dst = CHAIN_ROW(to, y);
+
+		/* 8 pixels a round, 12 + 16 byte stores */
+		for (x = 0; x + 10 <= video->sw; x += 8) {
+			a1 = _mm256_loadu_si256((__m256i *) &row1[x * 8]);
+			a2 = _mm256_loadu_si256((__m256i *) &row2[x * 8]);
+			b1 = _mm256_loadu_si256((__m256i *) &row1[x * 8 + 32]);
+			b2 = _mm256_loadu_si256((__m256i *) &row2[x * 8 + 32]);
+
+			lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero),
+					      _mm256_unpacklo_epi8(a2, zero));
+			hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero),
+					      _mm256_unpackhi_epi8(a2, zero));
+			a1 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi),
+								_mm256_unpackhi_epi64(lo, hi)), 2);
+
+			lo = _mm256_add_epi16(_mm256_unpacklo_epi8(b1, zero),
+					      _mm256_unpacklo_epi8(b2, zero));
+			hi = _mm256_add_epi16(_mm256_unpackhi_epi8(b1, zero),
+					      _mm256_unpackhi_epi8(b2, zero));
+			b1 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi),
+								_mm256_unpackhi_epi64(lo, hi)), 2);
+
+			/* packing works within lanes, put pixels back in order */
+			a1 = _mm256_permute4x64_epi64(_mm256_packus_epi16(a1, b1), 0xd8);
+			a1 = _mm256_shuffle_epi8(a1, pack);
+
+			_mm_storeu_si128((__m128i *) &dst[x * 3], _mm256_castsi256_si128(a1));
+			_mm_storeu_si128((__m128i *) &dst[x * 3 + 12], _mm256_extracti128_si256(a1, 1));
 		}
+
+		x = scale_rgb_half_row_ssse3(video, row1, row2, dst, x);
+		scale_rgb_half_row(video, row1, row2, dst, x);
+	}
+}
+
+__attribute__ ((target ("ssse3")))
+unsigned int scale_half_row_ssse3(unsigned char *row1, unsigned char *row2,
+				  unsigned char *dst, unsigned int x, unsigned int w,
+				  int chroma)
+{
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i weight = chroma ? _mm_set1_epi16(0x0200) : one;
+	__m128i a, b;
+
+	for (; x + 16 <= w; x += 16) {
+		a = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128((__m128i *) &row1[x * 2]), one),
+				  _mm_maddubs_epi16(_mm_loadu_si128((__m128i *) &row2[x * 2]), weight));
+		b = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128((__m128i *) &row1[x * 2 + 16]), one),
+				  _mm_maddubs_epi16(_mm_loadu_si128((__m128i *) &row2[x * 2 + 16]), weight));
+		_mm_storeu_si128((__m128i *) &dst[x],
+				 _mm_packus_epi16(_mm_srli_epi16(a, 2), _mm_srli_epi16(b, 2)));
 	}
+
+	return x;
 }
 
+__attribute__ ((target ("avx2")))
+unsigned int scale_half_row_avx2(unsigned char *row1, unsigned char *row2,
+				 unsigned char *dst, unsigned int x, unsigned int w,
+				 int chroma)
+{
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i weight = chroma ? _mm256_set1_epi16(0x0200) : one;
+	__m256i a, b;
+
+	for (; x + 32 <= w; x += 32) {
+		a = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256((__m256i *) &row1[x * 2]), one),
+				     _mm256_maddubs_epi16(_mm256_loadu_si256((__m256i *) &row2[x * 2]), weight));
+		b = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256((__m256i *) &row1[x * 2 + 32]), one),
+				     _mm256_maddubs_epi16(_mm256_loadu_si256((__m256i *) &row2[x * 2 + 32]), weight));
+		a = _mm256_packus_epi16(_mm256_srli_epi16(a, 2), _mm256_srli_epi16(b, 2));
+		_mm256_storeu_si256((__m256i *) &dst[x], _mm256_permute4x64_epi64(a, 0xd8));
+	}
+
+	return scale_half_row_ssse3(row1, row2, dst, x, w, chroma);
+}
+
+__attribute__ ((target ("ssse3")))
+void scale_ycbcr_half_ssse3(scale_t scale, struct scale_video_stream_s *video,
+			    chain_rows_t *from, chain_rows_t *to,
+			    unsigned int y, unsigned int rows)
+{
+	unsigned int x, c, cw_from, cw_to;
+	unsigned char *row1, *row2, *dst;
+
+	cw_from = video->w / 2;
+	cw_to = video->sw / 2;
+
+	for (c = y / 2; c < (y + rows) / 2; c++) {
+		row1 = CHAIN_CB_ROW(from, c * 2);
+		dst = CHAIN_CB_ROW(to, c);
+		x = scale_half_row_ssse3(row1, &row1[cw_from], dst, 0, cw_to, 1);
+		scale_half_chroma_row(row1, &row1[cw_from], dst, x, cw_to);
+
+		row1 = CHAIN_CR_ROW(from, c * 2);
+		dst = CHAIN_CR_ROW(to, c);
+		x = scale_half_row_ssse3(row1, &row1[cw_from], dst, 0, cw_to, 1);
+		scale_half_chroma_row(row1, &row1[cw_from], dst, x, cw_to);
+	}
+
+	for (; rows > 0; rows--, y++) {
+		row1 = CHAIN_ROW(from, y * 2);
+		row2 = CHAIN_ROW(from, y * 2 + 1);
+		dst = CHAIN_ROW(to, y);
+		x = scale_half_row_ssse3(row1, row2, dst, 0, video->sw, 0);
+		scale_half_row(row1, row2, dst, x, video->sw);
+	}
+}
+
+__attribute__ ((target ("avx2")))
+void scale_ycbcr_half_avx2(scale_t scale, struct scale_video_stream_s *video,
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows)
+{
+	unsigned int x, c, cw_from, cw_to;
+	unsigned char *row1, *row2, *dst;
+
+	cw_from = video->w / 2;
+	cw_to = video->sw / 2;
+
+	for (c = y / 2; c < (y + rows) / 2; c++) {
+		row1 = CHAIN_CB_ROW(from, c * 2);
+		dst = CHAIN_CB_ROW(to, c);
+		x = scale_half_row_avx2(row1, &row1[cw_from], dst, 0, cw_to, 1);
+		scale_half_chroma_row(row1, &row1[cw_from], dst, x, cw_to);
+
+		row1 = CHAIN_CR_ROW(from, c * 2);
+		dst = CHAIN_CR_ROW(to, c);
+		x = scale_half_row_avx2(row1, &row1[cw_from], dst, 0, cw_to, 1);
+		scale_half_chroma_row(row1, &row1[cw_from], dst, x, cw_to);
+	}
+
+	for (; rows > 0; rows--, y++) {
+		row1 = CHAIN_ROW(from, y * 2);
+		row2 = CHAIN_ROW(from, y * 2 + 1);
+		dst = CHAIN_ROW(to, y);
+		x = scale_half_row_avx2(row1, row2, dst, 0, video->sw, 0);
+		scale_half_row(row1, row2, dst, x, video->sw);
+	}
+}
+
+__attribute__ ((target ("ssse3")))
+void scale_rgb_convert_ssse3(scale_t scale, struct scale_video_stream_s *video,
+			     chain_rows_t *from, chain_rows_t *to,
+			     unsigned int y, unsigned int rows)
+{
+	const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+					   10, 12, 13, 14, -1, -1, -1, -1);
+	unsigned int x;
+	unsigned char *src, *dst;
+
+	for (; rows > 0; rows--, y++) {
+		src = CHAIN_ROW(from, y);
+		dst = CHAIN_ROW(to, y);
+
+		for (x = 0; x + 6 <= video->sw; x += 4)
+			_mm_storeu_si128((__m128i *) &dst[x * 3],
+					 _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) &src[x * 4]), pack));
+
+		for (; x < video->sw; x++) {
+			dst[x * 3 + 0] = src[x * 4 + 0];
+			dst[x * 3 + 1] = src[x * 4 + 1];
+			dst[x * 3 + 2] = src[x * 4 + 2];
+		}
+	}
+}
+
+
+#endif /* SCALE_X86 */
+
+#ifdef __ARM_NEON
+
+void scale_rgb_half_neon(scale_t scale, struct scale_video_stream_s *video,
+			 chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows)
+{
+	unsigned char *row1, *row2, *dst;
+	uint8x16x4_t a4, b4;
+	uint8x16x3_t a3, b3;
+	uint8x8x3_t out;
+	unsigned int x, c;
+
+	for (; rows > 0; rows--, y++) {
+		row1 = CHAIN_ROW(from, y * 2);
+		row2 = CHAIN_ROW(from, y * 2 + 1);
+		dst = CHAIN_ROW(to, y);
+
+		/* 8 pixels a round, channels deinterleaved by loads */
+		for (x = 0; x + 8 <= video->sw; x += 8) {
+			if (video->bpp == 4) {
+				a4 = vld4q_u8(&row1[x * 8]);
+				b4 = vld4q_u8(&row2[x * 8]);
+				for (c = 0; c < 3; c++)
+					out.val[c] = vshrn_n_u16(vpadalq_u8(vpaddlq_u8(a4.val[c]),
+									    b4.val[c]), 2);
+			} else {
+				a3 = vld3q_u8(&row1[x * 6]);
+				b3 = vld3q_u8(&row2[x * 6]);
+				for (c = 0; c < 3; c++)
+					out.val[c] = vshrn_n_u16(vpadalq_u8(vpaddlq_u8(a3.val[c]),
+									    b3.val[c]), 2);
+			}
+			vst3_u8(&dst[x * 3], out);
+		}
+
+		scale_rgb_half_row(video, row1, row2, dst, x);
+	}
+}
+
+unsigned int scale_half_row_neon(unsigned char *row1, unsigned char *row2,
+				 unsigned char *dst, unsigned int x, unsigned int w,
+				 int chroma)
+{
+	uint16x8_t sum;
+
+	for (; x + 8 <= w; x += 8) {
+		sum = vpaddlq_u8(vld1q_u8(&row1[x * 2]));
+		if (chroma)
+			sum = vaddq_u16(sum, vshll_n_u8(vld2_u8(&row2[x * 2]).val[1], 1));
+		else
+			sum = vpadalq_u8(sum, vld1q_u8(&row2[x * 2]));
+		vst1_u8(&dst[x], vshrn_n_u16(sum, 2));
+	}
+
+	return x;
+}
+
+void scale_ycbcr_half_neon(scale_t scale, struct scale_video_stream_s *video,
+			   chain_rows_t *from, chain_rows_t *to,
+			   unsigned int y, unsigned int rows)
+{
+	unsigned int x, c, cw_from, cw_to;
+	unsigned char *row1, *row2, *dst;
+
+	cw_from = video->w / 2;
+	cw_to = video->sw / 2;
+
+	for (c = y / 2; c < (y + rows) / 2; c++) {
+		row1 = CHAIN_CB_ROW(from, c * 2);
+		dst = CHAIN_CB_ROW(to, c);
+		x = scale_half_row_neon(row1, &row1[cw_from], dst, 0, cw_to, 1);
+		scale_half_chroma_row(row1, &row1[cw_from], dst, x, cw_to);
+
+		row1 = CHAIN_CR_ROW(from, c * 2);
+		dst = CHAIN_CR_ROW(to, c);
+		x = scale_half_row_neon(row1, &row1[cw_from], dst, 0, cw_to, 1);
+		scale_half_chroma_row(row1, &row1[cw_from], dst, x, cw_to);
+	}
+
+	for (; rows > 0; rows--, y++) {
+		row1 = CHAIN_ROW(from, y * 2);
+		row2 = CHAIN_ROW(from, y * 2 + 1);
+		dst = CHAIN_ROW(to, y);
+		x = scale_half_row_neon(row1, row2, dst, 0, video->sw, 0);
+		scale_half_row(row1, row2, dst, x, video->sw);
+	}
+}
+
+void scale_rgb_convert_neon(scale_t scale, struct scale_video_stream_s *video,
+			    chain_rows_t *from, chain_rows_t *to,
+			    unsigned int y, unsigned int rows)
+{
+	unsigned int x;
+	unsigned char *src, *dst;
+	uint8x16x4_t in;
+	uint8x16x3_t out;
+
+	for (; rows > 0; rows--, y++) {
+		src = CHAIN_ROW(from, y);
+		dst = CHAIN_ROW(to, y);
+
+		for (x = 0; x + 16 <= video->sw; x += 16) {
+			in = vld4q_u8(&src[x * 4]);
+			out.val[0] = in.val[0];
+			out.val[1] = in.val[1];
+			out.val[2] = in.val[2];
+			vst3q_u8(&dst[x * 3], out);
+		}
+
+		for (; x < video->sw; x++) {
+			dst[x * 3 + 0] = src[x * 4 + 0];
+			dst[x * 3 + 1] = src[x * 4 + 1];
+			dst[x * 3 + 2] = src[x * 4 + 2];
+		}
+	}
+}
+
+#endif /* __ARM_NEON */
+
 int scale_video_format_message(scale_t scale,
 			       glc_video_format_message_t *format_message,
 			       glc_thread_state_t *state)
 {
 	struct scale_video_stream_s *video;
 	glc_flags_t old_flags;
+	int ret;
 
-	scale_get_video_stream(scale, format_message->id, &video);
+	if ((ret = scale_get_video_stream(scale, format_message->id, &video)))
+		return ret;
 	pthread_rwlock_wrlock(&video->update);
 
 	old_flags = video->flags;
@@ -498,6 +1308,9 @@ int scale_video_format_message(scale_t scale,
 			if (video->row % 8 != 0)
 				video->row += 8 - video->row % 8;
 		}
+
+		video->line = (video->bpp == 4) ? &scale_filter_line_bgra
+						: &scale_filter_line_bgr;
 	}
 
 	video->proc = NULL; /* do not try anything stupid... */
@@ -519,7 +1332,11 @@ int scale_video_format_message(scale_t scale,
 				 "scaling RGB data with factor %f (from %ux%u to %ux%u)",
 				 video->scale, video->w, video->h, video->sw, video->sh);
 			video->proc = scale_rgb_scale;
-			scale_generate_rgb_map(scale, video);
+			if (scale_generate_map(scale, video)) {
+				glc_log(scale->glc, GLC_ERROR, "scale",
+					 "can't generate scale map for video stream %d", video->id);
+				video->proc = NULL;
+			}
 		}
 
 		format_message->format = GLC_VIDEO_BGR; /* after scaling data is in BGR */
@@ -554,7 +1371,11 @@ int scale_video_format_message(scale_t scale,
 				 "scaling Y'CbCr data with factor %f (from %ux%u to %ux%u)",
 				 video->scale, video->w, video->h, video->sw, video->sh);
 			video->proc = scale_ycbcr_scale;
-			scale_generate_ycbcr_map(scale, video);
+			if (scale_generate_map(scale, video)) {
+				glc_log(scale->glc, GLC_ERROR, "scale",
+					 "can't generate scale map for video stream %d", video->id);
+				video->proc = NULL;
+			}
 		}
 
 		if ((scale->flags & SCALE_SIZE) && (video->created) &&
@@ -563,166 +1384,141 @@ int scale_video_format_message(scale_t scale,
 		video->created = 1;
 	}
 
+	video->kernel = video->proc ? scale_simd(scale, video) : NULL;
+
 	state->flags |= GLC_THREAD_COPY;
 
 	pthread_rwlock_unlock(&video->update);
 	return 0;
 }
 
-int scale_generate_rgb_map(scale_t scale, struct scale_video_stream_s *video)
+float scale_taps_kernel(int interpolation, float x)
 {
-	float ofx, ofy, fx0, fx1, fy0, fy1;
-	unsigned int tp, x, y, r;
-	float d;
-	size_t smap_size = video->sw * video->sh * 3 * 4;
+	x = fabsf(x);
+
+	if (interpolation == SCALE_BICUBIC) {
+		/* Keys, a = -0.5 */
+		if (x < 1.0)
+			return (1.5 * x - 2.5) * x * x + 1.0;
+		else if (x < 2.0)
+			return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+		return 0.0;
+	} else if (interpolation == SCALE_LANCZOS) {
+		if (x == 0.0)
+			return 1.0;
+		else if (x >= 3.0)
+			return 0.0;
+		return 3.0 * sinf(M_PI * x) * sinf(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+	}
 
-	glc_log(scale->glc, GLC_DEBUG, "scale", "generating %zd + %zd byte scale map for video stream %d",
-		 smap_size * sizeof(unsigned int), smap_size * sizeof(float), video->id);
+	return (x < 1.0) ? (1.0 - x) : 0.0;
+}
 
-	if (video->pos)
-		video->pos = (unsigned int *) realloc(video->pos, sizeof(unsigned int) * smap_size);
-	else
-		video->pos = (unsigned int *) malloc(sizeof(unsigned int) * smap_size);
-	if (video->factor)
-		video->factor = (float *) realloc(video->factor, sizeof(float) * smap_size);
+int scale_generate_taps(scale_t scale, struct scale_taps_s *taps,
+			unsigned int from, unsigned int to)
+{
+	float ratio, stretch, support, center, sum, k, weight[SCALE_MAX_TAPS];
+	unsigned int x, t, taps_max, max;
+	int left, start, i, total;
+	short *w;
+
+	ratio = (float) from / (float) to;
+	/* when making pictures smaller, filter covers more source samples */
+	stretch = (ratio > 1.0) ? ratio : 1.0;
+
+	if (scale->interpolation == SCALE_BICUBIC)
+		support = 2.0;
+	else if (scale->interpolation == SCALE_LANCZOS)
+		support = 3.0;
 	else
-		video->factor = (float *) malloc(sizeof(float) * smap_size);
-
-	r = 0;
-	do {
-		d = (float) (video->w - r++) / (float) video->sw;
-		glc_log(scale->glc, GLC_DEBUG, "scale", "d = %f", d);
-	} while ((d * (float) (video->sh - 1) + 1.0 > video->h) |
-		 (d * (float) (video->sw - 1) + 1.0 > video->w));
-
-	ofx = ofy = 0;
-	for (y = 0; y < video->sh; y++) {
-		for (x = 0; x < video->sw; x++) {
-			tp = (x + y * video->sw) * 4;
-
-			video->pos[tp + 0] = ((unsigned int) ofx + 0) * video->bpp +
-					   ((unsigned int) ofy + 0) * video->row;
-			video->pos[tp + 1] = ((unsigned int) ofx + 1) * video->bpp +
-					   ((unsigned int) ofy + 0) * video->row;
-			video->pos[tp + 2] = ((unsigned int) ofx + 0) * video->bpp +
-					   ((unsigned int) ofy + 1) * video->row;
-			video->pos[tp + 3] = ((unsigned int) ofx + 1) * video->bpp +
-					   ((unsigned int) ofy + 1) * video->row;
-
-			fx1 = (float) x * d - (float) ((unsigned int) ofx);
-			fx0 = 1.0 - fx1;
-			fy1 = (float) y * d - (float) ((unsigned int) ofy);
-			fy0 = 1.0 - fy1;
-
-			video->factor[tp + 0] = fx0 * fy0;
-			video->factor[tp + 1] = fx1 * fy0;
-			video->factor[tp + 2] = fx0 * fy1;
-			video->factor[tp + 3] = fx1 * fy1;
-
-			ofx += d;
+		support = 1.0;
+
+	if (2.0 * support * stretch > SCALE_MAX_TAPS) {
+		/* very small pictures, just lose some quality */
+		stretch = SCALE_MAX_TAPS / (2.0 * support);
+	}
+	support *= stretch;
+
+	taps_max = (unsigned int) ceilf(2.0 * support);
+	if (taps_max > from)
+		taps_max = from;
+
+	scale_free_taps(taps);
+	taps->size = to;
+	taps->taps = taps_max;
+	if (!(taps->start = malloc(sizeof(unsigned int) * to)))
+		return ENOMEM;
+	if (!(taps->weight = malloc(sizeof(short) * to * taps_max))) {
+		scale_free_taps(taps);
+		return ENOMEM;
+	}
+
+	for (x = 0; x < to; x++) {
+		center = ((float) x + 0.5) * ratio - 0.5;
+		left = (int) floorf(center - support) + 1;
+
+		/* keep window inside picture, edge samples repeat */
+		start = left;
+		if (start + (int) taps_max > (int) from)
+			start = from - taps_max;
+		if (start < 0)
+			start = 0;
+
+		for (t = 0; t < taps_max; t++)
+			weight[t] = 0.0;
+
+		sum = 0.0;
+		for (i = left; i < left + (int) taps_max; i++) {
+			t = ((i < 0) ? 0 : ((i >= (int) from) ? from - 1 : i)) - start;
+			k = scale_taps_kernel(scale->interpolation, ((float) i - center) / stretch);
+			weight[t] += k;
+			sum += k;
 		}
-		ofy += d;
-		ofx = 0;
+
+		/* fixed point, rounding error goes to the largest tap */
+		taps->start[x] = start;
+		w = &taps->weight[x * taps_max];
+		total = max = 0;
+		for (t = 0; t < taps_max; t++) {
+			w[t] = (short) lrintf(weight[t] / sum * (float) (1 << SCALE_BITS));
+			total += w[t];
+			if (w[t] > w[max])
+				max = t;
+		}
+		w[max] += (1 << SCALE_BITS) - total;
 	}
 
 	return 0;
 }
 
-int scale_generate_ycbcr_map(scale_t scale, struct scale_video_stream_s *video)
+void scale_free_taps(struct scale_taps_s *taps)
 {
-	float ofx, ofy, fx0, fx1, fy0, fy1;
-	unsigned int tp, x, y, r, cw, ch;
-	float d;
-	size_t smap_size = video->sw * video->sh * 5; /* yw*yh*4 + (ch*cw)*4, ch = yh/2, cw = yw/2 */
+	if (taps->start)
+		free(taps->start);
+	if (taps->weight)
+		free(taps->weight);
+	memset(taps, 0, sizeof(struct scale_taps_s));
+}
 
-	glc_log(scale->glc, GLC_DEBUG, "scale", "generating %zd B + %zd B scale map for video stream %d",
-		 smap_size * sizeof(unsigned int), smap_size * sizeof(float), video->id);
+int scale_generate_map(scale_t scale, struct scale_video_stream_s *video)
+{
+	int ret;
 
-	if (video->pos)
-		video->pos = (unsigned int *) realloc(video->pos, sizeof(unsigned int) * smap_size);
-	else
-		video->pos = (unsigned int *) malloc(sizeof(unsigned int) * smap_size);
-	if (video->factor)
-		video->factor = (float *) realloc(video->factor, sizeof(float) * smap_size);
-	else
-		video->factor = (float *) malloc(sizeof(float) * smap_size);
-
-	r = 0;
-	do {
-		d = (float) (video->w - r++) / (float) video->sw;
-		glc_log(scale->glc, GLC_DEBUG, "scale", "Y: d = %f", d);
-	} while ((d * (float) (video->sh - 1) + 1.0 > video->h) |
-		 (d * (float) (video->sw - 1) + 1.0 > video->w));
-
-	ofx = ofy = 0;
-	for (y = 0; y < video->sh; y++) {
-		for (x = 0; x < video->sw; x++) {
-			tp = (x + y * video->sw) * 4;
-
-			video->pos[tp + 0] = ((unsigned int) ofx + 0) +
-					   ((unsigned int) ofy + 0) * video->w;
-			video->pos[tp + 1] = ((unsigned int) ofx + 1) +
-					   ((unsigned int) ofy + 0) * video->w;
-			video->pos[tp + 2] = ((unsigned int) ofx + 0) +
-					   ((unsigned int) ofy + 1) * video->w;
-			video->pos[tp + 3] = ((unsigned int) ofx + 1) +
-					   ((unsigned int) ofy + 1) * video->w;
-
-			fx1 = (float) x * d - (float) ((unsigned int) ofx);
-			fx0 = 1.0 - fx1;
-			fy1 = (float) y * d - (float) ((unsigned int) ofy);
-			fy0 = 1.0 - fy1;
-
-			video->factor[tp + 0] = fx0 * fy0;
-			video->factor[tp + 1] = fx1 * fy0;
-			video->factor[tp + 2] = fx0 * fy1;
-			video->factor[tp + 3] = fx1 * fy1;
-
-			ofx += d;
-		}
-		ofy += d;
-		ofx = 0;
-	}
+	if ((ret = scale_generate_taps(scale, &video->col, video->w, video->sw)))
+		return ret;
+	if ((ret = scale_generate_taps(scale, &video->row_taps, video->h, video->sh)))
+		return ret;
 
-	cw = video->sw / 2;
-	ch = video->sh / 2;
-	r = (r < 2) ? (0) : (r - 2);
-	do {
-		d = (float) ((video->w / 2) - r++) / (float) cw;
-		glc_log(scale->glc, GLC_DEBUG, "scale", "C: d = %f", d);
-	} while ((d * (float) (ch - 1) + 1.0 > (video->h / 2)) |
-		 (d * (float) (cw - 1) + 1.0 > (video->w / 2)));
-
-	ofx = ofy = 0;
-	for (y = 0; y < ch; y++) {
-		for (x = 0; x < cw; x++) {
-			tp = video->sw * video->sh * 4 + (x + y * cw) * 4;
-
-			video->pos[tp + 0] = ((unsigned int) ofx + 0) +
-					   ((unsigned int) ofy + 0) * (video->w / 2);
-			video->pos[tp + 1] = ((unsigned int) ofx + 1) +
-					   ((unsigned int) ofy + 0) * (video->w / 2);
-			video->pos[tp + 2] = ((unsigned int) ofx + 0) +
-					   ((unsigned int) ofy + 1) * (video->w / 2);
-			video->pos[tp + 3] = ((unsigned int) ofx + 1) +
-					   ((unsigned int) ofy + 1) * (video->w / 2);
-
-			fx1 = (float) x * d - (float) ((unsigned int) ofx);
-			fx0 = 1.0 - fx1;
-			fy1 = (float) y * d - (float) ((unsigned int) ofy);
-			fy0 = 1.0 - fy1;
-
-			video->factor[tp + 0] = fx0 * fy0;
-			video->factor[tp + 1] = fx1 * fy0;
-			video->factor[tp + 2] = fx0 * fy1;
-			video->factor[tp + 3] = fx1 * fy1;
-
-			ofx += d;
-		}
-		ofy += d;
-		ofx = 0;
+	if (video->format == GLC_VIDEO_YCBCR_420JPEG) {
+		if ((ret = scale_generate_taps(scale, &video->chroma_col, video->w / 2, video->sw / 2)))
+			return ret;
+		if ((ret = scale_generate_taps(scale, &video->chroma_row, video->h / 2, video->sh / 2)))
+			return ret;
 	}
 
+	glc_log(scale->glc, GLC_DEBUG, "scale",
+		 "%d and %d taps per pixel for video stream %d",
+		 video->col.taps, video->row_taps.taps, video->id);
 	return 0;
 }
 
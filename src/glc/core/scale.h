@@ -18,6 +18,7 @@
 
 #include <packetstream.h>
 #include <glc/common/glc.h>
+#include <glc/core/chain.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -60,6 +61,27 @@ __PUBLIC int scale_set_scale(scale_t scale, double factor);
 __PUBLIC int scale_set_size(scale_t scale, unsigned int width,
 			    unsigned int height);
 
+/** linear interpolation, cheapest */
+#define SCALE_BILINEAR                 0
+/** cubic interpolation, sharper */
+#define SCALE_BICUBIC                  1
+/** 3-lobed Lanczos, sharpest and slowest */
+#define SCALE_LANCZOS                  2
+
+/**
+ * \brief set interpolation
+ *
+ * Pictures are scaled first vertically and then horizontally
+ * with fixed point filters. When making pictures smaller the
+ * filters are widened, so every source pixel contributes.
+ * Half-size scaling always averages 2x2 blocks. Default is
+ * SCALE_BILINEAR.
+ * \param scale scale object
+ * \param interpolation SCALE_BILINEAR, SCALE_BICUBIC or SCALE_LANCZOS
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int scale_set_interpolation(scale_t scale, int interpolation);
+
 /**
  * \brief process data
  *
@@ -80,6 +102,16 @@ __PUBLIC int scale_process_start(scale_t scale, ps_buffer_t *from,
  */
 __PUBLIC int scale_process_wait(scale_t scale);
 
+/**
+ * \brief get scale filter for chain
+ *
+ * scale must not be started on its own if it is used in a chain.
+ * \param scale scale object
+ * \param filter filter vtable is written here
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int scale_filter(scale_t scale, chain_filter_t *filter);
+
 /**
  * \brief destroy scale object
  * \param scale scale object
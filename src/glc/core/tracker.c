@@ -18,6 +18,7 @@
 
 #include <glc/common/glc.h>
 #include <glc/common/log.h>
+#include <glc/common/registry.h>
 
 #include "tracker.h"
 
@@ -25,120 +26,90 @@
 #define TRACKER_VIDEO_COLOR       0x02
 
 struct tracker_video_s {
-	glc_stream_id_t id;
 	glc_flags_t flags;
 	glc_video_format_message_t format;
 	glc_color_message_t color;
-	struct tracker_video_s *next;
 };
 
 #define TRACKER_AUDIO_FORMAT      0x01
 
 struct tracker_audio_s {
-	glc_stream_id_t id;
 	glc_flags_t flags;
 	glc_audio_format_message_t format;
-	struct tracker_audio_s *next;
 };
 
 struct tracker_s {
 	glc_t *glc;
 
-	struct tracker_video_s *video_streams;
-	struct tracker_audio_s *audio_streams;
+	glc_registry_t video_streams;
+	glc_registry_t audio_streams;
 };
 
-struct tracker_video_s *tracker_get_video_stream(tracker_t tracker, glc_stream_id_t id);
-struct tracker_audio_s *tracker_get_audio_stream(tracker_t tracker, glc_stream_id_t id);
+struct tracker_iterate_s {
+	tracker_callback_t callback;
+	void *arg;
+};
+
+int tracker_iterate_video(void *entry, glc_stream_id_t id, void *arg);
+int tracker_iterate_audio(void *entry, glc_stream_id_t id, void *arg);
 
 int tracker_init(tracker_t *tracker, glc_t *glc)
 {
+	int ret;
+
 	*tracker = (tracker_t) malloc(sizeof(struct tracker_s));
 	memset(*tracker, 0, sizeof(struct tracker_s));
 
+	(*tracker)->glc = glc;
+	if ((ret = glc_registry_init(&(*tracker)->video_streams, sizeof(struct tracker_video_s),
+				     NULL, NULL, NULL)))
+		goto err;
+	if ((ret = glc_registry_init(&(*tracker)->audio_streams, sizeof(struct tracker_audio_s),
+				     NULL, NULL, NULL))) {
+		glc_registry_destroy((*tracker)->video_streams);
+		goto err;
+	}
+
 	return 0;
+err:
+	free(*tracker);
+	return ret;
 }
 
 int tracker_destroy(tracker_t tracker)
 {
-	struct tracker_video_s *video_del;
-	struct tracker_audio_s *audio_del;
-
-	while (tracker->video_streams != NULL) {
-		video_del = tracker->video_streams;
-		tracker->video_streams = tracker->video_streams->next;
-		free(video_del);
-	}
-
-	while (tracker->audio_streams != NULL) {
-		audio_del = tracker->audio_streams;
-		tracker->audio_streams = tracker->audio_streams->next;
-		free(audio_del);
-	}
-
+	glc_registry_destroy(tracker->video_streams);
+	glc_registry_destroy(tracker->audio_streams);
 	free(tracker);
 	return 0;
 }
 
-struct tracker_video_s *tracker_get_video_stream(tracker_t tracker, glc_stream_id_t id)
-{
-	struct tracker_video_s *video = tracker->video_streams;
-
-	while (video != NULL) {
-		if (video->id == id)
-			break;
-		video = video->next;
-	}
-
-	if (video == NULL) {
-		video = malloc(sizeof(struct tracker_video_s));
-		memset(video, 0, sizeof(struct tracker_video_s));
-
-		video->next = tracker->video_streams;
-		tracker->video_streams = video;
-	}
-
-	return video;
-}
-
-struct tracker_audio_s *tracker_get_audio_stream(tracker_t tracker, glc_stream_id_t id)
-{
-	struct tracker_audio_s *audio = tracker->audio_streams;
-
-	while (audio != NULL) {
-		if (audio->id == id)
-			break;
-		audio = audio->next;
-	}
-
-	if (audio == NULL) {
-		audio = malloc(sizeof(struct tracker_audio_s));
-		memset(audio, 0, sizeof(struct tracker_audio_s));
-
-		audio->next = tracker->audio_streams;
-		tracker->audio_streams = audio;
-	}
-
-	return audio;
-}
-
-
 int tracker_submit(tracker_t tracker, glc_message_header_t *header,
 		   void *message, size_t message_size)
 {
 	struct tracker_video_s *video;
 	struct tracker_audio_s *audio;
+	int ret;
 
 	if (header->type == GLC_MESSAGE_VIDEO_FORMAT) {
-		video = tracker_get_video_stream(tracker, ((glc_video_format_message_t *) message)->id);
+		if ((ret = glc_registry_get(tracker->video_streams,
+					    ((glc_video_format_message_t *) message)->id,
+					    (void **) &video)))
+			return ret;
 		memcpy(&video->format, message, sizeof(glc_video_format_message_t));
 		video->flags |= TRACKER_VIDEO_FORMAT;
 	} else if (header->type == GLC_MESSAGE_AUDIO_FORMAT) {
-		audio = tracker_get_audio_stream(tracker, ((glc_audio_format_message_t *) message)->id);
+		if ((ret = glc_registry_get(tracker->audio_streams,
+					    ((glc_audio_format_message_t *) message)->id,
+					    (void **) &audio)))
+			return ret;
 		memcpy(&audio->format, message, sizeof(glc_audio_format_message_t));
 		audio->flags |= TRACKER_AUDIO_FORMAT;
 	} else if (header->type == GLC_MESSAGE_COLOR) {
-		video = tracker_get_video_stream(tracker, ((glc_color_message_t *) message)->id);
+		if ((ret = glc_registry_get(tracker->video_streams,
+					    ((glc_color_message_t *) message)->id,
+					    (void **) &video)))
+			return ret;
 		memcpy(&video->color, message, sizeof(glc_color_message_t));
 		video->flags |= TRACKER_VIDEO_COLOR;
 	}
@@ -149,37 +120,54 @@ int tracker_submit(tracker_t tracker, glc_message_header_t *header,
 int tracker_iterate_state(tracker_t tracker, tracker_callback_t callback,
 			  void *arg)
 {
-	int ret = 0;
-	struct tracker_video_s *video = tracker->video_streams;
-	struct tracker_audio_s *audio = tracker->audio_streams;
-	glc_message_header_t header;
+	struct tracker_iterate_s iterate;
+	int ret;
+
+	iterate.callback = callback;
+	iterate.arg = arg;
+
+	if ((ret = glc_registry_iterate(tracker->video_streams,
+					&tracker_iterate_video, &iterate)))
+		return ret;
+	return glc_registry_iterate(tracker->audio_streams,
+				    &tracker_iterate_audio, &iterate);
+}
 
-	while (video != NULL) {
-		if (video->flags & TRACKER_VIDEO_FORMAT) {
-			header.type = GLC_MESSAGE_VIDEO_FORMAT;
-			if ((ret = callback(&header, &video->format, sizeof(glc_video_format_message_t), arg)))
-				goto finish;
-		}
+int tracker_iterate_video(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct tracker_video_s *video = entry;
+	struct tracker_iterate_s *iterate = arg;
+	glc_message_header_t header;
+	int ret;
 
-		if (video->flags & TRACKER_VIDEO_COLOR) {
-			header.type = GLC_MESSAGE_COLOR;
-			if ((ret = callback(&header, &video->color, sizeof(glc_color_message_t), arg)))
-				goto finish;
-		}
+	if (video->flags & TRACKER_VIDEO_FORMAT) {
+		header.type = GLC_MESSAGE_VIDEO_FORMAT;
+		if ((ret = iterate->callback(&header, &video->format,
+					     sizeof(glc_video_format_message_t), iterate->arg)))
+			return ret;
+	}
 
-		video = video->next;
+	if (video->flags & TRACKER_VIDEO_COLOR) {
+		header.type = GLC_MESSAGE_COLOR;
+		if ((ret = iterate->callback(&header, &video->color,
+					     sizeof(glc_color_message_t), iterate->arg)))
+			return ret;
 	}
 
-	while (audio != NULL) {
-		if (audio->flags & TRACKER_AUDIO_FORMAT) {
-			header.type = GLC_MESSAGE_AUDIO_FORMAT;
-			if ((ret = callback(&header, &audio->format, sizeof(glc_audio_format_message_t), arg)))
-				goto finish;
-		}
+	return 0;
+}
 
-		audio = audio->next;
+int tracker_iterate_audio(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct tracker_audio_s *audio = entry;
+	struct tracker_iterate_s *iterate = arg;
+	glc_message_header_t header;
+
+	if (audio->flags & TRACKER_AUDIO_FORMAT) {
+		header.type = GLC_MESSAGE_AUDIO_FORMAT;
+		return iterate->callback(&header, &audio->format,
+					 sizeof(glc_audio_format_message_t), iterate->arg);
 	}
 
-finish:
-	return ret;
+	return 0;
 }
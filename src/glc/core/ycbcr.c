@@ -19,11 +19,21 @@
 #include <pthread.h>
 #include <errno.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define YCBCR_X86
+#endif
+#ifdef __ARM_NEON
+# include <arm_neon.h>
+#endif
+
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/thread.h>
 #include <glc/common/util.h>
+#include <glc/common/slice.h>
+#include <glc/common/registry.h>
 
 #include "ycbcr.h"
 
@@ -47,10 +57,13 @@ Y', Cb, Cr      in {0, 1, 2, ..., 255}
 	(128 + 0.5      * (Rd) - 0.418688 * (Gd) - 0.081312 * (Bd))
 */
 
+#define YCBCR_CLAMP(v) ((v) > 255 ? 255 : (v))
+
 #define RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd) \
 	(    + ((306 * (Rd) + 601 * (Gd) + 117 * (Bd)) >> 10))
+/* pure blue would give 256 */
 #define RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd) \
-	(128 - ((173 * (Rd) + 339 * (Gd) - 512 * (Bd)) >> 10))
+	YCBCR_CLAMP(128 - ((173 * (Rd) + 339 * (Gd) - 512 * (Bd)) >> 10))
 #define RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd) \
 	(128 + ((512 * (Rd) - 429 * (Gd) -  83 * (Bd)) >> 10))
 
@@ -61,6 +74,12 @@ typedef void (*ycbcr_convert_proc)(ycbcr_t ycbcr,
 				   struct ycbcr_video_stream_s *video,
 				   unsigned char *from,
 				   unsigned char *to);
+typedef void (*ycbcr_rows_proc)(ycbcr_t ycbcr,
+				struct ycbcr_video_stream_s *video,
+				chain_rows_t *from, chain_rows_t *to,
+				unsigned int y, unsigned int rows);
+typedef void (*ycbcr_interleave_proc)(unsigned char *Cb, unsigned char *Cr,
+				      unsigned char *CbCr, unsigned int n);
 
 struct ycbcr_video_stream_s {
 	glc_stream_id_t id;
@@ -70,14 +89,19 @@ struct ycbcr_video_stream_s {
 	unsigned int row;
 	double scale;
 	size_t size;
+	glc_video_format_t format;
 
 	unsigned int *pos;
 	float *factor;
 
-	ycbcr_convert_proc convert;
+	/* convert is the C loop, kernel and rows what actually run */
+	ycbcr_convert_proc convert, kernel;
+	ycbcr_rows_proc rows;
+	/* NV12 rows are produced with planar rows and interleave */
+	ycbcr_rows_proc planar;
+	ycbcr_interleave_proc interleave;
 
 	pthread_rwlock_t update;
-	struct ycbcr_video_stream_s *next;
 };
 
 struct ycbcr_s {
@@ -85,18 +109,33 @@ struct ycbcr_s {
 	glc_thread_t thread;
 	int running;
 	double scale;
+	glc_video_format_t format;
+
+	glc_registry_t video;
+};
 
+struct ycbcr_slice_s {
+	ycbcr_t ycbcr;
 	struct ycbcr_video_stream_s *video;
+	chain_rows_t from, to;
 };
 
 int ycbcr_read_callback(glc_thread_state_t *state);
 int ycbcr_write_callback(glc_thread_state_t *state);
+void ycbcr_slice_callback(void *ptr, unsigned int y, unsigned int rows);
 void ycbcr_finish_callback(void *ptr, int err);
 
 int ycbcr_video_format_message(ycbcr_t ycbcr, glc_video_format_message_t *video_format);
-void ycbcr_get_video_stream(ycbcr_t ycbcr, glc_stream_id_t id, struct ycbcr_video_stream_s **video);
+int ycbcr_get_video_stream(ycbcr_t ycbcr, glc_stream_id_t id, struct ycbcr_video_stream_s **video);
+int ycbcr_video_stream_init(void *entry, glc_stream_id_t id, void *arg);
+int ycbcr_video_stream_destroy(void *entry, glc_stream_id_t id, void *arg);
+void ycbcr_video_geometry(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+			  unsigned int width, unsigned int height, int aligned);
 
 int ycbcr_generate_map(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video);
+int ycbcr_check_kernel(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+		       const char *name, unsigned char *from, unsigned char *to,
+		       unsigned char *expected, int tolerance);
 
 void ycbcr_bgr_to_jpeg420(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
 			  unsigned char *from, unsigned char *to);
@@ -104,13 +143,92 @@ void ycbcr_bgr_to_jpeg420_half(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video
 			       unsigned char *from, unsigned char *to);
 void ycbcr_bgr_to_jpeg420_scale(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
 				unsigned char *from, unsigned char *to);
+void ycbcr_bgr_to_jpeg420_rows_bgr(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				   chain_rows_t *from, chain_rows_t *to,
+				   unsigned int y, unsigned int rows);
+void ycbcr_bgr_to_jpeg420_rows_bgra(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    chain_rows_t *from, chain_rows_t *to,
+				    unsigned int y, unsigned int rows);
+void ycbcr_bgr_to_jpeg420_half_bgr(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				   unsigned char *from, unsigned char *to);
+void ycbcr_bgr_to_jpeg420_half_bgra(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    unsigned char *from, unsigned char *to);
+
+void ycbcr_jpeg420_row(struct ycbcr_video_stream_s *video,
+		       unsigned char *row1, unsigned char *row2,
+		       unsigned char *Y1, unsigned char *Y2,
+		       unsigned char *Cb, unsigned char *Cr, unsigned int Yx);
+void ycbcr_jpeg420_half_row(struct ycbcr_video_stream_s *video, unsigned char **row,
+			    unsigned char *Y1, unsigned char *Y2,
+			    unsigned char *Cb, unsigned char *Cr, unsigned int Yx);
+
+void ycbcr_simd(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video);
+int ycbcr_banded(struct ycbcr_video_stream_s *video);
+
+void ycbcr_jpeg420_to_nv12(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+			   unsigned char *from, unsigned char *to);
+void ycbcr_jpeg420_to_nv12_rows(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				chain_rows_t *from, chain_rows_t *to,
+				unsigned int y, unsigned int rows);
+void ycbcr_bgr_to_nv12_rows(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+			    chain_rows_t *from, chain_rows_t *to,
+			    unsigned int y, unsigned int rows);
+int ycbcr_nv12_pack(struct ycbcr_video_stream_s *video, unsigned char *pic);
+void ycbcr_interleave(unsigned char *Cb, unsigned char *Cr,
+		      unsigned char *CbCr, unsigned int n);
+
+#ifdef YCBCR_X86
+void ycbcr_bgr_to_jpeg420_rows_ssse3(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				     chain_rows_t *from, chain_rows_t *to,
+				     unsigned int y, unsigned int rows);
+void ycbcr_bgr_to_jpeg420_rows_avx2(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    chain_rows_t *from, chain_rows_t *to,
+				    unsigned int y, unsigned int rows);
+void ycbcr_bgr_to_jpeg420_half_ssse3(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				     unsigned char *from, unsigned char *to);
+void ycbcr_bgr_to_jpeg420_half_avx2(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    unsigned char *from, unsigned char *to);
+void ycbcr_bgr_to_jpeg420_scale_ssse3(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				      unsigned char *from, unsigned char *to);
+void ycbcr_interleave_sse2(unsigned char *Cb, unsigned char *Cr,
+			   unsigned char *CbCr, unsigned int n);
+#endif
+
+#ifdef __ARM_NEON
+void ycbcr_bgr_to_jpeg420_rows_neon(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    chain_rows_t *from, chain_rows_t *to,
+				    unsigned int y, unsigned int rows);
+void ycbcr_bgr_to_jpeg420_half_neon(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    unsigned char *from, unsigned char *to);
+void ycbcr_interleave_neon(unsigned char *Cb, unsigned char *Cr,
+			   unsigned char *CbCr, unsigned int n);
+#endif
+
+int ycbcr_message_callback(void *ptr, glc_thread_state_t *state);
+int ycbcr_frame_callback(void *ptr, glc_stream_id_t id,
+			 chain_rows_t *from, chain_rows_t *to,
+			 int *whole, void **ctx);
+void ycbcr_need_callback(void *ptr, void *ctx, unsigned int y, unsigned int rows,
+			 unsigned int *from_y, unsigned int *from_rows);
+void ycbcr_rows_callback(void *ptr, void *ctx, chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows);
+void ycbcr_done_callback(void *ptr, void *ctx);
+void ycbcr_get_rows(struct ycbcr_video_stream_s *video, chain_rows_t *from, chain_rows_t *to);
 
 int ycbcr_init(ycbcr_t *ycbcr, glc_t *glc)
 {
+	int ret;
+
 	*ycbcr = malloc(sizeof(struct ycbcr_s));
 	memset(*ycbcr, 0, sizeof(struct ycbcr_s));
 
 	(*ycbcr)->glc = glc;
+	if ((ret = glc_registry_init(&(*ycbcr)->video, sizeof(struct ycbcr_video_stream_s),
+				     &ycbcr_video_stream_init, &ycbcr_video_stream_destroy,
+				     *ycbcr))) {
+		free(*ycbcr);
+		return ret;
+	}
 
 	(*ycbcr)->thread.flags = GLC_THREAD_READ | GLC_THREAD_WRITE;
 	(*ycbcr)->thread.read_callback = &ycbcr_read_callback;
@@ -118,13 +236,16 @@ int ycbcr_init(ycbcr_t *ycbcr, glc_t *glc)
 	(*ycbcr)->thread.finish_callback = &ycbcr_finish_callback;
 	(*ycbcr)->thread.ptr = *ycbcr;
 	(*ycbcr)->thread.threads = glc_threads_hint(glc);
+	(*ycbcr)->thread.name = "ycbcr";
 	(*ycbcr)->scale = 1.0;
+	(*ycbcr)->format = GLC_VIDEO_YCBCR_420JPEG;
 
 	return 0;
 }
 
 int ycbcr_destroy(ycbcr_t ycbcr)
 {
+	glc_registry_destroy(ycbcr->video);
 	free(ycbcr);
 	return 0;
 }
@@ -138,6 +259,19 @@ int ycbcr_set_scale(ycbcr_t ycbcr, double scale)
 	return 0;
 }
 
+int ycbcr_set_format(ycbcr_t ycbcr, glc_video_format_t format)
+{
+	if (ycbcr->running)
+		return EALREADY;
+
+	if ((format != GLC_VIDEO_YCBCR_420JPEG) &&
+	    (format != GLC_VIDEO_NV12))
+		return EINVAL;
+
+	ycbcr->format = format;
+	return 0;
+}
+
 int ycbcr_process_start(ycbcr_t ycbcr, ps_buffer_t *from, ps_buffer_t *to)
 {
 	int ret;
@@ -165,26 +299,31 @@ int ycbcr_process_wait(ycbcr_t ycbcr)
 	return 0;
 }
 
+int ycbcr_filter(ycbcr_t ycbcr, chain_filter_t *filter)
+{
+	if (ycbcr->running)
+		return EALREADY;
+
+	memset(filter, 0, sizeof(chain_filter_t));
+	filter->ptr = ycbcr;
+	filter->message_callback = &ycbcr_message_callback;
+	filter->frame_callback = &ycbcr_frame_callback;
+	filter->need_callback = &ycbcr_need_callback;
+	filter->rows_callback = &ycbcr_rows_callback;
+	filter->done_callback = &ycbcr_done_callback;
+	filter->finish_callback = &ycbcr_finish_callback;
+
+	return 0;
+}
+
 void ycbcr_finish_callback(void *ptr, int err)
 {
 	ycbcr_t ycbcr = ptr;
-	struct ycbcr_video_stream_s *del;
 
 	if (err)
 		glc_log(ycbcr->glc, GLC_ERROR, "ycbcr", "%s (%d)", strerror(err), err);
 
-	while (ycbcr->video != NULL) {
-		del = ycbcr->video;
-		ycbcr->video = ycbcr->video->next;
-
-		if (del->pos)
-			free(del->pos);
-		if (del->factor)
-			free(del->factor);
-
-		pthread_rwlock_destroy(&del->update);
-		free(del);
-	}
+	glc_registry_clear(ycbcr->video);
 }
 
 int ycbcr_read_callback(glc_thread_state_t *state)
@@ -192,13 +331,15 @@ int ycbcr_read_callback(glc_thread_state_t *state)
 	ycbcr_t ycbcr = state->ptr;
 	struct ycbcr_video_stream_s *video;
 	glc_video_frame_header_t *pic_hdr;
+	int ret;
 
 	if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
 		ycbcr_video_format_message(ycbcr, (glc_video_format_message_t *) state->read_data);
 
 	if (state->header.type == GLC_MESSAGE_VIDEO_FRAME) {
 		pic_hdr = (glc_video_frame_header_t *) state->read_data;
-		ycbcr_get_video_stream(ycbcr, pic_hdr->id, &video);
+		if ((ret = ycbcr_get_video_stream(ycbcr, pic_hdr->id, &video)))
+			return ret;
 		state->threadptr = video;
 
 		pthread_rwlock_rdlock(&video->update);
@@ -219,142 +360,315 @@ int ycbcr_write_callback(glc_thread_state_t *state)
 {
 	ycbcr_t ycbcr = state->ptr;
 	struct ycbcr_video_stream_s *video = state->threadptr;
+	struct ycbcr_slice_s slice;
+	int ret = 0;
 
 	memcpy(state->write_data, state->read_data, sizeof(glc_video_frame_header_t));
-	video->convert(ycbcr, video,
-		     (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
-		     (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)]);
+
+	if (ycbcr_banded(video)) {
+		/* plain conversion can be split in slices */
+		slice.ycbcr = ycbcr;
+		slice.video = video;
+		ycbcr_get_rows(video, &slice.from, &slice.to);
+		slice.from.data = (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)];
+		slice.to.data = (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)];
+		glc_slice_run(ycbcr->glc, video->yh, 2, &ycbcr_slice_callback, &slice);
+	} else {
+		video->kernel(ycbcr, video,
+			      (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
+			      (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)]);
+		if (video->format == GLC_VIDEO_NV12)
+			ret = ycbcr_nv12_pack(video, (unsigned char *)
+					      &state->write_data[sizeof(glc_video_frame_header_t)]);
+	}
 	pthread_rwlock_unlock(&video->update);
 
+	return ret;
+}
+
+void ycbcr_slice_callback(void *ptr, unsigned int y, unsigned int rows)
+{
+	struct ycbcr_slice_s *slice = ptr;
+	slice->video->rows(slice->ycbcr, slice->video, &slice->from, &slice->to, y, rows);
+}
+
+int ycbcr_message_callback(void *ptr, glc_thread_state_t *state)
+{
+	if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
+		ycbcr_video_format_message((ycbcr_t) ptr,
+					   (glc_video_format_message_t *) state->read_data);
 	return 0;
 }
 
-void ycbcr_get_video_stream(ycbcr_t ycbcr, glc_stream_id_t id, struct ycbcr_video_stream_s **video)
+int ycbcr_frame_callback(void *ptr, glc_stream_id_t id,
+			 chain_rows_t *from, chain_rows_t *to,
+			 int *whole, void **ctx)
 {
-	*video = ycbcr->video;
+	struct ycbcr_video_stream_s *video;
+	int ret;
+
+	if ((ret = ycbcr_get_video_stream((ycbcr_t) ptr, id, &video)))
+		return ret;
+	pthread_rwlock_rdlock(&video->update);
 
-	while (*video != NULL) {
-		if ((*video)->id == id)
-			break;
-		*video = (*video)->next;
+	if (video->convert == NULL) {
+		pthread_rwlock_unlock(&video->update);
+		*ctx = NULL;
+		return 0;
 	}
 
-	if (*video == NULL) {
-		*video = malloc(sizeof(struct ycbcr_video_stream_s));
-		memset(*video, 0, sizeof(struct ycbcr_video_stream_s));
+	/* only plain conversion is done in bands */
+	*whole = !ycbcr_banded(video);
+	ycbcr_get_rows(video, from, to);
+	*ctx = video;
+	return 0;
+}
+
+void ycbcr_need_callback(void *ptr, void *ctx, unsigned int y, unsigned int rows,
+			 unsigned int *from_y, unsigned int *from_rows)
+{
+	struct ycbcr_video_stream_s *video = ctx;
+
+	*from_rows = rows;
+	if (video->convert == &ycbcr_jpeg420_to_nv12)
+		*from_y = y;
+	else /* picture is flipped */
+		*from_y = video->h - y - rows;
+}
+
+void ycbcr_rows_callback(void *ptr, void *ctx, chain_rows_t *from, chain_rows_t *to,
+			 unsigned int y, unsigned int rows)
+{
+	struct ycbcr_video_stream_s *video = ctx;
 
-		(*video)->next = ycbcr->video;
-		ycbcr->video = *video;
-		(*video)->id = id;
-		pthread_rwlock_init(&(*video)->update, NULL);
+	if (ycbcr_banded(video))
+		video->rows((ycbcr_t) ptr, video, from, to, y, rows);
+	else {
+		video->kernel((ycbcr_t) ptr, video, from->data, to->data);
+		if (video->format == GLC_VIDEO_NV12)
+			ycbcr_nv12_pack(video, to->data);
 	}
 }
 
+void ycbcr_done_callback(void *ptr, void *ctx)
+{
+	struct ycbcr_video_stream_s *video = ctx;
+	pthread_rwlock_unlock(&video->update);
+}
+
+void ycbcr_get_rows(struct ycbcr_video_stream_s *video, chain_rows_t *from, chain_rows_t *to)
+{
+	memset(from, 0, sizeof(chain_rows_t));
+	if (video->convert == &ycbcr_jpeg420_to_nv12)
+		from->format = GLC_VIDEO_YCBCR_420JPEG;
+	else
+		from->format = (video->bpp == 4) ? GLC_VIDEO_BGRA : GLC_VIDEO_BGR;
+	from->w = video->w;
+	from->h = video->h;
+	from->row = video->row;
+	from->rows = video->h;
+
+	memset(to, 0, sizeof(chain_rows_t));
+	to->format = video->format;
+	to->w = video->yw;
+	to->h = video->yh;
+	to->row = video->yw;
+	to->rows = video->yh;
+}
+
+int ycbcr_get_video_stream(ycbcr_t ycbcr, glc_stream_id_t id, struct ycbcr_video_stream_s **video)
+{
+	return glc_registry_get(ycbcr->video, id, (void **) video);
+}
+
+int ycbcr_video_stream_init(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct ycbcr_video_stream_s *video = entry;
+
+	video->id = id;
+	pthread_rwlock_init(&video->update, NULL);
+	return 0;
+}
+
+int ycbcr_video_stream_destroy(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct ycbcr_video_stream_s *video = entry;
+
+	if (video->pos)
+		free(video->pos);
+	if (video->factor)
+		free(video->factor);
+
+	pthread_rwlock_destroy(&video->update);
+	return 0;
+}
+
 void ycbcr_bgr_to_jpeg420(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
 			  unsigned char *from, unsigned char *to)
 {
-	unsigned int Ypix;
-	unsigned int op1, op2, op3, op4;
-	unsigned char Rd, Gd, Bd;
-	unsigned int ox, oy, Yy, Yx;
-	unsigned char *Y, *Cb, *Cr;
-
-	Y = to;
-	Cb = &to[video->yw * video->yh];
-	Cr = &to[video->yw * video->yh + video->cw * video->ch];
+	chain_rows_t from_rows, to_rows;
 
-	oy = (video->h - 2) * video->row;
-	ox = 0;
+	ycbcr_get_rows(video, &from_rows, &to_rows);
+	from_rows.data = from;
+	to_rows.data = to;
+	video->rows(ycbcr, video, &from_rows, &to_rows, 0, video->yh);
+}
 
-	for (Yy = 0; Yy < video->yh; Yy += 2) {
-		for (Yx = 0; Yx < video->yw; Yx += 2) {
-			op1 = ox + oy;
-			op2 = op1 + video->bpp;
-			op3 = op1 + video->row;
-			op4 = op2 + video->row;
-			Rd = (from[op1 + 2] + from[op2 + 2] + from[op3 + 2] + from[op4 + 2]) >> 2;
-			Gd = (from[op1 + 1] + from[op2 + 1] + from[op3 + 1] + from[op4 + 1]) >> 2;
-			Bd = (from[op1 + 0] + from[op2 + 0] + from[op3 + 0] + from[op4 + 0]) >> 2;
+/*
+ * C kernels are instantiated at build time for BGR and BGRA, so
+ * pixel size is a constant and compiler can unroll and vectorize
+ * inner loops. Bottom-up row order and row alignment only move row
+ * pointers, so those are handled once per row.
+ */
 
-			/* CbCr */
-			*Cb++ = RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd);
-			*Cr++ = RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd);
+static inline __attribute__ ((always_inline))
+void ycbcr_jpeg420_row_bpp(const unsigned int bpp, unsigned int yw,
+			   const unsigned char *row1, const unsigned char *row2,
+			   unsigned char *Y1, unsigned char *Y2,
+			   unsigned char *Cb, unsigned char *Cr, unsigned int Yx)
+{
+	unsigned int op1, op2;
+	unsigned char Rd, Gd, Bd;
 
-			/* Y' */
-			Ypix = Yx + Yy * video->yw;
-			Y[Ypix] = RGB_TO_YCbCrJPEG_Y(from[op3 + 2],
-						     from[op3 + 1],
-						     from[op3 + 0]);
-			Y[Ypix + 1] = RGB_TO_YCbCrJPEG_Y(from[op4 + 2],
-							 from[op4 + 1],
-							 from[op4 + 0]);
-			Y[Ypix + video->yw] = RGB_TO_YCbCrJPEG_Y(from[op1 + 2],
-							       from[op1 + 1],
-							       from[op1 + 0]);
-			Y[Ypix + 1 + video->yw] = RGB_TO_YCbCrJPEG_Y(from[op2 + 2],
-								   from[op2 + 1],
-								   from[op2 + 0]);
-			ox += video->bpp * 2;
-		}
-		ox = 0;
-		oy -= 2 * video->row;
+	for (; Yx < yw; Yx += 2) {
+		op1 = Yx * bpp;
+		op2 = op1 + bpp;
+		Rd = (row1[op1 + 2] + row1[op2 + 2] + row2[op1 + 2] + row2[op2 + 2]) >> 2;
+		Gd = (row1[op1 + 1] + row1[op2 + 1] + row2[op1 + 1] + row2[op2 + 1]) >> 2;
+		Bd = (row1[op1 + 0] + row1[op2 + 0] + row2[op1 + 0] + row2[op2 + 0]) >> 2;
+
+		/* CbCr */
+		Cb[Yx / 2] = RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd);
+		Cr[Yx / 2] = RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd);
+
+		/* Y' */
+		Y1[Yx] = RGB_TO_YCbCrJPEG_Y(row2[op1 + 2],
+					    row2[op1 + 1],
+					    row2[op1 + 0]);
+		Y1[Yx + 1] = RGB_TO_YCbCrJPEG_Y(row2[op2 + 2],
+						row2[op2 + 1],
+						row2[op2 + 0]);
+		Y2[Yx] = RGB_TO_YCbCrJPEG_Y(row1[op1 + 2],
+					    row1[op1 + 1],
+					    row1[op1 + 0]);
+		Y2[Yx + 1] = RGB_TO_YCbCrJPEG_Y(row1[op2 + 2],
+						row1[op2 + 1],
+						row1[op2 + 0]);
 	}
 }
 
-#define CALC_BILINEAR_RGB(x0, x1, y0, y1) \
-	op1 = (ox + x0) + (oy + y0) * video->row; \
-	op2 = op1 + (x1 - x0); \
-	op3 = op1 + (y1 - y0) * video->row; \
-	op4 = op2 + (y1 - y0) * video->row; \
-	Rd = (from[op1 + 2] + from[op2 + 2] + from[op3 + 2] + from[op4 + 2]) >> 2; \
-	Gd = (from[op1 + 1] + from[op2 + 1] + from[op3 + 1] + from[op4 + 1]) >> 2; \
-	Bd = (from[op1 + 0] + from[op2 + 0] + from[op3 + 0] + from[op4 + 0]) >> 2;
-
-void ycbcr_bgr_to_jpeg420_half(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
-			       unsigned char *from, unsigned char *to)
+#define CALC_BILINEAR_RGB(row1, row2, x) \
+	op1 = (x) * bpp; \
+	op2 = op1 + bpp; \
+	Rd = (row1[op1 + 2] + row1[op2 + 2] + row2[op1 + 2] + row2[op2 + 2]) >> 2; \
+	Gd = (row1[op1 + 1] + row1[op2 + 1] + row2[op1 + 1] + row2[op2 + 1]) >> 2; \
+	Bd = (row1[op1 + 0] + row1[op2 + 0] + row2[op1 + 0] + row2[op2 + 0]) >> 2;
+
+static inline __attribute__ ((always_inline))
+void ycbcr_jpeg420_half_row_bpp(const unsigned int bpp, unsigned int yw,
+				unsigned char **row,
+				unsigned char *Y1, unsigned char *Y2,
+				unsigned char *Cb, unsigned char *Cr, unsigned int Yx)
 {
-	unsigned int Ypix;
-	unsigned int op1, op2, op3, op4;
+	const unsigned char *row0 = row[0], *row1 = row[1], *row2 = row[2], *row3 = row[3];
+	unsigned int op1, op2;
 	unsigned char Rd, Gd, Bd;
-	unsigned int ox, oy, Yy, Yx;
-	unsigned char *Cb, *Cr;
 
-	Cb = &to[video->yw * video->yh];
-	Cr = &to[video->yw * video->yh + video->cw * video->ch];
+	for (; Yx < yw; Yx += 2) {
+		/* CbCr from between the Y' samples */
+		CALC_BILINEAR_RGB(row1, row2, Yx * 2 + 1)
+		Cb[Yx / 2] = RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd);
+		Cr[Yx / 2] = RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd);
 
-	oy = (video->h - 4);
-	ox = 0;
+		/* Y' */
+		CALC_BILINEAR_RGB(row2, row3, Yx * 2)
+		Y1[Yx] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
 
-	for (Yy = 0; Yy < video->yh; Yy += 2) {
-		for (Yx = 0; Yx < video->yw; Yx += 2) {
-			/* CbCr */
-			CALC_BILINEAR_RGB(video->bpp, video->bpp * 2, 1, 2)
-			*Cb++ = RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd);
-			*Cr++ = RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd);
+		CALC_BILINEAR_RGB(row2, row3, Yx * 2 + 2)
+		Y1[Yx + 1] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
 
-			/* Y' */
-			Ypix = Yx + Yy * video->yw;
+		CALC_BILINEAR_RGB(row0, row1, Yx * 2)
+		Y2[Yx] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
 
-			CALC_BILINEAR_RGB(0, video->bpp, 2, 3)
-			to[Ypix] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
+		CALC_BILINEAR_RGB(row0, row1, Yx * 2 + 2)
+		Y2[Yx + 1] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
+	}
+}
 
-			CALC_BILINEAR_RGB(video->bpp * 2, video->bpp * 3, 2, 3)
-			to[Ypix + 1] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
+#undef CALC_BILINEAR_RGB
 
-			CALC_BILINEAR_RGB(0, video->bpp, 0, 1)
-			to[Ypix + video->yw] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
+#define YCBCR_KERNELS(fmt, bpp) \
+void ycbcr_bgr_to_jpeg420_rows_##fmt(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video, \
+				     chain_rows_t *from, chain_rows_t *to, \
+				     unsigned int y, unsigned int rows) \
+{ \
+	unsigned int Yy; \
+ \
+	/* rows always start at even row and come in pairs */ \
+	for (Yy = y; Yy < y + rows; Yy += 2) { \
+		/* BGR picture is stored bottom-up */ \
+		ycbcr_jpeg420_row_bpp(bpp, video->yw, \
+				      CHAIN_ROW(from, video->h - 2 - Yy), \
+				      CHAIN_ROW(from, video->h - 1 - Yy), \
+				      CHAIN_ROW(to, Yy), CHAIN_ROW(to, Yy + 1), \
+				      CHAIN_CB_ROW(to, Yy / 2), CHAIN_CR_ROW(to, Yy / 2), 0); \
+	} \
+} \
+ \
+void ycbcr_bgr_to_jpeg420_half_##fmt(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video, \
+				     unsigned char *from, unsigned char *to) \
+{ \
+	unsigned char *row[4]; \
+	unsigned int Yy, i; \
+ \
+	for (Yy = 0; Yy < video->yh; Yy += 2) { \
+		/* four source rows for two Y' rows, stored bottom-up */ \
+		for (i = 0; i < 4; i++) \
+			row[i] = &from[(video->h - 4 - Yy * 2 + i) * video->row]; \
+ \
+		ycbcr_jpeg420_half_row_bpp(bpp, video->yw, row, \
+					   &to[Yy * video->yw], &to[(Yy + 1) * video->yw], \
+					   &to[video->yw * video->yh + (Yy / 2) * video->cw], \
+					   &to[video->yw * video->yh + video->cw * video->ch + \
+					       (Yy / 2) * video->cw], 0); \
+	} \
+}
 
-			CALC_BILINEAR_RGB(video->bpp * 2, video->bpp * 3, 0, 1)
-			to[Ypix + 1 + video->yw] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
+YCBCR_KERNELS(bgr, 3)
+YCBCR_KERNELS(bgra, 4)
 
-			ox += video->bpp * 4;
-		}
-		ox = 0;
-		oy -= 4;
-	}
+#undef YCBCR_KERNELS
+
+void ycbcr_bgr_to_jpeg420_half(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+			       unsigned char *from, unsigned char *to)
+{
+	if (video->bpp == 4)
+		ycbcr_bgr_to_jpeg420_half_bgra(ycbcr, video, from, to);
+	else
+		ycbcr_bgr_to_jpeg420_half_bgr(ycbcr, video, from, to);
 }
 
-#undef CALC_BILINEAR_RGB
+/* these finish rows for vector kernels */
+void ycbcr_jpeg420_row(struct ycbcr_video_stream_s *video,
+		       unsigned char *row1, unsigned char *row2,
+		       unsigned char *Y1, unsigned char *Y2,
+		       unsigned char *Cb, unsigned char *Cr, unsigned int Yx)
+{
+	if (video->bpp == 4)
+		ycbcr_jpeg420_row_bpp(4, video->yw, row1, row2, Y1, Y2, Cb, Cr, Yx);
+	else
+		ycbcr_jpeg420_row_bpp(3, video->yw, row1, row2, Y1, Y2, Cb, Cr, Yx);
+}
+
+void ycbcr_jpeg420_half_row(struct ycbcr_video_stream_s *video, unsigned char **row,
+			    unsigned char *Y1, unsigned char *Y2,
+			    unsigned char *Cb, unsigned char *Cr, unsigned int Yx)
+{
+	if (video->bpp == 4)
+		ycbcr_jpeg420_half_row_bpp(4, video->yw, row, Y1, Y2, Cb, Cr, Yx);
+	else
+		ycbcr_jpeg420_half_row_bpp(3, video->yw, row, Y1, Y2, Cb, Cr, Yx);
+}
 
 void ycbcr_bgr_to_jpeg420_scale(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
 				unsigned char *from, unsigned char *to)
@@ -415,45 +729,971 @@ void ycbcr_bgr_to_jpeg420_scale(ycbcr_t ycbcr, struct ycbcr_video_stream_s *vide
 #undef Bd
 }
 
+void ycbcr_simd(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video)
+{
+	glc_flags_t cpu = glc_cpu_features(ycbcr->glc);
+
+	video->kernel = video->convert;
+	video->interleave = &ycbcr_interleave;
+
+	/* C kernel instance for pixel size */
+	if (video->bpp == 4) {
+		video->rows = &ycbcr_bgr_to_jpeg420_rows_bgra;
+		if (video->convert == &ycbcr_bgr_to_jpeg420_half)
+			video->kernel = &ycbcr_bgr_to_jpeg420_half_bgra;
+	} else {
+		video->rows = &ycbcr_bgr_to_jpeg420_rows_bgr;
+		if (video->convert == &ycbcr_bgr_to_jpeg420_half)
+			video->kernel = &ycbcr_bgr_to_jpeg420_half_bgr;
+	}
+
+#ifdef YCBCR_X86
+	if (cpu & GLC_CPU_SSE2)
+		video->interleave = &ycbcr_interleave_sse2;
+
+	if (video->convert == &ycbcr_bgr_to_jpeg420) {
+		if (cpu & GLC_CPU_AVX2)
+			video->rows = &ycbcr_bgr_to_jpeg420_rows_avx2;
+		else if (cpu & GLC_CPU_SSSE3)
+			video->rows = &ycbcr_bgr_to_jpeg420_rows_ssse3;
+	} else if (video->convert == &ycbcr_bgr_to_jpeg420_half) {
+		if (cpu & GLC_CPU_AVX2)
+			video->kernel = &ycbcr_bgr_to_jpeg420_half_avx2;
+		else if (cpu & GLC_CPU_SSSE3)
+			video->kernel = &ycbcr_bgr_to_jpeg420_half_ssse3;
+	} else if (video->convert == &ycbcr_bgr_to_jpeg420_scale) {
+		if (cpu & GLC_CPU_SSSE3)
+			video->kernel = &ycbcr_bgr_to_jpeg420_scale_ssse3;
+	}
+#endif
+
+#ifdef __ARM_NEON
+	if (cpu & GLC_CPU_NEON) {
+		video->interleave = &ycbcr_interleave_neon;
+		if (video->convert == &ycbcr_bgr_to_jpeg420)
+			video->rows = &ycbcr_bgr_to_jpeg420_rows_neon;
+		else if (video->convert == &ycbcr_bgr_to_jpeg420_half)
+			video->kernel = &ycbcr_bgr_to_jpeg420_half_neon;
+	}
+#endif
+
+	if (video->convert == &ycbcr_jpeg420_to_nv12)
+		video->rows = &ycbcr_jpeg420_to_nv12_rows;
+	else if (video->format == GLC_VIDEO_NV12) {
+		video->planar = video->rows;
+		video->rows = &ycbcr_bgr_to_nv12_rows;
+	}
+}
+
+int ycbcr_banded(struct ycbcr_video_stream_s *video)
+{
+	return (video->convert == &ycbcr_bgr_to_jpeg420) |
+	       (video->convert == &ycbcr_jpeg420_to_nv12);
+}
+
+void ycbcr_jpeg420_to_nv12(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+			   unsigned char *from, unsigned char *to)
+{
+	chain_rows_t from_rows, to_rows;
+
+	ycbcr_get_rows(video, &from_rows, &to_rows);
+	from_rows.data = from;
+	to_rows.data = to;
+	video->rows(ycbcr, video, &from_rows, &to_rows, 0, video->yh);
+}
+
+void ycbcr_jpeg420_to_nv12_rows(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				chain_rows_t *from, chain_rows_t *to,
+				unsigned int y, unsigned int rows)
+{
+	unsigned int Yy;
+
+	/* rows always start at even row and come in pairs */
+	for (Yy = y; Yy < y + rows; Yy += 2) {
+		memcpy(CHAIN_ROW(to, Yy), CHAIN_ROW(from, Yy), video->yw);
+		memcpy(CHAIN_ROW(to, Yy + 1), CHAIN_ROW(from, Yy + 1), video->yw);
+		video->interleave(CHAIN_CB_ROW(from, Yy / 2), CHAIN_CR_ROW(from, Yy / 2),
+				  CHAIN_UV_ROW(to, Yy / 2), video->cw);
+	}
+}
+
+void ycbcr_bgr_to_nv12_rows(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+			    chain_rows_t *from, chain_rows_t *to,
+			    unsigned int y, unsigned int rows)
+{
+	chain_rows_t pair;
+	unsigned int Yy;
+
+	/* each row pair is converted into planar rows that stay in cache */
+	memset(&pair, 0, sizeof(chain_rows_t));
+	pair.format = GLC_VIDEO_YCBCR_420JPEG;
+	pair.w = video->yw;
+	pair.h = video->yh;
+	pair.row = video->yw;
+	pair.rows = 2;
+	if (!(pair.data = malloc(2 * video->yw + 2 * video->cw)))
+		return;
+
+	for (Yy = y; Yy < y + rows; Yy += 2) {
+		pair.y = Yy;
+		video->planar(ycbcr, video, from, &pair, Yy, 2);
+
+		memcpy(CHAIN_ROW(to, Yy), CHAIN_ROW(&pair, Yy), video->yw);
+		memcpy(CHAIN_ROW(to, Yy + 1), CHAIN_ROW(&pair, Yy + 1), video->yw);
+		video->interleave(CHAIN_CB_ROW(&pair, Yy / 2), CHAIN_CR_ROW(&pair, Yy / 2),
+				  CHAIN_UV_ROW(to, Yy / 2), video->cw);
+	}
+
+	free(pair.data);
+}
+
+/** scaled conversion writes planar picture, chroma is interleaved afterwards */
+int ycbcr_nv12_pack(struct ycbcr_video_stream_s *video, unsigned char *pic)
+{
+	unsigned char *chroma, *CbCr;
+	size_t plane = video->cw * video->ch;
+	unsigned int c;
+
+	if (!(chroma = malloc(2 * plane)))
+		return ENOMEM;
+
+	CbCr = &pic[video->yw * video->yh];
+	memcpy(chroma, CbCr, 2 * plane);
+	for (c = 0; c < video->ch; c++)
+		video->interleave(&chroma[c * video->cw], &chroma[plane + c * video->cw],
+				  &CbCr[c * video->cw * 2], video->cw);
+
+	free(chroma);
+	return 0;
+}
+
+void ycbcr_interleave(unsigned char *Cb, unsigned char *Cr,
+		      unsigned char *CbCr, unsigned int n)
+{
+	unsigned int x;
+
+	for (x = 0; x < n; x++) {
+		CbCr[x * 2 + 0] = Cb[x];
+		CbCr[x * 2 + 1] = Cr[x];
+	}
+}
+
+/*
+ * Vector kernels below produce exactly the same output as the loops
+ * above, which also finish the last pixels of each row. Samples are
+ * widened to 16 bits and multiplied with the same 10-bit coefficients,
+ * sums are kept in 32 bits so nothing is rounded differently.
+ */
+
+#ifdef YCBCR_X86
+
+/* B, G, R coefficients for pmaddwd, in pixel order */
+#define YCBCR_COEF_Y   117,  601, 306, 0
+#define YCBCR_COEF_Cb -512,  339, 173, 0
+#define YCBCR_COEF_Cr  -83, -429, 512, 0
+
+/* 8 pixels -> 4 vectors of two BGR0 pixels, 16 bits per channel */
+__attribute__ ((target ("ssse3")))
+static inline void ycbcr_load_ssse3(struct ycbcr_video_stream_s *video,
+				    unsigned char *src, __m128i *v)
+{
+	const __m128i bgra_lo = _mm_setr_epi8(0, -1, 1, -1, 2, -1, -1, -1,
+					      4, -1, 5, -1, 6, -1, -1, -1);
+	const __m128i bgra_hi = _mm_setr_epi8(8, -1, 9, -1, 10, -1, -1, -1,
+					      12, -1, 13, -1, 14, -1, -1, -1);
+	const __m128i bgr_lo = _mm_setr_epi8(0, -1, 1, -1, 2, -1, -1, -1,
+					     3, -1, 4, -1, 5, -1, -1, -1);
+	const __m128i bgr_hi = _mm_setr_epi8(6, -1, 7, -1, 8, -1, -1, -1,
+					     9, -1, 10, -1, 11, -1, -1, -1);
+	/* second BGR load starts at byte 8, pixel 4 is at its byte 4 */
+	const __m128i bgr_lo2 = _mm_setr_epi8(4, -1, 5, -1, 6, -1, -1, -1,
+					      7, -1, 8, -1, 9, -1, -1, -1);
+	const __m128i bgr_hi2 = _mm_setr_epi8(10, -1, 11, -1, 12, -1, -1, -1,
+					      13, -1, 14, -1, 15, -1, -1, -1);
+	__m128i a, b;
+
+	if (video->bpp == 4) {
+		a = _mm_loadu_si128((__m128i *) &src[0]);
+		b = _mm_loadu_si128((__m128i *) &src[16]);
+		v[0] = _mm_shuffle_epi8(a, bgra_lo);
+		v[1] = _mm_shuffle_epi8(a, bgra_hi);
+		v[2] = _mm_shuffle_epi8(b, bgra_lo);
+		v[3] = _mm_shuffle_epi8(b, bgra_hi);
+	} else {
+		a = _mm_loadu_si128((__m128i *) &src[0]);
+		b = _mm_loadu_si128((__m128i *) &src[8]);
+		v[0] = _mm_shuffle_epi8(a, bgr_lo);
+		v[1] = _mm_shuffle_epi8(a, bgr_hi);
+		v[2] = _mm_shuffle_epi8(b, bgr_lo2);
+		v[3] = _mm_shuffle_epi8(b, bgr_hi2);
+	}
+}
+
+/* 2x2 pixels on two rows -> 2 averaged pixels */
+__attribute__ ((target ("ssse3")))
+static inline __m128i ycbcr_avg_ssse3(__m128i a0, __m128i a1, __m128i b0, __m128i b1)
+{
+	a0 = _mm_add_epi16(a0, b0);
+	a1 = _mm_add_epi16(a1, b1);
+	return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(a0, a1),
+					    _mm_unpackhi_epi64(a0, a1)), 2);
+}
+
+/* 4 pixels -> 4 (sum >> 10) */
+__attribute__ ((target ("ssse3")))
+static inline __m128i ycbcr_dot_ssse3(__m128i v0, __m128i v1, __m128i coef)
+{
+	return _mm_srai_epi32(_mm_hadd_epi32(_mm_madd_epi16(v0, coef),
+					     _mm_madd_epi16(v1, coef)), 10);
+}
+
+/* 8 pixels -> 8 Y' */
+__attribute__ ((target ("ssse3")))
+static inline __m128i ycbcr_luma_ssse3(__m128i *v)
+{
+	const __m128i coef = _mm_setr_epi16(YCBCR_COEF_Y, YCBCR_COEF_Y);
+
+	return _mm_packs_epi32(ycbcr_dot_ssse3(v[0], v[1], coef),
+			       ycbcr_dot_ssse3(v[2], v[3], coef));
+}
+
+/* 8 pixels -> 8 Cb and 8 Cr */
+__attribute__ ((target ("ssse3")))
+static inline void ycbcr_chroma_ssse3(__m128i *c, unsigned char *Cb, unsigned char *Cr)
+{
+	const __m128i coef_cb = _mm_setr_epi16(YCBCR_COEF_Cb, YCBCR_COEF_Cb);
+	const __m128i coef_cr = _mm_setr_epi16(YCBCR_COEF_Cr, YCBCR_COEF_Cr);
+	const __m128i half = _mm_set1_epi16(128);
+	__m128i cb, cr;
+
+	cb = _mm_sub_epi16(half, _mm_packs_epi32(ycbcr_dot_ssse3(c[0], c[1], coef_cb),
+						  ycbcr_dot_ssse3(c[2], c[3], coef_cb)));
+	cr = _mm_add_epi16(half, _mm_packs_epi32(ycbcr_dot_ssse3(c[0], c[1], coef_cr),
+						  ycbcr_dot_ssse3(c[2], c[3], coef_cr)));
+	cb = _mm_packus_epi16(cb, cr);
+	_mm_storel_epi64((__m128i *) Cb, cb);
+	_mm_storel_epi64((__m128i *) Cr, _mm_srli_si128(cb, 8));
+}
+
+__attribute__ ((target ("ssse3")))
+unsigned int ycbcr_jpeg420_row_ssse3(struct ycbcr_video_stream_s *video,
+				     unsigned char *row1, unsigned char *row2,
+				     unsigned char *Y1, unsigned char *Y2,
+				     unsigned char *Cb, unsigned char *Cr, unsigned int Yx)
+{
+	__m128i a[4], b[4], c[4], l1, l2;
+
+	/* 16 pixels a round */
+	for (; Yx + 16 <= video->yw; Yx += 16) {
+		ycbcr_load_ssse3(video, &row1[Yx * video->bpp], a);
+		ycbcr_load_ssse3(video, &row2[Yx * video->bpp], b);
+		c[0] = ycbcr_avg_ssse3(a[0], a[1], b[0], b[1]);
+		c[1] = ycbcr_avg_ssse3(a[2], a[3], b[2], b[3]);
+		l1 = ycbcr_luma_ssse3(b);
+		l2 = ycbcr_luma_ssse3(a);
+
+		ycbcr_load_ssse3(video, &row1[(Yx + 8) * video->bpp], a);
+		ycbcr_load_ssse3(video, &row2[(Yx + 8) * video->bpp], b);
+		c[2] = ycbcr_avg_ssse3(a[0], a[1], b[0], b[1]);
+		c[3] = ycbcr_avg_ssse3(a[2], a[3], b[2], b[3]);
+		_mm_storeu_si128((__m128i *) &Y1[Yx], _mm_packus_epi16(l1, ycbcr_luma_ssse3(b)));
+		_mm_storeu_si128((__m128i *) &Y2[Yx], _mm_packus_epi16(l2, ycbcr_luma_ssse3(a)));
+
+		ycbcr_chroma_ssse3(c, &Cb[Yx / 2], &Cr[Yx / 2]);
+	}
+
+	return Yx;
+}
+
+/* 16 pixels on two rows -> 8 averaged pixels */
+__attribute__ ((target ("ssse3")))
+static inline void ycbcr_half_ssse3(struct ycbcr_video_stream_s *video,
+				    unsigned char *row1, unsigned char *row2, __m128i *v)
+{
+	__m128i a[4], b[4];
+
+	ycbcr_load_ssse3(video, row1, a);
+	ycbcr_load_ssse3(video, row2, b);
+	v[0] = ycbcr_avg_ssse3(a[0], a[1], b[0], b[1]);
+	v[1] = ycbcr_avg_ssse3(a[2], a[3], b[2], b[3]);
+	ycbcr_load_ssse3(video, &row1[8 * video->bpp], a);
+	ycbcr_load_ssse3(video, &row2[8 * video->bpp], b);
+	v[2] = ycbcr_avg_ssse3(a[0], a[1], b[0], b[1]);
+	v[3] = ycbcr_avg_ssse3(a[2], a[3], b[2], b[3]);
+}
+
+__attribute__ ((target ("ssse3")))
+unsigned int ycbcr_jpeg420_half_row_ssse3(struct ycbcr_video_stream_s *video,
+					  unsigned char **row,
+					  unsigned char *Y1, unsigned char *Y2,
+					  unsigned char *Cb, unsigned char *Cr,
+					  unsigned int Yx)
+{
+	__m128i v[4], w[4], c[4];
+	unsigned int x;
+
+	/* 16 Y' a round, chroma reads one pixel further */
+	for (; (Yx + 16 <= video->yw) && (Yx * 2 + 33 <= video->w); Yx += 16) {
+		x = Yx * 2 * video->bpp;
+
+		ycbcr_half_ssse3(video, &row[2][x], &row[3][x], v);
+		ycbcr_half_ssse3(video, &row[2][x + 16 * video->bpp],
+				 &row[3][x + 16 * video->bpp], w);
+		_mm_storeu_si128((__m128i *) &Y1[Yx],
+				 _mm_packus_epi16(ycbcr_luma_ssse3(v), ycbcr_luma_ssse3(w)));
+
+		ycbcr_half_ssse3(video, &row[0][x], &row[1][x], v);
+		ycbcr_half_ssse3(video, &row[0][x + 16 * video->bpp],
+				 &row[1][x + 16 * video->bpp], w);
+		_mm_storeu_si128((__m128i *) &Y2[Yx],
+				 _mm_packus_epi16(ycbcr_luma_ssse3(v), ycbcr_luma_ssse3(w)));
+
+		/* only every other pair of pixels is a chroma sample */
+		x += video->bpp;
+		ycbcr_half_ssse3(video, &row[1][x], &row[2][x], v);
+		ycbcr_half_ssse3(video, &row[1][x + 16 * video->bpp],
+				 &row[2][x + 16 * video->bpp], w);
+		c[0] = _mm_unpacklo_epi64(v[0], v[1]);
+		c[1] = _mm_unpacklo_epi64(v[2], v[3]);
+		c[2] = _mm_unpacklo_epi64(w[0], w[1]);
+		c[3] = _mm_unpacklo_epi64(w[2], w[3]);
+		ycbcr_chroma_ssse3(c, &Cb[Yx / 2], &Cr[Yx / 2]);
+	}
+
+	return Yx;
+}
+
+__attribute__ ((target ("ssse3")))
+void ycbcr_bgr_to_jpeg420_rows_ssse3(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				     chain_rows_t *from, chain_rows_t *to,
+				     unsigned int y, unsigned int rows)
+{
+	unsigned char *row1, *row2, *Y1, *Y2, *Cb, *Cr;
+	unsigned int Yy, Yx;
+
+	for (Yy = y; Yy < y + rows; Yy += 2) {
+		row1 = CHAIN_ROW(from, video->h - 2 - Yy);
+		row2 = CHAIN_ROW(from, video->h - 1 - Yy);
+		Y1 = CHAIN_ROW(to, Yy);
+		Y2 = CHAIN_ROW(to, Yy + 1);
+		Cb = CHAIN_CB_ROW(to, Yy / 2);
+		Cr = CHAIN_CR_ROW(to, Yy / 2);
+
+		Yx = ycbcr_jpeg420_row_ssse3(video, row1, row2, Y1, Y2, Cb, Cr, 0);
+		ycbcr_jpeg420_row(video, row1, row2, Y1, Y2, Cb, Cr, Yx);
+	}
+}
+
+__attribute__ ((target ("ssse3")))
+void ycbcr_bgr_to_jpeg420_half_ssse3(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				     unsigned char *from, unsigned char *to)
+{
+	unsigned char *row[4], *Y1, *Y2, *Cb, *Cr;
+	unsigned int Yy, Yx, i;
+
+	for (Yy = 0; Yy < video->yh; Yy += 2) {
+		for (i = 0; i < 4; i++)
+			row[i] = &from[(video->h - 4 - Yy * 2 + i) * video->row];
+		Y1 = &to[Yy * video->yw];
+		Y2 = &to[(Yy + 1) * video->yw];
+		Cb = &to[video->yw * video->yh + (Yy / 2) * video->cw];
+		Cr = &Cb[video->cw * video->ch];
+
+		Yx = ycbcr_jpeg420_half_row_ssse3(video, row, Y1, Y2, Cb, Cr, 0);
+		ycbcr_jpeg420_half_row(video, row, Y1, Y2, Cb, Cr, Yx);
+	}
+}
+
+/* one bilinear sample from scale map, same float math as the C loop */
+__attribute__ ((target ("ssse3")))
+static inline __m128i ycbcr_sample_ssse3(struct ycbcr_video_stream_s *video,
+					 unsigned char *from, unsigned int m)
+{
+	unsigned int *pos = &video->pos[m * 4];
+	float *factor = &video->factor[m * 4];
+	unsigned char *p;
+	__m128 sum;
+	unsigned int i;
+
+	sum = _mm_setzero_ps();
+	for (i = 0; i < 4; i++) {
+		p = &from[pos[i]];
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(_mm_setr_epi32(p[0], p[1], p[2], 0)),
+						 _mm_set1_ps(factor[i])));
+	}
+
+	return _mm_cvttps_epi32(sum);
+}
+
+__attribute__ ((target ("ssse3")))
+void ycbcr_bgr_to_jpeg420_scale_ssse3(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				      unsigned char *from, unsigned char *to)
+{
+	const __m128i coef_y = _mm_setr_epi16(YCBCR_COEF_Y, YCBCR_COEF_Y);
+	const __m128i coef_c = _mm_setr_epi16(YCBCR_COEF_Cb, YCBCR_COEF_Cr);
+	unsigned char *Y, *Cb, *Cr;
+	unsigned int Cpix, Cmap, Yy, Yx, y0, y1;
+	int out[4];
+	__m128i c, l;
+
+	Y = to;
+	Cb = &to[video->yw * video->yh];
+	Cr = &to[video->yw * video->yh + video->cw * video->ch];
+
+	Cpix = 0;
+	Cmap = video->yw * video->yh;
+
+	/* map lookups dominate, so just one block at a time */
+	for (Yy = 0; Yy < video->yh; Yy += 2) {
+		for (Yx = 0; Yx < video->yw; Yx += 2, Cpix++) {
+			y0 = Yx + Yy * video->yw;
+			y1 = y0 + video->yw;
+
+			c = ycbcr_sample_ssse3(video, from, Cmap + Cpix);
+			c = _mm_packs_epi32(c, c);
+			c = ycbcr_dot_ssse3(c, c, coef_c);
+			_mm_storeu_si128((__m128i *) out, c);
+			Cb[Cpix] = YCBCR_CLAMP(128 - out[0]);
+			Cr[Cpix] = 128 + out[1];
+
+			l = ycbcr_dot_ssse3(_mm_packs_epi32(ycbcr_sample_ssse3(video, from, y0),
+							    ycbcr_sample_ssse3(video, from, y0 + 1)),
+					    _mm_packs_epi32(ycbcr_sample_ssse3(video, from, y1),
+							    ycbcr_sample_ssse3(video, from, y1 + 1)),
+					    coef_y);
+			_mm_storeu_si128((__m128i *) out, l);
+			Y[y0] = out[0];
+			Y[y0 + 1] = out[1];
+			Y[y1] = out[2];
+			Y[y1 + 1] = out[3];
+		}
+	}
+}
+
+/* 16 pixels -> 4 vectors, lanes hold pixels 0-7 and 8-15 */
+__attribute__ ((target ("avx2")))
+static inline void ycbcr_load_avx2(struct ycbcr_video_stream_s *video,
+				   unsigned char *src, __m256i *v)
+{
+	const __m256i bgra_lo = _mm256_setr_epi8(0, -1, 1, -1, 2, -1, -1, -1,
+						 4, -1, 5, -1, 6, -1, -1, -1,
+						 0, -1, 1, -1, 2, -1, -1, -1,
+						 4, -1, 5, -1, 6, -1, -1, -1);
+	const __m256i bgra_hi = _mm256_setr_epi8(8, -1, 9, -1, 10, -1, -1, -1,
+						 12, -1, 13, -1, 14, -1, -1, -1,
+						 8, -1, 9, -1, 10, -1, -1, -1,
+						 12, -1, 13, -1, 14, -1, -1, -1);
+	const __m256i bgr_lo = _mm256_setr_epi8(0, -1, 1, -1, 2, -1, -1, -1,
+						3, -1, 4, -1, 5, -1, -1, -1,
+						0, -1, 1, -1, 2, -1, -1, -1,
+						3, -1, 4, -1, 5, -1, -1, -1);
+	const __m256i bgr_hi = _mm256_setr_epi8(6, -1, 7, -1, 8, -1, -1, -1,
+						9, -1, 10, -1, 11, -1, -1, -1,
+						6, -1, 7, -1, 8, -1, -1, -1,
+						9, -1, 10, -1, 11, -1, -1, -1);
+	const __m256i bgr_lo2 = _mm256_setr_epi8(4, -1, 5, -1, 6, -1, -1, -1,
+						 7, -1, 8, -1, 9, -1, -1, -1,
+						 4, -1, 5, -1, 6, -1, -1, -1,
+						 7, -1, 8, -1, 9, -1, -1, -1);
+	const __m256i bgr_hi2 = _mm256_setr_epi8(10, -1, 11, -1, 12, -1, -1, -1,
+						 13, -1, 14, -1, 15, -1, -1, -1,
+						 10, -1, 11, -1, 12, -1, -1, -1,
+						 13, -1, 14, -1, 15, -1, -1, -1);
+	unsigned int next = video->bpp * 8;
+	__m256i a, b;
+
+	if (video->bpp == 4) {
+		a = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((__m128i *) &src[0])),
+			_mm_loadu_si128((__m128i *) &src[next]), 1);
+		b = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((__m128i *) &src[16])),
+			_mm_loadu_si128((__m128i *) &src[next + 16]), 1);
+		v[0] = _mm256_shuffle_epi8(a, bgra_lo);
+		v[1] = _mm256_shuffle_epi8(a, bgra_hi);
+		v[2] = _mm256_shuffle_epi8(b, bgra_lo);
+		v[3] = _mm256_shuffle_epi8(b, bgra_hi);
+	} else {
+		a = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((__m128i *) &src[0])),
+			_mm_loadu_si128((__m128i *) &src[next]), 1);
+		b = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((__m128i *) &src[8])),
+			_mm_loadu_si128((__m128i *) &src[next + 8]), 1);
+		v[0] = _mm256_shuffle_epi8(a, bgr_lo);
+		v[1] = _mm256_shuffle_epi8(a, bgr_hi);
+		v[2] = _mm256_shuffle_epi8(b, bgr_lo2);
+		v[3] = _mm256_shuffle_epi8(b, bgr_hi2);
+	}
+}
+
+__attribute__ ((target ("avx2")))
+static inline __m256i ycbcr_avg_avx2(__m256i a0, __m256i a1, __m256i b0, __m256i b1)
+{
+	a0 = _mm256_add_epi16(a0, b0);
+	a1 = _mm256_add_epi16(a1, b1);
+	return _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(a0, a1),
+						  _mm256_unpackhi_epi64(a0, a1)), 2);
+}
+
+__attribute__ ((target ("avx2")))
+static inline __m256i ycbcr_dot_avx2(__m256i v0, __m256i v1, __m256i coef)
+{
+	return _mm256_srai_epi32(_mm256_hadd_epi32(_mm256_madd_epi16(v0, coef),
+						   _mm256_madd_epi16(v1, coef)), 10);
+}
+
+/* 16 pixels -> 16 Y', in order */
+__attribute__ ((target ("avx2")))
+static inline __m256i ycbcr_luma_avx2(__m256i *v)
+{
+	const __m256i coef = _mm256_setr_epi16(YCBCR_COEF_Y, YCBCR_COEF_Y,
+					       YCBCR_COEF_Y, YCBCR_COEF_Y);
+
+	return _mm256_packs_epi32(ycbcr_dot_avx2(v[0], v[1], coef),
+				  ycbcr_dot_avx2(v[2], v[3], coef));
+}
+
+/* 16 Y' and 16 Y' -> 32 bytes */
+__attribute__ ((target ("avx2")))
+static inline void ycbcr_store_luma_avx2(unsigned char *Y, __m256i a, __m256i b)
+{
+	_mm256_storeu_si256((__m256i *) Y,
+			    _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+}
+
+/* chroma pixels 0 1 | 4 5, 2 3 | 6 7, 8 9 | 12 13, 10 11 | 14 15 -> 16 Cb and 16 Cr */
+__attribute__ ((target ("avx2")))
+static inline void ycbcr_chroma_avx2(__m256i *c, unsigned char *Cb, unsigned char *Cr)
+{
+	const __m256i coef_cb = _mm256_setr_epi16(YCBCR_COEF_Cb, YCBCR_COEF_Cb,
+						  YCBCR_COEF_Cb, YCBCR_COEF_Cb);
+	const __m256i coef_cr = _mm256_setr_epi16(YCBCR_COEF_Cr, YCBCR_COEF_Cr,
+						  YCBCR_COEF_Cr, YCBCR_COEF_Cr);
+	const __m256i half = _mm256_set1_epi16(128);
+	__m256i cb, cr;
+
+	cb = _mm256_packs_epi32(ycbcr_dot_avx2(c[0], c[1], coef_cb),
+				ycbcr_dot_avx2(c[2], c[3], coef_cb));
+	cr = _mm256_packs_epi32(ycbcr_dot_avx2(c[0], c[1], coef_cr),
+				ycbcr_dot_avx2(c[2], c[3], coef_cr));
+	cb = _mm256_sub_epi16(half, _mm256_permute4x64_epi64(cb, 0xd8));
+	cr = _mm256_add_epi16(half, _mm256_permute4x64_epi64(cr, 0xd8));
+
+	cb = _mm256_permute4x64_epi64(_mm256_packus_epi16(cb, cr), 0xd8);
+	_mm_storeu_si128((__m128i *) Cb, _mm256_castsi256_si128(cb));
+	_mm_storeu_si128((__m128i *) Cr, _mm256_extracti128_si256(cb, 1));
+}
+
+__attribute__ ((target ("avx2")))
+unsigned int ycbcr_jpeg420_row_avx2(struct ycbcr_video_stream_s *video,
+				    unsigned char *row1, unsigned char *row2,
+				    unsigned char *Y1, unsigned char *Y2,
+				    unsigned char *Cb, unsigned char *Cr, unsigned int Yx)
+{
+	__m256i a[4], b[4], c[4], l1, l2;
+
+	/* 32 pixels a round */
+	for (; Yx + 32 <= video->yw; Yx += 32) {
+		ycbcr_load_avx2(video, &row1[Yx * video->bpp], a);
+		ycbcr_load_avx2(video, &row2[Yx * video->bpp], b);
+		c[0] = ycbcr_avg_avx2(a[0], a[1], b[0], b[1]);
+		c[1] = ycbcr_avg_avx2(a[2], a[3], b[2], b[3]);
+		l1 = ycbcr_luma_avx2(b);
+		l2 = ycbcr_luma_avx2(a);
+
+		ycbcr_load_avx2(video, &row1[(Yx + 16) * video->bpp], a);
+		ycbcr_load_avx2(video, &row2[(Yx + 16) * video->bpp], b);
+		c[2] = ycbcr_avg_avx2(a[0], a[1], b[0], b[1]);
+		c[3] = ycbcr_avg_avx2(a[2], a[3], b[2], b[3]);
+		ycbcr_store_luma_avx2(&Y1[Yx], l1, ycbcr_luma_avx2(b));
+		ycbcr_store_luma_avx2(&Y2[Yx], l2, ycbcr_luma_avx2(a));
+
+		ycbcr_chroma_avx2(c, &Cb[Yx / 2], &Cr[Yx / 2]);
+	}
+
+	return ycbcr_jpeg420_row_ssse3(video, row1, row2, Y1, Y2, Cb, Cr, Yx);
+}
+
+/* 32 pixels on two rows -> averaged pixels 0 1 | 4 5, 2 3 | 6 7, 8 9 | 12 13, 10 11 | 14 15 */
+__attribute__ ((target ("avx2")))
+static inline void ycbcr_half_avx2(struct ycbcr_video_stream_s *video,
+				   unsigned char *row1, unsigned char *row2, __m256i *v)
+{
+	__m256i a[4], b[4];
+
+	ycbcr_load_avx2(video, row1, a);
+	ycbcr_load_avx2(video, row2, b);
+	v[0] = ycbcr_avg_avx2(a[0], a[1], b[0], b[1]);
+	v[1] = ycbcr_avg_avx2(a[2], a[3], b[2], b[3]);
+	ycbcr_load_avx2(video, &row1[16 * video->bpp], a);
+	ycbcr_load_avx2(video, &row2[16 * video->bpp], b);
+	v[2] = ycbcr_avg_avx2(a[0], a[1], b[0], b[1]);
+	v[3] = ycbcr_avg_avx2(a[2], a[3], b[2], b[3]);
+}
+
+__attribute__ ((target ("avx2")))
+unsigned int ycbcr_jpeg420_half_row_avx2(struct ycbcr_video_stream_s *video,
+					 unsigned char **row,
+					 unsigned char *Y1, unsigned char *Y2,
+					 unsigned char *Cb, unsigned char *Cr,
+					 unsigned int Yx)
+{
+	__m256i v[4], w[4], c[4];
+	unsigned int x;
+
+	/* 32 Y' a round */
+	for (; (Yx + 32 <= video->yw) && (Yx * 2 + 65 <= video->w); Yx += 32) {
+		x = Yx * 2 * video->bpp;
+
+		ycbcr_half_avx2(video, &row[2][x], &row[3][x], v);
+		ycbcr_half_avx2(video, &row[2][x + 32 * video->bpp],
+				&row[3][x + 32 * video->bpp], w);
+		ycbcr_store_luma_avx2(&Y1[Yx],
+				      _mm256_permute4x64_epi64(ycbcr_luma_avx2(v), 0xd8),
+				      _mm256_permute4x64_epi64(ycbcr_luma_avx2(w), 0xd8));
+
+		ycbcr_half_avx2(video, &row[0][x], &row[1][x], v);
+		ycbcr_half_avx2(video, &row[0][x + 32 * video->bpp],
+				&row[1][x + 32 * video->bpp], w);
+		ycbcr_store_luma_avx2(&Y2[Yx],
+				      _mm256_permute4x64_epi64(ycbcr_luma_avx2(v), 0xd8),
+				      _mm256_permute4x64_epi64(ycbcr_luma_avx2(w), 0xd8));
+
+		x += video->bpp;
+		ycbcr_half_avx2(video, &row[1][x], &row[2][x], v);
+		ycbcr_half_avx2(video, &row[1][x + 32 * video->bpp],
+				&row[2][x + 32 * video->bpp], w);
+		v[0] = _mm256_unpacklo_epi64(v[0], v[1]);
+		v[1] = _mm256_unpacklo_epi64(v[2], v[3]);
+		w[0] = _mm256_unpacklo_epi64(w[0], w[1]);
+		w[1] = _mm256_unpacklo_epi64(w[2], w[3]);
+		c[0] = _mm256_permute2x128_si256(v[0], v[1], 0x20);
+		c[1] = _mm256_permute2x128_si256(v[0], v[1], 0x31);
+		c[2] = _mm256_permute2x128_si256(w[0], w[1], 0x20);
+		c[3] = _mm256_permute2x128_si256(w[0], w[1], 0x31);
+		ycbcr_chroma_avx2(c, &Cb[Yx / 2], &Cr[Yx / 2]);
+	}
+
+	return ycbcr_jpeg420_half_row_ssse3(video, row, Y1, Y2, Cb, Cr, Yx);
+}
+
+__attribute__ ((target ("avx2")))
+void ycbcr_bgr_to_jpeg420_rows_avx2(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    chain_rows_t *from, chain_rows_t *to,
+				    unsigned int y, unsigned int rows)
+{
+	unsigned char *row1, *row2, *Y1, *Y2, *Cb, *Cr;
+	unsigned int Yy, Yx;
+
+	for (Yy = y; Yy < y + rows; Yy += 2) {
+		row1 = CHAIN_ROW(from, video->h - 2 - Yy);
+		row2 = CHAIN_ROW(from, video->h - 1 - Yy);
+		Y1 = CHAIN_ROW(to, Yy);
+		Y2 = CHAIN_ROW(to, Yy + 1);
+		Cb = CHAIN_CB_ROW(to, Yy / 2);
+		Cr = CHAIN_CR_ROW(to, Yy / 2);
+
+		Yx = ycbcr_jpeg420_row_avx2(video, row1, row2, Y1, Y2, Cb, Cr, 0);
+		ycbcr_jpeg420_row(video, row1, row2, Y1, Y2, Cb, Cr, Yx);
+	}
+}
+
+__attribute__ ((target ("avx2")))
+void ycbcr_bgr_to_jpeg420_half_avx2(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    unsigned char *from, unsigned char *to)
+{
+	unsigned char *row[4], *Y1, *Y2, *Cb, *Cr;
+	unsigned int Yy, Yx, i;
+
+	for (Yy = 0; Yy < video->yh; Yy += 2) {
+		for (i = 0; i < 4; i++)
+			row[i] = &from[(video->h - 4 - Yy * 2 + i) * video->row];
+		Y1 = &to[Yy * video->yw];
+		Y2 = &to[(Yy + 1) * video->yw];
+		Cb = &to[video->yw * video->yh + (Yy / 2) * video->cw];
+		Cr = &Cb[video->cw * video->ch];
+
+		Yx = ycbcr_jpeg420_half_row_avx2(video, row, Y1, Y2, Cb, Cr, 0);
+		ycbcr_jpeg420_half_row(video, row, Y1, Y2, Cb, Cr, Yx);
+	}
+}
+
+#undef YCBCR_COEF_Y
+#undef YCBCR_COEF_Cb
+#undef YCBCR_COEF_Cr
+
+__attribute__ ((target ("sse2")))
+void ycbcr_interleave_sse2(unsigned char *Cb, unsigned char *Cr,
+			   unsigned char *CbCr, unsigned int n)
+{
+	__m128i cb, cr;
+	unsigned int x;
+
+	for (x = 0; x + 16 <= n; x += 16) {
+		cb = _mm_loadu_si128((__m128i *) &Cb[x]);
+		cr = _mm_loadu_si128((__m128i *) &Cr[x]);
+		_mm_storeu_si128((__m128i *) &CbCr[x * 2], _mm_unpacklo_epi8(cb, cr));
+		_mm_storeu_si128((__m128i *) &CbCr[x * 2 + 16], _mm_unpackhi_epi8(cb, cr));
+	}
+
+	ycbcr_interleave(&Cb[x], &Cr[x], &CbCr[x * 2], n - x);
+}
+
+#endif /* YCBCR_X86 */
+
+#ifdef __ARM_NEON
+
+static inline uint8x8_t ycbcr_luma_neon(uint16x8_t b, uint16x8_t g, uint16x8_t r)
+{
+	uint32x4_t lo, hi;
+
+	lo = vmull_n_u16(vget_low_u16(r), 306);
+	lo = vmlal_n_u16(lo, vget_low_u16(g), 601);
+	lo = vmlal_n_u16(lo, vget_low_u16(b), 117);
+	hi = vmull_n_u16(vget_high_u16(r), 306);
+	hi = vmlal_n_u16(hi, vget_high_u16(g), 601);
+	hi = vmlal_n_u16(hi, vget_high_u16(b), 117);
+
+	return vmovn_u16(vcombine_u16(vshrn_n_u32(lo, 10), vshrn_n_u32(hi, 10)));
+}
+
+/* 8 averaged pixels -> 8 Cb and 8 Cr */
+static inline void ycbcr_chroma_neon(uint16x8_t b, uint16x8_t g, uint16x8_t r,
+				     unsigned char *Cb, unsigned char *Cr)
+{
+	int16x8_t sb = vreinterpretq_s16_u16(b);
+	int16x8_t sg = vreinterpretq_s16_u16(g);
+	int16x8_t sr = vreinterpretq_s16_u16(r);
+	const int16x8_t half = vdupq_n_s16(128);
+	int32x4_t lo, hi;
+
+	lo = vmull_n_s16(vget_low_s16(sr), 173);
+	lo = vmlal_n_s16(lo, vget_low_s16(sg), 339);
+	lo = vmlsl_n_s16(lo, vget_low_s16(sb), 512);
+	hi = vmull_n_s16(vget_high_s16(sr), 173);
+	hi = vmlal_n_s16(hi, vget_high_s16(sg), 339);
+	hi = vmlsl_n_s16(hi, vget_high_s16(sb), 512);
+	vst1_u8(Cb, vqmovun_s16(vsubq_s16(half, vcombine_s16(vshrn_n_s32(lo, 10),
+							     vshrn_n_s32(hi, 10)))));
+
+	lo = vmull_n_s16(vget_low_s16(sr), 512);
+	lo = vmlsl_n_s16(lo, vget_low_s16(sg), 429);
+	lo = vmlsl_n_s16(lo, vget_low_s16(sb), 83);
+	hi = vmull_n_s16(vget_high_s16(sr), 512);
+	hi = vmlsl_n_s16(hi, vget_high_s16(sg), 429);
+	hi = vmlsl_n_s16(hi, vget_high_s16(sb), 83);
+	vst1_u8(Cr, vqmovun_s16(vaddq_s16(half, vcombine_s16(vshrn_n_s32(lo, 10),
+							     vshrn_n_s32(hi, 10)))));
+}
+
+/* 16 pixels, channels deinterleaved */
+static inline uint8x16x3_t ycbcr_load_neon(struct ycbcr_video_stream_s *video,
+					   unsigned char *src)
+{
+	uint8x16x4_t in4;
+	uint8x16x3_t in;
+
+	if (video->bpp == 4) {
+		in4 = vld4q_u8(src);
+		in.val[0] = in4.val[0];
+		in.val[1] = in4.val[1];
+		in.val[2] = in4.val[2];
+	} else
+		in = vld3q_u8(src);
+
+	return in;
+}
+
+/* 16 + 16 pixels, two rows -> 8 averaged pixels */
+static inline uint16x8_t ycbcr_avg_neon(uint8x16_t a, uint8x16_t b)
+{
+	return vshrq_n_u16(vpadalq_u8(vpaddlq_u8(a), b), 2);
+}
+
+unsigned int ycbcr_jpeg420_row_neon(struct ycbcr_video_stream_s *video,
+				    unsigned char *row1, unsigned char *row2,
+				    unsigned char *Y1, unsigned char *Y2,
+				    unsigned char *Cb, unsigned char *Cr, unsigned int Yx)
+{
+	uint8x16x3_t a, b;
+	uint16x8_t avg[3];
+	unsigned int c;
+
+	/* 16 pixels a round */
+	for (; Yx + 16 <= video->yw; Yx += 16) {
+		a = ycbcr_load_neon(video, &row1[Yx * video->bpp]);
+		b = ycbcr_load_neon(video, &row2[Yx * video->bpp]);
+
+		vst1q_u8(&Y1[Yx], vcombine_u8(
+			ycbcr_luma_neon(vmovl_u8(vget_low_u8(b.val[0])),
+					vmovl_u8(vget_low_u8(b.val[1])),
+					vmovl_u8(vget_low_u8(b.val[2]))),
+			ycbcr_luma_neon(vmovl_u8(vget_high_u8(b.val[0])),
+					vmovl_u8(vget_high_u8(b.val[1])),
+					vmovl_u8(vget_high_u8(b.val[2])))));
+		vst1q_u8(&Y2[Yx], vcombine_u8(
+			ycbcr_luma_neon(vmovl_u8(vget_low_u8(a.val[0])),
+					vmovl_u8(vget_low_u8(a.val[1])),
+					vmovl_u8(vget_low_u8(a.val[2]))),
+			ycbcr_luma_neon(vmovl_u8(vget_high_u8(a.val[0])),
+					vmovl_u8(vget_high_u8(a.val[1])),
+					vmovl_u8(vget_high_u8(a.val[2])))));
+
+		for (c = 0; c < 3; c++)
+			avg[c] = ycbcr_avg_neon(a.val[c], b.val[c]);
+		ycbcr_chroma_neon(avg[0], avg[1], avg[2], &Cb[Yx / 2], &Cr[Yx / 2]);
+	}
+
+	return Yx;
+}
+
+unsigned int ycbcr_jpeg420_half_row_neon(struct ycbcr_video_stream_s *video,
+					 unsigned char **row,
+					 unsigned char *Y1, unsigned char *Y2,
+					 unsigned char *Cb, unsigned char *Cr,
+					 unsigned int Yx)
+{
+	uint8x16x3_t a, b;
+	uint16x8_t lo[3], hi[3];
+	unsigned int x, c, i;
+	unsigned char *dst;
+
+	/* 16 Y' a round, chroma reads one pixel further */
+	for (; (Yx + 16 <= video->yw) && (Yx * 2 + 33 <= video->w); Yx += 16) {
+		for (i = 0; i < 2; i++) {
+			x = Yx * 2 * video->bpp;
+			dst = i ? &Y2[Yx] : &Y1[Yx];
+
+			a = ycbcr_load_neon(video, &row[i ? 0 : 2][x]);
+			b = ycbcr_load_neon(video, &row[i ? 1 : 3][x]);
+			for (c = 0; c < 3; c++)
+				lo[c] = ycbcr_avg_neon(a.val[c], b.val[c]);
+			a = ycbcr_load_neon(video, &row[i ? 0 : 2][x + 16 * video->bpp]);
+			b = ycbcr_load_neon(video, &row[i ? 1 : 3][x + 16 * video->bpp]);
+			for (c = 0; c < 3; c++)
+				hi[c] = ycbcr_avg_neon(a.val[c], b.val[c]);
+
+			vst1q_u8(dst, vcombine_u8(ycbcr_luma_neon(lo[0], lo[1], lo[2]),
+						  ycbcr_luma_neon(hi[0], hi[1], hi[2])));
+		}
+
+		/* only every other pair of pixels is a chroma sample */
+		x = (Yx * 2 + 1) * video->bpp;
+		a = ycbcr_load_neon(video, &row[1][x]);
+		b = ycbcr_load_neon(video, &row[2][x]);
+		for (c = 0; c < 3; c++)
+			lo[c] = ycbcr_avg_neon(a.val[c], b.val[c]);
+		a = ycbcr_load_neon(video, &row[1][x + 16 * video->bpp]);
+		b = ycbcr_load_neon(video, &row[2][x + 16 * video->bpp]);
+		for (c = 0; c < 3; c++)
+			lo[c] = vuzpq_u16(lo[c], ycbcr_avg_neon(a.val[c], b.val[c])).val[0];
+
+		ycbcr_chroma_neon(lo[0], lo[1], lo[2], &Cb[Yx / 2], &Cr[Yx / 2]);
+	}
+
+	return Yx;
+}
+
+void ycbcr_bgr_to_jpeg420_rows_neon(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    chain_rows_t *from, chain_rows_t *to,
+				    unsigned int y, unsigned int rows)
+{
+	unsigned char *row1, *row2, *Y1, *Y2, *Cb, *Cr;
+	unsigned int Yy, Yx;
+
+	for (Yy = y; Yy < y + rows; Yy += 2) {
+		row1 = CHAIN_ROW(from, video->h - 2 - Yy);
+		row2 = CHAIN_ROW(from, video->h - 1 - Yy);
+		Y1 = CHAIN_ROW(to, Yy);
+		Y2 = CHAIN_ROW(to, Yy + 1);
+		Cb = CHAIN_CB_ROW(to, Yy / 2);
+		Cr = CHAIN_CR_ROW(to, Yy / 2);
+
+		Yx = ycbcr_jpeg420_row_neon(video, row1, row2, Y1, Y2, Cb, Cr, 0);
+		ycbcr_jpeg420_row(video, row1, row2, Y1, Y2, Cb, Cr, Yx);
+	}
+}
+
+void ycbcr_bgr_to_jpeg420_half_neon(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    unsigned char *from, unsigned char *to)
+{
+	unsigned char *row[4], *Y1, *Y2, *Cb, *Cr;
+	unsigned int Yy, Yx, i;
+
+	for (Yy = 0; Yy < video->yh; Yy += 2) {
+		for (i = 0; i < 4; i++)
+			row[i] = &from[(video->h - 4 - Yy * 2 + i) * video->row];
+		Y1 = &to[Yy * video->yw];
+		Y2 = &to[(Yy + 1) * video->yw];
+		Cb = &to[video->yw * video->yh + (Yy / 2) * video->cw];
+		Cr = &Cb[video->cw * video->ch];
+
+		Yx = ycbcr_jpeg420_half_row_neon(video, row, Y1, Y2, Cb, Cr, 0);
+		ycbcr_jpeg420_half_row(video, row, Y1, Y2, Cb, Cr, Yx);
+	}
+}
+
+void ycbcr_interleave_neon(unsigned char *Cb, unsigned char *Cr,
+			   unsigned char *CbCr, unsigned int n)
+{
+	uint8x16x2_t out;
+	unsigned int x;
+
+	for (x = 0; x + 16 <= n; x += 16) {
+		out.val[0] = vld1q_u8(&Cb[x]);
+		out.val[1] = vld1q_u8(&Cr[x]);
+		vst2q_u8(&CbCr[x * 2], out);
+	}
+
+	ycbcr_interleave(&Cb[x], &Cr[x], &CbCr[x * 2], n - x);
+}
+
+#endif /* __ARM_NEON */
+
 int ycbcr_video_format_message(ycbcr_t ycbcr, glc_video_format_message_t *video_format)
 {
 	struct ycbcr_video_stream_s *video;
+	int ret;
 
-	ycbcr_get_video_stream(ycbcr, video_format->id, &video);
+	if ((ret = ycbcr_get_video_stream(ycbcr, video_format->id, &video)))
+		return ret;
 	pthread_rwlock_wrlock(&video->update);
 
 	if (video_format->format == GLC_VIDEO_BGRA)
 		video->bpp = 4;
 	else if (video_format->format == GLC_VIDEO_BGR)
 		video->bpp = 3;
-	else {
+	else if ((video_format->format == GLC_VIDEO_YCBCR_420JPEG) &&
+		 (ycbcr->format == GLC_VIDEO_NV12)) {
+		/* already Y'CbCr, only chroma is interleaved */
+		video->bpp = 0;
+		video->w = video->yw = video_format->width;
+		video->h = video->yh = video_format->height;
+		video->cw = video->yw / 2;
+		video->ch = video->yh / 2;
+		video->row = video->w;
+		video->scale = 1.0;
+
+		video_format->format = video->format = GLC_VIDEO_NV12;
+		video->convert = &ycbcr_jpeg420_to_nv12;
+		video->size = video->yw * video->yh + 2 * (video->cw * video->ch);
+		ycbcr_simd(ycbcr, video);
+
+		pthread_rwlock_unlock(&video->update);
+		return 0;
+	} else {
 		video->convert = NULL;
 		pthread_rwlock_unlock(&video->update);
 		return 0;
 	}
 
-	video->w = video_format->width;
-	video->h = video_format->height;
-
-	video->row = video->w * video->bpp;
-
-	if (video_format->flags & GLC_VIDEO_DWORD_ALIGNED) {
-		if (video->row % 8 != 0)
-			video->row += 8 - video->row % 8;
-	}
-
-	video->scale = ycbcr->scale;
-	video->yw = video->w * video->scale;
-	video->yh = video->h * video->scale;
-	video->yw -= video->yw % 2; /* safer and faster             */
-	video->yh -= video->yh % 2; /* but we might drop a pixel... */
-
-	video->cw = video->yw / 2;
-	video->ch = video->yh / 2;
+	ycbcr_video_geometry(ycbcr, video, video_format->width, video_format->height,
+			     video_format->flags & GLC_VIDEO_DWORD_ALIGNED);
 
 	/* nuke old flags */
 	video_format->flags &= ~GLC_VIDEO_DWORD_ALIGNED;
-	video_format->format = GLC_VIDEO_YCBCR_420JPEG;
+	video_format->format = video->format = ycbcr->format;
 	video_format->width = video->yw;
 	video_format->height = video->yh;
 
@@ -473,11 +1713,173 @@ int ycbcr_video_format_message(ycbcr_t ycbcr, glc_video_format_message_t *video_
 	}
 
 	video->size = video->yw * video->yh + 2 * (video->cw * video->ch);
+	ycbcr_simd(ycbcr, video);
 
 	pthread_rwlock_unlock(&video->update);
 	return 0;
 }
 
+void ycbcr_video_geometry(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+			  unsigned int width, unsigned int height, int aligned)
+{
+	video->w = width;
+	video->h = height;
+
+	video->row = video->w * video->bpp;
+
+	if (aligned) {
+		if (video->row % 8 != 0)
+			video->row += 8 - video->row % 8;
+	}
+
+	video->scale = ycbcr->scale;
+	video->yw = video->w * video->scale;
+	video->yh = video->h * video->scale;
+	video->yw -= video->yw % 2; /* safer and faster             */
+	video->yh -= video->yh % 2; /* but we might drop a pixel... */
+
+	video->cw = video->yw / 2;
+	video->ch = video->yh / 2;
+}
+
+int ycbcr_check(ycbcr_t ycbcr, glc_video_format_t format,
+		unsigned int width, unsigned int height, int tolerance)
+{
+	struct ycbcr_video_stream_s video;
+	glc_flags_t cpu = glc_cpu_features(ycbcr->glc);
+	unsigned char *from = NULL, *to = NULL, *expected = NULL;
+	unsigned int seed = width * 65521 + height;
+	size_t i, size;
+	int ret = 0;
+
+	if ((format != GLC_VIDEO_BGR) && (format != GLC_VIDEO_BGRA))
+		return EINVAL;
+
+	memset(&video, 0, sizeof(struct ycbcr_video_stream_s));
+	video.bpp = (format == GLC_VIDEO_BGRA) ? 4 : 3;
+	/* odd row lengths are the interesting case, so no alignment */
+	ycbcr_video_geometry(ycbcr, &video, width, height, 0);
+	if ((!video.yw) | (!video.yh))
+		return EINVAL;
+	video.format = GLC_VIDEO_YCBCR_420JPEG;
+	video.size = video.yw * video.yh + 2 * (video.cw * video.ch);
+
+	if (video.scale == 1.0)
+		video.convert = &ycbcr_bgr_to_jpeg420;
+	else if (video.scale == 0.5)
+		video.convert = &ycbcr_bgr_to_jpeg420_half;
+	else {
+		video.convert = &ycbcr_bgr_to_jpeg420_scale;
+		if ((ret = ycbcr_generate_map(ycbcr, &video)))
+			return ret;
+	}
+
+	size = video.row * video.h;
+	from = malloc(size);
+	to = malloc(video.size);
+	expected = malloc(video.size);
+	if ((!from) | (!to) | (!expected)) {
+		ret = ENOMEM;
+		goto finish;
+	}
+
+	for (i = 0; i < size; i++)
+		from[i] = rand_r(&seed);
+
+	/* plain C kernel is the reference */
+	if (video.convert == &ycbcr_bgr_to_jpeg420)
+		video.rows = (video.bpp == 4) ? &ycbcr_bgr_to_jpeg420_rows_bgra :
+						&ycbcr_bgr_to_jpeg420_rows_bgr;
+	video.convert(ycbcr, &video, from, expected);
+
+#ifdef YCBCR_X86
+	if (video.convert == &ycbcr_bgr_to_jpeg420) {
+		if ((!ret) && (cpu & GLC_CPU_SSSE3)) {
+			video.rows = &ycbcr_bgr_to_jpeg420_rows_ssse3;
+			ret = ycbcr_check_kernel(ycbcr, &video, "rows_ssse3",
+						 from, to, expected, tolerance);
+		}
+		if ((!ret) && (cpu & GLC_CPU_AVX2)) {
+			video.rows = &ycbcr_bgr_to_jpeg420_rows_avx2;
+			ret = ycbcr_check_kernel(ycbcr, &video, "rows_avx2",
+						 from, to, expected, tolerance);
+		}
+	} else if (video.convert == &ycbcr_bgr_to_jpeg420_half) {
+		if ((!ret) && (cpu & GLC_CPU_SSSE3)) {
+			video.kernel = &ycbcr_bgr_to_jpeg420_half_ssse3;
+			ret = ycbcr_check_kernel(ycbcr, &video, "half_ssse3",
+						 from, to, expected, tolerance);
+		}
+		if ((!ret) && (cpu & GLC_CPU_AVX2)) {
+			video.kernel = &ycbcr_bgr_to_jpeg420_half_avx2;
+			ret = ycbcr_check_kernel(ycbcr, &video, "half_avx2",
+						 from, to, expected, tolerance);
+		}
+	} else if ((!ret) && (cpu & GLC_CPU_SSSE3)) {
+		video.kernel = &ycbcr_bgr_to_jpeg420_scale_ssse3;
+		ret = ycbcr_check_kernel(ycbcr, &video, "scale_ssse3",
+					 from, to, expected, tolerance);
+	}
+#endif
+
+#ifdef __ARM_NEON
+	if (cpu & GLC_CPU_NEON) {
+		if (video.convert == &ycbcr_bgr_to_jpeg420) {
+			video.rows = &ycbcr_bgr_to_jpeg420_rows_neon;
+			ret = ycbcr_check_kernel(ycbcr, &video, "rows_neon",
+						 from, to, expected, tolerance);
+		} else if (video.convert == &ycbcr_bgr_to_jpeg420_half) {
+			video.kernel = &ycbcr_bgr_to_jpeg420_half_neon;
+			ret = ycbcr_check_kernel(ycbcr, &video, "half_neon",
+						 from, to, expected, tolerance);
+		}
+	}
+#endif
+
+finish:
+	if (from)
+		free(from);
+	if (to)
+		free(to);
+	if (expected)
+		free(expected);
+	if (video.pos)
+		free(video.pos);
+	if (video.factor)
+		free(video.factor);
+	return ret;
+}
+
+int ycbcr_check_kernel(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+		       const char *name, unsigned char *from, unsigned char *to,
+		       unsigned char *expected, int tolerance)
+{
+	size_t i;
+	int diff;
+
+	/* banded kernels go through rows, others are called directly */
+	memset(to, 0, video->size);
+	if (video->convert == &ycbcr_bgr_to_jpeg420)
+		video->convert(ycbcr, video, from, to);
+	else
+		video->kernel(ycbcr, video, from, to);
+
+	for (i = 0; i < video->size; i++) {
+		diff = abs((int) to[i] - (int) expected[i]);
+		if (diff > tolerance) {
+			glc_log(ycbcr->glc, GLC_ERROR, "ycbcr",
+				 "%s: %ux%u %s sample %zu is %d, C kernel gives %d",
+				 name, video->w, video->h, (video->bpp == 4) ? "BGRA" : "BGR",
+				 i, to[i], expected[i]);
+			return EDOM;
+		}
+	}
+
+	glc_log(ycbcr->glc, GLC_DEBUG, "ycbcr", "%s: %ux%u %s matches C kernel",
+		 name, video->w, video->h, (video->bpp == 4) ? "BGRA" : "BGR");
+	return 0;
+}
+
 /**
  * \todo smaller map is sometimes possible, should inflict better
  *       cache utilization => implement
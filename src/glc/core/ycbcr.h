@@ -17,6 +17,7 @@
 #define _YCBCR_H
 
 #include <glc/common/glc.h>
+#include <glc/core/chain.h>
 #include <packetstream.h>
 
 #ifdef __cplusplus
@@ -44,11 +45,23 @@ __PUBLIC int ycbcr_init(ycbcr_t *ycbcr, glc_t *glc);
  */
 __PUBLIC int ycbcr_set_scale(ycbcr_t ycbcr, double scale);
 
+/**
+ * \brief set output format
+ *
+ * GLC_VIDEO_NV12 output is meant for hardware encoders. Y'CbCr
+ * 420JPEG pictures are then converted to NV12 too. Default is
+ * GLC_VIDEO_YCBCR_420JPEG.
+ * \param ycbcr ycbcr object
+ * \param format GLC_VIDEO_YCBCR_420JPEG or GLC_VIDEO_NV12
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ycbcr_set_format(ycbcr_t ycbcr, glc_video_format_t format);
+
 /**
  * \brief process data and transfer between buffers
  *
  * ycbcr process converts all BGR and BGRA frames into
- * YCBCR_420JPEG and optionally does rescaling. Downscaling
+ * YCBCR_420JPEG or NV12 and optionally does rescaling. Downscaling
  * is cheap operation and mostly makes actual conversion much
  * faster since smaller amount of data has to be converted.
  *
@@ -69,6 +82,34 @@ __PUBLIC int ycbcr_process_start(ycbcr_t ycbcr, ps_buffer_t *from,
  */
 __PUBLIC int ycbcr_process_wait(ycbcr_t ycbcr);
 
+/**
+ * \brief get ycbcr filter for chain
+ *
+ * ycbcr must not be started on its own if it is used in a chain.
+ * Scaled conversion is done a whole picture at a time.
+ * \param ycbcr ycbcr object
+ * \param filter filter vtable is written here
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ycbcr_filter(ycbcr_t ycbcr, chain_filter_t *filter);
+
+/**
+ * \brief compare vector kernels against C kernel
+ *
+ * Converts a pseudo-random BGR or BGRA picture at current scale with
+ * the C kernel and with every vector kernel the CPU supports, and
+ * compares the Y'CbCr samples. Mismatches are logged.
+ * \param ycbcr ycbcr object
+ * \param format GLC_VIDEO_BGR or GLC_VIDEO_BGRA
+ * \param width picture width
+ * \param height picture height
+ * \param tolerance largest allowed difference per sample
+ * \return 0 if kernels agree, EDOM if a sample differs more than
+ *         tolerance, otherwise an error code
+ */
+__PUBLIC int ycbcr_check(ycbcr_t ycbcr, glc_video_format_t format,
+			 unsigned int width, unsigned int height, int tolerance);
+
 /**
  * \brief destroy ycbcr object
  * \param ycbcr ycbcr object to destroy
@@ -0,0 +1,743 @@
+/**
+ * \file glc/export/encode.c
+ * \brief in-process encoder
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup encode
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <packetstream.h>
+#include <errno.h>
+
+#include <glc/common/glc.h>
+#include <glc/common/core.h>
+#include <glc/common/log.h>
+#include <glc/common/thread.h>
+
+#ifdef __LIBAV
+# include <libavformat/avformat.h>
+# include <libavcodec/avcodec.h>
+# include <libavutil/channel_layout.h>
+# include <libavutil/imgutils.h>
+# include <libswresample/swresample.h>
+#endif
+
+#include "encode.h"
+
+/** audio bitrate in bit/s */
+#define ENCODE_AUDIO_BITRATE      192000
+/** samples per frame for encoders that accept any frame size */
+#define ENCODE_AUDIO_FRAME          1024
+
+#ifdef __LIBAV
+struct encode_video_s {
+	int configured;
+	glc_video_format_t format;
+	unsigned int width, height;
+
+	AVStream *stream;
+	AVCodecContext *ctx;
+	AVFrame *frame;
+	int64_t pts;
+	int have_frame;
+};
+
+struct encode_audio_s {
+	int configured, changed;
+	glc_audio_format_t format;
+	glc_flags_t flags;
+	unsigned int rate, channels;
+
+	AVStream *stream;
+	AVCodecContext *ctx;
+	AVFrame *frame;
+	SwrContext *swr;
+	const uint8_t **planes;
+	int64_t pts;
+	int started;
+
+	int32_t *s24;
+	size_t s24_size;
+};
+#endif
+
+struct encode_s {
+	glc_t *glc;
+	glc_thread_t thread;
+	int running;
+
+	unsigned int file_count;
+	const char *filename_format;
+	glc_stream_id_t video_id, audio_id;
+	glc_utime_t start_time;
+	double fps;
+
+	const char *codec, *audio_codec, *preset;
+	int quality;
+	unsigned int bitrate, threads;
+
+#ifdef __LIBAV
+	AVFormatContext *out;
+	AVPacket *packet;
+	int header;
+	struct encode_video_s video;
+	struct encode_audio_s audio;
+#endif
+};
+
+#ifdef __LIBAV
+int encode_read_callback(glc_thread_state_t *state);
+void encode_finish_callback(void *priv, int err);
+
+int encode_averror(encode_t encode, const char *what, int err);
+int encode_open(encode_t encode);
+int encode_open_video(encode_t encode);
+int encode_open_audio(encode_t encode);
+int encode_close(encode_t encode);
+int encode_send(encode_t encode, AVCodecContext *ctx, AVStream *stream, AVFrame *frame);
+
+int encode_video_format_message(encode_t encode, glc_video_format_message_t *format_message);
+int encode_video_frame_message(encode_t encode, glc_video_frame_header_t *pic_header, char *data);
+int encode_audio_format_message(encode_t encode, glc_audio_format_message_t *format_message);
+int encode_audio_data_message(encode_t encode, glc_audio_data_header_t *audio_header, char *data);
+int encode_audio_frames(encode_t encode, int flush);
+#endif
+
+int encode_init(encode_t *encode, glc_t *glc)
+{
+	*encode = (encode_t) malloc(sizeof(struct encode_s));
+	memset(*encode, 0, sizeof(struct encode_s));
+
+	(*encode)->glc = glc;
+	(*encode)->fps = 30;
+	(*encode)->filename_format = "video%02d.mkv";
+	(*encode)->video_id = 1;
+	(*encode)->audio_id = 1;
+	(*encode)->codec = "libx264";
+	(*encode)->quality = 23;
+
+#ifdef __LIBAV
+	(*encode)->thread.flags = GLC_THREAD_READ;
+	(*encode)->thread.ptr = *encode;
+	(*encode)->thread.read_callback = &encode_read_callback;
+	(*encode)->thread.finish_callback = &encode_finish_callback;
+	(*encode)->thread.threads = 1;
+	(*encode)->thread.name = "encode";
+#endif
+
+	return 0;
+}
+
+int encode_destroy(encode_t encode)
+{
+	free(encode);
+	return 0;
+}
+
+int encode_set_filename(encode_t encode, const char *filename)
+{
+	encode->filename_format = filename;
+	return 0;
+}
+
+int encode_set_video_id(encode_t encode, glc_stream_id_t id)
+{
+	encode->video_id = id;
+	return 0;
+}
+
+int encode_set_audio_id(encode_t encode, glc_stream_id_t id)
+{
+	encode->audio_id = id;
+	return 0;
+}
+
+int encode_set_start_time(encode_t encode, glc_utime_t time)
+{
+	encode->start_time = time;
+	return 0;
+}
+
+int encode_set_fps(encode_t encode, double fps)
+{
+	if (fps <= 0)
+		return EINVAL;
+	encode->fps = fps;
+	return 0;
+}
+
+int encode_set_codec(encode_t encode, const char *video, const char *audio)
+{
+	if (video == NULL)
+		return EINVAL;
+	encode->codec = video;
+	encode->audio_codec = audio;
+	return 0;
+}
+
+int encode_set_preset(encode_t encode, const char *preset)
+{
+	encode->preset = preset;
+	return 0;
+}
+
+int encode_set_quality(encode_t encode, int quality)
+{
+	encode->quality = quality;
+	return 0;
+}
+
+int encode_set_bitrate(encode_t encode, unsigned int bitrate)
+{
+	encode->bitrate = bitrate;
+	return 0;
+}
+
+int encode_set_threads(encode_t encode, unsigned int threads)
+{
+	encode->threads = threads;
+	return 0;
+}
+
+int encode_process_start(encode_t encode, ps_buffer_t *from)
+{
+#ifdef __LIBAV
+	int ret;
+	if (encode->running)
+		return EAGAIN;
+
+	if ((ret = glc_thread_create(encode->glc, &encode->thread, from, NULL)))
+		return ret;
+	encode->running = 1;
+
+	return 0;
+#else
+	glc_log(encode->glc, GLC_ERROR, "encode", "glc was built without libavcodec");
+	return ENOTSUP;
+#endif
+}
+
+int encode_process_wait(encode_t encode)
+{
+	if (!encode->running)
+		return EAGAIN;
+
+	glc_thread_wait(&encode->thread);
+	encode->running = 0;
+
+	return 0;
+}
+
+#ifdef __LIBAV
+void encode_finish_callback(void *priv, int err)
+{
+	encode_t encode = (encode_t) priv;
+
+	if (err)
+		glc_log(encode->glc, GLC_ERROR, "encode", "%s (%d)", strerror(err), err);
+
+	/* write what was encoded even if stream was cut */
+	encode_close(encode);
+
+	if (encode->audio.s24) {
+		free(encode->audio.s24);
+		encode->audio.s24 = NULL;
+		encode->audio.s24_size = 0;
+	}
+
+	encode->video.configured = encode->audio.configured = 0;
+	encode->file_count = 0;
+}
+
+int encode_read_callback(glc_thread_state_t *state)
+{
+	encode_t encode = (encode_t) state->ptr;
+
+	if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
+		return encode_video_format_message(encode, (glc_video_format_message_t *) state->read_data);
+	else if (state->header.type == GLC_MESSAGE_VIDEO_FRAME)
+		return encode_video_frame_message(encode, (glc_video_frame_header_t *) state->read_data,
+						  &state->read_data[sizeof(glc_video_frame_header_t)]);
+	else if (state->header.type == GLC_MESSAGE_VIDEO_REPEAT)
+		return encode_video_frame_message(encode, (glc_video_frame_header_t *) state->read_data, NULL);
+	else if (state->header.type == GLC_MESSAGE_AUDIO_FORMAT)
+		return encode_audio_format_message(encode, (glc_audio_format_message_t *) state->read_data);
+	else if (state->header.type == GLC_MESSAGE_AUDIO_DATA)
+		return encode_audio_data_message(encode, (glc_audio_data_header_t *) state->read_data,
+						 &state->read_data[sizeof(glc_audio_data_header_t)]);
+
+	return 0;
+}
+
+int encode_averror(encode_t encode, const char *what, int err)
+{
+	char str[AV_ERROR_MAX_STRING_SIZE];
+
+	av_strerror(err, str, sizeof(str));
+	glc_log(encode->glc, GLC_ERROR, "encode", "%s: %s", what, str);
+
+	if (err == AVERROR(ENOMEM))
+		return ENOMEM;
+	return EIO;
+}
+
+int encode_video_format_message(encode_t encode, glc_video_format_message_t *format_message)
+{
+	int ret;
+
+	if (format_message->id != encode->video_id)
+		return 0;
+
+	if (!((format_message->format == GLC_VIDEO_YCBCR_420JPEG) |
+	      (format_message->format == GLC_VIDEO_NV12))) {
+		glc_log(encode->glc, GLC_ERROR, "encode",
+			 "video stream %d is not in 420jpeg or nv12 format", format_message->id);
+		return ENOTSUP;
+	}
+
+	if ((encode->out) &&
+	    ((format_message->format != encode->video.format) |
+	     (format_message->width != encode->video.width) |
+	     (format_message->height != encode->video.height))) {
+		glc_log(encode->glc, GLC_WARNING, "encode", "video stream configuration changed");
+		if ((ret = encode_close(encode)))
+			return ret;
+	}
+
+	encode->video.format = format_message->format;
+	encode->video.width = format_message->width;
+	encode->video.height = format_message->height;
+	encode->video.configured = 1;
+
+	return 0;
+}
+
+int encode_video_frame_message(encode_t encode, glc_video_frame_header_t *pic_header, char *data)
+{
+	uint8_t *src[4];
+	int linesize[4];
+	int64_t pts;
+	int ret;
+
+	if ((pic_header->id != encode->video_id) || (!encode->video.configured))
+		return 0;
+
+	/* file is opened when first picture arrives */
+	if ((!encode->out) && (ret = encode_open(encode)))
+		return ret;
+
+	if (pic_header->time < encode->start_time)
+		return 0;
+	pts = av_rescale_q(pic_header->time - encode->start_time,
+			   (AVRational) {1, 1000000}, encode->video.ctx->time_base);
+	if (pts <= encode->video.pts)
+		return 0; /* faster than fps */
+
+	if (data) {
+		if ((ret = av_frame_make_writable(encode->video.frame)) < 0)
+			return encode_averror(encode, "can't allocate picture", ret);
+
+		av_image_fill_arrays(src, linesize, (const uint8_t *) data,
+				     encode->video.ctx->pix_fmt,
+				     encode->video.width, encode->video.height, 1);
+		av_image_copy(encode->video.frame->data, encode->video.frame->linesize,
+			      (const uint8_t **) src, linesize, encode->video.ctx->pix_fmt,
+			      encode->video.width, encode->video.height);
+		encode->video.have_frame = 1;
+	} else if (!encode->video.have_frame)
+		return 0; /* repeat of a picture before file was opened */
+
+	encode->video.frame->pts = encode->video.pts = pts;
+	return encode_send(encode, encode->video.ctx, encode->video.stream, encode->video.frame);
+}
+
+int encode_audio_format_message(encode_t encode, glc_audio_format_message_t *format_message)
+{
+	if ((format_message->id != encode->audio_id) || (!encode->audio_id))
+		return 0;
+
+	if ((format_message->format != GLC_AUDIO_S16_LE) &&
+	    (format_message->format != GLC_AUDIO_S24_LE) &&
+	    (format_message->format != GLC_AUDIO_S32_LE)) {
+		glc_log(encode->glc, GLC_ERROR, "encode",
+			 "unsupported format 0x%02x (stream %d)", format_message->format, format_message->id);
+		return ENOTSUP;
+	}
+
+	/* streams can't be added or changed once header is written */
+	if (encode->out) {
+		if (!encode->audio.stream)
+			glc_log(encode->glc, GLC_WARNING, "encode",
+				 "audio stream %d started after video, not encoded",
+				 format_message->id);
+		else if ((format_message->format != encode->audio.format) |
+			 (format_message->flags != encode->audio.flags) |
+			 (format_message->rate != encode->audio.rate) |
+			 (format_message->channels != encode->audio.channels)) {
+			glc_log(encode->glc, GLC_WARNING, "encode",
+				 "audio stream %d configuration changed, not encoded",
+				 format_message->id);
+			encode->audio.changed = 1;
+		}
+		return 0;
+	}
+
+	encode->audio.format = format_message->format;
+	encode->audio.flags = format_message->flags;
+	encode->audio.rate = format_message->rate;
+	encode->audio.channels = format_message->channels;
+	encode->audio.configured = 1;
+
+	return 0;
+}
+
+int encode_audio_data_message(encode_t encode, glc_audio_data_header_t *audio_header, char *data)
+{
+	unsigned int c, sample_size;
+	size_t samples, s;
+	int ret;
+
+	if ((audio_header->id != encode->audio_id) || (!encode->audio.stream) ||
+	    (encode->audio.changed))
+		return 0;
+
+	sample_size = (encode->audio.format == GLC_AUDIO_S16_LE) ? 2 : 4;
+	samples = audio_header->size / (sample_size * encode->audio.channels);
+
+	/* audio continues from where first packet starts */
+	if (!encode->audio.started) {
+		if (audio_header->time < encode->start_time)
+			return 0;
+		encode->audio.pts = av_rescale(audio_header->time - encode->start_time,
+					       encode->audio.rate, 1000000);
+		encode->audio.started = 1;
+	}
+
+	/* 24bit samples are in the low bytes of 32bit words */
+	if (encode->audio.format == GLC_AUDIO_S24_LE) {
+		if (encode->audio.s24_size < audio_header->size) {
+			encode->audio.s24_size = audio_header->size;
+			encode->audio.s24 = (int32_t *) realloc(encode->audio.s24, encode->audio.s24_size);
+		}
+		for (s = 0; s < samples * encode->audio.channels; s++)
+			encode->audio.s24[s] = (int32_t) (((u_int32_t *) data)[s] << 8);
+		data = (char *) encode->audio.s24;
+	}
+
+	if (encode->audio.flags & GLC_AUDIO_INTERLEAVED)
+		encode->audio.planes[0] = (const uint8_t *) data;
+	else {
+		for (c = 0; c < encode->audio.channels; c++)
+			encode->audio.planes[c] = (const uint8_t *) &data[samples * sample_size * c];
+	}
+
+	/* resampler buffers input until there is a full frame */
+	if ((ret = swr_convert(encode->audio.swr, NULL, 0,
+			       encode->audio.planes, samples)) < 0)
+		return encode_averror(encode, "can't convert audio", ret);
+
+	return encode_audio_frames(encode, 0);
+}
+
+int encode_audio_frames(encode_t encode, int flush)
+{
+	AVFrame *frame = encode->audio.frame;
+	int frame_size, ret;
+
+	frame_size = frame->nb_samples;
+
+	while ((swr_get_out_samples(encode->audio.swr, 0) >= frame_size) ||
+	       ((flush) && (swr_get_out_samples(encode->audio.swr, 0) > 0))) {
+		if ((ret = av_frame_make_writable(frame)) < 0)
+			return encode_averror(encode, "can't allocate audio frame", ret);
+
+		frame->nb_samples = frame_size;
+		if ((ret = swr_convert(encode->audio.swr, frame->data, frame_size, NULL, 0)) < 0)
+			return encode_averror(encode, "can't convert audio", ret);
+		if (ret == 0)
+			break;
+
+		/* only some encoders accept short last frame */
+		if ((ret < frame_size) &&
+		    (!(encode->audio.ctx->codec->capabilities &
+		       (AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_VARIABLE_FRAME_SIZE))))
+			break;
+
+		frame->nb_samples = ret;
+		frame->pts = encode->audio.pts;
+		encode->audio.pts += ret;
+
+		ret = encode_send(encode, encode->audio.ctx, encode->audio.stream, frame);
+		frame->nb_samples = frame_size;
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+int encode_send(encode_t encode, AVCodecContext *ctx, AVStream *stream, AVFrame *frame)
+{
+	int ret;
+
+	if ((ret = avcodec_send_frame(ctx, frame)) < 0)
+		return encode_averror(encode, "can't encode", ret);
+
+	while ((ret = avcodec_receive_packet(ctx, encode->packet)) >= 0) {
+		av_packet_rescale_ts(encode->packet, ctx->time_base, stream->time_base);
+		encode->packet->stream_index = stream->index;
+		if ((ret = av_interleaved_write_frame(encode->out, encode->packet)) < 0)
+			return encode_averror(encode, "can't write packet", ret);
+	}
+
+	if ((ret == AVERROR(EAGAIN)) || (ret == AVERROR_EOF))
+		return 0;
+	return encode_averror(encode, "can't encode", ret);
+}
+
+int encode_open(encode_t encode)
+{
+	char *filename;
+	int ret;
+
+	filename = (char *) malloc(1024);
+	snprintf(filename, 1023, encode->filename_format, ++encode->file_count);
+	glc_log(encode->glc, GLC_INFORMATION, "encode", "opening %s for writing", filename);
+
+	if (avformat_alloc_output_context2(&encode->out, NULL, NULL, filename) < 0) {
+		if ((ret = avformat_alloc_output_context2(&encode->out, NULL,
+							  "matroska", filename)) < 0) {
+			free(filename);
+			return encode_averror(encode, "can't create container", ret);
+		}
+	}
+
+	if (!(encode->packet = av_packet_alloc())) {
+		ret = ENOMEM;
+		goto err;
+	}
+
+	if ((ret = encode_open_video(encode)))
+		goto err;
+	if ((encode->audio_id) && (encode->audio.configured)) {
+		if ((ret = encode_open_audio(encode)))
+			goto err;
+	}
+
+	if (!(encode->out->oformat->flags & AVFMT_NOFILE)) {
+		if ((ret = avio_open(&encode->out->pb, filename, AVIO_FLAG_WRITE)) < 0) {
+			glc_log(encode->glc, GLC_ERROR, "encode", "can't open %s", filename);
+			ret = encode_averror(encode, "can't open file", ret);
+			goto err;
+		}
+	}
+
+	if ((ret = avformat_write_header(encode->out, NULL)) < 0) {
+		ret = encode_averror(encode, "can't write header", ret);
+		goto err;
+	}
+	encode->header = 1;
+
+	encode->video.pts = -1;
+	encode->video.have_frame = 0;
+	encode->audio.started = 0;
+	encode->audio.changed = 0;
+
+	free(filename);
+	return 0;
+err:
+	encode_close(encode);
+	free(filename);
+	return ret;
+}
+
+int encode_open_video(encode_t encode)
+{
+	AVDictionary *options = NULL;
+	const AVCodec *codec;
+	AVCodecContext *ctx;
+	int ret;
+
+	if (!(codec = avcodec_find_encoder_by_name(encode->codec))) {
+		glc_log(encode->glc, GLC_ERROR, "encode", "unknown encoder '%s'", encode->codec);
+		return ENOTSUP;
+	}
+
+	if (!(encode->video.stream = avformat_new_stream(encode->out, NULL)))
+		return ENOMEM;
+	if (!(encode->video.ctx = ctx = avcodec_alloc_context3(codec)))
+		return ENOMEM;
+
+	ctx->width = encode->video.width;
+	ctx->height = encode->video.height;
+	if (encode->video.format == GLC_VIDEO_NV12)
+		ctx->pix_fmt = AV_PIX_FMT_NV12;
+	else
+		ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	/* full range BT.601, see ycbcr */
+	ctx->color_range = AVCOL_RANGE_JPEG;
+	ctx->colorspace = AVCOL_SPC_BT470BG;
+	ctx->framerate = av_d2q(encode->fps, 100000);
+	ctx->time_base = av_inv_q(ctx->framerate);
+	ctx->thread_count = encode->threads;
+
+	if (encode->bitrate)
+		ctx->bit_rate = (int64_t) encode->bitrate * 1000;
+	else
+		av_dict_set_int(&options, "crf", encode->quality, 0);
+	if (encode->preset)
+		av_dict_set(&options, "preset", encode->preset, 0);
+
+	if (encode->out->oformat->flags & AVFMT_GLOBALHEADER)
+		ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	/* options encoder doesn't know are left in dictionary */
+	ret = avcodec_open2(ctx, codec, &options);
+	av_dict_free(&options);
+	if (ret < 0)
+		return encode_averror(encode, "can't open video encoder", ret);
+
+	if ((ret = avcodec_parameters_from_context(encode->video.stream->codecpar, ctx)) < 0)
+		return encode_averror(encode, "can't set video parameters", ret);
+	encode->video.stream->time_base = ctx->time_base;
+
+	if (!(encode->video.frame = av_frame_alloc()))
+		return ENOMEM;
+	encode->video.frame->format = ctx->pix_fmt;
+	encode->video.frame->width = ctx->width;
+	encode->video.frame->height = ctx->height;
+	if ((ret = av_frame_get_buffer(encode->video.frame, 0)) < 0)
+		return encode_averror(encode, "can't allocate picture", ret);
+
+	glc_log(encode->glc, GLC_INFORMATION, "encode", "encoding video stream %d (%ux%u) with %s",
+		 encode->video_id, encode->video.width, encode->video.height, codec->name);
+	return 0;
+}
+
+int encode_open_audio(encode_t encode)
+{
+	enum AVSampleFormat in_format;
+	const AVCodec *codec;
+	AVCodecContext *ctx;
+	int ret;
+
+	if (encode->audio_codec)
+		codec = avcodec_find_encoder_by_name(encode->audio_codec);
+	else
+		codec = avcodec_find_encoder(encode->out->oformat->audio_codec);
+	if (!codec) {
+		glc_log(encode->glc, GLC_WARNING, "encode", "no audio encoder, not encoding audio");
+		return 0;
+	}
+
+	if (!(encode->audio.stream = avformat_new_stream(encode->out, NULL)))
+		return ENOMEM;
+	if (!(encode->audio.ctx = ctx = avcodec_alloc_context3(codec)))
+		return ENOMEM;
+
+	ctx->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+	ctx->sample_rate = encode->audio.rate;
+	av_channel_layout_default(&ctx->ch_layout, encode->audio.channels);
+	ctx->bit_rate = ENCODE_AUDIO_BITRATE;
+	ctx->time_base = (AVRational) {1, encode->audio.rate};
+
+	if (encode->out->oformat->flags & AVFMT_GLOBALHEADER)
+		ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	if ((ret = avcodec_open2(ctx, codec, NULL)) < 0)
+		return encode_averror(encode, "can't open audio encoder", ret);
+	if ((ret = avcodec_parameters_from_context(encode->audio.stream->codecpar, ctx)) < 0)
+		return encode_averror(encode, "can't set audio parameters", ret);
+	encode->audio.stream->time_base = ctx->time_base;
+
+	if (!(encode->audio.frame = av_frame_alloc()))
+		return ENOMEM;
+	encode->audio.frame->format = ctx->sample_fmt;
+	encode->audio.frame->sample_rate = ctx->sample_rate;
+	if ((ret = av_channel_layout_copy(&encode->audio.frame->ch_layout, &ctx->ch_layout)) < 0)
+		return encode_averror(encode, "can't set channel layout", ret);
+	if ((ctx->frame_size) &&
+	    (!(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)))
+		encode->audio.frame->nb_samples = ctx->frame_size;
+	else
+		encode->audio.frame->nb_samples = ENCODE_AUDIO_FRAME;
+	if ((ret = av_frame_get_buffer(encode->audio.frame, 0)) < 0)
+		return encode_averror(encode, "can't allocate audio frame", ret);
+
+	/* glc audio is converted, never resampled */
+	if (encode->audio.format == GLC_AUDIO_S16_LE)
+		in_format = AV_SAMPLE_FMT_S16;
+	else
+		in_format = AV_SAMPLE_FMT_S32;
+	if (!(encode->audio.flags & GLC_AUDIO_INTERLEAVED))
+		in_format = av_get_planar_sample_fmt(in_format);
+
+	if ((ret = swr_alloc_set_opts2(&encode->audio.swr,
+				       &ctx->ch_layout, ctx->sample_fmt, ctx->sample_rate,
+				       &ctx->ch_layout, in_format, ctx->sample_rate,
+				       0, NULL)) < 0)
+		return encode_averror(encode, "can't create audio converter", ret);
+	if ((ret = swr_init(encode->audio.swr)) < 0)
+		return encode_averror(encode, "can't create audio converter", ret);
+
+	encode->audio.planes = (const uint8_t **) malloc(sizeof(uint8_t *) * encode->audio.channels);
+
+	glc_log(encode->glc, GLC_INFORMATION, "encode", "encoding audio stream %d with %s",
+		 encode->audio_id, codec->name);
+	return 0;
+}
+
+int encode_close(encode_t encode)
+{
+	int ret = 0;
+
+	if (!encode->out)
+		return 0;
+
+	/* flush encoders only if there is a file to flush to */
+	if (encode->header) {
+		if ((encode->audio.started) && (!encode->audio.changed))
+			encode_audio_frames(encode, 1);
+		if (encode->audio.stream && encode->audio.ctx)
+			encode_send(encode, encode->audio.ctx, encode->audio.stream, NULL);
+		if (encode->video.have_frame)
+			encode_send(encode, encode->video.ctx, encode->video.stream, NULL);
+
+		if ((ret = av_write_trailer(encode->out)) < 0)
+			ret = encode_averror(encode, "can't write trailer", ret);
+	}
+
+	if (!(encode->out->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&encode->out->pb);
+
+	avcodec_free_context(&encode->video.ctx);
+	av_frame_free(&encode->video.frame);
+	encode->video.stream = NULL;
+
+	avcodec_free_context(&encode->audio.ctx);
+	av_frame_free(&encode->audio.frame);
+	swr_free(&encode->audio.swr);
+	encode->audio.stream = NULL;
+	if (encode->audio.planes) {
+		free(encode->audio.planes);
+		encode->audio.planes = NULL;
+	}
+
+	av_packet_free(&encode->packet);
+	avformat_free_context(encode->out);
+	encode->out = NULL;
+	encode->header = 0;
+
+	return ret;
+}
+#endif
+
+/**  \} */
@@ -0,0 +1,190 @@
+/**
+ * \file glc/export/encode.h
+ * \brief in-process encoder
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup export
+ *  \{
+ * \defgroup encode in-process encoder
+ *  \{
+ */
+
+#ifndef _ENCODE_H
+#define _ENCODE_H
+
+#include <packetstream.h>
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief encode object
+ */
+typedef struct encode_s* encode_t;
+
+/**
+ * \brief initialize encode object
+ * \param encode encode object
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_init(encode_t *encode, glc_t *glc);
+
+/**
+ * \brief destroy encode object
+ * \param encode encode object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_destroy(encode_t encode);
+
+/**
+ * \brief set filename format
+ *
+ * Container is guessed from file extension, matroska is
+ * used if that fails. If video stream configuration changes,
+ * encode has to start a new file. %d in filename is
+ * substituted with counter.
+ *
+ * Default format is "video%02d.mkv"
+ * \param encode encode object
+ * \param filename filename format
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_filename(encode_t encode, const char *filename);
+
+/**
+ * \brief set video stream number
+ *
+ * Default stream number is 1.
+ * \param encode encode object
+ * \param id video stream id
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_video_id(encode_t encode, glc_stream_id_t id);
+
+/**
+ * \brief set audio stream number
+ *
+ * Default stream number is 1. Audio stream must be configured
+ * before first picture arrives, later audio streams are not
+ * encoded.
+ * \param encode encode object
+ * \param id audio stream id, 0 disables audio
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_audio_id(encode_t encode, glc_stream_id_t id);
+
+/**
+ * \brief set stream time export starts from
+ *
+ * Timestamps in output file are relative to this.
+ * Default is 0.
+ * \param encode encode object
+ * \param time start time in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_start_time(encode_t encode, glc_utime_t time);
+
+/**
+ * \brief set fps
+ *
+ * Pictures are timestamped at 1/fps precision and pictures
+ * arriving faster are dropped. Missing pictures are not
+ * interpolated, container timestamps keep a/v sync.
+ * Default fps is 30.
+ * \param encode encode object
+ * \param fps fps
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_fps(encode_t encode, double fps);
+
+/**
+ * \brief set video and audio encoders
+ *
+ * Default video encoder is 'libx264', audio is encoded
+ * with container's default audio encoder.
+ * \param encode encode object
+ * \param video libavcodec video encoder name
+ * \param audio libavcodec audio encoder name or NULL
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_codec(encode_t encode, const char *video, const char *audio);
+
+/**
+ * \brief set encoder preset
+ *
+ * Passed to video encoder as 'preset' option, f.ex.
+ * 'veryfast' for real-time x264 encoding. By default
+ * encoder's own default is used.
+ * \param encode encode object
+ * \param preset preset name or NULL
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_preset(encode_t encode, const char *preset);
+
+/**
+ * \brief set video quality
+ *
+ * Passed to video encoder as 'crf' option if no bitrate
+ * is set. Default is 23.
+ * \param encode encode object
+ * \param quality constant rate factor
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_quality(encode_t encode, int quality);
+
+/**
+ * \brief set video bitrate
+ *
+ * Default is 0, which uses constant quality.
+ * \param encode encode object
+ * \param bitrate bitrate in kbit/s, 0 uses quality
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_bitrate(encode_t encode, unsigned int bitrate);
+
+/**
+ * \brief set encoder thread count
+ *
+ * Default is 0, which lets encoder pick thread count
+ * based on number of CPUs.
+ * \param encode encode object
+ * \param threads encoder threads
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_set_threads(encode_t encode, unsigned int threads);
+
+/**
+ * \brief start encode process
+ *
+ * encode encodes Y'CbCr or NV12 pictures in selected video
+ * stream and audio from selected audio stream with libavcodec
+ * and muxes them into a single file. Returns ENOTSUP if glc
+ * was built without libavcodec.
+ * \param encode encode object
+ * \param from source buffer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_process_start(encode_t encode, ps_buffer_t *from);
+
+/**
+ * \brief block until process has finished
+ * \param encode encode object
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int encode_process_wait(encode_t encode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
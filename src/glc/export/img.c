@@ -11,12 +11,11 @@
  *  \{
  */
 
-/** \todo employ threads in image compression */
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <png.h>
 #include <packetstream.h>
 
@@ -28,6 +27,22 @@
 
 #include "img.h"
 
+/** pictures queued per encoder thread */
+#define IMG_QUEUE_DEPTH          2
+
+/* QOI opcodes */
+#define IMG_QOI_OP_INDEX      0x00
+#define IMG_QOI_OP_DIFF       0x40
+#define IMG_QOI_OP_LUMA       0x80
+#define IMG_QOI_OP_RUN        0xc0
+#define IMG_QOI_OP_RGB        0xfe
+
+struct img_job_s {
+	unsigned char *pic;
+	unsigned int first, count;
+	struct img_job_s *next;
+};
+
 struct img_private_s;
 typedef int (*img_write_proc)(img_t img,
 			      const unsigned char *pic,
@@ -50,10 +65,21 @@ struct img_s {
 	unsigned int w, h;
 	unsigned int row;
 	unsigned char *prev_video_frame_message;
-	glc_utime_t time;
+	glc_utime_t time, start_time;
+	glc_utime_t range_begin, range_end;
 	int i;
 
 	img_write_proc write_proc;
+	int png_level, png_filter;
+
+	unsigned int threads;
+	pthread_t *workers;
+	unsigned int running_workers;
+	pthread_mutex_t job_mutex;
+	pthread_cond_t job_cond, done_cond;
+	struct img_job_s *jobs, *jobs_tail, *free_jobs;
+	unsigned int allocated_jobs, busy_jobs;
+	int quit, error;
 };
 
 void img_finish_callback(void *ptr, int err);
@@ -62,6 +88,13 @@ int img_read_callback(glc_thread_state_t *state);
 int img_video_format_message(img_t img, glc_video_format_message_t *video_format);
 int img_video_frame_message(img_t img, glc_video_frame_header_t *pic_hdr,
 	    const unsigned char *pic, size_t pic_size);
+int img_write(img_t img, const unsigned char *pic, unsigned int first, unsigned int count);
+int img_in_range(img_t img, glc_utime_t time);
+
+int img_workers_start(img_t img);
+int img_workers_stop(img_t img);
+int img_workers_drain(img_t img);
+void *img_worker(void *argptr);
 
 int img_write_bmp(img_t img, const unsigned char *pic,
 		  unsigned int w, unsigned int h,
@@ -69,6 +102,12 @@ int img_write_bmp(img_t img, const unsigned char *pic,
 int img_write_png(img_t img, const unsigned char *pic,
 		  unsigned int w, unsigned int h,
 		  const char *filename);
+int img_write_qoi(img_t img, const unsigned char *pic,
+		  unsigned int w, unsigned int h,
+		  const char *filename);
+int img_write_ppm(img_t img, const unsigned char *pic,
+		  unsigned int w, unsigned int h,
+		  const char *filename);
 
 int img_init(img_t *img, glc_t *glc)
 {
@@ -81,18 +120,29 @@ int img_init(img_t *img, glc_t *glc)
 	(*img)->write_proc = &img_write_png;
 	(*img)->filename_format = "frame%08d.png";
 	(*img)->id = 1;
+	(*img)->png_level = -1;
+	(*img)->png_filter = IMG_PNG_FILTER_DEFAULT;
+	(*img)->threads = 1;
+
+	pthread_mutex_init(&(*img)->job_mutex, NULL);
+	pthread_cond_init(&(*img)->job_cond, NULL);
+	pthread_cond_init(&(*img)->done_cond, NULL);
 
 	(*img)->thread.flags = GLC_THREAD_READ;
 	(*img)->thread.ptr = *img;
 	(*img)->thread.read_callback = &img_read_callback;
 	(*img)->thread.finish_callback = &img_finish_callback;
 	(*img)->thread.threads = 1;
+	(*img)->thread.name = "img";
 
 	return 0;
 }
 
 int img_destroy(img_t img)
 {
+	pthread_cond_destroy(&img->done_cond);
+	pthread_cond_destroy(&img->job_cond);
+	pthread_mutex_destroy(&img->job_mutex);
 	free(img);
 	return 0;
 }
@@ -103,8 +153,13 @@ int img_process_start(img_t img, ps_buffer_t *from)
 	if (img->running)
 		return EAGAIN;
 
-	if ((ret = glc_thread_create(img->glc, &img->thread, from, NULL)))
+	if ((ret = img_workers_start(img)))
+		return ret;
+
+	if ((ret = glc_thread_create(img->glc, &img->thread, from, NULL))) {
+		img_workers_stop(img);
 		return ret;
+	}
 	img->running = 1;
 
 	return 0;
@@ -140,6 +195,10 @@ int img_set_format(img_t img, int format)
 		img->write_proc = &img_write_png;
 	else if (format == IMG_BMP)
 		img->write_proc = &img_write_bmp;
+	else if (format == IMG_QOI)
+		img->write_proc = &img_write_qoi;
+	else if (format == IMG_PPM)
+		img->write_proc = &img_write_ppm;
 	else {
 		glc_log(img->glc, GLC_ERROR, "img",
 			 "unknown format 0x%02x", format);
@@ -149,16 +208,58 @@ int img_set_format(img_t img, int format)
 	return 0;
 }
 
+int img_set_png_compression(img_t img, int level, int filter)
+{
+	if ((level < -1) || (level > 9) ||
+	    (filter < IMG_PNG_FILTER_DEFAULT) || (filter > IMG_PNG_FILTER_PAETH))
+		return EINVAL;
+
+	img->png_level = level;
+	img->png_filter = filter;
+	return 0;
+}
+
+int img_set_threads(img_t img, unsigned int threads)
+{
+	if (img->running)
+		return EALREADY;
+
+	img->threads = threads;
+	return 0;
+}
+
 int img_set_stream_id(img_t img, glc_stream_id_t id)
 {
 	img->id = id;
 	return 0;
 }
 
+int img_set_start_time(img_t img, glc_utime_t time)
+{
+	img->start_time = img->time = time;
+	return 0;
+}
+
+int img_set_range(img_t img, glc_utime_t begin, glc_utime_t end)
+{
+	img->range_begin = begin;
+	img->range_end = end;
+	return 0;
+}
+
+int img_in_range(img_t img, glc_utime_t time)
+{
+	return (time >= img->range_begin) &&
+	       ((!img->range_end) || (time < img->range_end));
+}
+
 void img_finish_callback(void *ptr, int err)
 {
 	img_t img = (img_t) ptr;
 
+	/* queued pictures are written before workers quit */
+	img_workers_stop(img);
+
 	glc_log(img->glc, GLC_INFORMATION, "img", "%d images written", img->i);
 
 	if (err)
@@ -170,7 +271,7 @@ void img_finish_callback(void *ptr, int err)
 	}
 
 	img->i = 0;
-	img->time = 0;
+	img->time = img->start_time;
 }
 
 int img_read_callback(glc_thread_state_t *state)
@@ -183,7 +284,10 @@ int img_read_callback(glc_thread_state_t *state)
 	} else if (state->header.type == GLC_MESSAGE_VIDEO_FRAME) {
 		ret = img_video_frame_message(img, (glc_video_frame_header_t *) state->read_data,
 			      (const unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
-			      state->read_size);
+			      state->read_size - sizeof(glc_video_frame_header_t));
+	} else if (state->header.type == GLC_MESSAGE_VIDEO_REPEAT) {
+		ret = img_video_frame_message(img, (glc_video_frame_header_t *) state->read_data,
+			      img->prev_video_frame_message, img->row * img->h);
 	}
 
 	return ret;
@@ -191,6 +295,9 @@ int img_read_callback(glc_thread_state_t *state)
 
 int img_video_format_message(img_t img, glc_video_format_message_t *video_format)
 {
+	struct img_job_s *job;
+	int ret;
+
 	if (video_format->id != img->id)
 		return 0;
 
@@ -200,6 +307,16 @@ int img_video_format_message(img_t img, glc_video_format_message_t *video_format
 		return ENOTSUP;
 	}
 
+	/* queued pictures still use old size */
+	if ((ret = img_workers_drain(img)))
+		return ret;
+	while ((job = img->free_jobs) != NULL) {
+		img->free_jobs = job->next;
+		free(job->pic);
+		free(job);
+	}
+	img->allocated_jobs = 0;
+
 	img->w = video_format->width;
 	img->h = video_format->height;
 	img->row = img->w * 3;
@@ -221,32 +338,219 @@ int img_video_format_message(img_t img, glc_video_format_message_t *video_format
 int img_video_frame_message(img_t img, glc_video_frame_header_t *pic_hdr,
 	    const unsigned char *pic, size_t pic_size)
 {
+	unsigned int first = 0, count = 0;
 	int ret = 0;
-	char filename[1024];
 
 	if (pic_hdr->id != img->id)
 		return 0;
 
+	/* img->time is always time of frame number img->i */
 	if (img->time < pic_hdr->time) {
 		/* write previous pic until we are 'fps' away from current time */
 		while (img->time + img->fps_usec < pic_hdr->time) {
+			if (img_in_range(img, img->time)) {
+				if (!count)
+					first = img->i;
+				count++;
+			}
 			img->time += img->fps_usec;
-
-			snprintf(filename, sizeof(filename) - 1, img->filename_format, img->i++);
-			img->write_proc(img, img->prev_video_frame_message, img->w, img->h, filename);
+			img->i++;
 		}
 
+		if (count)
+			ret = img_write(img, img->prev_video_frame_message, first, count);
+
+		if ((!ret) && (img_in_range(img, img->time)))
+			ret = img_write(img, pic, img->i, 1);
+
 		img->time += img->fps_usec;
+		img->i++;
+	}
+
+	if (pic != img->prev_video_frame_message)
+		memcpy(img->prev_video_frame_message, pic, pic_size);
+
+	return ret;
+}
+
+int img_write(img_t img, const unsigned char *pic, unsigned int first, unsigned int count)
+{
+	struct img_job_s *job;
+	char filename[1024];
+	unsigned int i;
+	int ret = 0;
+
+	if (!img->running_workers) {
+		for (i = first; i < first + count; i++) {
+			snprintf(filename, sizeof(filename) - 1, img->filename_format, i);
+			if ((ret = img->write_proc(img, pic, img->w, img->h, filename)))
+				return ret;
+		}
+		return 0;
+	}
+
+	pthread_mutex_lock(&img->job_mutex);
+	/* pictures are copied, so queue length is limited */
+	while ((!img->error) && (!img->free_jobs) &&
+	       (img->allocated_jobs >= img->running_workers * IMG_QUEUE_DEPTH))
+		pthread_cond_wait(&img->done_cond, &img->job_mutex);
+
+	if ((ret = img->error)) {
+		pthread_mutex_unlock(&img->job_mutex);
+		return ret;
+	}
+
+	if ((job = img->free_jobs))
+		img->free_jobs = job->next;
+	img->busy_jobs++;
+	pthread_mutex_unlock(&img->job_mutex);
+
+	if (!job) {
+		job = (struct img_job_s *) malloc(sizeof(struct img_job_s));
+		job->pic = (unsigned char *) malloc(img->row * img->h);
+		img->allocated_jobs++; /* only img thread touches this */
+	}
+
+	memcpy(job->pic, pic, img->row * img->h);
+	job->first = first;
+	job->count = count;
+	job->next = NULL;
+
+	pthread_mutex_lock(&img->job_mutex);
+	if (img->jobs_tail)
+		img->jobs_tail->next = job;
+	else
+		img->jobs = job;
+	img->jobs_tail = job;
+	pthread_cond_signal(&img->job_cond);
+	pthread_mutex_unlock(&img->job_mutex);
+
+	return 0;
+}
+
+int img_workers_start(img_t img)
+{
+	pthread_attr_t attr;
+	unsigned int threads, i;
+	int ret = 0;
+
+	threads = img->threads ? img->threads : glc_threads_hint(img->glc);
+	img->error = img->quit = 0;
+	if (threads < 2)
+		return 0;
+
+	img->workers = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	for (i = 0; i < threads; i++) {
+		if ((ret = pthread_create(&img->workers[i], &attr, img_worker, img)))
+			break;
+		img->running_workers++;
+	}
+
+	pthread_attr_destroy(&attr);
+
+	if (ret) {
+		glc_log(img->glc, GLC_ERROR, "img",
+			 "can't create encoder thread: %s (%d)", strerror(ret), ret);
+		img_workers_stop(img);
+		return ret;
+	}
+
+	glc_log(img->glc, GLC_DEBUG, "img", "started %u encoder threads", img->running_workers);
+	return 0;
+}
 
-		snprintf(filename, sizeof(filename) - 1, img->filename_format, img->i++);
-		ret = img->write_proc(img, pic, img->w, img->h, filename);
+int img_workers_stop(img_t img)
+{
+	struct img_job_s *job;
+	unsigned int i;
+
+	if (img->workers) {
+		pthread_mutex_lock(&img->job_mutex);
+		img->quit = 1;
+		pthread_cond_broadcast(&img->job_cond);
+		pthread_mutex_unlock(&img->job_mutex);
+
+		for (i = 0; i < img->running_workers; i++)
+			pthread_join(img->workers[i], NULL);
+		free(img->workers);
+		img->workers = NULL;
+		img->running_workers = 0;
 	}
 
-	memcpy(img->prev_video_frame_message, pic, pic_size);
+	while ((job = img->free_jobs) != NULL) {
+		img->free_jobs = job->next;
+		free(job->pic);
+		free(job);
+	}
+	img->allocated_jobs = 0;
+
+	return img->error;
+}
+
+int img_workers_drain(img_t img)
+{
+	int ret;
+
+	pthread_mutex_lock(&img->job_mutex);
+	while (img->busy_jobs)
+		pthread_cond_wait(&img->done_cond, &img->job_mutex);
+	ret = img->error;
+	pthread_mutex_unlock(&img->job_mutex);
 
 	return ret;
 }
 
+void *img_worker(void *argptr)
+{
+	img_t img = (img_t) argptr;
+	struct img_job_s *job;
+	glc_thread_attr_t attr;
+	char filename[1024];
+	unsigned int i;
+	int ret;
+
+	glc_get_thread_attr(img->glc, "img", &attr);
+	glc_apply_thread_attr(img->glc, &attr);
+
+	pthread_mutex_lock(&img->job_mutex);
+	for (;;) {
+		/* queue is emptied before quitting */
+		while ((!img->quit) && (img->jobs == NULL))
+			pthread_cond_wait(&img->job_cond, &img->job_mutex);
+		if ((job = img->jobs) == NULL)
+			break;
+
+		if (!(img->jobs = job->next))
+			img->jobs_tail = NULL;
+		pthread_mutex_unlock(&img->job_mutex);
+
+		ret = 0;
+		for (i = job->first; (i < job->first + job->count) && (!ret); i++) {
+			snprintf(filename, sizeof(filename) - 1, img->filename_format, i);
+			ret = img->write_proc(img, job->pic, img->w, img->h, filename);
+		}
+
+		pthread_mutex_lock(&img->job_mutex);
+		if ((ret) && (!img->error)) {
+			glc_log(img->glc, GLC_ERROR, "img", "can't write %s: %s (%d)",
+				 filename, strerror(ret), ret);
+			img->error = ret;
+		}
+
+		job->next = img->free_jobs;
+		img->free_jobs = job;
+		img->busy_jobs--;
+		pthread_cond_broadcast(&img->done_cond);
+	}
+	pthread_mutex_unlock(&img->job_mutex);
+
+	return NULL;
+}
+
 int img_write_bmp(img_t img, const unsigned char *pic,
 		  unsigned int w, unsigned int h, const char *filename)
 {
@@ -305,6 +609,18 @@ int img_write_png(img_t img, const unsigned char *pic,
 		     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
 		     PNG_FILTER_TYPE_DEFAULT);
 	png_set_bgr(png_ptr);
+
+	if (img->png_level >= 0)
+		png_set_compression_level(png_ptr, img->png_level);
+	if (img->png_filter == IMG_PNG_FILTER_NONE)
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+	else if (img->png_filter == IMG_PNG_FILTER_SUB)
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+	else if (img->png_filter == IMG_PNG_FILTER_UP)
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_UP);
+	else if (img->png_filter == IMG_PNG_FILTER_PAETH)
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_PAETH);
+
 	row_pointers = (png_bytep *) png_malloc(png_ptr, h * sizeof(png_bytep));
 
 	for (i = 0; i < h; i++)
@@ -320,4 +636,138 @@ int img_write_png(img_t img, const unsigned char *pic,
 	return 0;
 }
 
+int img_write_qoi(img_t img, const unsigned char *pic,
+		  unsigned int w, unsigned int h,
+		  const char *filename)
+{
+	unsigned char header[14] = {'q', 'o', 'i', 'f'};
+	unsigned char index[64][4];
+	unsigned char *out, *o;
+	const unsigned char *px, *prev;
+	unsigned char black[3] = {0, 0, 0};
+	signed char vr, vg, vb, vg_r, vg_b;
+	unsigned int x, y, run = 0, hash;
+	FILE *fd;
+
+	glc_log(img->glc, GLC_INFORMATION, "img",
+		 "opening %s for writing (QOI)", filename);
+	if (!(fd = fopen(filename, "w")))
+		return errno;
+
+	header[4] = w >> 24;
+	header[5] = w >> 16;
+	header[6] = w >> 8;
+	header[7] = w;
+	header[8] = h >> 24;
+	header[9] = h >> 16;
+	header[10] = h >> 8;
+	header[11] = h;
+	header[12] = 3; /* RGB */
+	header[13] = 0; /* sRGB */
+	fwrite(header, 1, sizeof(header), fd);
+
+	/* alpha is always 255, empty index entries have 0 */
+	memset(index, 0, sizeof(index));
+	prev = black;
+	/* pixel takes at most 4 bytes, pending run is written with first pixel */
+	out = (unsigned char *) malloc(w * 4 + 1);
+
+	for (y = 0; y < h; y++) {
+		o = out;
+		px = &pic[(h - y - 1) * img->row];
+
+		for (x = 0; x < w; x++, px += 3) {
+			if ((px[0] == prev[0]) && (px[1] == prev[1]) && (px[2] == prev[2])) {
+				if (++run == 62) {
+					*o++ = IMG_QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+				continue;
+			}
+
+			if (run) {
+				*o++ = IMG_QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+
+			/* px is BGR */
+			hash = (px[2] * 3 + px[1] * 5 + px[0] * 7 + 255 * 11) % 64;
+			if ((index[hash][0] == px[0]) && (index[hash][1] == px[1]) &&
+			    (index[hash][2] == px[2]) && (index[hash][3] == 255))
+				*o++ = IMG_QOI_OP_INDEX | hash;
+			else {
+				memcpy(index[hash], px, 3);
+				index[hash][3] = 255;
+
+				vr = px[2] - prev[2];
+				vg = px[1] - prev[1];
+				vb = px[0] - prev[0];
+				vg_r = vr - vg;
+				vg_b = vb - vg;
+
+				if ((vr > -3) && (vr < 2) && (vg > -3) && (vg < 2) &&
+				    (vb > -3) && (vb < 2))
+					*o++ = IMG_QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2);
+				else if ((vg_r > -9) && (vg_r < 8) && (vg > -33) && (vg < 32) &&
+					 (vg_b > -9) && (vg_b < 8)) {
+					*o++ = IMG_QOI_OP_LUMA | (vg + 32);
+					*o++ = ((vg_r + 8) << 4) | (vg_b + 8);
+				} else {
+					*o++ = IMG_QOI_OP_RGB;
+					*o++ = px[2];
+					*o++ = px[1];
+					*o++ = px[0];
+				}
+			}
+
+			prev = px;
+		}
+
+		fwrite(out, 1, o - out, fd);
+	}
+
+	out[0] = IMG_QOI_OP_RUN | (run - 1);
+	if (run)
+		fwrite(out, 1, 1, fd);
+	fwrite("\x00\x00\x00\x00\x00\x00\x00\x01", 1, 8, fd);
+
+	free(out);
+	fclose(fd);
+
+	return 0;
+}
+
+int img_write_ppm(img_t img, const unsigned char *pic,
+		  unsigned int w, unsigned int h,
+		  const char *filename)
+{
+	unsigned char *rgb;
+	const unsigned char *bgr;
+	unsigned int x, y;
+	FILE *fd;
+
+	glc_log(img->glc, GLC_INFORMATION, "img",
+		 "opening %s for writing (PPM)", filename);
+	if (!(fd = fopen(filename, "w")))
+		return errno;
+
+	fprintf(fd, "P6\n%u %u\n255\n", w, h);
+
+	rgb = (unsigned char *) malloc(w * 3);
+	for (y = 0; y < h; y++) {
+		bgr = &pic[(h - y - 1) * img->row];
+		for (x = 0; x < w * 3; x += 3) {
+			rgb[x + 0] = bgr[x + 2];
+			rgb[x + 1] = bgr[x + 1];
+			rgb[x + 2] = bgr[x + 0];
+		}
+		fwrite(rgb, 1, w * 3, fd);
+	}
+
+	free(rgb);
+	fclose(fd);
+
+	return 0;
+}
+
 /**  \} */
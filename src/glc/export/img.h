@@ -27,6 +27,21 @@ extern "C" {
 #define IMG_BMP     0x1
 /** PNG format */
 #define IMG_PNG     0x2
+/** QOI format */
+#define IMG_QOI     0x3
+/** binary PPM format */
+#define IMG_PPM     0x4
+
+/** let libpng pick filter for each row */
+#define IMG_PNG_FILTER_DEFAULT  0x0
+/** no filtering, fastest */
+#define IMG_PNG_FILTER_NONE     0x1
+/** sub filter */
+#define IMG_PNG_FILTER_SUB      0x2
+/** up filter */
+#define IMG_PNG_FILTER_UP       0x3
+/** paeth filter */
+#define IMG_PNG_FILTER_PAETH    0x4
 
 /**
  * \brief img object
@@ -71,6 +86,32 @@ __PUBLIC int img_set_filename(img_t img, const char *filename);
  */
 __PUBLIC int img_set_stream_id(img_t img, glc_stream_id_t id);
 
+/**
+ * \brief set stream time export starts from
+ *
+ * Gap between start time and first frame is filled as if
+ * stream started there. Set when stream is read from seek
+ * position, default is 0.
+ * \param img img object
+ * \param time start time in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int img_set_start_time(img_t img, glc_utime_t time);
+
+/**
+ * \brief write only frames in given stream time range
+ *
+ * Frames outside [begin, end) are skipped but numbered as
+ * usual from start time, so consecutive ranges of one stream
+ * can be exported in parallel into the same file names.
+ * Default is the whole stream.
+ * \param img img object
+ * \param begin first stream time in microseconds
+ * \param end end of range, 0 means no limit
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int img_set_range(img_t img, glc_utime_t begin, glc_utime_t end);
+
 /**
  * \brief set fps
  *
@@ -84,7 +125,10 @@ __PUBLIC int img_set_fps(img_t img, double fps);
 /**
  * \brief set format
  *
- * Currently BMP (IMG_BMP) and PNG (IMG_PNG) are supported.
+ * Currently BMP (IMG_BMP), PNG (IMG_PNG), QOI (IMG_QOI)
+ * and binary PPM (IMG_PPM) are supported. QOI and PPM are
+ * a lot faster to write than PNG, which makes them better
+ * for intermediate files.
  *
  * Default format is PNG.
  * \param img img object
@@ -93,6 +137,31 @@ __PUBLIC int img_set_fps(img_t img, double fps);
  */
 __PUBLIC int img_set_format(img_t img, int format);
 
+/**
+ * \brief set PNG compression
+ *
+ * Default level is -1, which uses zlib default. Filter
+ * is one of IMG_PNG_FILTER_*, default lets libpng choose.
+ * \param img img object
+ * \param level zlib level 0-9 or -1
+ * \param filter row filter
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int img_set_png_compression(img_t img, int level, int filter);
+
+/**
+ * \brief set number of encoder threads
+ *
+ * Images are named in stream order but encoded and written
+ * in this many threads. Each picture waiting for a thread
+ * takes a copy of it in memory. Default is 1, which encodes
+ * in img thread. 0 uses one thread per CPU.
+ * \param img img object
+ * \param threads encoder thread count
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int img_set_threads(img_t img, unsigned int threads);
+
 /**
  * \brief start img process
  *
@@ -66,7 +66,8 @@ struct wav_s {
 
 	FILE *to;
 	
-	glc_utime_t time;
+	glc_utime_t time, start_time;
+	glc_utime_t range_begin, range_end;
 	unsigned int rate, channels, interleaved;
 	size_t bps;
 	size_t sample_size;
@@ -79,6 +80,7 @@ void wav_finish_callback(void *priv, int err);
 
 int wav_write_hdr(wav_t wav, glc_audio_format_message_t *fmt_msg);
 int wav_write_audio(wav_t wav, glc_audio_data_header_t *audio_msg, char *data);
+int wav_in_range(wav_t wav, glc_utime_t time);
 
 int wav_init(wav_t *wav, glc_t *glc)
 {
@@ -101,6 +103,7 @@ int wav_init(wav_t *wav, glc_t *glc)
 	(*wav)->thread.read_callback = &wav_read_callback;
 	(*wav)->thread.finish_callback = &wav_finish_callback;
 	(*wav)->thread.threads = 1;
+	(*wav)->thread.name = "wav";
 
 	return 0;
 }
@@ -154,6 +157,25 @@ int wav_set_stream_id(wav_t wav, glc_stream_id_t id)
 	return 0;
 }
 
+int wav_set_start_time(wav_t wav, glc_utime_t time)
+{
+	wav->start_time = wav->time = time;
+	return 0;
+}
+
+int wav_set_range(wav_t wav, glc_utime_t begin, glc_utime_t end)
+{
+	wav->range_begin = begin;
+	wav->range_end = end;
+	return 0;
+}
+
+int wav_in_range(wav_t wav, glc_utime_t time)
+{
+	return (time >= wav->range_begin) &&
+	       ((!wav->range_end) || (time < wav->range_end));
+}
+
 int wav_set_silence_threshold(wav_t wav, glc_utime_t silence_threshold)
 {
 	wav->silence_threshold = silence_threshold;
@@ -273,7 +295,7 @@ int wav_write_audio(wav_t wav, glc_audio_data_header_t *audio_hdr, char *data)
 		need_silence -= need_silence % ((size_t) wav->sample_size * (size_t) wav->channels);
 
 		wav->time += ((glc_utime_t) need_silence * (glc_utime_t) 1000000) / (glc_utime_t) wav->bps;
-		if (wav->interpolate) {
+		if ((wav->interpolate) && (wav_in_range(wav, audio_hdr->time))) {
 			glc_log(wav->glc, GLC_WARNING, "wav", "writing %zd bytes of silence", need_silence);
 			while (need_silence > 0) {
 				write_silence = need_silence > wav->silence_size ? wav->silence_size : need_silence;
@@ -283,6 +305,10 @@ int wav_write_audio(wav_t wav, glc_audio_data_header_t *audio_hdr, char *data)
 		}
 	}
 
+	/* time is tracked outside range too, to place silence right */
+	if (!wav_in_range(wav, audio_hdr->time))
+		return 0;
+
 	if (wav->interleaved)
 		fwrite(data, 1, audio_hdr->size, wav->to);
 	else {
@@ -70,6 +70,32 @@ __PUBLIC int wav_set_filename(wav_t wav, const char *filename);
  */
 __PUBLIC int wav_set_stream_id(wav_t wav, glc_stream_id_t id);
 
+/**
+ * \brief set stream time export starts from
+ *
+ * Gap between start time and first packet is filled as if
+ * stream started there. Set when stream is read from seek
+ * position, default is 0.
+ * \param wav wav object
+ * \param time start time in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int wav_set_start_time(wav_t wav, glc_utime_t time);
+
+/**
+ * \brief write only audio in given stream time range
+ *
+ * Packets with time outside [begin, end) are skipped, as is
+ * silence before them. Consecutive ranges of one stream can be
+ * exported in parallel and concatenated. Default is the whole
+ * stream.
+ * \param wav wav object
+ * \param begin first stream time in microseconds
+ * \param end end of range, 0 means no limit
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int wav_set_range(wav_t wav, glc_utime_t begin, glc_utime_t end);
+
 /**
  * \brief set interpolation
  *
@@ -17,8 +17,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <packetstream.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <errno.h>
 
 #include <glc/common/glc.h>
@@ -29,21 +34,29 @@
 
 #include "yuv4mpeg.h"
 
+/** pictures per writev()/vmsplice() call */
+#define YUV4MPEG_BATCH 32
+
 struct yuv4mpeg_s {
 	glc_t *glc;
 	glc_thread_t thread;
 	int running;
 
 	unsigned int file_count;
-	FILE *to;
+	int to;
+	int splice;
 
-	glc_utime_t time;
+	glc_utime_t time, start_time;
+	glc_utime_t range_begin, range_end;
 	glc_utime_t fps_usec;
 	double fps;
 
 	unsigned int size;
+	size_t pic_size;
+	char *pic[2], *spliced;
 	char *prev_video_frame_message;
 	int interpolate;
+	int raw;
 
 	const char *filename_format;
 	glc_stream_id_t id;
@@ -54,7 +67,13 @@ void yuv4mpeg_finish_callback(void *priv, int err);
 
 int yuv4mpeg_handle_hdr(yuv4mpeg_t yuv4mpeg, glc_video_format_message_t *video_format);
 int yuv4mpeg_handle_video_frame_message(yuv4mpeg_t yuv4mpeg, glc_video_frame_header_t *pic_header, char *data);
-int yuv4mpeg_write_video_frame_message(yuv4mpeg_t yuv4mpeg, char *pic);
+int yuv4mpeg_write_video_frame_message(yuv4mpeg_t yuv4mpeg, char *pic, unsigned int count);
+int yuv4mpeg_writev(yuv4mpeg_t yuv4mpeg, struct iovec *iov, int iovcnt);
+int yuv4mpeg_in_range(yuv4mpeg_t yuv4mpeg, glc_utime_t time);
+void yuv4mpeg_close(yuv4mpeg_t yuv4mpeg);
+void yuv4mpeg_free_pics(yuv4mpeg_t yuv4mpeg);
+
+static const char yuv4mpeg_frame_tag[] = "FRAME\n";
 
 int yuv4mpeg_init(yuv4mpeg_t *yuv4mpeg, glc_t *glc)
 {
@@ -67,12 +86,14 @@ int yuv4mpeg_init(yuv4mpeg_t *yuv4mpeg, glc_t *glc)
 	(*yuv4mpeg)->filename_format = "video%02d.glc";
 	(*yuv4mpeg)->id = 1;
 	(*yuv4mpeg)->interpolate = 1;
+	(*yuv4mpeg)->to = -1;
 
 	(*yuv4mpeg)->thread.flags = GLC_THREAD_READ;
 	(*yuv4mpeg)->thread.ptr = *yuv4mpeg;
 	(*yuv4mpeg)->thread.read_callback = &yuv4mpeg_read_callback;
 	(*yuv4mpeg)->thread.finish_callback = &yuv4mpeg_finish_callback;
 	(*yuv4mpeg)->thread.threads = 1;
+	(*yuv4mpeg)->thread.name = "yuv4mpeg";
 
 	return 0;
 }
@@ -95,6 +116,25 @@ int yuv4mpeg_set_stream_id(yuv4mpeg_t yuv4mpeg, glc_stream_id_t id)
 	return 0;
 }
 
+int yuv4mpeg_set_start_time(yuv4mpeg_t yuv4mpeg, glc_utime_t time)
+{
+	yuv4mpeg->start_time = yuv4mpeg->time = time;
+	return 0;
+}
+
+int yuv4mpeg_set_range(yuv4mpeg_t yuv4mpeg, glc_utime_t begin, glc_utime_t end)
+{
+	yuv4mpeg->range_begin = begin;
+	yuv4mpeg->range_end = end;
+	return 0;
+}
+
+int yuv4mpeg_in_range(yuv4mpeg_t yuv4mpeg, glc_utime_t time)
+{
+	return (time >= yuv4mpeg->range_begin) &&
+	       ((!yuv4mpeg->range_end) || (time < yuv4mpeg->range_end));
+}
+
 int yuv4mpeg_set_fps(yuv4mpeg_t yuv4mpeg, double fps)
 {
 	yuv4mpeg->fps = fps;
@@ -139,18 +179,11 @@ void yuv4mpeg_finish_callback(void *priv, int err)
 	if (err)
 		glc_log(yuv4mpeg->glc, GLC_ERROR, "yuv4mpeg", "%s (%d)", strerror(err), err);
 
-	if (yuv4mpeg->to) {
-		fclose(yuv4mpeg->to);
-		yuv4mpeg->to = NULL;
-	}
-
-	if (yuv4mpeg->prev_video_frame_message) {
-		free(yuv4mpeg->prev_video_frame_message);
-		yuv4mpeg->prev_video_frame_message = NULL;
-	}
+	yuv4mpeg_close(yuv4mpeg);
+	yuv4mpeg_free_pics(yuv4mpeg);
 
 	yuv4mpeg->file_count = 0;
-	yuv4mpeg->time = 0;
+	yuv4mpeg->time = yuv4mpeg->start_time;
 }
 
 int yuv4mpeg_read_callback(glc_thread_state_t *state)
@@ -161,6 +194,8 @@ int yuv4mpeg_read_callback(glc_thread_state_t *state)
 		return yuv4mpeg_handle_hdr(yuv4mpeg, (glc_video_format_message_t *) state->read_data);
 	else if (state->header.type == GLC_MESSAGE_VIDEO_FRAME)
 		return yuv4mpeg_handle_video_frame_message(yuv4mpeg, (glc_video_frame_header_t *) state->read_data, &state->read_data[sizeof(glc_video_frame_header_t)]);
+	else if (state->header.type == GLC_MESSAGE_VIDEO_REPEAT)
+		return yuv4mpeg_handle_video_frame_message(yuv4mpeg, (glc_video_frame_header_t *) state->read_data, yuv4mpeg->prev_video_frame_message);
 
 	return 0;
 }
@@ -169,15 +204,19 @@ int yuv4mpeg_handle_hdr(yuv4mpeg_t yuv4mpeg, glc_video_format_message_t *video_f
 {
 	char *filename;
 	unsigned int p, q;
+	struct stat st;
+	int pipe_size;
 
 	if (video_format->id != yuv4mpeg->id)
 		return 0;
 
-	if (!(video_format->format == GLC_VIDEO_YCBCR_420JPEG))
+	if (!((video_format->format == GLC_VIDEO_YCBCR_420JPEG) |
+	      (video_format->format == GLC_VIDEO_NV12)))
 		return ENOTSUP;
+	yuv4mpeg->raw = (video_format->format == GLC_VIDEO_NV12);
 
-	if (yuv4mpeg->to) {
-		fclose(yuv4mpeg->to);
+	if (yuv4mpeg->to >= 0) {
+		yuv4mpeg_close(yuv4mpeg);
 		glc_log(yuv4mpeg->glc, GLC_WARNING, "yuv4mpeg", "video stream configuration changed");
 	}
 
@@ -185,8 +224,8 @@ int yuv4mpeg_handle_hdr(yuv4mpeg_t yuv4mpeg, glc_video_format_message_t *video_f
 	snprintf(filename, 1023, yuv4mpeg->filename_format, ++yuv4mpeg->file_count);
 	glc_log(yuv4mpeg->glc, GLC_INFORMATION, "yuv4mpeg", "opening %s for writing", filename);
 
-	yuv4mpeg->to = fopen(filename, "w");
-	if (!yuv4mpeg->to) {
+	yuv4mpeg->to = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (yuv4mpeg->to < 0) {
 		glc_log(yuv4mpeg->glc, GLC_ERROR, "yuv4mpeg", "can't open %s", filename);
 		free(filename);
 		return EINVAL;
@@ -196,18 +235,43 @@ int yuv4mpeg_handle_hdr(yuv4mpeg_t yuv4mpeg, glc_video_format_message_t *video_f
 	yuv4mpeg->size = video_format->width * video_format->height +
 			 (video_format->width * video_format->height) / 2;
 
-	if (yuv4mpeg->interpolate) {
-		if (yuv4mpeg->prev_video_frame_message)
-			yuv4mpeg->prev_video_frame_message = (char *) realloc(yuv4mpeg->prev_video_frame_message, yuv4mpeg->size);
-		else
-			yuv4mpeg->prev_video_frame_message = (char *) malloc(yuv4mpeg->size);
+	/*
+	 Pipes get pictures with vmsplice(), which only references our
+	 pages. Pictures are copied to the buffer that wasn't spliced
+	 last, so a full picture from the other buffer has been spliced
+	 since. If a picture fills the whole pipe no reference to the
+	 old contents can remain. Smaller pictures are written normally.
+	*/
+	yuv4mpeg->splice = 0;
+	if ((!fstat(yuv4mpeg->to, &st)) && (S_ISFIFO(st.st_mode))) {
+		pipe_size = fcntl(yuv4mpeg->to, F_GETPIPE_SZ);
+		if ((pipe_size > 0) && (yuv4mpeg->size >= (unsigned int) pipe_size))
+			yuv4mpeg->splice = 1;
+	}
 
-		/* Set Y' 0 */
-		memset(yuv4mpeg->prev_video_frame_message, 0, video_format->width * video_format->height);
-		/* Set CbCr 128 */
-		memset(&yuv4mpeg->prev_video_frame_message[video_format->width * video_format->height],
-		       128, (video_format->width * video_format->height) / 2);
+	/*
+	 Previous picture is needed for repeat messages too. Pages may
+	 still be referenced by the pipe so they are unmapped and
+	 never reused for anything else.
+	*/
+	yuv4mpeg_free_pics(yuv4mpeg);
+	yuv4mpeg->pic_size = yuv4mpeg->size;
+	for (p = 0; p < 2; p++) {
+		yuv4mpeg->pic[p] = mmap(NULL, yuv4mpeg->pic_size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (yuv4mpeg->pic[p] == MAP_FAILED) {
+			yuv4mpeg->pic[p] = NULL;
+			yuv4mpeg_free_pics(yuv4mpeg);
+			return ENOMEM;
+		}
 	}
+	yuv4mpeg->prev_video_frame_message = yuv4mpeg->pic[0];
+
+	/* Set Y' 0 */
+	memset(yuv4mpeg->prev_video_frame_message, 0, video_format->width * video_format->height);
+	/* Set CbCr 128, same for both planar and NV12 */
+	memset(&yuv4mpeg->prev_video_frame_message[video_format->width * video_format->height],
+	       128, (video_format->width * video_format->height) / 2);
 
 	/* calculate fps in p/q */
 	/** \todo something more intelligent perhaps... */
@@ -218,37 +282,145 @@ int yuv4mpeg_handle_hdr(yuv4mpeg_t yuv4mpeg, glc_video_format_message_t *video_f
 		p = q * yuv4mpeg->fps;
 	}
 
-	fprintf(yuv4mpeg->to, "YUV4MPEG2 W%d H%d F%d:%d Ip\n",
-		video_format->width, video_format->height, p, q);
+	if (yuv4mpeg->raw) {
+		glc_log(yuv4mpeg->glc, GLC_INFORMATION, "yuv4mpeg",
+			"writing raw NV12, read with '-f rawvideo -pix_fmt nv12 -s %dx%d -r %d/%d'",
+			video_format->width, video_format->height, p, q);
+		return 0;
+	}
+
+	if (dprintf(yuv4mpeg->to, "YUV4MPEG2 W%d H%d F%d:%d Ip\n",
+		    video_format->width, video_format->height, p, q) < 0)
+		return errno;
 	return 0;
 }
 
 int yuv4mpeg_handle_video_frame_message(yuv4mpeg_t yuv4mpeg, glc_video_frame_header_t *pic_hdr, char *data)
 {
+	unsigned int dup = 0;
+	int due, ret;
+	char *next;
+
 	if (pic_hdr->id != yuv4mpeg->id)
 		return 0;
 
-	if (yuv4mpeg->time < pic_hdr->time) {
+	if (yuv4mpeg->to < 0)
+		return 0; /* no format message for this stream yet */
+
+	due = (yuv4mpeg->time < pic_hdr->time);
+	if (due) {
 		while (yuv4mpeg->time + yuv4mpeg->fps_usec < pic_hdr->time) {
-			if (yuv4mpeg->interpolate)
-				yuv4mpeg_write_video_frame_message(yuv4mpeg, yuv4mpeg->prev_video_frame_message);
+			if (yuv4mpeg_in_range(yuv4mpeg, yuv4mpeg->time))
+				dup++;
 			yuv4mpeg->time += yuv4mpeg->fps_usec;
 		}
-		yuv4mpeg_write_video_frame_message(yuv4mpeg, data);
+		/* duplicates all point to the same pages */
+		if ((yuv4mpeg->interpolate) && (dup) &&
+		    ((ret = yuv4mpeg_write_video_frame_message(yuv4mpeg,
+				yuv4mpeg->prev_video_frame_message, dup))))
+			return ret;
+	}
+
+	/* spliced pages must stay valid, copy to the other buffer */
+	if ((yuv4mpeg->splice) && (data != yuv4mpeg->prev_video_frame_message)) {
+		next = (yuv4mpeg->spliced == yuv4mpeg->pic[0]) ?
+			yuv4mpeg->pic[1] : yuv4mpeg->pic[0];
+		memcpy(next, data, yuv4mpeg->size);
+		data = next;
+	}
+
+	if (due) {
+		if ((yuv4mpeg_in_range(yuv4mpeg, yuv4mpeg->time)) &&
+		    ((ret = yuv4mpeg_write_video_frame_message(yuv4mpeg, data, 1))))
+			return ret;
 		yuv4mpeg->time += yuv4mpeg->fps_usec;
 	}
 
-	if (yuv4mpeg->interpolate)
+	if (yuv4mpeg->splice)
+		yuv4mpeg->prev_video_frame_message = data;
+	else if (data != yuv4mpeg->prev_video_frame_message)
 		memcpy(yuv4mpeg->prev_video_frame_message, data, yuv4mpeg->size);
 
 	return 0;
 }
 
-int yuv4mpeg_write_video_frame_message(yuv4mpeg_t yuv4mpeg, char *pic)
+int yuv4mpeg_write_video_frame_message(yuv4mpeg_t yuv4mpeg, char *pic, unsigned int count)
 {
-	fprintf(yuv4mpeg->to, "FRAME\n");
-	fwrite(pic, 1, yuv4mpeg->size, yuv4mpeg->to);
+	struct iovec iov[YUV4MPEG_BATCH * 2];
+	int iovcnt, ret;
+
+	while (count) {
+		iovcnt = 0;
+		while ((count) && (iovcnt < YUV4MPEG_BATCH * 2)) {
+			if (!yuv4mpeg->raw) {
+				iov[iovcnt].iov_base = (void *) yuv4mpeg_frame_tag;
+				iov[iovcnt++].iov_len = sizeof(yuv4mpeg_frame_tag) - 1;
+			}
+			iov[iovcnt].iov_base = pic;
+			iov[iovcnt++].iov_len = yuv4mpeg->size;
+			count--;
+		}
+
+		if ((ret = yuv4mpeg_writev(yuv4mpeg, iov, iovcnt)))
+			return ret;
+	}
+
+	if (yuv4mpeg->splice)
+		yuv4mpeg->spliced = pic;
 	return 0;
 }
 
+int yuv4mpeg_writev(yuv4mpeg_t yuv4mpeg, struct iovec *iov, int iovcnt)
+{
+	ssize_t ret;
+
+	while (iovcnt) {
+		if (yuv4mpeg->splice)
+			ret = vmsplice(yuv4mpeg->to, iov, iovcnt, 0);
+		else
+			ret = writev(yuv4mpeg->to, iov, iovcnt);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+
+		/* skip what was written */
+		while ((iovcnt) && ((size_t) ret >= iov->iov_len)) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *) iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+void yuv4mpeg_close(yuv4mpeg_t yuv4mpeg)
+{
+	if (yuv4mpeg->to < 0)
+		return;
+
+	close(yuv4mpeg->to);
+	yuv4mpeg->to = -1;
+}
+
+void yuv4mpeg_free_pics(yuv4mpeg_t yuv4mpeg)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (yuv4mpeg->pic[i])
+			munmap(yuv4mpeg->pic[i], yuv4mpeg->pic_size);
+		yuv4mpeg->pic[i] = NULL;
+	}
+	yuv4mpeg->prev_video_frame_message = NULL;
+	yuv4mpeg->spliced = NULL;
+}
+
 /**  \} */
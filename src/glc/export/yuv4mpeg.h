@@ -68,6 +68,32 @@ __PUBLIC int yuv4mpeg_set_filename(yuv4mpeg_t yuv4mpeg, const char *filename);
  */
 __PUBLIC int yuv4mpeg_set_stream_id(yuv4mpeg_t yuv4mpeg, glc_stream_id_t id);
 
+/**
+ * \brief set stream time export starts from
+ *
+ * Gap between start time and first frame is filled as if
+ * stream started there. Set when stream is read from seek
+ * position, default is 0.
+ * \param yuv4mpeg yuv4mpeg object
+ * \param time start time in microseconds
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int yuv4mpeg_set_start_time(yuv4mpeg_t yuv4mpeg, glc_utime_t time);
+
+/**
+ * \brief write only frames in given stream time range
+ *
+ * Frames outside [begin, end) are skipped. Frame times still
+ * advance from start time, so consecutive ranges of one stream
+ * exported in parallel can be concatenated without gaps.
+ * Default is the whole stream.
+ * \param yuv4mpeg yuv4mpeg object
+ * \param begin first stream time in microseconds
+ * \param end end of range, 0 means no limit
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int yuv4mpeg_set_range(yuv4mpeg_t yuv4mpeg, glc_utime_t begin, glc_utime_t end);
+
 /**
  * \brief set fps
  *
@@ -94,7 +120,10 @@ __PUBLIC int yuv4mpeg_set_interpolation(yuv4mpeg_t yuv4mpeg, int interpolate);
  * \brief start yuv4mpeg process
  *
  * yuv4mpeg writes Y'CbCr frames in selected video stream
- * into yuv4mpeg formatted file.
+ * into yuv4mpeg formatted file. NV12 frames are written
+ * as raw video without yuv4mpeg headers, since yuv4mpeg
+ * can't describe NV12. When output is a pipe, pictures
+ * are passed with vmsplice() instead of being copied.
  * \param yuv4mpeg yuv4mpeg object
  * \param from source buffer
  * \return 0 on success otherwise an error code
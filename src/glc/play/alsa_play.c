@@ -29,6 +29,19 @@
 
 #include "alsa_play.h"
 
+/* device is kept this many periods ahead in mmap mode */
+#define ALSA_PLAY_MMAP_PERIODS		4
+/* snd_pcm_wait() timeout in ms, cancel is checked in between */
+#define ALSA_PLAY_MMAP_WAIT		100
+/* errors beyond this (usec) are corrected at once with silence or skip */
+#define ALSA_PLAY_HARD_SYNC		40000
+/* smaller errors (usec) are ignored */
+#define ALSA_PLAY_SOFT_SYNC		1000
+/* at most one frame out of this many is dropped or duplicated */
+#define ALSA_PLAY_SOFT_RATIO		200
+/* drift estimate is averaged over this many packets */
+#define ALSA_PLAY_DRIFT_SMOOTH		8
+
 struct alsa_play_s {
 	glc_t *glc;
 	glc_thread_t thread;
@@ -48,6 +61,12 @@ struct alsa_play_s {
 	int fmt;
 
 	void **bufs;
+
+	glc_utime_t period_time;
+	snd_pcm_format_t pcm_format;
+	snd_pcm_uframes_t period_size, buffer_size;
+	snd_pcm_channel_area_t *areas;
+	double drift;
 };
 
 int alsa_play_read_callback(glc_thread_state_t *state);
@@ -56,6 +75,11 @@ void alsa_play_finish_callback(void *priv, int err);
 int alsa_play_hw(alsa_play_t alsa_play, glc_audio_format_message_t *fmt_msg);
 int alsa_play_play(alsa_play_t alsa_play, glc_audio_data_header_t *audio_msg, char *data);
 
+int alsa_play_sw(alsa_play_t alsa_play);
+int alsa_play_mmap_play(alsa_play_t alsa_play, glc_audio_data_header_t *audio_hdr, char *data);
+int alsa_play_mmap_write(alsa_play_t alsa_play, snd_pcm_uframes_t offset,
+			 snd_pcm_uframes_t frames, int silence);
+
 snd_pcm_format_t glc_fmt_to_pcm_fmt(glc_audio_format_t format);
 
 int alsa_play_xrun(alsa_play_t alsa_play, int err);
@@ -88,6 +112,7 @@ int alsa_play_init(alsa_play_t *alsa_play, glc_t *glc)
 	(*alsa_play)->thread.read_callback = &alsa_play_read_callback;
 	(*alsa_play)->thread.finish_callback = &alsa_play_finish_callback;
 	(*alsa_play)->thread.threads = 1;
+	(*alsa_play)->thread.name = "alsa_play";
 
 	return 0;
 }
@@ -110,6 +135,14 @@ int alsa_play_set_stream_id(alsa_play_t alsa_play, glc_stream_id_t id)
 	return 0;
 }
 
+int alsa_play_set_mmap(alsa_play_t alsa_play, glc_utime_t period)
+{
+	if (alsa_play->running)
+		return EALREADY;
+	alsa_play->period_time = period;
+	return 0;
+}
+
 int alsa_play_process_start(alsa_play_t alsa_play, ps_buffer_t *from)
 {
 	int ret;
@@ -151,6 +184,11 @@ void alsa_play_finish_callback(void *priv, int err)
 		free(alsa_play->bufs);
 		alsa_play->bufs = NULL;
 	}
+
+	if (alsa_play->areas) {
+		free(alsa_play->areas);
+		alsa_play->areas = NULL;
+	}
 }
 
 int alsa_play_read_callback(glc_thread_state_t *state)
@@ -171,7 +209,7 @@ int alsa_play_hw(alsa_play_t alsa_play, glc_audio_format_message_t *fmt_msg)
 	snd_pcm_hw_params_t *hw_params = NULL;
 	snd_pcm_access_t access;
 	snd_pcm_uframes_t max_buffer_size;
-	unsigned int min_periods;
+	unsigned int min_periods, period_time, periods;
 	int dir, ret = 0;
 
 	if (fmt_msg->id != alsa_play->id)
@@ -182,10 +220,18 @@ int alsa_play_hw(alsa_play_t alsa_play, glc_audio_format_message_t *fmt_msg)
 	alsa_play->rate = fmt_msg->rate;
 	alsa_play->channels = fmt_msg->channels;
 
+	alsa_play->pcm_format = glc_fmt_to_pcm_fmt(alsa_play->format);
+	alsa_play->drift = 0;
+
 	if (alsa_play->pcm) /* re-open */
 		snd_pcm_close(alsa_play->pcm);
 
-	if (alsa_play->flags & GLC_AUDIO_INTERLEAVED)
+	if (alsa_play->period_time) {
+		if (alsa_play->flags & GLC_AUDIO_INTERLEAVED)
+			access = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+		else
+			access = SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
+	} else if (alsa_play->flags & GLC_AUDIO_INTERLEAVED)
 		access = SND_PCM_ACCESS_RW_INTERLEAVED;
 	else
 		access = SND_PCM_ACCESS_RW_NONINTERLEAVED;
@@ -201,7 +247,7 @@ int alsa_play_hw(alsa_play_t alsa_play, glc_audio_format_message_t *fmt_msg)
 						hw_params, access)) < 0)
 		goto err;
 	if ((ret = snd_pcm_hw_params_set_format(alsa_play->pcm, hw_params,
-						glc_fmt_to_pcm_fmt(alsa_play->format))) < 0)
+						alsa_play->pcm_format)) < 0)
 		goto err;
 	if ((ret = snd_pcm_hw_params_set_channels(alsa_play->pcm, hw_params,
 						  alsa_play->channels)) < 0)
@@ -209,24 +255,55 @@ int alsa_play_hw(alsa_play_t alsa_play, glc_audio_format_message_t *fmt_msg)
 	if ((ret = snd_pcm_hw_params_set_rate(alsa_play->pcm, hw_params,
 					      alsa_play->rate, 0)) < 0)
 		goto err;
-	if ((ret = snd_pcm_hw_params_get_buffer_size_max(hw_params,
-							 &max_buffer_size)) < 0)
-		goto err;
-	if ((ret = snd_pcm_hw_params_set_buffer_size(alsa_play->pcm,
-						     hw_params, max_buffer_size)) < 0)
-		goto err;
-	if ((ret = snd_pcm_hw_params_get_periods_min(hw_params, &min_periods, &dir)) < 0)
+	if (alsa_play->period_time) {
+		/* few short periods instead of one big safety buffer */
+		period_time = alsa_play->period_time;
+		dir = 0;
+		if ((ret = snd_pcm_hw_params_set_period_time_near(alsa_play->pcm, hw_params,
+								  &period_time, &dir)) < 0)
+			goto err;
+		periods = ALSA_PLAY_MMAP_PERIODS;
+		dir = 0;
+		if ((ret = snd_pcm_hw_params_set_periods_near(alsa_play->pcm, hw_params,
+							      &periods, &dir)) < 0)
+			goto err;
+	} else {
+		if ((ret = snd_pcm_hw_params_get_buffer_size_max(hw_params,
+								 &max_buffer_size)) < 0)
+			goto err;
+		if ((ret = snd_pcm_hw_params_set_buffer_size(alsa_play->pcm,
+							     hw_params, max_buffer_size)) < 0)
+			goto err;
+		if ((ret = snd_pcm_hw_params_get_periods_min(hw_params, &min_periods, &dir)) < 0)
+			goto err;
+		if ((ret = snd_pcm_hw_params_set_periods(alsa_play->pcm, hw_params,
+							 min_periods < 2 ? 2 : min_periods, dir)) < 0)
+			goto err;
+	}
+	if ((ret = snd_pcm_hw_params(alsa_play->pcm, hw_params)) < 0)
 		goto err;
-	if ((ret = snd_pcm_hw_params_set_periods(alsa_play->pcm, hw_params,
-						 min_periods < 2 ? 2 : min_periods, dir)) < 0)
+	if ((ret = snd_pcm_hw_params_get_period_size(hw_params,
+						     &alsa_play->period_size, &dir)) < 0)
 		goto err;
-	if ((ret = snd_pcm_hw_params(alsa_play->pcm, hw_params)) < 0)
+	if ((ret = snd_pcm_hw_params_get_buffer_size(hw_params,
+						     &alsa_play->buffer_size)) < 0)
 		goto err;
 
-	alsa_play->bufs = (void **) malloc(sizeof(void *) * alsa_play->channels);
+	if (alsa_play->period_time) {
+		if ((ret = alsa_play_sw(alsa_play)) < 0)
+			goto err;
+		alsa_play->areas = (snd_pcm_channel_area_t *)
+			realloc(alsa_play->areas,
+				sizeof(snd_pcm_channel_area_t) * alsa_play->channels);
+	} else
+		alsa_play->bufs = (void **) realloc(alsa_play->bufs,
+						    sizeof(void *) * alsa_play->channels);
 
 	glc_log(alsa_play->glc, GLC_INFORMATION, "alsa_play",
-		"opened pcm %s for playback", alsa_play->device);
+		"opened pcm %s for %splayback, %lu frame periods, %lu frame buffer",
+		alsa_play->device, alsa_play->period_time ? "mmap " : "",
+		(unsigned long) alsa_play->period_size,
+		(unsigned long) alsa_play->buffer_size);
 
 	snd_pcm_hw_params_free(hw_params);
 	return 0;
@@ -254,6 +331,9 @@ int alsa_play_play(alsa_play_t alsa_play, glc_audio_data_header_t *audio_hdr, ch
 		return EINVAL;
 	}
 
+	if (alsa_play->period_time)
+		return alsa_play_mmap_play(alsa_play, audio_hdr, data);
+
 	frames = snd_pcm_bytes_to_frames(alsa_play->pcm, audio_hdr->size);
 	glc_utime_t time = glc_state_time(alsa_play->glc);
 	glc_utime_t duration = ((glc_utime_t) 1000000 * (glc_utime_t) frames) /
@@ -302,6 +382,196 @@ int alsa_play_play(alsa_play_t alsa_play, glc_audio_data_header_t *audio_hdr, ch
 	return 0;
 }
 
+int alsa_play_sw(alsa_play_t alsa_play)
+{
+	snd_pcm_sw_params_t *sw_params = NULL;
+	int ret;
+
+	if ((ret = snd_pcm_sw_params_malloc(&sw_params)) < 0)
+		return ret;
+	if ((ret = snd_pcm_sw_params_current(alsa_play->pcm, sw_params)) < 0)
+		goto finish;
+	/* start as soon as first period is queued */
+	if ((ret = snd_pcm_sw_params_set_start_threshold(alsa_play->pcm, sw_params,
+							 alsa_play->period_size)) < 0)
+		goto finish;
+	if ((ret = snd_pcm_sw_params_set_avail_min(alsa_play->pcm, sw_params,
+						   alsa_play->period_size)) < 0)
+		goto finish;
+	ret = snd_pcm_sw_params(alsa_play->pcm, sw_params);
+finish:
+	snd_pcm_sw_params_free(sw_params);
+	return ret;
+}
+
+int alsa_play_mmap_play(alsa_play_t alsa_play, glc_audio_data_header_t *audio_hdr, char *data)
+{
+	snd_pcm_uframes_t frames, pos, seg;
+	snd_pcm_sframes_t delay, error, correction, max, n, hard, soft;
+	unsigned int c, bits;
+	long long ahead;
+	int ret;
+
+	frames = snd_pcm_bytes_to_frames(alsa_play->pcm, audio_hdr->size);
+	if (!frames)
+		return 0;
+
+	/* source areas describe packet in same terms as device buffer */
+	bits = snd_pcm_format_physical_width(alsa_play->pcm_format);
+	for (c = 0; c < alsa_play->channels; c++) {
+		if (alsa_play->flags & GLC_AUDIO_INTERLEAVED) {
+			alsa_play->areas[c].addr = data;
+			alsa_play->areas[c].first = c * bits;
+			alsa_play->areas[c].step = alsa_play->channels * bits;
+		} else {
+			alsa_play->areas[c].addr =
+				&data[snd_pcm_samples_to_bytes(alsa_play->pcm, frames) * c];
+			alsa_play->areas[c].first = 0;
+			alsa_play->areas[c].step = bits;
+		}
+	}
+
+	/*
+	 Everything queued plays before this packet, so packet is heard
+	 after 'delay' frames. Error is how many frames early (positive)
+	 or late (negative) that is compared to state time.
+	*/
+	while ((ret = snd_pcm_delay(alsa_play->pcm, &delay)) < 0) {
+		if ((ret = alsa_play_xrun(alsa_play, ret)))
+			return ret;
+	}
+	if (delay < 0)
+		delay = 0;
+
+	ahead = (long long) audio_hdr->time - (long long) glc_state_time(alsa_play->glc);
+	error = (snd_pcm_sframes_t) (ahead * alsa_play->rate / 1000000) - delay;
+	pos = 0;
+	correction = 0;
+
+	hard = (long long) ALSA_PLAY_HARD_SYNC * alsa_play->rate / 1000000;
+	soft = (long long) ALSA_PLAY_SOFT_SYNC * alsa_play->rate / 1000000;
+
+	if (ahead - (long long) alsa_play->silence_threshold > 0 &&
+	    snd_pcm_state(alsa_play->pcm) != SND_PCM_STATE_RUNNING) {
+		/* gap in stream, nothing to keep running so just sleep */
+		usleep(ahead - (long long) alsa_play->silence_threshold);
+		error = (snd_pcm_sframes_t) (alsa_play->silence_threshold *
+					     alsa_play->rate / 1000000) - delay;
+	}
+
+	if (error <= -(snd_pcm_sframes_t) frames) {
+		glc_log(alsa_play->glc, GLC_DEBUG, "alsa_play", "dropped packet");
+		alsa_play->drift = 0;
+		return 0;
+	} else if (error >= hard) {
+		/* fill up to packet start so that device keeps running */
+		alsa_play->drift = 0;
+		if ((ret = alsa_play_mmap_write(alsa_play, 0, error, 1)))
+			return ret;
+	} else if (error <= -hard) {
+		glc_log(alsa_play->glc, GLC_DEBUG, "alsa_play", "skipping %ld frames",
+			 (long) -error);
+		alsa_play->drift = 0;
+		pos = -error;
+	} else {
+		/*
+		 Small errors are clock drift between sound card and state
+		 time. Those are evened out by dropping or duplicating single
+		 frames spread over the packet, which is not audible unlike
+		 silence or skips.
+		*/
+		alsa_play->drift += (error - alsa_play->drift) / ALSA_PLAY_DRIFT_SMOOTH;
+		if (alsa_play->drift > soft || alsa_play->drift < -soft) {
+			max = frames / ALSA_PLAY_SOFT_RATIO;
+			if (!max && frames > 1)
+				max = 1;
+			correction = (snd_pcm_sframes_t) alsa_play->drift;
+			if (correction > max)
+				correction = max;
+			else if (correction < -max)
+				correction = -max;
+			alsa_play->drift -= correction;
+		}
+	}
+
+	if (correction) {
+		n = correction < 0 ? -correction : correction;
+		seg = (frames - pos) / (n + 1);
+		while (n-- > 0) {
+			if ((ret = alsa_play_mmap_write(alsa_play, pos, seg, 0)))
+				return ret;
+			pos += seg;
+			if (correction > 0) {
+				if ((ret = alsa_play_mmap_write(alsa_play, pos - 1, 1, 0)))
+					return ret;
+			} else
+				pos++;
+		}
+	}
+
+	return alsa_play_mmap_write(alsa_play, pos, frames - pos, 0);
+}
+
+int alsa_play_mmap_write(alsa_play_t alsa_play, snd_pcm_uframes_t offset,
+			 snd_pcm_uframes_t frames, int silence)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t pcm_offset, size;
+	snd_pcm_sframes_t avail, committed;
+	int ret;
+
+	while (frames > 0) {
+		if ((avail = snd_pcm_avail_update(alsa_play->pcm)) < 0) {
+			if ((ret = alsa_play_xrun(alsa_play, avail)))
+				goto err;
+			continue;
+		}
+
+		if ((snd_pcm_uframes_t) avail < frames &&
+		    (snd_pcm_uframes_t) avail < alsa_play->period_size) {
+			/* device starts by itself once start threshold is met */
+			if (glc_state_test(alsa_play->glc, GLC_STATE_CANCEL))
+				return 0;
+			if ((ret = snd_pcm_wait(alsa_play->pcm, ALSA_PLAY_MMAP_WAIT)) < 0) {
+				if ((ret = alsa_play_xrun(alsa_play, ret)))
+					goto err;
+			}
+			continue;
+		}
+
+		size = frames;
+		if ((ret = snd_pcm_mmap_begin(alsa_play->pcm, &areas,
+					      &pcm_offset, &size)) < 0) {
+			if ((ret = alsa_play_xrun(alsa_play, ret)))
+				goto err;
+			continue;
+		}
+
+		if (silence)
+			snd_pcm_areas_silence(areas, pcm_offset, alsa_play->channels,
+					      size, alsa_play->pcm_format);
+		else
+			snd_pcm_areas_copy(areas, pcm_offset, alsa_play->areas, offset,
+					   alsa_play->channels, size, alsa_play->pcm_format);
+
+		committed = snd_pcm_mmap_commit(alsa_play->pcm, pcm_offset, size);
+		if (committed < 0 || (snd_pcm_uframes_t) committed != size) {
+			if ((ret = alsa_play_xrun(alsa_play, committed < 0 ? committed : -EPIPE)))
+				goto err;
+			continue;
+		}
+
+		offset += size;
+		frames -= size;
+	}
+
+	return 0;
+err:
+	glc_log(alsa_play->glc, GLC_ERROR, "alsa_play",
+		 "xrun recovery failed: %s", snd_strerror(-ret));
+	return ret;
+}
+
 int alsa_play_xrun(alsa_play_t alsa_play, int err)
 {
 	if (err == -EPIPE) {
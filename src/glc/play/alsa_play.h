@@ -64,6 +64,20 @@ __PUBLIC int alsa_play_set_stream_id(alsa_play_t alsa_play, glc_stream_id_t id);
 __PUBLIC int alsa_play_set_alsa_playback_device(alsa_play_t alsa_play,
 						 const char *device);
 
+/**
+ * \brief use mmap playback with short periods
+ *
+ * Default is to write into a large device buffer and only
+ * drop late packets. In mmap mode device buffer holds only a
+ * few periods, and audio is kept locked to state time by
+ * dropping or duplicating single frames. Larger errors are
+ * corrected with silence or by skipping frames.
+ * \param alsa_play alsa_play object
+ * \param period period length in microseconds, 0 disables mmap mode
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int alsa_play_set_mmap(alsa_play_t alsa_play, glc_utime_t period);
+
 /**
  * \brief start alsa_play process
  *
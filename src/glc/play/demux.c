@@ -25,11 +25,16 @@
 #include <glc/common/state.h>
 #include <glc/common/thread.h>
 #include <glc/common/util.h>
+#include <glc/common/registry.h>
+#include <glc/common/shared.h>
 
 #include "demux.h"
 #include "gl_play.h"
 #include "alsa_play.h"
 
+/* messages from this size up are passed through shared pool */
+#define DEMUX_SHARED_MIN             4096
+
 struct demux_video_stream_s {
 	glc_stream_id_t id;
 	ps_buffer_t buffer;
@@ -37,8 +42,6 @@ struct demux_video_stream_s {
 
 	int running;
 	gl_play_t gl_play;
-
-	struct demux_video_stream_s *next;
 };
 
 struct demux_audio_stream_s {
@@ -48,8 +51,6 @@ struct demux_audio_stream_s {
 
 	int running;
 	alsa_play_t alsa_play;
-
-	struct demux_audio_stream_s *next;
 };
 
 struct demux_s {
@@ -60,16 +61,33 @@ struct demux_s {
 	int running;
 
 	const char *alsa_playback_device;
+	glc_utime_t alsa_period;
+
+	int color_override;
+	float brightness, contrast;
+	float red_gamma, green_gamma, blue_gamma;
 
 	ps_bufferattr_t video_bufferattr;
 	ps_bufferattr_t audio_bufferattr;
 
-	struct demux_video_stream_s *video;
-	struct demux_audio_stream_s *audio;
+	size_t shared_size;
+	glc_shared_pool_t shared;
+
+	glc_registry_t video;
+	glc_registry_t audio;
+};
+
+struct demux_broadcast_s {
+	demux_t demux;
+	glc_message_header_t *header;
+	char *data;
+	size_t size;
 };
 
 int demux_close(demux_t demux);
 void *demux_thread(void *argptr);
+int demux_send(demux_t demux, ps_packet_t *packet, glc_message_header_t *header,
+	       char *data, size_t size);
 
 int demux_video_stream_message(demux_t demux, glc_message_header_t *header,
 			       char *data, size_t size);
@@ -79,6 +97,9 @@ int demux_video_stream_send(demux_t demux, struct demux_video_stream_s *video,
 			    glc_message_header_t *header, char *data, size_t size);
 int demux_video_stream_close(demux_t demux);
 int demux_video_stream_clean(demux_t demux, struct demux_video_stream_s *video);
+int demux_video_stream_start(void *entry, glc_stream_id_t id, void *arg);
+int demux_video_stream_stop(void *entry, glc_stream_id_t id, void *arg);
+int demux_video_stream_broadcast(void *entry, glc_stream_id_t id, void *arg);
 
 int demux_audio_stream_message(demux_t demux, glc_message_header_t *header,
 			       char *data, size_t size);
@@ -88,28 +109,50 @@ int demux_audio_stream_send(demux_t demux, struct demux_audio_stream_s *audio,
 			 glc_message_header_t *header, char *data, size_t size);
 int demux_audio_stream_close(demux_t demux);
 int demux_audio_stream_clean(demux_t demux, struct demux_audio_stream_s *audio);
+int demux_audio_stream_start(void *entry, glc_stream_id_t id, void *arg);
+int demux_audio_stream_stop(void *entry, glc_stream_id_t id, void *arg);
+int demux_audio_stream_broadcast(void *entry, glc_stream_id_t id, void *arg);
 
 int demux_init(demux_t *demux, glc_t *glc)
 {
+	int ret;
+
 	*demux = malloc(sizeof(struct demux_s));
 	memset(*demux, 0, sizeof(struct demux_s));
 
 	(*demux)->glc = glc;
+	if ((ret = glc_registry_init(&(*demux)->video, sizeof(struct demux_video_stream_s),
+				     &demux_video_stream_start, NULL, *demux)))
+		goto err;
+	if ((ret = glc_registry_init(&(*demux)->audio, sizeof(struct demux_audio_stream_s),
+				     &demux_audio_stream_start, NULL, *demux))) {
+		glc_registry_destroy((*demux)->video);
+		goto err;
+	}
 	(*demux)->alsa_playback_device = "default";
 
 	ps_bufferattr_init(&(*demux)->video_bufferattr);
 	ps_bufferattr_init(&(*demux)->audio_bufferattr);
 
-	ps_bufferattr_setsize(&(*demux)->video_bufferattr, 1024 * 1024 * 10);
-	ps_bufferattr_setsize(&(*demux)->audio_bufferattr, 1024 * 1024 * 1);
+	ps_bufferattr_setsize(&(*demux)->video_bufferattr, 1024 * 1024 * 1);
+	ps_bufferattr_setsize(&(*demux)->audio_bufferattr, 1024 * 256);
+	(*demux)->shared_size = 1024 * 1024 * 10;
 
 	return 0;
+err:
+	free(*demux);
+	return ret;
 }
 
 int demux_destroy(demux_t demux)
 {
+	/* streams may still hold shared messages */
+	if (demux->shared)
+		glc_shared_pool_destroy(demux->shared);
 	ps_bufferattr_destroy(&demux->video_bufferattr);
 	ps_bufferattr_destroy(&demux->audio_bufferattr);
+	glc_registry_destroy(demux->video);
+	glc_registry_destroy(demux->audio);
 	free(demux);
 
 	return 0;
@@ -125,12 +168,38 @@ int demux_set_audio_buffer_size(demux_t demux, size_t size)
 	return ps_bufferattr_setsize(&demux->audio_bufferattr, size);
 }
 
+int demux_set_shared_size(demux_t demux, size_t size)
+{
+	if (demux->running)
+		return EALREADY;
+	demux->shared_size = size;
+	return 0;
+}
+
 int demux_set_alsa_playback_device(demux_t demux, const char *device)
 {
 	demux->alsa_playback_device = device;
 	return 0;
 }
 
+int demux_set_alsa_mmap(demux_t demux, glc_utime_t period)
+{
+	demux->alsa_period = period;
+	return 0;
+}
+
+int demux_set_color_override(demux_t demux, float brightness, float contrast,
+			     float red, float green, float blue)
+{
+	demux->color_override = 1;
+	demux->brightness = brightness;
+	demux->contrast = contrast;
+	demux->red_gamma = red;
+	demux->green_gamma = green;
+	demux->blue_gamma = blue;
+	return 0;
+}
+
 int demux_process_start(demux_t demux, ps_buffer_t *from)
 {
 	int ret;
@@ -140,6 +209,10 @@ int demux_process_start(demux_t demux, ps_buffer_t *from)
 
 	demux->from = from;
 
+	if ((!demux->shared) &&
+	    ((ret = glc_shared_pool_init(&demux->shared, demux->glc, demux->shared_size))))
+		return ret;
+
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
@@ -166,17 +239,13 @@ int demux_close(demux_t demux)
 {
 	int ret = 0;
 
-	if (demux->video != NULL) {
-		if ((ret = demux_video_stream_close(demux)))
-			glc_log(demux->glc, GLC_ERROR, "demux", "can't close video streams: %s (%d)",
-				 strerror(ret), ret);
-	}
+	if ((ret = demux_video_stream_close(demux)))
+		glc_log(demux->glc, GLC_ERROR, "demux", "can't close video streams: %s (%d)",
+			 strerror(ret), ret);
 
-	if (demux->audio != NULL) {
-		if ((ret = demux_audio_stream_close(demux)))
-			glc_log(demux->glc, GLC_ERROR, "demux", "can't close audio streams: %s (%d)",
-				 strerror(ret), ret);
-	}
+	if ((ret = demux_audio_stream_close(demux)))
+		glc_log(demux->glc, GLC_ERROR, "demux", "can't close audio streams: %s (%d)",
+			 strerror(ret), ret);
 
 	return 0;
 }
@@ -185,9 +254,10 @@ void *demux_thread(void *argptr)
 {
 	demux_t demux = (demux_t ) argptr;
 	glc_message_header_t msg_hdr;
+	glc_shared_ref_t in;
 	size_t data_size;
 	char *data;
-	int ret = 0;
+	int ret = 0, has_in = 0;
 
 	ps_packet_t read;
 
@@ -203,12 +273,24 @@ void *demux_thread(void *argptr)
 		if ((ret = ps_packet_getsize(&read, &data_size)))
 			goto err;
 		data_size -= sizeof(glc_message_header_t);
-		if ((ret = ps_packet_dma(&read, (void *) &data, data_size, PS_ACCEPT_FAKE_DMA)))
+
+		if (msg_hdr.type == GLC_MESSAGE_SHARED_REF) {
+			/* resolve references from mirrored ring */
+			if ((ret = ps_packet_read(&read, &in, sizeof(glc_shared_ref_t))))
+				goto err;
+			has_in = 1;
+			msg_hdr.type = in.type;
+			data = in.data;
+			data_size = in.size;
+		} else if ((ret = ps_packet_dma(&read, (void *) &data, data_size,
+					       PS_ACCEPT_FAKE_DMA)))
 			goto err;
 
 		if ((msg_hdr.type == GLC_MESSAGE_CLOSE) |
 		    (msg_hdr.type == GLC_MESSAGE_VIDEO_FRAME) |
-		    (msg_hdr.type == GLC_MESSAGE_VIDEO_FORMAT)) {
+		    (msg_hdr.type == GLC_MESSAGE_VIDEO_REPEAT) |
+		    (msg_hdr.type == GLC_MESSAGE_VIDEO_FORMAT) |
+		    (msg_hdr.type == GLC_MESSAGE_COLOR)) {
 			/* handle msg to gl_play */
 			demux_video_stream_message(demux, &msg_hdr, data, data_size);
 		}
@@ -221,10 +303,17 @@ void *demux_thread(void *argptr)
 		}
 
 		ps_packet_close(&read);
+
+		if (has_in) {
+			has_in = 0;
+			in.release(in.arg);
+		}
 	} while ((!glc_state_test(demux->glc, GLC_STATE_CANCEL)) &&
 		 (msg_hdr.type != GLC_MESSAGE_CLOSE));
 
 finish:
+	if (has_in)
+		in.release(in.arg);
 	ps_packet_destroy(&read);
 
 	if (glc_state_test(demux->glc, GLC_STATE_CANCEL))
@@ -243,28 +332,58 @@ err:
 	goto finish;
 }
 
+int demux_send(demux_t demux, ps_packet_t *packet, glc_message_header_t *header,
+	       char *data, size_t size)
+{
+	glc_shared_ref_t ref;
+	int ret;
+
+	if (size >= DEMUX_SHARED_MIN) {
+		/* stream buffer holds only the reference */
+		if ((ret = glc_shared_copy(demux->shared, header->type, data, size, 1, &ref)))
+			return ret;
+		return glc_shared_write(packet, &ref);
+	}
+
+	if ((ret = ps_packet_open(packet, PS_PACKET_WRITE)))
+		return ret;
+	if ((ret = ps_packet_write(packet, header, sizeof(glc_message_header_t))))
+		return ret;
+	if ((ret = ps_packet_write(packet, data, size)))
+		return ret;
+	return ps_packet_close(packet);
+}
+
 int demux_video_stream_message(demux_t demux, glc_message_header_t *header,
 			char *data, size_t size)
 {
 	struct demux_video_stream_s *video;
+	struct demux_broadcast_s broadcast;
 	glc_stream_id_t id;
 	int ret;
 
 	if (header->type == GLC_MESSAGE_CLOSE) {
 		/* broadcast to all */
-		video = demux->video;
-		while (video != NULL) {
-			if (video->running) {
-				if ((ret = demux_video_stream_send(demux, video, header, data, size)))
-					return ret;
-			}
-			video = video->next;
-		}
-		return 0;
+		broadcast.demux = demux;
+		broadcast.header = header;
+		broadcast.data = data;
+		broadcast.size = size;
+		return glc_registry_iterate(demux->video, &demux_video_stream_broadcast,
+					    &broadcast);
 	} else if (header->type == GLC_MESSAGE_VIDEO_FORMAT)
 		id = ((glc_video_format_message_t *) data)->id;
-	else if (header->type == GLC_MESSAGE_VIDEO_FRAME)
+	else if ((header->type == GLC_MESSAGE_VIDEO_FRAME) |
+		 (header->type == GLC_MESSAGE_VIDEO_REPEAT)) {
 		id = ((glc_video_frame_header_t *) data)->id;
+
+		/* don't copy frames gl_play would drop */
+		if ((header->type == GLC_MESSAGE_VIDEO_FRAME) &&
+		    (glc_state_video_late(demux->glc, id,
+					  ((glc_video_frame_header_t *) data)->time)))
+			return 0;
+	}
+	else if (header->type == GLC_MESSAGE_COLOR)
+		id = ((glc_color_message_t *) data)->id;
 	else
 		return EINVAL;
 
@@ -282,16 +401,10 @@ int demux_video_stream_send(demux_t demux, struct demux_video_stream_s *video,
 			 glc_message_header_t *header, char *data, size_t size)
 {
 	int ret;
-	if ((ret = ps_packet_open(&video->packet, PS_PACKET_WRITE)))
-		goto err;
-	if ((ret = ps_packet_write(&video->packet, header, sizeof(glc_message_header_t))))
-		goto err;
-	if ((ret = ps_packet_write(&video->packet, data, size)))
-		goto err;
-	if ((ret = ps_packet_close(&video->packet)))
+	if ((ret = demux_send(demux, &video->packet, header, data, size)))
 		goto err;
 err:
-	if (ret != EINTR)
+	if ((ret != EINTR) || (glc_state_test(demux->glc, GLC_STATE_CANCEL)))
 		return ret;
 
 	/* since it is EINTR, _cancel() is already done */
@@ -302,54 +415,63 @@ err:
 
 int demux_video_stream_close(demux_t demux)
 {
-	struct demux_video_stream_s *del;
-
-	while (demux->video != NULL) {
-		del = demux->video;
-		demux->video = demux->video->next;
+	glc_registry_iterate(demux->video, &demux_video_stream_stop, demux);
+	return glc_registry_clear(demux->video);
+}
 
-		if (del->running) {
-			ps_buffer_cancel(&del->buffer);
-			demux_video_stream_clean(demux, del);
-		}
+int demux_video_stream_stop(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct demux_video_stream_s *video = entry;
 
-		free(del);
+	if (video->running) {
+		ps_buffer_cancel(&video->buffer);
+		demux_video_stream_clean((demux_t) arg, video);
 	}
 	return 0;
 }
 
+int demux_video_stream_broadcast(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct demux_video_stream_s *video = entry;
+	struct demux_broadcast_s *broadcast = arg;
+
+	if (!video->running)
+		return 0;
+	return demux_video_stream_send(broadcast->demux, video, broadcast->header,
+				       broadcast->data, broadcast->size);
+}
+
 int demux_video_stream_get(demux_t demux, glc_stream_id_t id, struct demux_video_stream_s **video)
 {
-	int ret;
-	*video = demux->video;
+	return glc_registry_get(demux->video, id, (void **) video);
+}
 
-	while (*video != NULL) {
-		if ((*video)->id == id)
-			break;
-		*video = (*video)->next;
-	}
+int demux_video_stream_start(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct demux_video_stream_s *video = entry;
+	demux_t demux = arg;
+	int ret;
 
-	if (*video == NULL) {
-		*video = malloc(sizeof(struct demux_video_stream_s));
-		memset(*video, 0, sizeof(struct demux_video_stream_s));
-		(*video)->id = id;
+	video->id = id;
 
-		if ((ret = ps_buffer_init(&(*video)->buffer, &demux->video_bufferattr)))
-			return ret;
-		if ((ret = ps_packet_init(&(*video)->packet, &(*video)->buffer)))
-			return ret;
+	if ((ret = ps_buffer_init(&video->buffer, &demux->video_bufferattr)))
+		return ret;
+	if ((ret = ps_packet_init(&video->packet, &video->buffer)))
+		return ret;
 
-		if ((ret = gl_play_init(&(*video)->gl_play, demux->glc)))
-			return ret;
-		if ((ret = gl_play_set_stream_id((*video)->gl_play, (*video)->id)))
-			return ret;
-		if ((ret = gl_play_process_start((*video)->gl_play, &(*video)->buffer)))
-			return ret;
-		(*video)->running = 1;
+	if ((ret = gl_play_init(&video->gl_play, demux->glc)))
+		return ret;
+	if ((ret = gl_play_set_stream_id(video->gl_play, video->id)))
+		return ret;
+	if ((demux->color_override) &&
+	    ((ret = gl_play_set_color_override(video->gl_play, demux->brightness,
+					       demux->contrast, demux->red_gamma,
+					       demux->green_gamma, demux->blue_gamma))))
+		return ret;
+	if ((ret = gl_play_process_start(video->gl_play, &video->buffer)))
+		return ret;
+	video->running = 1;
 
-		(*video)->next = demux->video;
-		demux->video = (*video);
-	}
 	return 0;
 }
 
@@ -372,20 +494,18 @@ int demux_audio_stream_message(demux_t demux, glc_message_header_t *header,
 			char *data, size_t size)
 {
 	struct demux_audio_stream_s *audio;
+	struct demux_broadcast_s broadcast;
 	glc_stream_id_t id;
 	int ret;
 
 	if (header->type == GLC_MESSAGE_CLOSE) {
 		/* broadcast to all */
-		audio = demux->audio;
-		while (audio != NULL) {
-			if (audio->running) {
-				if ((ret = demux_audio_stream_send(demux, audio, header, data, size)))
-					return ret;
-			}
-			audio = audio->next;
-		}
-		return 0;
+		broadcast.demux = demux;
+		broadcast.header = header;
+		broadcast.data = data;
+		broadcast.size = size;
+		return glc_registry_iterate(demux->audio, &demux_audio_stream_broadcast,
+					    &broadcast);
 	} else if (header->type == GLC_MESSAGE_AUDIO_FORMAT)
 		id = ((glc_audio_format_message_t *) data)->id;
 	else if (header->type == GLC_MESSAGE_AUDIO_DATA)
@@ -405,60 +525,64 @@ int demux_audio_stream_message(demux_t demux, glc_message_header_t *header,
 
 int demux_audio_stream_close(demux_t demux)
 {
-	struct demux_audio_stream_s *del;
-
-	while (demux->audio != NULL) {
-		del = demux->audio;
-		demux->audio = demux->audio->next;
+	glc_registry_iterate(demux->audio, &demux_audio_stream_stop, demux);
+	return glc_registry_clear(demux->audio);
+}
 
-		if (del->running) {
-			ps_buffer_cancel(&del->buffer);
-			demux_audio_stream_clean(demux, del);
-		}
+int demux_audio_stream_stop(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct demux_audio_stream_s *audio = entry;
 
-		free(del);
+	if (audio->running) {
+		ps_buffer_cancel(&audio->buffer);
+		demux_audio_stream_clean((demux_t) arg, audio);
 	}
 	return 0;
 }
 
+int demux_audio_stream_broadcast(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct demux_audio_stream_s *audio = entry;
+	struct demux_broadcast_s *broadcast = arg;
+
+	if (!audio->running)
+		return 0;
+	return demux_audio_stream_send(broadcast->demux, audio, broadcast->header,
+				       broadcast->data, broadcast->size);
+}
+
 int demux_audio_stream_get(demux_t demux, glc_stream_id_t id,
 			   struct demux_audio_stream_s **audio)
 {
-	int ret;
-	*audio = demux->audio;
+	return glc_registry_get(demux->audio, id, (void **) audio);
+}
 
-	while (*audio != NULL) {
-		if ((*audio)->id == id)
-			break;
-		*audio = (*audio)->next;
-	}
+int demux_audio_stream_start(void *entry, glc_stream_id_t id, void *arg)
+{
+	struct demux_audio_stream_s *audio = entry;
+	demux_t demux = arg;
+	int ret;
 
-	if (*audio == NULL) {
-		*audio = malloc(sizeof(struct demux_audio_stream_s));
-		memset(*audio, 0, sizeof(struct demux_audio_stream_s));
-		(*audio)->id = id;
+	audio->id = id;
 
-		if ((ret = ps_buffer_init(&(*audio)->buffer, &demux->audio_bufferattr)))
-			return ret;
-		if ((ret = ps_packet_init(&(*audio)->packet, &(*audio)->buffer)))
-			return ret;
+	if ((ret = ps_buffer_init(&audio->buffer, &demux->audio_bufferattr)))
+		return ret;
+	if ((ret = ps_packet_init(&audio->packet, &audio->buffer)))
+		return ret;
 
-		if ((ret = alsa_play_init(&(*audio)->alsa_play, demux->glc)))
-			return ret;
-		if ((ret = alsa_play_set_stream_id((*audio)->alsa_play,
-							(*audio)->id)))
-			return ret;
-		if ((ret = alsa_play_set_alsa_playback_device((*audio)->alsa_play,
-							       demux->alsa_playback_device)))
-			return ret;
-		if ((ret = alsa_play_process_start((*audio)->alsa_play,
-						    &(*audio)->buffer)))
-			return ret;
-		(*audio)->running = 1;
+	if ((ret = alsa_play_init(&audio->alsa_play, demux->glc)))
+		return ret;
+	if ((ret = alsa_play_set_stream_id(audio->alsa_play, audio->id)))
+		return ret;
+	if ((ret = alsa_play_set_alsa_playback_device(audio->alsa_play,
+						      demux->alsa_playback_device)))
+		return ret;
+	if ((ret = alsa_play_set_mmap(audio->alsa_play, demux->alsa_period)))
+		return ret;
+	if ((ret = alsa_play_process_start(audio->alsa_play, &audio->buffer)))
+		return ret;
+	audio->running = 1;
 
-		(*audio)->next = demux->audio;
-		demux->audio = (*audio);
-	}
 	return 0;
 }
 
@@ -466,16 +590,10 @@ int demux_audio_stream_send(demux_t demux, struct demux_audio_stream_s *audio,
 			 glc_message_header_t *header, char *data, size_t size)
 {
 	int ret;
-	if ((ret = ps_packet_open(&audio->packet, PS_PACKET_WRITE)))
-		goto err;
-	if ((ret = ps_packet_write(&audio->packet, header, sizeof(glc_message_header_t))))
-		goto err;
-	if ((ret = ps_packet_write(&audio->packet, data, size)))
-		goto err;
-	if ((ret = ps_packet_close(&audio->packet)))
+	if ((ret = demux_send(demux, &audio->packet, header, data, size)))
 		goto err;
 err:
-	if (ret != EINTR)
+	if ((ret != EINTR) || (glc_state_test(demux->glc, GLC_STATE_CANCEL)))
 		return ret;
 
 	glc_log(demux->glc, GLC_DEBUG, "demux", "audio stream %d has quit", audio->id);
@@ -46,7 +46,9 @@ __PUBLIC int demux_destroy(demux_t demux);
 /**
  * \brief set video stream buffer size
  *
- * Default buffer size for video streams is 10 MiB
+ * Pictures are held in shared memory, stream buffer holds
+ * references and small messages. Default buffer size for
+ * video streams is 1 MiB
  * \param demux demux object
  * \param size video stream buffer size
  * \return 0 on success otherwise an error code
@@ -56,13 +58,25 @@ __PUBLIC int demux_set_video_buffer_size(demux_t demux, size_t size);
 /**
  * \brief set audio stream buffer size
  *
- * Default buffer size for audio streams is 1 MiB
+ * Default buffer size for audio streams is 256 KiB
  * \param demux demux object
  * \param size audio stream buffer size
  * \return 0 on success otherwise an error code
  */
 __PUBLIC int demux_set_audio_buffer_size(demux_t demux, size_t size);
 
+/**
+ * \brief set shared memory size
+ *
+ * Pictures and audio data are copied once into a pool shared
+ * by all streams. Demux blocks when streams hold this much.
+ * Default is 10 MiB.
+ * \param demux demux object
+ * \param size shared memory size
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int demux_set_shared_size(demux_t demux, size_t size);
+
 /**
  * \brief set ALSA playback device
  *
@@ -73,6 +87,33 @@ __PUBLIC int demux_set_audio_buffer_size(demux_t demux, size_t size);
  */
 __PUBLIC int demux_set_alsa_playback_device(demux_t demux, const char *device);
 
+/**
+ * \brief use mmap playback in alsa_play
+ *
+ * Passed to every alsa_play object, see alsa_play_set_mmap().
+ * \param demux demux object
+ * \param period period length in microseconds, 0 disables mmap mode
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int demux_set_alsa_mmap(demux_t demux, glc_utime_t period);
+
+/**
+ * \brief set global color correction for gl_play
+ *
+ * Passed to every gl_play object, see gl_play_set_color_override().
+ * Use this when color correction is done on display instead of
+ * color filter.
+ * \param demux demux object
+ * \param brightness brightness
+ * \param contrast contrast
+ * \param red red gamma
+ * \param green green gamma
+ * \param blue blue gamma
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int demux_set_color_override(demux_t demux, float brightness, float contrast,
+				      float red, float green, float blue);
+
 /**
  * \brief start demux process
  *
@@ -20,7 +20,9 @@
 #include <GL/gl.h>
 #include <GL/glx.h>
 #include <GL/glext.h>
+#include <GL/glxext.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <packetstream.h>
 #include <pthread.h>
 #include <errno.h>
@@ -39,6 +41,20 @@
 #define GL_PLAY_FULLSCREEN         0x4
 #define GL_PLAY_NON_POWER_OF_TWO   0x8
 #define GL_PLAY_CANCEL            0x10
+#define GL_PLAY_PBO               0x20
+#define GL_PLAY_SYNC              0x40
+#define GL_PLAY_OML               0x80
+#define GL_PLAY_SHADER           0x100
+#define GL_PLAY_PLANAR           0x200
+#define GL_PLAY_COLOR_OVERRIDE   0x400
+#define GL_PLAY_COLOR_WARNED     0x800
+
+/** pixel buffers in flight */
+#define GL_PLAY_PBOS                 2
+/** how long to wait for an upload to finish, in nanoseconds */
+#define GL_PLAY_FENCE_TIMEOUT        1000000000
+/** vblanks swaps are scheduled ahead with GLX_OML_sync_control */
+#define GL_PLAY_SWAP_AHEAD           2
 
 struct gl_play_s {
 	glc_t *glc;
@@ -48,6 +64,7 @@ struct gl_play_s {
 
 	glc_stream_id_t id;
 	GLenum format;
+	GLint internal_format;
 	unsigned int w, h;
 	unsigned int pack_alignment;
 	glc_utime_t last;
@@ -65,10 +82,51 @@ struct gl_play_s {
 	GLsizei max_texture_size;
 
 	GLuint *tiles;
-	GLsizei tiles_x, tiles_y;
+	GLsizei tiles_x, tiles_y, textures;
 
 	GLint *vertices;
 
+	GLuint pbo[GL_PLAY_PBOS];
+	GLsync fence[GL_PLAY_PBOS];
+	unsigned int pbo_next;
+	size_t pbo_size;
+	int32_t msc_rate_num, msc_rate_den;
+
+	GLuint program;
+	GLint u_planar, u_correct, u_brightness, u_contrast, u_gamma;
+	float brightness, contrast;
+	float red_gamma, green_gamma, blue_gamma;
+
+	PFNGLGENBUFFERSPROC glGenBuffers;
+	PFNGLDELETEBUFFERSPROC glDeleteBuffers;
+	PFNGLBINDBUFFERPROC glBindBuffer;
+	PFNGLBUFFERDATAPROC glBufferData;
+	PFNGLMAPBUFFERPROC glMapBuffer;
+	PFNGLUNMAPBUFFERPROC glUnmapBuffer;
+	PFNGLFENCESYNCPROC glFenceSync;
+	PFNGLCLIENTWAITSYNCPROC glClientWaitSync;
+	PFNGLDELETESYNCPROC glDeleteSync;
+	PFNGLXGETSYNCVALUESOMLPROC glXGetSyncValuesOML;
+	PFNGLXGETMSCRATEOMLPROC glXGetMscRateOML;
+	PFNGLXSWAPBUFFERSMSCOMLPROC glXSwapBuffersMscOML;
+
+	PFNGLACTIVETEXTUREPROC glActiveTexture;
+	PFNGLCREATESHADERPROC glCreateShader;
+	PFNGLDELETESHADERPROC glDeleteShader;
+	PFNGLSHADERSOURCEPROC glShaderSource;
+	PFNGLCOMPILESHADERPROC glCompileShader;
+	PFNGLGETSHADERIVPROC glGetShaderiv;
+	PFNGLCREATEPROGRAMPROC glCreateProgram;
+	PFNGLDELETEPROGRAMPROC glDeleteProgram;
+	PFNGLATTACHSHADERPROC glAttachShader;
+	PFNGLLINKPROGRAMPROC glLinkProgram;
+	PFNGLGETPROGRAMIVPROC glGetProgramiv;
+	PFNGLUSEPROGRAMPROC glUseProgram;
+	PFNGLGETUNIFORMLOCATIONPROC glGetUniformLocation;
+	PFNGLUNIFORM1IPROC glUniform1i;
+	PFNGLUNIFORM1FPROC glUniform1f;
+	PFNGLUNIFORM3FPROC glUniform3f;
+
 	Atom wm_proto_atom;
 	Atom wm_delete_window_atom;
 	Atom net_wm_state_atom;
@@ -86,10 +144,18 @@ int gl_play_update_viewport(gl_play_t gl_play, int x, int y,
 int gl_play_toggle_fullscreen(gl_play_t gl_play);
 
 int gl_play_init_texture_information(gl_play_t gl_play);
+int gl_play_init_extensions(gl_play_t gl_play);
 int gl_play_create_textures(gl_play_t gl_play);
 int gl_play_destroy_textures(gl_play_t gl_play);
+int gl_play_create_pbos(gl_play_t gl_play);
+int gl_play_destroy_pbos(gl_play_t gl_play);
+int gl_play_create_program(gl_play_t gl_play);
+int gl_play_update_color(gl_play_t gl_play);
+int gl_play_color_msg(gl_play_t gl_play, glc_color_message_t *msg);
 
 int gl_play_draw_video_frame_messageture(gl_play_t gl_play, char *from);
+const char *gl_play_upload(gl_play_t gl_play, char *from);
+int gl_play_present(gl_play_t gl_play, glc_utime_t pic_time);
 
 int gl_play_handle_xevents(gl_play_t gl_play, glc_thread_state_t *state);
 
@@ -111,9 +177,13 @@ int gl_play_init(gl_play_t *gl_play, glc_t *glc)
 	(*gl_play)->play_thread.read_callback = &gl_play_read_callback;
 	(*gl_play)->play_thread.finish_callback = &gl_play_finish_callback;
 	(*gl_play)->play_thread.threads = 1;
+	(*gl_play)->play_thread.name = "gl_play";
 
-	/* TODO support more formats */
 	(*gl_play)->format = GL_BGR;
+	(*gl_play)->internal_format = 3;
+	(*gl_play)->red_gamma = 1.0;
+	(*gl_play)->green_gamma = 1.0;
+	(*gl_play)->blue_gamma = 1.0;
 
 	return 0;
 }
@@ -130,6 +200,18 @@ int gl_play_set_stream_id(gl_play_t gl_play, glc_stream_id_t ctx)
 	return 0;
 }
 
+int gl_play_set_color_override(gl_play_t gl_play, float brightness, float contrast,
+			       float red, float green, float blue)
+{
+	gl_play->brightness = brightness;
+	gl_play->contrast = contrast;
+	gl_play->red_gamma = red;
+	gl_play->green_gamma = green;
+	gl_play->blue_gamma = blue;
+	gl_play->flags |= GL_PLAY_COLOR_OVERRIDE;
+	return 0;
+}
+
 int gl_play_process_start(gl_play_t gl_play, ps_buffer_t *from)
 {
 	int ret;
@@ -140,6 +222,9 @@ int gl_play_process_start(gl_play_t gl_play, ps_buffer_t *from)
 		return ret;
 	gl_play->flags |= GL_PLAY_RUNNING;
 
+	/* earlier stages can drop frames we would drop */
+	glc_state_video_set_deadline(gl_play->glc, gl_play->id, gl_play->skip_threshold);
+
 	return 0;
 }
 
@@ -178,9 +263,14 @@ void gl_play_finish_callback(void *ptr, int err)
 		glc_log(gl_play->glc, GLC_ERROR, "gl_play",
 			 "%s (%d)", strerror(err), err);
 
+	glc_state_video_set_deadline(gl_play->glc, gl_play->id, 0);
+
 	if (gl_play->flags & GL_PLAY_INITIALIZED) {
 		if (gl_play->tiles)
 			gl_play_destroy_textures(gl_play);
+		gl_play_destroy_pbos(gl_play);
+		if (gl_play->program)
+			gl_play->glDeleteProgram(gl_play->program);
 
 		glXDestroyContext(gl_play->dpy, gl_play->ctx);
 		XDestroyWindow(gl_play->dpy, gl_play->win);
@@ -195,8 +285,11 @@ int gl_play_draw_video_frame_messageture(gl_play_t gl_play, char *from)
 {
 	unsigned int width_r = gl_play->w;
 	unsigned int height_r = gl_play->h;
-	unsigned int tile_w, tile_h;
+	unsigned int tile_w, tile_h, x, y, p;
 	unsigned int c = 0;
+	const char *base = NULL;
+	const char *plane[3];
+	unsigned int cw = gl_play->w / 2, ch = gl_play->h / 2;
 
 	static GLint tex_coord[] = {
 		0, 0,
@@ -205,10 +298,28 @@ int gl_play_draw_video_frame_messageture(gl_play_t gl_play, char *from)
 		1, 1
 	};
 
+	/* Y'CbCr is stored top-down */
+	static GLint tex_coord_flipped[] = {
+		0, 1,
+		0, 0,
+		1, 1,
+		1, 0
+	};
+
 	glEnable(GL_TEXTURE_2D);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, gl_play->pack_alignment);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, gl_play->w);
 
+	/* with PBO base is an offset into the bound buffer */
+	if (from)
+		base = gl_play_upload(gl_play, from);
+	plane[0] = base;
+	plane[1] = &base[gl_play->w * gl_play->h];
+	plane[2] = &plane[1][cw * ch];
+
+	if (gl_play->flags & GL_PLAY_SHADER)
+		gl_play->glUseProgram(gl_play->program);
+
 	height_r = gl_play->h;
 	while (height_r > 0) {
 		width_r = gl_play->w;
@@ -216,18 +327,45 @@ int gl_play_draw_video_frame_messageture(gl_play_t gl_play, char *from)
 
 		while (width_r > 0) {
 			tile_w = gl_play_next_texture_size(gl_play, width_r);
-
-			glBindTexture(GL_TEXTURE_2D, gl_play->tiles[c]);
-			glTexImage2D(GL_TEXTURE_2D, 0, 3, tile_w, tile_h,
-				     0, gl_play->format, GL_UNSIGNED_BYTE,
-				     &from[gl_play->row * (gl_play->h - height_r) +
-					   gl_play->bpp * (gl_play->w - width_r)]);
+			x = gl_play->w - width_r;
+			y = gl_play->h - height_r;
+
+			if (gl_play->flags & GL_PLAY_PLANAR) {
+				/* tiles are even-sized, chroma tiles are half of that */
+				for (p = 0; p < 3; p++) {
+					gl_play->glActiveTexture(GL_TEXTURE0 + p);
+					glBindTexture(GL_TEXTURE_2D, gl_play->tiles[c * 3 + p]);
+					if (!from)
+						continue;
+
+					if (p == 0) {
+						glPixelStorei(GL_UNPACK_ROW_LENGTH, gl_play->w);
+						glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tile_w, tile_h,
+								GL_LUMINANCE, GL_UNSIGNED_BYTE,
+								&plane[0][gl_play->w * y + x]);
+					} else {
+						glPixelStorei(GL_UNPACK_ROW_LENGTH, cw);
+						glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tile_w / 2, tile_h / 2,
+								GL_LUMINANCE, GL_UNSIGNED_BYTE,
+								&plane[p][cw * (y / 2) + x / 2]);
+					}
+				}
+				gl_play->glActiveTexture(GL_TEXTURE0);
+			} else {
+				glBindTexture(GL_TEXTURE_2D, gl_play->tiles[c]);
+				/* repeated picture is already in tiles */
+				if (from)
+					glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tile_w, tile_h,
+							gl_play->format, GL_UNSIGNED_BYTE,
+							&base[gl_play->row * y + gl_play->bpp * x]);
+			}
 
 			glEnableClientState(GL_VERTEX_ARRAY);
 			glVertexPointer(2, GL_INT, 0, &gl_play->vertices[c * 8]);
 
 			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-			glTexCoordPointer(2, GL_INT, 0, tex_coord);
+			glTexCoordPointer(2, GL_INT, 0, (gl_play->flags & GL_PLAY_PLANAR) ?
+					  tex_coord_flipped : tex_coord);
 
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
@@ -237,6 +375,94 @@ int gl_play_draw_video_frame_messageture(gl_play_t gl_play, char *from)
 		height_r -= tile_h;
 	}
 
+	if (gl_play->flags & GL_PLAY_SHADER)
+		gl_play->glUseProgram(0);
+
+	if ((from) && (gl_play->flags & GL_PLAY_PBO)) {
+		gl_play->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		/* buffer can be refilled once texture uploads from it are done */
+		if (gl_play->flags & GL_PLAY_SYNC)
+			gl_play->fence[gl_play->pbo_next] =
+				gl_play->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		gl_play->pbo_next = (gl_play->pbo_next + 1) % GL_PLAY_PBOS;
+	}
+
+	return 0;
+}
+
+const char *gl_play_upload(gl_play_t gl_play, char *from)
+{
+	unsigned int p = gl_play->pbo_next;
+	void *dst;
+
+	if (!(gl_play->flags & GL_PLAY_PBO))
+		return from;
+
+	/*
+	 Texture upload from PBO is asynchronous, so we only wait
+	 for the upload GL_PLAY_PBOS frames ago. Without sync objects
+	 the old storage is orphaned and driver does the same.
+	*/
+	if (gl_play->fence[p]) {
+		gl_play->glClientWaitSync(gl_play->fence[p], GL_SYNC_FLUSH_COMMANDS_BIT,
+					  GL_PLAY_FENCE_TIMEOUT);
+		gl_play->glDeleteSync(gl_play->fence[p]);
+		gl_play->fence[p] = NULL;
+	}
+
+	gl_play->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gl_play->pbo[p]);
+	if (!(gl_play->flags & GL_PLAY_SYNC))
+		gl_play->glBufferData(GL_PIXEL_UNPACK_BUFFER, gl_play->pbo_size,
+				      NULL, GL_STREAM_DRAW);
+
+	dst = gl_play->glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if (!dst) {
+		/* fall back to client memory for this frame */
+		gl_play->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return from;
+	}
+	memcpy(dst, from, gl_play->pbo_size);
+	gl_play->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	return (const char *) NULL;
+}
+
+int gl_play_present(gl_play_t gl_play, glc_utime_t pic_time)
+{
+	glc_utime_t time, period;
+	int64_t ust, msc, sbc, ahead;
+
+	time = glc_state_time(gl_play->glc);
+
+	if (!(gl_play->flags & GL_PLAY_OML)) {
+		/* swap interval takes care of tearing */
+		if (pic_time > time + gl_play->sleep_threshold)
+			usleep(pic_time - time);
+		glXSwapBuffers(gl_play->dpy, gl_play->win);
+		return 0;
+	}
+
+	/*
+	 Sleep coarsely until picture is due in a few vblanks and
+	 let the driver swap at the right one. This keeps the swap
+	 queue short and presentation vblank-accurate.
+	*/
+	period = ((glc_utime_t) gl_play->msc_rate_den * 1000000) / gl_play->msc_rate_num;
+	if (pic_time > time + period * GL_PLAY_SWAP_AHEAD + gl_play->sleep_threshold) {
+		usleep(pic_time - time - period * GL_PLAY_SWAP_AHEAD);
+		time = glc_state_time(gl_play->glc);
+	}
+
+	ahead = 0;
+	if (pic_time > time)
+		ahead = (pic_time - time) / period;
+
+	if (!gl_play->glXGetSyncValuesOML(gl_play->dpy, gl_play->win, &ust, &msc, &sbc)) {
+		glXSwapBuffers(gl_play->dpy, gl_play->win);
+		return 0;
+	}
+	gl_play->glXSwapBuffersMscOML(gl_play->dpy, gl_play->win, msc + ahead, 0, 0);
+
 	return 0;
 }
 
@@ -277,6 +503,7 @@ int gl_play_create_ctx(gl_play_t gl_play)
 	XFree(visinfo);
 
 	gl_play_init_texture_information(gl_play);
+	gl_play_init_extensions(gl_play);
 
 	gl_play->wm_proto_atom = XInternAtom(gl_play->dpy, "WM_PROTOCOLS", True);
 	gl_play->wm_delete_window_atom = XInternAtom(gl_play->dpy, "WM_DELETE_WINDOW", False);
@@ -323,6 +550,9 @@ int gl_play_update_ctx(gl_play_t gl_play)
 	if (gl_play->tiles)
 		gl_play_destroy_textures(gl_play);
 	gl_play_create_textures(gl_play);
+	gl_play_destroy_pbos(gl_play);
+	gl_play_create_pbos(gl_play);
+	gl_play_update_color(gl_play);
 
 	return gl_play_update_viewport(gl_play, 0, 0, gl_play->w, gl_play->h);
 }
@@ -386,6 +616,295 @@ int gl_play_init_texture_information(gl_play_t gl_play)
 	return 0;
 }
 
+int gl_play_init_extensions(gl_play_t gl_play)
+{
+	const char *gl_extensions, *glx_extensions, *gl_version;
+	PFNGLXSWAPINTERVALEXTPROC glXSwapIntervalEXT;
+	PFNGLXSWAPINTERVALMESAPROC glXSwapIntervalMESA;
+	PFNGLXSWAPINTERVALSGIPROC glXSwapIntervalSGI;
+	int major = 1, minor = 0;
+
+	gl_extensions = (const char *) glGetString(GL_EXTENSIONS);
+	gl_version = (const char *) glGetString(GL_VERSION);
+	glx_extensions = glXQueryExtensionsString(gl_play->dpy, DefaultScreen(gl_play->dpy));
+	if (!gl_extensions)
+		gl_extensions = "";
+	if (!glx_extensions)
+		glx_extensions = "";
+	if (gl_version)
+		sscanf(gl_version, "%d.%d", &major, &minor);
+
+#define GL_PLAY_PROC(type, name) \
+	((type) glXGetProcAddressARB((const GLubyte *) name))
+
+	/* pixel buffer objects, core since 2.1 */
+	if ((major > 2) || ((major == 2) && (minor >= 1)) ||
+	    strstr(gl_extensions, "GL_ARB_pixel_buffer_object")) {
+		gl_play->glGenBuffers = GL_PLAY_PROC(PFNGLGENBUFFERSPROC, "glGenBuffers");
+		gl_play->glDeleteBuffers = GL_PLAY_PROC(PFNGLDELETEBUFFERSPROC, "glDeleteBuffers");
+		gl_play->glBindBuffer = GL_PLAY_PROC(PFNGLBINDBUFFERPROC, "glBindBuffer");
+		gl_play->glBufferData = GL_PLAY_PROC(PFNGLBUFFERDATAPROC, "glBufferData");
+		gl_play->glMapBuffer = GL_PLAY_PROC(PFNGLMAPBUFFERPROC, "glMapBuffer");
+		gl_play->glUnmapBuffer = GL_PLAY_PROC(PFNGLUNMAPBUFFERPROC, "glUnmapBuffer");
+
+		if ((gl_play->glGenBuffers) && (gl_play->glDeleteBuffers) &&
+		    (gl_play->glBindBuffer) && (gl_play->glBufferData) &&
+		    (gl_play->glMapBuffer) && (gl_play->glUnmapBuffer)) {
+			gl_play->flags |= GL_PLAY_PBO;
+			glc_log(gl_play->glc, GLC_INFORMATION, "gl_play",
+				"using pixel buffer objects for texture upload");
+		}
+	}
+
+	/* fence sync, core since 3.2 */
+	if ((gl_play->flags & GL_PLAY_PBO) &&
+	    ((major > 3) || ((major == 3) && (minor >= 2)) ||
+	     strstr(gl_extensions, "GL_ARB_sync"))) {
+		gl_play->glFenceSync = GL_PLAY_PROC(PFNGLFENCESYNCPROC, "glFenceSync");
+		gl_play->glClientWaitSync = GL_PLAY_PROC(PFNGLCLIENTWAITSYNCPROC, "glClientWaitSync");
+		gl_play->glDeleteSync = GL_PLAY_PROC(PFNGLDELETESYNCPROC, "glDeleteSync");
+
+		if ((gl_play->glFenceSync) && (gl_play->glClientWaitSync) &&
+		    (gl_play->glDeleteSync))
+			gl_play->flags |= GL_PLAY_SYNC;
+	}
+
+	/* vsync */
+	if (strstr(glx_extensions, "GLX_EXT_swap_control")) {
+		glXSwapIntervalEXT = GL_PLAY_PROC(PFNGLXSWAPINTERVALEXTPROC, "glXSwapIntervalEXT");
+		if (glXSwapIntervalEXT)
+			glXSwapIntervalEXT(gl_play->dpy, gl_play->win, 1);
+	} else if (strstr(glx_extensions, "GLX_MESA_swap_control")) {
+		glXSwapIntervalMESA = GL_PLAY_PROC(PFNGLXSWAPINTERVALMESAPROC, "glXSwapIntervalMESA");
+		if (glXSwapIntervalMESA)
+			glXSwapIntervalMESA(1);
+	} else if (strstr(glx_extensions, "GLX_SGI_swap_control")) {
+		glXSwapIntervalSGI = GL_PLAY_PROC(PFNGLXSWAPINTERVALSGIPROC, "glXSwapIntervalSGI");
+		if (glXSwapIntervalSGI)
+			glXSwapIntervalSGI(1);
+	}
+
+	/* vblank-scheduled swaps */
+	if (strstr(glx_extensions, "GLX_OML_sync_control")) {
+		gl_play->glXGetSyncValuesOML = GL_PLAY_PROC(PFNGLXGETSYNCVALUESOMLPROC,
+							    "glXGetSyncValuesOML");
+		gl_play->glXGetMscRateOML = GL_PLAY_PROC(PFNGLXGETMSCRATEOMLPROC,
+							 "glXGetMscRateOML");
+		gl_play->glXSwapBuffersMscOML = GL_PLAY_PROC(PFNGLXSWAPBUFFERSMSCOMLPROC,
+							     "glXSwapBuffersMscOML");
+
+		if ((gl_play->glXGetSyncValuesOML) && (gl_play->glXGetMscRateOML) &&
+		    (gl_play->glXSwapBuffersMscOML) &&
+		    (gl_play->glXGetMscRateOML(gl_play->dpy, gl_play->win,
+					       &gl_play->msc_rate_num,
+					       &gl_play->msc_rate_den)) &&
+		    (gl_play->msc_rate_num > 0) && (gl_play->msc_rate_den > 0)) {
+			gl_play->flags |= GL_PLAY_OML;
+			glc_log(gl_play->glc, GLC_INFORMATION, "gl_play",
+				"scheduling swaps at %.2f Hz refresh rate",
+				(double) gl_play->msc_rate_num / (double) gl_play->msc_rate_den);
+		}
+	}
+
+	/* GLSL for Y'CbCr conversion and color correction, core since 2.0 */
+	if (major >= 2) {
+		gl_play->glActiveTexture = GL_PLAY_PROC(PFNGLACTIVETEXTUREPROC, "glActiveTexture");
+		gl_play->glCreateShader = GL_PLAY_PROC(PFNGLCREATESHADERPROC, "glCreateShader");
+		gl_play->glDeleteShader = GL_PLAY_PROC(PFNGLDELETESHADERPROC, "glDeleteShader");
+		gl_play->glShaderSource = GL_PLAY_PROC(PFNGLSHADERSOURCEPROC, "glShaderSource");
+		gl_play->glCompileShader = GL_PLAY_PROC(PFNGLCOMPILESHADERPROC, "glCompileShader");
+		gl_play->glGetShaderiv = GL_PLAY_PROC(PFNGLGETSHADERIVPROC, "glGetShaderiv");
+		gl_play->glCreateProgram = GL_PLAY_PROC(PFNGLCREATEPROGRAMPROC, "glCreateProgram");
+		gl_play->glDeleteProgram = GL_PLAY_PROC(PFNGLDELETEPROGRAMPROC, "glDeleteProgram");
+		gl_play->glAttachShader = GL_PLAY_PROC(PFNGLATTACHSHADERPROC, "glAttachShader");
+		gl_play->glLinkProgram = GL_PLAY_PROC(PFNGLLINKPROGRAMPROC, "glLinkProgram");
+		gl_play->glGetProgramiv = GL_PLAY_PROC(PFNGLGETPROGRAMIVPROC, "glGetProgramiv");
+		gl_play->glUseProgram = GL_PLAY_PROC(PFNGLUSEPROGRAMPROC, "glUseProgram");
+		gl_play->glGetUniformLocation = GL_PLAY_PROC(PFNGLGETUNIFORMLOCATIONPROC,
+							     "glGetUniformLocation");
+		gl_play->glUniform1i = GL_PLAY_PROC(PFNGLUNIFORM1IPROC, "glUniform1i");
+		gl_play->glUniform1f = GL_PLAY_PROC(PFNGLUNIFORM1FPROC, "glUniform1f");
+		gl_play->glUniform3f = GL_PLAY_PROC(PFNGLUNIFORM3FPROC, "glUniform3f");
+
+		if ((gl_play->glActiveTexture) && (gl_play->glCreateShader) &&
+		    (gl_play->glDeleteShader) && (gl_play->glShaderSource) &&
+		    (gl_play->glCompileShader) && (gl_play->glGetShaderiv) &&
+		    (gl_play->glCreateProgram) && (gl_play->glDeleteProgram) &&
+		    (gl_play->glAttachShader) && (gl_play->glLinkProgram) &&
+		    (gl_play->glGetProgramiv) && (gl_play->glUseProgram) &&
+		    (gl_play->glGetUniformLocation) && (gl_play->glUniform1i) &&
+		    (gl_play->glUniform1f) && (gl_play->glUniform3f) &&
+		    (!gl_play_create_program(gl_play))) {
+			gl_play->flags |= GL_PLAY_SHADER;
+			glc_log(gl_play->glc, GLC_INFORMATION, "gl_play",
+				"converting Y'CbCr and correcting color with GLSL");
+		}
+	}
+
+#undef GL_PLAY_PROC
+
+	return 0;
+}
+
+int gl_play_create_program(gl_play_t gl_play)
+{
+	/* same arithmetic as rgb and color */
+	static const char *source =
+		"uniform sampler2D tex_y, tex_cb, tex_cr;\n"
+		"uniform bool planar, correct;\n"
+		"uniform float brightness, contrast;\n"
+		"uniform vec3 gamma;\n"
+		"void main()\n"
+		"{\n"
+		"	vec3 rgb;\n"
+		"	if (planar) {\n"
+		"		float y = texture2D(tex_y, gl_TexCoord[0].st).r;\n"
+		"		float cb = texture2D(tex_cb, gl_TexCoord[0].st).r - 128.0 / 255.0;\n"
+		"		float cr = texture2D(tex_cr, gl_TexCoord[0].st).r - 128.0 / 255.0;\n"
+		"		rgb = vec3(y + 1.402 * cr,\n"
+		"			   y - 0.344136 * cb - 0.714136 * cr,\n"
+		"			   y + 1.772 * cb);\n"
+		"	} else\n"
+		"		rgb = texture2D(tex_y, gl_TexCoord[0].st).rgb;\n"
+		"	if (correct)\n"
+		"		rgb = (pow(clamp(rgb, 0.0, 1.0), 1.0 / gamma) - 0.5) *\n"
+		"		      (1.0 + contrast) + brightness + 0.5;\n"
+		"	gl_FragColor = vec4(clamp(rgb, 0.0, 1.0), 1.0);\n"
+		"}\n";
+	GLuint shader;
+	GLint status;
+
+	shader = gl_play->glCreateShader(GL_FRAGMENT_SHADER);
+	gl_play->glShaderSource(shader, 1, &source, NULL);
+	gl_play->glCompileShader(shader);
+	gl_play->glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		glc_log(gl_play->glc, GLC_WARNING, "gl_play", "can't compile fragment shader");
+		gl_play->glDeleteShader(shader);
+		return ENOTSUP;
+	}
+
+	gl_play->program = gl_play->glCreateProgram();
+	gl_play->glAttachShader(gl_play->program, shader);
+	gl_play->glLinkProgram(gl_play->program);
+	gl_play->glDeleteShader(shader); /* program keeps it */
+	gl_play->glGetProgramiv(gl_play->program, GL_LINK_STATUS, &status);
+	if (!status) {
+		glc_log(gl_play->glc, GLC_WARNING, "gl_play", "can't link shader program");
+		gl_play->glDeleteProgram(gl_play->program);
+		gl_play->program = 0;
+		return ENOTSUP;
+	}
+
+	gl_play->u_planar = gl_play->glGetUniformLocation(gl_play->program, "planar");
+	gl_play->u_correct = gl_play->glGetUniformLocation(gl_play->program, "correct");
+	gl_play->u_brightness = gl_play->glGetUniformLocation(gl_play->program, "brightness");
+	gl_play->u_contrast = gl_play->glGetUniformLocation(gl_play->program, "contrast");
+	gl_play->u_gamma = gl_play->glGetUniformLocation(gl_play->program, "gamma");
+
+	gl_play->glUseProgram(gl_play->program);
+	gl_play->glUniform1i(gl_play->glGetUniformLocation(gl_play->program, "tex_y"), 0);
+	gl_play->glUniform1i(gl_play->glGetUniformLocation(gl_play->program, "tex_cb"), 1);
+	gl_play->glUniform1i(gl_play->glGetUniformLocation(gl_play->program, "tex_cr"), 2);
+	gl_play->glUseProgram(0);
+
+	return 0;
+}
+
+int gl_play_update_color(gl_play_t gl_play)
+{
+	int correct = !((gl_play->brightness == 0) &&
+			(gl_play->contrast == 0) &&
+			(gl_play->red_gamma == 1) &&
+			(gl_play->green_gamma == 1) &&
+			(gl_play->blue_gamma == 1));
+
+	if (!(gl_play->flags & GL_PLAY_SHADER)) {
+		if ((correct) && !(gl_play->flags & GL_PLAY_COLOR_WARNED)) {
+			glc_log(gl_play->glc, GLC_WARNING, "gl_play",
+				"color correction needs GLSL, ignoring it");
+			gl_play->flags |= GL_PLAY_COLOR_WARNED;
+		}
+		return 0;
+	}
+
+	gl_play->glUseProgram(gl_play->program);
+	gl_play->glUniform1i(gl_play->u_planar, (gl_play->flags & GL_PLAY_PLANAR) ? 1 : 0);
+	gl_play->glUniform1i(gl_play->u_correct, correct);
+	gl_play->glUniform1f(gl_play->u_brightness, gl_play->brightness);
+	gl_play->glUniform1f(gl_play->u_contrast, gl_play->contrast);
+	gl_play->glUniform3f(gl_play->u_gamma, gl_play->red_gamma,
+			     gl_play->green_gamma, gl_play->blue_gamma);
+	gl_play->glUseProgram(0);
+
+	return 0;
+}
+
+int gl_play_color_msg(gl_play_t gl_play, glc_color_message_t *msg)
+{
+	if (gl_play->flags & GL_PLAY_COLOR_OVERRIDE)
+		return 0; /* ignore */
+
+	gl_play->brightness = msg->brightness;
+	gl_play->contrast = msg->contrast;
+	gl_play->red_gamma = msg->red;
+	gl_play->green_gamma = msg->green;
+	gl_play->blue_gamma = msg->blue;
+
+	glc_log(gl_play->glc, GLC_INFORMATION, "gl_play",
+		 "video stream %d: brightness=%f, contrast=%f, red=%f, green=%f, blue=%f",
+		 msg->id, gl_play->brightness, gl_play->contrast,
+		 gl_play->red_gamma, gl_play->green_gamma, gl_play->blue_gamma);
+
+	if (gl_play->flags & GL_PLAY_INITIALIZED)
+		return gl_play_update_color(gl_play);
+	return 0;
+}
+
+int gl_play_create_pbos(gl_play_t gl_play)
+{
+	unsigned int p;
+
+	if (!(gl_play->flags & GL_PLAY_PBO))
+		return 0;
+
+	if (gl_play->flags & GL_PLAY_PLANAR)
+		gl_play->pbo_size = gl_play->w * gl_play->h +
+				    (gl_play->w / 2) * (gl_play->h / 2) * 2;
+	else
+		gl_play->pbo_size = gl_play->row * gl_play->h;
+	gl_play->pbo_next = 0;
+	gl_play->glGenBuffers(GL_PLAY_PBOS, gl_play->pbo);
+
+	for (p = 0; p < GL_PLAY_PBOS; p++) {
+		gl_play->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gl_play->pbo[p]);
+		gl_play->glBufferData(GL_PIXEL_UNPACK_BUFFER, gl_play->pbo_size,
+				      NULL, GL_STREAM_DRAW);
+		gl_play->fence[p] = NULL;
+	}
+	gl_play->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	return 0;
+}
+
+int gl_play_destroy_pbos(gl_play_t gl_play)
+{
+	unsigned int p;
+
+	if ((!(gl_play->flags & GL_PLAY_PBO)) || (!gl_play->pbo_size))
+		return 0;
+
+	for (p = 0; p < GL_PLAY_PBOS; p++) {
+		if (gl_play->fence[p])
+			gl_play->glDeleteSync(gl_play->fence[p]);
+		gl_play->fence[p] = NULL;
+	}
+	gl_play->glDeleteBuffers(GL_PLAY_PBOS, gl_play->pbo);
+	gl_play->pbo_size = 0;
+
+	return 0;
+}
+
 int gl_play_next_texture_size(gl_play_t gl_play, unsigned int number)
 {
 	unsigned int pot = 1 << 31;
@@ -413,7 +932,7 @@ int gl_play_create_textures(gl_play_t gl_play)
 	/* calculate number of textures needed */
 	unsigned int width_r = gl_play->w;
 	unsigned int height_r = gl_play->h;
-	unsigned int tile_w, tile_h;
+	unsigned int tile_w, tile_h, y, p, planes;
 	unsigned int c = 0;
 	GLint *t_vertices;
 
@@ -430,12 +949,14 @@ int gl_play_create_textures(gl_play_t gl_play)
 		gl_play->tiles_x++;
 	}
 
-	/* create textures */
-	gl_play->tiles = (GLuint *) malloc(sizeof(GLuint) * gl_play->tiles_x * gl_play->tiles_y);
-	memset(gl_play->tiles, 0, sizeof(GLuint) * gl_play->tiles_x * gl_play->tiles_y);
+	/* create textures, Y'CbCr has a texture for each plane */
+	planes = (gl_play->flags & GL_PLAY_PLANAR) ? 3 : 1;
+	gl_play->textures = gl_play->tiles_x * gl_play->tiles_y * planes;
+	gl_play->tiles = (GLuint *) malloc(sizeof(GLuint) * gl_play->textures);
+	memset(gl_play->tiles, 0, sizeof(GLuint) * gl_play->textures);
 
 	glEnable(GL_TEXTURE_2D);
-	glGenTextures(gl_play->tiles_x * gl_play->tiles_y, gl_play->tiles);
+	glGenTextures(gl_play->textures, gl_play->tiles);
 
 	/* data for vertices 4 x 2 coordinates per each */
 	gl_play->vertices = (GLint *) malloc(sizeof(GLint) * gl_play->tiles_x * gl_play->tiles_y * 8);
@@ -451,28 +972,41 @@ int gl_play_create_textures(gl_play_t gl_play)
 			tile_w = gl_play_next_texture_size(gl_play, width_r);
 			t_vertices = &gl_play->vertices[c * 8];
 
-			glBindTexture(GL_TEXTURE_2D, gl_play->tiles[c]);
-			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			for (p = 0; p < planes; p++) {
+				glBindTexture(GL_TEXTURE_2D, gl_play->tiles[c * planes + p]);
+				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+
+				/* storage is allocated once, frames only update it */
+				glTexImage2D(GL_TEXTURE_2D, 0, gl_play->internal_format,
+					     p ? tile_w / 2 : tile_w, p ? tile_h / 2 : tile_h, 0,
+					     gl_play->format, GL_UNSIGNED_BYTE, NULL);
+			}
+
+			/* Y'CbCr rows are top-down, BGR bottom-up */
+			if (gl_play->flags & GL_PLAY_PLANAR)
+				y = height_r - tile_h;
+			else
+				y = gl_play->h - height_r;
 
 			/* (0,0) */
 			t_vertices[0] = gl_play->w - width_r;
-			t_vertices[1] = gl_play->h - height_r;
+			t_vertices[1] = y;
 
 			/* (0,1) */
 			t_vertices[2] = gl_play->w - width_r;
-			t_vertices[3] = gl_play->h - height_r + tile_h;
+			t_vertices[3] = y + tile_h;
 
 			/* (1,0) */
 			t_vertices[4] = gl_play->w - width_r + tile_w;
-			t_vertices[5] = gl_play->h - height_r;
+			t_vertices[5] = y;
 
 			/* (1,1) */
 			t_vertices[6] = gl_play->w - width_r + tile_w;
-			t_vertices[7] = gl_play->h - height_r + tile_h;
+			t_vertices[7] = y + tile_h;
 
 			glc_log(gl_play->glc, GLC_DEBUG, "gl_play",
 				"tile %u: (%u, %u): %ux%u", c,
@@ -494,7 +1028,7 @@ int gl_play_destroy_textures(gl_play_t gl_play)
 	if (!gl_play->tiles)
 		return EAGAIN;
 
-	glDeleteTextures(gl_play->tiles_x * gl_play->tiles_y, gl_play->tiles);
+	glDeleteTextures(gl_play->textures, gl_play->tiles);
 
 	free(gl_play->tiles);
 	gl_play->tiles = NULL;
@@ -611,34 +1145,66 @@ int gl_play_read_callback(glc_thread_state_t *state)
 		if (format_msg->id != gl_play->id)
 			return 0; /* just ignore it */
 
+		if ((format_msg->format != GLC_VIDEO_BGR) &&
+		    (format_msg->format != GLC_VIDEO_BGRA) &&
+		    (format_msg->format != GLC_VIDEO_YCBCR_420JPEG)) {
+			glc_log(gl_play->glc, GLC_ERROR, "gl_play",
+				"video stream %d is in unsupported format 0x%02x",
+				format_msg->id, format_msg->format);
+			return EINVAL;
+		}
+
 		gl_play->w = format_msg->width;
 		gl_play->h = format_msg->height;
-		gl_play->bpp = 3;
-		gl_play->row = gl_play->w * gl_play->bpp;
-
-		if (format_msg->flags & GLC_VIDEO_DWORD_ALIGNED) {
-			gl_play->pack_alignment = 8;
-			if (gl_play->row % 8 != 0)
-				gl_play->row += 8 - gl_play->row % 8;
-		} else
+
+		if (format_msg->format == GLC_VIDEO_YCBCR_420JPEG) {
+			/* rows are tightly packed planes */
+			gl_play->flags |= GL_PLAY_PLANAR;
+			gl_play->format = GL_LUMINANCE;
+			gl_play->internal_format = GL_LUMINANCE;
+			gl_play->bpp = 1;
+			gl_play->row = gl_play->w;
 			gl_play->pack_alignment = 1;
+		} else {
+			gl_play->flags &= ~GL_PLAY_PLANAR;
+			gl_play->internal_format = 3;
+			if (format_msg->format == GLC_VIDEO_BGRA) {
+				gl_play->format = GL_BGRA;
+				gl_play->bpp = 4;
+			} else {
+				gl_play->format = GL_BGR;
+				gl_play->bpp = 3;
+			}
+			gl_play->row = gl_play->w * gl_play->bpp;
+
+			if (format_msg->flags & GLC_VIDEO_DWORD_ALIGNED) {
+				gl_play->pack_alignment = 8;
+				if (gl_play->row % 8 != 0)
+					gl_play->row += 8 - gl_play->row % 8;
+			} else
+				gl_play->pack_alignment = 1;
+		}
 
-		if ((format_msg->format == GLC_VIDEO_BGR) &&
-		    !(gl_play->flags & GL_PLAY_INITIALIZED))
+		if (!(gl_play->flags & GL_PLAY_INITIALIZED))
 			gl_play_create_ctx(gl_play);
-		else if (format_msg->format == GLC_VIDEO_BGR) {
-			if (gl_play_update_ctx(gl_play)) {
-				glc_log(gl_play->glc, GLC_ERROR, "gl_play",
-					 "broken video stream %d", format_msg->id);
-				return EINVAL;
-			}
-		} else {
+		else if (gl_play_update_ctx(gl_play)) {
 			glc_log(gl_play->glc, GLC_ERROR, "gl_play",
-				"video stream %d is in unsupported format 0x%02x",
-				format_msg->id, format_msg->format);
+				 "broken video stream %d", format_msg->id);
 			return EINVAL;
 		}
-	} else if (state->header.type == GLC_MESSAGE_VIDEO_FRAME) {
+
+		if ((gl_play->flags & GL_PLAY_PLANAR) &&
+		    !(gl_play->flags & GL_PLAY_SHADER)) {
+			glc_log(gl_play->glc, GLC_ERROR, "gl_play",
+				"video stream %d is Y'CbCr, displaying it needs GLSL",
+				format_msg->id);
+			return ENOTSUP;
+		}
+	} else if (state->header.type == GLC_MESSAGE_COLOR) {
+		if (((glc_color_message_t *) state->read_data)->id == gl_play->id)
+			return gl_play_color_msg(gl_play, (glc_color_message_t *) state->read_data);
+	} else if ((state->header.type == GLC_MESSAGE_VIDEO_FRAME) |
+		   (state->header.type == GLC_MESSAGE_VIDEO_REPEAT)) {
 		pic_hdr = (glc_video_frame_header_t *) state->read_data;
 
 		if (pic_hdr->id != gl_play->id)
@@ -658,17 +1224,13 @@ int gl_play_read_callback(glc_thread_state_t *state)
 			return 0;
 		}
 
-		/* draw first, measure and sleep after */
-		gl_play_draw_video_frame_messageture(gl_play, &state->read_data[sizeof(glc_video_frame_header_t)]);
+		/* upload and draw are queued, GPU works while we wait */
+		if (state->header.type == GLC_MESSAGE_VIDEO_REPEAT)
+			gl_play_draw_video_frame_messageture(gl_play, NULL);
+		else
+			gl_play_draw_video_frame_messageture(gl_play, &state->read_data[sizeof(glc_video_frame_header_t)]);
 
-		/* wait until actual drawing is done */
-		glFinish();
-
-		time = glc_state_time(gl_play->glc);
-		if (pic_hdr->time > time + gl_play->sleep_threshold)
-			usleep(pic_hdr->time - time);
-
-		glXSwapBuffers(gl_play->dpy, gl_play->win);
+		gl_play_present(gl_play, pic_hdr->time);
 	}
 
 	return 0;
@@ -53,10 +53,30 @@ __PUBLIC int gl_play_destroy(gl_play_t gl_play);
  */
 __PUBLIC int gl_play_set_stream_id(gl_play_t gl_play, glc_stream_id_t id);
 
+/**
+ * \brief set global color correction
+ *
+ * Overrides color correction messages in stream. Correction
+ * is applied with a fragment shader, so it is available
+ * only if GLSL is supported.
+ * \param gl_play gl_play object
+ * \param brightness brightness
+ * \param contrast contrast
+ * \param red red gamma
+ * \param green green gamma
+ * \param blue blue gamma
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_play_set_color_override(gl_play_t gl_play, float brightness, float contrast,
+					float red, float green, float blue);
+
 /**
  * \brief start gl_play process
  *
- * gl_play plays RGB (BGR) video data from selected video stream.
+ * gl_play plays BGR, BGRA and Y'CbCr 420jpeg video data from
+ * selected video stream. Y'CbCr is converted to RGB and color
+ * correction messages are applied in a fragment shader, so
+ * those need GLSL support.
  * \param gl_play gl_play object
  * \param from source buffer
  * \return 0 on success otherwise an error code
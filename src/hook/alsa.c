@@ -42,6 +42,9 @@ struct alsa_private_s {
 	int capture;
 	int capturing;
 
+	/* audio batching, milliseconds and bytes */
+	unsigned int batch, batch_size, batch_latency;
+
 	struct alsa_capture_stream_s *capture_stream;
 
 	void *libasound_handle;
@@ -88,6 +91,20 @@ int alsa_init(glc_t *glc)
 		alsa_hook_allow_skip(alsa.alsa_hook, 0);
 		if (getenv("GLC_AUDIO_SKIP"))
 			alsa_hook_allow_skip(alsa.alsa_hook, atoi(getenv("GLC_AUDIO_SKIP")));
+
+		/* coalesce small periods into ~20ms packets by default */
+		alsa.batch = 20;
+		if (getenv("GLC_AUDIO_BATCH"))
+			alsa.batch = atoi(getenv("GLC_AUDIO_BATCH"));
+		alsa.batch_size = 65536;
+		if (getenv("GLC_AUDIO_BATCH_SIZE"))
+			alsa.batch_size = atoi(getenv("GLC_AUDIO_BATCH_SIZE"));
+		alsa.batch_latency = 50;
+		if (getenv("GLC_AUDIO_BATCH_LATENCY"))
+			alsa.batch_latency = atoi(getenv("GLC_AUDIO_BATCH_LATENCY"));
+
+		alsa_hook_set_batch(alsa.alsa_hook, (glc_utime_t) alsa.batch * 1000,
+				    alsa.batch_size, (glc_utime_t) alsa.batch_latency * 1000);
 	}
 
 	if (getenv("GLC_AUDIO_RECORD"))
@@ -324,6 +341,16 @@ err:
 	exit(1);
 }
 
+int alsa_dropped(unsigned long *chunks, unsigned long *bytes)
+{
+	if (!alsa.alsa_hook) {
+		*chunks = *bytes = 0;
+		return 0;
+	}
+
+	return alsa_hook_dropped(alsa.alsa_hook, chunks, bytes);
+}
+
 int alsa_unhook_so(const char *soname)
 {
 	int ret;
@@ -0,0 +1,438 @@
+/**
+ * \file hook/control.c
+ * \brief control socket
+ * \author Pyry Haulos <pyry.haulos@gmail.com>
+ * \date 2007-2008
+ * For conditions of distribution and use, see copyright notice in glc.h
+ */
+
+/**
+ * \addtogroup hook
+ *  \{
+ * \defgroup control control socket
+ *  \{
+ */
+
+/*
+ Control socket accepts one command per line and answers
+ with zero or more lines ending with 'ok' or 'error ...':
+
+  stats                 time, stage counters (see
+                        glc_thread_stats_write()), dropped
+                        video frames and audio chunks
+  fps FPS               capture rate
+  compress METHOD [LVL] quicklz, lzo, lzjb, lz4, zstd,
+                        adaptive or none
+  scale FACTOR          CPU scaling factor
+
+ Capture rate and scale are changed at once. Compression is
+ sent down the stream as a callback request and switched when
+ all earlier packets have been compressed, 'ok queued' is
+ answered then. Errors of queued changes are only logged.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <glc/common/glc.h>
+#include <glc/common/core.h>
+#include <glc/common/log.h>
+#include <glc/common/thread.h>
+#include <glc/core/pack.h>
+
+#include "lib.h"
+
+/* quit flag is checked this often, in ms */
+#define CONTROL_POLL                200
+#define CONTROL_LINE_MAX            256
+
+#define CONTROL_FPS                 0x1
+#define CONTROL_COMPRESS            0x2
+#define CONTROL_SCALE               0x3
+
+struct control_request_s {
+	int what;
+	double value;
+	int compression, level;
+
+	struct control_request_s *next;
+};
+
+struct control_private_s {
+	glc_t *glc;
+	char *path;
+	int fd;
+
+	pthread_t thread;
+	int started;
+	int quit;
+
+	/* requests in stream, freed at close if never reached */
+	pthread_mutex_t pending_mutex;
+	struct control_request_s *pending;
+};
+
+__PRIVATE struct control_private_s control;
+
+__PRIVATE void *control_thread(void *argptr);
+__PRIVATE void control_client(int fd);
+__PRIVATE int control_send(int fd, const char *data, size_t size);
+__PRIVATE void control_command(FILE *stream, char *line);
+__PRIVATE void control_stats(FILE *stream);
+__PRIVATE int control_compression(const char *name, int *compression);
+__PRIVATE int control_request(struct control_request_s *request, int *queued);
+__PRIVATE int control_apply(struct control_request_s *request);
+__PRIVATE struct control_request_s *control_unqueue(void *arg);
+
+int control_init(glc_t *glc)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int ret = 0;
+
+	control.glc = glc;
+	control.path = NULL;
+	control.fd = -1;
+	control.started = control.quit = 0;
+	control.pending = NULL;
+	pthread_mutex_init(&control.pending_mutex, NULL);
+
+	if (!getenv("GLC_CONTROL"))
+		return 0;
+
+	glc_log(control.glc, GLC_DEBUG, "control", "initializing");
+
+	control.path = malloc(1024);
+	snprintf(control.path, 1023, getenv("GLC_CONTROL"), getpid());
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	if (strlen(control.path) >= sizeof(addr.sun_path)) {
+		ret = ENAMETOOLONG;
+		goto err;
+	}
+	strcpy(addr.sun_path, control.path);
+
+	if ((control.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		ret = errno;
+		goto err;
+	}
+
+	/* socket left by an earlier process with same pid */
+	unlink(control.path);
+	/* only owner may change capture settings, not even before chmod() */
+	mask = umask(S_IRWXG | S_IRWXO);
+	if (bind(control.fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)))
+		ret = errno;
+	umask(mask);
+	if (ret)
+		goto err;
+	if (chmod(control.path, S_IRUSR | S_IWUSR)) {
+		ret = errno;
+		goto err;
+	}
+	if (listen(control.fd, 1)) {
+		ret = errno;
+		goto err;
+	}
+
+	/* stats are totals of glc_thread counters */
+	glc_log_collect_stats(control.glc, 1);
+
+	if ((ret = pthread_create(&control.thread, NULL, control_thread, NULL)))
+		goto err;
+	control.started = 1;
+
+	glc_log(control.glc, GLC_INFORMATION, "control",
+		 "listening on %s", control.path);
+	return 0;
+err:
+	glc_log(control.glc, GLC_ERROR, "control",
+		 "can't open %s: %s (%d)", control.path, strerror(ret), ret);
+	if (control.fd >= 0) {
+		close(control.fd);
+		unlink(control.path);
+		control.fd = -1;
+	}
+	free(control.path);
+	control.path = NULL;
+	return ret;
+}
+
+int control_close()
+{
+	struct control_request_s *request;
+
+	if (!control.started)
+		return 0;
+
+	glc_log(control.glc, GLC_DEBUG, "control", "closing");
+
+	__atomic_store_n(&control.quit, 1, __ATOMIC_RELEASE);
+	pthread_join(control.thread, NULL);
+	__atomic_store_n(&control.started, 0, __ATOMIC_RELEASE);
+
+	close(control.fd);
+	unlink(control.path);
+	free(control.path);
+	control.path = NULL;
+
+	/* stream may have been stopped before these were reached */
+	pthread_mutex_lock(&control.pending_mutex);
+	while ((request = control.pending) != NULL) {
+		control.pending = request->next;
+		free(request);
+	}
+	pthread_mutex_unlock(&control.pending_mutex);
+
+	return 0;
+}
+
+void control_callback(void *arg)
+{
+	struct control_request_s *request;
+
+	/* stream has reached the request, unless it was freed at close */
+	if (!(request = control_unqueue(arg)))
+		return;
+	control_apply(request);
+	free(request);
+}
+
+struct control_request_s *control_unqueue(void *arg)
+{
+	struct control_request_s **prev, *request;
+
+	/* arg is only compared, it may point to freed memory */
+	pthread_mutex_lock(&control.pending_mutex);
+	for (prev = &control.pending; (request = *prev) != NULL; prev = &request->next) {
+		if ((void *) request == arg) {
+			*prev = request->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&control.pending_mutex);
+
+	return request;
+}
+
+void *control_thread(void *argptr)
+{
+	struct pollfd pfd;
+	int fd;
+
+	pfd.fd = control.fd;
+	pfd.events = POLLIN;
+
+	/* clients are served one at a time */
+	while (!__atomic_load_n(&control.quit, __ATOMIC_ACQUIRE)) {
+		if (poll(&pfd, 1, CONTROL_POLL) <= 0)
+			continue;
+		if ((fd = accept(control.fd, NULL, NULL)) < 0)
+			continue;
+
+		control_client(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+void control_client(int fd)
+{
+	char line[CONTROL_LINE_MAX], *end, *reply;
+	size_t len = 0, reply_size;
+	struct pollfd pfd;
+	FILE *stream;
+	ssize_t got;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (!__atomic_load_n(&control.quit, __ATOMIC_ACQUIRE)) {
+		if (poll(&pfd, 1, CONTROL_POLL) <= 0)
+			continue;
+		if ((got = read(fd, &line[len], CONTROL_LINE_MAX - 1 - len)) <= 0)
+			return;
+		len += got;
+		line[len] = '\0';
+
+		while ((end = strchr(line, '\n')) != NULL) {
+			*end = '\0';
+
+			if (!(stream = open_memstream(&reply, &reply_size)))
+				return;
+			control_command(stream, line);
+			fclose(stream);
+
+			got = control_send(fd, reply, reply_size);
+			free(reply);
+			if (got)
+				return;
+
+			len -= end + 1 - line;
+			memmove(line, end + 1, len + 1);
+		}
+
+		/* too long to be a command */
+		if (len == CONTROL_LINE_MAX - 1)
+			return;
+	}
+}
+
+int control_send(int fd, const char *data, size_t size)
+{
+	ssize_t sent;
+
+	while (size > 0) {
+		/* client going away must not kill the application */
+		if ((sent = send(fd, data, size, MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		data += sent;
+		size -= sent;
+	}
+
+	return 0;
+}
+
+void control_command(FILE *stream, char *line)
+{
+	struct control_request_s *request, change;
+	char *cmd, *arg, *save;
+	int ret, queued = 0;
+
+	if (!(cmd = strtok_r(line, " \t\r", &save)))
+		return;
+	arg = strtok_r(NULL, " \t\r", &save);
+
+	if (!strcmp(cmd, "stats")) {
+		control_stats(stream);
+		fprintf(stream, "ok\n");
+		return;
+	}
+
+	memset(&change, 0, sizeof(struct control_request_s));
+
+	ret = EINVAL;
+	if ((!strcmp(cmd, "fps")) | (!strcmp(cmd, "scale"))) {
+		/* capture side settings, no need to wait for stream */
+		change.what = strcmp(cmd, "fps") ? CONTROL_SCALE : CONTROL_FPS;
+		if ((arg) && ((change.value = atof(arg)) > 0))
+			ret = control_apply(&change);
+	} else if (!strcmp(cmd, "compress")) {
+		change.what = CONTROL_COMPRESS;
+		ret = control_compression(arg, &change.compression);
+		/* same default level as pack */
+		change.level = 1;
+		if ((arg = strtok_r(NULL, " \t\r", &save)))
+			change.level = atoi(arg);
+
+		if (!ret) {
+			if ((request = (struct control_request_s *)
+				       malloc(sizeof(struct control_request_s)))) {
+				memcpy(request, &change, sizeof(struct control_request_s));
+				ret = control_request(request, &queued);
+			} else
+				ret = ENOMEM;
+		}
+	} else {
+		fprintf(stream, "error unknown command '%s'\n", cmd);
+		return;
+	}
+
+	if (ret)
+		fprintf(stream, "error %s (%d)\n", strerror(ret), ret);
+	else
+		fprintf(stream, queued ? "ok queued\n" : "ok\n");
+}
+
+void control_stats(FILE *stream)
+{
+	unsigned long chunks, bytes;
+
+	fprintf(stream, "time %.3f\n", (double) glc_time(control.glc) / 1000000.0);
+	glc_thread_stats_write(control.glc, stream);
+	fprintf(stream, "video_dropped %llu\n", opengl_dropped());
+	alsa_dropped(&chunks, &bytes);
+	fprintf(stream, "audio_dropped %lu %lu\n", chunks, bytes);
+}
+
+int control_compression(const char *name, int *compression)
+{
+	if (name == NULL)
+		return EINVAL;
+
+	if (!strcmp(name, "quicklz"))
+		*compression = PACK_QUICKLZ;
+	else if (!strcmp(name, "lzo"))
+		*compression = PACK_LZO;
+	else if (!strcmp(name, "lzjb"))
+		*compression = PACK_LZJB;
+	else if (!strcmp(name, "lz4"))
+		*compression = PACK_LZ4;
+	else if (!strcmp(name, "zstd"))
+		*compression = PACK_ZSTD;
+	else if (!strcmp(name, "adaptive"))
+		*compression = PACK_ADAPTIVE;
+	else if (!strcmp(name, "none"))
+		*compression = PACK_STORE;
+	else
+		return EINVAL;
+
+	return 0;
+}
+
+int control_request(struct control_request_s *request, int *queued)
+{
+	int ret;
+
+	/* listed before pushing, callback may run right away */
+	pthread_mutex_lock(&control.pending_mutex);
+	request->next = control.pending;
+	control.pending = request;
+	pthread_mutex_unlock(&control.pending_mutex);
+
+	/* applied in stream order by control_callback() */
+	if (!(ret = request_callback(request))) {
+		*queued = 1;
+		return 0;
+	}
+	control_unqueue(request);
+
+	/* not running or no file to run callbacks, apply now */
+	if ((ret == EAGAIN) || (ret == ENOTSUP))
+		ret = control_apply(request);
+	free(request);
+	return ret;
+}
+
+int control_apply(struct control_request_s *request)
+{
+	int ret;
+
+	if (request->what == CONTROL_FPS)
+		ret = opengl_set_fps(request->value);
+	else if (request->what == CONTROL_SCALE)
+		ret = opengl_set_scale(request->value);
+	else
+		ret = switch_compression(request->compression, request->level);
+
+	if (ret)
+		glc_log(control.glc, GLC_ERROR, "control",
+			 "can't apply change: %s (%d)", strerror(ret), ret);
+	return ret;
+}
+
+/**  \} */
+/**  \} */
@@ -55,8 +55,13 @@ __PRIVATE int open_stream();
 __PRIVATE int close_stream();
 __PRIVATE int reload_stream();
 __PRIVATE int start_capture();
+__PRIVATE int start_capture_sized(size_t size);
 __PRIVATE int stop_capture();
 __PRIVATE void increment_capture();
+__PRIVATE int save_replay();
+__PRIVATE int request_callback(void *arg);
+__PRIVATE int switch_compression(int compression, int level);
+__PRIVATE int write_stats(int force);
 /**  \} */
 
 /**
@@ -69,6 +74,7 @@ __PRIVATE int alsa_close();
 __PRIVATE int alsa_capture_start_all();
 __PRIVATE int alsa_capture_stop_all();
 __PRIVATE int alsa_unhook_so(const char *soname);
+__PRIVATE int alsa_dropped(unsigned long *chunks, unsigned long *bytes);
 /**  \} */
 
 /**
@@ -80,8 +86,14 @@ __PRIVATE int opengl_start(ps_buffer_t *buffer);
 __PRIVATE int opengl_capture_start();
 __PRIVATE int opengl_capture_stop();
 __PRIVATE int opengl_refresh_color_correction();
+__PRIVATE int opengl_reset_repeat();
+__PRIVATE int opengl_try_frame_refs(int try_refs);
 __PRIVATE int opengl_close();
 __PRIVATE int opengl_push_message(glc_message_header_t *hdr, void *message, size_t message_size);
+__PRIVATE int opengl_set_fps(double fps);
+__PRIVATE int opengl_set_scale(double scale);
+__PRIVATE unsigned long long opengl_dropped();
+__PRIVATE int opengl_size_buffers(unsigned int ms);
 /**  \} */
 
 /**
@@ -92,6 +104,15 @@ __PRIVATE int x11_init(glc_t *glc);
 __PRIVATE int x11_close();
 /**  \} */
 
+/**
+ * \addtogroup control
+ *  \{
+ */
+__PRIVATE int control_init(glc_t *glc);
+__PRIVATE int control_close();
+__PRIVATE void control_callback(void *arg);
+/**  \} */
+
 /**
  * \defgroup hooks Hooked functions
  *  \{
@@ -27,9 +27,15 @@
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/util.h>
+#include <glc/common/ring.h>
 #include <glc/common/state.h>
+#include <glc/common/slice.h>
+#include <glc/common/thread.h>
 #include <glc/core/pack.h>
 #include <glc/core/file.h>
+#include <glc/core/replay.h>
+#include <glc/export/encode.h>
+#include <glc/core/ipc.h>
 
 #include "lib.h"
 
@@ -40,6 +46,17 @@
 #define MAIN_SYNC                 0x20
 #define MAIN_COMPRESS_LZJB        0x40
 #define MAIN_START                0x80
+#define MAIN_PERSISTENT_PBO      0x100
+#define MAIN_COMPRESS_LZ4        0x200
+#define MAIN_COMPRESS_ZSTD       0x400
+#define MAIN_COMPRESS_ADAPTIVE   0x800
+#define MAIN_FILE_DIRECT        0x1000
+#define MAIN_ENCODE             0x2000
+#define MAIN_SIZE_PENDING       0x4000
+#define MAIN_DAEMON             0x8000
+
+/* most stages in one GLC_MESSAGE_STATS */
+#define MAIN_STATS_STAGES       32
 
 struct main_private_s {
 	glc_t glc;
@@ -48,10 +65,32 @@ struct main_private_s {
 	ps_buffer_t *uncompressed;
 	ps_buffer_t *compressed;
 	size_t uncompressed_size, compressed_size;
+	int numa_node;
+	glc_flags_t buffer_flags;
+	unsigned int buffer_auto;
+	int buffer_mirror;
+	glc_ring_t ring;
 
 	file_t file;
+	size_t file_buffer;
+	unsigned int file_uring;
+	glc_utime_t file_index;
+	glc_size_t segment_size;
+	glc_utime_t segment_time;
+	glc_utime_t file_flush;
 	pack_t pack;
 
+	replay_t replay;
+	glc_utime_t replay_duration;
+	size_t replay_size;
+
+	encode_t encode;
+	const char *encode_file_fmt;
+
+	ipc_t ipc;
+	const char *daemon_path;
+	size_t daemon_ring;
+
 	unsigned int capture;
 	const char *stream_file_fmt;
 	char *stream_file;
@@ -62,6 +101,10 @@ struct main_private_s {
 	void (*sigterm_handler)(int);
 
 	glc_utime_t stop_time;
+
+	/* GLC_MESSAGE_STATS interval, 0 disables */
+	glc_utime_t stats_interval;
+	glc_utime_t stats_time;
 };
 
 __PRIVATE glc_lib_t lib = {NULL, /* dlopen */
@@ -78,9 +121,14 @@ __PRIVATE struct main_private_s mpriv;
 __PRIVATE int init_buffers();
 __PRIVATE void lib_close();
 __PRIVATE int load_environ();
+__PRIVATE int load_thread_attr();
 __PRIVATE void signal_handler(int signum);
 __PRIVATE void get_real_libc_dlsym();
 __PRIVATE void reload_stream_callback(void *arg);
+__PRIVATE int init_file(file_t *file);
+__PRIVATE int init_encode();
+__PRIVATE int open_target(file_t file, const char *name);
+__PRIVATE int start_sink(ps_buffer_t *from);
 
 void init_glc()
 {
@@ -89,8 +137,20 @@ void init_glc()
 	mpriv.flags = 0;
 	mpriv.capture = 0;
 	mpriv.stop_time = 0;
+	mpriv.file_buffer = 1024 * 1024;
+	mpriv.file_flush = 1000000;
+	mpriv.file_uring = 0;
+	mpriv.file_index = 1000000;
+	mpriv.segment_size = 0;
+	mpriv.segment_time = 0;
+	mpriv.replay_duration = 0;
+	mpriv.replay_size = 0;
 	mpriv.stream_file = NULL;
 	mpriv.stream_file_fmt = "%app%-%pid%-%capture%.glc";
+	mpriv.encode = NULL;
+	mpriv.encode_file_fmt = "%app%-%pid%-%capture%.mkv";
+	mpriv.ipc = NULL;
+	mpriv.daemon_ring = 0;
 
 	if ((ret = pthread_mutex_lock(&lib.init_lock)))
 		goto err;
@@ -106,7 +166,8 @@ void init_glc()
 	load_environ();
 	glc_util_log_version(&mpriv.glc);
 
-	if ((ret = init_buffers()))
+	/* auto-sized buffers are created at first picture */
+	if ((!mpriv.buffer_auto) && ((ret = init_buffers())))
 		goto err;
 
 	if ((ret = opengl_init(&mpriv.glc)))
@@ -115,6 +176,8 @@ void init_glc()
 		goto err;
 	if ((ret = x11_init(&mpriv.glc)))
 		goto err;
+	/* capture works without control socket */
+	control_init(&mpriv.glc);
 
 	/* get current time for correct timediff */
 	mpriv.stop_time = glc_state_time(&mpriv.glc);
@@ -164,18 +227,42 @@ int init_buffers()
 	ps_bufferattr_t attr;
 	ps_bufferattr_init(&attr);
 
+	/* keep buffers on same node as glc threads */
+	if (mpriv.numa_node >= 0)
+		glc_prefer_numa_node(&mpriv.glc, mpriv.numa_node);
+
 	ps_bufferattr_setsize(&attr, mpriv.uncompressed_size);
 	mpriv.uncompressed = (ps_buffer_t *) malloc(sizeof(ps_buffer_t));
 	if ((ret = ps_buffer_init(mpriv.uncompressed, &attr)))
 		return ret;
+	/* no page faults in capture path later */
+	if ((ret = glc_util_buffer_prepare(&mpriv.glc, mpriv.uncompressed,
+					   mpriv.uncompressed_size, mpriv.buffer_flags)))
+		return ret;
+
+	if (mpriv.buffer_mirror) {
+		/* pictures bypass buffer, only references are queued */
+		if ((ret = glc_ring_init(&mpriv.ring, &mpriv.glc,
+					 mpriv.uncompressed_size, mpriv.buffer_flags)))
+			return ret;
+		if ((ret = glc_ring_attach(mpriv.uncompressed, mpriv.ring)))
+			return ret;
+	}
 
 	if (!(mpriv.flags & MAIN_COMPRESS_NONE)) {
 		ps_bufferattr_setsize(&attr, mpriv.compressed_size);
 		mpriv.compressed = (ps_buffer_t *) malloc(sizeof(ps_buffer_t));
 		if ((ret = ps_buffer_init(mpriv.compressed, &attr)))
 			return ret;
+		if ((ret = glc_util_buffer_prepare(&mpriv.glc, mpriv.compressed,
+						   mpriv.compressed_size, mpriv.buffer_flags)))
+			return ret;
 	}
 
+	/* this is application's thread */
+	if (mpriv.numa_node >= 0)
+		glc_prefer_numa_node(&mpriv.glc, -1);
+
 	ps_bufferattr_destroy(&attr);
 	return 0;
 }
@@ -191,7 +278,7 @@ int open_stream()
 
 	if ((ret = file_set_sync(mpriv.file, (mpriv.flags & MAIN_SYNC) ? 1 : 0)))
 		return ret;
-	if ((ret = file_open_target(mpriv.file, mpriv.stream_file)))
+	if ((ret = open_target(mpriv.file, mpriv.stream_file)))
 		return ret;
 	if ((ret = file_write_info(mpriv.file, stream_info,
 				   info_name, info_date)))
@@ -203,6 +290,49 @@ int open_stream()
 	return 0;
 }
 
+int save_replay()
+{
+	glc_stream_info_t *stream_info;
+	char *info_name, *info_date, *filename;
+	file_t file;
+	int ret;
+
+	if ((!lib.running) || (!mpriv.replay))
+		return EAGAIN;
+
+	/* only this touches disk in replay mode */
+	filename = glc_util_format_filename(mpriv.stream_file_fmt, mpriv.capture++);
+	if ((ret = init_file(&file)))
+		goto err;
+	file_set_sync(file, (mpriv.flags & MAIN_SYNC) ? 1 : 0);
+	if ((ret = open_target(file, filename))) {
+		file_destroy(file);
+		goto err;
+	}
+
+	glc_util_info_create(&mpriv.glc, &stream_info, &info_name, &info_date);
+	ret = file_write_info(file, stream_info, info_name, info_date);
+	free(stream_info);
+	free(info_name);
+	free(info_date);
+
+	/* replay writes and closes file in background */
+	if ((ret) || (ret = replay_save(mpriv.replay, file))) {
+		file_close_target(file);
+		file_destroy(file);
+		unlink(filename);
+		goto err;
+	}
+
+	free(filename);
+	return 0;
+err:
+	glc_log(&mpriv.glc, GLC_ERROR, "main",
+		"can't save replay: %s (%d)", strerror(ret), ret);
+	free(filename);
+	return ret;
+}
+
 int close_stream()
 {
 	int ret;
@@ -223,6 +353,12 @@ void reload_stream_callback(void *arg)
 	/* this is called when callback request arrives to file object */
 	int ret;
 
+	if (arg != NULL) {
+		/* pushed with request_callback() */
+		control_callback(arg);
+		return;
+	}
+
 	glc_log(&mpriv.glc, GLC_INFORMATION, "main", "reloading stream");
 
 	if ((ret = file_write_eof(mpriv.file)))
@@ -242,15 +378,46 @@ err:
 
 int reload_stream()
 {
+	int ret;
 	glc_message_header_t hdr;
 	hdr.type = GLC_CALLBACK_REQUEST;
 	glc_callback_request_t callback_req;
 	callback_req.arg = NULL;
 
+	/* synchronize with opengl top buffer */
+	if ((ret = opengl_push_message(&hdr, &callback_req, sizeof(glc_callback_request_t))))
+		return ret;
+
+	/* new file must not start with a repeated picture */
+	return opengl_reset_repeat();
+}
+
+int request_callback(void *arg)
+{
+	glc_message_header_t hdr;
+	glc_callback_request_t callback_req;
+
+	/* replay and encode don't run callbacks */
+	if (!mpriv.file)
+		return ENOTSUP;
+
+	hdr.type = GLC_CALLBACK_REQUEST;
+	callback_req.arg = arg;
+
 	/* synchronize with opengl top buffer */
 	return opengl_push_message(&hdr, &callback_req, sizeof(glc_callback_request_t));
 }
 
+int switch_compression(int compression, int level)
+{
+	if (mpriv.flags & MAIN_COMPRESS_NONE)
+		return ENOTSUP;
+	if (!lib.running)
+		return EAGAIN;
+
+	return pack_switch_compression(mpriv.pack, compression, level);
+}
+
 void increment_capture()
 {
 	mpriv.capture++;
@@ -263,6 +430,17 @@ int start_capture()
 	if (lib.flags & LIB_CAPTURING)
 		return EAGAIN;
 
+	if ((!lib.running) && (mpriv.uncompressed == NULL)) {
+		if (mpriv.flags & MAIN_SIZE_PENDING)
+			return EAGAIN;
+		/* opengl calls start_capture_sized() at next picture */
+		mpriv.flags |= MAIN_SIZE_PENDING;
+		opengl_size_buffers(mpriv.buffer_auto);
+		glc_log(&mpriv.glc, GLC_INFORMATION, "main",
+			 "waiting for first picture to size buffers");
+		return 0;
+	}
+
 	if (!lib.running) {
 		if ((ret = start_glc()))
 			goto err;
@@ -284,13 +462,43 @@ err:
 	return ret;
 }
 
+int start_capture_sized(size_t size)
+{
+	int ret;
+
+	if (!(mpriv.flags & MAIN_SIZE_PENDING))
+		return EINVAL;
+	mpriv.flags &= ~MAIN_SIZE_PENDING;
+
+	mpriv.uncompressed_size = mpriv.compressed_size = size;
+	glc_log(&mpriv.glc, GLC_INFORMATION, "main",
+		 "stream buffers are %zu MiB", size / (1024 * 1024));
+
+	if ((ret = init_buffers())) {
+		glc_log(&mpriv.glc, GLC_ERROR, "main",
+			"can't create buffers: %s (%d)", strerror(ret), ret);
+		return ret;
+	}
+
+	return start_capture();
+}
+
 int stop_capture()
 {
 	int ret;
 
+	if (mpriv.flags & MAIN_SIZE_PENDING) {
+		mpriv.flags &= ~MAIN_SIZE_PENDING;
+		opengl_size_buffers(0);
+		return 0;
+	}
+
 	if (!(lib.flags & LIB_CAPTURING))
 		return EAGAIN;
 
+	/* counters at end of capture */
+	write_stats(1);
+
 	if ((ret = alsa_capture_stop_all()))
 		goto err;
 	if ((ret = opengl_capture_stop()))
@@ -307,6 +515,42 @@ err:
 	return ret;
 }
 
+int write_stats(int force)
+{
+	glc_stats_message_t *stats;
+	glc_message_header_t hdr;
+	unsigned long chunks, bytes;
+	glc_utime_t now;
+	int ret;
+
+	if ((!mpriv.stats_interval) || (!(lib.flags & LIB_CAPTURING)))
+		return 0;
+
+	/* called at every picture, keep it cheap */
+	now = glc_time(&mpriv.glc);
+	if ((!force) && (now - mpriv.stats_time < mpriv.stats_interval))
+		return 0;
+	mpriv.stats_time = now;
+
+	if (!(stats = (glc_stats_message_t *) malloc(sizeof(glc_stats_message_t) +
+						      MAIN_STATS_STAGES * sizeof(glc_stats_stage_t))))
+		return ENOMEM;
+
+	stats->time = glc_state_time(&mpriv.glc);
+	stats->video_dropped = opengl_dropped();
+	alsa_dropped(&chunks, &bytes);
+	stats->audio_dropped = chunks;
+	stats->audio_dropped_bytes = bytes;
+	stats->stages = glc_thread_stats_get(&mpriv.glc, (glc_stats_stage_t *) &stats[1],
+					     MAIN_STATS_STAGES);
+
+	hdr.type = GLC_MESSAGE_STATS;
+	ret = opengl_push_message(&hdr, stats, sizeof(glc_stats_message_t) +
+				  stats->stages * sizeof(glc_stats_stage_t));
+	free(stats);
+	return ret;
+}
+
 int start_glc()
 {
 	int ret;
@@ -319,17 +563,45 @@ int start_glc()
 
 	glc_log(&mpriv.glc, GLC_INFORMATION, "main", "starting glc");
 
-	/* initialize file & write stream info */
-	if ((ret = file_init(&mpriv.file, &mpriv.glc)))
-		return ret;
-	/* NOTE at the moment only reload is used as callback */
-	if ((ret = file_set_callback(mpriv.file, &reload_stream_callback)))
-		return ret;
-	if ((ret = open_stream()))
-		return ret;
+	if (mpriv.flags & MAIN_DAEMON) {
+		/* glc-daemon compresses and writes stream */
+		if ((ret = ipc_init(&mpriv.ipc, &mpriv.glc)))
+			return ret;
+		if ((mpriv.daemon_ring) &&
+		    (ipc_set_ring_size(mpriv.ipc, mpriv.daemon_ring)))
+			glc_log(&mpriv.glc, GLC_WARNING, "main",
+				 "invalid daemon ring size %zu MiB",
+				 mpriv.daemon_ring / (1024 * 1024));
+		if ((ret = ipc_connect(mpriv.ipc, mpriv.daemon_path)))
+			return ret;
+	} else if (mpriv.flags & MAIN_ENCODE) {
+		/* pictures are encoded straight from uncompressed buffer */
+		if ((ret = init_encode()))
+			return ret;
+	} else if (mpriv.replay_duration) {
+		/* stream is kept in memory until it is saved */
+		if ((ret = replay_init(&mpriv.replay, &mpriv.glc)))
+			return ret;
+		if ((ret = replay_set_duration(mpriv.replay, mpriv.replay_duration,
+					       mpriv.replay_size)))
+			return ret;
+		glc_log(&mpriv.glc, GLC_INFORMATION, "main",
+			 "keeping last %u s in memory",
+			 (unsigned int) (mpriv.replay_duration / 1000000));
+	} else {
+		/* initialize file & write stream info */
+		if ((ret = init_file(&mpriv.file)))
+			return ret;
+		/* reload, or control change pushed with request_callback() */
+		if ((ret = file_set_callback(mpriv.file, &reload_stream_callback)))
+			return ret;
+		file_set_segment(mpriv.file, mpriv.segment_size, mpriv.segment_time);
+		if ((ret = open_stream()))
+			return ret;
+	}
 
 	if (!(mpriv.flags & MAIN_COMPRESS_NONE)) {
-		if ((ret = file_write_process_start(mpriv.file, mpriv.compressed)))
+		if ((ret = start_sink(mpriv.compressed)))
 			return ret;
 
 		if ((ret = pack_init(&mpriv.pack, &mpriv.glc)))
@@ -341,15 +613,68 @@ int start_glc()
 			pack_set_compression(mpriv.pack, PACK_LZO);
 		else if (mpriv.flags & MAIN_COMPRESS_LZJB)
 			pack_set_compression(mpriv.pack, PACK_LZJB);
+		else if (mpriv.flags & MAIN_COMPRESS_LZ4)
+			pack_set_compression(mpriv.pack, PACK_LZ4);
+		else if (mpriv.flags & MAIN_COMPRESS_ZSTD)
+			pack_set_compression(mpriv.pack, PACK_ZSTD);
+		else if (mpriv.flags & MAIN_COMPRESS_ADAPTIVE)
+			pack_set_compression(mpriv.pack, PACK_ADAPTIVE);
+
+		if (getenv("GLC_COMPRESS_LEVEL")) {
+			if (pack_set_compression_level(mpriv.pack, atoi(getenv("GLC_COMPRESS_LEVEL"))))
+				glc_log(&mpriv.glc, GLC_WARNING, "main",
+					 "invalid compression level '%s'", getenv("GLC_COMPRESS_LEVEL"));
+		}
+
+		if (getenv("GLC_DELTA")) {
+			if (pack_set_delta(mpriv.pack, atoi(getenv("GLC_DELTA"))))
+				glc_log(&mpriv.glc, GLC_WARNING, "main",
+					 "invalid key frame interval '%s'", getenv("GLC_DELTA"));
+		}
+
+		if (getenv("GLC_DELTA_TILES"))
+			pack_set_delta_tiles(mpriv.pack, atoi(getenv("GLC_DELTA_TILES")));
+
+		if (getenv("GLC_AUDIO_LPC"))
+			pack_set_audio_lpc(mpriv.pack, atoi(getenv("GLC_AUDIO_LPC")));
+
+		/* index and replay of compressed stream need packet times and key frames */
+		if ((mpriv.file_index) || (mpriv.replay))
+			pack_set_stamp(mpriv.pack, 1);
+
+		if (getenv("GLC_COMPRESS_BLOCK_SIZE")) {
+			if (pack_set_block_size(mpriv.pack,
+						atoi(getenv("GLC_COMPRESS_BLOCK_SIZE")) * 1024))
+				glc_log(&mpriv.glc, GLC_WARNING, "main",
+					 "invalid compression block size '%s'",
+					 getenv("GLC_COMPRESS_BLOCK_SIZE"));
+		}
+
+		if (getenv("GLC_COMPRESS_HEADROOM")) {
+			if (pack_set_adaptive_headroom(mpriv.pack, atof(getenv("GLC_COMPRESS_HEADROOM"))))
+				glc_log(&mpriv.glc, GLC_WARNING, "main",
+					 "invalid compression headroom '%s'", getenv("GLC_COMPRESS_HEADROOM"));
+		}
 
 		if ((ret = pack_process_start(mpriv.pack, mpriv.uncompressed, mpriv.compressed)))
 			return ret;
+	} else if (mpriv.flags & MAIN_DAEMON) {
+		if ((ret = ipc_write_process_start(mpriv.ipc, mpriv.uncompressed)))
+			return ret;
+	} else if (mpriv.flags & MAIN_ENCODE) {
+		if ((ret = encode_process_start(mpriv.encode, mpriv.uncompressed)))
+			return ret;
 	} else {
 		glc_log(&mpriv.glc, GLC_WARNING, "main", "compression disabled");
-		if ((ret = file_write_process_start(mpriv.file, mpriv.uncompressed)))
+		if ((ret = start_sink(mpriv.uncompressed)))
 			return ret;
 	}
 
+	/* frame references must be resolved by pack */
+	if ((mpriv.flags & MAIN_PERSISTENT_PBO) &&
+	    (!(mpriv.flags & MAIN_COMPRESS_NONE)))
+		opengl_try_frame_refs(1);
+
 	if ((ret = alsa_start(mpriv.uncompressed)))
 		return ret;
 	if ((ret = opengl_start(mpriv.uncompressed)))
@@ -361,6 +686,77 @@ int start_glc()
 	return 0;
 }
 
+int init_file(file_t *file)
+{
+	int ret;
+
+	if ((ret = file_init(file, &mpriv.glc)))
+		return ret;
+	if ((ret = file_set_write_buffer(*file, mpriv.file_buffer)))
+		goto err;
+	file_set_flush_interval(*file, mpriv.file_flush);
+	if ((ret = file_set_direct(*file, (mpriv.flags & MAIN_FILE_DIRECT) ? 1 : 0)))
+		goto err;
+	file_set_index(*file, mpriv.file_index);
+	if (file_set_uring(*file, mpriv.file_uring))
+		glc_log(&mpriv.glc, GLC_WARNING, "main",
+			 "invalid io_uring buffer count %u", mpriv.file_uring);
+
+	return 0;
+err:
+	file_destroy(*file);
+	return ret;
+}
+
+int init_encode()
+{
+	glc_stream_info_t *stream_info;
+	char *info_name, *info_date;
+	int ret;
+
+	if ((ret = encode_init(&mpriv.encode, &mpriv.glc)))
+		return ret;
+
+	/* same fps that stream info would have */
+	glc_util_info_create(&mpriv.glc, &stream_info, &info_name, &info_date);
+	encode_set_fps(mpriv.encode, stream_info->fps);
+	free(stream_info);
+	free(info_name);
+	free(info_date);
+
+	mpriv.stream_file = glc_util_format_filename(mpriv.encode_file_fmt, mpriv.capture);
+	encode_set_filename(mpriv.encode, mpriv.stream_file);
+
+	if (getenv("GLC_ENCODER"))
+		encode_set_codec(mpriv.encode, getenv("GLC_ENCODER"), NULL);
+	if (getenv("GLC_ENCODE_PRESET"))
+		encode_set_preset(mpriv.encode, getenv("GLC_ENCODE_PRESET"));
+	if (getenv("GLC_ENCODE_QUALITY"))
+		encode_set_quality(mpriv.encode, atoi(getenv("GLC_ENCODE_QUALITY")));
+	if (getenv("GLC_ENCODE_BITRATE"))
+		encode_set_bitrate(mpriv.encode, atoi(getenv("GLC_ENCODE_BITRATE")));
+	if (getenv("GLC_ENCODE_THREADS"))
+		encode_set_threads(mpriv.encode, atoi(getenv("GLC_ENCODE_THREADS")));
+
+	glc_log(&mpriv.glc, GLC_INFORMATION, "main", "encoding to %s", mpriv.stream_file);
+	return 0;
+}
+
+int open_target(file_t file, const char *name)
+{
+	/* tcp://host:port streams to glc-play on another machine */
+	if (!strncmp(name, "tcp://", 6))
+		return file_connect_target(file, &name[6]);
+	return file_open_target(file, name);
+}
+
+int start_sink(ps_buffer_t *from)
+{
+	if (mpriv.replay)
+		return replay_process_start(mpriv.replay, from);
+	return file_write_process_start(mpriv.file, from);
+}
+
 void signal_handler(int signum)
 {
 	if ((signum == SIGINT) &&
@@ -404,6 +800,8 @@ void lib_close()
 
 	glc_log(&mpriv.glc, GLC_INFORMATION, "main", "closing glc");
 
+	if ((ret = control_close()))
+		goto err;
 	if ((ret = alsa_close()))
 		goto err;
 	if ((ret = opengl_close()))
@@ -414,9 +812,20 @@ void lib_close()
 			pack_process_wait(mpriv.pack);
 			pack_destroy(mpriv.pack);
 		}
-		file_write_process_wait(mpriv.file);
-		close_stream();
-		file_destroy(mpriv.file);
+		if (mpriv.ipc) {
+			ipc_write_process_wait(mpriv.ipc);
+			ipc_destroy(mpriv.ipc);
+		} else if (mpriv.encode) {
+			encode_process_wait(mpriv.encode);
+			encode_destroy(mpriv.encode);
+		} else if (mpriv.replay) {
+			replay_process_wait(mpriv.replay);
+			replay_destroy(mpriv.replay);
+		} else {
+			file_write_process_wait(mpriv.file);
+			close_stream();
+			file_destroy(mpriv.file);
+		}
 	}
 
 	if (mpriv.compressed) {
@@ -424,8 +833,13 @@ void lib_close()
 		free(mpriv.compressed);
 	}
 
-	ps_buffer_destroy(mpriv.uncompressed);
-	free(mpriv.uncompressed);
+	if (mpriv.uncompressed) {
+		ps_buffer_destroy(mpriv.uncompressed);
+		free(mpriv.uncompressed);
+	}
+
+	if (mpriv.ring)
+		glc_ring_destroy(mpriv.ring);
 
 	if (mpriv.flags & MAIN_CUSTOM_LOG)
 		glc_log_close(&mpriv.glc);
@@ -463,6 +877,40 @@ int load_environ()
 		mpriv.flags |= MAIN_CUSTOM_LOG;
 	}
 
+	if (getenv("GLC_STATS_FILE")) {
+		log_file = malloc(1024);
+		snprintf(log_file, 1023, getenv("GLC_STATS_FILE"), getpid());
+		if (glc_log_open_stats_file(&mpriv.glc, log_file))
+			glc_log(&mpriv.glc, GLC_WARNING, "main",
+				 "can't open stats file %s", log_file);
+		free(log_file);
+	}
+
+	if (getenv("GLC_STATS_INTERVAL")) {
+		if (glc_log_set_stats_interval(&mpriv.glc,
+				(glc_utime_t) (atof(getenv("GLC_STATS_INTERVAL")) * 1000000.0)))
+			glc_log(&mpriv.glc, GLC_WARNING, "main",
+				 "invalid stats interval '%s'", getenv("GLC_STATS_INTERVAL"));
+	}
+
+	/* GLC_MESSAGE_STATS in stream, needs thread counters */
+	mpriv.stats_interval = 1000000;
+	if (getenv("GLC_STREAM_STATS"))
+		mpriv.stats_interval = (glc_utime_t) (atof(getenv("GLC_STREAM_STATS")) * 1000000.0);
+	if (mpriv.stats_interval)
+		glc_log_collect_stats(&mpriv.glc, 1);
+
+	if (getenv("GLC_SLICES")) {
+		if (glc_slice_set_count(&mpriv.glc, atoi(getenv("GLC_SLICES"))))
+			glc_log(&mpriv.glc, GLC_WARNING, "main",
+				 "invalid slice count '%s'", getenv("GLC_SLICES"));
+	}
+
+	if (getenv("GLC_SIMD")) {
+		if (!atoi(getenv("GLC_SIMD")))
+			glc_set_cpu_features(&mpriv.glc, 0);
+	}
+
 	mpriv.sighandler = 0;
 	if (getenv("GLC_SIGHANDLER"))
 		mpriv.sighandler = atoi(getenv("GLC_SIGHANDLER"));
@@ -472,6 +920,34 @@ int load_environ()
 			mpriv.flags |= MAIN_SYNC;
 	}
 
+	if (getenv("GLC_FILE_BUFFER"))
+		mpriv.file_buffer = atoi(getenv("GLC_FILE_BUFFER")) * 1024;
+	if (getenv("GLC_FILE_FLUSH"))
+		mpriv.file_flush = atoi(getenv("GLC_FILE_FLUSH")) * 1000;
+	if (getenv("GLC_INDEX_INTERVAL"))
+		mpriv.file_index = atoi(getenv("GLC_INDEX_INTERVAL")) * 1000;
+	if (getenv("GLC_FILE_SEGMENT_SIZE"))
+		mpriv.segment_size = (glc_size_t) atoi(getenv("GLC_FILE_SEGMENT_SIZE")) * 1024 * 1024;
+	if (getenv("GLC_FILE_SEGMENT_TIME"))
+		mpriv.segment_time = (glc_utime_t) atoi(getenv("GLC_FILE_SEGMENT_TIME")) * 1000000;
+	if (getenv("GLC_REPLAY"))
+		mpriv.replay_duration = (glc_utime_t) atoi(getenv("GLC_REPLAY")) * 1000000;
+	if (getenv("GLC_REPLAY_SIZE"))
+		mpriv.replay_size = (size_t) atoi(getenv("GLC_REPLAY_SIZE")) * 1024 * 1024;
+	if (getenv("GLC_FILE_URING"))
+		mpriv.file_uring = atoi(getenv("GLC_FILE_URING"));
+	if (getenv("GLC_FILE_DIRECT")) {
+		if (atoi(getenv("GLC_FILE_DIRECT")))
+			mpriv.flags |= MAIN_FILE_DIRECT;
+	}
+
+	load_thread_attr();
+
+	if (getenv("GLC_PERSISTENT_PBO")) {
+		if (atoi(getenv("GLC_PERSISTENT_PBO")))
+			mpriv.flags |= MAIN_PERSISTENT_PBO;
+	}
+
 	mpriv.uncompressed_size = 1024 * 1024 * 25;
 	if (getenv("GLC_UNCOMPRESSED_BUFFER_SIZE"))
 		mpriv.uncompressed_size = atoi(getenv("GLC_UNCOMPRESSED_BUFFER_SIZE")) * 1024 * 1024;
@@ -480,6 +956,11 @@ int load_environ()
 	if (getenv("GLC_COMPRESSED_BUFFER_SIZE"))
 		mpriv.compressed_size = atoi(getenv("GLC_COMPRESSED_BUFFER_SIZE")) * 1024 * 1024;
 
+	/* milliseconds of pictures, overrides sizes above */
+	mpriv.buffer_auto = 0;
+	if (getenv("GLC_BUFFER_AUTO"))
+		mpriv.buffer_auto = atoi(getenv("GLC_BUFFER_AUTO"));
+
 	if (getenv("GLC_COMPRESS")) {
 		if (!strcmp(getenv("GLC_COMPRESS"), "lzo"))
 			mpriv.flags |= MAIN_COMPRESS_LZO;
@@ -487,10 +968,35 @@ int load_environ()
 			mpriv.flags |= MAIN_COMPRESS_QUICKLZ;
 		else if (!strcmp(getenv("GLC_COMPRESS"), "lzjb"))
 			mpriv.flags |= MAIN_COMPRESS_LZJB;
+		else if (!strcmp(getenv("GLC_COMPRESS"), "lz4"))
+			mpriv.flags |= MAIN_COMPRESS_LZ4;
+		else if (!strcmp(getenv("GLC_COMPRESS"), "zstd"))
+			mpriv.flags |= MAIN_COMPRESS_ZSTD;
+		else if (!strcmp(getenv("GLC_COMPRESS"), "adaptive"))
+			mpriv.flags |= MAIN_COMPRESS_ADAPTIVE;
 		else
 			mpriv.flags |= MAIN_COMPRESS_NONE;
 	}
 
+	/* encoder needs uncompressed pictures */
+	if (getenv("GLC_ENCODE")) {
+		if (atoi(getenv("GLC_ENCODE")))
+			mpriv.flags |= MAIN_ENCODE | MAIN_COMPRESS_NONE;
+	}
+	if (getenv("GLC_ENCODE_FILE"))
+		mpriv.encode_file_fmt = getenv("GLC_ENCODE_FILE");
+
+	/* daemon compresses, hook only pushes raw stream */
+	if (getenv("GLC_DAEMON")) {
+		if (strlen(getenv("GLC_DAEMON")) && strcmp(getenv("GLC_DAEMON"), "0")) {
+			mpriv.daemon_path = getenv("GLC_DAEMON");
+			mpriv.flags |= MAIN_DAEMON | MAIN_COMPRESS_NONE;
+			mpriv.flags &= ~MAIN_ENCODE;
+		}
+	}
+	if (getenv("GLC_DAEMON_RING"))
+		mpriv.daemon_ring = (size_t) atoi(getenv("GLC_DAEMON_RING")) * 1024 * 1024;
+
 	return 0;
 }
 
@@ -675,5 +1181,77 @@ void *__main___libc_dlsym(void *handle, const char *symbol)
 	return lib.__libc_dlsym(handle, symbol);
 }
 
-/**  \} */
+int load_thread_attr()
+{
+	const char *stages[][2] = {{"pack",  "GLC_PACK_CPUS"},
+				   {"file",  "GLC_FILE_CPUS"},
+				   {"scale", "GLC_SCALE_CPUS"},
+				   {"ycbcr", "GLC_YCBCR_CPUS"},
+				   {"slice", "GLC_SLICE_CPUS"},
+				   {NULL, NULL}};
+	glc_thread_attr_t attr, stage_attr;
+	unsigned int i;
+
+	glc_thread_attr_init(&attr);
+
+	if (getenv("GLC_CPUS")) {
+		if (glc_thread_attr_set_cpus(&attr, getenv("GLC_CPUS")))
+			glc_log(&mpriv.glc, GLC_WARNING, "main",
+				 "invalid CPU list '%s'", getenv("GLC_CPUS"));
+	}
+
+	if (getenv("GLC_SCHED")) {
+		if (!strcmp(getenv("GLC_SCHED"), "idle"))
+			attr.policy = SCHED_IDLE;
+		else if (!strcmp(getenv("GLC_SCHED"), "batch"))
+			attr.policy = SCHED_BATCH;
+		else if (strcmp(getenv("GLC_SCHED"), "normal"))
+			glc_log(&mpriv.glc, GLC_WARNING, "main",
+				 "unknown scheduling policy '%s'", getenv("GLC_SCHED"));
+	}
+
+	if (getenv("GLC_NICE"))
+		attr.nice = atoi(getenv("GLC_NICE"));
+
+	mpriv.numa_node = -1;
+	if (getenv("GLC_NUMA_NODE"))
+		mpriv.numa_node = attr.numa_node = atoi(getenv("GLC_NUMA_NODE"));
+
+	mpriv.buffer_flags = 0;
+	if (getenv("GLC_BUFFER_HUGEPAGES")) {
+		if (atoi(getenv("GLC_BUFFER_HUGEPAGES")))
+			mpriv.buffer_flags |= GLC_UTIL_BUFFER_HUGEPAGES;
+	}
+	if (getenv("GLC_BUFFER_PREFAULT")) {
+		if (atoi(getenv("GLC_BUFFER_PREFAULT")))
+			mpriv.buffer_flags |= GLC_UTIL_BUFFER_PREFAULT;
+	}
+	if (getenv("GLC_BUFFER_LOCK")) {
+		if (atoi(getenv("GLC_BUFFER_LOCK")))
+			mpriv.buffer_flags |= GLC_UTIL_BUFFER_LOCK;
+	}
+
+	mpriv.buffer_mirror = 0;
+	if (getenv("GLC_BUFFER_MIRROR"))
+		mpriv.buffer_mirror = atoi(getenv("GLC_BUFFER_MIRROR"));
+
+	glc_set_thread_attr(&mpriv.glc, NULL, &attr);
+
+	/* per-stage CPU sets override GLC_CPUS */
+	for (i = 0; stages[i][0] != NULL; i++) {
+		if (!getenv(stages[i][1]))
+			continue;
+
+		memcpy(&stage_attr, &attr, sizeof(glc_thread_attr_t));
+		if (glc_thread_attr_set_cpus(&stage_attr, getenv(stages[i][1]))) {
+			glc_log(&mpriv.glc, GLC_WARNING, "main",
+				 "invalid CPU list '%s'", getenv(stages[i][1]));
+			continue;
+		}
+		glc_set_thread_attr(&mpriv.glc, stages[i][0], &stage_attr);
+	}
+
+	return 0;
+}
+
 /**  \} */
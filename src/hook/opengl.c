@@ -45,9 +45,12 @@ struct opengl_private_s {
 
 	int capture_glfinish;
 	int convert_ycbcr_420jpeg;
+	int try_frame_refs;
 	double scale_factor;
+	int scale_interpolation;
 	GLenum read_buffer;
 	double fps;
+	unsigned int size_ms;
 
 	int started;
 	int capturing;
@@ -58,6 +61,7 @@ __PRIVATE struct opengl_private_s opengl;
 __PRIVATE void get_real_opengl();
 __PRIVATE void opengl_capture_current();
 __PRIVATE void opengl_draw_indicator();
+__PRIVATE int opengl_size_from_drawable(Display *dpy, GLXDrawable drawable);
 
 int opengl_init(glc_t *glc)
 {
@@ -65,9 +69,11 @@ int opengl_init(glc_t *glc)
 	opengl.buffer = opengl.unscaled = NULL;
 	opengl.started = 0;
 	opengl.scale_factor = 1.0;
+	opengl.scale_interpolation = SCALE_BILINEAR;
 	opengl.capture_glfinish = 0;
 	opengl.read_buffer = GL_FRONT;
 	opengl.capturing = 0;
+	opengl.size_ms = 0;
 	int ret = 0;
 	unsigned int x, y, w, h;
 
@@ -117,9 +123,45 @@ int opengl_init(glc_t *glc)
 	if (getenv("GLC_SCALE"))
 		opengl.scale_factor = atof(getenv("GLC_SCALE"));
 
+	if (getenv("GLC_SCALE_FILTER")) {
+		if (!strcmp(getenv("GLC_SCALE_FILTER"), "bicubic"))
+			opengl.scale_interpolation = SCALE_BICUBIC;
+		else if (!strcmp(getenv("GLC_SCALE_FILTER"), "lanczos"))
+			opengl.scale_interpolation = SCALE_LANCZOS;
+		else if (strcmp(getenv("GLC_SCALE_FILTER"), "bilinear"))
+			glc_log(opengl.glc, GLC_WARNING, "opengl",
+				 "unknown scale filter '%s'", getenv("GLC_SCALE_FILTER"));
+	}
+
 	if (getenv("GLC_TRY_PBO"))
 		gl_capture_try_pbo(opengl.gl_capture, atoi(getenv("GLC_TRY_PBO")));
 
+	if (getenv("GLC_PBO_COUNT"))
+		gl_capture_set_pbo_count(opengl.gl_capture, atoi(getenv("GLC_PBO_COUNT")));
+
+	if (getenv("GLC_PBO_WORKER"))
+		gl_capture_try_worker(opengl.gl_capture, atoi(getenv("GLC_PBO_WORKER")));
+
+	if (getenv("GLC_GPU_SCALE")) {
+		if (atoi(getenv("GLC_GPU_SCALE")) && (opengl.scale_factor != 1.0)) {
+			/* no scaling is left for scale or ycbcr */
+			if (!gl_capture_set_scale(opengl.gl_capture, opengl.scale_factor))
+				opengl.scale_factor = 1.0;
+		}
+	}
+
+	if (getenv("GLC_GPU_CONVERT")) {
+		if (atoi(getenv("GLC_GPU_CONVERT"))) {
+			/* ycbcr does CPU scaling and conversion in one pass */
+			if (opengl.convert_ycbcr_420jpeg && (opengl.scale_factor == 1.0))
+				gl_capture_convert_ycbcr_420jpeg(opengl.gl_capture, 1);
+			else
+				glc_log(opengl.glc, GLC_WARNING, "opengl",
+					 "GPU conversion requires '420jpeg' colorspace and "
+					 "no scaling or GPU scaling");
+		}
+	}
+
 	gl_capture_set_pack_alignment(opengl.gl_capture, 8);
 	if (getenv("GLC_CAPTURE_DWORD_ALIGNED")) {
 		if (!atoi(getenv("GLC_CAPTURE_DWORD_ALIGNED")))
@@ -139,10 +181,23 @@ int opengl_init(glc_t *glc)
 	if (getenv("GLC_INDICATOR"))
 		gl_capture_draw_indicator(opengl.gl_capture, atoi(getenv("GLC_INDICATOR")));
 
+	if (getenv("GLC_DETECT_REPEAT"))
+		gl_capture_detect_repeat(opengl.gl_capture, atoi(getenv("GLC_DETECT_REPEAT")));
+
 	gl_capture_lock_fps(opengl.gl_capture, 0);
 	if (getenv("GLC_LOCK_FPS"))
 		gl_capture_lock_fps(opengl.gl_capture, atoi(getenv("GLC_LOCK_FPS")));
 
+	if (getenv("GLC_LOCK_FPS_PACING")) {
+		if (!strcmp(getenv("GLC_LOCK_FPS_PACING"), "hybrid"))
+			gl_capture_set_pacing(opengl.gl_capture, GL_CAPTURE_PACE_HYBRID);
+		else if (!strcmp(getenv("GLC_LOCK_FPS_PACING"), "vblank"))
+			gl_capture_set_pacing(opengl.gl_capture, GL_CAPTURE_PACE_VBLANK);
+		else if (strcmp(getenv("GLC_LOCK_FPS_PACING"), "sleep"))
+			glc_log(opengl.glc, GLC_WARNING, "opengl",
+				 "unknown pacing method '%s'", getenv("GLC_LOCK_FPS_PACING"));
+	}
+
 	get_real_opengl();
 	return 0;
 }
@@ -172,13 +227,22 @@ int opengl_start(ps_buffer_t *buffer)
 		} else {
 			scale_init(&opengl.scale, opengl.glc);
 			scale_set_scale(opengl.scale, opengl.scale_factor);
+			scale_set_interpolation(opengl.scale, opengl.scale_interpolation);
 			scale_process_start(opengl.scale, opengl.unscaled, buffer);
 		}
 
 		gl_capture_set_buffer(opengl.gl_capture, opengl.unscaled);
+
+		if (opengl.try_frame_refs)
+			glc_log(opengl.glc, GLC_WARNING, "opengl",
+				 "persistent PBOs can't be used with scaling or conversion on CPU");
 	} else {
 		gl_capture_set_pixel_format(opengl.gl_capture, GL_BGR);
 		gl_capture_set_buffer(opengl.gl_capture, opengl.buffer);
+
+		/* pack reads pictures straight from PBOs */
+		if (opengl.try_frame_refs)
+			gl_capture_try_frame_refs(opengl.gl_capture, 1);
 	}
 
 	opengl.started = 1;
@@ -290,6 +354,107 @@ int opengl_refresh_color_correction()
 	return gl_capture_refresh_color_correction(opengl.gl_capture);
 }
 
+int opengl_reset_repeat()
+{
+	return gl_capture_reset_repeat(opengl.gl_capture);
+}
+
+int opengl_set_fps(double fps)
+{
+	int ret;
+
+	if ((ret = gl_capture_set_fps(opengl.gl_capture, fps)))
+		return ret;
+
+	opengl.fps = fps;
+	return 0;
+}
+
+int opengl_set_scale(double scale)
+{
+	int ret;
+
+	/* only CPU scaling can be adjusted, GPU scaling is fixed in FBOs */
+	if (!opengl.unscaled)
+		return ENOTSUP;
+
+	if (opengl.convert_ycbcr_420jpeg)
+		ret = ycbcr_set_scale(opengl.ycbcr, scale);
+	else
+		ret = scale_set_scale(opengl.scale, scale);
+	if (ret)
+		return ret;
+	opengl.scale_factor = scale;
+
+	/* new factor is picked up at next format message */
+	return gl_capture_refresh_format(opengl.gl_capture);
+}
+
+unsigned long long opengl_dropped()
+{
+	return gl_capture_dropped(opengl.gl_capture);
+}
+
+int opengl_size_buffers(unsigned int ms)
+{
+	if (opengl.started)
+		return EALREADY;
+
+	/* zero cancels pending sizing */
+	opengl.size_ms = ms;
+	return 0;
+}
+
+int opengl_size_from_drawable(Display *dpy, GLXDrawable drawable)
+{
+	Window root;
+	int x, y, screen;
+	unsigned int w, h, sw, sh, border, depth, ms;
+	double out_bpp;
+	size_t size;
+
+	ms = opengl.size_ms;
+	opengl.size_ms = 0;
+	if (!XGetGeometry(dpy, drawable, &root, &x, &y, &w, &h, &border, &depth))
+		return EINVAL;
+
+	/* window can grow up to screen size without new buffers */
+	screen = DefaultScreen(dpy);
+	sw = DisplayWidth(dpy, screen);
+	sh = DisplayHeight(dpy, screen);
+	if (sw < w)
+		sw = w;
+	if (sh < h)
+		sh = h;
+
+	/* pictures in top buffer are scaled and maybe converted */
+	out_bpp = (opengl.convert_ycbcr_420jpeg ? 1.5 : 3.0) *
+		  opengl.scale_factor * opengl.scale_factor;
+	size = glc_util_buffer_auto_size((size_t) (w * h * out_bpp),
+					 (size_t) (sw * sh * out_bpp),
+					 opengl.fps, ms);
+
+	/* unscaled buffer holds BGRA pictures straight from GL */
+	if ((opengl.scale_factor != 1.0) | opengl.convert_ycbcr_420jpeg)
+		opengl.unscaled_size = glc_util_buffer_auto_size((size_t) w * h * 4,
+								 (size_t) sw * sh * 4,
+								 opengl.fps, ms);
+
+	glc_log(opengl.glc, GLC_DEBUG, "opengl",
+		 "sizing buffers for %ux%u (max %ux%u) at %f fps", w, h, sw, sh, opengl.fps);
+
+	return start_capture_sized(size);
+}
+
+int opengl_try_frame_refs(int try_refs)
+{
+	if (opengl.started)
+		return EALREADY;
+
+	opengl.try_frame_refs = try_refs;
+	return 0;
+}
+
 void get_real_opengl()
 {
 	if (!lib.dlopen)
@@ -351,7 +516,12 @@ void __opengl_glXSwapBuffers(Display *dpy, GLXDrawable drawable)
 	if (opengl.read_buffer == GL_FRONT)
 		opengl.glXSwapBuffers(dpy, drawable);
 
+	/* first picture after start with auto-sized buffers */
+	if (opengl.size_ms)
+		opengl_size_from_drawable(dpy, drawable);
+
 	gl_capture_frame(opengl.gl_capture, dpy, drawable);
+	write_stats(0);
 
 	if (opengl.read_buffer == GL_BACK)
 		opengl.glXSwapBuffers(dpy, drawable);
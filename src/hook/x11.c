@@ -54,6 +54,10 @@ struct x11_private_s {
 	unsigned int reload_key_mask;
 	KeySym reload_key;
 
+	/* write replay buffer to file */
+	unsigned int replay_key_mask;
+	KeySym replay_key;
+
 	Time last_event_time;
 };
 
@@ -101,6 +105,20 @@ int x11_init(glc_t *glc)
 		x11.reload_key = XK_F9;
 	}
 
+	if (getenv("GLC_REPLAY_HOTKEY")) {
+		if (x11_parse_key(getenv("GLC_REPLAY_HOTKEY"), &x11.replay_key, &x11.replay_key_mask)) {
+			glc_log(x11.glc, GLC_WARNING, "x11",
+				 "invalid replay hotkey '%s'", getenv("GLC_REPLAY_HOTKEY"));
+			glc_log(x11.glc, GLC_WARNING, "x11",
+				 "using default <Shift>F10\n");
+			x11.replay_key_mask = X11_KEY_SHIFT;
+			x11.replay_key = XK_F10;
+		}
+	} else {
+		x11.replay_key_mask = X11_KEY_SHIFT;
+		x11.replay_key = XK_F10;
+	}
+
 	return 0;
 }
 
@@ -173,7 +191,8 @@ void x11_event(Display *dpy, XEvent *event)
 				reload_stream();
 				start_capture();
 			}
-		}
+		} else if (x11_match_key(dpy, event, x11.replay_key, x11.replay_key_mask))
+			save_replay();
 
 		x11.last_event_time = event->xkey.time;
 	}
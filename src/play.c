@@ -9,16 +9,24 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <pthread.h>
 #include <getopt.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/util.h>
 #include <glc/common/state.h>
+#include <glc/common/slice.h>
+#include <glc/common/thread.h>
+#include <glc/common/ring.h>
 
+#include <glc/core/chain.h>
+#include <glc/core/copy.h>
 #include <glc/core/file.h>
 #include <glc/core/pack.h>
 #include <glc/core/rgb.h>
@@ -30,10 +38,49 @@
 #include <glc/export/img.h>
 #include <glc/export/wav.h>
 #include <glc/export/yuv4mpeg.h>
+#include <glc/export/encode.h>
 
 #include <glc/play/demux.h>
 
-enum play_action {action_play, action_info, action_img, action_yuv4mpeg, action_wav, action_val};
+enum play_action {action_play, action_info, action_img, action_yuv4mpeg, action_wav, action_encode, action_multi, action_recompress, action_val};
+
+/** maximum number of --export targets */
+#define PLAY_EXPORTS 8
+/** bytes read from each packet with --headers */
+#define PLAY_SCAN_SIZE 4096
+/** stream time read before and after each --ranges range */
+#define PLAY_RANGE_MARGIN 1000000
+
+enum play_export_sink {sink_yuv4mpeg, sink_wav, sink_img};
+
+struct play_export_s {
+	enum play_export_sink sink;
+	int nv12, img_format;
+	glc_stream_id_t id;
+	const char *filename;
+
+	ps_buffer_t buffer, converted_buffer;
+	chain_t chain;
+	rgb_t rgb;
+	scale_t scale;
+	color_t color;
+	ycbcr_t ycbcr;
+
+	yuv4mpeg_t yuv4mpeg;
+	wav_t wav;
+	img_t img;
+};
+
+/* part of stream exported in its own pipeline, see export_ranges() */
+struct play_range_s {
+	struct play_s *play;
+	unsigned int num;
+	file_t file;
+	char *filename;
+	glc_utime_t begin, end;
+	pthread_t thread;
+	int ret;
+};
 
 struct play_s {
 	glc_t glc;
@@ -47,6 +94,7 @@ struct play_s {
 
 	double scale_factor;
 	unsigned int scale_width, scale_height;
+	int scale_interpolation;
 
 	size_t compressed_size, uncompressed_size;
 
@@ -62,26 +110,65 @@ struct play_s {
 	glc_stream_id_t export_video_id;
 	glc_stream_id_t export_audio_id;
 	int img_format;
+	int png_level, png_filter;
+	int nv12;
+
+	const char *encode_codec, *encode_preset;
+	int encode_quality;
+	unsigned int encode_bitrate, encode_threads;
+
+	struct play_export_s export[PLAY_EXPORTS];
+	unsigned int exports;
 
 	glc_utime_t silence_threshold;
 	const char *alsa_playback_device;
+	glc_utime_t alsa_period;
 
 	int log_level;
+	int fused;
+	int gl_convert;
+	unsigned int slices;
+	glc_utime_t seek;
+	int mmap;
+	int scan;
+
+	int recompress, recompress_level;
+	unsigned int ranges;
+	int mirror;
+
+	glc_thread_attr_t thread_attr;
 };
 
 int show_info_value(struct play_s *play, const char *value);
+int add_export(struct play_s *play, char *spec);
 
 int play_stream(struct play_s *play);
 int stream_info(struct play_s *play);
-int export_img(struct play_s *play);
-int export_yuv4mpeg(struct play_s *play);
-int export_wav(struct play_s *play);
+int export_img(struct play_s *play, struct play_range_s *range);
+int export_yuv4mpeg(struct play_s *play, struct play_range_s *range);
+int export_wav(struct play_s *play, struct play_range_s *range);
+int export_ranges(struct play_s *play);
+int export_range(struct play_range_s *range);
+void *export_range_thread(void *argptr);
+int export_range_open(struct play_s *play, struct play_range_s *range);
+int export_ranges_join(struct play_s *play, struct play_range_s *range, unsigned int ranges);
+off_t export_range_header(const char *filename);
+int export_range_append(const char *to, const char *from, off_t skip);
+int export_encode(struct play_s *play);
+int export_multi(struct play_s *play);
+int recompress_stream(struct play_s *play);
+int parse_compression(struct play_s *play, const char *spec);
+int recompress_sink_read_callback(glc_thread_state_t *state);
+int play_buffer_init(struct play_s *play, ps_buffer_t *buffer, ps_bufferattr_t *attr,
+		     size_t size);
+void play_buffer_destroy(ps_buffer_t *buffer);
 
 int main(int argc, char *argv[])
 {
 	struct play_s play;
 	play.action = action_play;
 	const char *val_str = NULL;
+	glc_utime_t last;
 	int opt, option_index;
 
 	struct option long_options[] = {
@@ -89,18 +176,46 @@ int main(int argc, char *argv[])
 		{"wav",			1, NULL, 'a'},
 		{"bmp",			1, NULL, 'b'},
 		{"png",			1, NULL, 'p'},
+		{"qoi",			1, NULL, 'Q'},
+		{"ppm",			1, NULL, 'M'},
+		{"png-level",		1, NULL, 'z'},
+		{"png-filter",		1, NULL, 'Z'},
 		{"yuv4mpeg",		1, NULL, 'y'},
+		{"nv12",		1, NULL, 'Y'},
+		{"encode",		1, NULL, 'e'},
+		{"encode-audio",	1, NULL, 'A'},
+		{"encoder",		1, NULL, 'E'},
+		{"preset",		1, NULL, 'P'},
+		{"quality",		1, NULL, 'q'},
+		{"bitrate",		1, NULL, 'B'},
+		{"encode-threads",	1, NULL, 'T'},
+		{"export",		1, NULL, 'x'},
 		{"out",			1, NULL, 'o'},
 		{"fps",			1, NULL, 'f'},
 		{"resize",		1, NULL, 'r'},
+		{"resize-filter",	1, NULL, 'I'},
 		{"adjust",		1, NULL, 'g'},
 		{"silence",		1, NULL, 'l'},
 		{"alsa-device",		1, NULL, 'd'},
+		{"alsa-mmap",		1, NULL, 'L'},
 		{"streaming",		0, NULL, 't'},
 		{"compressed",		1, NULL, 'c'},
 		{"uncompressed",	1, NULL, 'u'},
 		{"show",		1, NULL, 's'},
 		{"verbosity",		1, NULL, 'v'},
+		{"cpus",		1, NULL, 'C'},
+		{"sched",		1, NULL, 'S'},
+		{"nice",		1, NULL, 'n'},
+		{"numa-node",		1, NULL, 'N'},
+		{"fused",		0, NULL, 'F'},
+		{"gl-convert",		0, NULL, 'G'},
+		{"slices",		1, NULL, 'j'},
+		{"seek",		1, NULL, 'k'},
+		{"mmap",		0, NULL, 'm'},
+		{"headers",		0, NULL, 'H'},
+		{"recompress",		1, NULL, 'R'},
+		{"ranges",		1, NULL, 'J'},
+		{"mirror",		0, NULL, 'W'},
 		{"help",		0, NULL, 'h'},
 		{"version",		0, NULL, 'V'},
 		{0, 0, 0, 0}
@@ -111,10 +226,12 @@ int main(int argc, char *argv[])
 
 	play.silence_threshold = 200000; /* 0.2 sec accuracy */
 	play.alsa_playback_device = "default";
+	play.alsa_period = 0; /* regular writes */
 
 	/* don't scale by default */
 	play.scale_factor = 1;
 	play.scale_width = play.scale_height = 0;
+	play.scale_interpolation = SCALE_BILINEAR;
 
 	/* default buffer size is 10MiB */
 	play.compressed_size = 10 * 1024 * 1024;
@@ -124,10 +241,31 @@ int main(int argc, char *argv[])
 	play.log_level = 0;
 	play.info_level = 1;
 
+	/* separate process for each filter */
+	play.fused = 0;
+	play.gl_convert = 0;
+	play.slices = 1;
+	play.seek = 0;
+	play.mmap = 0;
+	play.scan = 0;
+	play.recompress = 0;
+	play.recompress_level = 1;
+	play.ranges = 1;
+
 	/* default export settings */
 	play.interpolate = 1;
 	play.export_filename_format = NULL; /* user has to specify */
 	play.img_format = IMG_BMP;
+	play.png_level = -1;
+	play.png_filter = IMG_PNG_FILTER_DEFAULT;
+	play.nv12 = 0;
+	play.export_audio_id = 1;
+	play.encode_codec = "libx264";
+	play.encode_preset = NULL;
+	play.encode_quality = 23;
+	play.encode_bitrate = 0;
+	play.encode_threads = 0;
+	play.exports = 0;
 
 	/* global color correction */
 	play.override_color_correction = 0;
@@ -136,7 +274,10 @@ int main(int argc, char *argv[])
 	play.green_gamma = 1.0;
 	play.blue_gamma = 1.0;
 
-	while ((opt = getopt_long(argc, argv, "i:a:b:p:y:o:f:r:g:l:td:c:u:s:v:hV",
+	/* inherit affinity and scheduling policy */
+	glc_thread_attr_init(&play.thread_attr);
+
+	while ((opt = getopt_long(argc, argv, "i:a:b:p:Q:M:z:Z:y:Y:e:A:E:P:q:B:T:x:o:f:r:I:g:l:td:L:c:u:s:v:C:S:n:N:FGj:k:mHR:J:WhV",
 				  long_options, &optind)) != -1) {
 		switch (opt) {
 		case 'i':
@@ -152,19 +293,82 @@ int main(int argc, char *argv[])
 			play.action = action_wav;
 			break;
 		case 'p':
-			play.img_format = IMG_PNG;
+		case 'Q':
+		case 'M':
 		case 'b':
+			if (opt == 'p')
+				play.img_format = IMG_PNG;
+			else if (opt == 'Q')
+				play.img_format = IMG_QOI;
+			else if (opt == 'M')
+				play.img_format = IMG_PPM;
+			else
+				play.img_format = IMG_BMP;
 			play.export_video_id = atoi(optarg);
 			if (play.export_video_id < 1)
 				goto usage;
 			play.action = action_img;
 			break;
+		case 'Y':
+			play.nv12 = 1;
 		case 'y':
 			play.export_video_id = atoi(optarg);
 			if (play.export_video_id < 1)
 				goto usage;
 			play.action = action_yuv4mpeg;
 			break;
+		case 'e':
+			play.export_video_id = atoi(optarg);
+			if (play.export_video_id < 1)
+				goto usage;
+			play.action = action_encode;
+			break;
+		case 'x':
+			if (add_export(&play, optarg))
+				goto usage;
+			play.action = action_multi;
+			break;
+		case 'z':
+			play.png_level = atoi(optarg);
+			if ((play.png_level < -1) || (play.png_level > 9))
+				goto usage;
+			break;
+		case 'Z':
+			if (!strcmp(optarg, "default"))
+				play.png_filter = IMG_PNG_FILTER_DEFAULT;
+			else if (!strcmp(optarg, "none"))
+				play.png_filter = IMG_PNG_FILTER_NONE;
+			else if (!strcmp(optarg, "sub"))
+				play.png_filter = IMG_PNG_FILTER_SUB;
+			else if (!strcmp(optarg, "up"))
+				play.png_filter = IMG_PNG_FILTER_UP;
+			else if (!strcmp(optarg, "paeth"))
+				play.png_filter = IMG_PNG_FILTER_PAETH;
+			else
+				goto usage;
+			break;
+		case 'A':
+			play.export_audio_id = atoi(optarg);
+			break;
+		case 'E':
+			play.encode_codec = optarg;
+			break;
+		case 'P':
+			play.encode_preset = optarg;
+			break;
+		case 'q':
+			play.encode_quality = atoi(optarg);
+			break;
+		case 'B':
+			if (atoi(optarg) < 0)
+				goto usage;
+			play.encode_bitrate = atoi(optarg);
+			break;
+		case 'T':
+			if (atoi(optarg) < 0)
+				goto usage;
+			play.encode_threads = atoi(optarg);
+			break;
 		case 'f':
 			play.fps = atof(optarg);
 			if (play.fps <= 0)
@@ -181,6 +385,16 @@ int main(int argc, char *argv[])
 					goto usage;
 			}
 			break;
+		case 'I':
+			if (!strcmp(optarg, "bilinear"))
+				play.scale_interpolation = SCALE_BILINEAR;
+			else if (!strcmp(optarg, "bicubic"))
+				play.scale_interpolation = SCALE_BICUBIC;
+			else if (!strcmp(optarg, "lanczos"))
+				play.scale_interpolation = SCALE_LANCZOS;
+			else
+				goto usage;
+			break;
 		case 'g':
 			play.override_color_correction = 1;
 			sscanf(optarg, "%f;%f;%f;%f;%f", &play.brightness, &play.contrast,
@@ -193,6 +407,11 @@ int main(int argc, char *argv[])
 		case 'd':
 			play.alsa_playback_device = optarg;
 			break;
+		case 'L':
+			if (atof(optarg) <= 0)
+				goto usage;
+			play.alsa_period = atof(optarg) * 1000;
+			break;
 		case 'o':
 			if (!strcmp(optarg, "-")) /** \todo fopen(1) ? */
 				play.export_filename_format = "/dev/stdout";
@@ -221,6 +440,63 @@ int main(int argc, char *argv[])
 			if (play.log_level < 0)
 				goto usage;
 			break;
+		case 'C':
+			if (glc_thread_attr_set_cpus(&play.thread_attr, optarg))
+				goto usage;
+			break;
+		case 'S':
+			if (!strcmp(optarg, "idle"))
+				play.thread_attr.policy = SCHED_IDLE;
+			else if (!strcmp(optarg, "batch"))
+				play.thread_attr.policy = SCHED_BATCH;
+			else if (!strcmp(optarg, "normal"))
+				play.thread_attr.policy = SCHED_OTHER;
+			else
+				goto usage;
+			break;
+		case 'n':
+			play.thread_attr.nice = atoi(optarg);
+			break;
+		case 'N':
+			play.thread_attr.numa_node = atoi(optarg);
+			if (play.thread_attr.numa_node < 0)
+				goto usage;
+			break;
+		case 'F':
+			play.fused = 1;
+			break;
+		case 'G':
+			play.gl_convert = 1;
+			break;
+		case 'j':
+			if (atoi(optarg) < 1)
+				goto usage;
+			play.slices = atoi(optarg);
+			break;
+		case 'm':
+			play.mmap = 1;
+			break;
+		case 'H':
+			play.scan = 1;
+			break;
+		case 'R':
+			if (parse_compression(&play, optarg))
+				goto usage;
+			play.action = action_recompress;
+			break;
+		case 'J':
+			play.ranges = atoi(optarg);
+			if (!play.ranges)
+				goto usage;
+			break;
+		case 'W':
+			play.mirror = 1;
+			break;
+		case 'k':
+			if (atof(optarg) < 0)
+				goto usage;
+			play.seek = atof(optarg) * 1000000.0;
+			break;
 		case 'V':
 			printf("glc version %s\n", glc_version());
 			return EXIT_SUCCESS;
@@ -238,7 +514,9 @@ int main(int argc, char *argv[])
 	/* same goes to output file */
 	if (((play.action == action_img) |
 	     (play.action == action_wav) |
-	     (play.action == action_yuv4mpeg)) &&
+	     (play.action == action_yuv4mpeg) |
+	     (play.action == action_encode) |
+	     (play.action == action_recompress)) &&
 	    (play.export_filename_format == NULL))
 		goto usage;
 
@@ -248,16 +526,40 @@ int main(int argc, char *argv[])
 	glc_util_log_version(&play.glc);
 	glc_state_init(&play.glc);
 
+	/* applied to every processing thread */
+	glc_set_thread_attr(&play.glc, NULL, &play.thread_attr);
+	if (play.thread_attr.numa_node >= 0)
+		glc_prefer_numa_node(&play.glc, play.thread_attr.numa_node);
+	glc_slice_set_count(&play.glc, play.slices);
+
 	/* open stream file */
 	if (file_init(&play.file, &play.glc))
 		return EXIT_FAILURE;
-	if (file_open_source(play.file, play.stream_file))
+	file_set_mmap(play.file, play.mmap);
+	if (!strncmp(play.stream_file, "tcp://", 6)) {
+		/* stream from glc-capture -o tcp://host:port */
+		if (file_listen_source(play.file, &play.stream_file[6]))
+			return EXIT_FAILURE;
+	} else if (file_open_source(play.file, play.stream_file))
 		return EXIT_FAILURE;
 
 	/* load information and check that the file is valid */
 	if (file_read_info(play.file, &play.stream_info, &play.info_name, &play.info_date))
 		return EXIT_FAILURE;
 
+	/* start from seek position as if stream started there */
+	if (play.seek) {
+		if (file_seek_time(play.file, play.seek, &play.seek)) {
+			glc_log(&play.glc, GLC_ERROR, "glc-play", "can't seek");
+			return EXIT_FAILURE;
+		}
+	} else if (file_index_span(play.file, &play.seek, &last))
+		play.seek = 0; /* no index, stream starts from 0 */
+
+	/* segments of a split stream start later, first index entry tells when */
+	if (play.seek)
+		glc_state_time_add_diff(&play.glc, -((glc_stime_t) play.seek));
+
 	/*
 	 If the fps hasn't been specified read it from the
 	 stream information.
@@ -271,15 +573,24 @@ int main(int argc, char *argv[])
 			return EXIT_FAILURE;
 		break;
 	case action_wav:
-		if (export_wav(&play))
+	case action_yuv4mpeg:
+		if (export_ranges(&play))
 			return EXIT_FAILURE;
 		break;
-	case action_yuv4mpeg:
-		if (export_yuv4mpeg(&play))
+	case action_encode:
+		if (export_encode(&play))
 			return EXIT_FAILURE;
 		break;
 	case action_img:
-		if (export_img(&play))
+		if (export_ranges(&play))
+			return EXIT_FAILURE;
+		break;
+	case action_multi:
+		if (export_multi(&play))
+			return EXIT_FAILURE;
+		break;
+	case action_recompress:
+		if (recompress_stream(&play))
 			return EXIT_FAILURE;
 		break;
 	case action_info:
@@ -306,22 +617,48 @@ int main(int argc, char *argv[])
 
 usage:
 	printf("%s [file] [option]...\n", argv[0]);
+	printf("  file 'tcp://[HOST]:PORT' waits for a stream from network\n");
 	printf("  -i, --info=LEVEL         show stream information, LEVEL must be\n"
 	       "                             greater than 0\n"
 	       "  -a, --wav=NUM            save audio stream NUM in wav format\n"
 	       "  -b, --bmp=NUM            save frames from stream NUM as bmp files\n"
 	       "                             (use -o pic-%%010d.bmp f.ex.)\n"
 	       "  -p, --png=NUM            save frames from stream NUM as png files\n"
+	       "  -Q, --qoi=NUM            save frames from stream NUM as qoi files\n"
+	       "  -M, --ppm=NUM            save frames from stream NUM as ppm files\n"
+	       "  -z, --png-level=N        png zlib level 0-9, default -1 is zlib default\n"
+	       "  -Z, --png-filter=FLT     png row filter, 'default', 'none', 'sub',\n"
+	       "                             'up' or 'paeth'\n"
 	       "  -y, --yuv4mpeg=NUM       save video stream NUM in yuv4mpeg format\n"
+	       "  -Y, --nv12=NUM           save video stream NUM as raw NV12 frames\n"
+	       "                             for hardware encoders\n"
+	       "  -e, --encode=NUM         encode video stream NUM with libavcodec,\n"
+	       "                             container is chosen by -o file extension\n"
+	       "  -A, --encode-audio=NUM   encode audio stream NUM, 0 disables audio,\n"
+	       "                             default is 1\n"
+	       "  -E, --encoder=CODEC      video encoder, default is 'libx264'\n"
+	       "  -P, --preset=NAME        video encoder preset, f.ex. 'veryfast'\n"
+	       "  -q, --quality=CRF        constant quality, default is 23\n"
+	       "  -B, --bitrate=KBITS      video bitrate in kbit/s instead of -q\n"
+	       "  -T, --encode-threads=N   encoder threads for -e and image export,\n"
+	       "                             default 0 picks automatically\n"
+	       "  -x, --export=SPEC        export to several files in a single pass,\n"
+	       "                             SPEC is TYPE:NUM:FILE where TYPE is yuv4mpeg,\n"
+	       "                             nv12, wav, bmp, png, qoi or ppm, can be\n"
+	       "                             given up to 8 times\n"
 	       "  -o, --out=FILE           write to FILE\n"
 	       "  -f, --fps=FPS            save images or video at FPS\n"
 	       "  -r, --resize=VAL         resize pictures with scale factor VAL or WxH\n"
+	       "  -I, --resize-filter=FLT  'bilinear', 'bicubic' or 'lanczos' resize\n"
+	       "                             default is 'bilinear'\n"
 	       "  -g, --color=ADJUST       adjust colors\n"
 	       "                             format is brightness;contrast;red;green;blue\n"
 	       "  -l, --silence=SECONDS    audio silence threshold in seconds\n"
 	       "                             default threshold is 0.2\n"
 	       "  -d, --alsa-device=DEV    alsa playback device name\n"
 	       "                             default is 'default'\n"
+	       "  -L, --alsa-mmap=MS       low-latency mmap playback with MS millisecond\n"
+	       "                             periods, audio follows video clock\n"
 	       "  -t, --streaming          streaming mode (eg. don't interpolate data)\n"
 	       "  -c, --compressed=SIZE    compressed stream buffer size in MiB\n"
 	       "                             default is 10 MiB\n"
@@ -331,6 +668,31 @@ usage:
 	       "                             all, signature, version, flags, fps,\n"
 	       "                             pid, name, date\n"
 	       "  -v, --verbosity=LEVEL    verbosity level\n"
+	       "  -C, --cpus=LIST          run processing threads on CPUs in LIST\n"
+	       "                             eg. '0-3,8'\n"
+	       "  -S, --sched=POLICY       thread scheduling policy, 'normal', 'batch'\n"
+	       "                             or 'idle'\n"
+	       "  -n, --nice=N             nice value for processing threads\n"
+	       "  -N, --numa-node=NODE     allocate buffers on NUMA node NODE\n"
+	       "  -F, --fused              run conversion, scaling and color correction\n"
+	       "                             in a single pass\n"
+	       "  -G, --gl-convert         play Y'CbCr and apply color correction with\n"
+	       "                             OpenGL shaders instead of CPU\n"
+	       "  -j, --slices=N           split each picture into N slices processed\n"
+	       "                             in parallel, default is 1\n"
+	       "  -k, --seek=SEC           start from SEC seconds using stream index,\n"
+	       "                             by default stream starts from first index entry\n"
+	       "  -m, --mmap               read stream file through memory mapping\n"
+	       "  -H, --headers            with -i read only headers of pictures and\n"
+	       "                             audio and skip rest of the data\n"
+	       "  -R, --recompress=CODEC   write stream to -o with different compression,\n"
+	       "                             CODEC is quicklz, lzo, lzjb, lz4 or zstd,\n"
+	       "                             optionally followed by :LEVEL\n"
+	       "  -J, --ranges=N           split image, yuv4mpeg or wav export into N\n"
+	       "                             time ranges exported in parallel using\n"
+	       "                             stream index, default is 1\n"
+	       "  -W, --mirror             pass large messages between threads through\n"
+	       "                             mirrored rings next to stream buffers\n"
 	       "  -h, --help               show help\n");
 
 	return EXIT_FAILURE;
@@ -365,6 +727,61 @@ int show_info_value(struct play_s *play, const char *value)
 	return 0;
 }
 
+int add_export(struct play_s *play, char *spec)
+{
+	struct play_export_s *export;
+	char *num, *filename;
+
+	if (play->exports >= PLAY_EXPORTS)
+		return ENOSPC;
+	export = &play->export[play->exports];
+	memset(export, 0, sizeof(struct play_export_s));
+
+	/* TYPE:NUM:FILE, FILE may contain ':' */
+	if ((num = strchr(spec, ':')) == NULL)
+		return EINVAL;
+	*num++ = '\0';
+	if ((filename = strchr(num, ':')) == NULL)
+		return EINVAL;
+	*filename++ = '\0';
+
+	if (!strcmp(spec, "yuv4mpeg"))
+		export->sink = sink_yuv4mpeg;
+	else if (!strcmp(spec, "nv12")) {
+		export->sink = sink_yuv4mpeg;
+		export->nv12 = 1;
+	} else if (!strcmp(spec, "wav"))
+		export->sink = sink_wav;
+	else if (!strcmp(spec, "bmp")) {
+		export->sink = sink_img;
+		export->img_format = IMG_BMP;
+	} else if (!strcmp(spec, "png")) {
+		export->sink = sink_img;
+		export->img_format = IMG_PNG;
+	} else if (!strcmp(spec, "qoi")) {
+		export->sink = sink_img;
+		export->img_format = IMG_QOI;
+	} else if (!strcmp(spec, "ppm")) {
+		export->sink = sink_img;
+		export->img_format = IMG_PPM;
+	} else
+		return EINVAL;
+
+	if (atoi(num) < 1)
+		return EINVAL;
+	export->id = atoi(num);
+
+	if (!strcmp(filename, "-"))
+		export->filename = "/dev/stdout";
+	else if (*filename != '\0')
+		export->filename = filename;
+	else
+		return EINVAL;
+
+	play->exports++;
+	return 0;
+}
+
 int play_stream(struct play_s *play)
 {
 	/*
@@ -380,12 +797,21 @@ int play_stream(struct play_s *play)
 	 Each filter, except demux and file, has glc_threads_hint(glc) worker
 	 threads. Packet order in stream is preserved. Demux creates
 	 separate buffer and _play handler for each video/audio stream.
+
+	 When fused, chain runs rgb, scale and color on bands of rows
+	 and writes straight to 'color' buffer.
+
+	 With --gl-convert rgb and color are left out and gl_play
+	 converts Y'CbCr and applies color correction in a shader.
+	 Only scale writes to 'color' buffer then.
 	*/
 
 	ps_bufferattr_t attr;
 	ps_buffer_t uncompressed_buffer, compressed_buffer,
 		    rgb_buffer, color_buffer, scale_buffer;
 	demux_t demux;
+	chain_t chain;
+	chain_filter_t filter;
 	color_t color;
 	scale_t scale;
 	unpack_t unpack;
@@ -401,20 +827,22 @@ int play_stream(struct play_s *play)
 	*/
 	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&compressed_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &compressed_buffer, &attr, play->compressed_size)))
 		goto err;
 
 	/* rest use 'uncompressed_buffer' size */
 	if ((ret = ps_bufferattr_setsize(&attr, play->uncompressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&uncompressed_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &uncompressed_buffer, &attr, play->uncompressed_size)))
 		goto err;
 	if ((ret = ps_buffer_init(&color_buffer, &attr)))
 		goto err;
-	if ((ret = ps_buffer_init(&rgb_buffer, &attr)))
-		goto err;
-	if ((ret = ps_buffer_init(&scale_buffer, &attr)))
-		goto err;
+	if ((!play->fused) && (!play->gl_convert)) {
+		if ((ret = ps_buffer_init(&rgb_buffer, &attr)))
+			goto err;
+		if ((ret = ps_buffer_init(&scale_buffer, &attr)))
+			goto err;
+	}
 
 	/* no longer necessary */
 	if ((ret = ps_bufferattr_destroy(&attr)))
@@ -431,26 +859,58 @@ int play_stream(struct play_s *play)
 		scale_set_size(scale, play->scale_width, play->scale_height);
 	else
 		scale_set_scale(scale, play->scale_factor);
+	scale_set_interpolation(scale, play->scale_interpolation);
 	if ((ret = color_init(&color, &play->glc)))
 		goto err;
 	if (play->override_color_correction)
 		color_override(color, play->brightness, play->contrast,
 			       play->red_gamma, play->green_gamma, play->blue_gamma);
+	if (play->fused) {
+		if ((ret = chain_init(&chain, &play->glc)))
+			goto err;
+		if (!play->gl_convert) {
+			rgb_filter(rgb, &filter);
+			if ((ret = chain_add_filter(chain, &filter)))
+				goto err;
+		}
+		scale_filter(scale, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+		if (!play->gl_convert) {
+			color_filter(color, &filter);
+			if ((ret = chain_add_filter(chain, &filter)))
+				goto err;
+		}
+	}
 	if ((ret = demux_init(&demux, &play->glc)))
 		goto err;
-	demux_set_video_buffer_size(demux, play->uncompressed_size);
-	demux_set_audio_buffer_size(demux, play->uncompressed_size / 10);
+	/* stream buffers carry references to shared pictures */
+	demux_set_shared_size(demux, play->uncompressed_size);
+	demux_set_video_buffer_size(demux, play->uncompressed_size / 10);
+	demux_set_audio_buffer_size(demux, play->uncompressed_size / 40);
 	demux_set_alsa_playback_device(demux, play->alsa_playback_device);
+	demux_set_alsa_mmap(demux, play->alsa_period);
+	if ((play->gl_convert) && (play->override_color_correction))
+		demux_set_color_override(demux, play->brightness, play->contrast,
+					 play->red_gamma, play->green_gamma, play->blue_gamma);
 
 	/* construct a pipeline for playback */
 	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
 		goto err;
-	if ((ret = rgb_process_start(rgb, &uncompressed_buffer, &rgb_buffer)))
-		goto err;
-	if ((ret = scale_process_start(scale, &rgb_buffer, &scale_buffer)))
-		goto err;
-	if ((ret = color_process_start(color, &scale_buffer, &color_buffer)))
-		goto err;
+	if (play->fused) {
+		if ((ret = chain_process_start(chain, &uncompressed_buffer, &color_buffer)))
+			goto err;
+	} else if (play->gl_convert) {
+		if ((ret = scale_process_start(scale, &uncompressed_buffer, &color_buffer)))
+			goto err;
+	} else {
+		if ((ret = rgb_process_start(rgb, &uncompressed_buffer, &rgb_buffer)))
+			goto err;
+		if ((ret = scale_process_start(scale, &rgb_buffer, &scale_buffer)))
+			goto err;
+		if ((ret = color_process_start(color, &scale_buffer, &color_buffer)))
+			goto err;
+	}
 	if ((ret = demux_process_start(demux, &color_buffer)))
 		goto err;
 
@@ -461,12 +921,20 @@ int play_stream(struct play_s *play)
 	/* we've done our part - just wait for the threads */
 	if ((ret = demux_process_wait(demux)))
 		goto err; /* wait for demux, since when it quits, others should also */
-	if ((ret = color_process_wait(color)))
-		goto err;
-	if ((ret = scale_process_wait(scale)))
-		goto err;
-	if ((ret = rgb_process_wait(rgb)))
-		goto err;
+	if (play->fused) {
+		if ((ret = chain_process_wait(chain)))
+			goto err;
+	} else if (play->gl_convert) {
+		if ((ret = scale_process_wait(scale)))
+			goto err;
+	} else {
+		if ((ret = color_process_wait(color)))
+			goto err;
+		if ((ret = scale_process_wait(scale)))
+			goto err;
+		if ((ret = rgb_process_wait(rgb)))
+			goto err;
+	}
 	if ((ret = unpack_process_wait(unpack)))
 		goto err;
 
@@ -476,12 +944,16 @@ int play_stream(struct play_s *play)
 	scale_destroy(scale);
 	color_destroy(color);
 	demux_destroy(demux);
+	if (play->fused)
+		chain_destroy(chain);
 
-	ps_buffer_destroy(&compressed_buffer);
-	ps_buffer_destroy(&uncompressed_buffer);
+	play_buffer_destroy(&compressed_buffer);
+	play_buffer_destroy(&uncompressed_buffer);
 	ps_buffer_destroy(&color_buffer);
-	ps_buffer_destroy(&scale_buffer);
-	ps_buffer_destroy(&rgb_buffer);
+	if ((!play->fused) && (!play->gl_convert)) {
+		ps_buffer_destroy(&scale_buffer);
+		ps_buffer_destroy(&rgb_buffer);
+	}
 
 	return 0;
 err:
@@ -502,6 +974,9 @@ int stream_info(struct play_s *play)
 	 file -(uncompressed_buffer)->     reads data from stream file
 	 unpack -(uncompressed_buffer)->   decompresses lzo/quicklz packets
 	 info -(rgb)->              shows stream information
+
+	 When scanning, file reads only first page of each picture and
+	 audio packet and unpack decodes just the headers from it.
 	*/
 
 	ps_bufferattr_t attr;
@@ -516,12 +991,12 @@ int stream_info(struct play_s *play)
 	/* initialize buffers */
 	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&compressed_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &compressed_buffer, &attr, play->compressed_size)))
 		goto err;
 
 	if ((ret = ps_bufferattr_setsize(&attr, play->uncompressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&uncompressed_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &uncompressed_buffer, &attr, play->uncompressed_size)))
 		goto err;
 
 	if ((ret = ps_bufferattr_destroy(&attr)))
@@ -534,6 +1009,11 @@ int stream_info(struct play_s *play)
 		goto err;
 	info_set_level(info, play->info_level);
 
+	if ((play->scan) &&
+	    (((ret = file_set_scan(play->file, PLAY_SCAN_SIZE))) ||
+	     ((ret = unpack_set_scan(unpack, 1)))))
+		goto err;
+
 	/* run it */
 	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
 		goto err;
@@ -551,8 +1031,8 @@ int stream_info(struct play_s *play)
 	unpack_destroy(unpack);
 	info_destroy(info);
 
-	ps_buffer_destroy(&compressed_buffer);
-	ps_buffer_destroy(&uncompressed_buffer);
+	play_buffer_destroy(&compressed_buffer);
+	play_buffer_destroy(&uncompressed_buffer);
 
 	return 0;
 err:
@@ -560,7 +1040,7 @@ err:
 	return ret;
 }
 
-int export_img(struct play_s *play)
+int export_img(struct play_s *play, struct play_range_s *range)
 {
 	/*
 	 Export img uses following pipeline:
@@ -571,12 +1051,16 @@ int export_img(struct play_s *play)
 	 scale -(scale)->           does rescaling
 	 color -(color)->           applies color correction
 	 img                        writes separate image files for each frame
+
+	 When fused, chain does rgb, scale and color.
 	*/
 
 	ps_bufferattr_t attr;
 	ps_buffer_t uncompressed_buffer, compressed_buffer,
 		    rgb_buffer, color_buffer, scale_buffer;
 	img_t img;
+	chain_t chain;
+	chain_filter_t filter;
 	color_t color;
 	scale_t scale;
 	unpack_t unpack;
@@ -589,19 +1073,21 @@ int export_img(struct play_s *play)
 	/* buffers */
 	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&compressed_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &compressed_buffer, &attr, play->compressed_size)))
 		goto err;
 
 	if ((ret = ps_bufferattr_setsize(&attr, play->uncompressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&uncompressed_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &uncompressed_buffer, &attr, play->uncompressed_size)))
 		goto err;
 	if ((ret = ps_buffer_init(&color_buffer, &attr)))
 		goto err;
-	if ((ret = ps_buffer_init(&rgb_buffer, &attr)))
-		goto err;
-	if ((ret = ps_buffer_init(&scale_buffer, &attr)))
-		goto err;
+	if (!play->fused) {
+		if ((ret = ps_buffer_init(&rgb_buffer, &attr)))
+			goto err;
+		if ((ret = ps_buffer_init(&scale_buffer, &attr)))
+			goto err;
+	}
 
 	if ((ret = ps_bufferattr_destroy(&attr)))
 		goto err;
@@ -609,6 +1095,7 @@ int export_img(struct play_s *play)
 	/* filters */
 	if ((ret = unpack_init(&unpack, &play->glc)))
 		goto err;
+	unpack_set_filter(unpack, GLC_MESSAGE_VIDEO_FRAME, play->export_video_id);
 	if ((ret = rgb_init(&rgb, &play->glc)))
 		goto err;
 	if ((ret = scale_init(&scale, &play->glc)))
@@ -617,43 +1104,71 @@ int export_img(struct play_s *play)
 		scale_set_size(scale, play->scale_width, play->scale_height);
 	else
 		scale_set_scale(scale, play->scale_factor);
+	scale_set_interpolation(scale, play->scale_interpolation);
 	if ((ret = color_init(&color, &play->glc)))
 		goto err;
 	if (play->override_color_correction)
 		color_override(color, play->brightness, play->contrast,
 			       play->red_gamma, play->green_gamma, play->blue_gamma);
+	if (play->fused) {
+		if ((ret = chain_init(&chain, &play->glc)))
+			goto err;
+		rgb_filter(rgb, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+		scale_filter(scale, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+		color_filter(color, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+	}
 	if ((ret = img_init(&img, &play->glc)))
 		goto err;
-	img_set_filename(img, play->export_filename_format);
+	img_set_filename(img, range->filename);
 	img_set_stream_id(img, play->export_video_id);
+	img_set_start_time(img, play->seek);
+	img_set_range(img, range->begin, range->end);
 	img_set_format(img, play->img_format);
 	img_set_fps(img, play->fps);
+	img_set_png_compression(img, play->png_level, play->png_filter);
+	img_set_threads(img, play->encode_threads);
 
 	/* pipeline... */
 	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
 		goto err;
-	if ((ret = rgb_process_start(rgb, &uncompressed_buffer, &rgb_buffer)))
-		goto err;
-	if ((ret = scale_process_start(scale, &rgb_buffer, &scale_buffer)))
-		goto err;
-	if ((ret = color_process_start(color, &scale_buffer, &color_buffer)))
-		goto err;
+	if (play->fused) {
+		if ((ret = chain_process_start(chain, &uncompressed_buffer, &color_buffer)))
+			goto err;
+	} else {
+		if ((ret = rgb_process_start(rgb, &uncompressed_buffer, &rgb_buffer)))
+			goto err;
+		if ((ret = scale_process_start(scale, &rgb_buffer, &scale_buffer)))
+			goto err;
+		if ((ret = color_process_start(color, &scale_buffer, &color_buffer)))
+			goto err;
+	}
 	if ((ret = img_process_start(img, &color_buffer)))
 		goto err;
 
 	/* ok, read the file */
-	if ((ret = file_read(play->file, &compressed_buffer)))
+	if ((ret = file_read(range->file, &compressed_buffer)))
 		goto err;
 
 	/* wait 'till its done and clean up the mess... */
 	if ((ret = img_process_wait(img)))
 		goto err;
-	if ((ret = color_process_wait(color)))
-		goto err;
-	if ((ret = scale_process_wait(scale)))
-		goto err;
-	if ((ret = rgb_process_wait(rgb)))
-		goto err;
+	if (play->fused) {
+		if ((ret = chain_process_wait(chain)))
+			goto err;
+	} else {
+		if ((ret = color_process_wait(color)))
+			goto err;
+		if ((ret = scale_process_wait(scale)))
+			goto err;
+		if ((ret = rgb_process_wait(rgb)))
+			goto err;
+	}
 	if ((ret = unpack_process_wait(unpack)))
 		goto err;
 
@@ -662,12 +1177,16 @@ int export_img(struct play_s *play)
 	scale_destroy(scale);
 	color_destroy(color);
 	img_destroy(img);
+	if (play->fused)
+		chain_destroy(chain);
 
-	ps_buffer_destroy(&compressed_buffer);
-	ps_buffer_destroy(&uncompressed_buffer);
+	play_buffer_destroy(&compressed_buffer);
+	play_buffer_destroy(&uncompressed_buffer);
 	ps_buffer_destroy(&color_buffer);
-	ps_buffer_destroy(&scale_buffer);
-	ps_buffer_destroy(&rgb_buffer);
+	if (!play->fused) {
+		ps_buffer_destroy(&scale_buffer);
+		ps_buffer_destroy(&rgb_buffer);
+	}
 
 	return 0;
 err:
@@ -675,7 +1194,7 @@ err:
 	return ret;
 }
 
-int export_yuv4mpeg(struct play_s *play)
+int export_yuv4mpeg(struct play_s *play, struct play_range_s *range)
 {
 	/*
 	 Export yuv4mpeg uses following pipeline:
@@ -684,14 +1203,19 @@ int export_yuv4mpeg(struct play_s *play)
 	 unpack -(uncompressed_buffer)->   decompresses lzo/quicklz packets
 	 scale -(scale)->           does rescaling
 	 color -(color)->           applies color correction
-	 ycbcr -(ycbcr)->           does conversion to Y'CbCr (if necessary)
+	 ycbcr -(ycbcr)->           does conversion to Y'CbCr or NV12 (if necessary)
 	 yuv4mpeg                   writes yuv4mpeg stream
+
+	 When fused, chain does scale, color and ycbcr and writes
+	 to 'ycbcr' buffer.
 	*/
 
 	ps_bufferattr_t attr;
 	ps_buffer_t uncompressed_buffer, compressed_buffer,
 		    ycbcr_buffer, color_buffer, scale_buffer;
 	yuv4mpeg_t yuv4mpeg;
+	chain_t chain;
+	chain_filter_t filter;
 	ycbcr_t ycbcr;
 	scale_t scale;
 	unpack_t unpack;
@@ -704,19 +1228,21 @@ int export_yuv4mpeg(struct play_s *play)
 	/* buffers */
 	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&compressed_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &compressed_buffer, &attr, play->compressed_size)))
 		goto err;
 
 	if ((ret = ps_bufferattr_setsize(&attr, play->uncompressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&uncompressed_buffer, &attr)))
-		goto err;
-	if ((ret = ps_buffer_init(&color_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &uncompressed_buffer, &attr, play->uncompressed_size)))
 		goto err;
 	if ((ret = ps_buffer_init(&ycbcr_buffer, &attr)))
 		goto err;
-	if ((ret = ps_buffer_init(&scale_buffer, &attr)))
-		goto err;
+	if (!play->fused) {
+		if ((ret = ps_buffer_init(&color_buffer, &attr)))
+			goto err;
+		if ((ret = ps_buffer_init(&scale_buffer, &attr)))
+			goto err;
+	}
 
 	if ((ret = ps_bufferattr_destroy(&attr)))
 		goto err;
@@ -724,51 +1250,239 @@ int export_yuv4mpeg(struct play_s *play)
 	/* initialize filters */
 	if ((ret = unpack_init(&unpack, &play->glc)))
 		goto err;
+	unpack_set_filter(unpack, GLC_MESSAGE_VIDEO_FRAME, play->export_video_id);
 	if ((ret = ycbcr_init(&ycbcr, &play->glc)))
 		goto err;
+	if (play->nv12)
+		ycbcr_set_format(ycbcr, GLC_VIDEO_NV12);
 	if ((ret = scale_init(&scale, &play->glc)))
 		goto err;
 	if (play->scale_width && play->scale_height)
 		scale_set_size(scale, play->scale_width, play->scale_height);
 	else
 		scale_set_scale(scale, play->scale_factor);
+	scale_set_interpolation(scale, play->scale_interpolation);
 	if ((ret = color_init(&color, &play->glc)))
 		goto err;
 	if (play->override_color_correction)
 		color_override(color, play->brightness, play->contrast,
 			       play->red_gamma, play->green_gamma, play->blue_gamma);
+	if (play->fused) {
+		if ((ret = chain_init(&chain, &play->glc)))
+			goto err;
+		scale_filter(scale, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+		color_filter(color, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+		ycbcr_filter(ycbcr, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+	}
 	if ((ret = yuv4mpeg_init(&yuv4mpeg, &play->glc)))
 		goto err;
 	yuv4mpeg_set_fps(yuv4mpeg, play->fps);
 	yuv4mpeg_set_stream_id(yuv4mpeg, play->export_video_id);
+	yuv4mpeg_set_start_time(yuv4mpeg, play->seek);
+	yuv4mpeg_set_range(yuv4mpeg, range->begin, range->end);
 	yuv4mpeg_set_interpolation(yuv4mpeg, play->interpolate);
-	yuv4mpeg_set_filename(yuv4mpeg, play->export_filename_format);
+	yuv4mpeg_set_filename(yuv4mpeg, range->filename);
 
 	/* construct the pipeline */
 	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
 		goto err;
-	if ((ret = scale_process_start(scale, &uncompressed_buffer, &scale_buffer)))
-		goto err;
-	if ((ret = color_process_start(color, &scale_buffer, &color_buffer)))
-		goto err;
-	if ((ret = ycbcr_process_start(ycbcr, &color_buffer, &ycbcr_buffer)))
-		goto err;
+	if (play->fused) {
+		if ((ret = chain_process_start(chain, &uncompressed_buffer, &ycbcr_buffer)))
+			goto err;
+	} else {
+		if ((ret = scale_process_start(scale, &uncompressed_buffer, &scale_buffer)))
+			goto err;
+		if ((ret = color_process_start(color, &scale_buffer, &color_buffer)))
+			goto err;
+		if ((ret = ycbcr_process_start(ycbcr, &color_buffer, &ycbcr_buffer)))
+			goto err;
+	}
 	if ((ret = yuv4mpeg_process_start(yuv4mpeg, &ycbcr_buffer)))
 		goto err;
 
 	/* feed it with data */
-	if ((ret = file_read(play->file, &compressed_buffer)))
+	if ((ret = file_read(range->file, &compressed_buffer)))
 		goto err;
 
 	/* threads will do the dirty work... */
 	if ((ret = yuv4mpeg_process_wait(yuv4mpeg)))
 		goto err;
-	if ((ret = color_process_wait(color)))
+	if (play->fused) {
+		if ((ret = chain_process_wait(chain)))
+			goto err;
+	} else {
+		if ((ret = color_process_wait(color)))
+			goto err;
+		if ((ret = scale_process_wait(scale)))
+			goto err;
+		if ((ret = ycbcr_process_wait(ycbcr)))
+			goto err;
+	}
+	if ((ret = unpack_process_wait(unpack)))
 		goto err;
-	if ((ret = scale_process_wait(scale)))
+
+	unpack_destroy(unpack);
+	ycbcr_destroy(ycbcr);
+	scale_destroy(scale);
+	color_destroy(color);
+	yuv4mpeg_destroy(yuv4mpeg);
+	if (play->fused)
+		chain_destroy(chain);
+
+	play_buffer_destroy(&compressed_buffer);
+	play_buffer_destroy(&uncompressed_buffer);
+	ps_buffer_destroy(&ycbcr_buffer);
+	if (!play->fused) {
+		ps_buffer_destroy(&color_buffer);
+		ps_buffer_destroy(&scale_buffer);
+	}
+
+	return 0;
+err:
+	fprintf(stderr, "exporting yuv4mpeg failed: %s (%d)\n", strerror(ret), ret);
+	return ret;
+}
+
+int export_encode(struct play_s *play)
+{
+	/*
+	 Export encode uses following pipeline:
+
+	 file -(uncompressed_buffer)->     reads data from stream file
+	 unpack -(uncompressed_buffer)->   decompresses lzo/quicklz packets
+	 scale -(scale)->           does rescaling
+	 color -(color)->           applies color correction
+	 ycbcr -(ycbcr)->           does conversion to Y'CbCr (if necessary)
+	 encode                     encodes video and audio into a file
+
+	 When fused, chain does scale, color and ycbcr and writes
+	 to 'ycbcr' buffer.
+	*/
+
+	ps_bufferattr_t attr;
+	ps_buffer_t uncompressed_buffer, compressed_buffer,
+		    ycbcr_buffer, color_buffer, scale_buffer;
+	encode_t encode;
+	chain_t chain;
+	chain_filter_t filter;
+	ycbcr_t ycbcr;
+	scale_t scale;
+	unpack_t unpack;
+	color_t color;
+	int ret = 0;
+
+	if ((ret = ps_bufferattr_init(&attr)))
+		goto err;
+
+	/* buffers */
+	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
 		goto err;
-	if ((ret = ycbcr_process_wait(ycbcr)))
+	if ((ret = play_buffer_init(play, &compressed_buffer, &attr, play->compressed_size)))
 		goto err;
+
+	if ((ret = ps_bufferattr_setsize(&attr, play->uncompressed_size)))
+		goto err;
+	if ((ret = play_buffer_init(play, &uncompressed_buffer, &attr, play->uncompressed_size)))
+		goto err;
+	if ((ret = ps_buffer_init(&ycbcr_buffer, &attr)))
+		goto err;
+	if (!play->fused) {
+		if ((ret = ps_buffer_init(&color_buffer, &attr)))
+			goto err;
+		if ((ret = ps_buffer_init(&scale_buffer, &attr)))
+			goto err;
+	}
+
+	if ((ret = ps_bufferattr_destroy(&attr)))
+		goto err;
+
+	/* initialize filters */
+	if ((ret = unpack_init(&unpack, &play->glc)))
+		goto err;
+	unpack_set_filter(unpack, GLC_MESSAGE_VIDEO_FRAME, play->export_video_id);
+	if (play->export_audio_id)
+		unpack_set_filter(unpack, GLC_MESSAGE_AUDIO_DATA, play->export_audio_id);
+	if ((ret = ycbcr_init(&ycbcr, &play->glc)))
+		goto err;
+	if ((ret = scale_init(&scale, &play->glc)))
+		goto err;
+	if (play->scale_width && play->scale_height)
+		scale_set_size(scale, play->scale_width, play->scale_height);
+	else
+		scale_set_scale(scale, play->scale_factor);
+	scale_set_interpolation(scale, play->scale_interpolation);
+	if ((ret = color_init(&color, &play->glc)))
+		goto err;
+	if (play->override_color_correction)
+		color_override(color, play->brightness, play->contrast,
+			       play->red_gamma, play->green_gamma, play->blue_gamma);
+	if (play->fused) {
+		if ((ret = chain_init(&chain, &play->glc)))
+			goto err;
+		scale_filter(scale, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+		color_filter(color, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+		ycbcr_filter(ycbcr, &filter);
+		if ((ret = chain_add_filter(chain, &filter)))
+			goto err;
+	}
+	if ((ret = encode_init(&encode, &play->glc)))
+		goto err;
+	encode_set_fps(encode, play->fps);
+	encode_set_video_id(encode, play->export_video_id);
+	encode_set_audio_id(encode, play->export_audio_id);
+	encode_set_start_time(encode, play->seek);
+	encode_set_filename(encode, play->export_filename_format);
+	encode_set_codec(encode, play->encode_codec, NULL);
+	encode_set_preset(encode, play->encode_preset);
+	encode_set_quality(encode, play->encode_quality);
+	encode_set_bitrate(encode, play->encode_bitrate);
+	encode_set_threads(encode, play->encode_threads);
+
+	/* construct the pipeline */
+	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
+		goto err;
+	if (play->fused) {
+		if ((ret = chain_process_start(chain, &uncompressed_buffer, &ycbcr_buffer)))
+			goto err;
+	} else {
+		if ((ret = scale_process_start(scale, &uncompressed_buffer, &scale_buffer)))
+			goto err;
+		if ((ret = color_process_start(color, &scale_buffer, &color_buffer)))
+			goto err;
+		if ((ret = ycbcr_process_start(ycbcr, &color_buffer, &ycbcr_buffer)))
+			goto err;
+	}
+	if ((ret = encode_process_start(encode, &ycbcr_buffer)))
+		goto err;
+
+	/* feed it with data */
+	if ((ret = file_read(play->file, &compressed_buffer)))
+		goto err;
+
+	/* threads will do the dirty work... */
+	if ((ret = encode_process_wait(encode)))
+		goto err;
+	if (play->fused) {
+		if ((ret = chain_process_wait(chain)))
+			goto err;
+	} else {
+		if ((ret = color_process_wait(color)))
+			goto err;
+		if ((ret = scale_process_wait(scale)))
+			goto err;
+		if ((ret = ycbcr_process_wait(ycbcr)))
+			goto err;
+	}
 	if ((ret = unpack_process_wait(unpack)))
 		goto err;
 
@@ -776,21 +1490,197 @@ int export_yuv4mpeg(struct play_s *play)
 	ycbcr_destroy(ycbcr);
 	scale_destroy(scale);
 	color_destroy(color);
-	yuv4mpeg_destroy(yuv4mpeg);
+	encode_destroy(encode);
+	if (play->fused)
+		chain_destroy(chain);
 
-	ps_buffer_destroy(&compressed_buffer);
-	ps_buffer_destroy(&uncompressed_buffer);
-	ps_buffer_destroy(&color_buffer);
-	ps_buffer_destroy(&scale_buffer);
+	play_buffer_destroy(&compressed_buffer);
+	play_buffer_destroy(&uncompressed_buffer);
 	ps_buffer_destroy(&ycbcr_buffer);
+	if (!play->fused) {
+		ps_buffer_destroy(&color_buffer);
+		ps_buffer_destroy(&scale_buffer);
+	}
 
 	return 0;
 err:
-	fprintf(stderr, "exporting yuv4mpeg failed: %s (%d)\n", strerror(ret), ret);
+	fprintf(stderr, "encoding failed: %s (%d)\n", strerror(ret), ret);
+	return ret;
+}
+
+int parse_compression(struct play_s *play, const char *spec)
+{
+	char name[16];
+	size_t len = strcspn(spec, ":");
+
+	if (len >= sizeof(name))
+		return EINVAL;
+	memcpy(name, spec, len);
+	name[len] = '\0';
+
+	if (!strcmp(name, "quicklz"))
+		play->recompress = PACK_QUICKLZ;
+	else if (!strcmp(name, "lzo"))
+		play->recompress = PACK_LZO;
+	else if (!strcmp(name, "lzjb"))
+		play->recompress = PACK_LZJB;
+	else if (!strcmp(name, "lz4"))
+		play->recompress = PACK_LZ4;
+	else if (!strcmp(name, "zstd"))
+		play->recompress = PACK_ZSTD;
+	else
+		return EINVAL;
+
+	if (spec[len] == ':')
+		play->recompress_level = atoi(&spec[len + 1]);
+	return 0;
+}
+
+int recompress_stream(struct play_s *play)
+{
+	/*
+	 Recompress uses following pipeline:
+
+	 file -(compressed_buffer)->       reads data from stream file
+	 unpack -(uncompressed_buffer)->   decompresses packets
+	 pack -(packed_buffer)->           compresses with new algorithm
+	 sink                              writes messages to new file
+
+	 pack stamps packets with their stream id and time, index
+	 of new file is built from those.
+	*/
+
+	ps_bufferattr_t attr;
+	ps_buffer_t compressed_buffer, uncompressed_buffer, packed_buffer;
+	glc_thread_t sink;
+	glc_stream_info_t info;
+	file_t out;
+	unpack_t unpack;
+	pack_t pack;
+	int ret = 0;
+
+	if ((ret = ps_bufferattr_init(&attr)))
+		goto err;
+
+	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
+		goto err;
+	if ((ret = play_buffer_init(play, &compressed_buffer, &attr, play->compressed_size)))
+		goto err;
+	if ((ret = ps_buffer_init(&packed_buffer, &attr)))
+		goto err;
+
+	if ((ret = ps_bufferattr_setsize(&attr, play->uncompressed_size)))
+		goto err;
+	if ((ret = play_buffer_init(play, &uncompressed_buffer, &attr, play->uncompressed_size)))
+		goto err;
+
+	if ((ret = ps_bufferattr_destroy(&attr)))
+		goto err;
+
+	/* stream info is kept, but messages are written in current format */
+	if ((ret = file_init(&out, &play->glc)))
+		goto err;
+	file_set_index(out, 1000000);
+	if ((ret = file_open_target(out, play->export_filename_format)))
+		goto err;
+	memcpy(&info, &play->stream_info, sizeof(glc_stream_info_t));
+	info.version = GLC_STREAM_VERSION;
+	if ((ret = file_write_info(out, &info, play->info_name, play->info_date)))
+		goto err;
+
+	if ((ret = unpack_init(&unpack, &play->glc)))
+		goto err;
+	if ((ret = pack_init(&pack, &play->glc)))
+		goto err;
+	if ((ret = pack_set_compression(pack, play->recompress)))
+		goto err;
+	if ((ret = pack_set_compression_level(pack, play->recompress_level)))
+		goto err;
+	pack_set_stamp(pack, 1);
+
+	memset(&sink, 0, sizeof(glc_thread_t));
+	sink.flags = GLC_THREAD_READ;
+	sink.ptr = out;
+	sink.read_callback = &recompress_sink_read_callback;
+	sink.threads = 1;
+	sink.name = "sink";
+
+	glc_log(&play->glc, GLC_INFORMATION, "glc-play", "recompressing to %s (compression %d, level %d)",
+		play->export_filename_format, play->recompress, play->recompress_level);
+
+	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
+		goto err;
+	if ((ret = pack_process_start(pack, &uncompressed_buffer, &packed_buffer)))
+		goto err;
+	if ((ret = glc_thread_create(&play->glc, &sink, &packed_buffer, NULL)))
+		goto err;
+	if ((ret = file_read(play->file, &compressed_buffer)))
+		goto err;
+
+	glc_thread_wait(&sink);
+	if ((ret = pack_process_wait(pack)))
+		goto err;
+	if ((ret = unpack_process_wait(unpack)))
+		goto err;
+
+	/* writes index */
+	if ((ret = file_close_target(out)))
+		goto err;
+
+	pack_destroy(pack);
+	unpack_destroy(unpack);
+	file_destroy(out);
+
+	play_buffer_destroy(&compressed_buffer);
+	play_buffer_destroy(&uncompressed_buffer);
+	ps_buffer_destroy(&packed_buffer);
+
+	return 0;
+err:
+	fprintf(stderr, "recompressing stream failed: %s (%d)\n", strerror(ret), ret);
 	return ret;
 }
 
-int export_wav(struct play_s *play)
+int recompress_sink_read_callback(glc_thread_state_t *state)
+{
+	file_t out = (file_t) state->ptr;
+
+	/* index is written only after eof */
+	if (state->header.type == GLC_MESSAGE_CLOSE)
+		return file_write_eof(out);
+
+	return file_write_packet(out, &state->header, state->read_data, state->read_size);
+}
+
+int play_buffer_init(struct play_s *play, ps_buffer_t *buffer, ps_bufferattr_t *attr,
+		     size_t size)
+{
+	glc_ring_t ring;
+	int ret;
+
+	if ((ret = ps_buffer_init(buffer, attr)))
+		return ret;
+	if (!play->mirror)
+		return 0;
+
+	/* writers put large messages into ring, buffer gets references */
+	if ((ret = glc_ring_init(&ring, &play->glc, size, 0)))
+		return ret;
+	if ((ret = glc_ring_attach(buffer, ring)))
+		glc_ring_destroy(ring);
+	return ret;
+}
+
+void play_buffer_destroy(ps_buffer_t *buffer)
+{
+	glc_ring_t ring = glc_ring_lookup(buffer);
+
+	ps_buffer_destroy(buffer);
+	if (ring)
+		glc_ring_destroy(ring);
+}
+
+int export_wav(struct play_s *play, struct play_range_s *range)
 {
 	/*
 	 Export wav uses following pipeline:
@@ -812,12 +1702,12 @@ int export_wav(struct play_s *play)
 	/* buffers */
 	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&compressed_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &compressed_buffer, &attr, play->compressed_size)))
 		goto err;
 
 	if ((ret = ps_bufferattr_setsize(&attr, play->uncompressed_size)))
 		goto err;
-	if ((ret = ps_buffer_init(&uncompressed_buffer, &attr)))
+	if ((ret = play_buffer_init(play, &uncompressed_buffer, &attr, play->uncompressed_size)))
 		goto err;
 
 	if ((ret = ps_bufferattr_destroy(&attr)))
@@ -826,11 +1716,14 @@ int export_wav(struct play_s *play)
 	/* init filters */
 	if ((ret = unpack_init(&unpack, &play->glc)))
 		goto err;
+	unpack_set_filter(unpack, GLC_MESSAGE_AUDIO_DATA, play->export_audio_id);
 	if ((ret = wav_init(&wav, &play->glc)))
 		goto err;
 	wav_set_interpolation(wav, play->interpolate);
-	wav_set_filename(wav, play->export_filename_format);
+	wav_set_filename(wav, range->filename);
 	wav_set_stream_id(wav, play->export_audio_id);
+	wav_set_start_time(wav, play->seek);
+	wav_set_range(wav, range->begin, range->end);
 	wav_set_silence_threshold(wav, play->silence_threshold);
 
 	/* start the threads */
@@ -838,7 +1731,7 @@ int export_wav(struct play_s *play)
 		goto err;
 	if ((ret = wav_process_start(wav, &uncompressed_buffer)))
 		goto err;
-	if ((ret = file_read(play->file, &compressed_buffer)))
+	if ((ret = file_read(range->file, &compressed_buffer)))
 		goto err;
 
 	/* wait and clean up */
@@ -850,8 +1743,8 @@ int export_wav(struct play_s *play)
 	unpack_destroy(unpack);
 	wav_destroy(wav);
 
-	ps_buffer_destroy(&compressed_buffer);
-	ps_buffer_destroy(&uncompressed_buffer);
+	play_buffer_destroy(&compressed_buffer);
+	play_buffer_destroy(&uncompressed_buffer);
 
 	return 0;
 err:
@@ -863,3 +1756,496 @@ err:
 		return ret;
 	}
 }
+
+int export_ranges(struct play_s *play)
+{
+	/*
+	 Stream from seek position to last index entry is split into
+	 equal time ranges. Each range is read from its own file
+	 object, seeked with index, so stream state at the beginning
+	 comes from the index snapshot, and exported in its own
+	 pipeline. Reading starts and ends PLAY_RANGE_MARGIN outside
+	 the range so that exporters see previous picture and time
+	 of previous audio packet as they would in a single pass.
+	 Exporters write only their own range, with frame numbers
+	 and times counted from seek position.
+
+	 Images have absolute numbers and go straight to final names.
+	 yuv4mpeg and wav ranges are written into FILE.partN files
+	 and joined in order once everything is done.
+	*/
+
+	struct play_range_s *range;
+	glc_utime_t first, last, length;
+	unsigned int r, started, ranges = play->ranges;
+	char filename[1024];
+	struct stat st;
+	int ret = 0;
+
+	if ((ranges > 1) && (file_index_span(play->file, &first, &last))) {
+		glc_log(&play->glc, GLC_WARNING, "glc-play",
+			"stream has no index, exporting in one range");
+		ranges = 1;
+	}
+
+	if ((ranges > 1) && (last <= play->seek))
+		ranges = 1;
+
+	/* pipes can't be joined afterwards */
+	if ((ranges > 1) && (play->action != action_img)) {
+		snprintf(filename, sizeof(filename) - 1, play->export_filename_format, 1);
+		if ((!stat(filename, &st)) && (!S_ISREG(st.st_mode))) {
+			glc_log(&play->glc, GLC_WARNING, "glc-play",
+				"%s is not a regular file, exporting in one range", filename);
+			ranges = 1;
+		}
+	}
+
+	if (!(range = (struct play_range_s *) calloc(ranges, sizeof(struct play_range_s))))
+		return ENOMEM;
+
+	if (ranges == 1) {
+		range[0].play = play;
+		range[0].file = play->file;
+		range[0].filename = (char *) play->export_filename_format;
+		ret = export_range(&range[0]);
+		free(range);
+		return ret;
+	}
+
+	length = last - play->seek;
+	for (r = 0; r < ranges; r++) {
+		range[r].play = play;
+		range[r].num = r;
+		range[r].begin = r ? play->seek + length * r / ranges : 0;
+		range[r].end = (r + 1 < ranges) ? play->seek + length * (r + 1) / ranges : 0;
+		if ((ret = export_range_open(play, &range[r])))
+			goto err;
+	}
+
+	for (started = 0; started < ranges; started++) {
+		if ((ret = pthread_create(&range[started].thread, NULL,
+					  export_range_thread, &range[started])))
+			break;
+	}
+
+	for (r = 0; r < started; r++) {
+		pthread_join(range[r].thread, NULL);
+		if ((!ret) && (range[r].ret))
+			ret = range[r].ret;
+	}
+
+	if ((!ret) && (play->action != action_img))
+		ret = export_ranges_join(play, range, ranges);
+
+err:
+	for (r = 0; r < ranges; r++) {
+		if ((range[r].file) && (range[r].file != play->file)) {
+			file_close_source(range[r].file);
+			file_destroy(range[r].file);
+		}
+		if (range[r].filename != play->export_filename_format)
+			free(range[r].filename);
+	}
+	free(range);
+
+	if (ret)
+		fprintf(stderr, "exporting ranges failed: %s (%d)\n", strerror(ret), ret);
+	return ret;
+}
+
+int export_range_open(struct play_s *play, struct play_range_s *range)
+{
+	glc_stream_info_t info;
+	char *info_name, *info_date;
+	int ret;
+
+	if (play->action == action_img)
+		range->filename = (char *) play->export_filename_format;
+	else {
+		range->filename = (char *) malloc(strlen(play->export_filename_format) + 16);
+		sprintf(range->filename, "%s.part%u", play->export_filename_format, range->num);
+	}
+
+	/* first range continues from seek position */
+	if (!range->num)
+		range->file = play->file;
+	else {
+		if ((ret = file_init(&range->file, &play->glc)))
+			return ret;
+		file_set_mmap(range->file, play->mmap);
+		if ((ret = file_open_source(range->file, play->stream_file)))
+			return ret;
+		if ((ret = file_read_info(range->file, &info, &info_name, &info_date)))
+			return ret;
+		free(info_name);
+		free(info_date);
+
+		if ((ret = file_seek_time(range->file, range->begin > PLAY_RANGE_MARGIN ?
+					  range->begin - PLAY_RANGE_MARGIN : 0, NULL)))
+			return ret;
+	}
+
+	if ((range->end) &&
+	    ((ret = file_set_read_end(range->file, range->end + PLAY_RANGE_MARGIN, NULL))))
+		return ret;
+
+	glc_log(&play->glc, GLC_INFORMATION, "glc-play", "range %u: %.3f - %.3f s",
+		range->num, (double) range->begin / 1000000.0, (double) range->end / 1000000.0);
+	return 0;
+}
+
+void *export_range_thread(void *argptr)
+{
+	struct play_range_s *range = (struct play_range_s *) argptr;
+	range->ret = export_range(range);
+	return NULL;
+}
+
+int export_range(struct play_range_s *range)
+{
+	if (range->play->action == action_img)
+		return export_img(range->play, range);
+	else if (range->play->action == action_yuv4mpeg)
+		return export_yuv4mpeg(range->play, range);
+	else if (range->play->action == action_wav)
+		return export_wav(range->play, range);
+	return EINVAL;
+}
+
+int export_ranges_join(struct play_s *play, struct play_range_s *range, unsigned int ranges)
+{
+	char part[1024], filename[1024];
+	unsigned int r, n, count = 0;
+	int joined, ret;
+	off_t header;
+	struct stat st;
+
+	/*
+	 Each range opens a new file when it gets stream format from
+	 seek state. First file with data in range continues last file
+	 of previous range, later ones were started by format changes.
+	*/
+	for (r = 0; r < ranges; r++) {
+		joined = (r == 0);
+		for (n = 1; ; n++) {
+			snprintf(part, sizeof(part) - 1, range[r].filename, n);
+			if (stat(part, &st))
+				break;
+			header = export_range_header(part);
+
+			if ((r) && (st.st_size <= header)) {
+				unlink(part);
+				continue;
+			}
+
+			if ((!joined) && (count)) {
+				snprintf(filename, sizeof(filename) - 1, play->export_filename_format, count);
+				if ((ret = export_range_append(filename, part, header)))
+					return ret;
+				unlink(part);
+				joined = 1;
+				continue;
+			}
+
+			snprintf(filename, sizeof(filename) - 1, play->export_filename_format, ++count);
+			if (rename(part, filename))
+				return errno;
+			joined = 1;
+		}
+	}
+
+	return 0;
+}
+
+off_t export_range_header(const char *filename)
+{
+	char buf[128], *end;
+	ssize_t got;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return 0;
+	got = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (got <= 0)
+		return 0;
+	buf[got] = '\0';
+
+	/* raw NV12 has no header */
+	if ((!strncmp(buf, "YUV4MPEG2 ", 10)) && ((end = strchr(buf, '\n')) != NULL))
+		return end - buf + 1;
+	/* RIFF, fmt and data chunk headers written by wav */
+	if ((got >= 44) && (!strncmp(buf, "RIFF", 4)))
+		return 44;
+	return 0;
+}
+
+int export_range_append(const char *to, const char *from, off_t skip)
+{
+	char *buf;
+	ssize_t got = 0;
+	int in, out, ret = 0;
+
+	if ((in = open(from, O_RDONLY)) < 0)
+		return errno;
+	if ((out = open(to, O_WRONLY | O_APPEND)) < 0) {
+		ret = errno;
+		close(in);
+		return ret;
+	}
+
+	buf = (char *) malloc(1024 * 1024);
+	if (lseek(in, skip, SEEK_SET) == -1)
+		ret = errno;
+	while ((!ret) && ((got = read(in, buf, 1024 * 1024)) > 0)) {
+		if (write(out, buf, got) != got)
+			ret = errno ? errno : EIO;
+	}
+	if ((!ret) && (got < 0))
+		ret = errno;
+
+	free(buf);
+	close(out);
+	close(in);
+	return ret;
+}
+
+int export_multi(struct play_s *play)
+{
+	/*
+	 Export multi uses following pipeline:
+
+	 file -(compressed_buffer)->       reads data from stream file
+	 unpack -(uncompressed_buffer)->   decompresses lzo/quicklz packets
+	 copy -(buffer)->                  routes each target's stream to
+	                                   its own buffer
+
+	 and for each video target:
+
+	 chain -(converted_buffer)->       rgb, scale and color for images,
+	                                   scale, color and ycbcr for yuv4mpeg
+	 img or yuv4mpeg                   writes target file
+
+	 Audio targets are written by wav straight from 'buffer'.
+	 The stream is read and decompressed only once.
+	*/
+
+	ps_bufferattr_t attr;
+	ps_buffer_t uncompressed_buffer, compressed_buffer;
+	struct play_export_s *export;
+	chain_filter_t filter;
+	unpack_t unpack;
+	copy_t copy;
+	unsigned int e;
+	int ret = 0;
+
+	if ((ret = ps_bufferattr_init(&attr)))
+		goto err;
+
+	/* buffers */
+	if ((ret = ps_bufferattr_setsize(&attr, play->compressed_size)))
+		goto err;
+	if ((ret = play_buffer_init(play, &compressed_buffer, &attr, play->compressed_size)))
+		goto err;
+
+	if ((ret = ps_bufferattr_setsize(&attr, play->uncompressed_size)))
+		goto err;
+	if ((ret = play_buffer_init(play, &uncompressed_buffer, &attr, play->uncompressed_size)))
+		goto err;
+	for (e = 0; e < play->exports; e++) {
+		export = &play->export[e];
+		if ((ret = ps_buffer_init(&export->buffer, &attr)))
+			goto err;
+		if (export->sink == sink_wav)
+			continue;
+		if ((ret = ps_buffer_init(&export->converted_buffer, &attr)))
+			goto err;
+	}
+
+	if ((ret = ps_bufferattr_destroy(&attr)))
+		goto err;
+
+	/* unpack only what some target needs, copy routes it */
+	if ((ret = unpack_init(&unpack, &play->glc)))
+		goto err;
+	if ((ret = copy_init(&copy, &play->glc)))
+		goto err;
+
+	for (e = 0; e < play->exports; e++) {
+		export = &play->export[e];
+
+		if (export->sink == sink_wav) {
+			if ((ret = unpack_set_filter(unpack, GLC_MESSAGE_AUDIO_DATA, export->id)))
+				goto err;
+			copy_add_stream(copy, &export->buffer, GLC_MESSAGE_AUDIO_FORMAT, export->id);
+			copy_add_stream(copy, &export->buffer, GLC_MESSAGE_AUDIO_DATA, export->id);
+			copy_add(copy, &export->buffer, GLC_MESSAGE_CLOSE);
+
+			if ((ret = wav_init(&export->wav, &play->glc)))
+				goto err;
+			wav_set_interpolation(export->wav, play->interpolate);
+			wav_set_filename(export->wav, export->filename);
+			wav_set_stream_id(export->wav, export->id);
+			wav_set_start_time(export->wav, play->seek);
+			wav_set_silence_threshold(export->wav, play->silence_threshold);
+			continue;
+		}
+
+		if ((ret = unpack_set_filter(unpack, GLC_MESSAGE_VIDEO_FRAME, export->id)))
+			goto err;
+		copy_add_stream(copy, &export->buffer, GLC_MESSAGE_VIDEO_FORMAT, export->id);
+		copy_add_stream(copy, &export->buffer, GLC_MESSAGE_VIDEO_FRAME, export->id);
+		copy_add_stream(copy, &export->buffer, GLC_MESSAGE_VIDEO_REPEAT, export->id);
+		copy_add_stream(copy, &export->buffer, GLC_MESSAGE_COLOR, export->id);
+		copy_add(copy, &export->buffer, GLC_MESSAGE_CLOSE);
+
+		if ((ret = scale_init(&export->scale, &play->glc)))
+			goto err;
+		if (play->scale_width && play->scale_height)
+			scale_set_size(export->scale, play->scale_width, play->scale_height);
+		else
+			scale_set_scale(export->scale, play->scale_factor);
+		scale_set_interpolation(export->scale, play->scale_interpolation);
+		if ((ret = color_init(&export->color, &play->glc)))
+			goto err;
+		if (play->override_color_correction)
+			color_override(export->color, play->brightness, play->contrast,
+				       play->red_gamma, play->green_gamma, play->blue_gamma);
+		if ((ret = chain_init(&export->chain, &play->glc)))
+			goto err;
+
+		if (export->sink == sink_img) {
+			if ((ret = rgb_init(&export->rgb, &play->glc)))
+				goto err;
+			rgb_filter(export->rgb, &filter);
+			if ((ret = chain_add_filter(export->chain, &filter)))
+				goto err;
+			scale_filter(export->scale, &filter);
+			if ((ret = chain_add_filter(export->chain, &filter)))
+				goto err;
+			color_filter(export->color, &filter);
+			if ((ret = chain_add_filter(export->chain, &filter)))
+				goto err;
+
+			if ((ret = img_init(&export->img, &play->glc)))
+				goto err;
+			img_set_filename(export->img, export->filename);
+			img_set_stream_id(export->img, export->id);
+			img_set_start_time(export->img, play->seek);
+			img_set_format(export->img, export->img_format);
+			img_set_fps(export->img, play->fps);
+			img_set_png_compression(export->img, play->png_level, play->png_filter);
+			img_set_threads(export->img, play->encode_threads);
+		} else {
+			if ((ret = ycbcr_init(&export->ycbcr, &play->glc)))
+				goto err;
+			if (export->nv12)
+				ycbcr_set_format(export->ycbcr, GLC_VIDEO_NV12);
+			scale_filter(export->scale, &filter);
+			if ((ret = chain_add_filter(export->chain, &filter)))
+				goto err;
+			color_filter(export->color, &filter);
+			if ((ret = chain_add_filter(export->chain, &filter)))
+				goto err;
+			ycbcr_filter(export->ycbcr, &filter);
+			if ((ret = chain_add_filter(export->chain, &filter)))
+				goto err;
+
+			if ((ret = yuv4mpeg_init(&export->yuv4mpeg, &play->glc)))
+				goto err;
+			yuv4mpeg_set_fps(export->yuv4mpeg, play->fps);
+			yuv4mpeg_set_stream_id(export->yuv4mpeg, export->id);
+			yuv4mpeg_set_start_time(export->yuv4mpeg, play->seek);
+			yuv4mpeg_set_interpolation(export->yuv4mpeg, play->interpolate);
+			yuv4mpeg_set_filename(export->yuv4mpeg, export->filename);
+		}
+	}
+
+	/* start sinks first so copy never waits on an idle target */
+	for (e = 0; e < play->exports; e++) {
+		export = &play->export[e];
+
+		if (export->sink == sink_wav) {
+			if ((ret = wav_process_start(export->wav, &export->buffer)))
+				goto err;
+			continue;
+		}
+
+		if ((ret = chain_process_start(export->chain, &export->buffer,
+					       &export->converted_buffer)))
+			goto err;
+		if (export->sink == sink_img)
+			ret = img_process_start(export->img, &export->converted_buffer);
+		else
+			ret = yuv4mpeg_process_start(export->yuv4mpeg, &export->converted_buffer);
+		if (ret)
+			goto err;
+	}
+	if ((ret = copy_process_start(copy, &uncompressed_buffer)))
+		goto err;
+	if ((ret = unpack_process_start(unpack, &compressed_buffer, &uncompressed_buffer)))
+		goto err;
+
+	/* single pass over the file */
+	if ((ret = file_read(play->file, &compressed_buffer)))
+		goto err;
+
+	/* wait and clean up */
+	for (e = 0; e < play->exports; e++) {
+		export = &play->export[e];
+
+		if (export->sink == sink_wav) {
+			if ((ret = wav_process_wait(export->wav)))
+				goto err;
+			continue;
+		}
+
+		if (export->sink == sink_img)
+			ret = img_process_wait(export->img);
+		else
+			ret = yuv4mpeg_process_wait(export->yuv4mpeg);
+		if (ret)
+			goto err;
+		if ((ret = chain_process_wait(export->chain)))
+			goto err;
+	}
+	if ((ret = copy_process_wait(copy)))
+		goto err;
+	if ((ret = unpack_process_wait(unpack)))
+		goto err;
+
+	for (e = 0; e < play->exports; e++) {
+		export = &play->export[e];
+
+		if (export->sink == sink_wav) {
+			wav_destroy(export->wav);
+			ps_buffer_destroy(&export->buffer);
+			continue;
+		}
+
+		if (export->sink == sink_img) {
+			img_destroy(export->img);
+			rgb_destroy(export->rgb);
+		} else {
+			yuv4mpeg_destroy(export->yuv4mpeg);
+			ycbcr_destroy(export->ycbcr);
+		}
+		chain_destroy(export->chain);
+		scale_destroy(export->scale);
+		color_destroy(export->color);
+
+		ps_buffer_destroy(&export->buffer);
+		ps_buffer_destroy(&export->converted_buffer);
+	}
+	copy_destroy(copy);
+	unpack_destroy(unpack);
+
+	play_buffer_destroy(&compressed_buffer);
+	play_buffer_destroy(&uncompressed_buffer);
+
+	return 0;
+err:
+	fprintf(stderr, "exporting failed: %s (%d)\n", strerror(ret), ret);
+	return ret;
+}